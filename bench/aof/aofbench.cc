@@ -0,0 +1,95 @@
+#include "all.h"
+#include "util.h"
+#include "../benchclient.h"
+
+/* SET throughput with the append only file off and with each fsync policy.
+ * 'clients' connections each keep a pipeline of 'depth' requests of 'size'
+ * byte values in flight for 'seconds'. The server has to run with a data
+ * directory on the disk to measure, the policy is switched with CONFIG SET.
+ *
+ * usage: aofbench [ip] [port] [clients] [depth] [size] [seconds] */
+
+/* Sends one command, false if it failed. */
+bool config(int32_t fd, Reader &reader, const std::vector <std::string> &argv) {
+    std::string out;
+    appendCommand(out, argv);
+    std::string reply;
+    return writeAll(fd, out.data(), out.size()) && reader.readReply(&reply) && reply[0] != '-';
+}
+
+void client(const char *ip, uint16_t port, int32_t id, int32_t depth, size_t size,
+            int64_t deadline, std::atomic <int64_t> *total) {
+    int32_t fd = connectServer(ip, port);
+    if (fd < 0) {
+        return;
+    }
+
+    std::string pipeline;
+    std::string value(size, 'v');
+    for (int32_t i = 0; i < depth; i++) {
+        appendCommand(pipeline, {"SET", "aof:" + std::to_string(id) + ":" + std::to_string(i), value});
+    }
+
+    std::vector<char> buf;
+    int64_t requests = 0;
+    while (ustime() < deadline) {
+        if (!writeAll(fd, pipeline.data(), pipeline.size()) ||
+            !readExactly(fd, buf, 5 * depth)) {
+            break;
+        }
+        requests += depth;
+    }
+    *total += requests;
+    ::close(fd);
+}
+
+int main(int argc, char *argv[]) {
+    const char *ip = argc > 1 ? argv[1] : "127.0.0.1";
+    uint16_t port = argc > 2 ? atoi(argv[2]) : 6379;
+    int32_t clients = argc > 3 ? atoi(argv[3]) : 16;
+    int32_t depth = argc > 4 ? atoi(argv[4]) : 16;
+    size_t size = argc > 5 ? atoi(argv[5]) : 64;
+    int32_t seconds = argc > 6 ? atoi(argv[6]) : 5;
+
+    int32_t fd = connectServer(ip, port);
+    if (fd < 0) {
+        fprintf(stderr, "connect %s:%d failed\n", ip, port);
+        return 1;
+    }
+
+    Reader reader(fd);
+
+    const char *policies[] = {"off", "no", "everysec", "always"};
+    printf("%10s %12s\n", "appendfsync", "sets/s");
+    for (const char *policy : policies) {
+        bool ok = strcmp(policy, "off") == 0 ? config(fd, reader, {"config", "set", "appendonly", "no"}) :
+                  config(fd, reader, {"config", "set", "appendonly", "yes"}) &&
+                  config(fd, reader, {"config", "set", "appendfsync", policy});
+        if (!ok) {
+            fprintf(stderr, "config set %s failed\n", policy);
+            return 1;
+        }
+
+        /* Give the server a cron tick to create the file. */
+        std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+
+        std::atomic <int64_t> total(0);
+        int64_t start = ustime();
+        int64_t deadline = start + seconds * 1000000LL;
+        std::vector <std::thread> threads;
+        for (int32_t i = 0; i < clients; i++) {
+            threads.emplace_back(client, ip, port, i, depth, size, deadline, &total);
+        }
+
+        for (auto &it : threads) {
+            it.join();
+        }
+
+        double elapsed = (ustime() - start) / 1000000.0;
+        printf("%10s %12.0f\n", policy, total / elapsed);
+    }
+
+    config(fd, reader, {"config", "set", "appendonly", "no"});
+    ::close(fd);
+    return 0;
+}
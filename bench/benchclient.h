@@ -0,0 +1,173 @@
+#pragma once
+
+#include "all.h"
+
+/* The blocking client the benches that drive a running server share: they
+ * pipeline commands on plain sockets and read the replies back in order. */
+
+inline int32_t connectServer(const char *ip, uint16_t port) {
+    int32_t fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    ::inet_pton(AF_INET, ip, &addr.sin_addr);
+    if (::connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        ::close(fd);
+        return -1;
+    }
+
+    int32_t on = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return fd;
+}
+
+inline bool writeAll(int32_t fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = ::write(fd, data, len);
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+/* Reads 'len' bytes into 'buf', for replies whose size is known up front. */
+inline bool readExactly(int32_t fd, std::vector<char> &buf, size_t len) {
+    if (buf.size() < len) {
+        buf.resize(len);
+    }
+
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = ::read(fd, buf.data() + got, len - got);
+        if (n <= 0) {
+            return false;
+        }
+        got += n;
+    }
+    return true;
+}
+
+inline void appendCommand(std::string &out, const std::vector <std::string> &argv) {
+    out += "*" + std::to_string(argv.size()) + "\r\n";
+    for (auto &it : argv) {
+        out += "$" + std::to_string(it.size()) + "\r\n" + it + "\r\n";
+    }
+}
+
+/* Reads the replies of one connection. Bulk strings are skipped by their
+ * length, so values may hold anything. */
+class Reader {
+public:
+    explicit Reader(int32_t fd) : fd(fd), pos(0) {}
+
+    bool readLine(std::string *line) {
+        for (;;) {
+            size_t end = buf.find("\r\n", pos);
+            if (end != std::string::npos) {
+                line->assign(buf, pos, end - pos);
+                pos = end + 2;
+                return true;
+            }
+
+            if (!fill()) {
+                return false;
+            }
+        }
+    }
+
+    /* Read one reply of any type, 'first' gets its first line, "$-1" for a
+     * nil bulk string. */
+    bool readReply(std::string *first = nullptr) {
+        std::string line;
+        if (!readLine(&line) || line.empty()) {
+            return false;
+        }
+
+        if (line[0] == '$') {
+            int64_t len = atoll(line.c_str() + 1);
+            if (len >= 0 && !skip(len + 2)) {
+                return false;
+            }
+        } else if (line[0] == '*') {
+            for (int64_t i = atoll(line.c_str() + 1); i > 0; i--) {
+                if (!readReply()) {
+                    return false;
+                }
+            }
+        }
+
+        if (first != nullptr) {
+            first->swap(line);
+        }
+        return true;
+    }
+
+    /* Read the replies of a pipeline, 'first' gets the first line of the
+     * first error, or of the first reply if none failed. */
+    bool readReplies(int64_t count, std::string *first = nullptr) {
+        if (first != nullptr) {
+            first->clear();
+        }
+
+        std::string line;
+        for (int64_t i = 0; i < count; i++) {
+            if (!readReply(&line)) {
+                return false;
+            }
+
+            if (first != nullptr && (first->empty() || (line[0] == '-' && (*first)[0] != '-'))) {
+                first->swap(line);
+            }
+        }
+        return true;
+    }
+
+    /* Read a multi bulk reply, returns its element count, -1 on error. */
+    int64_t readArray() {
+        std::string line;
+        if (!readLine(&line) || line.empty() || line[0] != '*') {
+            return -1;
+        }
+
+        int64_t count = atoll(line.c_str() + 1);
+        for (int64_t i = 0; i < count; i++) {
+            if (!readReply()) {
+                return -1;
+            }
+        }
+        return count;
+    }
+
+private:
+    bool fill() {
+        buf.erase(0, pos);
+        pos = 0;
+        char tmp[65536];
+        ssize_t n = ::read(fd, tmp, sizeof(tmp));
+        if (n <= 0) {
+            return false;
+        }
+        buf.append(tmp, n);
+        return true;
+    }
+
+    bool skip(size_t len) {
+        while (buf.size() - pos < len) {
+            len -= buf.size() - pos;
+            pos = buf.size();
+            if (!fill()) {
+                return false;
+            }
+        }
+        pos += len;
+        return true;
+    }
+
+    int32_t fd;
+    std::string buf;
+    size_t pos;
+};
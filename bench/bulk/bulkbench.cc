@@ -0,0 +1,68 @@
+#include "all.h"
+#include "util.h"
+#include "../benchclient.h"
+
+/* GET throughput against the value size. Stores one value per size, then
+ * fetches it with a pipeline of 'depth' requests until 'bytes' of payload
+ * have been read.
+ *
+ * usage: bulkbench [ip] [port] [depth] [megabytes] */
+
+int main(int argc, char *argv[]) {
+    const char *ip = argc > 1 ? argv[1] : "127.0.0.1";
+    uint16_t port = argc > 2 ? atoi(argv[2]) : 6379;
+    int32_t depth = argc > 3 ? atoi(argv[3]) : 16;
+    int64_t total = (argc > 4 ? atoll(argv[4]) : 2048) * 1024 * 1024;
+
+    int32_t fd = connectServer(ip, port);
+    if (fd < 0) {
+        fprintf(stderr, "connect %s:%d failed\n", ip, port);
+        return 1;
+    }
+
+    const size_t sizes[] = {64, 1024, 16 * 1024, 100 * 1024, 256 * 1024, 512 * 1024, 1024 * 1024};
+    std::vector<char> buf;
+    printf("%10s %12s %10s\n", "size", "gets/s", "MB/s");
+    for (size_t size : sizes) {
+        char key[32];
+        int32_t keylen = snprintf(key, sizeof(key), "bulk:%zu", size);
+        std::string value(size, 'v');
+
+        char header[128];
+        int32_t len = snprintf(header, sizeof(header), "*3\r\n$3\r\nSET\r\n$%d\r\n%s\r\n$%zu\r\n",
+                               keylen, key, size);
+        std::string set(header, len);
+        set += value;
+        set += "\r\n";
+        if (!writeAll(fd, set.data(), set.size()) || !readExactly(fd, buf, 5)) {
+            fprintf(stderr, "set failed\n");
+            return 1;
+        }
+
+        len = snprintf(header, sizeof(header), "*2\r\n$3\r\nGET\r\n$%d\r\n%s\r\n", keylen, key);
+        std::string pipeline;
+        for (int32_t i = 0; i < depth; i++) {
+            pipeline.append(header, len);
+        }
+
+        size_t reply = snprintf(header, sizeof(header), "$%zu\r\n", size) + size + 2;
+        int64_t requests = std::max<int64_t>(total / size, depth);
+        requests -= requests % depth;
+
+        int64_t start = ustime();
+        for (int64_t sent = 0; sent < requests; sent += depth) {
+            if (!writeAll(fd, pipeline.data(), pipeline.size()) ||
+                !readExactly(fd, buf, reply * depth)) {
+                fprintf(stderr, "get failed\n");
+                return 1;
+            }
+        }
+        int64_t end = ustime();
+
+        double seconds = (end - start) / 1000000.0;
+        printf("%10zu %12.0f %10.1f\n", size, requests / seconds, requests * size / seconds / 1024 / 1024);
+    }
+
+    ::close(fd);
+    return 0;
+}
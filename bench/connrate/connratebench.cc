@@ -0,0 +1,91 @@
+#include "all.h"
+#include "util.h"
+
+/* Connection rate of the server in a reconnect storm. 'threads' clients
+ * each connect, send a PING, wait for the reply and close, as fast as they
+ * can, until 'connections' connections were made. Connections are reset on
+ * close so the client does not run out of ports to TIME_WAIT. Reports the
+ * rate and the latency from connect() to the PONG.
+ *
+ * usage: connratebench [ip] [port] [threads] [connections] */
+
+const char *ip = "127.0.0.1";
+uint16_t port = 6379;
+int32_t threads = 8;
+int64_t connections = 200000;
+
+std::atomic <int64_t> started(0);
+std::atomic <int64_t> failed(0);
+
+void client(std::vector <int64_t> *latencies) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    ::inet_pton(AF_INET, ip, &addr.sin_addr);
+
+    const char ping[] = "*1\r\n$4\r\nping\r\n";
+    char buf[64];
+    while (started.fetch_add(1) < connections) {
+        int64_t begin = ustime();
+        int32_t fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (::connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+            ::write(fd, ping, sizeof(ping) - 1) != sizeof(ping) - 1 ||
+            ::read(fd, buf, sizeof(buf)) <= 0) {
+            failed++;
+        } else {
+            latencies->push_back(ustime() - begin);
+        }
+
+        struct linger linger = {1, 0};
+        ::setsockopt(fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+        ::close(fd);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1) {
+        ip = argv[1];
+    }
+
+    if (argc > 2) {
+        port = atoi(argv[2]);
+    }
+
+    if (argc > 3) {
+        threads = atoi(argv[3]);
+    }
+
+    if (argc > 4) {
+        connections = atoll(argv[4]);
+    }
+
+    std::vector <std::vector<int64_t>> latencies(threads);
+    std::vector <std::thread> clients;
+    int64_t begin = ustime();
+    for (int32_t i = 0; i < threads; i++) {
+        clients.push_back(std::thread(client, &latencies[i]));
+    }
+
+    for (auto &it : clients) {
+        it.join();
+    }
+    int64_t elapsed = ustime() - begin;
+
+    std::vector <int64_t> all;
+    for (auto &it : latencies) {
+        all.insert(all.end(), it.begin(), it.end());
+    }
+    std::sort(all.begin(), all.end());
+
+    auto percentile = [&](double p) -> int64_t {
+        return all.empty() ? 0 : all[std::min(all.size() - 1, size_t(all.size() * p / 100))];
+    };
+
+    printf("%ld connections in %.2f s, %.0f connections/s, %ld failed\n",
+           (long) all.size(), elapsed / 1e6, all.size() * 1e6 / elapsed, (long) failed.load());
+    printf("connect to PONG p50 %ld us, p99 %ld us, p99.9 %ld us, max %ld us\n",
+           (long) percentile(50), (long) percentile(99), (long) percentile(99.9),
+           (long) (all.empty() ? 0 : all.back()));
+    return 0;
+}
@@ -0,0 +1,120 @@
+#include "all.h"
+#include "util.h"
+#include "object.h"
+#include "keyspace.h"
+
+/* INCR on many counter keys, between the old value layout (every counter a
+ * RAW sds object, parsed and replaced by a new object on each INCR) and the
+ * INT encoding updated in place. Counters that start below
+ * REDIS_SHARED_INTEGERS point to the shared pool and cost no value at all.
+ *
+ * usage: counterbench [sds|int] [keys] [start] [rounds] */
+
+int32_t keys = 1000000;
+int64_t start = 100000;
+int32_t rounds = 10;
+
+size_t residentMemory() {
+    long pages = 0, resident = 0;
+    FILE *fp = ::fopen("/proc/self/statm", "r");
+    if (fp) {
+        if (fscanf(fp, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        ::fclose(fp);
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+/* The object and its control block in separate allocations, as values were
+ * created before the INT encoding. */
+RedisObjectPtr createSdsObject(int64_t value) {
+    RedisObjectPtr o(new RedisObject());
+    o->type = REDIS_STRING;
+    o->encoding = OBJ_ENCODING_RAW;
+    o->ptr = sdsfromlonglong(value);
+    return o;
+}
+
+void sdsIncr(RedisObjectPtr &val) {
+    int64_t value;
+    string2ll(val->ptr, sdslen(val->ptr), &value);
+    val = createSdsObject(value + 1);
+}
+
+void intIncr(RedisObjectPtr &val) {
+    int64_t value = (intptr_t) val->ptr;
+    value++;
+    if (val.use_count() == 1 && (value < 0 || value >= REDIS_SHARED_INTEGERS)) {
+        val->ptr = (sds)(intptr_t) value;
+    } else {
+        val = createStringObjectFromLongLong(value);
+    }
+}
+
+void bench(const char *name, bool sds) {
+    KeySpace keySpace;
+    std::vector <KeyEntry *> entries;
+    entries.reserve(keys);
+    char buf[32];
+
+    size_t before = residentMemory();
+    for (int32_t i = 0; i < keys; i++) {
+        int32_t len = snprintf(buf, sizeof(buf), "counter:%d", i);
+        KeyEntry *entry = keySpace.insert(buf, len, dictGenHashFunction(buf, len), OBJ_STRING);
+        entry->val = sds ? createSdsObject(start) : createStringObjectFromLongLong(start);
+    }
+
+    for (int32_t i = 0; i < keys; i++) {
+        int32_t len = snprintf(buf, sizeof(buf), "counter:%d", i);
+        entries.push_back(keySpace.find(buf, len, dictGenHashFunction(buf, len)));
+    }
+
+    size_t after = residentMemory();
+    int64_t t0 = ustime();
+    for (int32_t r = 0; r < rounds; r++) {
+        for (auto entry : entries) {
+            if (sds) {
+                sdsIncr(entry->val);
+            } else {
+                intIncr(entry->val);
+            }
+        }
+    }
+
+    int64_t t1 = ustime();
+    int64_t checksum = 0;
+    for (auto entry : entries) {
+        int64_t value;
+        getLongLongFromObject(entry->val, &value);
+        checksum += value;
+    }
+
+    printf("%s keys:%d start:%ld rounds:%d\n", name, keys, start, rounds);
+    printf("  memory per key: %.1f bytes\n", (double)(after - before) / keys);
+    printf("  incr: %.0f ops/s checksum:%ld\n",
+           (double) keys * rounds / ((t1 - t0) / 1000000.0), checksum);
+}
+
+int main(int argc, char *argv[]) {
+    const char *mode = argc > 1 ? argv[1] : "int";
+    if (argc > 2) {
+        keys = atoi(argv[2]);
+    }
+
+    if (argc > 3) {
+        start = atoll(argv[3]);
+    }
+
+    if (argc > 4) {
+        rounds = atoi(argv[4]);
+    }
+
+    createSharedObjects();
+    if (!strcmp(mode, "sds")) {
+        bench("sds", true);
+    } else {
+        bench("int", false);
+    }
+    return 0;
+}
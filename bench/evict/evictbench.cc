@@ -0,0 +1,221 @@
+#include "all.h"
+#include "util.h"
+#include "../benchclient.h"
+
+/* Hit ratio and throughput of the eviction policies for a cache workload.
+ * The client GETs keys drawn from a Zipfian distribution and SETs the keys
+ * that miss, with an expire of a random length for volatile-ttl, against a
+ * server bounded by maxmemory through CONFIG SET. The key space is larger
+ * than what fits, so the hit ratio tells how well the policy keeps the hot
+ * keys. Given the port of a slave of the server, each run also checks that
+ * the slave dropped the evicted keys too.
+ *
+ * usage: evictbench [ip] [port] [maxmemory] [keys] [requests] [skew] [slave port] */
+
+/* Zipfian ranks in [0, n), rank 0 the most popular, drawn with the
+ * rejection-free method of Gray et al. "Quickly Generating Billion-Record
+ * Synthetic Databases". */
+class Zipf {
+public:
+    Zipf(uint64_t n, double theta)
+            : n(n),
+              theta(theta),
+              seed(88172645463325252ULL) {
+        double zeta2 = 0;
+        for (uint64_t i = 1; i <= 2; i++) {
+            zeta2 += 1.0 / pow(i, theta);
+        }
+
+        zetan = 0;
+        for (uint64_t i = 1; i <= n; i++) {
+            zetan += 1.0 / pow(i, theta);
+        }
+
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+    }
+
+    uint64_t next() {
+        double u = (double) (nextRandom() >> 11) / (1ULL << 53);
+        double uz = u * zetan;
+        if (uz < 1.0) {
+            return 0;
+        }
+
+        if (uz < 1.0 + pow(0.5, theta)) {
+            return 1;
+        }
+        return (uint64_t) (n * pow(eta * u - eta + 1.0, alpha)) % n;
+    }
+
+    uint64_t nextRandom() {
+        seed ^= seed >> 12;
+        seed ^= seed << 25;
+        seed ^= seed >> 27;
+        return seed * 0x2545F4914F6CDD1DULL;
+    }
+
+private:
+    uint64_t n;
+    double theta;
+    double zetan;
+    double alpha;
+    double eta;
+    uint64_t seed;
+};
+
+const char *ip = "127.0.0.1";
+uint16_t port = 6379;
+const char *maxmemory = "32mb";
+int64_t keys = 1000000;
+int64_t requests = 2000000;
+double skew = 0.99;
+uint16_t slavePort = 0;
+
+bool command(int32_t fd, Reader &reader, const std::vector <std::string> &argv) {
+    std::string cmd, first;
+    appendCommand(cmd, argv);
+    if (!writeAll(fd, cmd.data(), cmd.size()) || !reader.readReply(&first)) {
+        return false;
+    }
+
+    if (first[0] == '-') {
+        printf("%s: %s\n", argv[0].c_str(), first.c_str());
+        return false;
+    }
+    return true;
+}
+
+int64_t dbsize(int32_t fd, Reader &reader) {
+    std::string cmd, first;
+    appendCommand(cmd, {"dbsize"});
+    if (!writeAll(fd, cmd.data(), cmd.size()) || !reader.readReply(&first) || first[0] != ':') {
+        return -1;
+    }
+    return atoll(first.c_str() + 1);
+}
+
+/* The slave has no maxmemory of its own, it only loses keys through the
+ * DELs of the master. Once it caught up both hold the same keys. */
+bool checkSlave(int32_t fd, Reader &reader) {
+    int32_t slave = connectServer(ip, slavePort);
+    if (slave < 0) {
+        printf("connect %s:%d failed\n", ip, slavePort);
+        return false;
+    }
+
+    Reader slaveReader(slave);
+    int64_t size = -1, slaveSize = -1;
+    for (int32_t i = 0; i < 50; i++) {
+        size = dbsize(fd, reader);
+        slaveSize = dbsize(slave, slaveReader);
+        if (size < 0 || slaveSize < 0 || size == slaveSize) {
+            break;
+        }
+        usleep(100 * 1000);
+    }
+    ::close(slave);
+
+    bool synced = size >= 0 && size == slaveSize;
+    printf("%-13s slave holds %ld keys, master %ld%s\n", "", slaveSize, size,
+           synced ? "" : "  OUT OF SYNC");
+    return synced;
+}
+
+bool bench(const char *policy) {
+    int32_t fd = connectServer(ip, port);
+    if (fd < 0) {
+        printf("connect %s:%d failed\n", ip, port);
+        return false;
+    }
+
+    Reader reader(fd);
+    if (!command(fd, reader, {"flushdb"}) ||
+        !command(fd, reader, {"config", "set", "maxmemory-policy", policy}) ||
+        !command(fd, reader, {"config", "set", "maxmemory", maxmemory})) {
+        ::close(fd);
+        return false;
+    }
+
+    bool volatileTtl = !strcmp(policy, "volatile-ttl");
+    std::string value(100, 'x');
+    Zipf zipf(keys, skew);
+    int64_t hits = 0, misses = 0, ooms = 0;
+    int64_t start = ustime();
+    for (int64_t i = 0; i < requests; i++) {
+        std::string key = "key:" + std::to_string(zipf.next());
+        std::string cmd, first;
+        appendCommand(cmd, {"get", key});
+        if (!writeAll(fd, cmd.data(), cmd.size()) || !reader.readReply(&first)) {
+            break;
+        }
+
+        if (first != "$-1") {
+            hits++;
+            continue;
+        }
+
+        misses++;
+        cmd.clear();
+        if (volatileTtl) {
+            std::string ttl = std::to_string(60 + zipf.nextRandom() % 3600);
+            appendCommand(cmd, {"set", key, value, "ex", ttl});
+        } else {
+            appendCommand(cmd, {"set", key, value});
+        }
+
+        if (!writeAll(fd, cmd.data(), cmd.size()) || !reader.readReply(&first)) {
+            break;
+        }
+
+        if (first[0] == '-') {
+            ooms++;
+        }
+    }
+
+    double seconds = (ustime() - start) / 1000000.0;
+    printf("%-13s hit ratio %.2f%%  %.0f gets/s  (%ld hits, %ld misses, %ld refused)\n",
+           policy, hits * 100.0 / std::max<int64_t>(1, hits + misses),
+           (hits + misses) / seconds, hits, misses, ooms);
+
+    bool synced = slavePort == 0 || checkSlave(fd, reader);
+    command(fd, reader, {"config", "set", "maxmemory", "0"});
+    command(fd, reader, {"flushdb"});
+    ::close(fd);
+    return synced;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1) {
+        ip = argv[1];
+    }
+
+    if (argc > 2) {
+        port = atoi(argv[2]);
+    }
+
+    if (argc > 3) {
+        maxmemory = argv[3];
+    }
+
+    if (argc > 4) {
+        keys = atoll(argv[4]);
+    }
+
+    if (argc > 5) {
+        requests = atoll(argv[5]);
+    }
+
+    if (argc > 6) {
+        skew = atof(argv[6]);
+    }
+
+    if (argc > 7) {
+        slavePort = atoi(argv[7]);
+    }
+
+    bool ok = bench("allkeys-lru");
+    ok = bench("allkeys-lfu") && ok;
+    ok = bench("volatile-ttl") && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,125 @@
+#include "all.h"
+#include "expire.h"
+#include "eventloop.h"
+
+/* Compare the memory cost and the insert rate of volatile keys between the
+ * old expire path (one Timer in the main TimerQueue per key plus a global
+ * expireTimers map) and the per shard ExpireWheel.
+ *
+ * usage: expirebench [wheel|timer] [keys] [threads] */
+
+const int32_t kShards = 1024;
+int32_t keys = 10000000;
+int32_t threadCount = 1;
+
+struct Shard {
+    ExpireWheel expireWheel;
+    std::mutex mtx;
+};
+
+size_t residentMemory() {
+    long pages = 0, resident = 0;
+    FILE *fp = ::fopen("/proc/self/statm", "r");
+    if (fp) {
+        if (fscanf(fp, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        ::fclose(fp);
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+void report(const char *name, size_t before, size_t after, int64_t start, int64_t end) {
+    double seconds = (end - start) / 1000000.0;
+    printf("%s keys:%d threads:%d\n", name, keys, threadCount);
+    printf("  expire memory per key: %.1f bytes\n", (double)(after - before) / keys);
+    printf("  set ex throughput: %.0f keys/s (%.3f s)\n", keys / seconds, seconds);
+}
+
+void timerBench(std::vector <RedisObjectPtr> &objs) {
+    EventLoop loop;
+    std::mutex expireMutex;
+    std::unordered_map <RedisObjectPtr, TimerPtr, Hash, Equal> expireTimers;
+
+    size_t before = residentMemory();
+    int64_t start = ustime();
+    for (auto &it : objs) {
+        RedisObjectPtr ex = createStringObject(it->ptr, sdslen(it->ptr));
+        ex->type = OBJ_EXPIRE;
+        TimerPtr timer = loop.runAfter(3600 + (ex->hash % 3600), false, [](){});
+        std::unique_lock <std::mutex> lck(expireMutex);
+        expireTimers.insert(std::make_pair(ex, timer));
+    }
+    int64_t end = ustime();
+    report("timer", before, residentMemory(), start, end);
+}
+
+void wheelBench(std::vector <RedisObjectPtr> &objs) {
+    std::unique_ptr <Shard[]> shards(new Shard[kShards]);
+    int64_t now = mstime();
+
+    size_t before = residentMemory();
+    int64_t start = ustime();
+    std::vector <std::thread> threads;
+    for (int32_t i = 0; i < threadCount; i++) {
+        threads.push_back(std::thread([&, i]() {
+            for (size_t j = i; j < objs.size(); j += threadCount) {
+                auto &obj = objs[j];
+                auto &shard = shards[obj->hash % kShards];
+                std::unique_lock <std::mutex> lck(shard.mtx);
+                shard.expireWheel.add(obj, now + (3600 + obj->hash % 3600) * 1000);
+            }
+        }));
+    }
+
+    for (auto &it : threads) {
+        it.join();
+    }
+    int64_t end = ustime();
+    report("wheel", before, residentMemory(), start, end);
+
+    /* Let everything expire and measure how fast the cycle reclaims it. */
+    std::vector <RedisObjectPtr> expired;
+    size_t count = 0;
+    start = ustime();
+    for (int32_t i = 0; i < kShards; i++) {
+        auto &shard = shards[i];
+        std::unique_lock <std::mutex> lck(shard.mtx);
+        while (shard.expireWheel.advance(now + 7200 * 1000 + 1,
+                                         REDIS_EXPIRELOOKUPS_PER_CRON, expired)) {
+            count += expired.size();
+            expired.clear();
+        }
+        count += expired.size();
+        expired.clear();
+    }
+    end = ustime();
+    printf("  active expire: %zu keys in %.3f s\n", count, (end - start) / 1000000.0);
+}
+
+int main(int argc, char *argv[]) {
+    const char *mode = argc > 1 ? argv[1] : "wheel";
+    if (argc > 2) {
+        keys = atoi(argv[2]);
+    }
+
+    if (argc > 3) {
+        threadCount = atoi(argv[3]);
+    }
+
+    createSharedObjects();
+    std::vector <RedisObjectPtr> objs;
+    objs.reserve(keys);
+    char buf[32];
+    for (int32_t i = 0; i < keys; i++) {
+        int32_t len = snprintf(buf, sizeof(buf), "session:%d", i);
+        objs.push_back(createStringObject(buf, len));
+    }
+
+    if (!strcmp(mode, "timer")) {
+        timerBench(objs);
+    } else {
+        wheelBench(objs);
+    }
+    return 0;
+}
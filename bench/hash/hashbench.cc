@@ -0,0 +1,139 @@
+#include "all.h"
+#include "util.h"
+#include "hash.h"
+
+/* Memory of many small hashes, between the old layout (every hash a hash
+ * table of field and value objects) and the listpack encoding, plus the
+ * HGET cost of the linear scan against a table lookup.
+ *
+ * usage: hashbench [dict|listpack] [hashes] [fields] */
+
+int32_t hashes = 1000000;
+int32_t fields = 10;
+
+typedef std::unordered_map <RedisObjectPtr, RedisObjectPtr, Hash, Equal> Dict;
+
+size_t residentMemory() {
+    long pages = 0, resident = 0;
+    FILE *fp = ::fopen("/proc/self/statm", "r");
+    if (fp) {
+        if (fscanf(fp, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        ::fclose(fp);
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+RedisObjectPtr createField(int32_t i) {
+    char buf[32];
+    int32_t len = snprintf(buf, sizeof(buf), "field:%d", i);
+    return createStringObject(buf, len);
+}
+
+RedisObjectPtr createValue(int32_t i) {
+    char buf[32];
+    int32_t len = snprintf(buf, sizeof(buf), "value:%d", i);
+    return createStringObject(buf, len);
+}
+
+void report(const char *name, size_t before, size_t after,
+            int64_t start, int64_t mid, int64_t end, size_t checksum) {
+    printf("%s hashes:%d fields:%d\n", name, hashes, fields);
+    printf("  memory per hash: %.1f bytes\n", (double)(after - before) / hashes);
+    printf("  hset: %.0f fields/s\n", (double) hashes * fields / ((mid - start) / 1000000.0));
+    printf("  hget: %.0f queries/s checksum:%zu\n",
+           (double) hashes / ((end - mid) / 1000000.0), checksum);
+}
+
+void dictBench() {
+    std::vector <Dict *> dicts;
+    dicts.reserve(hashes);
+
+    size_t before = residentMemory();
+    int64_t start = ustime();
+    for (int32_t i = 0; i < hashes; i++) {
+        Dict *dict = new Dict();
+        for (int32_t j = 0; j < fields; j++) {
+            (*dict)[createField(j)] = createValue(j);
+        }
+        dicts.push_back(dict);
+    }
+
+    size_t after = residentMemory();
+    int64_t mid = ustime();
+    size_t checksum = 0;
+    for (int32_t i = 0; i < hashes; i++) {
+        RedisObjectPtr field = createField(i % fields);
+        auto it = dicts[i]->find(field);
+        checksum += sdslen(it->second->ptr);
+    }
+
+    int64_t end = ustime();
+    report("dict", before, after, start, mid, end, checksum);
+
+    for (auto dict : dicts) {
+        delete dict;
+    }
+}
+
+void listpackBench() {
+    std::vector <RedisHash *> hashs;
+    hashs.reserve(hashes);
+
+    /* The field and value objects are shared across hashes, the listpack
+     * copies their bytes. */
+    std::vector <RedisObjectPtr> fieldObjs, valueObjs;
+    for (int32_t j = 0; j < fields; j++) {
+        fieldObjs.push_back(createField(j));
+        valueObjs.push_back(createValue(j));
+    }
+
+    size_t before = residentMemory();
+    int64_t start = ustime();
+    for (int32_t i = 0; i < hashes; i++) {
+        RedisHash *hash = new RedisHash();
+        for (int32_t j = 0; j < fields; j++) {
+            hash->set(fieldObjs[j], valueObjs[j]);
+        }
+        hashs.push_back(hash);
+    }
+
+    size_t after = residentMemory();
+    int64_t mid = ustime();
+    size_t checksum = 0;
+    char buf[Listpack::kIntBufSize];
+    for (int32_t i = 0; i < hashes; i++) {
+        RedisObjectPtr field = createField(i % fields);
+        std::string_view value;
+        if (hashs[i]->get(field, buf, &value)) {
+            checksum += value.size();
+        }
+    }
+
+    int64_t end = ustime();
+    printf("encoding:%s\n", hashs[0]->getEncoding() == OBJ_ENCODING_LISTPACK ? "listpack" : "hashtable");
+    report("listpack", before, after, start, mid, end, checksum);
+
+    for (auto hash : hashs) {
+        delete hash;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const char *mode = argc > 1 ? argv[1] : "listpack";
+    if (argc > 2) {
+        hashes = atoi(argv[2]);
+    }
+
+    if (argc > 3) {
+        fields = atoi(argv[3]);
+    }
+
+    if (!strcmp(mode, "dict")) {
+        dictBench();
+    } else {
+        listpackBench();
+    }
+    return 0;
+}
@@ -0,0 +1,144 @@
+#include "all.h"
+#include "keyspace.h"
+
+/* Compare the memory cost and the SET/GET rate of string keys between the
+ * old shard layout (an unordered_set of key objects plus one unordered_map
+ * per type) and the per shard KeySpace table.
+ *
+ * usage: keyspacebench [keyspace|map] [keys] */
+
+const int32_t kShards = 1024;
+int32_t keys = 10000000;
+
+typedef std::unordered_set <RedisObjectPtr, Hash, Equal> RedisMap;
+typedef std::unordered_map <RedisObjectPtr, RedisObjectPtr, Hash, Equal> StringMap;
+
+struct MapShard {
+    RedisMap redisMap;
+    StringMap stringMap;
+    std::mutex mtx;
+};
+
+struct KeySpaceShard {
+    KeySpace keySpace;
+    std::mutex mtx;
+};
+
+size_t residentMemory() {
+    long pages = 0, resident = 0;
+    FILE *fp = ::fopen("/proc/self/statm", "r");
+    if (fp) {
+        if (fscanf(fp, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        ::fclose(fp);
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+/* Keys and values are built inside the timed loops the way a request
+ * handler gets them, so both layouts pay the same allocation cost and only
+ * the objects they keep alive show up in the memory figure. */
+RedisObjectPtr createKey(int32_t i) {
+    char buf[32];
+    int32_t len = snprintf(buf, sizeof(buf), "key:%010d", i);
+    return createStringObject(buf, len);
+}
+
+RedisObjectPtr createValue(int32_t i) {
+    char buf[32];
+    int32_t len = snprintf(buf, sizeof(buf), "value:%d", i);
+    return createStringObject(buf, len);
+}
+
+void report(const char *name, size_t before, size_t after,
+            int64_t start, int64_t mid, int64_t end, size_t found) {
+    double setSeconds = (mid - start) / 1000000.0;
+    double getSeconds = (end - mid) / 1000000.0;
+    printf("%s keys:%d\n", name, keys);
+    printf("  memory per key: %.1f bytes\n", (double)(after - before) / keys);
+    printf("  set throughput: %.0f keys/s (%.3f s)\n", keys / setSeconds, setSeconds);
+    printf("  get throughput: %.0f keys/s (%.3f s) found:%zu\n", keys / getSeconds, getSeconds, found);
+}
+
+void mapBench() {
+    std::unique_ptr <MapShard[]> shards(new MapShard[kShards]);
+
+    size_t before = residentMemory();
+    int64_t start = ustime();
+    for (int32_t i = 0; i < keys; i++) {
+        RedisObjectPtr key = createKey(i);
+        auto &shard = shards[key->hash % kShards];
+        std::unique_lock <std::mutex> lck(shard.mtx);
+        auto it = shard.redisMap.find(key);
+        if (it == shard.redisMap.end()) {
+            shard.redisMap.insert(key);
+            shard.stringMap.insert(std::make_pair(key, createValue(i)));
+        }
+    }
+
+    size_t after = residentMemory();
+    int64_t mid = ustime();
+    size_t found = 0;
+    for (int32_t i = 0; i < keys; i++) {
+        RedisObjectPtr key = createKey((int64_t(i) * 7919) % keys);
+        auto &shard = shards[key->hash % kShards];
+        std::unique_lock <std::mutex> lck(shard.mtx);
+        auto it = shard.redisMap.find(key);
+        if (it != shard.redisMap.end() && (*it)->type == OBJ_STRING) {
+            auto iter = shard.stringMap.find(key);
+            found += iter != shard.stringMap.end();
+        }
+    }
+    int64_t end = ustime();
+    report("map", before, after, start, mid, end, found);
+}
+
+void keySpaceBench() {
+    std::unique_ptr <KeySpaceShard[]> shards(new KeySpaceShard[kShards]);
+
+    size_t before = residentMemory();
+    int64_t start = ustime();
+    for (int32_t i = 0; i < keys; i++) {
+        RedisObjectPtr key = createKey(i);
+        auto &shard = shards[key->hash % kShards];
+        std::unique_lock <std::mutex> lck(shard.mtx);
+        if (shard.keySpace.find(key) == nullptr) {
+            shard.keySpace.insert(key, OBJ_STRING)->val = createValue(i);
+        }
+    }
+
+    size_t after = residentMemory();
+    int64_t mid = ustime();
+    size_t found = 0;
+    for (int32_t i = 0; i < keys; i++) {
+        RedisObjectPtr key = createKey((int64_t(i) * 7919) % keys);
+        auto &shard = shards[key->hash % kShards];
+        std::unique_lock <std::mutex> lck(shard.mtx);
+        auto entry = shard.keySpace.find(key);
+        found += entry != nullptr && entry->type == OBJ_STRING;
+    }
+    int64_t end = ustime();
+    report("keyspace", before, after, start, mid, end, found);
+
+    size_t table = 0;
+    for (int32_t i = 0; i < kShards; i++) {
+        table += shards[i].keySpace.getMemoryUsage();
+    }
+    printf("  table memory per key: %.1f bytes\n", (double) table / keys);
+}
+
+int main(int argc, char *argv[]) {
+    const char *mode = argc > 1 ? argv[1] : "keyspace";
+    if (argc > 2) {
+        keys = atoi(argv[2]);
+    }
+
+    createSharedObjects();
+    if (!strcmp(mode, "map")) {
+        mapBench();
+    } else {
+        keySpaceBench();
+    }
+    return 0;
+}
@@ -0,0 +1,123 @@
+#include "all.h"
+#include "util.h"
+#include "../benchclient.h"
+
+/* Latency of deleting a huge key, inline with DEL against UNLINK, and of
+ * FLUSHDB against FLUSHDB ASYNC. For every round a set of 'members' members
+ * is built, then deleted while another client keeps sending PING. The
+ * delete is timed on its own connection, the PINGs tell how long the loop
+ * was stalled for everyone else.
+ *
+ * usage: lazyfreebench [ip] [port] [members] [keys] */
+
+const char *ip = "127.0.0.1";
+uint16_t port = 6379;
+int64_t members = 5000000;
+int64_t keys = 1000000;
+
+bool command(int32_t fd, Reader &reader, const std::vector <std::string> &argv) {
+    std::string cmd;
+    appendCommand(cmd, argv);
+    return writeAll(fd, cmd.data(), cmd.size()) && reader.readReply();
+}
+
+bool populate(int32_t fd, Reader &reader) {
+    const int32_t kBatch = 1000;
+    for (int64_t i = 0; i < members; i += kBatch * 10) {
+        std::string batch;
+        int64_t n = 0;
+        for (int64_t j = i; j < std::min(members, i + kBatch * 10); j += 10, n++) {
+            std::vector <std::string> argv = {"sadd", "bigset"};
+            for (int64_t k = j; k < std::min(members, j + 10); k++) {
+                argv.push_back("member:" + std::to_string(k));
+            }
+            appendCommand(batch, argv);
+        }
+
+        if (!writeAll(fd, batch.data(), batch.size()) || !reader.readReplies(n)) {
+            return false;
+        }
+    }
+
+    for (int64_t i = 0; i < keys; i += kBatch) {
+        std::string batch;
+        int64_t n = std::min<int64_t>(kBatch, keys - i);
+        for (int64_t j = 0; j < n; j++) {
+            appendCommand(batch, {"set", "key:" + std::to_string(i + j), "value"});
+        }
+
+        if (!writeAll(fd, batch.data(), batch.size()) || !reader.readReplies(n)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void bench(const char *name, const std::vector <std::string> &argv) {
+    int32_t fd = connectServer(ip, port);
+    if (fd < 0) {
+        printf("connect %s:%d failed\n", ip, port);
+        return;
+    }
+
+    Reader reader(fd);
+    if (!command(fd, reader, {"flushdb"}) || !populate(fd, reader)) {
+        printf("%s: populating failed\n", name);
+        ::close(fd);
+        return;
+    }
+
+    std::atomic<bool> stop(false);
+    int64_t maxPing = 0;
+    int64_t pings = 0;
+    std::thread pinger([&]() {
+        int32_t pfd = connectServer(ip, port);
+        Reader preader(pfd);
+        while (!stop) {
+            int64_t begin = ustime();
+            if (!command(pfd, preader, {"ping"})) {
+                break;
+            }
+            maxPing = std::max(maxPing, ustime() - begin);
+            pings++;
+        }
+        ::close(pfd);
+    });
+
+    /* Let the pinger settle before the delete. */
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    int64_t begin = ustime();
+    command(fd, reader, argv);
+    int64_t elapsed = ustime() - begin;
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    stop = true;
+    pinger.join();
+    ::close(fd);
+
+    printf("%-14s command %8ld us  max ping %8ld us  (%ld pings)\n",
+           name, elapsed, maxPing, pings);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1) {
+        ip = argv[1];
+    }
+
+    if (argc > 2) {
+        port = atoi(argv[2]);
+    }
+
+    if (argc > 3) {
+        members = atoll(argv[3]);
+    }
+
+    if (argc > 4) {
+        keys = atoll(argv[4]);
+    }
+
+    bench("del", {"del", "bigset"});
+    bench("unlink", {"unlink", "bigset"});
+    bench("flushdb", {"flushdb"});
+    bench("flushdb async", {"flushdb", "async"});
+    return 0;
+}
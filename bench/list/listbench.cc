@@ -0,0 +1,138 @@
+#include "all.h"
+#include "util.h"
+#include "object.h"
+#include "quicklist.h"
+#include "zmalloc.h"
+
+/* Compare the old list layout (a deque of string objects) with the
+ * quicklist: memory per element, RPUSH, LRANGE of a window in the middle,
+ * LINDEX at random places and LPOP of the whole list.
+ *
+ * usage: listbench [deque|quicklist] [elements] [compress depth] */
+
+int32_t elements = 1000000;
+int32_t depth = 0;
+const int32_t kQueries = 10000;
+const int32_t kRangeLen = 100;
+
+size_t residentMemory() {
+    long pages = 0, resident = 0;
+    FILE *fp = ::fopen("/proc/self/statm", "r");
+    if (fp) {
+        if (fscanf(fp, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        ::fclose(fp);
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+/* Job ids and feed entries, similar enough to compress a little. */
+int32_t createElement(char *buf, int32_t i) {
+    return snprintf(buf, 64, "{\"job\":%d,\"user\":%d,\"state\":\"queued\"}", i, i % 977);
+}
+
+void report(const char *name, size_t before, size_t after, int64_t t0, int64_t t1,
+            int64_t t2, int64_t t3, int64_t t4, size_t checksum) {
+    printf("%s elements:%d\n", name, elements);
+    printf("  memory per element: %.1f bytes\n", (double)(after - before) / elements);
+    printf("  rpush: %.0f ops/s\n", elements / ((t1 - t0) / 1000000.0));
+    printf("  lrange middle %d: %.0f queries/s\n", kRangeLen, kQueries / ((t2 - t1) / 1000000.0));
+    printf("  lindex: %.0f queries/s\n", kQueries / ((t3 - t2) / 1000000.0));
+    printf("  lpop: %.0f ops/s checksum:%zu\n", elements / ((t4 - t3) / 1000000.0), checksum);
+}
+
+void dequeBench() {
+    std::deque <RedisObjectPtr> list;
+    char buf[64];
+    size_t before = residentMemory();
+    int64_t t0 = ustime();
+    for (int32_t i = 0; i < elements; i++) {
+        int32_t len = createElement(buf, i);
+        list.push_back(createStringObject(buf, len));
+    }
+
+    int64_t t1 = ustime();
+    size_t after = residentMemory();
+    size_t checksum = 0;
+    for (int32_t i = 0; i < kQueries; i++) {
+        int64_t start = elements / 2 + i % 1000;
+        for (auto it = list.begin() + start, end = it + kRangeLen; it != end; ++it) {
+            checksum += sdslen((*it)->ptr);
+        }
+    }
+
+    int64_t t2 = ustime();
+    for (int32_t i = 0; i < kQueries; i++) {
+        checksum += sdslen(list[(int64_t(i) * 104729) % elements]->ptr);
+    }
+
+    int64_t t3 = ustime();
+    while (!list.empty()) {
+        checksum += sdslen(list.front()->ptr);
+        list.pop_front();
+    }
+
+    int64_t t4 = ustime();
+    report("deque", before, after, t0, t1, t2, t3, t4, checksum);
+}
+
+void quicklistBench() {
+    Quicklist list(depth);
+    char buf[64];
+    size_t used = zmalloc_used_memory();
+    size_t before = residentMemory();
+    int64_t t0 = ustime();
+    for (int32_t i = 0; i < elements; i++) {
+        int32_t len = createElement(buf, i);
+        list.push(buf, len, REDIS_LIST_TAIL);
+    }
+
+    int64_t t1 = ustime();
+    size_t after = residentMemory();
+    used = zmalloc_used_memory() - used;
+    size_t nodes = list.nodes();
+    size_t checksum = 0;
+    for (int32_t i = 0; i < kQueries; i++) {
+        int64_t start = elements / 2 + i % 1000;
+        list.range(start, start + kRangeLen - 1, [&](const std::string_view &value) {
+            checksum += value.size();
+        });
+    }
+
+    int64_t t2 = ustime();
+    for (int32_t i = 0; i < kQueries; i++) {
+        list.index((int64_t(i) * 104729) % elements, [&](const std::string_view &value) {
+            checksum += value.size();
+        });
+    }
+
+    int64_t t3 = ustime();
+    while (list.pop(REDIS_LIST_HEAD, [&](const std::string_view &value) {
+        checksum += value.size();
+    }));
+
+    int64_t t4 = ustime();
+    char name[32];
+    snprintf(name, sizeof(name), "quicklist depth:%d", depth);
+    report(name, before, after, t0, t1, t2, t3, t4, checksum);
+    printf("  allocated per element: %.1f bytes (%zu nodes)\n", (double) used / elements, nodes);
+}
+
+int main(int argc, char *argv[]) {
+    const char *mode = argc > 1 ? argv[1] : "quicklist";
+    if (argc > 2) {
+        elements = atoi(argv[2]);
+    }
+
+    if (argc > 3) {
+        depth = atoi(argv[3]);
+    }
+
+    if (!strcmp(mode, "deque")) {
+        dequeBench();
+    } else {
+        quicklistBench();
+    }
+    return 0;
+}
@@ -63,7 +63,8 @@ public:
             : loop(loop),
               threadPool(loop),
               sessionCount(sessionCount),
-              timeOut(timeOut) {
+              timeOut(timeOut),
+              numConencted(0) {
         loop->runAfter(timeOut, false, std::bind(&Client::handlerTimeout, this));
         if (threadCount > 1) {
             threadPool.setThreadNum(threadCount);
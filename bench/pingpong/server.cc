@@ -21,13 +21,17 @@ void onMessage(const TcpConnectionPtr &conn, Buffer *buffer) {
 
 int main(int argc, char *argv[]) {
     if (argc < 4) {
-        fprintf(stderr, "Usage: server <address> <port> <threads>\n");
+        fprintf(stderr, "Usage: server <address> <port> <threads> [epoll|io_uring]\n");
     } else {
         LOG_INFO << "ping pong server pid = " << getpid();
 
         const char *ip = argv[1];
         uint16_t port = static_cast<uint16_t>(atoi(argv[2]));
         int threadCount = atoi(argv[3]);
+        if (argc > 4 && !EventLoop::setIoBackend(argv[4])) {
+            fprintf(stderr, "%s is not available\n", argv[4]);
+            return 1;
+        }
 
         EventLoop loop;
         TcpServer server(&loop, ip, port, nullptr);
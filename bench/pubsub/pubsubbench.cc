@@ -0,0 +1,128 @@
+#include "all.h"
+#include "pubsub.h"
+#include "threadpool.h"
+#include "eventloop.h"
+#include "tcpconnection.h"
+
+/* PUBLISH fan-out to one channel, between the old delivery path (the
+ * publisher hands the frame to every subscriber with sendPipe(), one copy and
+ * one queued closure per connection) and PubSub, which queues one closure per
+ * loop that appends the shared frame to all of its subscribers.
+ *
+ * The subscribers are connections without a socket, a real run of 100k
+ * subscribers needs more descriptors than a test box allows, and the bytes
+ * appended to their output buffers are counted instead of written.
+ *
+ * usage: pubsubbench [batched|naive] [threads] [deliveries] */
+
+int32_t threadCount = 4;
+int64_t deliveries = 4000000;
+
+/* Runs 'cb' on every loop and waits for all of them, everything queued
+ * before has run when it returns. */
+void runOnAll(const std::vector<EventLoop *> &loops, const std::function<void(int32_t)> &cb) {
+    std::mutex mtx;
+    std::condition_variable cond;
+    size_t pending = loops.size();
+    for (size_t i = 0; i < loops.size(); i++) {
+        loops[i]->queueInLoop([&, i]() {
+            cb(i);
+            std::unique_lock <std::mutex> lck(mtx);
+            if (--pending == 0) {
+                cond.notify_one();
+            }
+        });
+    }
+
+    std::unique_lock <std::mutex> lck(mtx);
+    while (pending > 0) {
+        cond.wait(lck);
+    }
+}
+
+void bench(const char *mode, const std::vector<EventLoop *> &loops, int32_t subscribers) {
+    bool batched = !strcmp(mode, "batched");
+    PubSub pubsub;
+    pubsub.setLoops(loops);
+
+    RedisObjectPtr channel = createStringObject((char *) "news", 4);
+    RedisObjectPtr message = createStringObject((char *) "hello world", 11);
+    std::vector <std::vector<TcpConnectionPtr>> conns(loops.size());
+    std::vector <TcpConnectionPtr> all;
+    for (int32_t i = 0; i < subscribers; i++) {
+        int32_t core = i % loops.size();
+        TcpConnectionPtr conn(new TcpConnection(loops[core], (1 << 20) + i, std::any()));
+        conn->setState(TcpConnection::kConnected);
+        conns[core].push_back(conn);
+        all.push_back(conn);
+    }
+
+    /* Subscribe on the loops, as the server does. */
+    runOnAll(loops, [&](int32_t core) {
+        for (auto &it : conns[core]) {
+            pubsub.subscribe(core, it, channel);
+        }
+    });
+
+    /* The frame the old path built once per PUBLISH. */
+    std::string frame = "*3\r\n$7\r\nmessage\r\n$4\r\nnews\r\n$11\r\nhello world\r\n";
+    int64_t messages = std::max<int64_t>(1, deliveries / subscribers);
+    int64_t start = ustime();
+    for (int64_t m = 0; m < messages; m++) {
+        if (batched) {
+            pubsub.publish(channel, message);
+        } else {
+            for (auto &it : all) {
+                it->sendPipe(std::string_view(frame));
+            }
+        }
+    }
+
+    std::atomic <int64_t> bytes(0);
+    runOnAll(loops, [&](int32_t core) {
+        for (auto &it : conns[core]) {
+            bytes += it->outputBuffer()->readableBytes();
+            it->outputBuffer()->retrieveAll();
+        }
+    });
+    int64_t end = ustime();
+
+    double seconds = (end - start) / 1000000.0;
+    printf("%s subscribers:%d messages:%ld threads:%d\n", mode, subscribers, messages, threadCount);
+    printf("  publish: %.0f messages/s, %.0f deliveries/s (%.3f s)\n",
+           messages / seconds, messages * subscribers / seconds, seconds);
+    if (bytes != (int64_t) frame.size() * messages * subscribers) {
+        printf("  delivered %ld bytes, expected %ld\n", (int64_t) bytes,
+               (int64_t) frame.size() * messages * subscribers);
+    }
+
+    runOnAll(loops, [&](int32_t core) {
+        for (auto &it : conns[core]) {
+            pubsub.clear(core, it->getSockfd());
+            it->setState(TcpConnection::kDisconnected);
+        }
+    });
+}
+
+int main(int argc, char *argv[]) {
+    const char *mode = argc > 1 ? argv[1] : "batched";
+    if (argc > 2) {
+        threadCount = atoi(argv[2]);
+    }
+
+    if (argc > 3) {
+        deliveries = atoll(argv[3]);
+    }
+
+    createSharedObjects();
+    EventLoop loop;
+    ThreadPool pool(&loop);
+    pool.setThreadNum(threadCount);
+    pool.start();
+
+    std::vector<EventLoop *> loops = pool.getAllLoops();
+    bench(mode, loops, 1);
+    bench(mode, loops, 1000);
+    bench(mode, loops, 100000);
+    return 0;
+}
@@ -0,0 +1,118 @@
+#include "all.h"
+#include "redis.h"
+
+/* Startup load time against the number of load threads. Writes a synthetic
+ * RDB of 'keys' records, strings of 'size' bytes that compress well enough
+ * for LZF with a small hash every sixteenth key and an expire on every
+ * eighth one, then loads it with 1, 2, 4 ... 'threads' threads into an
+ * empty keyspace.
+ *
+ * usage: rdbloadbench [keys] [size] [threads] [port] */
+
+const char *kFileName = "rdbloadbench.rdb";
+
+bool writeRdb(Rdb *rdb, int64_t keys, size_t size) {
+    FILE *fp = ::fopen(kFileName, "w");
+    if (fp == nullptr) {
+        return false;
+    }
+
+    Rio rio;
+    rdb->rioInitWithFile(&rio, fp);
+    char magic[10];
+    snprintf(magic, sizeof(magic), "REDIS%04d", REDIS_RDB_VERSION);
+    if (rdb->rdbWriteRaw(&rio, magic, 9) == REDIS_ERR ||
+        rdb->rdbSaveType(&rio, RDB_OPCODE_SELECTDB) == REDIS_ERR ||
+        rdb->rdbSaveLen(&rio, 0) == REDIS_ERR) {
+        return false;
+    }
+
+    int64_t now = mstime();
+    char buf[64];
+    for (int64_t i = 0; i < keys; i++) {
+        int32_t len = snprintf(buf, sizeof(buf), "key:%lld", (long long) i);
+        RedisObjectPtr key = createStringObject(buf, len);
+        if (i % 16 == 15) {
+            key->type = OBJ_HASH;
+            if (rdb->rdbSaveKey(&rio, key) == REDIS_ERR ||
+                rdb->rdbSaveLen(&rio, 8) == REDIS_ERR) {
+                return false;
+            }
+
+            for (int32_t j = 0; j < 8; j++) {
+                len = snprintf(buf, sizeof(buf), "field:%d", j);
+                RedisObjectPtr field = createStringObject(buf, len);
+                len = snprintf(buf, sizeof(buf), "%lld", (long long) (i * 8 + j));
+                RedisObjectPtr value = createStringObject(buf, len);
+                if (rdb->rdbSaveValue(&rio, field) == REDIS_ERR ||
+                    rdb->rdbSaveValue(&rio, value) == REDIS_ERR) {
+                    return false;
+                }
+            }
+            continue;
+        }
+
+        std::string value(size, 'a' + i % 26);
+        len = snprintf(buf, sizeof(buf), "%lld:", (long long) i);
+        value.replace(0, std::min<size_t>(len, size), buf, std::min<size_t>(len, size));
+        RedisObjectPtr val = createStringObject(value.data(), value.size());
+        int64_t expiretime = i % 8 == 7 ? now + 3600 * 1000 : REDIS_ERR;
+        if (rdb->rdbSaveKeyValuePair(&rio, key, val, expiretime, now) == REDIS_ERR) {
+            return false;
+        }
+    }
+
+    if (rdb->rdbSaveType(&rio, RDB_OPCODE_EOF) == REDIS_ERR) {
+        return false;
+    }
+
+    uint64_t cksum = rio.cksum;
+    memrev64ifbe(&cksum);
+    if (rdb->rioWrite(&rio, &cksum, 8) == 0) {
+        return false;
+    }
+    return ::fclose(fp) == 0;
+}
+
+int main(int argc, char *argv[]) {
+    int64_t keys = argc > 1 ? atoll(argv[1]) : 4000000;
+    size_t size = argc > 2 ? atoi(argv[2]) : 128;
+    int32_t threads = argc > 3 ? atoi(argv[3]) : std::thread::hardware_concurrency();
+    uint16_t port = argc > 4 ? atoi(argv[4]) : 16379;
+
+    /* Loads nothing as long as there is no dump.rdb here. */
+    Redis redis("127.0.0.1", port, 1);
+    Rdb *rdb = redis.getRdb();
+
+    int64_t start = ustime();
+    if (!writeRdb(rdb, keys, size)) {
+        fprintf(stderr, "writing %s failed\n", kFileName);
+        return 1;
+    }
+
+    struct stat st;
+    ::stat(kFileName, &st);
+    printf("wrote %lld keys, %.1f MB in %.2f s\n", (long long) keys,
+           st.st_size / 1024.0 / 1024.0, (ustime() - start) / 1000000.0);
+
+    printf("%8s %10s %12s\n", "threads", "ms", "keys/s");
+    for (int32_t n = 1; n <= std::max(threads, 1); n *= 2) {
+        redis.clearCommand();
+        start = ustime();
+        if (rdb->rdbLoad(kFileName, n) == REDIS_ERR) {
+            fprintf(stderr, "loading with %d threads failed\n", n);
+            return 1;
+        }
+
+        double seconds = (ustime() - start) / 1000000.0;
+        if (redis.getDbsize() != keys) {
+            fprintf(stderr, "loaded %zu keys of %lld\n", redis.getDbsize(), (long long) keys);
+            return 1;
+        }
+        printf("%8d %10.0f %12.0f\n", n, seconds * 1000, keys / seconds);
+    }
+
+    ::unlink(kFileName);
+    fflush(stdout);
+    _exit(0);
+}
@@ -6,6 +6,7 @@ int clients = 100;
 int requests = 10000;
 int threadCount = 4;
 int valueLen = 3;
+int keys = 1;
 std::mutex mtx;
 std::condition_variable condition;
 std::atomic<int> connShutDown;
@@ -18,14 +19,15 @@ public:
         kSet,
     };
 
-    Client(EventLoop *loop, const char *ip, uint16_t port, Operation op)
-            : client(loop, nullptr),
+    Client(EventLoop *loop, const char *ip, uint16_t port, Operation op, int id)
+            : client(loop, ip, port, nullptr),
               operation(op),
+              id(id),
               ack(0),
               sent(0) {
         client.setConnectionCallback(std::bind(&Client::connCallBack, this, std::placeholders::_1));
         client.setMessageCallback(std::bind(&Client::readCallBack, this, std::placeholders::_1, std::placeholders::_2));
-        client.connect(ip, port);
+        client.connect();
     }
 
     void countDown() {
@@ -92,14 +94,23 @@ public:
         char *cmd;
         int argc;
         const char *argv[3];
+        /* With more than one key every client walks the whole key space, so
+         * a set run followed by a get run only ever reads existing keys. */
+        char key[32];
+        if (keys > 1) {
+            snprintf(key, sizeof(key), "foo:%d", (id + sent * clients) % keys);
+        } else {
+            snprintf(key, sizeof(key), "foo");
+        }
+
         if (operation == kSet) {
             argv[0] = "SET";
-            argv[1] = "foo\0xxx";
+            argv[1] = key;
             argv[2] = "bar";
             argc = 3;
         } else {
             argv[0] = "GET";
-            argv[1] = "foo\0xxx";
+            argv[1] = key;
             argc = 2;
         }
 
@@ -113,6 +124,7 @@ public:
     TcpConnectionPtr conn;
     Operation operation;
 
+    int id;
     int ack;
     int sent;
 };
@@ -120,9 +132,25 @@ public:
 std::vector <std::shared_ptr<Client>> clientPtr;
 
 int main(int argc, char *argv[]) {
-    if (argc < 3) {
-        fprintf(stderr, "Usage: server <address> <port> <set,get>\n");
+    if (argc < 4) {
+        fprintf(stderr, "Usage: server <address> <port> <set,get> [clients] [requests] [keys] [threads]\n");
     } else {
+        if (argc > 4) {
+            clients = atoi(argv[4]);
+        }
+
+        if (argc > 5) {
+            requests = atoi(argv[5]);
+        }
+
+        if (argc > 6) {
+            keys = atoi(argv[6]);
+        }
+
+        if (argc > 7) {
+            threadCount = atoi(argv[7]);
+        }
+
         LOG_INFO << "Connecting";
         connectCount = 0;
         connShutDown = 0;
@@ -142,7 +170,7 @@ int main(int argc, char *argv[]) {
         }
 
         for (int i = 0; i < clients; i++) {
-            std::shared_ptr <Client> client(new Client(pool.getNextLoop(), ip, port, opertion));
+            std::shared_ptr <Client> client(new Client(pool.getNextLoop(), ip, port, opertion, i));
             clientPtr.push_back(client);
         }
 
@@ -157,7 +185,7 @@ int main(int argc, char *argv[]) {
 
         TimeStamp start = TimeStamp::now();
         for (auto &it : clientPtr) {
-            it.send();
+            it->send();
         }
 
         {
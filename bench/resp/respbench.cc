@@ -0,0 +1,142 @@
+#include "all.h"
+#include "buffer.h"
+#include "object.h"
+#include "resp.h"
+
+/* Parse a pipeline of small SET/GET requests the way the session used to
+ * (one sds copy for the name, one object per argument in a deque) and with
+ * RespParser, which hands out slices of the input buffer.
+ *
+ * usage: respbench [object|slice] [commands] [rounds] */
+
+int32_t commands = 100000;
+int32_t rounds = 20;
+
+void fillPipeline(Buffer *buffer) {
+    char buf[128];
+    for (int32_t i = 0; i < commands; i++) {
+        char key[32];
+        int32_t keylen = snprintf(key, sizeof(key), "key:%d", i);
+        int32_t len;
+        if (i & 1) {
+            len = snprintf(buf, sizeof(buf), "*2\r\n$3\r\nGET\r\n$%d\r\n%s\r\n", keylen, key);
+        } else {
+            len = snprintf(buf, sizeof(buf), "*3\r\n$3\r\nSET\r\n$%d\r\n%s\r\n$5\r\nvalue\r\n", keylen, key);
+        }
+        buffer->append(buf, len);
+    }
+}
+
+/* The previous Session::processMultibulkBuffer(), without the connection. */
+int32_t objectParse(Buffer *buffer, RedisObjectPtr &cmd, std::deque <RedisObjectPtr> &argv) {
+    const char *queryBuf = buffer->peek();
+    const char *newline = strchr(queryBuf, '\r');
+    int64_t ll = 0;
+    size_t pos = 0;
+    if (newline == nullptr || !string2ll(queryBuf + 1, newline - (queryBuf + 1), &ll)) {
+        return REDIS_ERR;
+    }
+
+    pos = newline - queryBuf + 2;
+    int32_t multibulklen = ll;
+    for (int32_t i = 0; i < multibulklen; i++) {
+        newline = strchr(queryBuf + pos, '\r');
+        if (newline == nullptr || !string2ll(queryBuf + pos + 1, newline - (queryBuf + pos + 1), &ll)) {
+            return REDIS_ERR;
+        }
+
+        pos = newline - queryBuf + 2;
+        if (i == 0) {
+            cmd->ptr = sdscpylen(cmd->ptr, queryBuf + pos, ll);
+            cmd->calHash();
+        } else {
+            argv.push_back(createStringObject((char *) (queryBuf + pos), ll));
+        }
+        pos += ll + 2;
+    }
+
+    buffer->retrieve(pos);
+    return REDIS_OK;
+}
+
+void objectBench(Buffer *buffer) {
+    RedisObjectPtr cmd = createStringObject(nullptr, REDIS_COMMAND_LENGTH);
+    std::deque <RedisObjectPtr> argv;
+    size_t parsed = 0;
+    int64_t start = ustime();
+    for (int32_t r = 0; r < rounds; r++) {
+        Buffer input;
+        input.append(buffer->peek(), buffer->readableBytes());
+        input.append("\0", 1);
+        while (input.readableBytes() > 1 && objectParse(&input, cmd, argv) == REDIS_OK) {
+            parsed += argv.size() + 1;
+            argv.clear();
+        }
+    }
+    int64_t end = ustime();
+    double seconds = (end - start) / 1000000.0;
+    printf("object: %.0f commands/s, %zu arguments\n", commands * rounds / seconds, parsed);
+}
+
+void sliceBench(Buffer *buffer) {
+    RespParser parser;
+    size_t parsed = 0;
+    int64_t start = ustime();
+    for (int32_t r = 0; r < rounds; r++) {
+        Buffer input;
+        input.append(buffer->peek(), buffer->readableBytes());
+        while (parser.parse(&input) == REDIS_OK) {
+            parsed += parser.getArgv().size() + 1;
+            parser.consume(&input);
+        }
+    }
+    int64_t end = ustime();
+    double seconds = (end - start) / 1000000.0;
+    printf("slice: %.0f commands/s, %zu arguments\n", commands * rounds / seconds, parsed);
+}
+
+void crlfBench() {
+    /* One line of 4KB, the SIMD scan against a byte by byte search. */
+    std::string line(4096, 'x');
+    line += "\r\n";
+    const char crlf[] = "\r\n";
+    const int32_t loops = 100000;
+    const char *begin = line.data();
+    const char *last = begin + line.size();
+    size_t found = 0;
+
+    int64_t start = ustime();
+    for (int32_t i = 0; i < loops; i++) {
+        found += std::search(begin, last, crlf, crlf + 2) - begin;
+    }
+    int64_t mid = ustime();
+    for (int32_t i = 0; i < loops; i++) {
+        found += Buffer::findCRLF(begin, last) - begin;
+    }
+    int64_t end = ustime();
+    printf("crlf scan 4KB: std::search %.0f MB/s, findCRLF %.0f MB/s (%zu)\n",
+           line.size() * loops / double(mid - start),
+           line.size() * loops / double(end - mid), found);
+}
+
+int main(int argc, char *argv[]) {
+    const char *mode = argc > 1 ? argv[1] : "slice";
+    if (argc > 2) {
+        commands = atoi(argv[2]);
+    }
+
+    if (argc > 3) {
+        rounds = atoi(argv[3]);
+    }
+
+    createSharedObjects();
+    Buffer buffer;
+    fillPipeline(&buffer);
+    if (!strcmp(mode, "object")) {
+        objectBench(&buffer);
+    } else {
+        sliceBench(&buffer);
+    }
+    crlfBench();
+    return 0;
+}
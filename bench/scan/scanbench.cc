@@ -0,0 +1,165 @@
+#include "all.h"
+#include "util.h"
+#include "../benchclient.h"
+
+/* Latency of GET while another client walks the keyspace, with KEYS * or
+ * with a full SCAN iteration, against GET on an idle server. KEYS holds
+ * every shard mutex while it copies the keys of the shard, SCAN looks at
+ * 'count' keys per call, so the GETs landing on a shard being walked wait
+ * for a bounded slice only.
+ *
+ * usage: scanbench [ip] [port] [keys] [count] [seconds] */
+
+const char *ip = "127.0.0.1";
+uint16_t port = 6379;
+int64_t keys = 1000000;
+int32_t scanCount = 100;
+int32_t seconds = 3;
+
+bool populate() {
+    int32_t fd = connectServer(ip, port);
+    if (fd < 0) {
+        return false;
+    }
+
+    Reader reader(fd);
+    const int32_t kBatch = 1000;
+    for (int64_t i = 0; i < keys; i += kBatch) {
+        std::string batch;
+        int64_t n = std::min<int64_t>(kBatch, keys - i);
+        for (int64_t j = 0; j < n; j++) {
+            appendCommand(batch, {"set", "key:" + std::to_string(i + j), "value"});
+        }
+
+        if (!writeAll(fd, batch.data(), batch.size())) {
+            return false;
+        }
+
+        for (int64_t j = 0; j < n; j++) {
+            if (!reader.readReply()) {
+                return false;
+            }
+        }
+    }
+    ::close(fd);
+    return true;
+}
+
+/* One full walk of the keyspace, returns the number of keys seen. */
+int64_t walk(int32_t fd, Reader &reader, bool scan) {
+    if (!scan) {
+        std::string cmd;
+        appendCommand(cmd, {"keys", "*"});
+        writeAll(fd, cmd.data(), cmd.size());
+        return reader.readArray();
+    }
+
+    int64_t seen = 0;
+    std::string cursor = "0";
+    do {
+        std::string cmd, line;
+        appendCommand(cmd, {"scan", cursor, "count", std::to_string(scanCount)});
+        writeAll(fd, cmd.data(), cmd.size());
+        /* *2, the cursor as a bulk string, then the keys. */
+        if (!reader.readLine(&line) || !reader.readLine(&line) || !reader.readLine(&cursor)) {
+            return -1;
+        }
+
+        int64_t n = reader.readArray();
+        if (n < 0) {
+            return -1;
+        }
+        seen += n;
+    } while (cursor != "0");
+    return seen;
+}
+
+void bench(const char *mode) {
+    std::atomic<bool> stop(false);
+    std::atomic <int64_t> walks(0), walked(0);
+    std::thread walker;
+    if (strcmp(mode, "idle")) {
+        walker = std::thread([&]() {
+            int32_t fd = connectServer(ip, port);
+            Reader reader(fd);
+            while (!stop) {
+                int64_t n = walk(fd, reader, !strcmp(mode, "scan"));
+                if (n < 0) {
+                    break;
+                }
+                walks++;
+                walked += n;
+            }
+            ::close(fd);
+        });
+    }
+
+    int32_t fd = connectServer(ip, port);
+    Reader reader(fd);
+    std::vector <int64_t> latencies;
+    int64_t start = ustime();
+    uint64_t seed = 1;
+    while (ustime() - start < seconds * 1000000LL) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        std::string cmd;
+        appendCommand(cmd, {"get", "key:" + std::to_string((seed >> 33) % keys)});
+        int64_t begin = ustime();
+        if (!writeAll(fd, cmd.data(), cmd.size()) || !reader.readReply()) {
+            break;
+        }
+        latencies.push_back(ustime() - begin);
+    }
+    ::close(fd);
+
+    stop = true;
+    if (walker.joinable()) {
+        walker.join();
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    size_t n = latencies.size();
+    if (n == 0) {
+        printf("%s: no GET completed\n", mode);
+        return;
+    }
+
+    printf("%-5s gets:%zu  p50 %ld us  p99 %ld us  p99.9 %ld us  max %ld us",
+           mode, n, latencies[n / 2], latencies[n * 99 / 100],
+           latencies[n * 999 / 1000], latencies[n - 1]);
+    if (walks > 0) {
+        printf("  (%ld walks, %ld keys)", (int64_t) walks, (int64_t) walked);
+    }
+    printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1) {
+        ip = argv[1];
+    }
+
+    if (argc > 2) {
+        port = atoi(argv[2]);
+    }
+
+    if (argc > 3) {
+        keys = atoll(argv[3]);
+    }
+
+    if (argc > 4) {
+        scanCount = atoi(argv[4]);
+    }
+
+    if (argc > 5) {
+        seconds = atoi(argv[5]);
+    }
+
+    if (!populate()) {
+        printf("populating %s:%d failed\n", ip, port);
+        return 1;
+    }
+
+    bench("idle");
+    bench("keys");
+    bench("scan");
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include "all.h"
+#include "util.h"
+#include "../benchclient.h"
+
+/* Script throughput against the number of client threads. Every thread
+ * has its own connection and its own key and pipelines 'depth' calls of
+ * a script doing one INCR, sent as EVALSHA of a loaded script or as EVAL
+ * of the body. Run the server with as many threads as the clients use to
+ * see the interpreters of the loops work in parallel.
+ *
+ * usage: scriptbench [evalsha|eval] [ip] [port] [threads] [depth] [requests] */
+
+const char *kScript = "return redis.call('incr', KEYS[1])";
+
+int main(int argc, char *argv[]) {
+    bool evalsha = !(argc > 1 && !strcmp(argv[1], "eval"));
+    const char *ip = argc > 2 ? argv[2] : "127.0.0.1";
+    uint16_t port = argc > 3 ? atoi(argv[3]) : 6379;
+    int32_t threads = argc > 4 ? atoi(argv[4]) : 4;
+    int32_t depth = argc > 5 ? atoi(argv[5]) : 32;
+    int64_t requests = argc > 6 ? atoll(argv[6]) : 1000000;
+
+    int32_t fd = connectServer(ip, port);
+    if (fd < 0) {
+        printf("connect %s:%d failed\n", ip, port);
+        return 1;
+    }
+
+    std::string load, sha;
+    appendCommand(load, {"script", "load", kScript});
+    Reader reader(fd);
+    bool loaded = writeAll(fd, load.data(), load.size()) && reader.readLine(&sha) && sha == "$40" &&
+                  reader.readLine(&sha);
+    ::close(fd);
+    if (!loaded) {
+        printf("script load failed: %s\n", sha.c_str());
+        return 1;
+    }
+
+    for (int32_t count = 1; count <= threads; count *= 2) {
+        std::atomic <bool> failed(false);
+        std::vector <std::thread> workers;
+        int64_t perThread = requests / count;
+        int64_t start = ustime();
+        for (int32_t t = 0; t < count; t++) {
+            workers.emplace_back([&, t]() {
+                int32_t fd = connectServer(ip, port);
+                if (fd < 0) {
+                    failed = true;
+                    return;
+                }
+
+                Reader reader(fd);
+                std::string key = "script:" + std::to_string(t);
+                std::string batch;
+                for (int32_t i = 0; i < depth; i++) {
+                    appendCommand(batch, {evalsha ? "evalsha" : "eval",
+                                          evalsha ? sha : kScript, "1", key});
+                }
+
+                std::string first;
+                for (int64_t done = 0; done < perThread; done += depth) {
+                    if (!writeAll(fd, batch.data(), batch.size()) ||
+                        !reader.readReplies(depth, &first) || first[0] != ':') {
+                        if (!first.empty()) {
+                            printf("unexpected reply: %s\n", first.c_str());
+                        }
+                        failed = true;
+                        break;
+                    }
+                }
+                ::close(fd);
+            });
+        }
+
+        for (auto &it : workers) {
+            it.join();
+        }
+
+        int64_t end = ustime();
+        if (failed) {
+            return 1;
+        }
+
+        double seconds = (end - start) / 1000000.0;
+        printf("%s threads:%d depth:%d  %.0f scripts/s (%.3f s)\n",
+               evalsha ? "evalsha" : "eval", count, depth,
+               perThread * count / seconds, seconds);
+    }
+    return 0;
+}
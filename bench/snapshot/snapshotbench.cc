@@ -0,0 +1,121 @@
+#include "all.h"
+#include "util.h"
+#include "../benchclient.h"
+
+/* SET latency while a BGSAVE runs. Loads 'keys' values of 'size' bytes,
+ * measures single SETs for a while, starts BGSAVE with or without fork and
+ * keeps measuring for 'seconds'.
+ *
+ * usage: snapshotbench [fork|forkless] [keys] [size] [seconds] [ip] [port] */
+
+std::string setCommand(int64_t key, const std::string &value) {
+    char header[128];
+    char name[32];
+    int32_t keylen = snprintf(name, sizeof(name), "key:%lld", (long long) key);
+    int32_t len = snprintf(header, sizeof(header), "*3\r\n$3\r\nSET\r\n$%d\r\n%s\r\n$%zu\r\n",
+                           keylen, name, value.size());
+    std::string command(header, len);
+    command += value;
+    command += "\r\n";
+    return command;
+}
+
+std::string inlineCommand(const char *line) {
+    return std::string(line) + "\r\n";
+}
+
+void report(const char *name, std::vector <int64_t> &samples) {
+    if (samples.empty()) {
+        return;
+    }
+
+    std::sort(samples.begin(), samples.end());
+    auto at = [&samples](double p) { return samples[std::min(samples.size() - 1, size_t(samples.size() * p))]; };
+    printf("%-10s %8zu sets  p50 %6lld us  p99 %6lld us  p99.9 %6lld us  max %8lld us\n",
+           name, samples.size(), (long long) at(0.5), (long long) at(0.99),
+           (long long) at(0.999), (long long) samples.back());
+}
+
+int main(int argc, char *argv[]) {
+    bool forkless = argc > 1 && !strcmp(argv[1], "forkless");
+    int64_t keys = argc > 2 ? atoll(argv[2]) : 2000000;
+    size_t size = argc > 3 ? atoi(argv[3]) : 128;
+    int32_t seconds = argc > 4 ? atoi(argv[4]) : 10;
+    const char *ip = argc > 5 ? argv[5] : "127.0.0.1";
+    uint16_t port = argc > 6 ? atoi(argv[6]) : 6379;
+
+    int32_t fd = connectServer(ip, port);
+    int32_t control = connectServer(ip, port);
+    if (fd < 0 || control < 0) {
+        fprintf(stderr, "connect %s:%d failed\n", ip, port);
+        return 1;
+    }
+
+    Reader reader(fd);
+    Reader controlReader(control);
+
+    std::string value(size, 'v');
+    const int32_t batch = 1000;
+    for (int64_t i = 0; i < keys; i += batch) {
+        std::string pipeline;
+        int32_t n = std::min<int64_t>(batch, keys - i);
+        for (int32_t j = 0; j < n; j++) {
+            pipeline += setCommand(i + j, value);
+        }
+
+        if (!writeAll(fd, pipeline.data(), pipeline.size()) || !reader.readReplies(n)) {
+            fprintf(stderr, "load failed\n");
+            return 1;
+        }
+    }
+
+    std::string config = inlineCommand(forkless ? "config set bgsave-forkless yes" :
+                                       "config set bgsave-forkless no");
+    if (!writeAll(control, config.data(), config.size()) || !controlReader.readReply()) {
+        fprintf(stderr, "config failed\n");
+        return 1;
+    }
+
+    std::mt19937_64 rng(1);
+    std::vector <int64_t> before, during;
+    int64_t bgsaveLatency = 0;
+    int64_t start = ustime();
+    int64_t bgsaveAt = start + 2000000;
+    int64_t stop = bgsaveAt + seconds * 1000000LL;
+    bool started = false;
+    while (true) {
+        int64_t now = ustime();
+        if (now >= stop) {
+            break;
+        }
+
+        if (!started && now >= bgsaveAt) {
+            /* The reply only comes back after fork() returned. */
+            std::string bgsave = inlineCommand("BGSAVE");
+            int64_t t = ustime();
+            if (!writeAll(control, bgsave.data(), bgsave.size()) || !controlReader.readReply()) {
+                fprintf(stderr, "bgsave failed\n");
+                return 1;
+            }
+            bgsaveLatency = ustime() - t;
+            started = true;
+        }
+
+        std::string command = setCommand(rng() % keys, value);
+        int64_t t = ustime();
+        if (!writeAll(fd, command.data(), command.size()) || !reader.readReply()) {
+            fprintf(stderr, "set failed\n");
+            return 1;
+        }
+        (started ? during : before).push_back(ustime() - t);
+    }
+
+    printf("%s, %lld keys of %zu bytes, BGSAVE reply after %lld us\n",
+           forkless ? "forkless" : "fork", (long long) keys, size, (long long) bgsaveLatency);
+    report("idle", before);
+    report("bgsave", during);
+
+    ::close(fd);
+    ::close(control);
+    return 0;
+}
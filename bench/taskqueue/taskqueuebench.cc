@@ -0,0 +1,158 @@
+#include "all.h"
+#include "util.h"
+#include "eventloop.h"
+#include "threadpool.h"
+
+/* Cross thread task throughput of EventLoop::queueInLoop. 'producers'
+ * threads queue 'tasks' tasks each to one loop, one at a time and in
+ * batches, and the time until the loop ran them all is reported. The
+ * closure holds a shared_ptr and a counter, as a bind of shared_from_this()
+ * would, too big for the small buffer of a std::function.
+ *
+ * For reference the same runs against a queue built like the one the loop
+ * had before: a mutex guarding a vector of std::function, swapped out by
+ * the consumer, and an eventfd write for every task.
+ *
+ * usage: taskqueuebench [producers] [tasks] [batch] */
+
+int32_t producers = 4;
+int64_t tasks = 1000000;
+int32_t batchSize = 64;
+
+class LockedQueue {
+public:
+    typedef std::function<void()> Functor;
+
+    LockedQueue()
+            : wakeupFd(::eventfd(0, EFD_CLOEXEC)),
+              stop(false),
+              consumer(&LockedQueue::run, this) {
+
+    }
+
+    ~LockedQueue() {
+        queue([this]() { stop = true; });
+        consumer.join();
+        ::close(wakeupFd);
+    }
+
+    void queue(Functor &&cb) {
+        {
+            std::unique_lock <std::mutex> lck(mutex);
+            pending.push_back(std::move(cb));
+        }
+
+        uint64_t one = 1;
+        ::write(wakeupFd, &one, sizeof(one));
+    }
+
+private:
+    void run() {
+        std::vector <Functor> functors;
+        while (!stop) {
+            uint64_t one;
+            ::read(wakeupFd, &one, sizeof(one));
+            {
+                std::unique_lock <std::mutex> lck(mutex);
+                functors.swap(pending);
+            }
+
+            for (auto &it : functors) {
+                it();
+            }
+            functors.clear();
+        }
+    }
+
+    int32_t wakeupFd;
+    bool stop;
+    std::mutex mutex;
+    std::vector <Functor> pending;
+    std::thread consumer;
+};
+
+std::atomic <int64_t> done(0);
+
+void waitDone(int64_t total) {
+    while (done.load(std::memory_order_acquire) < total) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+void report(const char *name, int64_t begin) {
+    int64_t elapsed = ustime() - begin;
+    int64_t total = tasks * producers;
+    printf("%-28s %8.2f Mtasks/s %8.1f ns/task\n", name,
+           total / (double) elapsed, elapsed * 1000.0 / total);
+}
+
+/* Only the consumer writes it. */
+void count(const std::shared_ptr <int64_t> &hits) {
+    ++*hits;
+    done.store(done.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+template<class Push>
+void bench(const char *name, Push &&push) {
+    done = 0;
+    std::vector <std::thread> threads;
+    int64_t begin = ustime();
+    for (int32_t i = 0; i < producers; i++) {
+        threads.push_back(std::thread([&push]() {
+            push();
+        }));
+    }
+
+    for (auto &it : threads) {
+        it.join();
+    }
+    waitDone(tasks * producers);
+    report(name, begin);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1) {
+        producers = atoi(argv[1]);
+    }
+
+    if (argc > 2) {
+        tasks = atoll(argv[2]);
+    }
+
+    if (argc > 3) {
+        batchSize = atoi(argv[3]);
+    }
+
+    std::shared_ptr <int64_t> hits(new int64_t(0));
+    Thread thread;
+    EventLoop *loop = thread.startLoop();
+
+    bench("queueInLoop", [&]() {
+        for (int64_t i = 0; i < tasks; i++) {
+            loop->queueInLoop([hits]() { count(hits); });
+        }
+    });
+
+    bench("queueInLoop batch", [&]() {
+        TaskQueue::Batch batch(loop->getTaskQueue());
+        for (int64_t i = 0; i < tasks; i++) {
+            batch.add([hits]() { count(hits); });
+            if (batch.size() == size_t(batchSize)) {
+                loop->queueInLoop(batch);
+            }
+        }
+        loop->queueInLoop(batch);
+    });
+
+    {
+        LockedQueue locked;
+        bench("mutex + eventfd per task", [&]() {
+            for (int64_t i = 0; i < tasks; i++) {
+                locked.queue([hits]() { count(hits); });
+            }
+        });
+    }
+
+    printf("%ld tasks run, %d producers\n", (long) *hits, producers);
+    return 0;
+}
@@ -1,61 +1,218 @@
-#pragma once
-
 #include "all.h"
-#include "log.h"
-#include "tcpserver.h"
+#include "util.h"
+#include "eventloop.h"
+
+/* Add, cancel and fire throughput of the TimerQueue with 'timers' timers
+ * outstanding, against the TimerQueue this tree had before the timing
+ * wheel, kept below as MapTimerQueue.
+ *
+ *   add    'timers' timers 10 to 70 seconds away, they stay outstanding
+ *   churn  'timers' times add a timer and cancel it, as a request timeout
+ *          that is not hit does
+ *   fire   'timers' more timers due within 50ms, run once all are due
+ *   cancel the outstanding timers, in random order
+ *
+ * usage: timerbench [timers] */
+
+int64_t timerCount = 1000000;
 
-int count1 = 100000;
-int count2 = 0;
-int count3 = 0;
-int count4 = 0;
-EventLoop loop;
+/* The old TimerQueue: timers are shared_ptrs in a multimap by deadline and
+ * a map by sequence, and every add reads the wall clock. */
+class MapTimerQueue {
+public:
+    struct MapTimer {
+        int64_t when;
+        int64_t sequence;
+        TimerCallback callback;
+    };
 
-std::vector <TimerPtr> timers;
+    typedef std::shared_ptr <MapTimer> MapTimerPtr;
+
+    MapTimerQueue()
+            : timerfd(::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)),
+              sequence(0) {
 
-void serverCron1() {
-    assert(count2 <= count1 - count3);
-    if (++count2 == count1 - count3) {
-        count2 = 0;
-        printf("serverCron1\n");
     }
-}
 
-void serverCron2() {
-    printf("timer size:%d\n", loop.getTimerQueue()->getTimerSize());
+    ~MapTimerQueue() {
+        ::close(timerfd);
+    }
+
+    MapTimerPtr add(double delay, TimerCallback &&cb) {
+        MapTimerPtr timer(new MapTimer{TimeStamp::now().getMicroSecondsSinceEpoch() + int64_t(delay * 1000000),
+                                       ++sequence, std::move(cb)});
+        bool earliestChanged = timers.empty() || timer->when < timers.begin()->first;
+        timers.insert(std::make_pair(timer->when, timer));
+        active.insert(std::make_pair(timer->sequence, timer));
+        if (earliestChanged) {
+            reset(timer->when);
+        }
+        return timer;
+    }
+
+    void cancel(const MapTimerPtr &timer) {
+        auto it = active.find(timer->sequence);
+        if (it == active.end()) {
+            return;
+        }
+
+        for (auto iter = timers.find(timer->when); iter != timers.end(); ++iter) {
+            if (iter->second->sequence == timer->sequence) {
+                timers.erase(iter);
+                break;
+            }
+        }
+        active.erase(it);
+    }
+
+    void expire() {
+        int64_t now = TimeStamp::now().getMicroSecondsSinceEpoch();
+        auto end = timers.lower_bound(now);
+        std::multimap <int64_t, MapTimerPtr> expired(timers.begin(), end);
+        timers.erase(timers.begin(), end);
+        for (auto &it : expired) {
+            active.erase(it.second->sequence);
+        }
+
+        for (auto &it : expired) {
+            it.second->callback();
+        }
+
+        if (!timers.empty()) {
+            reset(timers.begin()->first);
+        }
+    }
+
+    size_t size() const { return timers.size(); }
+
+private:
+    void reset(int64_t when) {
+        int64_t delta = std::max<int64_t>(when - TimeStamp::now().getMicroSecondsSinceEpoch(), 100);
+        struct itimerspec value;
+        memset(&value, 0, sizeof(value));
+        value.it_value.tv_sec = delta / 1000000;
+        value.it_value.tv_nsec = (delta % 1000000) * 1000;
+        ::timerfd_settime(timerfd, 0, &value, nullptr);
+    }
+
+    int32_t timerfd;
+    int64_t sequence;
+    std::multimap <int64_t, MapTimerPtr> timers;
+    std::map <int64_t, MapTimerPtr> active;
+};
+
+int64_t fired = 0;
+
+void report(const char *name, const char *phase, int64_t begin) {
+    int64_t elapsed = ustime() - begin;
+    printf("%-6s %-7s %8.2f M/s %8.1f ns/timer\n", name, phase,
+           timerCount / (double) elapsed, elapsed * 1000.0 / timerCount);
 }
 
-void serverCron3() {
-    for (auto it = timers.begin(); it != timers.end();) {
-        loop.cancelAfter(*it);
-        timers.erase(it++);
-        count3++;
-        break;
+std::vector<double> delays(double low, double high) {
+    std::mt19937_64 rng(timerCount);
+    std::uniform_real_distribution<double> dist(low, high);
+    std::vector<double> out(timerCount);
+    for (auto &it : out) {
+        it = dist(rng);
     }
+    return out;
+}
+
+template<class T>
+void shuffle(std::vector <T> &v) {
+    std::mt19937_64 rng(timerCount + 1);
+    std::shuffle(v.begin(), v.end(), rng);
 }
 
-void serverCron4() {
-    if (++count4 == count1) {
-        printf("serverCron4\n");
+void benchWheel() {
+    EventLoop loop;
+    TimerQueue *queue = loop.getTimerQueue().get();
+    std::vector<double> outstanding = delays(10, 70);
+    std::vector<double> due = delays(0, 0.05);
+    std::vector <TimerPtr> timers;
+    timers.reserve(timerCount);
+
+    queue->updateTime();
+    int64_t begin = ustime();
+    for (auto &it : outstanding) {
+        timers.push_back(loop.runAfter(it, false, []() {}));
+    }
+    report("wheel", "add", begin);
+
+    begin = ustime();
+    for (auto &it : outstanding) {
+        loop.cancelAfter(loop.runAfter(it, false, []() {}));
+    }
+    report("wheel", "churn", begin);
+
+    fired = 0;
+    queue->updateTime();
+    for (auto &it : due) {
+        loop.runAfter(it, false, [&loop]() {
+            if (++fired == timerCount) {
+                loop.quit();
+            }
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    begin = ustime();
+    loop.run();
+    report("wheel", "fire", begin);
+
+    shuffle(timers);
+    begin = ustime();
+    for (auto &it : timers) {
+        loop.cancelAfter(it);
     }
+    report("wheel", "cancel", begin);
+    assert(queue->getTimerSize() == 0);
 }
 
-int main(int argc, char *argv[]) {
-    TcpServer server(&loop, "127.0.0.1", 6379, nullptr);
-    server.start();
+void benchMap() {
+    MapTimerQueue queue;
+    std::vector<double> outstanding = delays(10, 70);
+    std::vector<double> due = delays(0, 0.05);
+    std::vector <MapTimerQueue::MapTimerPtr> timers;
+    timers.reserve(timerCount);
 
-    for (int i = 0; i < count1; i++) {
-        TimerPtr timer = loop.runAfter(5.0, true, std::bind(serverCron1));
-        timers.push_back(timer);
-        //loop.cancelAfter(timer);
+    int64_t begin = ustime();
+    for (auto &it : outstanding) {
+        timers.push_back(queue.add(it, []() {}));
     }
+    report("map", "add", begin);
 
-    loop.runAfter(1.0, true, std::bind(serverCron2));
-    loop.runAfter(1.0, true, std::bind(serverCron3));
+    begin = ustime();
+    for (auto &it : outstanding) {
+        queue.cancel(queue.add(it, []() {}));
+    }
+    report("map", "churn", begin);
 
-    for (int i = 0; i < count1; i++) {
-        loop.runAfter(1.0, false, std::bind(serverCron4));
+    fired = 0;
+    for (auto &it : due) {
+        queue.add(it, []() { ++fired; });
     }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    begin = ustime();
+    queue.expire();
+    report("map", "fire", begin);
+    assert(fired == timerCount);
 
-    loop.run();
+    shuffle(timers);
+    begin = ustime();
+    for (auto &it : timers) {
+        queue.cancel(it);
+    }
+    report("map", "cancel", begin);
+    assert(queue.size() == 0);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1) {
+        timerCount = atoll(argv[1]);
+    }
+
+    benchWheel();
+    benchMap();
     return 0;
 }
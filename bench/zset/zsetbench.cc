@@ -0,0 +1,154 @@
+#include "all.h"
+#include "util.h"
+#include "zset.h"
+
+/* Compare ZRANGE at an offset and ZRANK between the old sorted set layout
+ * (a multimap ordered by score plus a member to score map, walked from the
+ * head) and the span annotated skiplist, and the memory of small sets in
+ * the listpack encoding.
+ *
+ * usage: zsetbench [multimap|skiplist|small] [members] [queries] */
+
+int32_t members = 1000000;
+int32_t queries = 1000;
+const int32_t kRangeLen = 10;
+
+size_t residentMemory() {
+    long pages = 0, resident = 0;
+    FILE *fp = ::fopen("/proc/self/statm", "r");
+    if (fp) {
+        if (fscanf(fp, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        ::fclose(fp);
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+int32_t createMember(char *buf, int32_t i) {
+    return snprintf(buf, 32, "member:%d", i);
+}
+
+void report(const char *name, int64_t start, int64_t mid, int64_t end, size_t checksum) {
+    double rangeSeconds = (mid - start) / 1000000.0;
+    double rankSeconds = (end - mid) / 1000000.0;
+    printf("%s members:%d queries:%d\n", name, members, queries);
+    printf("  zrange offset+%d: %.0f queries/s (%.3f s)\n",
+           kRangeLen, queries / rangeSeconds, rangeSeconds);
+    printf("  zrank: %.0f queries/s (%.3f s) checksum:%zu\n",
+           queries / rankSeconds, rankSeconds, checksum);
+}
+
+void multimapBench() {
+    std::multimap<double, std::string> sortMap;
+    std::unordered_map <std::string, double> indexMap;
+    char buf[32];
+    for (int32_t i = 0; i < members; i++) {
+        int32_t len = createMember(buf, i);
+        double score = (int64_t(i) * 7919) % members;
+        sortMap.insert(std::make_pair(score, std::string(buf, len)));
+        indexMap.insert(std::make_pair(std::string(buf, len), score));
+    }
+
+    size_t checksum = 0;
+    int64_t start = ustime();
+    for (int32_t i = 0; i < queries; i++) {
+        int64_t offset = (int64_t(i) * 104729) % members;
+        auto it = sortMap.begin();
+        std::advance(it, offset);
+        for (int32_t j = 0; j < kRangeLen && it != sortMap.end(); j++, ++it) {
+            checksum += it->second.size();
+        }
+    }
+
+    int64_t mid = ustime();
+    for (int32_t i = 0; i < queries; i++) {
+        int32_t len = createMember(buf, (int64_t(i) * 104729) % members);
+        auto iter = indexMap.find(std::string(buf, len));
+        auto it = sortMap.lower_bound(iter->second);
+        while (it->second != iter->first) {
+            ++it;
+        }
+        checksum += std::distance(sortMap.begin(), it);
+    }
+    int64_t end = ustime();
+    report("multimap", start, mid, end, checksum);
+}
+
+void skiplistBench() {
+    Zset zset;
+    char buf[32];
+    for (int32_t i = 0; i < members; i++) {
+        int32_t len = createMember(buf, i);
+        zset.add(buf, len, (int64_t(i) * 7919) % members);
+    }
+
+    size_t checksum = 0;
+    int64_t start = ustime();
+    for (int32_t i = 0; i < queries; i++) {
+        int64_t offset = (int64_t(i) * 104729) % members;
+        zset.range(offset, offset + kRangeLen - 1, false,
+                   [&](const std::string_view &ele, double score) {
+                       checksum += ele.size();
+                   });
+    }
+
+    int64_t mid = ustime();
+    for (int32_t i = 0; i < queries; i++) {
+        int32_t len = createMember(buf, (int64_t(i) * 104729) % members);
+        checksum += zset.getRank(buf, len, false);
+    }
+    int64_t end = ustime();
+    report("skiplist", start, mid, end, checksum);
+}
+
+/* Many sets of 'members' elements each, to see what the listpack encoding
+ * saves over the skiplist. */
+void smallBench() {
+    const int32_t sets = 100000;
+    char buf[32];
+    std::vector <Zset *> zsets;
+    zsets.reserve(sets);
+
+    size_t before = residentMemory();
+    int64_t start = ustime();
+    for (int32_t i = 0; i < sets; i++) {
+        Zset *zset = new Zset();
+        for (int32_t j = 0; j < members; j++) {
+            int32_t len = createMember(buf, j);
+            zset->add(buf, len, j);
+        }
+        zsets.push_back(zset);
+    }
+
+    int64_t end = ustime();
+    size_t after = residentMemory();
+    printf("small sets:%d members:%d encoding:%s\n", sets, members,
+           zsets[0]->getEncoding() == OBJ_ENCODING_LISTPACK ? "listpack" : "skiplist");
+    printf("  memory per member: %.1f bytes\n", (double)(after - before) / sets / members);
+    printf("  zadd throughput: %.0f members/s\n", (double) sets * members / ((end - start) / 1000000.0));
+
+    for (auto zset : zsets) {
+        delete zset;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const char *mode = argc > 1 ? argv[1] : "skiplist";
+    if (argc > 2) {
+        members = atoi(argv[2]);
+    }
+
+    if (argc > 3) {
+        queries = atoi(argv[3]);
+    }
+
+    if (!strcmp(mode, "multimap")) {
+        multimapBench();
+    } else if (!strcmp(mode, "small")) {
+        smallBench();
+    } else {
+        skiplistBench();
+    }
+    return 0;
+}
@@ -12,6 +12,9 @@ listenning(false) {
 	assert(idleFd >= 0);
 #endif
 	channel.setReadCallback(std::bind(&Acceptor::handleRead, this));
+	if (loop->usingUring()) {
+		channel.setAcceptCallback(std::bind(&Acceptor::handleAccept, this, std::placeholders::_1));
+	}
 }
 
 Acceptor::~Acceptor() {
@@ -22,18 +25,31 @@ Acceptor::~Acceptor() {
 
 void Acceptor::handleRead() {
 	loop->assertInLoopThread();
-	int32_t connfd = Socket::accept(sockfd);
-	if (connfd >= 0) {
+	for (int32_t i = 0; i < kMaxAcceptsPerCall; i++) {
+		int32_t connfd = Socket::accept(sockfd);
+		if (connfd < 0) {
+			break;
+		}
+
 		if (newConnectionCallback) {
 			Socket::setSocketNonBlock(connfd);
 			newConnectionCallback(connfd);
 		}
 		else {
-			Socket::close(sockfd);
+			Socket::close(connfd);
 		}
 	}
-	else {
+}
 
+void Acceptor::handleAccept(int32_t connfd) {
+	/* Accepted by the multishot accept of a loop on io_uring, already
+	 * non blocking. */
+	loop->assertInLoopThread();
+	if (newConnectionCallback) {
+		newConnectionCallback(connfd);
+	}
+	else {
+		Socket::close(connfd);
 	}
 }
 
@@ -21,15 +21,25 @@ public:
 		return listenning;
 	}
 
+	int32_t getfd() const {
+		return sockfd;
+	}
+
 	void listen();
 
 	void handleRead();
 
+	void handleAccept(int32_t connfd);
+
 private:
 	Acceptor(const Acceptor &);
 
 	void operator=(const Acceptor &);
 
+	/* Bound on the connections taken in one wakeup, so a connection storm
+	 * does not starve the other channels of the loop. */
+	const static int32_t kMaxAcceptsPerCall = 1000;
+
 	EventLoop *loop;
 	Channel channel;
 	int32_t sockfd;
@@ -23,6 +23,8 @@
 #include <functional>
 #include <algorithm>
 #include <memory>
+#include <new>
+#include <cstddef>
 #include <condition_variable>
 #include <thread>
 #include <sys/types.h>
@@ -117,6 +119,16 @@ typedef SSIZE_T ssize_t;
 #include <endian.h>
 #include <sys/un.h>
 #include <sys/utsname.h>
+#include <linux/filter.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+/* The io_uring backend needs the multishot receive and provided buffer
+ * rings of Linux 6.0 headers. */
+#ifdef IORING_RECV_MULTISHOT
+#define HAVE_IO_URING
 #endif
 
 #define LUA_TNONE        (-1)
@@ -148,7 +160,7 @@ typedef SSIZE_T ssize_t;
 /* Flag that is set when we should set SO_REUSEADDR before calling bind() */
 #define REDIS_REUSEADDR 5
 
-#define REDIS_ENCODING_EMBSTR_SIZE_LIMIT 39
+#define REDIS_ENCODING_EMBSTR_SIZE_LIMIT 44
 /* Client request types */
 #define REDIS_REQ_INLINE 1
 #define REDIS_REQ_MULTIBULK 2
@@ -158,6 +170,7 @@ typedef SSIZE_T ssize_t;
 #define REDIS_INLINE_MAX_SIZE (4096 * 64 * 10 * 10) /* Max size of inline reads */
 #define REDIS_LRU_BITS 24
 #define REDIS_MBULK_BIG_ARG (4096 * 11 * 10 * 10)
+#define REDIS_REPLY_REF_LEN (16 * 1024) /* Bulk replies from this size on are referenced, not copied */
 #define REDIS_NULL -1
 #define REDIS_STRING 0
 #define REDIS_LIST 1
@@ -179,6 +192,7 @@ typedef SSIZE_T ssize_t;
 #define OBJ_SET_XX (1<<1)     /* Set if key exists. */
 #define OBJ_SET_EX (1<<2)     /* Set if time in seconds is given */
 #define OBJ_SET_PX (1<<3)     /* Set if time in ms in given */
+#define OBJ_SET_PXAT (1<<4)   /* Set if unix time in ms is given */
 /* Units */
 #define UNIT_SECONDS 0
 #define UNIT_MILLISECONDS 1
@@ -189,6 +203,9 @@ typedef SSIZE_T ssize_t;
 #define REDIS_DEFAULT_HZ        10      /* Time interrupt calls/sec. */
 #define REDIS_MIN_HZ            1
 #define REDIS_MAX_HZ            500
+#define REDIS_EXPIRELOOKUPS_PER_CRON    20 /* lookup 20 expires per loop */
+#define REDIS_EXPIRELOOKUPS_TIME_PERC   25 /* CPU max % for keys collection */
+#define REDIS_EXPIRE_GRACE_MS           1000 /* active expire lags timeouts by 1s */
 #define REDIS_SERVERPORT        6379    /* TCP port */
 #define REDIS_TCP_BACKLOG       511     /* TCP listen backlog */
 #define REDIS_MAXIDLETIME       0       /* default client timeout: infinite */
@@ -197,7 +214,7 @@ typedef SSIZE_T ssize_t;
 #define REDIS_DBCRON_DBS_PER_CALL 16
 #define REDIS_MAX_WRITE_PER_EVENT (1024*64)
 #define REDIS_SHARED_SELECT_CMDS 10
-#define REDIS_SHARED_INTEGERS 32
+#define REDIS_SHARED_INTEGERS 10000
 #define REDIS_SHARED_BULKHDR_LEN 32
 #define REDIS_MAX_LOGMSG_LEN    1024 /* Default maximum lengthgth of syslog messages */
 #define REDIS_AOF_REWRITE_PERC  100
@@ -215,6 +232,13 @@ typedef SSIZE_T ssize_t;
 #define REDIS_DEFAULT_REPL_BACKLOG_SIZE (1024*1024)    /* 1mb */
 #define REDIS_DEFAULT_REPL_BACKLOG_TIME_LIMIT (60*60)  /* 1 hour */
 #define REDIS_REPL_BACKLOG_MIN_SIZE (1024*16)          /* 16k */
+#define REDIS_REPL_SYNC_BUFFER_LIMIT (1024*1024*256)   /* 256mb */
+
+/* Slave side replication state */
+#define REPL_STATE_NONE 0          /* No active replication */
+#define REPL_STATE_RECEIVE_PSYNC 1 /* Wait for the reply to PSYNC */
+#define REPL_STATE_TRANSFER 2      /* Receiving the RDB from the master */
+#define REPL_STATE_CONNECTED 3     /* Following the replication stream */
 #define REDIS_BGSAVE_RETRY_DELAY 5 /* Wait a few secs before trying again. */
 #define REDIS_DEFAULT_PID_FILE "/var/run/redis.pid"
 #define REDIS_DEFAULT_SYSLOG_IDENT "redis"
@@ -299,9 +323,17 @@ typedef SSIZE_T ssize_t;
 #define REDIS_RDB_TYPE_SET_INTSET    11
 #define REDIS_RDB_TYPE_ZSET_ZIPLIST  12
 #define REDIS_RDB_TYPE_HASH_ZIPLIST  13
+#define REDIS_RDB_TYPE_HASH_LISTPACK 16
+#define REDIS_RDB_TYPE_ZSET_LISTPACK 17
+#define REDIS_RDB_TYPE_LIST_QUICKLIST_2 18
+#define REDIS_RDB_TYPE_SET_LISTPACK 20
+
+/* Quicklist node containers in REDIS_RDB_TYPE_LIST_QUICKLIST_2. */
+#define REDIS_RDB_QUICKLIST_NODE_PLAIN 1
+#define REDIS_RDB_QUICKLIST_NODE_PACKED 2
 
 /* Test if a type is an object type. */
-#define rdbIsObjectType(t) ((t >= 0 && t <= 4) || (t >= 9 && t <= 13))
+#define rdbIsObjectType(t) ((t >= 0 && t <= 4) || (t >= 9 && t <= 13) || (t >= 16 && t <= 18) || t == 20)
 
 /* Special RDB opcodes (saved/loaded with rdbSaveType/rdbLoadType). */
 #define REDIS_RDB_OPCODE_SET        250
@@ -337,6 +369,39 @@ typedef SSIZE_T ssize_t;
 #define LONG_STR_SIZE      21          /* Bytes needed for long -> str + '\0' */
 #define AOF_AUTOSYNC_BYTES (1024*1024*32) /* fdatasync every 32MB */
 
+/* Append only file states */
+#define AOF_OFF 0             /* AOF is off */
+#define AOF_ON 1              /* AOF is on */
+#define AOF_WAIT_REWRITE 2    /* AOF waits rewrite to start appending */
+
+/* Append only file fsync policies */
+#define AOF_FSYNC_NO 0
+#define AOF_FSYNC_ALWAYS 1
+#define AOF_FSYNC_EVERYSEC 2
+
+/* Maxmemory policies */
+#define MAXMEMORY_NO_EVICTION 0
+#define MAXMEMORY_ALLKEYS_LRU 1
+#define MAXMEMORY_ALLKEYS_LFU 2
+#define MAXMEMORY_VOLATILE_TTL 3
+
+#define MAXMEMORY_SAMPLES 5           /* Keys sampled for every eviction */
+#define EVPOOL_SIZE 16                /* Best candidates kept between samples */
+#define EVICT_TIME_LIMIT_US 500       /* Eviction time of one command */
+#define LRU_CLOCK_MAX ((1 << REDIS_LRU_BITS) - 1)
+#define LRU_CLOCK_RESOLUTION 1000     /* Milliseconds of an LRU clock tick */
+#define LFU_INIT_VAL 5                /* Counter of a new key */
+#define LFU_LOG_FACTOR 10
+#define LFU_DECAY_TIME 1              /* Minutes between two counter decrements */
+
+#define LAZYFREE_THRESHOLD 64         /* Allocations above which a value is freed in the background */
+
+#define SLOWLOG_LOG_SLOWER_THAN 10000 /* Microseconds */
+#define SLOWLOG_MAX_LEN 128
+
+#define LUA_TIME_LIMIT 5000           /* Milliseconds a script may hold its shards */
+#define LUA_HOOK_COUNT 100000         /* Instructions between two checks of the limit */
+
 #define OBJ_SHARED_REFCOUNT INT_MAX
 #define REDIS_REPLY_STRING 1
 #define REDIS_REPLY_ARRAY 2
@@ -421,9 +486,25 @@ typedef SSIZE_T ssize_t;
 #define OBJ_ENCODING_EMBSTR 8  /* Embedded sds string encoding */
 #define OBJ_ENCODING_QUICKLIST 9 /* Encoded as linked list of ziplists */
 #define OBJ_ENCODING_STREAM 10 /* Encoded as a radix tree of listpacks */
+#define OBJ_ENCODING_LISTPACK 11 /* Encoded as a listpack */
+
+#define REDIS_ZSET_MAX_LISTPACK_ENTRIES 128
+#define REDIS_ZSET_MAX_LISTPACK_VALUE 64
+#define REDIS_HASH_MAX_LISTPACK_ENTRIES 128
+#define REDIS_HASH_MAX_LISTPACK_VALUE 64
+#define REDIS_SET_MAX_INTSET_ENTRIES 512
+#define REDIS_SET_MAX_LISTPACK_ENTRIES 128
+#define REDIS_SET_MAX_LISTPACK_VALUE 64
+#define REDIS_LIST_MAX_LISTPACK_ENTRIES 128
+#define REDIS_LIST_MAX_LISTPACK_VALUE 64
+
+#define REDIS_LIST_HEAD 0
+#define REDIS_LIST_TAIL 1
 
 #define RDB_SAVE_NONE 0
 #define RDB_SAVE_AOF_PREAMBLE (1<<0)
+#define RDB_SAVE_SNAPSHOT (1<<1) /* Forkless, the shards are saved by Rdb::rdbSnapshotShard() */
+#define RDB_SAVE_REPLICATION (1<<2) /* Snapshot for a full resync, cut at a replication offset */
 
 
 #define LONG_STR_SIZE      21          /* Bytes needed for long -> str + '\0' */
@@ -0,0 +1,475 @@
+#include "aof.h"
+#include "redis.h"
+
+/* Above this many bytes left in the rewrite buffer rewriteDone() writes
+ * them out without holding the mutex. */
+const static size_t kRewriteTail = 64 * 1024;
+
+static int32_t aofFsync(int32_t fd) {
+#ifdef __linux__
+    return ::fdatasync(fd);
+#elif defined(_WIN64)
+    return ::_commit(fd);
+#else
+    return ::fsync(fd);
+#endif
+}
+
+static bool aofWriteAll(int32_t fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = ::write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+Aof::Aof(Redis *redis)
+        : redis(redis),
+          state(AOF_OFF),
+          fsyncPolicy(AOF_FSYNC_EVERYSEC),
+          currentSize(0),
+          baseSize(0),
+          pending(sdsempty()),
+          pendingOffset(0),
+          threadStarted(false),
+          closeRequested(false),
+          rewriting(false),
+          rewriteBuffer(nullptr),
+          switchFd(-1),
+          switchPending(nullptr),
+          fd(-1) {
+
+}
+
+Aof::~Aof() {
+    sdsfree(pending);
+    sdsfree(rewriteBuffer);
+    sdsfree(switchPending);
+}
+
+void Aof::start(bool rewrite) {
+    std::unique_lock <std::mutex> lck(mutex);
+    if (state != AOF_OFF) {
+        return;
+    }
+
+    closeRequested = false;
+    if (rewrite) {
+        /* Nothing is written until the rewrite has created the file. */
+        state = AOF_WAIT_REWRITE;
+    } else {
+        int32_t newfd = ::open(REDIS_DEFAULT_AOF_FILENGTHAME, O_WRONLY | O_APPEND | O_CREAT, 0644);
+        if (newfd == -1) {
+            LOG_WARN << "Can't open the append-only file: " << strerror(errno);
+            return;
+        }
+
+        struct stat st;
+        if (::fstat(newfd, &st) == 0) {
+            currentSize = st.st_size;
+            baseSize = st.st_size;
+        }
+        switchFd = newfd;
+        switchName.clear();
+        state = AOF_ON;
+    }
+
+    if (!threadStarted) {
+        threadStarted = true;
+        std::thread thread(std::bind(&Aof::syncThread, this));
+        thread.detach();
+    }
+    condition.notify_one();
+}
+
+void Aof::stop() {
+    std::unique_lock <std::mutex> lck(mutex);
+    if (state == AOF_OFF) {
+        return;
+    }
+
+    /* A rewrite still running notices in rewriteDone(). */
+    state = AOF_OFF;
+    closeRequested = true;
+    condition.notify_one();
+}
+
+int64_t Aof::feed(const char *buf, size_t len, bool cut) {
+    std::unique_lock <std::mutex> lck(mutex);
+    pending = sdscatlen(pending, buf, len);
+    pendingOffset += len;
+    if (rewriting && cut) {
+        rewriteBuffer = sdscatlen(rewriteBuffer, buf, len);
+    }
+    condition.notify_one();
+    return pendingOffset;
+}
+
+int64_t Aof::feedCommand(const char *name, const std::deque <RedisObjectPtr> &obj, bool cut) {
+    std::vector <std::string_view> argv;
+    for (auto &it : obj) {
+        argv.emplace_back(it->ptr, sdslen(it->ptr));
+    }
+
+    Buffer buffer;
+    catCommand(&buffer, name, argv);
+    return feed(buffer.peek(), buffer.readableBytes(), cut);
+}
+
+/* A time to live counts from when the command ran, loading the file later
+ * would start it over. SET EX/PX and RESTORE are logged with the unix time
+ * in milliseconds the key expires at instead. */
+static bool aofAbsoluteExpire(const std::string_view &name, const std::vector <std::string_view> &argv,
+                              std::vector <std::string_view> *out, char *when, size_t size) {
+    int64_t ttl;
+    if (name.size() == 3 && !strncasecmp(name.data(), "set", 3)) {
+        for (size_t j = 2; j + 1 < argv.size(); j++) {
+            const std::string_view &a = argv[j];
+            if (a.size() != 2 || (a[1] != 'x' && a[1] != 'X')) {
+                return false;
+            }
+
+            bool seconds = a[0] == 'e' || a[0] == 'E';
+            if (!seconds && a[0] != 'p' && a[0] != 'P') {
+                continue;
+            }
+
+            if (!string2ll(argv[j + 1].data(), argv[j + 1].size(), &ttl) || ttl <= 0) {
+                return false;
+            }
+
+            *out = argv;
+            (*out)[j] = "pxat";
+            (*out)[j + 1] = std::string_view(when, ll2string(when, size,
+                                                               mstime() + (seconds ? ttl * 1000 : ttl)));
+            return true;
+        }
+    } else if (name.size() == 7 && !strncasecmp(name.data(), "restore", 7) && argv.size() >= 3) {
+        if (!string2ll(argv[1].data(), argv[1].size(), &ttl) || ttl <= 0) {
+            return false;
+        }
+
+        for (size_t j = 3; j < argv.size(); j++) {
+            if (argv[j] == "absttl") {
+                return false;
+            }
+        }
+
+        *out = argv;
+        (*out)[1] = std::string_view(when, ll2string(when, size, mstime() + ttl));
+        out->emplace_back("absttl");
+        return true;
+    }
+    return false;
+}
+
+void Aof::catCommand(Buffer *buffer, const std::string_view &name,
+                     const std::vector <std::string_view> &argv) {
+    std::vector <std::string_view> absolute;
+    char when[32];
+    if (aofAbsoluteExpire(name, argv, &absolute, when, sizeof(when))) {
+        catCommand(buffer, name, absolute);
+        return;
+    }
+
+    char buf[32];
+    int32_t len = snprintf(buf, sizeof(buf), "*%zu\r\n$%zu\r\n", argv.size() + 1, name.size());
+    buffer->append(buf, len);
+    buffer->append(name.data(), name.size());
+    buffer->append("\r\n", 2);
+
+    for (auto &it : argv) {
+        len = snprintf(buf, sizeof(buf), "$%zu\r\n", it.size());
+        buffer->append(buf, len);
+        buffer->append(it.data(), it.size());
+        buffer->append("\r\n", 2);
+    }
+}
+
+bool Aof::waitSync(int64_t offset, Functor &&cb) {
+    if (fsyncPolicy != AOF_FSYNC_ALWAYS || state != AOF_ON) {
+        return false;
+    }
+
+    std::unique_lock <std::mutex> lck(mutex);
+    waiters.emplace(offset, std::move(cb));
+    condition.notify_one();
+    return true;
+}
+
+/* Write what the loops fed, fsync as the policy asks and then answer the
+ * sessions waiting for it. Everything fed while a round is on the disk
+ * goes out together in the next one. */
+void Aof::syncThread() {
+    sds buf = sdsempty();
+    int64_t lastFsync = mstime();
+    bool dirty = false;
+    while (true) {
+        int32_t newfd;
+        sds old;
+        std::string name;
+        bool close;
+        int64_t end;
+        std::multimap <int64_t, Functor> done;
+        {
+            std::unique_lock <std::mutex> lck(mutex);
+            while (sdslen(pending) == 0 && switchFd == -1 && !closeRequested &&
+                   (waiters.empty() || waiters.begin()->first > pendingOffset)) {
+                if (!dirty) {
+                    condition.wait(lck);
+                } else if (condition.wait_for(lck, std::chrono::milliseconds(
+                        std::max<int64_t>(1, lastFsync + 1000 - mstime()))) == std::cv_status::timeout) {
+                    break;
+                }
+            }
+
+            std::swap(buf, pending);
+            end = pendingOffset;
+            newfd = switchFd;
+            old = switchPending;
+            name = switchName;
+            close = closeRequested;
+            switchFd = -1;
+            switchPending = nullptr;
+            closeRequested = false;
+        }
+
+        if (newfd != -1) {
+            if (old != nullptr && fd != -1) {
+                aofWriteAll(fd, old, sdslen(old));
+            }
+            switchFile(newfd, old, name);
+            dirty = false;
+        }
+
+        if (fd != -1 && sdslen(buf) > 0) {
+            if (!aofWriteAll(fd, buf, sdslen(buf))) {
+                LOG_WARN << "Error writing to the AOF file: " << strerror(errno);
+            } else {
+                currentSize += sdslen(buf);
+                dirty = true;
+            }
+        }
+        sdsclear(buf);
+
+        int64_t now = mstime();
+        if (fd != -1 && dirty && (fsyncPolicy == AOF_FSYNC_ALWAYS || close ||
+                                  (fsyncPolicy == AOF_FSYNC_EVERYSEC && now - lastFsync >= 1000))) {
+            aofFsync(fd);
+            lastFsync = now;
+            dirty = false;
+        }
+
+        if (close && fd != -1) {
+            ::close(fd);
+            fd = -1;
+        }
+
+        {
+            std::unique_lock <std::mutex> lck(mutex);
+            auto it = waiters.upper_bound(end);
+            done.insert(waiters.begin(), it);
+            waiters.erase(waiters.begin(), it);
+        }
+
+        for (auto &it : done) {
+            it.second();
+        }
+    }
+}
+
+/* Carry on with 'newfd'. A rewritten file replaces the old one once it is
+ * on disk, if that fails the old file still has every command. */
+void Aof::switchFile(int32_t newfd, sds old, const std::string &filename) {
+    sdsfree(old);
+    if (!filename.empty()) {
+        if (aofFsync(newfd) == -1 || ::rename(filename.c_str(), REDIS_DEFAULT_AOF_FILENGTHAME) == -1) {
+            LOG_WARN << "Error trying to rename the temporary AOF file: " << strerror(errno);
+            ::close(newfd);
+            ::unlink(filename.c_str());
+            return;
+        }
+    }
+
+    if (fd != -1) {
+        aofFsync(fd);
+        ::close(fd);
+    }
+    fd = newfd;
+
+    struct stat st;
+    if (::fstat(fd, &st) == 0) {
+        currentSize = st.st_size;
+        baseSize = st.st_size;
+    }
+}
+
+/* Replay the file through the command handlers, after the RDB preamble if
+ * it starts with one. A command cut short by a crash at the end of the file
+ * is dropped and the file truncated before it. */
+int32_t Aof::loadAppendOnlyFile(const char *filename, int32_t threads) {
+    FILE *fp;
+    if ((fp = ::fopen(filename, "r")) == nullptr) {
+        return REDIS_ERR;
+    }
+
+    char sig[5];
+    bool preamble = ::fread(sig, 1, sizeof(sig), fp) == sizeof(sig) && memcmp(sig, "REDIS", 5) == 0;
+    ::rewind(fp);
+    if (preamble) {
+        Rio rdb;
+        redis->getRdb()->rioInitWithFile(&rdb, fp);
+        if (redis->getRdb()->rdbLoadRio(&rdb, threads) == REDIS_ERR) {
+            LOG_WARN << "Error reading the RDB preamble of the AOF file";
+            ::fclose(fp);
+            return REDIS_ERR;
+        }
+    }
+
+    /* The handlers want a connection to reply to, it never goes out. */
+    TcpConnectionPtr conn(new TcpConnection(redis->getEventLoop(), -1, nullptr));
+    conn->setState(TcpConnection::kDisconnected);
+
+    int64_t valid = ::ftell(fp);
+    size_t commands = 0;
+    int32_t retval = REDIS_OK;
+    std::deque <RedisObjectPtr> obj;
+    RespParser parser;
+    Buffer buffer;
+    char buf[PROTO_IOBUF_LENGTH];
+    size_t n;
+    while (retval == REDIS_OK && (n = ::fread(buf, 1, sizeof(buf), fp)) > 0) {
+        buffer.append(buf, n);
+        while (parser.parse(&buffer) == REDIS_OK) {
+            if (!parser.getCommand().empty()) {
+                const std::string_view &name = parser.getCommand();
+                const RedisCommand *command = lookupCommand(name);
+                if (command == nullptr) {
+                    LOG_WARN << "Unknown command '" << std::string(name) << "' reading the append only file";
+                    retval = REDIS_ERR;
+                    break;
+                }
+
+                for (auto &it : parser.getArgv()) {
+                    obj.push_back(createStringObject((char *) it.data(), it.size()));
+                }
+                (redis->*command->proc)(obj, nullptr, conn);
+                conn->outputBuffer()->retrieveAll();
+                obj.clear();
+                commands++;
+            }
+
+            size_t readable = buffer.readableBytes();
+            parser.consume(&buffer);
+            valid += readable - buffer.readableBytes();
+        }
+
+        if (parser.getError()) {
+            LOG_WARN << "Bad file format reading the append only file: " << parser.getError();
+            retval = REDIS_ERR;
+        }
+    }
+    ::fclose(fp);
+
+    if (retval == REDIS_OK && buffer.readableBytes() > 0) {
+        LOG_WARN << "!!! Warning: short read while loading the AOF file !!!, truncating it to "
+                 << valid << " bytes";
+        if (::truncate(filename, valid) == -1) {
+            LOG_WARN << "Error truncating the AOF file: " << strerror(errno);
+        }
+    }
+
+    LOG_INFO << "AOF loaded " << commands << " commands" << (preamble ? " after an RDB preamble" : "");
+    return retval;
+}
+
+bool Aof::isRewriting() {
+    std::unique_lock <std::mutex> lck(mutex);
+    return rewriting;
+}
+
+bool Aof::rewriteNeeded() {
+    if (state != AOF_ON || currentSize < REDIS_AOF_REWRITE_MIN_SIZE || isRewriting()) {
+        return false;
+    }
+
+    int64_t base = std::max<int64_t>(baseSize, 1);
+    return (currentSize - base) * 100 / base >= REDIS_AOF_REWRITE_PERC;
+}
+
+/* Must come before the snapshot starts, so that every command finding it
+ * running is kept in the rewrite buffer. */
+bool Aof::rewriteStart() {
+    std::unique_lock <std::mutex> lck(mutex);
+    if (rewriting) {
+        return false;
+    }
+
+    rewriting = true;
+    sdsfree(rewriteBuffer);
+    rewriteBuffer = sdsempty();
+    return true;
+}
+
+void Aof::rewriteDone(const char *filename, bool success) {
+    int32_t newfd = -1;
+    if (success && state != AOF_OFF) {
+        newfd = ::open(filename, O_WRONLY | O_APPEND);
+    }
+
+    std::unique_lock <std::mutex> lck(mutex);
+    if (newfd == -1) {
+        LOG_WARN << "Background AOF rewrite failed";
+        rewriting = false;
+        sdsfree(rewriteBuffer);
+        rewriteBuffer = nullptr;
+        ::unlink(filename);
+        return;
+    }
+
+    /* Most of the buffer goes out while the loops keep feeding. */
+    bool ok = true;
+    while (ok && sdslen(rewriteBuffer) > kRewriteTail) {
+        sds buf = rewriteBuffer;
+        rewriteBuffer = sdsempty();
+        lck.unlock();
+        ok = aofWriteAll(newfd, buf, sdslen(buf));
+        sdsfree(buf);
+        lck.lock();
+    }
+
+    /* The rest under the mutex: from here on fed commands belong to the
+     * new file, the ones fed before are in the old one or in the rewrite. */
+    ok = ok && aofWriteAll(newfd, rewriteBuffer, sdslen(rewriteBuffer));
+    rewriting = false;
+    sdsfree(rewriteBuffer);
+    rewriteBuffer = nullptr;
+    if (!ok || state == AOF_OFF) {
+        LOG_WARN << "Background AOF rewrite failed: " << strerror(errno);
+        ::close(newfd);
+        ::unlink(filename);
+        return;
+    }
+
+    if (switchFd != -1) {
+        /* start() opened the file and the sync thread has not switched to
+         * it yet, the rewrite supersedes it. */
+        ::close(switchFd);
+    }
+
+    sdsfree(switchPending);
+    switchPending = pending;
+    pending = sdsempty();
+    switchFd = newfd;
+    switchName = filename;
+    state = AOF_ON;
+    condition.notify_one();
+    LOG_INFO << "Background AOF rewrite terminated with success";
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "all.h"
+#include "buffer.h"
+#include "object.h"
+#include "sds.h"
+
+class Redis;
+
+/* Append only file. Sessions hand over every batch of write commands in
+ * RESP once the batch ran, a dedicated thread writes whatever has piled up
+ * from all loops with one write() and, depending on the policy, one fsync,
+ * so several batches share the cost of a disk flush and no event loop ever
+ * waits for the disk.
+ *
+ * The file is rewritten from a forkless snapshot of the shards, see
+ * Rdb::rdbSaveSnapshotBackground(), saved as an RDB preamble followed by
+ * the commands that ran while the snapshot was taken. */
+class Aof {
+public:
+    typedef std::function<void()> Functor;
+
+    Aof(Redis *redis);
+
+    ~Aof();
+
+    /* Start appending to the file if it exists, or wait for a rewrite to
+     * create it with the current data set. */
+    void start(bool rewrite);
+
+    void stop();
+
+    bool isEnabled() const { return state != AOF_OFF; }
+
+    bool isWaitingRewrite() const { return state == AOF_WAIT_REWRITE; }
+
+    void setFsync(int32_t policy) { fsyncPolicy = policy; }
+
+    int32_t getFsync() const { return fsyncPolicy; }
+
+    /* Append a batch of commands. 'cut' tells whether the commands found a
+     * snapshot running before they touched their keys, only those are left
+     * out of the snapshot a rewrite is based on. Returns the offset the
+     * batch ends at in the stream of everything fed so far. */
+    int64_t feed(const char *buf, size_t len, bool cut);
+
+    int64_t feedCommand(const char *name, const std::deque <RedisObjectPtr> &obj, bool cut);
+
+    static void catCommand(Buffer *buffer, const std::string_view &name,
+                           const std::vector <std::string_view> &argv);
+
+    /* With the always policy, have 'cb' called from the sync thread once
+     * everything up to 'offset' is on disk. Returns false if there is
+     * nothing to wait for. */
+    bool waitSync(int64_t offset, Functor &&cb);
+
+    int32_t loadAppendOnlyFile(const char *filename, int32_t threads);
+
+    bool isRewriting();
+
+    bool rewriteNeeded();
+
+    /* Returns false if a rewrite is running already. */
+    bool rewriteStart();
+
+    /* Called by the snapshot thread once the preamble is in 'filename'. */
+    void rewriteDone(const char *filename, bool success);
+
+    int64_t getCurrentSize() const { return currentSize; }
+
+    int64_t getBaseSize() const { return baseSize; }
+
+private:
+    Aof(const Aof &);
+
+    void operator=(const Aof &);
+
+    void syncThread();
+
+    void switchFile(int32_t newfd, sds old, const std::string &filename);
+
+    Redis *redis;
+    std::atomic <int32_t> state;
+    std::atomic <int32_t> fsyncPolicy;
+    std::atomic <int64_t> currentSize;
+    std::atomic <int64_t> baseSize;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::multimap <int64_t, Functor> waiters;
+    sds pending;
+    int64_t pendingOffset;
+    bool threadStarted;
+    bool closeRequested;
+
+    bool rewriting;
+    sds rewriteBuffer;
+
+    /* Set by rewriteDone() or start(), the sync thread writes 'switchPending'
+     * to the old file and carries on with 'switchFd'. */
+    int32_t switchFd;
+    sds switchPending;
+    std::string switchName;
+
+    /* Only touched by the sync thread. */
+    int32_t fd;
+};
@@ -1,27 +1,355 @@
 #include "buffer.h"
+#include "zmalloc.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define BUFFER_SSE2
+#endif
 
 const char Buffer::kCRLF[] = "\r\n";
 const char Buffer::CONTENT[] = "Content-Length";
 const int32_t Buffer::kCheapPrepend;
 const int32_t Buffer::kInitialSize;
+char Buffer::kEmptySlab[Buffer::kCheapPrepend];
+
+const int32_t BufferPool::kMinShift;
+const int32_t BufferPool::kMaxShift;
+const int32_t BufferPool::kMinSlab;
+const int32_t BufferPool::kMaxSlab;
+const int32_t BufferPool::kCacheBytes;
+
+/* Slabs cached by a thread, one list per size linked through the first
+ * bytes of the slabs, which are in the prepend area of a buffer. Plain data,
+ * so reaching it costs no check for construction, the cache is emptied at
+ * thread exit by a SlabReaper armed the first time a slab is kept. */
+struct SlabCache {
+    static const int32_t kSizes = BufferPool::kMaxShift - BufferPool::kMinShift + 1;
+
+    char *heads[kSizes];
+    int32_t counts[kSizes];
+    bool armed;
+    bool destroyed;
+};
+
+struct SlabReaper {
+    ~SlabReaper();
+
+    void arm() {}
+};
+
+static thread_local SlabCache slabCache;
+
+static thread_local SlabReaper slabReaper;
+
+SlabReaper::~SlabReaper() {
+    BufferPool::trim();
+    slabCache.destroyed = true;
+}
+
+static inline char *&nextSlab(char *slab) {
+    return *reinterpret_cast<char **>(slab);
+}
+
+static inline int32_t slabIndex(int32_t size) {
+    if (size <= BufferPool::kMinSlab) {
+        return 0;
+    }
+#ifdef _WIN64
+    unsigned long idx;
+    _BitScanReverse(&idx, size - 1);
+    return idx + 1 - BufferPool::kMinShift;
+#else
+    return 32 - __builtin_clz(size - 1) - BufferPool::kMinShift;
+#endif
+}
+
+char *BufferPool::allocate(int32_t size, int32_t *capacity) {
+    if (size > kMaxSlab) {
+        *capacity = size;
+        return static_cast<char *>(zmalloc(size));
+    }
+
+    int32_t index = slabIndex(size);
+    *capacity = kMinSlab << index;
+    char *slab = slabCache.heads[index];
+    if (slab == nullptr) {
+        return static_cast<char *>(zmalloc(*capacity));
+    }
+
+    slabCache.heads[index] = nextSlab(slab);
+    slabCache.counts[index]--;
+    return slab;
+}
+
+void BufferPool::release(char *slab, int32_t capacity) {
+    if (capacity > kMaxSlab || slabCache.destroyed) {
+        zfree(slab);
+        return;
+    }
+
+    int32_t index = slabIndex(capacity);
+    assert(capacity == (kMinSlab << index));
+    if (slabCache.counts[index] >= std::max(kCacheBytes >> (kMinShift + index), 1)) {
+        zfree(slab);
+        return;
+    }
+
+    if (!slabCache.armed) {
+        slabReaper.arm();
+        slabCache.armed = true;
+    }
+
+    nextSlab(slab) = slabCache.heads[index];
+    slabCache.heads[index] = slab;
+    slabCache.counts[index]++;
+}
+
+void BufferPool::trim() {
+    for (int32_t i = 0; i < SlabCache::kSizes; i++) {
+        while (slabCache.heads[i] != nullptr) {
+            char *slab = slabCache.heads[i];
+            slabCache.heads[i] = nextSlab(slab);
+            zfree(slab);
+        }
+        slabCache.counts[i] = 0;
+    }
+}
+
+size_t BufferPool::cachedBytes() {
+    size_t bytes = 0;
+    for (int32_t i = 0; i < SlabCache::kSizes; i++) {
+        bytes += size_t(slabCache.counts[i]) * (kMinSlab << i);
+    }
+    return bytes;
+}
+
+void Buffer::grow(int32_t len) {
+    int32_t readable = readableBytes();
+    int32_t size = std::max(kCheapPrepend + readable + len,
+                            buffer == kEmptySlab ? kInitialSize : 2 * capacity);
+    int32_t newCapacity;
+    char *slab = BufferPool::allocate(size, &newCapacity);
+    if (readable > 0) {
+        memcpy(slab + kCheapPrepend, peek(), readable);
+    }
+    releaseSlab();
+    buffer = slab;
+    capacity = newCapacity;
+    readerIndex = kCheapPrepend;
+    writerIndex = kCheapPrepend + readable;
+}
+
+void Buffer::shrink(int32_t reserve) {
+    int32_t readable = readableBytes();
+    if (readable + reserve == 0) {
+        readerIndex = kCheapPrepend;
+        writerIndex = kCheapPrepend;
+        releaseSlab();
+        return;
+    }
+
+    int32_t newCapacity;
+    char *slab = BufferPool::allocate(kCheapPrepend + readable + reserve, &newCapacity);
+    memcpy(slab + kCheapPrepend, peek(), readable);
+    releaseSlab();
+    buffer = slab;
+    capacity = newCapacity;
+    readerIndex = kCheapPrepend;
+    writerIndex = kCheapPrepend + readable;
+}
+
+const char *Buffer::findCRLF(const char *start, const char *end) {
+    const char *p = start;
+#ifdef BUFFER_SSE2
+    /* Compare every byte with '\r' and the byte after it with '\n', a set
+     * bit in the mask is the position of a full CRLF. */
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    while (end - p > 16) {
+        __m128i lo = _mm_loadu_si128((const __m128i *) p);
+        __m128i hi = _mm_loadu_si128((const __m128i *) (p + 1));
+        uint32_t mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(lo, cr),
+                                                        _mm_cmpeq_epi8(hi, lf)));
+        if (mask) {
+#ifdef _WIN64
+            unsigned long idx;
+            _BitScanForward(&idx, mask);
+            return p + idx;
+#else
+            return p + __builtin_ctz(mask);
+#endif
+        }
+        p += 16;
+    }
+#endif
+
+    for (; end - p > 1; p++) {
+        if (p[0] == '\r' && p[1] == '\n') {
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+void Buffer::appendRef(const char *data, size_t len, const std::shared_ptr<void> &holder) {
+    refs.push_back(Ref{size_t(readableBytes()), data, len, holder});
+}
+
+void Buffer::appendBuffer(Buffer *buf) {
+    size_t offset = 0;
+    for (size_t i = buf->firstRef; i < buf->refs.size(); i++) {
+        Ref &it = buf->refs[i];
+        append(buf->peek() + offset, it.offset - offset);
+        offset = it.offset;
+        refs.push_back(Ref{size_t(readableBytes()), it.data, it.len, std::move(it.holder)});
+    }
+
+    append(buf->peek() + offset, buf->readableBytes() - offset);
+    buf->retrieveAll();
+}
+
+void Buffer::copyRefs() {
+    if (!hasRefs()) {
+        return;
+    }
+
+    std::vector <Ref> pending;
+    pending.swap(refs);
+    size_t first = firstRef;
+    firstRef = 0;
+    std::string stored = retrieveAllAsString();
+    size_t offset = 0;
+    for (size_t i = first; i < pending.size(); i++) {
+        Ref &it = pending[i];
+        append(stored.data() + offset, it.offset - offset);
+        offset = it.offset;
+        append(it.data, it.len);
+    }
+    append(stored.data() + offset, stored.size() - offset);
+}
+
+void Buffer::retrieveWritten(size_t len) {
+    while (len > 0) {
+        size_t stored = hasRefs() ? refs[firstRef].offset : readableBytes();
+        if (stored > 0) {
+            size_t n = std::min(len, stored);
+            readerIndex += n;
+            for (size_t i = firstRef; i < refs.size(); i++) {
+                refs[i].offset -= n;
+            }
+            len -= n;
+            continue;
+        }
+
+        Ref &ref = refs[firstRef];
+        size_t n = std::min(len, ref.len);
+        ref.data += n;
+        ref.len -= n;
+        len -= n;
+        if (ref.len == 0) {
+            ref.holder.reset();
+            if (++firstRef == refs.size()) {
+                refs.clear();
+                firstRef = 0;
+            }
+        }
+    }
+
+    if (readableBytes() == 0 && !hasRefs()) {
+        retrieveAll();
+    }
+}
+
+int32_t Buffer::fillIovec(IOV_TYPE *vec, int32_t maxIovec) {
+    int32_t count = 0;
+    size_t offset = 0;
+
+    auto push = [&](const char *data, size_t len) {
+#ifdef _WIN64
+        vec[count].buf = const_cast<char *>(data);
+        vec[count].len = len;
+#else
+        vec[count].iov_base = const_cast<char *>(data);
+        vec[count].iov_len = len;
+#endif
+        count++;
+    };
+
+    /* Stored bytes and references interleave, every reference can need
+     * two entries. Whatever does not fit goes out with the next call. */
+    bool complete = true;
+    for (size_t i = firstRef; i < refs.size(); i++) {
+        const Ref &it = refs[i];
+        if (count + 2 > maxIovec) {
+            complete = false;
+            break;
+        }
+
+        if (it.offset > offset) {
+            push(peek() + offset, it.offset - offset);
+            offset = it.offset;
+        }
+        push(it.data, it.len);
+    }
+
+    if (complete && offset < readableBytes()) {
+        push(peek() + offset, readableBytes() - offset);
+    }
+    return count;
+}
+
+ssize_t Buffer::writeFd(int32_t fd, int32_t *savedErrno) {
+    const int32_t kMaxIovec = 64;
+    IOV_TYPE vec[kMaxIovec];
+    int32_t count = fillIovec(vec, kMaxIovec);
+    const ssize_t n = Socket::writev(fd, vec, count);
+    if (n < 0) {
+        *savedErrno = errno;
+    } else {
+        retrieveWritten(n);
+    }
+    return n;
+}
 
 ssize_t Buffer::readFd(int32_t fd, int32_t *saveErrno) {
-    char extrabuf[65536];
-    IOV_TYPE vec[2];
+    const int32_t kExtraRead = 65536;
+    if (buffer == kEmptySlab) {
+        grow(0);
+    }
+
+    /* What does not fit is read straight into the slab the buffer would grow
+     * to, behind the place the bytes held now go to. Only those are copied
+     * when it is taken, the bytes read never are, and it goes back to the
+     * pool unused otherwise. */
     const int32_t writable = writableBytes();
+    const int32_t head = kCheapPrepend + readableBytes() + writable;
+    char *extra = nullptr;
+    int32_t extraCapacity = 0;
+    int32_t extraOffset = head;
+    if (writable < kExtraRead) {
+        if (2 * capacity <= BufferPool::kMaxSlab) {
+            extra = BufferPool::allocate(std::max(2 * capacity, kExtraRead), &extraCapacity);
+        } else {
+            /* Past the cached sizes the overflow is only a place to read
+             * to, appended from there. */
+            extra = BufferPool::allocate(kExtraRead, &extraCapacity);
+            extraOffset = 0;
+        }
+    }
+
+    IOV_TYPE vec[2];
 #ifdef _WIN64
     vec[0].buf = begin() + writerIndex;
     vec[0].len = writable;
-    vec[1].buf = extrabuf;
-    vec[1].len = sizeof(extrabuf);
+    vec[1].buf = extra + extraOffset;
+    vec[1].len = extraCapacity - extraOffset;
 #else
     vec[0].iov_base = begin() + writerIndex;
     vec[0].iov_len = writable;
-    vec[1].iov_base = extrabuf;
-    vec[1].iov_len = sizeof extrabuf;
+    vec[1].iov_base = extra + extraOffset;
+    vec[1].iov_len = extraCapacity - extraOffset;
 #endif
-    const int iovcnt = (writable < sizeof(extrabuf)) ? 2 : 1;
-    const ssize_t n = Socket::readv(fd, vec, iovcnt);
+    const ssize_t n = Socket::readv(fd, vec, extra != nullptr ? 2 : 1);
     if (n < 0) {
 #ifdef _WIN64
         *saveErrno = GetLastError();
@@ -30,9 +358,26 @@ ssize_t Buffer::readFd(int32_t fd, int32_t *saveErrno) {
 #endif
     } else if (n <= writable) {
         writerIndex += n;
+    } else if (extraOffset == 0) {
+        writerIndex = capacity;
+        append(extra, n - writable);
     } else {
-        writerIndex = buffer.size();
-        append(extrabuf, n - writable);
+        memcpy(extra + kCheapPrepend, peek(), head - kCheapPrepend);
+        releaseSlab();
+        buffer = extra;
+        capacity = extraCapacity;
+        readerIndex = kCheapPrepend;
+        writerIndex = head + (n - writable);
+        extra = nullptr;
+    }
+
+    if (extra != nullptr) {
+        BufferPool::release(extra, extraCapacity);
+    }
+
+    /* Nothing was read into an empty buffer, keep it empty. */
+    if (readableBytes() == 0 && !hasRefs()) {
+        releaseSlab();
     }
     return n;
 }
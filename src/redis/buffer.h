@@ -4,24 +4,69 @@
 #include "util.h"
 #include "socket.h"
 
+/* Power of two slabs from kMinSlab to kMaxSlab bytes for the storage of
+ * buffers, recycled through free lists kept per thread. A slab released
+ * goes to the cache of the releasing thread, which keeps up to kCacheBytes
+ * of every size and at least one slab, and the next buffer of that thread
+ * needing that size takes it back without going to malloc. kMaxSlab holds
+ * the biggest argument a request may have, bigger slabs are not cached. */
+class BufferPool {
+public:
+    static const int32_t kMinShift = 10;
+    static const int32_t kMaxShift = 23;
+    static const int32_t kMinSlab = 1 << kMinShift;
+    static const int32_t kMaxSlab = 1 << kMaxShift;
+    static const int32_t kCacheBytes = 1 << 19;
+
+    /* A slab of at least 'size' bytes, its actual size goes to 'capacity'. */
+    static char *allocate(int32_t size, int32_t *capacity);
+
+    static void release(char *slab, int32_t capacity);
+
+    /* Free the slabs cached by the calling thread. */
+    static void trim();
+
+    /* Bytes of slabs cached by the calling thread. */
+    static size_t cachedBytes();
+
+private:
+    BufferPool();
+};
+
+/* Bytes in one slab from the BufferPool. An empty buffer holds no slab, it
+ * takes one when written to and gives it back once everything was read, so
+ * an idle connection costs no buffer memory at all. */
 class Buffer {
 public:
     static const int32_t kCheapPrepend = 16;
-    static const int32_t kInitialSize = 1024;
+    static const int32_t kInitialSize = BufferPool::kMinSlab;
 
-    explicit Buffer(int32_t initialSize = kInitialSize)
-            : buffer(kCheapPrepend + initialSize),
+    Buffer()
+            : buffer(kEmptySlab),
+              capacity(kCheapPrepend),
               readerIndex(kCheapPrepend),
-              writerIndex(kCheapPrepend) {
-        assert(readableBytes() == 0);
-        assert(writableBytes() == initialSize);
-        assert(prependableBytes() == kCheapPrepend);
+              writerIndex(kCheapPrepend),
+              firstRef(0) {
+
+    }
+
+    /* Takes the slab, 'rhs' is left empty. */
+    Buffer(Buffer &&rhs)
+            : Buffer() {
+        swap(rhs);
+    }
+
+    ~Buffer() {
+        releaseSlab();
     }
 
     void swap(Buffer &rhs) {
-        buffer.swap(rhs.buffer);
+        std::swap(buffer, rhs.buffer);
+        std::swap(capacity, rhs.capacity);
         std::swap(readerIndex, rhs.readerIndex);
         std::swap(writerIndex, rhs.writerIndex);
+        refs.swap(rhs.refs);
+        std::swap(firstRef, rhs.firstRef);
     }
 
     int32_t readableBytes() const {
@@ -29,7 +74,7 @@ public:
     }
 
     int32_t writableBytes() const {
-        return buffer.size() - writerIndex;
+        return capacity - writerIndex;
     }
 
     int32_t getWriterIndex() {
@@ -53,17 +98,19 @@ public:
     }
 
     const char *findCRLF() const {
-        const char *crlf = std::search(peek(), beginWrite(), kCRLF, kCRLF + 2);
-        return crlf == beginWrite() ? nullptr : crlf;
+        return findCRLF(peek(), beginWrite());
     }
 
     const char *findCRLF(const char *start) const {
         assert(peek() <= start);
         assert(start <= beginWrite());
-        const char *crlf = std::search(start, beginWrite(), kCRLF, kCRLF + 2);
-        return crlf == beginWrite() ? nullptr : crlf;
+        return findCRLF(start, beginWrite());
     }
 
+    /* Scan [start, end) for "\r\n", 16 bytes at a time where SSE2 is
+     * available. Returns nullptr if there is none. */
+    static const char *findCRLF(const char *start, const char *end);
+
     const char *findEOL() const {
         const void *eol = memchr(peek(), '\n', readableBytes());
         return static_cast<const char *>(eol);
@@ -112,9 +159,13 @@ public:
         retrieve(sizeof(int8_t));
     }
 
+    /* Drops the slab too, it goes back to the pool. */
     void retrieveAll() {
         readerIndex = kCheapPrepend;
         writerIndex = kCheapPrepend;
+        refs.clear();
+        firstRef = 0;
+        releaseSlab();
     }
 
     std::string retrieveAllAsString() {
@@ -189,6 +240,9 @@ public:
     }
 
     void prepend(const void *data, int32_t len) {
+        if (buffer == kEmptySlab) {
+            grow(0);
+        }
         assert(len <= prependableBytes());
         readerIndex -= len;
         const char *d = static_cast<const char *>(data);
@@ -287,26 +341,52 @@ public:
         return std::string_view(peek(), static_cast<int32_t>(readableBytes()));
     }
 
-    void shrink(int32_t reserve) {
-        Buffer other;
-        other.ensureWritableBytes(readableBytes() + reserve);
-        other.append(toStringView());
-        swap(other);
-    }
+    /* Move the stored bytes to the smallest slab with room for 'reserve'
+     * more, or give the slab back if that is none. */
+    void shrink(int32_t reserve);
 
+    /* Size of the slab held, 0 for none. */
     int32_t internalCapacity() const {
-        return buffer.capacity();
+        return buffer == kEmptySlab ? 0 : capacity;
     }
 
     ssize_t readFd(int32_t fd, int32_t *savedErrno);
 
+    /* Queue 'len' bytes at 'data' behind what has been appended so far,
+     * without copying them. 'holder' keeps the memory alive until the bytes
+     * are written by writeFd(). readableBytes() and peek() only cover the
+     * bytes stored in the buffer itself, so a buffer holding references
+     * must be drained with writeFd() or appendBuffer(). */
+    void appendRef(const char *data, size_t len, const std::shared_ptr<void> &holder);
+
+    /* Move everything in 'buf', references included, to the end of this
+     * buffer and leave 'buf' empty. */
+    void appendBuffer(Buffer *buf);
+
+    bool hasRefs() const { return firstRef < refs.size(); }
+
+    /* Copy the referenced bytes in, for a reader that needs all of them at
+     * peek(). */
+    void copyRefs();
+
+    /* Write the stored bytes and the references in order with a single
+     * writev() and drop what was written. */
+    ssize_t writeFd(int32_t fd, int32_t *savedErrno);
+
+    /* Fill 'vec' with the stored bytes and the references in order, as
+     * writeFd() would write them, return the number of entries used. */
+    int32_t fillIovec(IOV_TYPE *vec, int32_t maxIovec);
+
+    /* Drop 'len' bytes sent from what fillIovec() returned. */
+    void retrieveWritten(size_t len);
+
 private:
     Buffer(const Buffer &);
 
     void operator=(const Buffer &);
 
     char *begin() {
-        return &*buffer.begin();
+        return buffer;
     }
 
     char *prepeek() {
@@ -314,12 +394,12 @@ private:
     }
 
     const char *begin() const {
-        return &*buffer.begin();
+        return buffer;
     }
 
     void makeSpace(int32_t len) {
         if (writableBytes() + prependableBytes() < len + kCheapPrepend) {
-            buffer.resize(writerIndex + len);
+            grow(len);
         } else {
             assert(kCheapPrepend < readerIndex);
             int32_t readable = readableBytes();
@@ -332,10 +412,37 @@ private:
         }
     }
 
+    /* Move the readable bytes to a slab with room for 'len' more, at least
+     * twice the size of the one held. */
+    void grow(int32_t len);
+
+    void releaseSlab() {
+        if (buffer != kEmptySlab) {
+            BufferPool::release(buffer, capacity);
+            buffer = kEmptySlab;
+            capacity = kCheapPrepend;
+        }
+    }
+
+    struct Ref {
+        size_t offset; /* Stored bytes in front of it, from readerIndex */
+        const char *data;
+        size_t len;
+        std::shared_ptr<void> holder;
+    };
+
 private:
-    std::vector<char> buffer;
+    char *buffer;
+    int32_t capacity;
     int32_t readerIndex;
     int32_t writerIndex;
+    /* The references not written yet start at firstRef, a vector does not
+     * allocate before the first one, unlike a deque. */
+    std::vector <Ref> refs;
+    size_t firstRef;
+
+    /* Where an empty buffer points, the prepend area only. */
+    static char kEmptySlab[kCheapPrepend];
 
     static const char kCRLF[];
     static const char kCRLFCRLF[];
@@ -38,6 +38,8 @@ class Poll;
 
 class Epoll;
 
+class Uring;
+
 class Thread;
 
 class RedisObject;
@@ -82,6 +84,7 @@ typedef std::shared_ptr <Channel> ChannelPtr;
 typedef std::shared_ptr <TimerQueue> TimerQueuePtr;
 typedef std::shared_ptr <Poll> PollPtr;
 typedef std::shared_ptr <Epoll> EpollPtr;
+typedef std::shared_ptr <Uring> UringPtr;
 typedef std::shared_ptr <Select> SelectPtr;
 typedef std::shared_ptr <Thread> ThreadPtr;
 typedef std::function<void()> TimerCallback;
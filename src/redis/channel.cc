@@ -90,6 +90,42 @@ void Channel::handleEvent() {
     }
 }
 
+void Channel::handleRecv(const char *data, ssize_t n) {
+    std::shared_ptr<void> guard;
+    if (tied) {
+        guard = tie.lock();
+        if (!guard) {
+            return;
+        }
+    }
+
+    eventHandling = true;
+    recvCallback(data, n);
+    eventHandling = false;
+}
+
+void Channel::handleAccept(int32_t fd) {
+    eventHandling = true;
+    acceptCallback(fd);
+    eventHandling = false;
+}
+
+void Channel::handleSendComplete() {
+    std::shared_ptr<void> guard;
+    if (tied) {
+        guard = tie.lock();
+        if (!guard) {
+            return;
+        }
+    }
+
+    eventHandling = true;
+    if (sendCompleteCallback) {
+        sendCompleteCallback();
+    }
+    eventHandling = false;
+}
+
 void Channel::setTie(const std::shared_ptr<void> &obj) {
     tie = obj;
     tied = true;
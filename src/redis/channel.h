@@ -7,6 +7,8 @@ class EventLoop;
 class Channel {
 public:
     typedef std::function<void()> EventCallback;
+    typedef std::function<void(const char *, ssize_t)> RecvCallback;
+    typedef std::function<void(int32_t)> AcceptCallback;
 
     Channel(EventLoop *loop, int32_t fd);
 
@@ -14,6 +16,16 @@ public:
 
     void handleEvent();
 
+    /* Completions of a loop on io_uring: 'n' bytes received at 'data', 0 at
+     * the end of the stream and -errno on error, a connection accepted and
+     * everything queued with EventLoop::queueSend() sent. A channel with a
+     * receive or accept callback gets those instead of readiness for reading. */
+    void handleRecv(const char *data, ssize_t n);
+
+    void handleAccept(int32_t fd);
+
+    void handleSendComplete();
+
     void setTie(const std::shared_ptr<void> &);
 
     void setRevents(int32_t revt) { revents = revt; }
@@ -38,6 +50,22 @@ public:
         errorCallback = std::move(cb);
     }
 
+    void setRecvCallback(const RecvCallback &&cb) {
+        recvCallback = std::move(cb);
+    }
+
+    void setAcceptCallback(const AcceptCallback &&cb) {
+        acceptCallback = std::move(cb);
+    }
+
+    void setSendCompleteCallback(const EventCallback &&cb) {
+        sendCompleteCallback = std::move(cb);
+    }
+
+    bool hasRecvCallback() const { return recvCallback != nullptr; }
+
+    bool hasAcceptCallback() const { return acceptCallback != nullptr; }
+
     bool readEnabled() { return events & kReadEvent; }
 
     bool writeEnabled() { return events & kWriteEvent; }
@@ -96,6 +124,9 @@ private:
     EventCallback writeCallback;
     EventCallback closeCallback;
     EventCallback errorCallback;
+    RecvCallback recvCallback;
+    AcceptCallback acceptCallback;
+    EventCallback sendCompleteCallback;
 
     static const int kNoneEvent;
     static const int kReadEvent;
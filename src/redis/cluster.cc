@@ -79,11 +79,10 @@ void Cluster::readCallback(const TcpConnectionPtr &conn, Buffer *buffer) {
                 auto &redisShards = redis->getRedisShards();
                 for (auto &it : redisShards) {
                     auto &mu = it.mtx;
-                    auto &map = it.redisMap;
                     std::unique_lock <std::mutex> lck(mu);
 
-                    for (auto &iter : map) {
-                        if (iter->type == OBJ_STRING) {
+                    for (auto &iter : it.keySpace) {
+                        if (iter.type == OBJ_STRING) {
 
                         }
                     }
@@ -425,72 +424,14 @@ void Cluster::getKeyInSlot(int32_t hashslot, std::vector <RedisObjectPtr> &keys,
     auto &redisShards = redis->getRedisShards();
     for (auto &it : redisShards) {
         auto &mu = it.mtx;
-        auto &map = it.redisMap;
-        auto &stringMap = it.stringMap;
-        auto &hashMap = it.hashMap;
-        auto &zsetMap = it.zsetMap;
-        auto &setMap = it.setMap;
-        auto &listMap = it.listMap;
-
         std::unique_lock <std::mutex> lck(mu);
-        for (auto &iter : map) {
-            if (iter->type == OBJ_STRING) {
-                auto iterr = stringMap.find(iter);
-                assert(iterr != stringMap.end());
-                assert(iterr->first->type == iter->type);
-                uint32_t slot = keyHashSlot(iter->ptr, sdslen(iter->ptr));
-                if (slot == hashslot) {
-                    keys.push_back(createRawStringObject(OBJ_STRING, iter->ptr, sdslen(iter->ptr)));
-                    if (--count == 0) {
-                        return;
-                    }
-                }
-            } else if (iter->type == OBJ_HASH) {
-                auto iterr = hashMap.find(iter);
-                assert(iterr != hashMap.end());
-                assert(iterr->first->type == iter->type);
-                uint32_t slot = keyHashSlot(iter->ptr, sdslen(iter->ptr));
-                if (slot == hashslot) {
-                    keys.push_back(createRawStringObject(OBJ_HASH, iter->ptr, sdslen(iter->ptr)));
-                    if (--count == 0) {
-                        return;
-                    }
-                }
-            } else if (iter->type == OBJ_LIST) {
-                auto iterr = listMap.find(iter);
-                assert(iterr != listMap.end());
-                assert(iterr->first->type == iter->type);
-                uint32_t slot = keyHashSlot(iter->ptr, sdslen(iter->ptr));
-                if (slot == hashslot) {
-                    keys.push_back(createRawStringObject(OBJ_LIST, iter->ptr, sdslen(iter->ptr)));
-                    if (--count == 0) {
-                        return;
-                    }
-                }
-            } else if (iter->type == OBJ_ZSET) {
-                auto iterr = zsetMap.find(iter);
-                assert(iterr != zsetMap.end());
-                assert(iterr->first->type == iter->type);
-                uint32_t slot = keyHashSlot(iter->ptr, sdslen(iter->ptr));
-                if (slot == hashslot) {
-                    keys.push_back(createRawStringObject(OBJ_ZSET, iter->ptr, sdslen(iter->ptr)));
-                    if (--count == 0) {
-                        return;
-                    }
-                }
-            } else if (iter->type == OBJ_SET) {
-                auto iterr = setMap.find(iter);
-                assert(iterr != setMap.end());
-                assert(iterr->first->type == iter->type);
-                uint32_t slot = keyHashSlot(iter->ptr, sdslen(iter->ptr));
-                if (slot == hashslot) {
-                    keys.push_back(createRawStringObject(OBJ_SET, iter->ptr, sdslen(iter->ptr)));
-                    if (--count == 0) {
-                        return;
-                    }
+        for (auto &iter : it.keySpace) {
+            uint32_t slot = keyHashSlot((char *) iter.getKey(), iter.getKeyLen());
+            if (slot == hashslot) {
+                keys.push_back(iter.createKeyObject());
+                if (--count == 0) {
+                    return;
                 }
-            } else {
-                assert(false);
             }
         }
     }
@@ -0,0 +1,117 @@
+#include "command.h"
+#include "redis.h"
+
+#define REDIS_COMMAND_ENTRY(name, proc, viewProc, arity, firstKey, lastKey, keyStep, flags) \
+    {name, proc, viewProc, arity, firstKey, lastKey, keyStep, flags},
+#define REDIS_COMMAND_NAME(name, ...) name,
+
+static const RedisCommand commandTable[] = {REDIS_COMMAND_TABLE(REDIS_COMMAND_ENTRY)};
+static constexpr const char *commandNames[] = {REDIS_COMMAND_TABLE(REDIS_COMMAND_NAME)};
+static constexpr size_t kCommandCount = sizeof(commandNames) / sizeof(commandNames[0]);
+
+/* FNV-1a over the names with the 0x20 bit forced on, which folds ASCII
+ * letters to lower case. Other bytes may collide with each other after
+ * folding, the final compare against the name sorts that out. */
+static constexpr uint32_t commandHash(const char *s, size_t len, uint32_t seed) {
+    uint32_t h = 2166136261u ^ seed;
+    for (size_t i = 0; i < len; i++) {
+        h ^= uint8_t(s[i]) | 0x20;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static constexpr size_t constLength(const char *s) {
+    size_t len = 0;
+    while (s[len]) {
+        len++;
+    }
+    return len;
+}
+
+/* At least eight slots per command keeps the expected number of seeds to
+ * try small. */
+static constexpr size_t indexSize() {
+    size_t size = 1;
+    while (size < kCommandCount * 8) {
+        size <<= 1;
+    }
+    return size;
+}
+
+struct CommandIndex {
+    const static size_t kSize = indexSize();
+    const static uint8_t kEmpty = 0xff;
+
+    uint32_t seed;
+    uint8_t slots[kSize];
+};
+
+static_assert(kCommandCount < CommandIndex::kEmpty, "command index slots are one byte");
+
+/* Try seeds until every name lands in its own slot. Runs at compile time
+ * only, a change of the table that makes this fail to terminate in time
+ * is a compile error. */
+static constexpr CommandIndex buildCommandIndex() {
+    for (uint32_t seed = 0;; seed++) {
+        CommandIndex index{};
+        index.seed = seed;
+        for (size_t i = 0; i < CommandIndex::kSize; i++) {
+            index.slots[i] = CommandIndex::kEmpty;
+        }
+
+        bool perfect = true;
+        for (size_t i = 0; i < kCommandCount && perfect; i++) {
+            const char *name = commandNames[i];
+            size_t slot = commandHash(name, constLength(name), seed) & (CommandIndex::kSize - 1);
+            if (index.slots[slot] != CommandIndex::kEmpty) {
+                perfect = false;
+            } else {
+                index.slots[slot] = i;
+            }
+        }
+
+        if (perfect) {
+            return index;
+        }
+    }
+}
+
+static constexpr CommandIndex commandIndex = buildCommandIndex();
+
+const RedisCommand *lookupCommand(const std::string_view &name) {
+    size_t slot = commandHash(name.data(), name.size(), commandIndex.seed) & (CommandIndex::kSize - 1);
+    uint8_t idx = commandIndex.slots[slot];
+    if (idx == CommandIndex::kEmpty) {
+        return nullptr;
+    }
+
+    const char *s = commandNames[idx];
+    if (strlen(s) != name.size()) {
+        return nullptr;
+    }
+
+    for (size_t i = 0; i < name.size(); i++) {
+        char c = name[i];
+        if (c >= 'A' && c <= 'Z') {
+            c += 32;
+        }
+
+        if (s[i] != c) {
+            return nullptr;
+        }
+    }
+    return &commandTable[idx];
+}
+
+size_t getCommandCount() {
+    return kCommandCount;
+}
+
+size_t getCommandId(const RedisCommand *command) {
+    return command - commandTable;
+}
+
+const RedisCommand *getCommandById(size_t id) {
+    return &commandTable[id];
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "all.h"
+#include "callback.h"
+#include "object.h"
+
+class Redis;
+
+/* Command flags */
+#define CMD_WRITE (1 << 0)    /* May modify the dataset, propagated to slaves */
+#define CMD_READONLY (1 << 1) /* Never modifies the dataset */
+#define CMD_NOSCRIPT (1 << 2) /* Not allowed from scripts */
+#define CMD_SCRIPT (1 << 3)   /* Runs a script, see Scripting */
+#define CMD_DENYOOM (1 << 4)  /* May add memory, refused above maxmemory */
+
+struct RedisCommand {
+    typedef bool (Redis::*Proc)(const std::deque <RedisObjectPtr> &,
+                                const SessionPtr &, const TcpConnectionPtr &);
+    /* Runs the command on argument slices of the input buffer. Returns
+     * REDIS_ERR without replying if the arguments need 'proc', which is
+     * then called with argument objects. */
+    typedef int32_t (Redis::*ViewProc)(const std::vector <std::string_view> &,
+                                       const SessionPtr &, const TcpConnectionPtr &);
+
+    const char *name;
+    Proc proc;
+    ViewProc viewProc;
+    int32_t arity;    /* Number of arguments with the name, -N means >= N */
+    int32_t firstKey; /* Position of the first key, 0 if there is none */
+    int32_t lastKey;  /* Position of the last key, -1 for the last argument */
+    int32_t keyStep;  /* Distance between two keys */
+    int32_t flags;
+
+    /* Positions count the command name as 0, so the key at 'pos' is
+     * obj[pos - 1] for the argument objects handed to 'proc'. */
+    bool hasKeys() const { return firstKey > 0; }
+
+    bool checkArity(size_t argc) const {
+        return arity > 0 ? argc == arity : argc >= -arity;
+    }
+};
+
+/* Every command the server knows about. Lookup is a compile time perfect
+ * hash over the names, see command.cc. Entries are
+ * X(name, proc, viewProc, arity, firstKey, lastKey, keyStep, flags) */
+#define REDIS_COMMAND_TABLE(X) \
+    X("set", &Redis::setCommand, &Redis::setViewCommand, -3, 1, 1, 1, CMD_WRITE | CMD_DENYOOM) \
+    X("get", &Redis::getCommand, &Redis::getViewCommand, 2, 1, 1, 1, CMD_READONLY) \
+    X("hset", &Redis::hsetCommand, nullptr, 4, 1, 1, 1, CMD_WRITE | CMD_DENYOOM) \
+    X("hget", &Redis::hgetCommand, nullptr, 3, 1, 1, 1, CMD_READONLY) \
+    X("hlen", &Redis::hlenCommand, nullptr, 2, 1, 1, 1, CMD_READONLY) \
+    X("hgetall", &Redis::hgetallCommand, nullptr, 2, 1, 1, 1, CMD_READONLY) \
+    X("lpush", &Redis::lpushCommand, nullptr, -3, 1, 1, 1, CMD_WRITE | CMD_DENYOOM) \
+    X("rpush", &Redis::rpushCommand, nullptr, -3, 1, 1, 1, CMD_WRITE | CMD_DENYOOM) \
+    X("lpop", &Redis::lpopCommand, nullptr, 2, 1, 1, 1, CMD_WRITE) \
+    X("rpop", &Redis::rpopCommand, nullptr, 2, 1, 1, 1, CMD_WRITE) \
+    X("lrange", &Redis::lrangeCommand, nullptr, 4, 1, 1, 1, CMD_READONLY) \
+    X("llen", &Redis::llenCommand, nullptr, 2, 1, 1, 1, CMD_READONLY) \
+    X("lindex", &Redis::lindexCommand, nullptr, 3, 1, 1, 1, CMD_READONLY) \
+    X("lset", &Redis::lsetCommand, nullptr, 4, 1, 1, 1, CMD_WRITE | CMD_DENYOOM) \
+    X("ltrim", &Redis::ltrimCommand, nullptr, 4, 1, 1, 1, CMD_WRITE) \
+    X("linsert", &Redis::linsertCommand, nullptr, 5, 1, 1, 1, CMD_WRITE | CMD_DENYOOM) \
+    X("zadd", &Redis::zaddCommand, nullptr, -4, 1, 1, 1, CMD_WRITE | CMD_DENYOOM) \
+    X("zrange", &Redis::zrangeCommand, nullptr, -4, 1, 1, 1, CMD_READONLY) \
+    X("zcard", &Redis::zcardCommand, nullptr, 2, 1, 1, 1, CMD_READONLY) \
+    X("zrevrange", &Redis::zrevrangeCommand, nullptr, -4, 1, 1, 1, CMD_READONLY) \
+    X("zrem", &Redis::zremCommand, nullptr, -3, 1, 1, 1, CMD_WRITE) \
+    X("zscore", &Redis::zscoreCommand, nullptr, 3, 1, 1, 1, CMD_READONLY) \
+    X("zrank", &Redis::zrankCommand, nullptr, 3, 1, 1, 1, CMD_READONLY) \
+    X("zrevrank", &Redis::zrevrankCommand, nullptr, 3, 1, 1, 1, CMD_READONLY) \
+    X("zrangebyscore", &Redis::zrangebyscoreCommand, nullptr, -4, 1, 1, 1, CMD_READONLY) \
+    X("zrevrangebyscore", &Redis::zrevrangebyscoreCommand, nullptr, -4, 1, 1, 1, CMD_READONLY) \
+    X("zcount", &Redis::zcountCommand, nullptr, 4, 1, 1, 1, CMD_READONLY) \
+    X("scard", &Redis::scardCommand, nullptr, 2, 1, 1, 1, CMD_READONLY) \
+    X("sadd", &Redis::saddCommand, nullptr, -3, 1, 1, 1, CMD_WRITE | CMD_DENYOOM) \
+    X("sismember", &Redis::sismemberCommand, nullptr, 3, 1, 1, 1, CMD_READONLY) \
+    X("smembers", &Redis::smembersCommand, nullptr, 2, 1, 1, 1, CMD_READONLY) \
+    X("dump", &Redis::dumpCommand, nullptr, 2, 1, 1, 1, CMD_READONLY) \
+    X("restore", &Redis::restoreCommand, nullptr, -4, 1, 1, 1, CMD_WRITE | CMD_DENYOOM) \
+    X("del", &Redis::delCommand, nullptr, -2, 1, -1, 1, CMD_WRITE) \
+    X("unlink", &Redis::unlinkCommand, nullptr, -2, 1, -1, 1, CMD_WRITE) \
+    X("ttl", &Redis::ttlCommand, nullptr, 2, 1, 1, 1, CMD_READONLY) \
+    X("incr", &Redis::incrCommand, nullptr, 2, 1, 1, 1, CMD_WRITE | CMD_DENYOOM) \
+    X("decr", &Redis::decrCommand, nullptr, 2, 1, 1, 1, CMD_WRITE | CMD_DENYOOM) \
+    X("keys", &Redis::keysCommand, nullptr, 2, 0, 0, 0, CMD_READONLY) \
+    X("scan", &Redis::scanCommand, nullptr, -2, 0, 0, 0, CMD_READONLY) \
+    X("sscan", &Redis::sscanCommand, nullptr, -3, 1, 1, 1, CMD_READONLY) \
+    X("hscan", &Redis::hscanCommand, nullptr, -3, 1, 1, 1, CMD_READONLY) \
+    X("zscan", &Redis::zscanCommand, nullptr, -3, 1, 1, 1, CMD_READONLY) \
+    X("flushdb", &Redis::flushdbCommand, nullptr, -1, 0, 0, 0, CMD_WRITE) \
+    X("dbsize", &Redis::dbsizeCommand, nullptr, 1, 0, 0, 0, CMD_READONLY) \
+    X("ping", &Redis::pingCommand, nullptr, 1, 0, 0, 0, 0) \
+    X("echo", &Redis::echoCommand, nullptr, 2, 0, 0, 0, 0) \
+    X("save", &Redis::saveCommand, nullptr, 1, 0, 0, 0, CMD_NOSCRIPT) \
+    X("bgsave", &Redis::bgsaveCommand, nullptr, 1, 0, 0, 0, CMD_NOSCRIPT) \
+    X("bgrewriteaof", &Redis::bgrewriteaofCommand, nullptr, 1, 0, 0, 0, CMD_NOSCRIPT) \
+    X("slaveof", &Redis::slaveofCommand, nullptr, 3, 0, 0, 0, CMD_NOSCRIPT) \
+    X("sync", &Redis::syncCommand, nullptr, 1, 0, 0, 0, CMD_NOSCRIPT) \
+    X("psync", &Redis::psyncCommand, nullptr, 3, 0, 0, 0, CMD_NOSCRIPT) \
+    X("command", &Redis::commandCommand, nullptr, -1, 0, 0, 0, 0) \
+    X("config", &Redis::configCommand, nullptr, -2, 0, 0, 0, CMD_NOSCRIPT) \
+    X("auth", &Redis::authCommand, nullptr, 2, 0, 0, 0, CMD_NOSCRIPT) \
+    X("info", &Redis::infoCommand, nullptr, -1, 0, 0, 0, 0) \
+    X("client", &Redis::clientCommand, nullptr, -1, 0, 0, 0, CMD_NOSCRIPT) \
+    X("memory", &Redis::memoryCommand, nullptr, -1, 0, 0, 0, 0) \
+    X("cluster", &Redis::clusterCommand, nullptr, -2, 0, 0, 0, CMD_NOSCRIPT) \
+    X("migrate", &Redis::migrateCommand, nullptr, -6, 0, 0, 0, 0) \
+    X("debug", &Redis::debugCommand, nullptr, -2, 0, 0, 0, CMD_NOSCRIPT) \
+    X("object", &Redis::objectCommand, nullptr, 3, 2, 2, 1, CMD_READONLY) \
+    X("monitor", &Redis::monitorCommand, nullptr, 1, 0, 0, 0, CMD_NOSCRIPT) \
+    X("subscribe", &Redis::subscribeCommand, nullptr, -2, 0, 0, 0, CMD_NOSCRIPT) \
+    X("unsubscribe", &Redis::unsubscribeCommand, nullptr, -1, 0, 0, 0, CMD_NOSCRIPT) \
+    X("psubscribe", &Redis::psubscribeCommand, nullptr, -2, 0, 0, 0, CMD_NOSCRIPT) \
+    X("punsubscribe", &Redis::punsubscribeCommand, nullptr, -1, 0, 0, 0, CMD_NOSCRIPT) \
+    X("publish", &Redis::publishCommand, nullptr, 3, 0, 0, 0, 0) \
+    X("pubsub", &Redis::pubsubCommand, nullptr, -2, 0, 0, 0, 0) \
+    X("slowlog", &Redis::slowlogCommand, nullptr, -2, 0, 0, 0, 0) \
+    X("latency", &Redis::latencyCommand, nullptr, -2, 0, 0, 0, 0) \
+    REDIS_SCRIPT_COMMAND_TABLE(X)
+
+/* Only built with Lua. The keys of a script follow its number of keys,
+ * see Redis::getFirstKey(). */
+#ifdef _LUA
+#define REDIS_SCRIPT_COMMAND_TABLE(X) \
+    X("eval", &Redis::evalCommand, nullptr, -3, 0, 0, 0, CMD_NOSCRIPT | CMD_SCRIPT) \
+    X("evalsha", &Redis::evalshaCommand, nullptr, -3, 0, 0, 0, CMD_NOSCRIPT | CMD_SCRIPT) \
+    X("script", &Redis::scriptCommand, nullptr, -2, 0, 0, 0, CMD_NOSCRIPT)
+#else
+#define REDIS_SCRIPT_COMMAND_TABLE(X)
+#endif
+
+/* Case insensitive lookup, returns nullptr for an unknown command. */
+const RedisCommand *lookupCommand(const std::string_view &name);
+
+/* Commands by position in the table, for per command statistics. */
+size_t getCommandCount();
+
+size_t getCommandId(const RedisCommand *command);
+
+const RedisCommand *getCommandById(size_t id);
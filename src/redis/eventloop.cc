@@ -13,11 +13,16 @@ int createEventfd()
 }
 #endif
 
+bool EventLoop::uringBackend = false;
+
 EventLoop::EventLoop()
         : threadId(std::this_thread::get_id()),
 #ifdef __linux__
 wakeupFd(createEventfd()),
-epoller(new Epoll(this)),
+epoller(uringBackend ? nullptr : new Epoll(this)),
+#ifdef HAVE_IO_URING
+uring(uringBackend ? new Uring(this) : nullptr),
+#endif
 timerQueue(new TimerQueue(this)),
 wakeupChannel(new Channel(this, wakeupFd)),
 #endif
@@ -36,7 +41,8 @@ timerQueue(new TimerQueue(this)),
           currentActiveChannel(nullptr),
           running(false),
           eventHandling(false),
-          callingPendingFunctors(false) {
+          callingPendingFunctors(false),
+          wakeupPending(false) {
     wakeupChannel->setReadCallback(std::bind(&EventLoop::handleRead, this));
     wakeupChannel->enableReading();
 }
@@ -82,9 +88,69 @@ std::thread::id EventLoop::getThreadId() const {
     return threadId;
 }
 
+bool EventLoop::setIoBackend(const char *name) {
+    if (!strcmp(name, "epoll")) {
+        uringBackend = false;
+        return true;
+    }
+
+#ifdef HAVE_IO_URING
+    if (!strcmp(name, "io_uring") && Uring::isSupported()) {
+        uringBackend = true;
+        return true;
+    }
+#endif
+    return false;
+}
+
+const char *EventLoop::getIoBackend() {
+#ifdef __APPLE__
+    return "poll";
+#endif
+
+#ifdef _WIN64
+    return "select";
+#endif
+
+#ifdef __linux__
+    return uringBackend ? "io_uring" : "epoll";
+#endif
+}
+
+bool EventLoop::usingUring() const {
+#ifdef HAVE_IO_URING
+    return uring != nullptr;
+#else
+    return false;
+#endif
+}
+
+void EventLoop::queueSend(Channel *channel, Buffer *buffer) {
+    assertInLoopThread();
+#ifdef HAVE_IO_URING
+    uring->queueSend(channel, buffer);
+#else
+    assert(false);
+#endif
+}
+
+bool EventLoop::isSending(Channel *channel) {
+#ifdef HAVE_IO_URING
+    return uring->isSending(channel);
+#else
+    return false;
+#endif
+}
+
 void EventLoop::updateChannel(Channel *channel) {
     assert(channel->ownerLoop() == this);
     assertInLoopThread();
+#ifdef HAVE_IO_URING
+    if (uring) {
+        uring->updateChannel(channel);
+        return;
+    }
+#endif
     epoller->updateChannel(channel);
 }
 
@@ -96,6 +162,13 @@ void EventLoop::removeChannel(Channel *channel) {
                std::find(activeChannels.begin(),
                          activeChannels.end(), channel) == activeChannels.end());
     }
+
+#ifdef HAVE_IO_URING
+    if (uring) {
+        uring->removeChannel(channel);
+        return;
+    }
+#endif
     epoller->removeChannel(channel);
 }
 
@@ -114,6 +187,11 @@ TimerPtr EventLoop::runAt(TimeStamp &&stamp, double when, bool repeat, TimerCall
 bool EventLoop::hasChannel(Channel *channel) {
     assert(channel->ownerLoop() == this);
     assertInLoopThread();
+#ifdef HAVE_IO_URING
+    if (uring) {
+        return uring->hasChannel(channel);
+    }
+#endif
     return epoller->hasChannel(channel);
 }
 
@@ -141,6 +219,10 @@ void EventLoop::quit() {
 }
 
 void EventLoop::wakeup() {
+    if (wakeupPending.exchange(true, std::memory_order_acq_rel)) {
+        return;
+    }
+
     uint64_t one = 1;
 #ifdef __linux__
     ssize_t n = Socket::write(wakeupFd, &one, sizeof one);
@@ -156,20 +238,22 @@ void EventLoop::wakeup() {
     assert(n == sizeof one);
 }
 
-void EventLoop::runInLoop(Functor &&cb) {
-    if (isInLoopThread()) {
-        cb();
-    } else {
-        queueInLoop(std::move(cb));
+void EventLoop::queueInLoop(TaskQueue::Batch &batch) {
+    if (batch.empty()) {
+        return;
     }
+
+    tasks.push(batch);
+    wakeupForTasks();
 }
 
-void EventLoop::queueInLoop(Functor &&cb) {
-    {
-        std::unique_lock <std::mutex> lk(mutex);
-        pendingFunctors.push_back(std::move(cb));
-    }
+TaskQueue *EventLoop::getTaskQueue() {
+    return &tasks;
+}
 
+void EventLoop::wakeupForTasks() {
+    /* Tasks queued by the loop itself while it handles events run at the
+     * end of the iteration, no need to wake it. */
     if (!isInLoopThread() || callingPendingFunctors) {
         wakeup();
     }
@@ -178,16 +262,12 @@ void EventLoop::queueInLoop(Functor &&cb) {
 void EventLoop::doPendingFunctors() {
     callingPendingFunctors = true;
 
-    {
-        std::unique_lock <std::mutex> lk(mutex);
-        functors.swap(pendingFunctors);
-    }
+    /* Cleared before draining: a task queued after the drain took the
+     * list sees the flag down and wakes the loop again, one queued before
+     * is run by this drain. */
+    wakeupPending.exchange(false, std::memory_order_acq_rel);
+    tasks.drain();
 
-    for (size_t i = 0; i < functors.size(); ++i) {
-        functors[i]();
-    }
-
-    functors.clear();
     callingPendingFunctors = false;
 }
 
@@ -195,7 +275,16 @@ void EventLoop::run() {
     running = true;
     while (running) {
         activeChannels.clear();
+#ifdef HAVE_IO_URING
+        if (uring) {
+            uring->epollWait(&activeChannels);
+        } else {
+            epoller->epollWait(&activeChannels);
+        }
+#else
         epoller->epollWait(&activeChannels);
+#endif
+        timerQueue->updateTime();
         eventHandling = true;
 
         for (auto &it : activeChannels) {
@@ -204,6 +293,11 @@ void EventLoop::run() {
         }
 
         currentActiveChannel = nullptr;
+#ifdef HAVE_IO_URING
+        if (uring) {
+            uring->handleCompletions();
+        }
+#endif
         eventHandling = false;
         doPendingFunctors();
     }
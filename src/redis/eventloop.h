@@ -10,6 +10,7 @@
 
 #ifdef __linux__
 #include "epoll.h"
+#include "uring.h"
 #endif
 
 #ifdef _WIN64
@@ -18,6 +19,7 @@
 
 #include "timer.h"
 #include "callback.h"
+#include "taskqueue.h"
 
 class EventLoop {
 public:
@@ -33,10 +35,32 @@ public:
 
     void handleRead();
 
-    void runInLoop(Functor &&cb);
-
-    void queueInLoop(Functor &&cb);
-
+    template<class F>
+    void runInLoop(F &&cb) {
+        if (isInLoopThread()) {
+            cb();
+        } else {
+            queueInLoop(std::forward<F>(cb));
+        }
+    }
+
+    /* Queue 'cb' to run on the loop after the events of the current
+     * iteration. Takes no lock, and a closure that fits in a Task is not
+     * allocated. */
+    template<class F>
+    void queueInLoop(F &&cb) {
+        tasks.push(std::forward<F>(cb));
+        wakeupForTasks();
+    }
+
+    /* Queue every task of 'batch' with a single push and at most one
+     * wakeup. 'batch' must be for getTaskQueue() and is emptied. */
+    void queueInLoop(TaskQueue::Batch &batch);
+
+    TaskQueue *getTaskQueue();
+
+    /* Wake the loop up. Calls made until it runs its queued tasks again
+     * share the first one's write to the wakeup fd. */
     void wakeup();
 
     void updateChannel(Channel *channel);
@@ -63,6 +87,22 @@ public:
 
     std::thread::id getThreadId() const;
 
+    /* Backend of the loops created from now on, "epoll" or "io_uring" where
+     * the platform has them. Returns false for a backend the kernel cannot
+     * run, the choice is left as it was. */
+    static bool setIoBackend(const char *name);
+
+    static const char *getIoBackend();
+
+    /* Whether the loop runs on io_uring, connections then receive and send
+     * through completions instead of waiting for readiness. */
+    bool usingUring() const;
+
+    /* Send what is in 'buffer' on a loop using io_uring, see Uring. */
+    void queueSend(Channel *channel, Buffer *buffer);
+
+    bool isSending(Channel *channel);
+
 private:
     EventLoop(const EventLoop &);
 
@@ -72,8 +112,9 @@ private:
 
     void doPendingFunctors();
 
+    void wakeupForTasks();
+
     std::thread::id threadId;
-    mutable std::mutex mutex;
 #ifdef __APPLE__
     PollPtr epoller;
     int32_t op;
@@ -82,6 +123,9 @@ private:
 
 #ifdef __linux__
     EpollPtr epoller;
+#ifdef HAVE_IO_URING
+    UringPtr uring;
+#endif
     int32_t wakeupFd;
 #endif
 
@@ -101,7 +145,9 @@ private:
     bool running;
     bool eventHandling;
     bool callingPendingFunctors;
-    std::vector <Functor> functors;
-    std::vector <Functor> pendingFunctors;
+    TaskQueue tasks;
+    std::atomic<bool> wakeupPending;
+
+    static bool uringBackend;
 };
 
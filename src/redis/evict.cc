@@ -0,0 +1,237 @@
+#include "evict.h"
+#include "redis.h"
+
+std::atomic <uint32_t> Evict::lruClock((setime() & LRU_CLOCK_MAX));
+std::atomic <uint32_t> Evict::lfuClock(((setime() / 60) & 0xffff));
+std::atomic<bool> Evict::lfuEnabled(false);
+
+Evict::Evict(Redis *redis)
+        : redis(redis),
+          maxmemory(0),
+          policy(MAXMEMORY_NO_EVICTION),
+          samples(MAXMEMORY_SAMPLES),
+          evictedKeys(0),
+          seed(ustime() | 1) {
+
+}
+
+Evict::~Evict() {
+
+}
+
+int32_t Evict::setMaxmemory(const char *value) {
+    /* A number of bytes with an optional unit: 1gb, 100mb, 64k. */
+    char *end;
+    errno = 0;
+    long long n = strtoll(value, &end, 10);
+    if (errno || n < 0 || end == value) {
+        return REDIS_ERR;
+    }
+
+    long long mul = 1;
+    if (!strcasecmp(end, "k") || !strcasecmp(end, "kb")) {
+        mul = 1024;
+    } else if (!strcasecmp(end, "m") || !strcasecmp(end, "mb")) {
+        mul = 1024 * 1024;
+    } else if (!strcasecmp(end, "g") || !strcasecmp(end, "gb")) {
+        mul = 1024LL * 1024 * 1024;
+    } else if (*end != '\0') {
+        return REDIS_ERR;
+    }
+
+    maxmemory = n * mul;
+    return REDIS_OK;
+}
+
+int32_t Evict::setPolicy(const char *value) {
+    int32_t p;
+    if (!strcasecmp(value, "noeviction")) {
+        p = MAXMEMORY_NO_EVICTION;
+    } else if (!strcasecmp(value, "allkeys-lru")) {
+        p = MAXMEMORY_ALLKEYS_LRU;
+    } else if (!strcasecmp(value, "allkeys-lfu")) {
+        p = MAXMEMORY_ALLKEYS_LFU;
+    } else if (!strcasecmp(value, "volatile-ttl")) {
+        p = MAXMEMORY_VOLATILE_TTL;
+    } else {
+        return REDIS_ERR;
+    }
+
+    /* The stamps keep their old meaning until the keys are touched again,
+     * the pool would compare both. */
+    std::unique_lock <std::mutex> lck(mutex);
+    policy = p;
+    lfuEnabled = p == MAXMEMORY_ALLKEYS_LFU;
+    pool.clear();
+    return REDIS_OK;
+}
+
+int32_t Evict::setSamples(const char *value) {
+    char *end;
+    long n = strtol(value, &end, 10);
+    if (*end != '\0' || n < 1 || n > 64) {
+        return REDIS_ERR;
+    }
+
+    samples = n;
+    return REDIS_OK;
+}
+
+const char *Evict::getPolicyName() const {
+    switch (policy) {
+        case MAXMEMORY_ALLKEYS_LRU:
+            return "allkeys-lru";
+        case MAXMEMORY_ALLKEYS_LFU:
+            return "allkeys-lfu";
+        case MAXMEMORY_VOLATILE_TTL:
+            return "volatile-ttl";
+        default:
+            return "noeviction";
+    }
+}
+
+void Evict::updateClock() {
+    int64_t now = setime();
+    lruClock.store(now & LRU_CLOCK_MAX, std::memory_order_relaxed);
+    lfuClock.store((now / 60) & 0xffff, std::memory_order_relaxed);
+}
+
+int32_t Evict::performEvictions() {
+    size_t limit = maxmemory.load(std::memory_order_relaxed);
+    if (limit == 0 || zmalloc_used_memory() <= limit) {
+        return REDIS_OK;
+    }
+
+    int32_t p = policy;
+    if (p == MAXMEMORY_NO_EVICTION) {
+        return REDIS_ERR;
+    }
+
+    /* Somebody else is evicting already, let the command go on. */
+    std::unique_lock <std::mutex> lck(mutex, std::try_to_lock);
+    if (!lck.owns_lock()) {
+        return REDIS_OK;
+    }
+
+    int64_t start = ustime();
+    int64_t evicted = 0;
+    while (zmalloc_used_memory() > limit) {
+        populatePool(p);
+        if (pool.empty()) {
+            break;
+        }
+
+        PoolEntry best = std::move(pool.back());
+        pool.pop_back();
+        if (redis->evictKey(best.index, best.key)) {
+            evicted++;
+        }
+
+        /* Checking the time every few keys is enough. */
+        if ((evicted & 15) == 0 && ustime() - start > EVICT_TIME_LIMIT_US) {
+            break;
+        }
+    }
+
+    evictedKeys += evicted;
+    return (evicted > 0 || zmalloc_used_memory() <= limit) ? REDIS_OK : REDIS_ERR;
+}
+
+void Evict::populatePool(int32_t p) {
+    auto &shards = redis->getRedisShards();
+    int32_t n = samples;
+    for (int32_t i = 0; i < n; i++) {
+        /* From a random shard, or the next one holding a candidate. */
+        uint64_t r = nextRandom();
+        size_t index = r % Redis::kShards;
+        for (int32_t j = 0; j < Redis::kShards; j++) {
+            auto &shard = shards[index];
+            std::unique_lock <std::mutex> lck(shard.mtx);
+            if (p == MAXMEMORY_VOLATILE_TTL) {
+                auto &expires = shard.expireWheel.getExpires();
+                if (!expires.empty()) {
+                    /* The first element of a random bucket that has any. */
+                    size_t buckets = expires.bucket_count();
+                    size_t b = (r >> 10) % buckets;
+                    while (expires.begin(b) == expires.end(b)) {
+                        b = (b + 1) % buckets;
+                    }
+
+                    auto it = expires.begin(b);
+                    insertPool(UINT64_MAX - it->second, index,
+                               it->first->ptr, sdslen(it->first->ptr));
+                    break;
+                }
+            } else if (shard.keySpace.size() > 0) {
+                KeyEntry *entry = shard.keySpace.random(r >> 10);
+                uint64_t idle = p == MAXMEMORY_ALLKEYS_LFU ?
+                                255 - decrAndReturn(entry->lru) :
+                                estimateIdleTime(entry->lru);
+                insertPool(idle, index, entry->getKey(), entry->getKeyLen());
+                break;
+            }
+            index = (index + 1) % Redis::kShards;
+        }
+    }
+}
+
+void Evict::insertPool(uint64_t idle, size_t index, const char *key, size_t len) {
+    /* Sorted by idle, the best candidate last. */
+    for (auto it = pool.begin(); it != pool.end(); ++it) {
+        if (it->index == index && it->key.size() == len && !memcmp(it->key.data(), key, len)) {
+            pool.erase(it);
+            break;
+        }
+    }
+
+    if (pool.size() == EVPOOL_SIZE) {
+        if (idle <= pool.front().idle) {
+            return;
+        }
+        pool.erase(pool.begin());
+    }
+
+    auto pos = std::upper_bound(pool.begin(), pool.end(), idle,
+                                [](uint64_t v, const PoolEntry &e) { return v < e.idle; });
+    pool.insert(pos, PoolEntry{idle, index, std::string(key, len)});
+}
+
+uint64_t Evict::nextRandom() {
+    /* xorshift64*, under 'mutex'. */
+    seed ^= seed >> 12;
+    seed ^= seed << 25;
+    seed ^= seed >> 27;
+    return seed * 0x2545F4914F6CDD1DULL;
+}
+
+uint64_t Evict::estimateIdleTime(uint32_t lru) {
+    uint32_t clock = lruClock.load(std::memory_order_relaxed);
+    if (clock >= lru) {
+        return uint64_t(clock - lru) * LRU_CLOCK_RESOLUTION;
+    }
+    return uint64_t(clock + (LRU_CLOCK_MAX - lru)) * LRU_CLOCK_RESOLUTION;
+}
+
+uint32_t Evict::decrAndReturn(uint32_t lru) {
+    uint32_t ldt = lru >> 8;
+    uint32_t counter = lru & 255;
+    uint32_t now = lfuClock.load(std::memory_order_relaxed);
+    uint32_t elapsed = now >= ldt ? now - ldt : 65535 - ldt + now;
+    uint32_t periods = elapsed / LFU_DECAY_TIME;
+    return periods > counter ? 0 : counter - periods;
+}
+
+uint32_t Evict::logIncr(uint32_t counter) {
+    if (counter == 255) {
+        return 255;
+    }
+
+    static thread_local uint32_t state = 2463534242U ^ (uint32_t)(uintptr_t) &state;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    double r = (double) state / UINT32_MAX;
+    double baseval = counter > LFU_INIT_VAL ? counter - LFU_INIT_VAL : 0;
+    double p = 1.0 / (baseval * LFU_LOG_FACTOR + 1);
+    return r < p ? counter + 1 : counter;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "all.h"
+#include "keyspace.h"
+#include "zmalloc.h"
+
+class Redis;
+
+/* Memory bounded operation. Once used memory goes past maxmemory, the write
+ * commands first evict keys chosen by the policy until it is below again:
+ *
+ * allkeys-lru   the keys idle for the longest time
+ * allkeys-lfu   the keys accessed the least often
+ * volatile-ttl  the keys with an expire that is the closest
+ * noeviction    nothing, writes that could add memory are refused
+ *
+ * Every key carries its access time or an access frequency in KeyEntry::lru,
+ * updated when the key is looked up. Eviction approximates the policy like
+ * upstream: a few keys are sampled from random shards into a small pool of
+ * the best candidates seen so far and the best of the pool is evicted. A
+ * write command spends at most EVICT_TIME_LIMIT_US on evicting, the server
+ * cron carries on from there, so a large overshoot never stalls one client
+ * for long. */
+class Evict {
+public:
+    Evict(Redis *redis);
+
+    ~Evict();
+
+    /* CONFIG SET, return REDIS_ERR for an invalid value. */
+    int32_t setMaxmemory(const char *value);
+
+    int32_t setPolicy(const char *value);
+
+    int32_t setSamples(const char *value);
+
+    size_t getMaxmemory() const { return maxmemory; }
+
+    const char *getPolicyName() const;
+
+    int64_t getEvictedKeys() const { return evictedKeys; }
+
+    /* Evict keys while used memory is above maxmemory, for a bounded time.
+     * Returns REDIS_ERR if memory is still above and no key could be
+     * evicted. Any thread, the threads coming while another one evicts do
+     * not wait for it. */
+    int32_t performEvictions();
+
+    bool isAboveLimit() const {
+        size_t limit = maxmemory;
+        return limit > 0 && zmalloc_used_memory() > limit;
+    }
+
+    /* Called by the server cron. */
+    static void updateClock();
+
+    /* Record an access to the key, and the first one for a new key. */
+    static void touch(KeyEntry &entry) {
+        if (lfuEnabled.load(std::memory_order_relaxed)) {
+            uint32_t counter = logIncr(decrAndReturn(entry.lru));
+            entry.lru = (lfuClock.load(std::memory_order_relaxed) << 8) | counter;
+        } else {
+            entry.lru = lruClock.load(std::memory_order_relaxed);
+        }
+    }
+
+    static void init(KeyEntry &entry) {
+        if (lfuEnabled.load(std::memory_order_relaxed)) {
+            entry.lru = (lfuClock.load(std::memory_order_relaxed) << 8) | LFU_INIT_VAL;
+        } else {
+            entry.lru = lruClock.load(std::memory_order_relaxed);
+        }
+    }
+
+private:
+    Evict(const Evict &);
+
+    void operator=(const Evict &);
+
+    struct PoolEntry {
+        uint64_t idle;  /* The higher the better to evict */
+        size_t index;   /* Shard */
+        std::string key;
+    };
+
+    /* Sample keys into the pool, under 'mutex'. */
+    void populatePool(int32_t policy);
+
+    void insertPool(uint64_t idle, size_t index, const char *key, size_t len);
+
+    uint64_t nextRandom();
+
+    /* Idle time in milliseconds of an LRU stamp. */
+    static uint64_t estimateIdleTime(uint32_t lru);
+
+    /* The LFU counter of the stamp, decremented for the minutes elapsed
+     * since it was last updated. */
+    static uint32_t decrAndReturn(uint32_t lru);
+
+    /* Increment the counter with a probability falling as it grows, so 8
+     * bits count up to millions of accesses. */
+    static uint32_t logIncr(uint32_t counter);
+
+    Redis *redis;
+    std::atomic <size_t> maxmemory;
+    std::atomic <int32_t> policy;
+    std::atomic <int32_t> samples;
+    std::atomic <int64_t> evictedKeys;
+
+    std::mutex mutex;
+    std::vector <PoolEntry> pool;
+    uint64_t seed;
+
+    /* Seconds, and minutes for LFU, both wrapping around. */
+    static std::atomic <uint32_t> lruClock;
+    static std::atomic <uint32_t> lfuClock;
+    static std::atomic<bool> lfuEnabled;
+};
@@ -0,0 +1,213 @@
+#include "expire.h"
+
+static int32_t countTrailingZeros(uint64_t mask) {
+#ifdef _WIN64
+    unsigned long idx;
+    _BitScanForward64(&idx, mask);
+    return idx;
+#else
+    return __builtin_ctzll(mask);
+#endif
+}
+
+ExpireWheel::ExpireWheel()
+        : current(mstime()),
+          pending(0) {
+    memset(bitmap, 0, sizeof(bitmap));
+}
+
+ExpireWheel::~ExpireWheel() {
+
+}
+
+void ExpireWheel::add(const RedisObjectPtr &key, int64_t when) {
+    auto it = expires.find(key);
+    if (it != expires.end()) {
+        if (it->second == when) {
+            return;
+        }
+        it->second = when;
+    } else {
+        expires.insert(std::make_pair(key, when));
+    }
+
+    /* Keys whose deadline keeps being pushed back leave a trail of stale
+     * entries, rebuild the wheel once they outnumber the live ones. */
+    if (pending > (expires.size() << 1) + kWheelSize) {
+        compact();
+    }
+    place(Entry{key, when});
+}
+
+bool ExpireWheel::remove(const RedisObjectPtr &key) {
+    /* The wheel entry is left behind and dropped when its slot fires. The
+     * stale entries still hold their keys, so once they outnumber the live
+     * ones the wheel is rebuilt, and the index gives back its buckets. */
+    if (expires.erase(key) == 0) {
+        return false;
+    }
+
+    if (expires.empty()) {
+        clear();
+    } else if (pending > (expires.size() << 1) + kWheelSize) {
+        compact();
+        if (expires.bucket_count() > (expires.size() << 2)) {
+            expires.rehash(0);
+        }
+    }
+    return true;
+}
+
+int64_t ExpireWheel::get(const RedisObjectPtr &key) const {
+    auto it = expires.find(key);
+    if (it == expires.end()) {
+        return -1;
+    }
+    return it->second;
+}
+
+void ExpireWheel::clear() {
+    ExpireMap map;
+    expires.swap(map);
+    std::vector <Slot> slots;
+    wheel.swap(slots);
+    memset(bitmap, 0, sizeof(bitmap));
+    pending = 0;
+}
+
+void ExpireWheel::swap(ExpireWheel &rhs) {
+    expires.swap(rhs.expires);
+    wheel.swap(rhs.wheel);
+    for (int32_t level = 0; level < kWheelLevels; level++) {
+        std::swap(bitmap[level], rhs.bitmap[level]);
+    }
+    std::swap(current, rhs.current);
+    std::swap(pending, rhs.pending);
+}
+
+void ExpireWheel::compact() {
+    for (int32_t level = 0; level < kWheelLevels; level++) {
+        for (int32_t idx = 0; idx < kWheelSize; idx++) {
+            Slot().swap(wheel[(level << kWheelBits) + idx]);
+        }
+        bitmap[level] = 0;
+    }
+
+    pending = 0;
+    for (auto &it : expires) {
+        place(Entry{it.first, it.second});
+    }
+}
+
+void ExpireWheel::place(Entry &&entry) {
+    /* Deadlines beyond the top level are parked in the farthest top level
+     * slot, they are placed again every time that slot is cascaded. */
+    int64_t when = std::max(entry.when, current);
+    int64_t delta = when - current;
+    const int64_t range = int64_t(1) << (kWheelLevels * kWheelBits);
+    if (delta >= range) {
+        when = current + range - 1;
+        delta = range - 1;
+    }
+
+    int32_t level = 0;
+    while (delta >= (int64_t(1) << ((level + 1) * kWheelBits))) {
+        level++;
+    }
+
+    if (wheel.empty()) {
+        wheel.resize(kWheelLevels * kWheelSize);
+    }
+
+    int32_t idx = (when >> (level * kWheelBits)) & kWheelMask;
+    wheel[(level << kWheelBits) + idx].push_back(std::move(entry));
+    bitmap[level] |= uint64_t(1) << idx;
+    pending++;
+}
+
+void ExpireWheel::cascade() {
+    for (int32_t level = 1; level < kWheelLevels; level++) {
+        int32_t idx = (current >> (level * kWheelBits)) & kWheelMask;
+        if (bitmap[level] & (uint64_t(1) << idx)) {
+            Slot slot;
+            slot.swap(wheel[(level << kWheelBits) + idx]);
+            bitmap[level] &= ~(uint64_t(1) << idx);
+            pending -= slot.size();
+
+            for (auto &it : slot) {
+                auto iter = expires.find(it.key);
+                if (iter == expires.end() || iter->second != it.when) {
+                    continue;
+                }
+                place(std::move(it));
+            }
+        }
+
+        if (idx != 0) {
+            break;
+        }
+    }
+}
+
+int64_t ExpireWheel::nextTick() const {
+    /* Find the first tick at or after 'current' that has work to do: either
+     * an occupied level 0 slot or the cascade of an occupied upper slot. */
+    int64_t next = INT64_MAX;
+    for (int32_t level = 0; level < kWheelLevels; level++) {
+        if (bitmap[level] == 0) {
+            continue;
+        }
+
+        int32_t shift = level * kWheelBits;
+        int64_t first = current >> shift;
+        if (level > 0 && (current & ((int64_t(1) << shift) - 1)) != 0) {
+            first++;
+        }
+
+        int32_t d = first & kWheelMask;
+        uint64_t mask = (bitmap[level] >> d) | (bitmap[level] << ((kWheelSize - d) & kWheelMask));
+        int64_t tick = (first + countTrailingZeros(mask)) << shift;
+        next = std::min(next, tick);
+    }
+    return next;
+}
+
+bool ExpireWheel::advance(int64_t now, size_t limit, std::vector <RedisObjectPtr> &expired) {
+    size_t count = 0;
+    while (true) {
+        int64_t tick = nextTick();
+        if (tick >= now) {
+            current = std::max(current, now);
+            return false;
+        }
+
+        current = tick;
+        if ((current & kWheelMask) == 0) {
+            cascade();
+        }
+
+        int32_t idx = current & kWheelMask;
+        auto &slot = wheel[idx];
+        while (!slot.empty()) {
+            if (count >= limit) {
+                return true;
+            }
+
+            Entry entry = std::move(slot.back());
+            slot.pop_back();
+            pending--;
+
+            auto it = expires.find(entry.key);
+            if (it == expires.end() || it->second != entry.when) {
+                continue;
+            }
+
+            expires.erase(it);
+            expired.push_back(std::move(entry.key));
+            count++;
+        }
+
+        bitmap[0] &= ~(uint64_t(1) << idx);
+        current++;
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "all.h"
+#include "object.h"
+
+/* Per shard expire index. Every volatile key has exactly one deadline in
+ * 'expires' (absolute unix time in milliseconds) and at least one entry in
+ * a hierarchical timing wheel with 1ms ticks. Updating or removing a
+ * deadline never touches the wheel: stale wheel entries are detected and
+ * dropped when their slot fires, so add/remove are O(1).
+ *
+ * The wheel is not thread safe, it is protected by the owning shard mutex. */
+class ExpireWheel {
+public:
+    ExpireWheel();
+
+    ~ExpireWheel();
+
+    void add(const RedisObjectPtr &key, int64_t when);
+
+    bool remove(const RedisObjectPtr &key);
+
+    int64_t get(const RedisObjectPtr &key) const;
+
+    /* Move the wheel forward to 'now' and append at most 'limit' keys whose
+     * deadline has passed to 'expired'. The keys are already removed from
+     * the index. Returns true if the limit was reached before the wheel
+     * caught up, which means more expired keys may be pending. */
+    bool advance(int64_t now, size_t limit, std::vector <RedisObjectPtr> &expired);
+
+    size_t size() const { return expires.size(); }
+
+    size_t wheelSize() const { return pending; }
+
+    void clear();
+
+    void swap(ExpireWheel &rhs);
+
+    typedef std::unordered_map<RedisObjectPtr, int64_t, Hash, Equal> ExpireMap;
+
+    const ExpireMap &getExpires() const { return expires; }
+
+    const static int32_t kWheelBits = 6;
+    const static int32_t kWheelSize = 1 << kWheelBits;
+    const static int32_t kWheelMask = kWheelSize - 1;
+    const static int32_t kWheelLevels = 5;
+
+private:
+    ExpireWheel(const ExpireWheel &);
+
+    void operator=(const ExpireWheel &);
+
+    struct Entry {
+        RedisObjectPtr key;
+        int64_t when;
+    };
+
+    typedef std::vector <Entry> Slot;
+
+    void place(Entry &&entry);
+
+    void cascade();
+
+    void compact();
+
+    int64_t nextTick() const;
+
+    ExpireMap expires;
+    /* kWheelLevels * kWheelSize slots, allocated on first use so that shards
+     * without volatile keys stay small. */
+    std::vector <Slot> wheel;
+    uint64_t bitmap[kWheelLevels];
+    int64_t current;
+    size_t pending;
+};
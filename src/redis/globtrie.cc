@@ -0,0 +1,272 @@
+#include "globtrie.h"
+
+GlobTrie::GlobTrie()
+        : root(new Node()),
+          count(0) {
+
+}
+
+GlobTrie::~GlobTrie() {
+    freeNode(root);
+}
+
+void GlobTrie::freeNode(Node *node) {
+    for (auto &it : node->literals) {
+        freeNode(it.second);
+    }
+
+    for (auto &it : node->classes) {
+        freeNode(it.second);
+    }
+
+    if (node->any) {
+        freeNode(node->any);
+    }
+
+    if (node->star) {
+        freeNode(node->star);
+    }
+    delete node;
+}
+
+/* Same parsing as stringmatchlen(), an unterminated class runs to the end
+ * of the pattern. */
+void GlobTrie::compile(const char *p, size_t len, std::vector <Token> *tokens) {
+    size_t i = 0;
+    while (i < len) {
+        Token token;
+        if (p[i] == '*') {
+            while (i < len && p[i] == '*') {
+                i++;
+            }
+            token.type = kStar;
+        } else if (p[i] == '?') {
+            token.type = kAny;
+            i++;
+        } else if (p[i] == '[') {
+            token.type = kClass;
+            i++;
+            token.text.push_back(i < len && p[i] == '^' ? '^' : '+');
+            if (i < len && p[i] == '^') {
+                i++;
+            }
+
+            while (i < len && p[i] != ']') {
+                unsigned char start = p[i], end = p[i];
+                if (p[i] == '\\' && len - i >= 2) {
+                    start = end = p[i + 1];
+                    i += 2;
+                } else if (len - i >= 3 && p[i + 1] == '-') {
+                    start = std::min<unsigned char>(p[i], p[i + 2]);
+                    end = std::max<unsigned char>(p[i], p[i + 2]);
+                    i += 3;
+                } else {
+                    i++;
+                }
+                token.text.push_back(start);
+                token.text.push_back(end);
+            }
+            i++;
+        } else {
+            token.type = kLiteral;
+            if (p[i] == '\\' && len - i >= 2) {
+                i++;
+            }
+            token.text.push_back(p[i]);
+            i++;
+        }
+        tokens->push_back(std::move(token));
+    }
+}
+
+bool GlobTrie::matchClass(const std::string &text, unsigned char c) {
+    bool match = false;
+    for (size_t i = 1; i + 1 < text.size() && !match; i += 2) {
+        match = c >= (unsigned char) text[i] && c <= (unsigned char) text[i + 1];
+    }
+    return text[0] == '^' ? !match : match;
+}
+
+GlobTrie::Node *GlobTrie::child(const Node *node, const Token &token) {
+    switch (token.type) {
+        case kLiteral: {
+            auto it = node->literals.find(token.text[0]);
+            return it == node->literals.end() ? nullptr : it->second;
+        }
+        case kAny:
+            return node->any;
+        case kStar:
+            return node->star;
+        default:
+            for (auto &it : node->classes) {
+                if (it.first == token.text) {
+                    return it.second;
+                }
+            }
+            return nullptr;
+    }
+}
+
+GlobTrie::Node *GlobTrie::addChild(Node *node, const Token &token) {
+    Node *next = child(node, token);
+    if (next != nullptr) {
+        return next;
+    }
+
+    next = new Node();
+    switch (token.type) {
+        case kLiteral:
+            node->literals[token.text[0]] = next;
+            break;
+        case kAny:
+            node->any = next;
+            break;
+        case kStar:
+            next->isStar = true;
+            node->star = next;
+            break;
+        default:
+            node->classes.push_back(std::make_pair(token.text, next));
+            break;
+    }
+    return next;
+}
+
+void GlobTrie::removeChild(Node *node, const Token &token) {
+    switch (token.type) {
+        case kLiteral:
+            node->literals.erase(token.text[0]);
+            break;
+        case kAny:
+            node->any = nullptr;
+            break;
+        case kStar:
+            node->star = nullptr;
+            break;
+        default:
+            for (auto it = node->classes.begin(); it != node->classes.end(); ++it) {
+                if (it->first == token.text) {
+                    node->classes.erase(it);
+                    break;
+                }
+            }
+            break;
+    }
+}
+
+bool GlobTrie::isEmpty(const Node *node) {
+    return node->patterns.empty() && node->literals.empty() && node->classes.empty() &&
+           node->any == nullptr && node->star == nullptr;
+}
+
+bool GlobTrie::insert(const RedisObjectPtr &pattern) {
+    std::vector <Token> tokens;
+    compile(pattern->ptr, sdslen(pattern->ptr), &tokens);
+
+    Node *node = root;
+    for (auto &token : tokens) {
+        node = addChild(node, token);
+    }
+
+    for (auto &it : node->patterns) {
+        if (sdslen(it->ptr) == sdslen(pattern->ptr) &&
+            memcmp(it->ptr, pattern->ptr, sdslen(pattern->ptr)) == 0) {
+            return false;
+        }
+    }
+
+    node->patterns.push_back(pattern);
+    count++;
+    return true;
+}
+
+bool GlobTrie::erase(const RedisObjectPtr &pattern) {
+    std::vector <Token> tokens;
+    compile(pattern->ptr, sdslen(pattern->ptr), &tokens);
+
+    std::vector < Node * > path;
+    path.push_back(root);
+    for (auto &token : tokens) {
+        Node *next = child(path.back(), token);
+        if (next == nullptr) {
+            return false;
+        }
+        path.push_back(next);
+    }
+
+    Node *node = path.back();
+    auto it = node->patterns.begin();
+    while (it != node->patterns.end() &&
+           (sdslen((*it)->ptr) != sdslen(pattern->ptr) ||
+            memcmp((*it)->ptr, pattern->ptr, sdslen(pattern->ptr)) != 0)) {
+        ++it;
+    }
+
+    if (it == node->patterns.end()) {
+        return false;
+    }
+
+    node->patterns.erase(it);
+    count--;
+
+    /* Drop the nodes no other pattern goes through. */
+    for (size_t i = tokens.size(); i > 0 && isEmpty(path[i]); i--) {
+        removeChild(path[i - 1], tokens[i - 1]);
+        delete path[i];
+    }
+    return true;
+}
+
+void GlobTrie::match(const char *s, size_t len, const Callback &cb) const {
+    std::vector <std::pair<const Node *, size_t>> stack;
+    std::set <std::pair<const Node *, size_t>> stars;
+
+    auto push = [&](const Node *node, size_t pos) {
+        /* Only star states can be reached twice, from the node before the
+         * star and from the star itself. */
+        if (!node->isStar || stars.insert(std::make_pair(node, pos)).second) {
+            stack.push_back(std::make_pair(node, pos));
+        }
+    };
+
+    push(root, 0);
+    while (!stack.empty()) {
+        const Node *node = stack.back().first;
+        size_t pos = stack.back().second;
+        stack.pop_back();
+
+        if (pos == len) {
+            for (auto &it : node->patterns) {
+                cb(it);
+            }
+        }
+
+        if (node->star != nullptr) {
+            push(node->star, pos);
+        }
+
+        if (pos == len) {
+            continue;
+        }
+
+        unsigned char c = s[pos];
+        if (node->isStar) {
+            push(node, pos + 1);
+        }
+
+        auto it = node->literals.find(c);
+        if (it != node->literals.end()) {
+            push(it->second, pos + 1);
+        }
+
+        if (node->any != nullptr) {
+            push(node->any, pos + 1);
+        }
+
+        for (auto &iter : node->classes) {
+            if (matchClass(iter.first, c)) {
+                push(iter.second, pos + 1);
+            }
+        }
+    }
+}
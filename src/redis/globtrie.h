@@ -0,0 +1,80 @@
+#pragma once
+
+#include "all.h"
+#include "object.h"
+
+/* Glob patterns compiled into a trie, so that the patterns matching a
+ * string are found in one walk instead of one stringmatchlen() per pattern,
+ * patterns with a common prefix share the nodes for it. The syntax is the
+ * one of stringmatchlen(): '*', '?', '[...]' with '^' and ranges, and '\'
+ * to escape.
+ *
+ * A walk keeps a set of (node, position) states. Runs of '*' are compiled
+ * to one star node that loops on itself, its states are deduplicated so
+ * that a pattern is reported once and the walk stays polynomial. */
+class GlobTrie {
+public:
+    typedef std::function<void(const RedisObjectPtr &)> Callback;
+
+    GlobTrie();
+
+    ~GlobTrie();
+
+    /* Returns false if the pattern is already there. */
+    bool insert(const RedisObjectPtr &pattern);
+
+    /* Returns false if the pattern is not there. */
+    bool erase(const RedisObjectPtr &pattern);
+
+    /* Calls 'cb' once for every pattern matching 's'. */
+    void match(const char *s, size_t len, const Callback &cb) const;
+
+    size_t size() const { return count; }
+
+private:
+    GlobTrie(const GlobTrie &);
+
+    void operator=(const GlobTrie &);
+
+    enum TokenType {
+        kLiteral, kAny, kStar, kClass
+    };
+
+    /* A literal keeps its byte in 'text', a class its ranges as pairs of
+     * bytes behind a '^' or '+' for negated or not. */
+    struct Token {
+        TokenType type;
+        std::string text;
+    };
+
+    struct Node {
+        Node() : any(nullptr), star(nullptr), isStar(false) {}
+
+        std::unordered_map<unsigned char, Node *> literals;
+        Node *any;
+        Node *star;
+        std::vector <std::pair<std::string, Node *>> classes;
+        /* The patterns ending here, several spellings like 'a*' and 'a**'
+         * compile to the same node. */
+        std::vector <RedisObjectPtr> patterns;
+        bool isStar;
+    };
+
+    static void compile(const char *p, size_t len, std::vector <Token> *tokens);
+
+    static bool matchClass(const std::string &text, unsigned char c);
+
+    /* The child of 'node' for 'token', nullptr if there is none. */
+    static Node *child(const Node *node, const Token &token);
+
+    static Node *addChild(Node *node, const Token &token);
+
+    static void removeChild(Node *node, const Token &token);
+
+    static bool isEmpty(const Node *node);
+
+    static void freeNode(Node *node);
+
+    Node *root;
+    size_t count;
+};
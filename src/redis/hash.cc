@@ -0,0 +1,137 @@
+#include "hash.h"
+
+RedisHash::RedisHash()
+        : dict(nullptr) {
+
+}
+
+RedisHash::~RedisHash() {
+    delete dict;
+}
+
+size_t RedisHash::size() const {
+    return dict ? dict->size() : lp.size() / 2;
+}
+
+void RedisHash::swap(RedisHash &rhs) {
+    lp.swap(rhs.lp);
+    std::swap(dict, rhs.dict);
+}
+
+unsigned char *RedisHash::findListpack(const char *field, size_t len) const {
+    for (unsigned char *p = lp.first(); p != nullptr; p = lp.next(lp.next(p))) {
+        if (Listpack::equals(p, field, len)) {
+            return lp.next(p);
+        }
+    }
+    return nullptr;
+}
+
+void RedisHash::convert() {
+    assert(dict == nullptr);
+    dict = new Dict();
+    dict->reserve(lp.size() / 2);
+
+    char fbuf[Listpack::kIntBufSize];
+    char vbuf[Listpack::kIntBufSize];
+    for (unsigned char *p = lp.first(); p != nullptr; p = lp.next(lp.next(p))) {
+        std::string_view field = Listpack::get(p).view(fbuf);
+        std::string_view value = Listpack::get(lp.next(p)).view(vbuf);
+        dict->emplace(createStringObject((char *) field.data(), field.size()),
+                      createStringObject((char *) value.data(), value.size()));
+    }
+    lp.clear();
+}
+
+bool RedisHash::set(const RedisObjectPtr &field, const RedisObjectPtr &value) {
+    if (dict == nullptr) {
+        size_t flen = sdslen(field->ptr);
+        size_t vlen = sdslen(value->ptr);
+        if (flen <= REDIS_HASH_MAX_LISTPACK_VALUE && vlen <= REDIS_HASH_MAX_LISTPACK_VALUE) {
+            unsigned char *vptr = findListpack(field->ptr, flen);
+            if (vptr != nullptr) {
+                lp.replace(vptr, value->ptr, vlen);
+                return false;
+            }
+
+            if (lp.size() / 2 < REDIS_HASH_MAX_LISTPACK_ENTRIES) {
+                lp.append(field->ptr, flen);
+                lp.append(value->ptr, vlen);
+                return true;
+            }
+        }
+        convert();
+    }
+
+    auto it = dict->find(field);
+    if (it != dict->end()) {
+        it->second = value;
+        return false;
+    }
+
+    dict->emplace(field, value);
+    return true;
+}
+
+bool RedisHash::get(const RedisObjectPtr &field, char *buf, std::string_view *value) const {
+    if (dict == nullptr) {
+        unsigned char *vptr = findListpack(field->ptr, sdslen(field->ptr));
+        if (vptr == nullptr) {
+            return false;
+        }
+
+        *value = Listpack::get(vptr).view(buf);
+        return true;
+    }
+
+    auto it = dict->find(field);
+    if (it == dict->end()) {
+        return false;
+    }
+
+    *value = std::string_view(it->second->ptr, sdslen(it->second->ptr));
+    return true;
+}
+
+void RedisHash::forEach(const Callback &cb) const {
+    if (dict == nullptr) {
+        char fbuf[Listpack::kIntBufSize];
+        char vbuf[Listpack::kIntBufSize];
+        for (unsigned char *p = lp.first(); p != nullptr; p = lp.next(lp.next(p))) {
+            cb(Listpack::get(p).view(fbuf), Listpack::get(lp.next(p)).view(vbuf));
+        }
+        return;
+    }
+
+    for (auto &it : *dict) {
+        cb(std::string_view(it.first->ptr, sdslen(it.first->ptr)),
+           std::string_view(it.second->ptr, sdslen(it.second->ptr)));
+    }
+}
+
+uint64_t RedisHash::scan(uint64_t cursor, size_t count, const Callback &cb) const {
+    if (dict == nullptr) {
+        forEach(cb);
+        return 0;
+    }
+
+    return scanBuckets(*dict, cursor, count, [&](const Dict::value_type &it) {
+        cb(std::string_view(it.first->ptr, sdslen(it.first->ptr)),
+           std::string_view(it.second->ptr, sdslen(it.second->ptr)));
+    });
+}
+
+bool RedisHash::assignListpack(const unsigned char *buf, size_t len) {
+    delete dict;
+    dict = nullptr;
+    if (!lp.assign(buf, len) || lp.size() % 2 != 0) {
+        lp.clear();
+        return false;
+    }
+
+    /* Written by a server with larger limits. */
+    if (lp.size() / 2 > REDIS_HASH_MAX_LISTPACK_ENTRIES) {
+        convert();
+    }
+    return true;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "all.h"
+#include "listpack.h"
+#include "object.h"
+
+/* Hash with two encodings. Small hashes are a listpack of field and value
+ * pairs, found by a linear scan which is cheaper than hashing at this size
+ * and costs a few bytes per field instead of two objects and a table node.
+ * Past REDIS_HASH_MAX_LISTPACK_ENTRIES fields, or once a field or value is
+ * longer than REDIS_HASH_MAX_LISTPACK_VALUE, it turns into a hash table. */
+class RedisHash {
+public:
+    typedef std::function<void(const std::string_view &, const std::string_view &)> Callback;
+
+    RedisHash();
+
+    ~RedisHash();
+
+    int32_t getEncoding() const { return dict ? OBJ_ENCODING_HT : OBJ_ENCODING_LISTPACK; }
+
+    size_t size() const;
+
+    void swap(RedisHash &rhs);
+
+    /* Returns true if the field is new. */
+    bool set(const RedisObjectPtr &field, const RedisObjectPtr &value);
+
+    /* Integer values of a listpack are formatted into 'buf', which must
+     * hold Listpack::kIntBufSize bytes. */
+    bool get(const RedisObjectPtr &field, char *buf, std::string_view *value) const;
+
+    void forEach(const Callback &cb) const;
+
+    /* One step of HSCAN, see scanBuckets(). A listpack is small enough to
+     * be returned whole, with cursor 0. */
+    uint64_t scan(uint64_t cursor, size_t count, const Callback &cb) const;
+
+    /* nullptr unless the hash is a listpack. */
+    const Listpack *getListpack() const { return dict ? nullptr : &lp; }
+
+    /* Load a serialized listpack of field and value pairs. */
+    bool assignListpack(const unsigned char *buf, size_t len);
+
+private:
+    RedisHash(const RedisHash &);
+
+    void operator=(const RedisHash &);
+
+    typedef std::unordered_map <RedisObjectPtr, RedisObjectPtr, Hash, Equal> Dict;
+
+    /* Position of the value of 'field', or nullptr. */
+    unsigned char *findListpack(const char *field, size_t len) const;
+
+    void convert();
+
+    Listpack lp;
+    Dict *dict;
+};
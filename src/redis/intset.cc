@@ -0,0 +1,228 @@
+#include "intset.h"
+#include "util.h"
+#include "zmalloc.h"
+
+#define INTSET_HDR_SIZE 8
+#define INTSET_ENC_INT16 (sizeof(int16_t))
+#define INTSET_ENC_INT32 (sizeof(int32_t))
+#define INTSET_ENC_INT64 (sizeof(int64_t))
+
+Intset::Intset()
+        : is((unsigned char *) zmalloc(INTSET_HDR_SIZE)) {
+    setEncoding(INTSET_ENC_INT16);
+    setLength(0);
+}
+
+Intset::~Intset() {
+    zfree(is);
+}
+
+uint32_t Intset::valueEncoding(int64_t value) {
+    if (value < INT32_MIN || value > INT32_MAX) {
+        return INTSET_ENC_INT64;
+    } else if (value < INT16_MIN || value > INT16_MAX) {
+        return INTSET_ENC_INT32;
+    }
+    return INTSET_ENC_INT16;
+}
+
+uint32_t Intset::getEncoding() const {
+    uint32_t encoding;
+    memcpy(&encoding, is, 4);
+    return intrev32ifbe(encoding);
+}
+
+void Intset::setEncoding(uint32_t encoding) {
+    encoding = intrev32ifbe(encoding);
+    memcpy(is, &encoding, 4);
+}
+
+size_t Intset::size() const {
+    uint32_t length;
+    memcpy(&length, is + 4, 4);
+    return intrev32ifbe(length);
+}
+
+void Intset::setLength(uint32_t length) {
+    length = intrev32ifbe(length);
+    memcpy(is + 4, &length, 4);
+}
+
+size_t Intset::bytes() const {
+    return INTSET_HDR_SIZE + size() * getEncoding();
+}
+
+int64_t Intset::get(size_t pos, uint32_t encoding) const {
+    const unsigned char *p = is + INTSET_HDR_SIZE + pos * encoding;
+    if (encoding == INTSET_ENC_INT64) {
+        int64_t v64;
+        memcpy(&v64, p, sizeof(v64));
+        memrev64ifbe(&v64);
+        return v64;
+    } else if (encoding == INTSET_ENC_INT32) {
+        int32_t v32;
+        memcpy(&v32, p, sizeof(v32));
+        memrev32ifbe(&v32);
+        return v32;
+    }
+
+    int16_t v16;
+    memcpy(&v16, p, sizeof(v16));
+    memrev16ifbe(&v16);
+    return v16;
+}
+
+int64_t Intset::get(size_t pos) const {
+    return get(pos, getEncoding());
+}
+
+void Intset::set(size_t pos, int64_t value) {
+    uint32_t encoding = getEncoding();
+    unsigned char *p = is + INTSET_HDR_SIZE + pos * encoding;
+    if (encoding == INTSET_ENC_INT64) {
+        int64_t v64 = value;
+        memrev64ifbe(&v64);
+        memcpy(p, &v64, sizeof(v64));
+    } else if (encoding == INTSET_ENC_INT32) {
+        int32_t v32 = value;
+        memrev32ifbe(&v32);
+        memcpy(p, &v32, sizeof(v32));
+    } else {
+        int16_t v16 = value;
+        memrev16ifbe(&v16);
+        memcpy(p, &v16, sizeof(v16));
+    }
+}
+
+/* Binary search, 'pos' is where the value is or where it would go. */
+bool Intset::search(int64_t value, size_t *pos) const {
+    size_t len = size();
+    if (len == 0) {
+        *pos = 0;
+        return false;
+    }
+
+    /* Appending and prepending are the common cases for ids. */
+    if (value > get(len - 1)) {
+        *pos = len;
+        return false;
+    } else if (value < get(0)) {
+        *pos = 0;
+        return false;
+    }
+
+    size_t min = 0, max = len - 1;
+    while (min <= max) {
+        size_t mid = min + (max - min) / 2;
+        int64_t cur = get(mid);
+        if (value > cur) {
+            min = mid + 1;
+        } else if (value < cur) {
+            if (mid == 0) {
+                break;
+            }
+            max = mid - 1;
+        } else {
+            *pos = mid;
+            return true;
+        }
+    }
+
+    *pos = min;
+    return false;
+}
+
+void Intset::resize(size_t len) {
+    is = (unsigned char *) zrealloc(is, INTSET_HDR_SIZE + len * getEncoding());
+}
+
+/* The value is wider than every member, so it goes at one of the ends.
+ * Members are widened from the tail so nothing is overwritten. */
+void Intset::upgradeAndAdd(int64_t value) {
+    uint32_t curenc = getEncoding();
+    size_t len = size();
+    bool prepend = value < 0;
+
+    setEncoding(valueEncoding(value));
+    resize(len + 1);
+    for (size_t i = len; i-- > 0;) {
+        set(i + prepend, get(i, curenc));
+    }
+
+    set(prepend ? 0 : len, value);
+    setLength(len + 1);
+}
+
+bool Intset::add(int64_t value) {
+    if (valueEncoding(value) > getEncoding()) {
+        upgradeAndAdd(value);
+        return true;
+    }
+
+    size_t pos;
+    if (search(value, &pos)) {
+        return false;
+    }
+
+    size_t len = size();
+    uint32_t encoding = getEncoding();
+    resize(len + 1);
+    memmove(is + INTSET_HDR_SIZE + (pos + 1) * encoding,
+            is + INTSET_HDR_SIZE + pos * encoding, (len - pos) * encoding);
+    set(pos, value);
+    setLength(len + 1);
+    return true;
+}
+
+bool Intset::remove(int64_t value) {
+    size_t pos;
+    if (valueEncoding(value) > getEncoding() || !search(value, &pos)) {
+        return false;
+    }
+
+    size_t len = size();
+    uint32_t encoding = getEncoding();
+    memmove(is + INTSET_HDR_SIZE + pos * encoding,
+            is + INTSET_HDR_SIZE + (pos + 1) * encoding, (len - pos - 1) * encoding);
+    setLength(len - 1);
+    resize(len - 1);
+    return true;
+}
+
+bool Intset::find(int64_t value) const {
+    size_t pos;
+    return valueEncoding(value) <= getEncoding() && search(value, &pos);
+}
+
+bool Intset::assign(const unsigned char *buf, size_t len) {
+    is = (unsigned char *) zrealloc(is, INTSET_HDR_SIZE);
+    setEncoding(INTSET_ENC_INT16);
+    setLength(0);
+    if (len < INTSET_HDR_SIZE) {
+        return false;
+    }
+
+    uint32_t encoding, length;
+    memcpy(&encoding, buf, 4);
+    memcpy(&length, buf + 4, 4);
+    encoding = intrev32ifbe(encoding);
+    length = intrev32ifbe(length);
+    if ((encoding != INTSET_ENC_INT16 && encoding != INTSET_ENC_INT32 &&
+         encoding != INTSET_ENC_INT64) || INTSET_HDR_SIZE + size_t(length) * encoding != len) {
+        return false;
+    }
+
+    is = (unsigned char *) zrealloc(is, len);
+    memcpy(is, buf, len);
+
+    /* Members must be strictly increasing for the binary search. */
+    for (size_t i = 1; i < length; i++) {
+        if (get(i - 1, encoding) >= get(i, encoding)) {
+            is = (unsigned char *) zrealloc(is, INTSET_HDR_SIZE);
+            setEncoding(INTSET_ENC_INT16);
+            setLength(0);
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "all.h"
+
+/* A sorted array of integers in one allocation, for sets whose members are
+ * all integers.
+ *
+ * <encoding:4> <length:4> <contents>
+ *
+ * Every integer takes the width in 'encoding', 2, 4 or 8 bytes, stored
+ * little endian. Adding a value that does not fit upgrades the whole array
+ * to the wider encoding, it never goes back. Lookups are binary searches. */
+class Intset {
+public:
+    Intset();
+
+    ~Intset();
+
+    size_t size() const;
+
+    size_t bytes() const;
+
+    const unsigned char *data() const { return is; }
+
+    /* Replace the contents with a serialized intset. Returns false if 'buf'
+     * is not a valid one, the intset is left empty then. */
+    bool assign(const unsigned char *buf, size_t len);
+
+    void swap(Intset &rhs) { std::swap(is, rhs.is); }
+
+    /* Returns true if the value is new. */
+    bool add(int64_t value);
+
+    bool remove(int64_t value);
+
+    bool find(int64_t value) const;
+
+    int64_t get(size_t pos) const;
+
+    int64_t max() const { return get(size() - 1); }
+
+private:
+    Intset(const Intset &);
+
+    void operator=(const Intset &);
+
+    static uint32_t valueEncoding(int64_t value);
+
+    uint32_t getEncoding() const;
+
+    void setEncoding(uint32_t encoding);
+
+    void setLength(uint32_t length);
+
+    int64_t get(size_t pos, uint32_t encoding) const;
+
+    void set(size_t pos, int64_t value);
+
+    bool search(int64_t value, size_t *pos) const;
+
+    void resize(size_t len);
+
+    void upgradeAndAdd(int64_t value);
+
+    unsigned char *is;
+};
@@ -0,0 +1,299 @@
+#include "keyspace.h"
+#include "evict.h"
+
+static_assert(sizeof(KeyEntry) == 64, "KeyEntry must fill one cache line");
+
+KeyEntry::KeyEntry()
+        : hash(0),
+          len(0),
+          type(0),
+          lru(0) {
+    key.ptr = nullptr;
+    obj.ptr = nullptr;
+}
+
+RedisObjectPtr KeyEntry::createKeyObject() const {
+    return createRawStringObject(type, (char *) getKey(), len);
+}
+
+int32_t KeyEntry::getEncoding() const {
+    switch (type) {
+        case OBJ_STRING:
+            return val->encoding;
+        case OBJ_HASH:
+            return obj.hash->getEncoding();
+        case OBJ_LIST:
+            return obj.list->getEncoding();
+        case OBJ_ZSET:
+            return obj.zset->getEncoding();
+        case OBJ_SET:
+            return obj.set->getEncoding();
+        default:
+            return OBJ_ENCODING_RAW;
+    }
+}
+
+KeySpace::KeySpace()
+        : used(0) {
+
+}
+
+KeySpace::~KeySpace() {
+    clear();
+}
+
+KeyEntry *KeySpace::find(const RedisObjectPtr &key) {
+    return find(key->ptr, sdslen(key->ptr), key->hash);
+}
+
+KeyEntry *KeySpace::find(const char *key, size_t len, uint32_t hash) {
+    if (used == 0) {
+        return nullptr;
+    }
+
+    uint64_t mix = mixHash(hash);
+    uint8_t tag = ctrlTag(mix);
+    size_t mask = ctrl.size() - 1;
+    for (size_t idx = homeSlot(mix);; idx = (idx + 1) & mask) {
+        uint8_t c = ctrl[idx];
+        if (c == 0) {
+            return nullptr;
+        }
+
+        if (c == tag && entries[idx].hash == hash && entries[idx].keyEquals(key, len)) {
+            Evict::touch(entries[idx]);
+            return &entries[idx];
+        }
+    }
+}
+
+KeyEntry *KeySpace::insert(const RedisObjectPtr &key, int32_t type) {
+    return insert(key->ptr, sdslen(key->ptr), key->hash, type);
+}
+
+KeyEntry *KeySpace::insert(const char *key, size_t len, uint32_t hash, int32_t type) {
+    /* Keep the load factor below 7/8. */
+    if ((used + 1) * 8 > ctrl.size() * 7) {
+        resize(ctrl.empty() ? 8 : ctrl.size() << 1);
+    }
+
+    uint64_t mix = mixHash(hash);
+    size_t mask = ctrl.size() - 1;
+    size_t idx = homeSlot(mix);
+    while (ctrl[idx]) {
+        idx = (idx + 1) & mask;
+    }
+
+    KeyEntry &entry = entries[idx];
+    ctrl[idx] = ctrlTag(mix);
+    entry.hash = hash;
+    entry.len = len;
+    entry.type = type;
+    Evict::init(entry);
+    if (len < KeyEntry::kInlineKeyLen) {
+        memcpy(entry.key.buf, key, len);
+    } else {
+        entry.key.ptr = sdsnewlen(key, len);
+    }
+
+    switch (type) {
+        case OBJ_HASH:
+            entry.obj.hash = new RedisHash();
+            break;
+        case OBJ_LIST:
+            entry.obj.list = new RedisList();
+            break;
+        case OBJ_ZSET:
+            entry.obj.zset = new Zset();
+            break;
+        case OBJ_SET:
+            entry.obj.set = new RedisSet();
+            break;
+        default:
+            break;
+    }
+
+    used++;
+    return &entry;
+}
+
+bool KeySpace::erase(const RedisObjectPtr &key) {
+    KeyEntry *entry = find(key);
+    if (entry == nullptr) {
+        return false;
+    }
+
+    erase(entry);
+    return true;
+}
+
+void KeySpace::erase(KeyEntry *entry) {
+    size_t mask = ctrl.size() - 1;
+    size_t hole = entry - entries.data();
+    assert(hole < ctrl.size() && ctrl[hole]);
+    release(entries[hole]);
+    ctrl[hole] = 0;
+    used--;
+
+    /* Backward shift: pull every following entry of the cluster whose home
+     * slot is not between the hole and its current position. */
+    for (size_t idx = (hole + 1) & mask; ctrl[idx]; idx = (idx + 1) & mask) {
+        size_t home = homeSlot(mixHash(entries[idx].hash));
+        if (((idx - home) & mask) >= ((idx - hole) & mask)) {
+            moveEntry(entries[hole], entries[idx]);
+            ctrl[hole] = ctrl[idx];
+            ctrl[idx] = 0;
+            hole = idx;
+        }
+    }
+
+    /* Give the memory back once the table is mostly empty, shrinking to a
+     * quarter leaves it a quarter full at most. */
+    if (used == 0) {
+        std::vector <uint8_t> c;
+        std::vector <KeyEntry> e;
+        ctrl.swap(c);
+        entries.swap(e);
+    } else if (ctrl.size() > 8 && used * 16 < ctrl.size()) {
+        resize(std::max<size_t>(8, ctrl.size() >> 2));
+    }
+}
+
+uint64_t KeySpace::scan(uint64_t cursor, const std::function<void(KeyEntry &)> &fn) {
+    if (used == 0) {
+        return 0;
+    }
+
+    /* Every entry lives in the cluster starting at its home slot, the walk
+     * stops at the first empty slot after it. */
+    uint64_t mask = ctrl.size() - 1;
+    size_t home = cursor & mask;
+    for (size_t idx = home; ctrl[idx]; idx = (idx + 1) & mask) {
+        if (homeSlot(mixHash(entries[idx].hash)) == home) {
+            fn(entries[idx]);
+        }
+    }
+
+    /* Set the bits above the mask so the increment of the reversed cursor
+     * carries through them, then add one to the reversed cursor. */
+    cursor |= ~mask;
+    cursor = reverseBits(cursor);
+    cursor++;
+    return reverseBits(cursor);
+}
+
+KeyEntry *KeySpace::random(uint64_t r) {
+    assert(used > 0);
+    size_t mask = ctrl.size() - 1;
+    size_t idx = r & mask;
+    while (!ctrl[idx]) {
+        idx = (idx + 1) & mask;
+    }
+    return &entries[idx];
+}
+
+uint64_t KeySpace::reverseBits(uint64_t v) {
+    /* Swap halves of ever smaller width: 32 bits, 16 bits and so on. */
+    uint64_t mask = ~0ULL;
+    for (int32_t s = 32; s > 0; s >>= 1) {
+        mask ^= (mask << s);
+        v = ((v >> s) & mask) | ((v << s) & ~mask);
+    }
+    return v;
+}
+
+void KeySpace::clear() {
+    for (size_t idx = 0; idx < ctrl.size(); idx++) {
+        if (ctrl[idx]) {
+            release(entries[idx]);
+        }
+    }
+
+    std::vector <uint8_t> c;
+    std::vector <KeyEntry> e;
+    ctrl.swap(c);
+    entries.swap(e);
+    used = 0;
+}
+
+void KeySpace::swap(KeySpace &rhs) {
+    ctrl.swap(rhs.ctrl);
+    entries.swap(rhs.entries);
+    std::swap(used, rhs.used);
+}
+
+size_t KeySpace::getMemoryUsage() const {
+    size_t size = ctrl.capacity() + entries.capacity() * sizeof(KeyEntry);
+    for (size_t idx = 0; idx < ctrl.size(); idx++) {
+        if (ctrl[idx] && entries[idx].len >= KeyEntry::kInlineKeyLen) {
+            size += sdsAllocSize(entries[idx].key.ptr);
+        }
+    }
+    return size;
+}
+
+void KeySpace::release(KeyEntry &entry) {
+    if (entry.len >= KeyEntry::kInlineKeyLen) {
+        sdsfree(entry.key.ptr);
+    }
+    entry.key.ptr = nullptr;
+    entry.len = 0;
+    entry.val.reset();
+    releaseValue(entry.type, entry.obj.ptr);
+    entry.obj.ptr = nullptr;
+}
+
+void KeySpace::releaseValue(int32_t type, void *ptr) {
+    switch (type) {
+        case OBJ_HASH:
+            delete (RedisHash *) ptr;
+            break;
+        case OBJ_LIST:
+            delete (RedisList *) ptr;
+            break;
+        case OBJ_ZSET:
+            delete (Zset *) ptr;
+            break;
+        case OBJ_SET:
+            delete (RedisSet *) ptr;
+            break;
+        default:
+            break;
+    }
+}
+
+void KeySpace::moveEntry(KeyEntry &dst, KeyEntry &src) {
+    dst.hash = src.hash;
+    dst.len = src.len;
+    dst.type = src.type;
+    dst.lru = src.lru;
+    dst.key = src.key;
+    dst.val = std::move(src.val);
+    dst.obj = src.obj;
+    src.key.ptr = nullptr;
+    src.len = 0;
+    src.obj.ptr = nullptr;
+}
+
+void KeySpace::resize(size_t size) {
+    std::vector <uint8_t> c(size, 0);
+    std::vector <KeyEntry> e(size);
+    ctrl.swap(c);
+    entries.swap(e);
+
+    size_t mask = size - 1;
+    for (size_t i = 0; i < c.size(); i++) {
+        if (!c[i]) {
+            continue;
+        }
+
+        uint64_t mix = mixHash(e[i].hash);
+        size_t idx = homeSlot(mix);
+        while (ctrl[idx]) {
+            idx = (idx + 1) & mask;
+        }
+
+        ctrl[idx] = ctrlTag(mix);
+        moveEntry(entries[idx], e[i]);
+    }
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include "all.h"
+#include "object.h"
+#include "hash.h"
+#include "list.h"
+#include "set.h"
+#include "zset.h"
+
+/* One slot of the keyspace table, exactly one cache line. Keys shorter than
+ * kInlineKeyLen are stored in the slot itself, longer keys in an sds. String
+ * values live in 'val', the other types own their container through 'obj'. */
+struct KeyEntry {
+    const static int32_t kInlineKeyLen = 24;
+
+    KeyEntry();
+
+    const char *getKey() const { return len < kInlineKeyLen ? key.buf : key.ptr; }
+
+    size_t getKeyLen() const { return len; }
+
+    bool keyEquals(const char *s, size_t l) const {
+        return len == l && memcmp(getKey(), s, l) == 0;
+    }
+
+    RedisObjectPtr createKeyObject() const;
+
+    int32_t getEncoding() const;
+
+    uint32_t hash;
+    uint32_t len;
+    uint32_t type;
+    /* Last access for LRU, or the minute of the last decrement and the
+     * access counter for LFU, see Evict. Fills the padding before 'key'. */
+    uint32_t lru;
+    union {
+        char buf[kInlineKeyLen];
+        sds ptr;
+    } key;
+    RedisObjectPtr val;
+    union {
+        RedisHash *hash;
+        RedisList *list;
+        Zset *zset;
+        RedisSet *set;
+        void *ptr;
+    } obj;
+};
+
+/* Per shard keyspace: an open addressing table with linear probing. Every
+ * slot has a control byte holding 7 bits of the hash so that most probes
+ * never touch the slot itself, deletion shifts the following slots back
+ * instead of leaving tombstones. Not thread safe, it is protected by the
+ * shard mutex like the rest of the shard. */
+class KeySpace {
+public:
+    KeySpace();
+
+    ~KeySpace();
+
+    KeyEntry *find(const RedisObjectPtr &key);
+
+    KeyEntry *find(const char *key, size_t len, uint32_t hash);
+
+    /* Insert a key that does not exist yet. Aggregate types get an empty
+     * container, string values must be assigned by the caller. */
+    KeyEntry *insert(const RedisObjectPtr &key, int32_t type);
+
+    KeyEntry *insert(const char *key, size_t len, uint32_t hash, int32_t type);
+
+    bool erase(const RedisObjectPtr &key);
+
+    void erase(KeyEntry *entry);
+
+    void clear();
+
+    void swap(KeySpace &rhs);
+
+    size_t size() const { return used; }
+
+    size_t capacity() const { return ctrl.size(); }
+
+    KeyEntry *at(size_t idx) { return ctrl[idx] ? &entries[idx] : nullptr; }
+
+    /* One step of SCAN: calls 'fn' for every entry whose home slot is the
+     * one 'cursor' points at and returns the next cursor, 0 once every slot
+     * was visited. The cursor is incremented from its high bits down, so
+     * the home slots visited before a resize are exactly those visited
+     * before it in the bigger table too, a smaller table may only repeat
+     * some. 'fn' must not change the table. */
+    uint64_t scan(uint64_t cursor, const std::function<void(KeyEntry &)> &fn);
+
+    /* The entry at a random slot or the next one after it, for eviction.
+     * Must not be called on an empty table. */
+    KeyEntry *random(uint64_t r);
+
+    size_t getMemoryUsage() const;
+
+    /* Free the container of an aggregate value, see KeyEntry::obj. */
+    static void releaseValue(int32_t type, void *ptr);
+
+    class iterator {
+    public:
+        iterator(KeySpace *space, size_t idx) : space(space), idx(idx) { skip(); }
+
+        KeyEntry &operator*() const { return space->entries[idx]; }
+
+        KeyEntry *operator->() const { return &space->entries[idx]; }
+
+        iterator &operator++() {
+            idx++;
+            skip();
+            return *this;
+        }
+
+        bool operator!=(const iterator &r) const { return idx != r.idx; }
+
+    private:
+        void skip() {
+            while (idx < space->ctrl.size() && !space->ctrl[idx]) {
+                idx++;
+            }
+        }
+
+        KeySpace *space;
+        size_t idx;
+    };
+
+    iterator begin() { return iterator(this, 0); }
+
+    iterator end() { return iterator(this, ctrl.size()); }
+
+private:
+    KeySpace(const KeySpace &);
+
+    void operator=(const KeySpace &);
+
+    static uint64_t mixHash(uint32_t hash) { return (hash | (uint64_t(hash) << 32)) * 0x9E3779B97F4A7C15ULL; }
+
+    static uint8_t ctrlTag(uint64_t mix) { return 0x80 | ((mix >> 25) & 0x7f); }
+
+    size_t homeSlot(uint64_t mix) const { return (mix >> 32) & (ctrl.size() - 1); }
+
+    void release(KeyEntry &entry);
+
+    static uint64_t reverseBits(uint64_t v);
+
+    void moveEntry(KeyEntry &dst, KeyEntry &src);
+
+    /* Rehash into 'size' slots, a power of two holding every entry. */
+    void resize(size_t size);
+
+    std::vector <uint8_t> ctrl;
+    std::vector <KeyEntry> entries;
+    size_t used;
+};
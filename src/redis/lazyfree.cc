@@ -0,0 +1,106 @@
+#include "lazyfree.h"
+#include "hash.h"
+#include "list.h"
+#include "set.h"
+#include "zset.h"
+
+LazyFree::LazyFree()
+        : pendingObjects(0),
+          freedObjects(0),
+          threadStarted(false),
+          closeRequested(false) {
+
+}
+
+LazyFree::~LazyFree() {
+    /* Wait for the thread to drain the queue, it touches 'this'. */
+    std::unique_lock <std::mutex> lck(mutex);
+    closeRequested = true;
+    condition.notify_all();
+    while (threadStarted) {
+        condition.wait(lck);
+    }
+}
+
+size_t LazyFree::getFreeEffort(const KeyEntry &entry) {
+    switch (entry.type) {
+        case OBJ_LIST:
+            return entry.obj.list->nodes();
+        case OBJ_HASH:
+            return entry.obj.hash->getEncoding() == OBJ_ENCODING_HT ? entry.obj.hash->size() : 1;
+        case OBJ_SET:
+            return entry.obj.set->getEncoding() == OBJ_ENCODING_HT ? entry.obj.set->size() : 1;
+        case OBJ_ZSET:
+            return entry.obj.zset->getEncoding() == OBJ_ENCODING_SKIPLIST ? entry.obj.zset->size() : 1;
+        default:
+            /* A string is a single allocation. */
+            return 1;
+    }
+}
+
+bool LazyFree::freeValueAsync(KeyEntry &entry) {
+    size_t effort = getFreeEffort(entry);
+    if (effort <= LAZYFREE_THRESHOLD) {
+        return false;
+    }
+
+    int32_t type = entry.type;
+    void *ptr = entry.obj.ptr;
+    entry.obj.ptr = nullptr;
+    entry.type = OBJ_STRING;
+    submit(1, [type, ptr]() { KeySpace::releaseValue(type, ptr); });
+    return true;
+}
+
+void LazyFree::freeShardAsync(KeySpace &keySpace, ExpireWheel &expireWheel) {
+    if (keySpace.size() == 0 && expireWheel.size() == 0) {
+        return;
+    }
+
+    std::shared_ptr <KeySpace> space(new KeySpace());
+    std::shared_ptr <ExpireWheel> wheel(new ExpireWheel());
+    space->swap(keySpace);
+    wheel->swap(expireWheel);
+    int64_t objects = space->size();
+    submit(objects, [space, wheel]() {
+        space->clear();
+        wheel->clear();
+    });
+}
+
+void LazyFree::submit(int64_t objects, Functor &&job) {
+    pendingObjects += objects;
+    std::unique_lock <std::mutex> lck(mutex);
+    jobs.push_back(Job{objects, std::move(job)});
+    if (!threadStarted) {
+        threadStarted = true;
+        std::thread thread(std::bind(&LazyFree::freeThread, this));
+        thread.detach();
+    }
+    condition.notify_one();
+}
+
+void LazyFree::freeThread() {
+    while (true) {
+        Job job;
+        {
+            std::unique_lock <std::mutex> lck(mutex);
+            while (jobs.empty() && !closeRequested) {
+                condition.wait(lck);
+            }
+
+            if (jobs.empty()) {
+                threadStarted = false;
+                condition.notify_all();
+                return;
+            }
+
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+
+        job.fn();
+        pendingObjects -= job.objects;
+        freedObjects += job.objects;
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "all.h"
+#include "expire.h"
+#include "keyspace.h"
+
+/* Background reclamation of values too big to free inline. UNLINK and
+ * FLUSHDB ASYNC detach what they delete from the keyspace under the shard
+ * mutex in O(1) and hand it to a thread of its own, so deleting a set of
+ * millions of members or flushing the whole dataset does not stall the
+ * loop holding the mutex. Values whose free effort, about the number of
+ * allocations behind them, is at most LAZYFREE_THRESHOLD are cheaper to
+ * free right away and stay on the inline path. */
+class LazyFree {
+public:
+    typedef std::function<void()> Functor;
+
+    LazyFree();
+
+    ~LazyFree();
+
+    /* Take the value of 'entry' for the background thread if it is worth
+     * it, the entry is then erased as usual with an empty value. Returns
+     * true if the value was taken. */
+    bool freeValueAsync(KeyEntry &entry);
+
+    /* Move the contents of a shard out, the shard is left empty. */
+    void freeShardAsync(KeySpace &keySpace, ExpireWheel &expireWheel);
+
+    /* About the allocations freeing the value of 'entry' takes. */
+    static size_t getFreeEffort(const KeyEntry &entry);
+
+    int64_t getPendingObjects() const { return pendingObjects; }
+
+    int64_t getFreedObjects() const { return freedObjects; }
+
+private:
+    LazyFree(const LazyFree &);
+
+    void operator=(const LazyFree &);
+
+    void submit(int64_t objects, Functor &&job);
+
+    void freeThread();
+
+    struct Job {
+        int64_t objects;
+        Functor fn;
+    };
+
+    std::atomic <int64_t> pendingObjects;
+    std::atomic <int64_t> freedObjects;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque <Job> jobs;
+    bool threadStarted;
+    bool closeRequested;
+};
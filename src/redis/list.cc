@@ -0,0 +1,162 @@
+#include "list.h"
+
+std::atomic <int32_t> RedisList::compressDepth(0);
+
+RedisList::RedisList()
+        : ql(nullptr) {
+
+}
+
+RedisList::~RedisList() {
+    delete ql;
+}
+
+size_t RedisList::size() const {
+    return ql ? ql->size() : lp.size();
+}
+
+void RedisList::swap(RedisList &rhs) {
+    lp.swap(rhs.lp);
+    std::swap(ql, rhs.ql);
+}
+
+void RedisList::convert() {
+    assert(ql == nullptr);
+    ql = new Quicklist(compressDepth);
+    if (lp.size() > 0) {
+        bool ok = ql->appendListpack(lp.data(), lp.bytes());
+        assert(ok);
+        (void) ok;
+    }
+    lp.clear();
+}
+
+void RedisList::push(const RedisObjectPtr &value, int32_t where) {
+    size_t len = sdslen(value->ptr);
+    if (ql == nullptr) {
+        if (lp.size() < REDIS_LIST_MAX_LISTPACK_ENTRIES && len <= REDIS_LIST_MAX_LISTPACK_VALUE) {
+            lp.insert(where == REDIS_LIST_HEAD ? lp.first() : nullptr, value->ptr, len);
+            return;
+        }
+        convert();
+    }
+    ql->push(value->ptr, len, where);
+}
+
+bool RedisList::pop(int32_t where, const Callback &cb) {
+    if (ql) {
+        return ql->pop(where, cb);
+    }
+
+    unsigned char *p = where == REDIS_LIST_HEAD ? lp.first() : lp.last();
+    if (p == nullptr) {
+        return false;
+    }
+
+    char buf[Listpack::kIntBufSize];
+    cb(Listpack::get(p).view(buf));
+    lp.erase(p);
+    return true;
+}
+
+bool RedisList::index(int64_t index, const Callback &cb) const {
+    if (ql) {
+        return ql->index(index, cb);
+    }
+
+    unsigned char *p = lp.seek(index);
+    if (p == nullptr) {
+        return false;
+    }
+
+    char buf[Listpack::kIntBufSize];
+    cb(Listpack::get(p).view(buf));
+    return true;
+}
+
+bool RedisList::set(int64_t index, const RedisObjectPtr &value) {
+    size_t len = sdslen(value->ptr);
+    if (ql == nullptr) {
+        unsigned char *p = lp.seek(index);
+        if (p == nullptr) {
+            return false;
+        }
+
+        if (len <= REDIS_LIST_MAX_LISTPACK_VALUE) {
+            lp.replace(p, value->ptr, len);
+            return true;
+        }
+        convert();
+    }
+    return ql->replace(index, value->ptr, len);
+}
+
+bool RedisList::insert(const RedisObjectPtr &pivot, const RedisObjectPtr &value, bool after) {
+    size_t plen = sdslen(pivot->ptr);
+    size_t len = sdslen(value->ptr);
+    if (ql == nullptr) {
+        unsigned char *p = lp.first();
+        while (p != nullptr && !Listpack::equals(p, pivot->ptr, plen)) {
+            p = lp.next(p);
+        }
+
+        if (p == nullptr) {
+            return false;
+        }
+
+        if (lp.size() < REDIS_LIST_MAX_LISTPACK_ENTRIES && len <= REDIS_LIST_MAX_LISTPACK_VALUE) {
+            lp.insert(after ? lp.next(p) : p, value->ptr, len);
+            return true;
+        }
+        convert();
+    }
+    return ql->insert(pivot->ptr, plen, value->ptr, len, after);
+}
+
+void RedisList::erase(int64_t start, int64_t n) {
+    if (ql) {
+        ql->erase(start, n);
+    } else {
+        lp.erase(lp.seek(start), n);
+    }
+}
+
+void RedisList::range(int64_t start, int64_t end, const Callback &cb) const {
+    if (ql) {
+        ql->range(start, end, cb);
+        return;
+    }
+
+    int64_t rangelen = end - start + 1;
+    char buf[Listpack::kIntBufSize];
+    for (unsigned char *p = lp.seek(start); rangelen-- > 0 && p != nullptr; p = lp.next(p)) {
+        cb(Listpack::get(p).view(buf));
+    }
+}
+
+void RedisList::forEachNode(const NodeCallback &cb) const {
+    if (ql) {
+        ql->forEachNode(cb);
+    } else {
+        cb(lp);
+    }
+}
+
+bool RedisList::appendListpack(const unsigned char *buf, size_t len) {
+    if (ql == nullptr && lp.size() == 0) {
+        if (!lp.assign(buf, len)) {
+            return false;
+        }
+
+        /* Written by a server with larger limits. */
+        if (lp.size() > REDIS_LIST_MAX_LISTPACK_ENTRIES) {
+            convert();
+        }
+        return true;
+    }
+
+    if (ql == nullptr) {
+        convert();
+    }
+    return ql->appendListpack(buf, len);
+}
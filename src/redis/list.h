@@ -0,0 +1,77 @@
+#pragma once
+
+#include "all.h"
+#include "listpack.h"
+#include "object.h"
+#include "quicklist.h"
+
+/* List with two encodings. Small lists are a listpack, up to
+ * REDIS_LIST_MAX_LISTPACK_ENTRIES elements of at most
+ * REDIS_LIST_MAX_LISTPACK_VALUE bytes, larger ones a quicklist. */
+class RedisList {
+public:
+    typedef std::function<void(const std::string_view &)> Callback;
+    typedef Quicklist::NodeCallback NodeCallback;
+
+    RedisList();
+
+    ~RedisList();
+
+    int32_t getEncoding() const { return ql ? OBJ_ENCODING_QUICKLIST : OBJ_ENCODING_LISTPACK; }
+
+    size_t size() const;
+
+    void swap(RedisList &rhs);
+
+    /* 'where' is REDIS_LIST_HEAD or REDIS_LIST_TAIL. */
+    void push(const RedisObjectPtr &value, int32_t where);
+
+    /* Calls 'cb' with the element before it is removed, returns false if
+     * the list is empty. */
+    bool pop(int32_t where, const Callback &cb);
+
+    /* Negative indexes count from the tail, these return false if 'index'
+     * is out of range. */
+    bool index(int64_t index, const Callback &cb) const;
+
+    bool set(int64_t index, const RedisObjectPtr &value);
+
+    /* Insert before or after the first element equal to 'pivot', returns
+     * false if there is none. */
+    bool insert(const RedisObjectPtr &pivot, const RedisObjectPtr &value, bool after);
+
+    /* Remove 'n' elements starting at 'start', which must be valid. */
+    void erase(int64_t start, int64_t n);
+
+    /* Elements with an index from 'start' to 'end', both valid. */
+    void range(int64_t start, int64_t end, const Callback &cb) const;
+
+    void forEach(const Callback &cb) const { range(0, int64_t(size()) - 1, cb); }
+
+    /* The list as quicklist nodes, a small list is a single one. */
+    size_t nodes() const { return ql ? ql->nodes() : 1; }
+
+    void forEachNode(const NodeCallback &cb) const;
+
+    /* Append a serialized listpack node, returns false if it is not a
+     * valid one. */
+    bool appendListpack(const unsigned char *buf, size_t len);
+
+    /* Interior nodes of lists created from now on are compressed, see
+     * Quicklist. */
+    static void setCompressDepth(int32_t depth) { compressDepth = depth; }
+
+    static int32_t getCompressDepth() { return compressDepth; }
+
+private:
+    RedisList(const RedisList &);
+
+    void operator=(const RedisList &);
+
+    void convert();
+
+    static std::atomic <int32_t> compressDepth;
+
+    Listpack lp;
+    Quicklist *ql;
+};
@@ -0,0 +1,475 @@
+#include "listpack.h"
+#include "util.h"
+#include "zmalloc.h"
+
+#define LP_HDR_SIZE 6
+#define LP_EOF 0xFF
+#define LP_COUNT_UNKNOWN UINT16_MAX
+
+#define LP_ENCODING_7BIT_UINT 0
+#define LP_ENCODING_7BIT_UINT_MASK 0x80
+#define LP_ENCODING_6BIT_STR 0x80
+#define LP_ENCODING_6BIT_STR_MASK 0xC0
+#define LP_ENCODING_13BIT_INT 0xC0
+#define LP_ENCODING_13BIT_INT_MASK 0xE0
+#define LP_ENCODING_12BIT_STR 0xE0
+#define LP_ENCODING_12BIT_STR_MASK 0xF0
+#define LP_ENCODING_16BIT_INT 0xF1
+#define LP_ENCODING_24BIT_INT 0xF2
+#define LP_ENCODING_32BIT_INT 0xF3
+#define LP_ENCODING_64BIT_INT 0xF4
+#define LP_ENCODING_32BIT_STR 0xF0
+
+std::string_view Listpack::Entry::view(char *buf) const {
+    if (sval != nullptr) {
+        return std::string_view(sval, slen);
+    }
+    return std::string_view(buf, ll2string(buf, kIntBufSize, lval));
+}
+
+Listpack::Listpack()
+        : lp((unsigned char *) zmalloc(LP_HDR_SIZE + 1)) {
+    setTotalBytes(LP_HDR_SIZE + 1);
+    setCount(0);
+    lp[LP_HDR_SIZE] = LP_EOF;
+}
+
+Listpack::~Listpack() {
+    zfree(lp);
+}
+
+uint32_t Listpack::getTotalBytes() const {
+    return uint32_t(lp[0]) | uint32_t(lp[1]) << 8 | uint32_t(lp[2]) << 16 | uint32_t(lp[3]) << 24;
+}
+
+void Listpack::setTotalBytes(uint32_t len) {
+    lp[0] = len & 0xff;
+    lp[1] = (len >> 8) & 0xff;
+    lp[2] = (len >> 16) & 0xff;
+    lp[3] = (len >> 24) & 0xff;
+}
+
+uint16_t Listpack::getCount() const {
+    return uint16_t(lp[4]) | uint16_t(lp[5]) << 8;
+}
+
+void Listpack::setCount(uint16_t count) {
+    lp[4] = count & 0xff;
+    lp[5] = (count >> 8) & 0xff;
+}
+
+void Listpack::addCount(int64_t delta) {
+    uint16_t count = getCount();
+    if (count == LP_COUNT_UNKNOWN) {
+        return;
+    }
+
+    int64_t n = count + delta;
+    setCount(n >= LP_COUNT_UNKNOWN ? LP_COUNT_UNKNOWN : uint16_t(n));
+}
+
+size_t Listpack::size() const {
+    uint16_t count = getCount();
+    if (count != LP_COUNT_UNKNOWN) {
+        return count;
+    }
+
+    size_t n = 0;
+    for (unsigned char *p = first(); p != nullptr; p = next(p)) {
+        n++;
+    }
+    return n;
+}
+
+size_t Listpack::bytes() const {
+    return getTotalBytes();
+}
+
+void Listpack::clear() {
+    lp = (unsigned char *) zrealloc(lp, LP_HDR_SIZE + 1);
+    setTotalBytes(LP_HDR_SIZE + 1);
+    setCount(0);
+    lp[LP_HDR_SIZE] = LP_EOF;
+}
+
+/* Writes the encoding and the data of 's' to 'buf' if it is not nullptr,
+ * returns how many bytes that takes. */
+uint32_t Listpack::encodeEntry(unsigned char *buf, const char *s, size_t len) {
+    int64_t v;
+    if (len <= 20 && string2ll(s, len, &v)) {
+        if (v >= 0 && v <= 127) {
+            if (buf) buf[0] = v;
+            return 1;
+        } else if (v >= -4096 && v <= 4095) {
+            uint64_t u = v < 0 ? (uint64_t(1) << 13) + v : v;
+            if (buf) {
+                buf[0] = (u >> 8) | LP_ENCODING_13BIT_INT;
+                buf[1] = u & 0xff;
+            }
+            return 2;
+        }
+
+        uint32_t width;
+        unsigned char encoding;
+        if (v >= INT16_MIN && v <= INT16_MAX) {
+            width = 2;
+            encoding = LP_ENCODING_16BIT_INT;
+        } else if (v >= -8388608 && v <= 8388607) {
+            width = 3;
+            encoding = LP_ENCODING_24BIT_INT;
+        } else if (v >= INT32_MIN && v <= INT32_MAX) {
+            width = 4;
+            encoding = LP_ENCODING_32BIT_INT;
+        } else {
+            width = 8;
+            encoding = LP_ENCODING_64BIT_INT;
+        }
+
+        if (buf) {
+            uint64_t u = width < 8 && v < 0 ? (uint64_t(1) << (width * 8)) + v : uint64_t(v);
+            buf[0] = encoding;
+            for (uint32_t i = 0; i < width; i++) {
+                buf[1 + i] = (u >> (i * 8)) & 0xff;
+            }
+        }
+        return 1 + width;
+    }
+
+    uint32_t hdr;
+    if (len < 64) {
+        hdr = 1;
+        if (buf) buf[0] = len | LP_ENCODING_6BIT_STR;
+    } else if (len < 4096) {
+        hdr = 2;
+        if (buf) {
+            buf[0] = (len >> 8) | LP_ENCODING_12BIT_STR;
+            buf[1] = len & 0xff;
+        }
+    } else {
+        hdr = 5;
+        if (buf) {
+            buf[0] = LP_ENCODING_32BIT_STR;
+            buf[1] = len & 0xff;
+            buf[2] = (len >> 8) & 0xff;
+            buf[3] = (len >> 16) & 0xff;
+            buf[4] = (len >> 24) & 0xff;
+        }
+    }
+
+    if (buf) {
+        memcpy(buf + hdr, s, len);
+    }
+    return hdr + len;
+}
+
+/* The length of the entry before it, 7 bits per byte read from the right,
+ * the high bit tells that more bytes follow to the left. */
+uint32_t Listpack::encodeBacklen(unsigned char *buf, uint32_t len) {
+    if (len <= 127) {
+        if (buf) buf[0] = len;
+        return 1;
+    } else if (len < 16383) {
+        if (buf) {
+            buf[0] = len >> 7;
+            buf[1] = (len & 127) | 128;
+        }
+        return 2;
+    } else if (len < 2097151) {
+        if (buf) {
+            buf[0] = len >> 14;
+            buf[1] = ((len >> 7) & 127) | 128;
+            buf[2] = (len & 127) | 128;
+        }
+        return 3;
+    } else if (len < 268435455) {
+        if (buf) {
+            buf[0] = len >> 21;
+            buf[1] = ((len >> 14) & 127) | 128;
+            buf[2] = ((len >> 7) & 127) | 128;
+            buf[3] = (len & 127) | 128;
+        }
+        return 4;
+    }
+
+    if (buf) {
+        buf[0] = len >> 28;
+        buf[1] = ((len >> 21) & 127) | 128;
+        buf[2] = ((len >> 14) & 127) | 128;
+        buf[3] = ((len >> 7) & 127) | 128;
+        buf[4] = (len & 127) | 128;
+    }
+    return 5;
+}
+
+static uint32_t decodeBacklen(const unsigned char *p) {
+    uint32_t val = 0;
+    uint32_t shift = 0;
+    while (true) {
+        val |= uint32_t(p[0] & 127) << shift;
+        if (!(p[0] & 128)) {
+            break;
+        }
+        shift += 7;
+        p--;
+    }
+    return val;
+}
+
+/* Size of the encoding and the data, without the back length. */
+static uint32_t encodedSize(const unsigned char *p) {
+    if ((p[0] & LP_ENCODING_7BIT_UINT_MASK) == LP_ENCODING_7BIT_UINT) {
+        return 1;
+    } else if ((p[0] & LP_ENCODING_6BIT_STR_MASK) == LP_ENCODING_6BIT_STR) {
+        return 1 + (p[0] & 0x3f);
+    } else if ((p[0] & LP_ENCODING_13BIT_INT_MASK) == LP_ENCODING_13BIT_INT) {
+        return 2;
+    } else if ((p[0] & LP_ENCODING_12BIT_STR_MASK) == LP_ENCODING_12BIT_STR) {
+        return 2 + (uint32_t(p[0] & 0x0f) << 8 | p[1]);
+    }
+
+    switch (p[0]) {
+        case LP_ENCODING_16BIT_INT:
+            return 3;
+        case LP_ENCODING_24BIT_INT:
+            return 4;
+        case LP_ENCODING_32BIT_INT:
+            return 5;
+        case LP_ENCODING_64BIT_INT:
+            return 9;
+        case LP_ENCODING_32BIT_STR:
+            return 5 + (uint32_t(p[1]) | uint32_t(p[2]) << 8 | uint32_t(p[3]) << 16 | uint32_t(p[4]) << 24);
+        default:
+            return 0;
+    }
+}
+
+uint32_t Listpack::entrySize(const unsigned char *p) {
+    uint32_t len = encodedSize(p);
+    return len + encodeBacklen(nullptr, len);
+}
+
+unsigned char *Listpack::first() const {
+    unsigned char *p = lp + LP_HDR_SIZE;
+    return p[0] == LP_EOF ? nullptr : p;
+}
+
+unsigned char *Listpack::last() const {
+    unsigned char *p = lp + getTotalBytes() - 1;
+    return prev(p);
+}
+
+unsigned char *Listpack::next(unsigned char *p) const {
+    p += entrySize(p);
+    return p[0] == LP_EOF ? nullptr : p;
+}
+
+unsigned char *Listpack::prev(unsigned char *p) const {
+    if (p == lp + LP_HDR_SIZE) {
+        return nullptr;
+    }
+
+    uint32_t len = decodeBacklen(p - 1);
+    return p - encodeBacklen(nullptr, len) - len;
+}
+
+unsigned char *Listpack::seek(int64_t index) const {
+    int64_t count = size();
+    if (index < 0) {
+        index += count;
+    }
+
+    if (index < 0 || index >= count) {
+        return nullptr;
+    }
+
+    /* Walk from the closer end. */
+    if (index <= count / 2) {
+        unsigned char *p = first();
+        while (index-- > 0) {
+            p = next(p);
+        }
+        return p;
+    }
+
+    unsigned char *p = last();
+    for (int64_t i = count - 1; i > index; i--) {
+        p = prev(p);
+    }
+    return p;
+}
+
+Listpack::Entry Listpack::get(const unsigned char *p) {
+    Entry entry;
+    entry.sval = nullptr;
+    entry.slen = 0;
+    entry.lval = 0;
+
+    if ((p[0] & LP_ENCODING_7BIT_UINT_MASK) == LP_ENCODING_7BIT_UINT) {
+        entry.lval = p[0] & 0x7f;
+        return entry;
+    } else if ((p[0] & LP_ENCODING_6BIT_STR_MASK) == LP_ENCODING_6BIT_STR) {
+        entry.sval = (const char *) p + 1;
+        entry.slen = p[0] & 0x3f;
+        return entry;
+    } else if ((p[0] & LP_ENCODING_13BIT_INT_MASK) == LP_ENCODING_13BIT_INT) {
+        uint64_t u = uint64_t(p[0] & 0x1f) << 8 | p[1];
+        entry.lval = u >= (1 << 12) ? int64_t(u) - (1 << 13) : int64_t(u);
+        return entry;
+    } else if ((p[0] & LP_ENCODING_12BIT_STR_MASK) == LP_ENCODING_12BIT_STR) {
+        entry.sval = (const char *) p + 2;
+        entry.slen = uint32_t(p[0] & 0x0f) << 8 | p[1];
+        return entry;
+    } else if (p[0] == LP_ENCODING_32BIT_STR) {
+        entry.sval = (const char *) p + 5;
+        entry.slen = uint32_t(p[1]) | uint32_t(p[2]) << 8 | uint32_t(p[3]) << 16 | uint32_t(p[4]) << 24;
+        return entry;
+    }
+
+    uint32_t width = encodedSize(p) - 1;
+    uint64_t u = 0;
+    for (uint32_t i = 0; i < width; i++) {
+        u |= uint64_t(p[1 + i]) << (i * 8);
+    }
+
+    if (width < 8 && u >= (uint64_t(1) << (width * 8 - 1))) {
+        entry.lval = int64_t(u - (uint64_t(1) << (width * 8)));
+    } else {
+        entry.lval = int64_t(u);
+    }
+    return entry;
+}
+
+bool Listpack::equals(const unsigned char *p, const char *s, size_t len) {
+    Entry entry = get(p);
+    if (entry.sval != nullptr) {
+        return entry.slen == len && memcmp(entry.sval, s, len) == 0;
+    }
+
+    /* Only strings that are integers get an integer encoding. */
+    int64_t v;
+    return len <= 20 && string2ll(s, len, &v) && v == entry.lval;
+}
+
+void Listpack::append(const char *s, size_t len) {
+    insert(nullptr, s, len);
+}
+
+void Listpack::appendInteger(int64_t value) {
+    char buf[kIntBufSize];
+    int32_t len = ll2string(buf, sizeof(buf), value);
+    insert(nullptr, buf, len);
+}
+
+unsigned char *Listpack::insert(unsigned char *p, const char *s, size_t len) {
+    uint32_t total = getTotalBytes();
+    size_t off = p ? p - lp : total - 1;
+    uint32_t enclen = encodeEntry(nullptr, s, len);
+    uint32_t size = enclen + encodeBacklen(nullptr, enclen);
+
+    lp = (unsigned char *) zrealloc(lp, total + size);
+    memmove(lp + off + size, lp + off, total - off);
+    encodeEntry(lp + off, s, len);
+    encodeBacklen(lp + off + enclen, enclen);
+    setTotalBytes(total + size);
+    addCount(1);
+    return lp + off;
+}
+
+unsigned char *Listpack::replace(unsigned char *p, const char *s, size_t len) {
+    uint32_t total = getTotalBytes();
+    size_t off = p - lp;
+    uint32_t oldsize = entrySize(p);
+    uint32_t enclen = encodeEntry(nullptr, s, len);
+    uint32_t newsize = enclen + encodeBacklen(nullptr, enclen);
+
+    if (newsize > oldsize) {
+        lp = (unsigned char *) zrealloc(lp, total + newsize - oldsize);
+    }
+
+    memmove(lp + off + newsize, lp + off + oldsize, total - off - oldsize);
+    if (newsize < oldsize) {
+        lp = (unsigned char *) zrealloc(lp, total + newsize - oldsize);
+    }
+
+    encodeEntry(lp + off, s, len);
+    encodeBacklen(lp + off + enclen, enclen);
+    setTotalBytes(total + newsize - oldsize);
+    return lp + off;
+}
+
+unsigned char *Listpack::erase(unsigned char *p) {
+    size_t off = p - lp;
+    erase(p, 1);
+    return lp[off] == LP_EOF ? nullptr : lp + off;
+}
+
+void Listpack::erase(unsigned char *p, size_t count) {
+    uint32_t total = getTotalBytes();
+    size_t off = p - lp;
+    unsigned char *end = p;
+    size_t erased = 0;
+    while (erased < count && end[0] != LP_EOF) {
+        end += entrySize(end);
+        erased++;
+    }
+
+    size_t gap = end - p;
+    memmove(lp + off, lp + off + gap, total - off - gap);
+    lp = (unsigned char *) zrealloc(lp, total - gap);
+    setTotalBytes(total - gap);
+
+    if (getCount() == LP_COUNT_UNKNOWN) {
+        /* The exact count might fit again. */
+        size_t n = size();
+        setCount(n < LP_COUNT_UNKNOWN ? uint16_t(n) : LP_COUNT_UNKNOWN);
+    } else {
+        addCount(-int64_t(erased));
+    }
+}
+
+bool Listpack::assign(const unsigned char *buf, size_t len) {
+    clear();
+    if (len < LP_HDR_SIZE + 1 || buf[len - 1] != LP_EOF) {
+        return false;
+    }
+
+    uint32_t total = uint32_t(buf[0]) | uint32_t(buf[1]) << 8 | uint32_t(buf[2]) << 16 | uint32_t(buf[3]) << 24;
+    if (total != len) {
+        return false;
+    }
+
+    /* Every entry has to end before the terminator and agree with its own
+     * back length. */
+    size_t count = 0;
+    const unsigned char *p = buf + LP_HDR_SIZE;
+    const unsigned char *end = buf + len - 1;
+    while (p < end) {
+        size_t header = p[0] == LP_ENCODING_32BIT_STR ? 5 :
+                        (p[0] & LP_ENCODING_12BIT_STR_MASK) == LP_ENCODING_12BIT_STR ? 2 : 1;
+        if (size_t(end - p) < header) {
+            return false;
+        }
+
+        uint32_t enclen = encodedSize(p);
+        if (enclen == 0) {
+            return false;
+        }
+
+        uint32_t backlen = encodeBacklen(nullptr, enclen);
+        if (size_t(end - p) < size_t(enclen) + backlen ||
+            decodeBacklen(p + enclen + backlen - 1) != enclen) {
+            return false;
+        }
+        p += enclen + backlen;
+        count++;
+    }
+
+    uint16_t stored = uint16_t(buf[4]) | uint16_t(buf[5]) << 8;
+    if (p != end || (stored != LP_COUNT_UNKNOWN && stored != count)) {
+        return false;
+    }
+
+    lp = (unsigned char *) zrealloc(lp, len);
+    memcpy(lp, buf, len);
+    return true;
+}
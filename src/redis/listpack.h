@@ -0,0 +1,102 @@
+#pragma once
+
+#include "all.h"
+
+/* A listpack stores a sequence of strings and integers in one allocation,
+ * for collections that are too small to be worth a node per element.
+ *
+ * <total bytes:4> <count:2> <entry> ... <entry> <end:0xFF>
+ *
+ * Every entry is an encoding byte with its data, followed by the length of
+ * both written backwards so that the list can be walked in both
+ * directions. Strings that are integers are stored as integers, small ones
+ * in a single byte. The count saturates at 65535, past that size() walks
+ * the entries. */
+class Listpack {
+public:
+    /* Large enough for any integer entry turned into a string. */
+    const static int32_t kIntBufSize = 21;
+
+    struct Entry {
+        const char *sval; /* nullptr for an integer */
+        uint32_t slen;
+        int64_t lval;
+
+        /* The entry as a string, integers are formatted into 'buf'. */
+        std::string_view view(char *buf) const;
+    };
+
+    Listpack();
+
+    ~Listpack();
+
+    size_t size() const;
+
+    size_t bytes() const;
+
+    const unsigned char *data() const { return lp; }
+
+    /* Replace the contents with a serialized listpack. Returns false if
+     * 'buf' is not a valid one, the listpack is left empty then. */
+    bool assign(const unsigned char *buf, size_t len);
+
+    void clear();
+
+    void swap(Listpack &rhs) { std::swap(lp, rhs.lp); }
+
+    /* Element positions, nullptr past either end. */
+    unsigned char *first() const;
+
+    unsigned char *last() const;
+
+    unsigned char *next(unsigned char *p) const;
+
+    unsigned char *prev(unsigned char *p) const;
+
+    /* Negative indexes count from the tail. */
+    unsigned char *seek(int64_t index) const;
+
+    static Entry get(const unsigned char *p);
+
+    static bool equals(const unsigned char *p, const char *s, size_t len);
+
+    void append(const char *s, size_t len);
+
+    void appendInteger(int64_t value);
+
+    /* Insert before 'p', or append if 'p' is nullptr. Returns the position
+     * of the new element. */
+    unsigned char *insert(unsigned char *p, const char *s, size_t len);
+
+    /* Returns the position of the element with the new value. */
+    unsigned char *replace(unsigned char *p, const char *s, size_t len);
+
+    /* Returns the element that followed 'p', or nullptr. */
+    unsigned char *erase(unsigned char *p);
+
+    /* Erase 'count' elements starting at 'p'. */
+    void erase(unsigned char *p, size_t count);
+
+private:
+    Listpack(const Listpack &);
+
+    void operator=(const Listpack &);
+
+    static uint32_t encodeEntry(unsigned char *buf, const char *s, size_t len);
+
+    static uint32_t encodeBacklen(unsigned char *buf, uint32_t len);
+
+    static uint32_t entrySize(const unsigned char *p);
+
+    uint32_t getTotalBytes() const;
+
+    void setTotalBytes(uint32_t len);
+
+    uint16_t getCount() const;
+
+    void setCount(uint16_t count);
+
+    void addCount(int64_t delta);
+
+    unsigned char *lp;
+};
@@ -0,0 +1,47 @@
+#include "mailbox.h"
+
+Mailbox::Mailbox(size_t capacity)
+        : head(0),
+          tail(0) {
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    ring.resize(size);
+    mask = size - 1;
+}
+
+Mailbox::~Mailbox() {
+
+}
+
+bool Mailbox::push(Functor &&cb) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) > mask) {
+        return false;
+    }
+
+    ring[t & mask] = std::move(cb);
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+}
+
+size_t Mailbox::drain() {
+    size_t h = head.load(std::memory_order_relaxed);
+    size_t t = tail.load(std::memory_order_acquire);
+    size_t count = t - h;
+    for (; h != t; h++) {
+        /* Release the slot before running the closure so that the producer
+         * can reuse it while we are busy. */
+        Functor cb = std::move(ring[h & mask]);
+        ring[h & mask] = nullptr;
+        head.store(h + 1, std::memory_order_release);
+        cb();
+    }
+    return count;
+}
+
+bool Mailbox::empty() const {
+    return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+}
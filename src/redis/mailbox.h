@@ -0,0 +1,34 @@
+#pragma once
+
+#include "all.h"
+
+/* Bounded single producer single consumer queue of closures. Exactly one
+ * thread may push and exactly one other thread may drain, neither side takes
+ * a lock. The head and tail counters live on separate cache lines so that
+ * the two threads only share a line when a slot actually changes hands. */
+class Mailbox {
+public:
+    typedef std::function<void()> Functor;
+
+    explicit Mailbox(size_t capacity);
+
+    ~Mailbox();
+
+    /* Returns false and leaves 'cb' untouched if the ring is full. */
+    bool push(Functor &&cb);
+
+    /* Run every closure that was pushed before the call, returns the count. */
+    size_t drain();
+
+    bool empty() const;
+
+private:
+    Mailbox(const Mailbox &);
+
+    void operator=(const Mailbox &);
+
+    std::vector <Functor> ring;
+    size_t mask;
+    alignas(64) std::atomic <size_t> head;
+    alignas(64) std::atomic <size_t> tail;
+};
@@ -41,7 +41,46 @@ int main(int argc, char *argv[])
 	Logger::setOutput(dummyOutput);
 	printf("%s\n", logo);
 
-	Redis redis("127.0.0.1", 6379, 0);
+	/* usage: redis-server [threads] [shared-nothing] [appendonly] [io-uring]
+	 *                     [reuseport] [cpu-affinity] [port <port>] */
+	int16_t threadCount = argc > 1 ? atoi(argv[1]) : 0;
+	int16_t port = 6379;
+	bool sharedNothing = false;
+	bool appendOnly = false;
+	bool reusePort = false;
+	bool cpuAffinity = false;
+	for (int32_t i = 2; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "port") && i + 1 < argc)
+		{
+			port = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "shared-nothing"))
+		{
+			sharedNothing = true;
+		}
+		else if (!strcmp(argv[i], "appendonly"))
+		{
+			appendOnly = true;
+		}
+		else if (!strcmp(argv[i], "reuseport"))
+		{
+			reusePort = true;
+		}
+		else if (!strcmp(argv[i], "cpu-affinity"))
+		{
+			reusePort = true;
+			cpuAffinity = true;
+		}
+		else if (!strcmp(argv[i], "io-uring"))
+		{
+			if (!EventLoop::setIoBackend("io_uring"))
+			{
+				LOG_WARN << "io_uring is not available, using " << EventLoop::getIoBackend();
+			}
+		}
+	}
+	Redis redis("127.0.0.1", port, threadCount, false, sharedNothing, appendOnly, reusePort, cpuAffinity);
 	redis.run();
 	return 0;
 }
\ No newline at end of file
@@ -9,7 +9,8 @@ RedisObject::RedisObject()
 }
 
 RedisObject::~RedisObject() {
-    if (ptr != nullptr) {
+    /* INT keeps the value in 'ptr', EMBSTR the string inside the object. */
+    if (encoding == OBJ_ENCODING_RAW && ptr != nullptr) {
         sdsfree(ptr);
     }
 }
@@ -29,8 +30,42 @@ bool RedisObject::operator<(const RedisObjectPtr &r) const {
     }
 }
 
+/* An EMBSTR object, the sds header and string are placed in 'buf' so that
+ * make_shared puts the control block, the object and the string in a
+ * single allocation. */
+template <size_t N>
+struct EmbeddedObject : public RedisObject {
+    char buf[N];
+};
+
+template <size_t N>
+static RedisObjectPtr createEmbeddedObject(const char *ptr, size_t len) {
+    auto o = std::make_shared <EmbeddedObject<N>>();
+    struct sdshdr8 *sh = (struct sdshdr8 *) o->buf;
+    sh->len = len;
+    sh->alloc = len;
+    sh->flags = SDS_TYPE_8;
+    o->ptr = (sds) sh->buf;
+    if (ptr != nullptr) {
+        memcpy(o->ptr, ptr, len);
+    }
+    o->ptr[len] = '\0';
+    o->type = REDIS_STRING;
+    o->encoding = OBJ_ENCODING_EMBSTR;
+    o->calHash();
+    return o;
+}
+
+static RedisObjectPtr createIntegerObject(int64_t value) {
+    RedisObjectPtr o = std::make_shared<RedisObject>();
+    o->type = REDIS_STRING;
+    o->encoding = OBJ_ENCODING_INT;
+    o->ptr = (sds)(intptr_t) value;
+    return o;
+}
+
 RedisObjectPtr createObject(int32_t type, char *ptr) {
-    RedisObjectPtr o(new RedisObject());
+    RedisObjectPtr o = std::make_shared<RedisObject>();
     o->encoding = REDIS_ENCODING_RAW;
     o->type = type;
     o->ptr = ptr;
@@ -48,9 +83,7 @@ int32_t getLongLongFromObject(const RedisObjectPtr &o, int64_t *target) {
                 return REDIS_ERR;
             }
         } else if (o->encoding == OBJ_ENCODING_INT) {
-            if (string2ll(o->ptr, sdslen(o->ptr), &value) == 0) {
-                return REDIS_ERR;
-            }
+            value = (intptr_t) o->ptr;
         } else {
             assert(false);
         }
@@ -95,11 +128,36 @@ int32_t getLongFromObjectOrReply(Buffer *buffer,
 }
 
 RedisObjectPtr createStringObjectFromLongLong(int64_t value) {
-    RedisObjectPtr o;
     if (value >= 0 && value < REDIS_SHARED_INTEGERS) {
-        o = shared.integers[value - 1];
+        return shared.integers[value];
+    } else if (value < INTPTR_MIN || value > INTPTR_MAX) {
+        return createObject(REDIS_STRING, sdsfromlonglong(value));
     } else {
-        o = createObject(REDIS_STRING, sdsfromlonglong(value));
+        return createIntegerObject(value);
+    }
+}
+
+RedisObjectPtr createEncodedStringObject(const char *ptr, size_t len) {
+    int64_t value;
+    if (len <= 20 && string2ll(ptr, len, &value)) {
+        return createStringObjectFromLongLong(value);
+    }
+    return createStringObject((char *) ptr, len);
+}
+
+RedisObjectPtr tryObjectEncoding(const RedisObjectPtr &o) {
+    if (!sdsEncodedObject(o)) {
+        return o;
+    }
+
+    int64_t value;
+    size_t len = sdslen(o->ptr);
+    if (len <= 20 && string2ll(o->ptr, len, &value)) {
+        return createStringObjectFromLongLong(value);
+    }
+
+    if (o->encoding == OBJ_ENCODING_RAW && len <= REDIS_ENCODING_EMBSTR_SIZE_LIMIT) {
+        return createEmbeddedStringObject(o->ptr, len);
     }
     return o;
 }
@@ -135,7 +193,7 @@ int32_t getDoubleFromObject(const RedisObjectPtr &o, double *target) {
                 (errno == ERANGE && value == 0) || errno == EINVAL)
                 return REDIS_ERR;
         } else if (o->encoding == OBJ_ENCODING_INT) {
-            value = (long) o->ptr;
+            value = (intptr_t) o->ptr;
         } else {
             assert(false);
         }
@@ -287,8 +345,7 @@ void createSharedObjects() {
     shared.eval = createObject(REDIS_STRING, sdsnew("eval"));
 
     for (j = 0; j < REDIS_SHARED_INTEGERS; j++) {
-        shared.integers[j] = createObject(REDIS_STRING, sdsfromlonglong(j));
-        shared.integers[j]->encoding = REDIS_ENCODING_INT;
+        shared.integers[j] = createIntegerObject(j);
     }
 
     for (j = 0; j < REDIS_SHARED_BULKHDR_LEN; j++) {
@@ -298,9 +355,25 @@ void createSharedObjects() {
 }
 
 RedisObjectPtr createStringObject(char *ptr, size_t len) {
+    if (len <= REDIS_ENCODING_EMBSTR_SIZE_LIMIT) {
+        return createEmbeddedStringObject(ptr, len);
+    }
     return createRawStringObject(ptr, len);
 }
 
+RedisObjectPtr createEmbeddedStringObject(const char *ptr, size_t len) {
+    /* Size classes for the sds header, the string and its terminator. */
+    size_t size = sizeof(struct sdshdr8) + len + 1;
+    assert(len <= REDIS_ENCODING_EMBSTR_SIZE_LIMIT);
+    if (size <= 16) {
+        return createEmbeddedObject<16>(ptr, len);
+    } else if (size <= 32) {
+        return createEmbeddedObject<32>(ptr, len);
+    } else {
+        return createEmbeddedObject<48>(ptr, len);
+    }
+}
+
 RedisObjectPtr createRawStringObject(int32_t type, char *ptr, size_t len) {
     return createObject(type, sdsnewlen(ptr, len));
 }
@@ -315,12 +388,11 @@ void addReplyBulkLen(Buffer *buffer, const RedisObjectPtr &obj) {
     if (sdsEncodedObject(obj)) {
         len = sdslen((const sds) obj->ptr);
     } else {
-        long n = (long) obj->ptr;
+        int64_t n = (intptr_t) obj->ptr;
         len = 1;
 
         if (n < 0) {
             len++;
-            n = -n;
         }
 
         while ((n = n / 10) != 0) {
@@ -337,7 +409,13 @@ void addReplyBulkLen(Buffer *buffer, const RedisObjectPtr &obj) {
 
 void addReplyBulk(Buffer *buffer, const RedisObjectPtr &obj) {
     addReplyBulkLen(buffer, obj);
-    addReply(buffer, obj);
+    /* Large values are not copied, the reply keeps a reference to the
+     * object until it has been written to the socket. */
+    if (sdsEncodedObject(obj) && sdslen(obj->ptr) >= REDIS_REPLY_REF_LEN) {
+        buffer->appendRef(obj->ptr, sdslen(obj->ptr), obj);
+    } else {
+        addReply(buffer, obj);
+    }
     addReply(buffer, shared.crlf);
 }
 
@@ -359,13 +437,13 @@ void addReplyLongLongWithPrefix(Buffer *buffer, int64_t ll, char prefix) {
     buffer->append(buf, len + 3);
 }
 
-void addReplyLongLong(Buffer *buffer, size_t len) {
-    if (len == 0) {
+void addReplyLongLong(Buffer *buffer, int64_t ll) {
+    if (ll == 0) {
         addReply(buffer, shared.czero);
-    } else if (len == 1) {
+    } else if (ll == 1) {
         addReply(buffer, shared.cone);
     } else {
-        addReplyLongLongWithPrefix(buffer, len, ':');
+        addReplyLongLongWithPrefix(buffer, ll, ':');
     }
 }
 
@@ -384,7 +462,13 @@ void addReplyError(Buffer *buffer, const char *str) {
 }
 
 void addReply(Buffer *buffer, const RedisObjectPtr &obj) {
-    buffer->append(obj->ptr, sdslen(obj->ptr));
+    if (obj->encoding == OBJ_ENCODING_INT) {
+        char buf[32];
+        int32_t len = ll2string(buf, sizeof(buf), (intptr_t) obj->ptr);
+        buffer->append(buf, len);
+    } else {
+        buffer->append(obj->ptr, sdslen(obj->ptr));
+    }
 }
 
 /* Add sds to reply (takes ownership of sds and frees it) */
@@ -468,6 +552,48 @@ void addReplyErrorLength(Buffer *buffer, const char *s, size_t len) {
     addReplyString(buffer, "\r\n", 2);
 }
 
+const char *strType(int32_t type) {
+    switch (type) {
+        case OBJ_STRING:
+            return "string";
+        case OBJ_LIST:
+            return "list";
+        case OBJ_SET:
+            return "set";
+        case OBJ_ZSET:
+            return "zset";
+        case OBJ_HASH:
+            return "hash";
+        default:
+            return nullptr;
+    }
+}
+
+const char *strEncoding(int32_t encoding) {
+    switch (encoding) {
+        case OBJ_ENCODING_RAW:
+            return "raw";
+        case OBJ_ENCODING_INT:
+            return "int";
+        case OBJ_ENCODING_HT:
+            return "hashtable";
+        case OBJ_ENCODING_LINKEDLIST:
+            return "linkedlist";
+        case OBJ_ENCODING_INTSET:
+            return "intset";
+        case OBJ_ENCODING_SKIPLIST:
+            return "skiplist";
+        case OBJ_ENCODING_EMBSTR:
+            return "embstr";
+        case OBJ_ENCODING_QUICKLIST:
+            return "quicklist";
+        case OBJ_ENCODING_LISTPACK:
+            return "listpack";
+        default:
+            return "unknown";
+    }
+}
+
 
 
 
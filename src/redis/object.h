@@ -37,6 +37,36 @@ struct Equal {
     }
 };
 
+/* One step of SSCAN, HSCAN or ZSCAN over the buckets of a std unordered
+ * container, calls 'fn' for the elements of at most 'count' of them or of
+ * ten times as many buckets. The cursor holds the bucket count in the high
+ * half and the next bucket in the low half. The bucket of an element
+ * changes when the container rehashes, so a cursor from before a rehash
+ * starts over: elements may come twice but none present all along is
+ * missed. Returns the next cursor, 0 once done. */
+template <typename Dict, typename Fn>
+uint64_t scanBuckets(const Dict &dict, uint64_t cursor, size_t count, Fn &&fn) {
+    size_t buckets = dict.bucket_count();
+    size_t idx = cursor & 0xffffffff;
+    if ((cursor >> 32) != buckets || idx >= buckets) {
+        idx = 0;
+    }
+
+    size_t visited = 0;
+    for (size_t empty = count * 10; idx < buckets && visited < count && empty > 0; idx++) {
+        if (dict.begin(idx) == dict.end(idx)) {
+            empty--;
+            continue;
+        }
+
+        for (auto it = dict.begin(idx); it != dict.end(idx); ++it) {
+            fn(*it);
+            visited++;
+        }
+    }
+    return idx < buckets ? (uint64_t(buckets) << 32) | idx : 0;
+}
+
 struct SharedObjectsStruct {
     RedisObjectPtr crlf, ok, err, emptybulk, czero,
             cone, cnegone, pping, ping, pong, ppong, space,
@@ -69,10 +99,24 @@ RedisObjectPtr createRawStringObject(int32_t type, char *ptr, size_t len);
 
 RedisObjectPtr createObject(int32_t type, char *ptr);
 
+/* Strings up to REDIS_ENCODING_EMBSTR_SIZE_LIMIT bytes are EMBSTR, the sds
+ * string lives in the same allocation as the object. Longer ones are RAW. */
 RedisObjectPtr createStringObject(char *ptr, size_t len);
 
+RedisObjectPtr createEmbeddedStringObject(const char *ptr, size_t len);
+
+/* Values below REDIS_SHARED_INTEGERS come from the shared pool, others are
+ * INT objects with the value stored in place of the pointer. */
 RedisObjectPtr createStringObjectFromLongLong(int64_t value);
 
+/* A string value in its most compact encoding: INT if it is a number that
+ * prints back the same, EMBSTR if short enough, RAW otherwise. */
+RedisObjectPtr createEncodedStringObject(const char *ptr, size_t len);
+
+/* Same for an object that already exists, which is returned when it can
+ * not be made smaller. */
+RedisObjectPtr tryObjectEncoding(const RedisObjectPtr &o);
+
 /* -----------------------------------------------------------------------------
  * Low level functions to add more data to output buffers.
  * -------------------------------------------------------------------------- */
@@ -100,7 +144,7 @@ void addReplyErrorFormat(Buffer *buffer, const char *fmt, ...);
 
 void addReplyBulkCBuffer(Buffer *buffer, const char *p, size_t len);
 
-void addReplyLongLong(Buffer *buffer, size_t len);
+void addReplyLongLong(Buffer *buffer, int64_t ll);
 
 void addReplySds(Buffer *buffer, sds s);
 
@@ -127,6 +171,11 @@ int32_t getDoubleFromObject(const RedisObjectPtr &o, double *target);
 int32_t getDoubleFromObjectOrReply(Buffer *buffer,
                                    const RedisObjectPtr &o, double *target, const char *msg);
 
+const char *strEncoding(int32_t encoding);
+
+/* The name TYPE reports, nullptr for an unknown type. */
+const char *strType(int32_t type);
+
 
 
 
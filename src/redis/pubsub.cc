@@ -0,0 +1,320 @@
+#include "pubsub.h"
+
+PubSub::PubSub() {
+
+}
+
+PubSub::~PubSub() {
+
+}
+
+void PubSub::setLoops(const std::vector<EventLoop *> &loops) {
+    this->loops = loops;
+    locals.clear();
+    for (size_t i = 0; i < loops.size(); i++) {
+        locals.push_back(std::unique_ptr<Local>(new Local()));
+    }
+}
+
+void PubSub::addCount(int32_t core, const RedisObjectPtr &name, bool pattern) {
+    CountMap &map = pattern ? patternCounts : channelCounts;
+    auto it = map.find(name);
+    if (it == map.end()) {
+        Counts counts;
+        counts.loops.resize(loops.size(), 0);
+        counts.total = 0;
+        it = map.insert(std::make_pair(name, std::move(counts))).first;
+        if (pattern) {
+            patternTrie.insert(name);
+        }
+    }
+
+    it->second.loops[core]++;
+    it->second.total++;
+}
+
+void PubSub::removeCount(int32_t core, const RedisObjectPtr &name, bool pattern) {
+    CountMap &map = pattern ? patternCounts : channelCounts;
+    auto it = map.find(name);
+    assert(it != map.end());
+    it->second.loops[core]--;
+    if (--it->second.total == 0) {
+        if (pattern) {
+            patternTrie.erase(it->first);
+        }
+        map.erase(it);
+    }
+}
+
+size_t PubSub::add(int32_t core, const TcpConnectionPtr &conn, const RedisObjectPtr &name, bool pattern) {
+    Local &local = *locals[core];
+    Client &client = local.clients[conn->getSockfd()];
+    if ((pattern ? client.patterns : client.channels).insert(name).second) {
+        Subscribers &subscribers = (pattern ? local.patterns : local.channels)[name];
+        subscribers.index[conn->getSockfd()] = subscribers.conns.size();
+        subscribers.conns.push_back(conn);
+
+        std::unique_lock <std::mutex> lck(mutex);
+        addCount(core, name, pattern);
+    }
+    return client.channels.size() + client.patterns.size();
+}
+
+size_t PubSub::remove(int32_t core, int32_t sockfd, const RedisObjectPtr &name, bool pattern) {
+    Local &local = *locals[core];
+    auto it = local.clients.find(sockfd);
+    if (it == local.clients.end()) {
+        return 0;
+    }
+
+    Client &client = it->second;
+    if ((pattern ? client.patterns : client.channels).erase(name) > 0) {
+        SubscriberMap &map = pattern ? local.patterns : local.channels;
+        auto iter = map.find(name);
+        assert(iter != map.end());
+        Subscribers &subscribers = iter->second;
+
+        /* Move the last one into the hole. */
+        size_t pos = subscribers.index[sockfd];
+        subscribers.index.erase(sockfd);
+        if (pos + 1 < subscribers.conns.size()) {
+            subscribers.conns[pos] = std::move(subscribers.conns.back());
+            subscribers.index[subscribers.conns[pos]->getSockfd()] = pos;
+        }
+        subscribers.conns.pop_back();
+
+        /* The key may be the object of this connection, drop it last. */
+        RedisObjectPtr key = iter->first;
+        if (subscribers.conns.empty()) {
+            map.erase(iter);
+        }
+
+        std::unique_lock <std::mutex> lck(mutex);
+        removeCount(core, key, pattern);
+    }
+
+    size_t count = client.channels.size() + client.patterns.size();
+    if (count == 0) {
+        local.clients.erase(it);
+    }
+    return count;
+}
+
+size_t PubSub::subscribe(int32_t core, const TcpConnectionPtr &conn, const RedisObjectPtr &channel) {
+    return add(core, conn, channel, false);
+}
+
+size_t PubSub::unsubscribe(int32_t core, int32_t sockfd, const RedisObjectPtr &channel) {
+    return remove(core, sockfd, channel, false);
+}
+
+size_t PubSub::psubscribe(int32_t core, const TcpConnectionPtr &conn, const RedisObjectPtr &pattern) {
+    return add(core, conn, pattern, true);
+}
+
+size_t PubSub::punsubscribe(int32_t core, int32_t sockfd, const RedisObjectPtr &pattern) {
+    return remove(core, sockfd, pattern, true);
+}
+
+void PubSub::getChannels(int32_t core, int32_t sockfd, std::vector <RedisObjectPtr> *channels) {
+    auto it = locals[core]->clients.find(sockfd);
+    if (it != locals[core]->clients.end()) {
+        channels->assign(it->second.channels.begin(), it->second.channels.end());
+    }
+}
+
+void PubSub::getPatterns(int32_t core, int32_t sockfd, std::vector <RedisObjectPtr> *patterns) {
+    auto it = locals[core]->clients.find(sockfd);
+    if (it != locals[core]->clients.end()) {
+        patterns->assign(it->second.patterns.begin(), it->second.patterns.end());
+    }
+}
+
+size_t PubSub::subscriptions(int32_t core, int32_t sockfd) {
+    auto it = locals[core]->clients.find(sockfd);
+    if (it == locals[core]->clients.end()) {
+        return 0;
+    }
+    return it->second.channels.size() + it->second.patterns.size();
+}
+
+void PubSub::clear(int32_t core, int32_t sockfd) {
+    if (core < 0 || core >= locals.size()) {
+        return;
+    }
+
+    std::vector <RedisObjectPtr> names;
+    getChannels(core, sockfd, &names);
+    for (auto &it : names) {
+        remove(core, sockfd, it, false);
+    }
+
+    names.clear();
+    getPatterns(core, sockfd, &names);
+    for (auto &it : names) {
+        remove(core, sockfd, it, true);
+    }
+}
+
+RedisObjectPtr PubSub::createFrame(const RedisObjectPtr &pattern, const RedisObjectPtr &channel,
+                                   const RedisObjectPtr &message) {
+    const RedisObjectPtr &kind = pattern ? shared.pmessagebulk : shared.messagebulk;
+    const RedisObjectPtr *bulks[3];
+    size_t n = 0;
+    if (pattern != nullptr) {
+        bulks[n++] = &pattern;
+    }
+    bulks[n++] = &channel;
+    bulks[n++] = &message;
+
+    /* Sized up front and filled with memcpy(), this runs on every PUBLISH. */
+    char lens[3][32];
+    int32_t lenlens[3];
+    size_t len = 4 + sdslen(kind->ptr);
+    for (size_t i = 0; i < n; i++) {
+        lenlens[i] = ll2string(lens[i], sizeof(lens[i]), sdslen((*bulks[i])->ptr));
+        len += 5 + lenlens[i] + sdslen((*bulks[i])->ptr);
+    }
+
+    sds s = sdsnewlen(nullptr, len);
+    char *p = s;
+    *p++ = '*';
+    *p++ = '0' + n + 1;
+    *p++ = '\r';
+    *p++ = '\n';
+    memcpy(p, kind->ptr, sdslen(kind->ptr));
+    p += sdslen(kind->ptr);
+    for (size_t i = 0; i < n; i++) {
+        const sds bulk = (*bulks[i])->ptr;
+        *p++ = '$';
+        memcpy(p, lens[i], lenlens[i]);
+        p += lenlens[i];
+        *p++ = '\r';
+        *p++ = '\n';
+        memcpy(p, bulk, sdslen(bulk));
+        p += sdslen(bulk);
+        *p++ = '\r';
+        *p++ = '\n';
+    }
+    assert(p == s + len);
+
+    /* Never looked up, so no hash. */
+    RedisObjectPtr frame = std::make_shared<RedisObject>();
+    frame->type = REDIS_STRING;
+    frame->encoding = OBJ_ENCODING_RAW;
+    frame->ptr = s;
+    return frame;
+}
+
+int64_t PubSub::publish(const RedisObjectPtr &channel, const RedisObjectPtr &message) {
+    size_t n = loops.size();
+    std::vector <int32_t> channelLoops;
+    std::vector <std::pair<RedisObjectPtr, std::vector<int32_t>>> matched;
+    int64_t receivers = 0;
+    {
+        std::unique_lock <std::mutex> lck(mutex);
+        auto it = channelCounts.find(channel);
+        if (it != channelCounts.end()) {
+            channelLoops = it->second.loops;
+            receivers += it->second.total;
+        }
+
+        if (patternTrie.size() > 0) {
+            patternTrie.match(channel->ptr, sdslen(channel->ptr), [&](const RedisObjectPtr &pattern) {
+                auto iter = patternCounts.find(pattern);
+                matched.push_back(std::make_pair(pattern, iter->second.loops));
+                receivers += iter->second.total;
+            });
+        }
+    }
+
+    if (receivers == 0) {
+        return 0;
+    }
+
+    RedisObjectPtr frame;
+    if (!channelLoops.empty()) {
+        frame = createFrame(nullptr, channel, message);
+    }
+
+    std::vector <RedisObjectPtr> frames;
+    for (auto &it : matched) {
+        frames.push_back(createFrame(it.first, channel, message));
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        Delivery delivery;
+        delivery.channel = channel;
+        if (!channelLoops.empty() && channelLoops[i] > 0) {
+            delivery.frame = frame;
+        }
+
+        for (size_t j = 0; j < matched.size(); j++) {
+            if (matched[j].second[i] > 0) {
+                delivery.patterns.push_back(std::make_pair(matched[j].first, frames[j]));
+            }
+        }
+
+        if (delivery.frame != nullptr || !delivery.patterns.empty()) {
+            loops[i]->queueInLoop([this, i, delivery = std::move(delivery)]() {
+                deliver(i, delivery);
+            });
+        }
+    }
+    return receivers;
+}
+
+void PubSub::write(const Subscribers &subscribers, const RedisObjectPtr &frame) {
+    /* Same rule as addReplyBulk(), a large frame is referenced by every
+     * output buffer instead of copied into each. */
+    size_t len = sdslen(frame->ptr);
+    bool ref = len >= REDIS_REPLY_REF_LEN;
+    for (auto &conn : subscribers.conns) {
+        Buffer *buffer = conn->outputBuffer();
+        if (ref) {
+            buffer->appendRef(frame->ptr, len, frame);
+        } else {
+            buffer->append(frame->ptr, len);
+        }
+        conn->sendPipe();
+    }
+}
+
+void PubSub::deliver(int32_t core, const Delivery &delivery) {
+    Local &local = *locals[core];
+    if (delivery.frame != nullptr) {
+        auto it = local.channels.find(delivery.channel);
+        if (it != local.channels.end()) {
+            write(it->second, delivery.frame);
+        }
+    }
+
+    for (auto &it : delivery.patterns) {
+        auto iter = local.patterns.find(it.first);
+        if (iter != local.patterns.end()) {
+            write(iter->second, it.second);
+        }
+    }
+}
+
+void PubSub::channels(const RedisObjectPtr &pattern, std::vector <RedisObjectPtr> *channels) {
+    std::unique_lock <std::mutex> lck(mutex);
+    for (auto &it : channelCounts) {
+        if (pattern == nullptr ||
+            stringmatchlen(pattern->ptr, sdslen(pattern->ptr),
+                           it.first->ptr, sdslen(it.first->ptr), 0)) {
+            channels->push_back(it.first);
+        }
+    }
+}
+
+int64_t PubSub::numsub(const RedisObjectPtr &channel) {
+    std::unique_lock <std::mutex> lck(mutex);
+    auto it = channelCounts.find(channel);
+    return it == channelCounts.end() ? 0 : it->second.total;
+}
+
+size_t PubSub::numpat() {
+    std::unique_lock <std::mutex> lck(mutex);
+    return patternCounts.size();
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "all.h"
+#include "object.h"
+#include "eventloop.h"
+#include "tcpconnection.h"
+#include "globtrie.h"
+
+/* Channel and pattern subscriptions, delivered by the loops the subscribers
+ * are served on. Every loop has its own subscriber tables and touches them
+ * without a lock: (P)SUBSCRIBE and (P)UNSUBSCRIBE run on the loop of the
+ * connection and only change the tables of that loop.
+ *
+ * A table behind a mutex counts the subscribers of every channel and
+ * pattern per loop. PUBLISH looks up there which loops to deliver to and
+ * matches the channel against the patterns in a GlobTrie. Each frame is
+ * encoded once, the loops get one queued closure each that hands the shared
+ * frame to all of their subscribers, so a message to 100k subscribers costs
+ * a few queueInLoop() calls instead of one per connection. */
+class PubSub {
+public:
+    PubSub();
+
+    ~PubSub();
+
+    /* The loops connections are served on, a loop is named by its index. */
+    void setLoops(const std::vector<EventLoop *> &loops);
+
+    /* These run on loop 'core', the loop of the connection, and return the
+     * number of channels and patterns it is subscribed to afterwards. */
+    size_t subscribe(int32_t core, const TcpConnectionPtr &conn, const RedisObjectPtr &channel);
+
+    size_t unsubscribe(int32_t core, int32_t sockfd, const RedisObjectPtr &channel);
+
+    size_t psubscribe(int32_t core, const TcpConnectionPtr &conn, const RedisObjectPtr &pattern);
+
+    size_t punsubscribe(int32_t core, int32_t sockfd, const RedisObjectPtr &pattern);
+
+    /* What a connection is subscribed to, for (P)UNSUBSCRIBE without
+     * arguments. */
+    void getChannels(int32_t core, int32_t sockfd, std::vector <RedisObjectPtr> *channels);
+
+    void getPatterns(int32_t core, int32_t sockfd, std::vector <RedisObjectPtr> *patterns);
+
+    /* The number of channels and patterns a connection is subscribed to. */
+    size_t subscriptions(int32_t core, int32_t sockfd);
+
+    /* Drop every subscription of a closed connection, on its loop. */
+    void clear(int32_t core, int32_t sockfd);
+
+    /* Queue the message to the subscribers of 'channel' and of the patterns
+     * matching it, returns how many there are. Any thread. */
+    int64_t publish(const RedisObjectPtr &channel, const RedisObjectPtr &message);
+
+    /* PUBSUB CHANNELS, with a nullptr pattern for all of them. */
+    void channels(const RedisObjectPtr &pattern, std::vector <RedisObjectPtr> *channels);
+
+    /* PUBSUB NUMSUB */
+    int64_t numsub(const RedisObjectPtr &channel);
+
+    /* PUBSUB NUMPAT, the number of patterns with a subscriber. */
+    size_t numpat();
+
+private:
+    PubSub(const PubSub &);
+
+    void operator=(const PubSub &);
+
+    /* The connections of one loop subscribed to one channel or pattern. A
+     * vector to deliver, the index by sockfd to remove in constant time. */
+    struct Subscribers {
+        std::vector <TcpConnectionPtr> conns;
+        std::unordered_map <int32_t, size_t> index;
+    };
+
+    typedef std::unordered_map <RedisObjectPtr, Subscribers, Hash, Equal> SubscriberMap;
+    typedef std::unordered_set <RedisObjectPtr, Hash, Equal> NameSet;
+
+    struct Client {
+        NameSet channels;
+        NameSet patterns;
+    };
+
+    /* Only touched on its loop. */
+    struct Local {
+        SubscriberMap channels;
+        SubscriberMap patterns;
+        std::unordered_map <int32_t, Client> clients;
+    };
+
+    struct Counts {
+        std::vector <int32_t> loops;
+        int64_t total;
+    };
+
+    typedef std::unordered_map <RedisObjectPtr, Counts, Hash, Equal> CountMap;
+
+    /* What one loop hands out for a PUBLISH: the message frame if it has
+     * subscribers of the channel, and the frame of every matching pattern
+     * it has subscribers of. */
+    struct Delivery {
+        RedisObjectPtr channel;
+        RedisObjectPtr frame;
+        std::vector <std::pair<RedisObjectPtr, RedisObjectPtr>> patterns;
+    };
+
+    size_t add(int32_t core, const TcpConnectionPtr &conn, const RedisObjectPtr &name, bool pattern);
+
+    size_t remove(int32_t core, int32_t sockfd, const RedisObjectPtr &name, bool pattern);
+
+    /* Both under 'mutex'. */
+    void addCount(int32_t core, const RedisObjectPtr &name, bool pattern);
+
+    void removeCount(int32_t core, const RedisObjectPtr &name, bool pattern);
+
+    void deliver(int32_t core, const Delivery &delivery);
+
+    static void write(const Subscribers &subscribers, const RedisObjectPtr &frame);
+
+    /* A message frame, or a pmessage frame if 'pattern' is not nullptr. */
+    static RedisObjectPtr createFrame(const RedisObjectPtr &pattern, const RedisObjectPtr &channel,
+                                      const RedisObjectPtr &message);
+
+    std::vector<EventLoop *> loops;
+    std::vector <std::unique_ptr<Local>> locals;
+
+    std::mutex mutex;
+    CountMap channelCounts;
+    CountMap patternCounts;
+    GlobTrie patternTrie;
+};
@@ -0,0 +1,397 @@
+#include "quicklist.h"
+#include "util.h"
+#include "zmalloc.h"
+
+Quicklist::Quicklist(int32_t compressDepth)
+        : count(0),
+          compressDepth(compressDepth) {
+
+}
+
+Quicklist::~Quicklist() {
+    for (auto &slot : slots) {
+        freeNode(slot.node);
+    }
+}
+
+Quicklist::Node *Quicklist::createNode() {
+    Node *node = new Node;
+    node->lzf = nullptr;
+    node->lzfLen = 0;
+    node->rawLen = 0;
+    node->count = 0;
+    node->incompressible = false;
+    return node;
+}
+
+void Quicklist::freeNode(Node *node) {
+    zfree(node->lzf);
+    delete node;
+}
+
+void Quicklist::insertNode(size_t pos, Node *node) {
+    Slot slot;
+    if (pos > 0) {
+        slot.start = slots[pos - 1].start + slots[pos - 1].node->count;
+    } else {
+        slot.start = slots.empty() ? 0 : slots[0].start - node->count;
+    }
+
+    slot.node = node;
+    slots.insert(slots.begin() + pos, slot);
+    count += node->count;
+}
+
+void Quicklist::deleteNode(size_t pos) {
+    count -= slots[pos].node->count;
+    freeNode(slots[pos].node);
+    slots.erase(slots.begin() + pos);
+}
+
+void Quicklist::renumber(size_t pos) {
+    for (size_t i = pos + 1; i < slots.size(); i++) {
+        slots[i].start = slots[i - 1].start + slots[i - 1].node->count;
+    }
+}
+
+size_t Quicklist::locate(int64_t index, int64_t *offset) const {
+    int64_t start = slots.front().start + index;
+    auto it = std::upper_bound(slots.begin(), slots.end(), start,
+                               [](int64_t start, const Slot &slot) {
+                                   return start < slot.start;
+                               });
+    --it;
+    *offset = start - it->start;
+    return it - slots.begin();
+}
+
+bool Quicklist::fits(const Node *node, size_t len) {
+    /* An entry takes at most 10 bytes besides its data. */
+    return node->lzf == nullptr && node->lp.bytes() + len + 10 <= kNodeBytes;
+}
+
+/* Compression goes through a scratch buffer per thread, so that only the
+ * final sizes are allocated and no node sized holes are left behind. */
+thread_local std::vector<unsigned char> Quicklist::scratchBuffer;
+
+void Quicklist::decompressInto(const Node *node, Listpack *lp) {
+    scratchBuffer.resize(node->rawLen);
+    unsigned int n = lzfDecompress(node->lzf, node->lzfLen, scratchBuffer.data(), node->rawLen);
+    assert(n == node->rawLen);
+    bool ok = lp->assign(scratchBuffer.data(), n);
+    assert(ok);
+    (void) ok;
+}
+
+const Listpack &Quicklist::view(const Node *node, Listpack *scratch) const {
+    if (node->lzf == nullptr) {
+        return node->lp;
+    }
+
+    decompressInto(node, scratch);
+    return *scratch;
+}
+
+void Quicklist::compress(Node *node) {
+    if (node->lzf != nullptr || node->incompressible) {
+        return;
+    }
+
+    size_t raw = node->lp.bytes();
+    if (raw < kMinCompressBytes) {
+        node->incompressible = true;
+        return;
+    }
+
+    /* Only keep it if it saves at least 8 bytes. */
+    scratchBuffer.resize(raw);
+    unsigned int n = lzfCompress(node->lp.data(), raw, scratchBuffer.data(), raw - 8);
+    if (n == 0) {
+        node->incompressible = true;
+        return;
+    }
+
+    node->lzf = (char *) zmalloc(n);
+    memcpy(node->lzf, scratchBuffer.data(), n);
+    node->lzfLen = n;
+    node->rawLen = raw;
+    node->lp.clear();
+}
+
+void Quicklist::decompress(Node *node) {
+    if (node->lzf == nullptr) {
+        return;
+    }
+
+    decompressInto(node, &node->lp);
+    zfree(node->lzf);
+    node->lzf = nullptr;
+    node->lzfLen = 0;
+    node->rawLen = 0;
+}
+
+bool Quicklist::isInterior(size_t pos) const {
+    return compressDepth > 0 && pos >= size_t(compressDepth) &&
+           pos + compressDepth < slots.size();
+}
+
+void Quicklist::recompress(size_t pos) {
+    if (isInterior(pos)) {
+        compress(slots[pos].node);
+    }
+}
+
+void Quicklist::applyDepth() {
+    if (compressDepth <= 0) {
+        return;
+    }
+
+    /* Nodes move by at most one place per change, so only the first node
+     * past the depth can have just become interior. */
+    size_t n = slots.size();
+    size_t depth = compressDepth;
+    for (size_t i = 0; i < depth && i < n; i++) {
+        decompress(slots[i].node);
+        decompress(slots[n - 1 - i].node);
+    }
+
+    if (n > depth * 2) {
+        compress(slots[depth].node);
+        compress(slots[n - 1 - depth].node);
+    }
+}
+
+void Quicklist::split(size_t pos) {
+    Node *node = slots[pos].node;
+    if (node->count <= 1 || node->lp.bytes() <= kNodeBytes) {
+        return;
+    }
+
+    uint32_t mid = node->count / 2;
+    Node *right = createNode();
+    char buf[Listpack::kIntBufSize];
+    unsigned char *start = node->lp.seek(mid);
+    for (unsigned char *p = start; p != nullptr; p = node->lp.next(p)) {
+        std::string_view value = Listpack::get(p).view(buf);
+        right->lp.append(value.data(), value.size());
+    }
+
+    /* The elements only move, the positions after the node stay. */
+    right->count = node->count - mid;
+    node->lp.erase(start, right->count);
+    node->count = mid;
+    count -= right->count;
+    insertNode(pos + 1, right);
+}
+
+void Quicklist::push(const char *s, size_t len, int32_t where) {
+    bool head = where == REDIS_LIST_HEAD;
+    Node *node = slots.empty() ? nullptr : (head ? slots.front().node : slots.back().node);
+    if (node != nullptr && fits(node, len)) {
+        if (head) {
+            node->lp.insert(node->lp.first(), s, len);
+            slots.front().start--;
+        } else {
+            node->lp.append(s, len);
+        }
+        node->count++;
+        node->incompressible = false;
+        count++;
+        return;
+    }
+
+    node = createNode();
+    node->lp.append(s, len);
+    node->count = 1;
+    insertNode(head ? 0 : slots.size(), node);
+    applyDepth();
+}
+
+bool Quicklist::pop(int32_t where, const Callback &cb) {
+    if (slots.empty()) {
+        return false;
+    }
+
+    bool head = where == REDIS_LIST_HEAD;
+    size_t pos = head ? 0 : slots.size() - 1;
+    Node *node = slots[pos].node;
+    decompress(node);
+    unsigned char *p = head ? node->lp.first() : node->lp.last();
+    char buf[Listpack::kIntBufSize];
+    cb(Listpack::get(p).view(buf));
+    node->lp.erase(p);
+    node->count--;
+    node->incompressible = false;
+    count--;
+    if (head) {
+        slots[pos].start++;
+    }
+
+    if (node->count == 0) {
+        deleteNode(pos);
+        applyDepth();
+    }
+    return true;
+}
+
+bool Quicklist::index(int64_t index, const Callback &cb) const {
+    if (index < 0) {
+        index += count;
+    }
+
+    if (index < 0 || index >= int64_t(count)) {
+        return false;
+    }
+
+    int64_t offset;
+    const Node *node = slots[locate(index, &offset)].node;
+    Listpack scratch;
+    const Listpack &lp = view(node, &scratch);
+    char buf[Listpack::kIntBufSize];
+    cb(Listpack::get(lp.seek(offset)).view(buf));
+    return true;
+}
+
+bool Quicklist::replace(int64_t index, const char *s, size_t len) {
+    if (index < 0) {
+        index += count;
+    }
+
+    if (index < 0 || index >= int64_t(count)) {
+        return false;
+    }
+
+    int64_t offset;
+    size_t pos = locate(index, &offset);
+    Node *node = slots[pos].node;
+    decompress(node);
+    node->lp.replace(node->lp.seek(offset), s, len);
+    node->incompressible = false;
+
+    split(pos);
+    applyDepth();
+    recompress(pos);
+    if (pos + 1 < slots.size()) {
+        recompress(pos + 1);
+    }
+    return true;
+}
+
+bool Quicklist::insert(const char *pivot, size_t plen, const char *s, size_t len, bool after) {
+    Listpack scratch;
+    for (size_t pos = 0; pos < slots.size(); pos++) {
+        Node *node = slots[pos].node;
+        const Listpack &lp = view(node, &scratch);
+        int64_t offset = 0;
+        unsigned char *p = lp.first();
+        while (p != nullptr && !Listpack::equals(p, pivot, plen)) {
+            p = lp.next(p);
+            offset++;
+        }
+
+        if (p == nullptr) {
+            continue;
+        }
+
+        decompress(node);
+        p = node->lp.seek(offset);
+        node->lp.insert(after ? node->lp.next(p) : p, s, len);
+        node->count++;
+        node->incompressible = false;
+        count++;
+        renumber(pos);
+
+        split(pos);
+        applyDepth();
+        recompress(pos);
+        if (pos + 1 < slots.size()) {
+            recompress(pos + 1);
+        }
+        return true;
+    }
+    return false;
+}
+
+void Quicklist::erase(int64_t start, int64_t n) {
+    int64_t offset;
+    size_t pos = locate(start, &offset);
+    size_t first = pos;
+    int64_t base = slots.front().start;
+
+    /* At most the first and the last node of the range are left partly
+     * erased, whole nodes in between go away. */
+    while (n > 0 && pos < slots.size()) {
+        Node *node = slots[pos].node;
+        int64_t take = std::min(n, int64_t(node->count) - offset);
+        if (offset == 0 && take == node->count) {
+            deleteNode(pos);
+        } else {
+            decompress(node);
+            node->lp.erase(node->lp.seek(offset), take);
+            node->count -= take;
+            node->incompressible = false;
+            count -= take;
+            pos++;
+        }
+
+        n -= take;
+        offset = 0;
+    }
+
+    if (slots.empty()) {
+        return;
+    }
+
+    if (first == 0) {
+        slots[0].start = base;
+    }
+    renumber(first > 0 ? first - 1 : 0);
+
+    applyDepth();
+    recompress(first);
+    if (first + 1 < slots.size()) {
+        recompress(first + 1);
+    }
+}
+
+void Quicklist::range(int64_t start, int64_t end, const Callback &cb) const {
+    int64_t rangelen = end - start + 1;
+    int64_t offset;
+    size_t pos = locate(start, &offset);
+    Listpack scratch;
+    char buf[Listpack::kIntBufSize];
+
+    for (; rangelen > 0 && pos < slots.size(); pos++) {
+        const Listpack &lp = view(slots[pos].node, &scratch);
+        for (unsigned char *p = lp.seek(offset); rangelen > 0 && p != nullptr; p = lp.next(p)) {
+            cb(Listpack::get(p).view(buf));
+            rangelen--;
+        }
+        offset = 0;
+    }
+}
+
+void Quicklist::forEachNode(const NodeCallback &cb) const {
+    Listpack scratch;
+    for (auto &slot : slots) {
+        cb(view(slot.node, &scratch));
+    }
+}
+
+bool Quicklist::appendListpack(const unsigned char *buf, size_t len) {
+    Node *node = createNode();
+    if (!node->lp.assign(buf, len)) {
+        freeNode(node);
+        return false;
+    }
+
+    node->count = node->lp.size();
+    if (node->count == 0) {
+        freeNode(node);
+        return true;
+    }
+
+    insertNode(slots.size(), node);
+    applyDepth();
+    return true;
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "all.h"
+#include "listpack.h"
+
+/* A list of listpack nodes, each holding up to kNodeBytes of elements, so
+ * a long list costs a few bytes per element instead of an object per
+ * element. The nodes are kept in order in a deque of slots, each with the
+ * position of its first element, so pushes and pops touch only the end
+ * nodes and an index is a binary search over the slots followed by a seek
+ * inside one listpack.
+ *
+ * Positions only need to be relative to each other: a push or a pop at the
+ * head moves the position of the head node instead of every other one.
+ *
+ * With a compress depth of n the nodes more than n away from both ends are
+ * kept LZF compressed, queues and feeds mostly touch the ends and the
+ * middle is rarely read. A depth of 0 disables compression. */
+class Quicklist {
+public:
+    typedef std::function<void(const std::string_view &)> Callback;
+    typedef std::function<void(const Listpack &)> NodeCallback;
+
+    /* A node is not grown past this size, a larger element gets a node of
+     * its own. */
+    const static size_t kNodeBytes = 8192;
+
+    /* Smaller nodes are not worth compressing. */
+    const static size_t kMinCompressBytes = 48;
+
+    explicit Quicklist(int32_t compressDepth);
+
+    ~Quicklist();
+
+    size_t size() const { return count; }
+
+    size_t nodes() const { return slots.size(); }
+
+    /* 'where' is REDIS_LIST_HEAD or REDIS_LIST_TAIL. */
+    void push(const char *s, size_t len, int32_t where);
+
+    /* Calls 'cb' with the element before it is removed, returns false if
+     * the list is empty. */
+    bool pop(int32_t where, const Callback &cb);
+
+    /* Negative indexes count from the tail. Returns false if 'index' is out
+     * of range. */
+    bool index(int64_t index, const Callback &cb) const;
+
+    bool replace(int64_t index, const char *s, size_t len);
+
+    /* Insert before or after the first element equal to 'pivot', returns
+     * false if there is none. */
+    bool insert(const char *pivot, size_t plen, const char *s, size_t len, bool after);
+
+    /* Remove 'n' elements starting at 'start', which must be valid. */
+    void erase(int64_t start, int64_t n);
+
+    /* Elements with an index from 'start' to 'end', both valid. */
+    void range(int64_t start, int64_t end, const Callback &cb) const;
+
+    /* Every node as an uncompressed listpack, head first. */
+    void forEachNode(const NodeCallback &cb) const;
+
+    /* Append a node with a copy of a serialized listpack. Returns false if
+     * it is not a valid one. */
+    bool appendListpack(const unsigned char *buf, size_t len);
+
+private:
+    Quicklist(const Quicklist &);
+
+    void operator=(const Quicklist &);
+
+    struct Node {
+        Listpack lp;        /* empty while compressed */
+        char *lzf;          /* the compressed listpack, or nullptr */
+        uint32_t lzfLen;
+        uint32_t rawLen;    /* listpack bytes before compression */
+        uint32_t count;
+        bool incompressible; /* compression failed since the last change */
+    };
+
+    struct Slot {
+        int64_t start;
+        Node *node;
+    };
+
+    static Node *createNode();
+
+    static void freeNode(Node *node);
+
+    /* Insert a node at slot 'pos' right after the elements before it. */
+    void insertNode(size_t pos, Node *node);
+
+    void deleteNode(size_t pos);
+
+    /* Recompute the positions of the slots after 'pos'. */
+    void renumber(size_t pos);
+
+    /* The slot holding element 'index' in [0, count) and the offset of the
+     * element inside its node. */
+    size_t locate(int64_t index, int64_t *offset) const;
+
+    /* The listpack of 'node', decompressed into 'scratch' if needed. */
+    const Listpack &view(const Node *node, Listpack *scratch) const;
+
+    static bool fits(const Node *node, size_t len);
+
+    static void decompressInto(const Node *node, Listpack *lp);
+
+    void compress(Node *node);
+
+    void decompress(Node *node);
+
+    bool isInterior(size_t pos) const;
+
+    /* Compress the node at 'pos' if it is in the middle of the list. */
+    void recompress(size_t pos);
+
+    /* Keep the nodes near the ends uncompressed after the ends moved. */
+    void applyDepth();
+
+    /* Split a node that grew past kNodeBytes in two, the second half goes
+     * to a new slot after 'pos'. */
+    void split(size_t pos);
+
+    static thread_local std::vector<unsigned char> scratchBuffer;
+
+    std::deque <Slot> slots;
+    size_t count;
+    int32_t compressDepth;
+};
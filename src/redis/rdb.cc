@@ -3,12 +3,20 @@
 
 Rdb::Rdb(Redis *redis)
         : redis(redis),
-          blockEnabled(true) {
+          blockEnabled(true),
+          parallelLoading(false),
+          snapshotRunning(false),
+          snapshotInProgress(false),
+          snapshotEpoch(0),
+          snapshotTime(0),
+          shardSnapshots(Redis::kShards) {
 
 }
 
 Rdb::~Rdb() {
-
+    for (auto &it : snapshotPending) {
+        sdsfree(it.second);
+    }
 }
 
 /* Returns REDIS_OK or 0 for success/failure. */
@@ -137,6 +145,10 @@ void Rdb::rioInitWithBuffer(Rio *r, sds s) {
                             std::placeholders::_1, std::placeholders::_2, std::placeholders::_3);
     r->tellFuc = std::bind(&Rdb::rioBufferTell, this, std::placeholders::_1);
     r->flushFuc = std::bind(&Rdb::rioBufferFlush, this, std::placeholders::_1);
+    r->updateFuc = nullptr;
+    r->cksum = 0;
+    r->processedBytes = 0;
+    r->maxProcessingChunk = 0;
     r->io.buffer.ptr = s;
     r->io.buffer.pos = 0;
 }
@@ -181,16 +193,10 @@ int32_t Rdb::rdbEncodeInteger(int64_t value, uint8_t *enc) {
 }
 
 int32_t Rdb::rdbTryIntegerEncoding(char *s, size_t len, uint8_t *enc) {
+    /* string2ll only accepts what prints back the same and needs no
+     * terminator, listpack entries are not terminated. */
     int64_t value;
-    char *endptr, buf[32];
-
-    value = strtoll(s, &endptr, 10);
-    if (endptr[0] != '\0') {
-        return 0;
-    }
-
-    ll2string(buf, 32, value);
-    if (strlen(buf) != len || memcmp(buf, s, len)) {
+    if (string2ll(s, len, &value) == 0) {
         return 0;
     }
     return rdbEncodeInteger(value, enc);
@@ -335,6 +341,11 @@ RedisObjectPtr Rdb::rdbGenericLoadStringObject(Rio *rdb, int32_t encode) {
     if (len && rioRead(rdb, (void *) o->ptr, len) == 0) {
         return nullptr;
     }
+
+    if (encode) {
+        return tryObjectEncoding(o);
+    }
+    o->calHash();
     return o;
 }
 
@@ -349,117 +360,165 @@ int32_t Rdb::rdbSaveBinaryDoubleValue(Rio *rdb, double val) {
 
 int32_t Rdb::rdbSaveStruct(Rio *rdb) {
     int64_t now = mstime();
-    size_t n = 0;
     auto &redisShards = redis->getRedisShards();
-    for (auto &it : redisShards) {
-        auto &mu = it.mtx;
-        auto &map = it.redisMap;
-        auto &stringMap = it.stringMap;
-        auto &hashMap = it.hashMap;
-        auto &listMap = it.listMap;
-        auto &zsetMap = it.zsetMap;
-        auto &setMap = it.setMap;
-
-        if (blockEnabled) mu.lock();
-        for (auto &iter : map) {
-            int64_t expire = redis->getExpire(iter);
-            if (iter->type == OBJ_STRING) {
-                auto iterr = stringMap.find(iter);
-                assert(iterr != stringMap.end());
-                assert(iterr->first->type == OBJ_STRING);
-                if (rdbSaveKeyValuePair(rdb, iterr->first,
-                                        iterr->second, expire, now) == REDIS_ERR) {
-                    return REDIS_ERR;
-                }
-            } else if (iter->type == OBJ_LIST) {
-                auto iterr = listMap.find(iter);
-                assert(iterr != listMap.end());
-                assert(iterr->first->type == OBJ_LIST);
+    for (size_t i = 0; i < redisShards.size(); i++) {
+        std::unique_lock <std::mutex> lck(redisShards[i].mtx, std::defer_lock);
+        if (blockEnabled) {
+            lck.lock();
+        }
 
-                if (rdbSaveKey(rdb, iterr->first) == REDIS_ERR) {
-                    return REDIS_ERR;
-                }
+        if (rdbSaveShard(rdb, i, now) == REDIS_ERR) {
+            return REDIS_ERR;
+        }
+    }
+    return REDIS_OK;
+}
 
-                if (rdbSaveLen(rdb, iterr->second.size()) == REDIS_ERR) {
-                    return REDIS_ERR;
-                }
+/* Save the keys of one shard, the caller makes sure the shard does not
+ * change meanwhile. Keys in 'skip' are left out. */
+int32_t Rdb::rdbSaveShard(Rio *rdb, size_t index, int64_t now,
+                          const std::unordered_set <std::string> *skip) {
+    auto &shard = redis->getRedisShards()[index];
+    for (auto &iter : shard.keySpace) {
+        if (skip && skip->count(std::string(iter.getKey(), iter.getKeyLen()))) {
+            continue;
+        }
 
-                for (auto &iterrr : iterr->second) {
-                    if (rdbSaveValue(rdb, iterrr) == REDIS_ERR) {
-                        return REDIS_ERR;
-                    }
-                }
-            } else if (iter->type == OBJ_HASH) {
-                auto iterr = hashMap.find(iter);
-                assert(iterr != hashMap.end());
-                assert(iterr->first->type == OBJ_HASH);
+        if (rdbSaveKeyEntry(rdb, iter, shard.expireWheel, now) == REDIS_ERR) {
+            return REDIS_ERR;
+        }
+    }
+    return REDIS_OK;
+}
 
-                if (rdbSaveKey(rdb, iterr->first) == REDIS_ERR) {
-                    return REDIS_ERR;
-                }
+int32_t Rdb::rdbSaveKeyEntry(Rio *rdb, KeyEntry &entry, const ExpireWheel &expireWheel, int64_t now) {
+    RedisObjectPtr key = entry.createKeyObject();
+    int64_t expire = expireWheel.get(key);
+    if (entry.type == OBJ_STRING) {
+        if (rdbSaveKeyValuePair(rdb, key,
+                                entry.val, expire, now) == REDIS_ERR) {
+            return REDIS_ERR;
+        }
+    } else {
+        if (rdbSaveType(rdb, rdbEntryType(entry)) == REDIS_ERR) {
+            return REDIS_ERR;
+        }
 
-                if (rdbSaveLen(rdb, iterr->second.size()) == REDIS_ERR) {
-                    return REDIS_ERR;
-                }
+        if (rdbSaveStringObject(rdb, key) == REDIS_ERR) {
+            return REDIS_ERR;
+        }
 
-                for (auto &iterrr : iterr->second) {
-                    if (rdbSaveValue(rdb, iterrr.first) == REDIS_ERR) {
-                        return REDIS_ERR;
-                    }
+        if (rdbSaveEntryValue(rdb, entry) == REDIS_ERR) {
+            return REDIS_ERR;
+        }
+    }
+    return REDIS_OK;
+}
 
-                    if (rdbSaveValue(rdb, iterrr.second) == REDIS_ERR) {
-                        return REDIS_ERR;
-                    }
-                }
-            } else if (iter->type == OBJ_ZSET) {
-                auto iterr = zsetMap.find(iter);
-                assert(iterr != zsetMap.end());
-                assert(iterr->first->type == OBJ_ZSET);
-                assert(iterr->second.first.size() == iterr->second.second.size());
+/* Compact encodings are written as they are in memory, so loading them is
+ * a copy rather than a rebuild. */
+int32_t Rdb::rdbEntryType(const KeyEntry &entry) {
+    switch (entry.type) {
+        case OBJ_LIST:
+            return REDIS_RDB_TYPE_LIST_QUICKLIST_2;
+        case OBJ_HASH:
+            return entry.obj.hash->getListpack() ? REDIS_RDB_TYPE_HASH_LISTPACK : REDIS_RDB_TYPE_HASH;
+        case OBJ_ZSET:
+            return entry.obj.zset->getListpack() ? REDIS_RDB_TYPE_ZSET_LISTPACK : REDIS_RDB_TYPE_ZSET;
+        case OBJ_SET:
+            if (entry.obj.set->getIntset()) {
+                return REDIS_RDB_TYPE_SET_INTSET;
+            }
+            return entry.obj.set->getListpack() ? REDIS_RDB_TYPE_SET_LISTPACK : REDIS_RDB_TYPE_SET;
+        default:
+            assert(false);
+            return REDIS_ERR;
+    }
+}
 
-                if (rdbSaveKey(rdb, iterr->first) == REDIS_ERR) {
-                    return REDIS_ERR;
-                }
+int32_t Rdb::rdbSaveEntryValue(Rio *rdb, const KeyEntry &entry) {
+    switch (entry.type) {
+        case OBJ_LIST:
+            return rdbSaveList(rdb, *entry.obj.list);
+        case OBJ_HASH:
+            return rdbSaveHash(rdb, *entry.obj.hash);
+        case OBJ_ZSET:
+            return rdbSaveZset(rdb, *entry.obj.zset);
+        case OBJ_SET:
+            return rdbSaveSet(rdb, *entry.obj.set);
+        default:
+            assert(false);
+            return REDIS_ERR;
+    }
+}
 
-                if (rdbSaveLen(rdb, iterr->second.first.size()) == REDIS_ERR) {
-                    return REDIS_ERR;
-                }
+int32_t Rdb::rdbSaveBlob(Rio *rdb, const unsigned char *buf, size_t len) {
+    if (rdbSaveRawString(rdb, (const char *) buf, len) == REDIS_ERR) {
+        return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
 
-                for (auto &iterrr : iterr->second.first) {
-                    if (rdbSaveBinaryDoubleValue(rdb, iterrr.second) == REDIS_ERR) {
-                        return REDIS_ERR;
-                    }
+/* Every node is written as a packed listpack, compressed nodes are
+ * inflated first. */
+int32_t Rdb::rdbSaveList(Rio *rdb, const RedisList &list) {
+    if (rdbSaveLen(rdb, list.nodes()) == REDIS_ERR) {
+        return REDIS_ERR;
+    }
 
-                    if (rdbSaveValue(rdb, iterrr.first) == REDIS_ERR) {
-                        return REDIS_ERR;
-                    }
-                }
-            } else if (iter->type == OBJ_SET) {
-                auto iterr = setMap.find(iter);
-                assert(iterr != setMap.end());
-                assert(iterr->first->type == OBJ_SET);
+    int32_t ret = REDIS_OK;
+    list.forEachNode([&](const Listpack &lp) {
+        if (ret == REDIS_OK &&
+            (rdbSaveLen(rdb, REDIS_RDB_QUICKLIST_NODE_PACKED) == REDIS_ERR ||
+             rdbSaveBlob(rdb, lp.data(), lp.bytes()) == REDIS_ERR)) {
+            ret = REDIS_ERR;
+        }
+    });
+    return ret;
+}
 
-                if (rdbSaveKey(rdb, iterr->first) == REDIS_ERR) {
-                    return REDIS_ERR;
-                }
+int32_t Rdb::rdbSaveHash(Rio *rdb, const RedisHash &rhash) {
+    const Listpack *lp = rhash.getListpack();
+    if (lp != nullptr) {
+        return rdbSaveBlob(rdb, lp->data(), lp->bytes());
+    }
 
-                if (rdbSaveLen(rdb, iterr->second.size()) == REDIS_ERR) {
-                    return REDIS_ERR;
-                }
+    if (rdbSaveLen(rdb, rhash.size()) == REDIS_ERR) {
+        return REDIS_ERR;
+    }
 
-                for (auto &iterrr : iterr->second) {
-                    if (rdbSaveValue(rdb, iterrr) == REDIS_ERR) {
-                        return REDIS_ERR;
-                    }
-                }
-            } else {
-                assert(false);
-            }
+    int32_t ret = REDIS_OK;
+    rhash.forEach([&](const std::string_view &field, const std::string_view &value) {
+        if (ret == REDIS_ERR) {
+            return;
+        }
+
+        if (rdbSaveRawString(rdb, field.data(), field.size()) == REDIS_ERR ||
+            rdbSaveRawString(rdb, value.data(), value.size()) == REDIS_ERR) {
+            ret = REDIS_ERR;
         }
+    });
+    return ret;
+}
 
-        if (blockEnabled) mu.unlock();
+int32_t Rdb::rdbSaveSet(Rio *rdb, const RedisSet &set) {
+    if (set.getIntset() != nullptr) {
+        return rdbSaveBlob(rdb, set.getIntset()->data(), set.getIntset()->bytes());
+    } else if (set.getListpack() != nullptr) {
+        return rdbSaveBlob(rdb, set.getListpack()->data(), set.getListpack()->bytes());
     }
-    return REDIS_OK;
+
+    if (rdbSaveLen(rdb, set.size()) == REDIS_ERR) {
+        return REDIS_ERR;
+    }
+
+    int32_t ret = REDIS_OK;
+    set.forEach([&](const std::string_view &member) {
+        if (ret == REDIS_OK && rdbSaveRawString(rdb, member.data(), member.size()) == REDIS_ERR) {
+            ret = REDIS_ERR;
+        }
+    });
+    return ret;
 }
 
 int32_t Rdb::rdbLoadSet(Rio *rdb, int32_t type) {
@@ -471,35 +530,44 @@ int32_t Rdb::rdbLoadSet(Rio *rdb, int32_t type) {
     }
 
     key->type = OBJ_SET;
-    if ((len = rdbLoadLen(rdb, nullptr)) == REDIS_ERR) {
-        return REDIS_ERR;
-    }
+    RedisSet set;
+    if (type == REDIS_RDB_TYPE_SET_INTSET || type == REDIS_RDB_TYPE_SET_LISTPACK) {
+        RedisObjectPtr blob;
+        if ((blob = rdbLoadStringObject(rdb)) == nullptr) {
+            return REDIS_ERR;
+        }
 
-    std::unordered_set <RedisObjectPtr, Hash, Equal> set;
-    for (int32_t i = 0; i < len; i++) {
-        RedisObjectPtr val;
-        if ((val = rdbLoadObject(type, rdb)) == nullptr) {
+        const unsigned char *buf = (const unsigned char *) blob->ptr;
+        if (type == REDIS_RDB_TYPE_SET_INTSET ? !set.assignIntset(buf, sdslen(blob->ptr)) :
+            !set.assignListpack(buf, sdslen(blob->ptr))) {
+            LOG_WARN << "Corrupt set encoding for key " << key->ptr;
             return REDIS_ERR;
         }
+    } else {
+        if ((len = rdbLoadLen(rdb, nullptr)) == REDIS_ERR) {
+            return REDIS_ERR;
+        }
+
+        for (int32_t i = 0; i < len; i++) {
+            RedisObjectPtr val;
+            if ((val = rdbLoadObject(type, rdb)) == nullptr) {
+                return REDIS_ERR;
+            }
 
-        val->type = OBJ_SET;
-        auto it = set.find(val);
-        assert(it == set.end());
-        set.insert(val);
+            bool added = set.add(val);
+            assert(added);
+        }
     }
 
-    assert(!set.empty());
+    assert(set.size() > 0);
 
     auto &redisShards = redis->getRedisShards();
     size_t index = key->hash % redis->kShards;
-    auto &mu = redisShards[index].mtx;
-    auto &map = redisShards[index].redisMap;
-    auto &setMap = redisShards[index].setMap;
+    auto &keySpace = redisShards[index].keySpace;
     {
-        std::unique_lock <std::mutex> lck(mu);
-        auto it = setMap.find(key);
-        assert(it == setMap.end());
-        setMap.insert(std::make_pair(key, std::move(set)));
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        assert(keySpace.find(key) == nullptr);
+        keySpace.insert(key, OBJ_SET)->obj.set->swap(set);
     }
     return REDIS_OK;
 }
@@ -512,52 +580,53 @@ int32_t Rdb::rdbLoadZset(Rio *rdb, int32_t type) {
     }
 
     key->type = OBJ_ZSET;
-    if ((len = rdbLoadLen(rdb, nullptr)) == REDIS_ERR) {
-        return REDIS_ERR;
-    }
-
-    Redis::SortIndexMap indexMap;
-    Redis::SortMap sortMap;
-    for (int32_t i = 0; i < len; i++) {
-        RedisObjectPtr val;
-        double socre;
-        if (rdbLoadBinaryDoubleValue(rdb, &socre) == REDIS_ERR) {
+    Zset zset;
+    if (type == REDIS_RDB_TYPE_ZSET_LISTPACK) {
+        RedisObjectPtr blob;
+        if ((blob = rdbLoadStringObject(rdb)) == nullptr) {
             return REDIS_ERR;
         }
 
-        if ((val = rdbLoadObject(type, rdb)) == nullptr) {
+        if (!zset.assignListpack((const unsigned char *) blob->ptr, sdslen(blob->ptr))) {
+            LOG_WARN << "Corrupt zset listpack for key " << key->ptr;
+            return REDIS_ERR;
+        }
+    } else {
+        if ((len = rdbLoadLen(rdb, nullptr)) == REDIS_ERR) {
             return REDIS_ERR;
         }
 
-        val->type = OBJ_ZSET;
-        sortMap.insert(std::make_pair(socre, val));
-        indexMap.insert(std::make_pair(val, socre));
+        for (int32_t i = 0; i < len; i++) {
+            RedisObjectPtr val;
+            double socre;
+            if (rdbLoadBinaryDoubleValue(rdb, &socre) == REDIS_ERR) {
+                return REDIS_ERR;
+            }
+
+            if ((val = rdbLoadObject(type, rdb)) == nullptr) {
+                return REDIS_ERR;
+            }
+
+            zset.add(val->ptr, sdslen(val->ptr), socre);
+        }
     }
 
-    assert(!sortMap.empty());
-    assert(!indexMap.empty());
+    assert(zset.size() > 0);
 
     auto &redisShards = redis->getRedisShards();
     size_t index = key->hash % redis->kShards;
-    auto &mu = redisShards[index].mtx;
-    auto &map = redisShards[index].redisMap;
-    auto &zsetMap = redisShards[index].zsetMap;
+    auto &keySpace = redisShards[index].keySpace;
     {
-        std::unique_lock <std::mutex> lck(mu);
-        auto it = zsetMap.find(key);
-        assert(it == zsetMap.end());
-
-        auto iter = map.find(key);
-        assert(iter == map.end());
-
-        zsetMap.insert(std::make_pair(key, std::make_pair(std::move(indexMap), std::move(sortMap))));
-        map.insert(key);
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        assert(keySpace.find(key) == nullptr);
+        auto entry = keySpace.insert(key, OBJ_ZSET);
+        entry->obj.zset->swap(zset);
     }
     return REDIS_OK;
 }
 
 int32_t Rdb::rdbLoadList(Rio *rdb, int32_t type) {
-    std::deque <RedisObjectPtr> list;
+    RedisList list;
     RedisObjectPtr key;
     int32_t len;
     if ((key = rdbLoadStringObject(rdb)) == nullptr) {
@@ -569,34 +638,54 @@ int32_t Rdb::rdbLoadList(Rio *rdb, int32_t type) {
         return REDIS_ERR;
     }
 
-    for (int32_t i = 0; i < len; i++) {
-        RedisObjectPtr val;
-        if ((val = rdbLoadObject(type, rdb)) == nullptr) {
+    if (type == REDIS_RDB_TYPE_LIST_QUICKLIST_2) {
+        if (rdbLoadQuicklist(rdb, len, &list) == REDIS_ERR) {
+            LOG_WARN << "Corrupt list encoding for key " << key->ptr;
             return REDIS_ERR;
         }
-
-        val->type = OBJ_LIST;
-        list.push_back(val);
+    } else {
+        for (int32_t i = 0; i < len; i++) {
+            RedisObjectPtr val;
+            if ((val = rdbLoadObject(type, rdb)) == nullptr) {
+                return REDIS_ERR;
+            }
+            list.push(val, REDIS_LIST_TAIL);
+        }
     }
 
-    assert(!list.empty());
+    assert(list.size() > 0);
     auto &redisShards = redis->getRedisShards();
     size_t index = key->hash % redis->kShards;
-    auto &mu = redisShards[index].mtx;
-    auto &map = redisShards[index].redisMap;
-    auto &listMap = redisShards[index].listMap;
+    auto &keySpace = redisShards[index].keySpace;
     {
-        std::unique_lock <std::mutex> lck(mu);
-        auto it = listMap.find(key);
-        assert(it == listMap.end());
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        assert(keySpace.find(key) == nullptr);
+        keySpace.insert(key, OBJ_LIST)->obj.list->swap(list);
+    }
+
+    return REDIS_OK;
+}
 
-        auto iter = map.find(key);
-        assert(iter == map.end());
+/* A list saved as a sequence of nodes, packed nodes are listpacks and
+ * plain nodes a single large element. Packed nodes are kept as they are. */
+int32_t Rdb::rdbLoadQuicklist(Rio *rdb, int32_t nodes, RedisList *list) {
+    for (int32_t i = 0; i < nodes; i++) {
+        uint32_t container;
+        RedisObjectPtr blob;
+        if ((container = rdbLoadLen(rdb, nullptr)) == REDIS_RDB_LENERR ||
+            (blob = rdbLoadStringObject(rdb)) == nullptr) {
+            return REDIS_ERR;
+        }
 
-        map.insert(key);
-        listMap.insert(std::make_pair(key, std::move(list)));
+        const unsigned char *buf = (const unsigned char *) blob->ptr;
+        if (container == REDIS_RDB_QUICKLIST_NODE_PLAIN) {
+            list->push(blob, REDIS_LIST_TAIL);
+        } else if (container != REDIS_RDB_QUICKLIST_NODE_PACKED) {
+            return REDIS_ERR;
+        } else if (!list->appendListpack(buf, sdslen(blob->ptr))) {
+            return REDIS_ERR;
+        }
     }
-
     return REDIS_OK;
 }
 
@@ -609,42 +698,43 @@ int32_t Rdb::rdbLoadHash(Rio *rdb, int32_t type) {
 
     key->type = OBJ_HASH;
 
-    std::unordered_map <RedisObjectPtr, RedisObjectPtr, Hash, Equal> rhash;
-    if ((len = rdbLoadLen(rdb, nullptr)) == REDIS_ERR) {
-        return REDIS_ERR;
-    }
-
-    for (int32_t i = 0; i < len; i++) {
-        RedisObjectPtr key, val;
-        if ((key = rdbLoadStringObject(rdb)) == nullptr) {
+    RedisHash rhash;
+    if (type == REDIS_RDB_TYPE_HASH_LISTPACK) {
+        RedisObjectPtr blob;
+        if ((blob = rdbLoadStringObject(rdb)) == nullptr) {
             return REDIS_ERR;
         }
 
-        key->type = OBJ_HASH;
-        if ((val = rdbLoadStringObject(rdb)) == nullptr) {
+        if (!rhash.assignListpack((const unsigned char *) blob->ptr, sdslen(blob->ptr))) {
+            LOG_WARN << "Corrupt hash listpack for key " << key->ptr;
+            return REDIS_ERR;
+        }
+    } else {
+        if ((len = rdbLoadLen(rdb, nullptr)) == REDIS_ERR) {
             return REDIS_ERR;
         }
 
-        val->type = OBJ_HASH;
-        rhash.insert(std::make_pair(key, val));
+        for (int32_t i = 0; i < len; i++) {
+            RedisObjectPtr field, val;
+            if ((field = rdbLoadStringObject(rdb)) == nullptr) {
+                return REDIS_ERR;
+            }
+
+            if ((val = rdbLoadStringObject(rdb)) == nullptr) {
+                return REDIS_ERR;
+            }
+            rhash.set(field, val);
+        }
     }
 
-    assert(!rhash.empty());
+    assert(rhash.size() > 0);
     auto &redisShards = redis->getRedisShards();
     size_t index = key->hash % redis->kShards;
-    auto &mu = redisShards[index].mtx;
-    auto &map = redisShards[index].redisMap;
-    auto &hashMap = redisShards[index].hashMap;
+    auto &keySpace = redisShards[index].keySpace;
     {
-        std::unique_lock <std::mutex> lck(mu);
-        auto it = hashMap.find(key);
-        assert(it == hashMap.end());
-
-        auto iter = map.find(key);
-        if (iter == map.end());
-
-        hashMap.insert(std::make_pair(key, std::move(rhash)));
-        map.insert(key);
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        assert(keySpace.find(key) == nullptr);
+        keySpace.insert(key, OBJ_HASH)->obj.hash->swap(rhash);
     }
     return REDIS_OK;
 }
@@ -659,70 +749,102 @@ int32_t Rdb::rdbLoadString(Rio *rdb, int32_t type, int64_t expiretime, int64_t n
         return REDIS_ERR;
     }
 
+    /* Keys already expired are not worth loading. */
+    if (expiretime != REDIS_ERR && expiretime < now) {
+        return REDIS_OK;
+    }
+
+    /* Values may be shared integers, they are strings already. */
     key->type = OBJ_STRING;
-    val->type = OBJ_STRING;
     auto &redisShards = redis->getRedisShards();
     size_t index = key->hash % redis->kShards;
-    auto &mu = redisShards[index].mtx;
-    auto &map = redisShards[index].redisMap;
-    auto &stringMap = redisShards[index].stringMap;
+    auto &keySpace = redisShards[index].keySpace;
     {
-        std::unique_lock <std::mutex> lck(mu);
-        auto it = map.find(key);
-        assert(it == map.end());
-
-        auto iter = stringMap.find(key);
-        assert(iter == stringMap.end());
-        map.insert(key);
-        stringMap.insert(std::make_pair(key, val));
-    }
-
-    if (now < expiretime) {
-        RedisObjectPtr k = createStringObject(key->ptr, sdslen(key->ptr));
-        k->type = OBJ_EXPIRE;
-        redis->setExpire(k, (expiretime - now) / 1000);
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        assert(keySpace.find(key) == nullptr);
+        keySpace.insert(key, OBJ_STRING)->val = val;
+        if (expiretime != REDIS_ERR) {
+            redisShards[index].expireWheel.add(key, expiretime);
+        }
     }
     return REDIS_OK;
 }
 
-bool Rdb::rdbReplication(char *filename, const TcpConnectionPtr &conn) {
-    Rio rdb;
-    FILE *fp;
-    if ((fp = ::fopen(filename, "r")) == nullptr) {
-        return false;
+/* The socket is non blocking, wait until it takes more. */
+static bool rdbWaitWritable(int32_t sockfd) {
+    if (errno == EINTR) {
+        return true;
     }
 
-    rioInitWithFile(&rdb, fp);
-    int32_t sendlen = startLoading(fp);
-
-    Buffer buf;
-    buf.appendInt32(sendlen);
-    conn->send(&buf);
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        return false;
+    }
 
 #ifdef _WIN64
-    int32_t fd = ::_fileno(fp);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    return true;
 #else
-    int32_t fd = ::fileno(fp);
+    struct pollfd pfd;
+    pfd.fd = sockfd;
+    pfd.events = POLLOUT;
+    return ::poll(&pfd, 1, REPLI_TIME_OUT * 1000) == 1;
 #endif
+}
 
-    if (fd < 0) {
+static bool rdbSendAll(int32_t sockfd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t nwrote = ::send(sockfd, buf, len, 0);
+        if (nwrote < 0) {
+            if (!rdbWaitWritable(sockfd)) {
+                return false;
+            }
+            continue;
+        }
+        buf += nwrote;
+        len -= nwrote;
+    }
+    return true;
+}
+
+bool Rdb::rdbReplication(const char *filename, const TcpConnectionPtr &conn,
+                         const std::string_view &header) {
+    FILE *fp;
+    if ((fp = ::fopen(filename, "rb")) == nullptr) {
         return false;
     }
 
-    off_t offset = 0;
-    ssize_t nwrote = 0;
+    int32_t sendlen = startLoading(fp);
+    if (sendlen == REDIS_ERR) {
+        ::fclose(fp);
+        return false;
+    }
 
-    while (sendlen) {
+    Buffer buf;
+    buf.append(header.data(), header.size());
+    buf.appendInt32(sendlen);
+
+    int32_t sockfd = conn->getSockfd();
+    bool ok = rdbSendAll(sockfd, buf.peek(), buf.readableBytes());
 #ifdef __linux__
-        nwrote = ::sendfile(conn->getSockfd(), fd, &offset, REDIS_SLAVE_SYNC_SIZE);
-#endif
-        if (nwrote >= 0) {
-            sendlen -= nwrote;
+    off_t offset = 0;
+    while (ok && offset < sendlen) {
+        ssize_t nwrote = ::sendfile(sockfd, ::fileno(fp), &offset, REDIS_SLAVE_SYNC_SIZE);
+        if (nwrote < 0) {
+            ok = rdbWaitWritable(sockfd);
+        } else if (nwrote == 0) {
+            ok = false;
         }
     }
+#else
+    char chunk[REDIS_SLAVE_SYNC_SIZE];
+    size_t n;
+    while (ok && (n = ::fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+        ok = rdbSendAll(sockfd, chunk, n);
+    }
+#endif
 
     ::fclose(fp);
-    return true;
+    return ok;
 }
 
 int32_t Rdb::rdbSyncWrite(const char *buf, FILE *fp, size_t len) {
@@ -737,86 +859,22 @@ int32_t Rdb::rdbSyncWrite(const char *buf, FILE *fp, size_t len) {
 int32_t Rdb::createDumpPayload(Rio *rdb, const RedisObjectPtr &obj) {
     auto &redisShards = redis->getRedisShards();
     size_t index = obj->hash % redis->kShards;
-    auto &mu = redisShards[index].mtx;
-    auto &map = redisShards[index].redisMap;
-    auto &stringMap = redisShards[index].stringMap;
-    auto &hashMap = redisShards[index].hashMap;
-    auto &listMap = redisShards[index].listMap;
-    auto &zsetMap = redisShards[index].zsetMap;
-    auto &setMap = redisShards[index].setMap;
+    auto &keySpace = redisShards[index].keySpace;
 
     {
-        std::unique_lock <std::mutex> lck(mu);
-        auto iter = map.find(obj);
-        if (iter != map.end()) {
-            if ((*iter)->type == OBJ_STRING) {
-                auto iterr = stringMap.find(obj);
-                assert(iterr != stringMap.end());
-                assert(iterr->first->type == OBJ_STRING);
-                if (rdbSaveValue(rdb, iterr->second) == REDIS_ERR) {
-                    return REDIS_ERR;
-                }
-
-            } else if ((*iter)->type == OBJ_LIST) {
-                auto iterr = listMap.find(obj);
-                assert(iterr != listMap.end());
-                assert(iterr->first->type == OBJ_LIST);
-                if (rdbSaveLen(rdb, iterr->second.size()) == REDIS_ERR) {
+        std::unique_lock <std::mutex> lck = redis->lockShard(index);
+        auto entry = keySpace.find(obj);
+        if (entry != nullptr) {
+            if (entry->type == OBJ_STRING) {
+                if (rdbSaveType(rdb, REDIS_RDB_TYPE_STRING) == REDIS_ERR ||
+                    rdbSaveValue(rdb, entry->val) == REDIS_ERR) {
                     return REDIS_ERR;
                 }
-
-                for (auto &iterrr : iterr->second) {
-                    if (rdbSaveValue(rdb, iterrr) == REDIS_ERR) {
-                        return REDIS_ERR;
-                    }
-                }
-            } else if ((*iter)->type == OBJ_HASH) {
-                auto iterr = hashMap.find(obj);
-                assert(iterr != hashMap.end());
-                assert(iterr->first->type == OBJ_HASH);
-                if (rdbSaveLen(rdb, iterr->second.size()) == REDIS_ERR) {
-                    return REDIS_ERR;
-                }
-
-                for (auto &iterrr : iterr->second) {
-                    if (rdbSaveKeyValuePair(rdb, iterrr.first,
-                                            iterrr.second, -1, -1) == REDIS_ERR) {
-                        return REDIS_ERR;
-                    }
-                }
-            } else if ((*iter)->type == OBJ_ZSET) {
-                auto iterr = zsetMap.find(obj);
-                assert(iterr != zsetMap.end());
-                assert(iterr->first->type == OBJ_ZSET);
-                assert(iterr->second.first.size() == iterr->second.second.size());
-                if (rdbSaveLen(rdb, iterr->second.first.size()) == REDIS_ERR) {
-                    return REDIS_ERR;
-                }
-
-                for (auto &iterrr : iterr->second.first) {
-                    if (rdbSaveBinaryDoubleValue(rdb, iterrr.second) == REDIS_ERR) {
-                        return REDIS_ERR;
-                    }
-
-                    if (rdbSaveValue(rdb, iterrr.first) == REDIS_ERR) {
-                        return REDIS_ERR;
-                    }
-                }
-            } else if ((*iter)->type == OBJ_SET) {
-                auto iterr = setMap.find(obj);
-                assert(iterr != setMap.end());
-                assert(iterr->first->type == OBJ_SET);
-                if (rdbSaveLen(rdb, iterr->second.size()) == REDIS_ERR) {
+            } else {
+                if (rdbSaveType(rdb, rdbEntryType(*entry)) == REDIS_ERR ||
+                    rdbSaveEntryValue(rdb, *entry) == REDIS_ERR) {
                     return REDIS_ERR;
                 }
-
-                for (auto &iterrr : iterr->second) {
-                    if (rdbSaveValue(rdb, iterrr) == REDIS_ERR) {
-                        return REDIS_ERR;
-                    }
-                }
-            } else {
-                assert(false);
             }
         }
     }
@@ -911,8 +969,83 @@ time_t Rdb::rdbLoadTime(Rio *rdb) {
     return (time_t) t32;
 }
 
-int32_t Rdb::rdbLoadRio(Rio *rdb) {
+/* SELECTDB, RESIZEDB and AUX, the records that carry no key. */
+int32_t Rdb::rdbLoadOpcode(Rio *rdb, int32_t type) {
     uint32_t dbid;
+    if (type == RDB_OPCODE_SELECTDB) {
+        /* SELECTDB: Select the specified database. */
+        if ((dbid = rdbLoadLen(rdb, nullptr)) == RDB_LENERR) {
+            return REDIS_ERR;
+        }
+        if (dbid >= (unsigned) redis->dbnum) {
+            LOG_WARN << "FATAL: Data file was created with a Redis "
+                        "server configured to handle more than "
+                        "databases. Exiting " << redis->dbnum;
+            exit(REDIS_OK);
+        }
+    } else if (type == RDB_OPCODE_RESIZEDB) {
+        uint64_t dbSize, expiresSize;
+        if ((dbSize = rdbLoadLen(rdb, nullptr)) == RDB_LENERR) {
+            return REDIS_ERR;
+        }
+
+        if ((expiresSize = rdbLoadLen(rdb, nullptr)) == RDB_LENERR) {
+            return REDIS_ERR;
+        }
+    } else if (type == RDB_OPCODE_AUX) {
+        /* AUX: generic string-string fields. Use to add state to RDB
+         * which is backward compatible. Implementations of RDB loading
+         * are requierd to skip AUX fields they don't understand.
+         *
+         * An AUX field is composed of two strings: key and value. */
+        RedisObjectPtr auxkey, auxval;
+        if ((auxkey = rdbLoadStringObject(rdb)) == nullptr) {
+            return REDIS_ERR;
+        }
+
+        if ((auxval = rdbLoadStringObject(rdb)) == nullptr) {
+            return REDIS_ERR;
+        }
+
+        if (((char *) auxkey->ptr)[0] == '%') {
+            /* All the fields with a name staring with '%' are considered
+             * information fields and are logged at startup with a log
+             * level of NOTICE. */
+            LOG_WARN << "RDB " << (char *) auxkey->ptr << " " << (char *) auxval->ptr;
+        }
+    }
+    return REDIS_OK;
+}
+
+int32_t Rdb::rdbLoadKeyValue(Rio *rdb, int32_t type, int64_t expiretime, int64_t now) {
+    if (type == REDIS_STRING) {
+        if (rdbLoadString(rdb, type, expiretime, now) == REDIS_ERR) {
+            return REDIS_ERR;
+        }
+    } else if (type == REDIS_HASH || type == REDIS_RDB_TYPE_HASH_LISTPACK) {
+        if (rdbLoadHash(rdb, type) == REDIS_ERR) {
+            return REDIS_ERR;
+        }
+    } else if (type == REDIS_LIST || type == REDIS_RDB_TYPE_LIST_QUICKLIST_2) {
+        if (rdbLoadList(rdb, type) == REDIS_ERR) {
+            return REDIS_ERR;
+        }
+    } else if (type == REDIS_SET || type == REDIS_RDB_TYPE_SET_INTSET ||
+               type == REDIS_RDB_TYPE_SET_LISTPACK) {
+        if (rdbLoadSet(rdb, type) == REDIS_ERR) {
+            return REDIS_ERR;
+        }
+    } else if (type == REDIS_ZSET || type == REDIS_RDB_TYPE_ZSET_LISTPACK) {
+        if (rdbLoadZset(rdb, type) == REDIS_ERR) {
+            return REDIS_ERR;
+        }
+    } else {
+        assert(false);
+    }
+    return REDIS_OK;
+}
+
+int32_t Rdb::rdbLoadRio(Rio *rdb, int32_t threads) {
     int32_t type, rdbver;
     char buf[1024];
 
@@ -934,119 +1067,320 @@ int32_t Rdb::rdbLoadRio(Rio *rdb) {
         return REDIS_OK;
     }
 
-    int64_t expiretime = REDIS_ERR, now = mstime();
+    if (threads > 1) {
+        if (rdbLoadParallel(rdb, threads) == REDIS_ERR) {
+            return REDIS_ERR;
+        }
+    } else {
+        int64_t expiretime = REDIS_ERR, now = mstime();
+        while (1) {
+            if ((type = rdbLoadType(rdb)) == REDIS_ERR) {
+                return REDIS_ERR;
+            }
+
+            if (type == RDB_OPCODE_EXPIRETIME) {
+                /* EXPIRETIME: load an expire associated with the next key
+                * to load. Note that after loading an expire we need to
+                * load the actual type, and continue. */
+                expiretime = rdbLoadTime(rdb);
+                expiretime *= 1000;
+                continue;
+            } else if (type == RDB_OPCODE_EXPIRETIME_MS) {
+                /* EXPIRETIME_MS: milliseconds precision expire times introduced
+                 * with RDB v3. Like EXPIRETIME but no with more precision. */
+                expiretime = rdbLoadMillisecondTime(rdb);
+                continue; /* Read next opcode. */
+            } else if (type == RDB_OPCODE_EOF) {
+                /* EOF: End of file, exit the main loop. */
+                break;
+            } else if (type == RDB_OPCODE_SELECTDB || type == RDB_OPCODE_RESIZEDB ||
+                       type == RDB_OPCODE_AUX) {
+                if (rdbLoadOpcode(rdb, type) == REDIS_ERR) {
+                    return REDIS_ERR;
+                }
+                continue; /* Read type again. */
+            }
+
+            if (rdbLoadKeyValue(rdb, type, expiretime, now) == REDIS_ERR) {
+                return REDIS_ERR;
+            }
+            expiretime = REDIS_ERR;
+        }
+    }
+
+    uint64_t cksum;
+    uint64_t expected = rdb->cksum;
+
+    if (rioRead(rdb, &cksum, 8) == 0) {
+        return REDIS_ERR;
+    }
+    memrev64ifbe(&cksum);
+
+    if (cksum == 0) {
+        LOG_WARN << "RDB file was saved with checksum disabled: no check performed";
+        return REDIS_ERR;
+    } else if (cksum != expected) {
+        LOG_WARN << "Wrong RDB checksum. Aborting now";
+        return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
+
+/* Chunks of records on their way from the reader to one load worker. */
+struct LoadQueue {
+    const static size_t kDepth = 8;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque <sds> chunks;
+    bool closed = false;
+};
+
+/* Load the records between the header and EOF with 'threads' workers. The
+ * calling thread only finds where every record ends and which shard its key
+ * belongs to, by reading the key and skipping over the value, and hands the
+ * raw record to the worker owning that shard. The workers decode the values,
+ * decompress LZF strings included, and insert without taking shard locks as
+ * no other thread touches their shards. */
+int32_t Rdb::rdbLoadParallel(Rio *rdb, int32_t threads) {
+    const static size_t kChunkSize = 256 * 1024;
+    std::vector <std::unique_ptr<LoadQueue>> queues;
+    std::vector <sds> chunks;
+    std::vector <std::thread> workers;
+    std::atomic<bool> failed(false);
+    int64_t now = mstime();
+
+    parallelLoading = true;
+    for (int32_t i = 0; i < threads; i++) {
+        queues.emplace_back(new LoadQueue());
+        chunks.push_back(sdsempty());
+        workers.emplace_back([this, &failed, now](LoadQueue *queue) {
+            while (true) {
+                sds chunk;
+                {
+                    std::unique_lock <std::mutex> lck(queue->mutex);
+                    while (queue->chunks.empty() && !queue->closed) {
+                        queue->condition.wait(lck);
+                    }
+
+                    if (queue->chunks.empty()) {
+                        break;
+                    }
+
+                    chunk = queue->chunks.front();
+                    queue->chunks.pop_front();
+                    queue->condition.notify_all();
+                }
 
-    while (1) {
+                if (!failed && rdbLoadRecords(chunk, now) == REDIS_ERR) {
+                    failed = true;
+                }
+                sdsfree(chunk);
+            }
+        }, queues.back().get());
+    }
+
+    auto push = [](LoadQueue *queue, sds chunk) {
+        std::unique_lock <std::mutex> lck(queue->mutex);
+        while (queue->chunks.size() >= LoadQueue::kDepth) {
+            queue->condition.wait(lck);
+        }
+        queue->chunks.push_back(chunk);
+        queue->condition.notify_all();
+    };
+
+    /* Every byte read goes into 'record' as well as into the checksum. */
+    sds record = sdsempty();
+    auto updateFuc = rdb->updateFuc;
+    rdb->updateFuc = [this, &record](Rio *r, const void *buf, size_t len) {
+        rioGenericUpdateChecksum(r, buf, len);
+        record = sdscatlen(record, buf, len);
+    };
+
+    int32_t retval = REDIS_OK;
+    std::string scratch;
+    while (!failed) {
+        int32_t type;
         if ((type = rdbLoadType(rdb)) == REDIS_ERR) {
-            return REDIS_ERR;
+            retval = REDIS_ERR;
+            break;
         }
 
         if (type == RDB_OPCODE_EXPIRETIME) {
-            /* EXPIRETIME: load an expire associated with the next key
-            * to load. Note that after loading an expire we need to
-            * load the actual type, and continue. */
-            expiretime = rdbLoadTime(rdb);
-            expiretime *= 1000;
+            rdbLoadTime(rdb);
             continue;
         } else if (type == RDB_OPCODE_EXPIRETIME_MS) {
-            /* EXPIRETIME_MS: milliseconds precision expire times introduced
-             * with RDB v3. Like EXPIRETIME but no with more precision. */
-            expiretime = rdbLoadMillisecondTime(rdb);
-            continue; /* Read next opcode. */
+            rdbLoadMillisecondTime(rdb);
+            continue;
         } else if (type == RDB_OPCODE_EOF) {
-            /* EOF: End of file, exit the main loop. */
             break;
-        } else if (type == RDB_OPCODE_SELECTDB) {
-            /* SELECTDB: Select the specified database. */
-            if ((dbid = rdbLoadLen(rdb, nullptr)) == RDB_LENERR) {
-                return REDIS_ERR;
-            }
-            if (dbid >= (unsigned) redis->dbnum) {
-                LOG_WARN << "FATAL: Data file was created with a Redis "
-                            "server configured to handle more than "
-                            "databases. Exiting " << redis->dbnum;
-                exit(REDIS_OK);
+        } else if (type == RDB_OPCODE_SELECTDB || type == RDB_OPCODE_RESIZEDB ||
+                   type == RDB_OPCODE_AUX) {
+            if (rdbLoadOpcode(rdb, type) == REDIS_ERR) {
+                retval = REDIS_ERR;
+                break;
             }
+            sdsclear(record);
+            continue;
+        }
 
-            continue; /* Read next opcode. */
-        } else if (type == RDB_OPCODE_RESIZEDB) {
-            uint64_t dbSize, expiresSize;
-            if ((dbSize = rdbLoadLen(rdb, nullptr)) == RDB_LENERR) {
-                return REDIS_ERR;
-            }
+        RedisObjectPtr key;
+        if ((key = rdbLoadStringObject(rdb)) == nullptr ||
+            rdbSkipValue(rdb, type, scratch) == REDIS_ERR) {
+            retval = REDIS_ERR;
+            break;
+        }
 
-            if ((expiresSize = rdbLoadLen(rdb, nullptr)) == RDB_LENERR) {
-                return REDIS_ERR;
-            }
+        int32_t worker = (key->hash % redis->kShards) * threads / redis->kShards;
+        chunks[worker] = sdscatsds(chunks[worker], record);
+        sdsclear(record);
+        if (sdslen(chunks[worker]) >= kChunkSize) {
+            push(queues[worker].get(), chunks[worker]);
+            chunks[worker] = sdsempty();
+        }
+    }
+
+    rdb->updateFuc = updateFuc;
+    sdsfree(record);
+
+    for (int32_t i = 0; i < threads; i++) {
+        if (sdslen(chunks[i]) > 0 && retval == REDIS_OK) {
+            push(queues[i].get(), chunks[i]);
+        } else {
+            sdsfree(chunks[i]);
+        }
+
+        std::unique_lock <std::mutex> lck(queues[i]->mutex);
+        queues[i]->closed = true;
+        queues[i]->condition.notify_all();
+    }
+
+    for (auto &it : workers) {
+        it.join();
+    }
+
+    parallelLoading = false;
+    return failed ? REDIS_ERR : retval;
+}
+
+/* Decode the records of one chunk cut by rdbLoadParallel(). */
+int32_t Rdb::rdbLoadRecords(sds chunk, int64_t now) {
+    Rio rdb;
+    rioInitWithBuffer(&rdb, chunk);
+    int64_t expiretime = REDIS_ERR;
+    while (rdb.io.buffer.pos < sdslen(chunk)) {
+        int32_t type;
+        if ((type = rdbLoadType(&rdb)) == REDIS_ERR) {
+            return REDIS_ERR;
+        }
+
+        if (type == RDB_OPCODE_EXPIRETIME) {
+            expiretime = rdbLoadTime(&rdb);
+            expiretime *= 1000;
             continue;
-        } else if (type == RDB_OPCODE_AUX) {
-            /* AUX: generic string-string fields. Use to add state to RDB
-             * which is backward compatible. Implementations of RDB loading
-             * are requierd to skip AUX fields they don't understand.
-             *
-             * An AUX field is composed of two strings: key and value. */
-            RedisObjectPtr auxkey, auxval;
-            if ((auxkey = rdbLoadStringObject(rdb)) == nullptr) {
-                return REDIS_ERR;
-            }
+        } else if (type == RDB_OPCODE_EXPIRETIME_MS) {
+            expiretime = rdbLoadMillisecondTime(&rdb);
+            continue;
+        }
 
-            if ((auxval = rdbLoadStringObject(rdb)) == nullptr) {
-                return REDIS_ERR;
-            }
+        if (rdbLoadKeyValue(&rdb, type, expiretime, now) == REDIS_ERR) {
+            return REDIS_ERR;
+        }
+        expiretime = REDIS_ERR;
+    }
+    return REDIS_OK;
+}
 
-            if (((char *) auxkey->ptr)[0] == '%') {
-                /* All the fields with a name staring with '%' are considered
-                 * information fields and are logged at startup with a log
-                 * level of NOTICE. */
-                LOG_WARN << "RDB " << (char *) auxkey->ptr << " " << (char *) auxval->ptr;
-            }
-            continue; /* Read type again. */
-        } else if (type == REDIS_STRING) {
-            if (rdbLoadString(rdb, type, expiretime, now) == REDIS_ERR) {
+/* Read past the value of a record, only the layout is looked at. */
+int32_t Rdb::rdbSkipValue(Rio *rdb, int32_t type, std::string &scratch) {
+    if (type == REDIS_STRING || type == REDIS_RDB_TYPE_HASH_LISTPACK ||
+        type == REDIS_RDB_TYPE_ZSET_LISTPACK || type == REDIS_RDB_TYPE_SET_INTSET ||
+        type == REDIS_RDB_TYPE_SET_LISTPACK) {
+        return rdbSkipStringObject(rdb, scratch);
+    }
+
+    uint32_t len;
+    if ((len = rdbLoadLen(rdb, nullptr)) == REDIS_RDB_LENERR) {
+        return REDIS_ERR;
+    }
+
+    for (uint32_t i = 0; i < len; i++) {
+        if (type == REDIS_ZSET) {
+            double score;
+            if (rdbLoadBinaryDoubleValue(rdb, &score) == REDIS_ERR) {
                 return REDIS_ERR;
             }
         } else if (type == REDIS_HASH) {
-            if (rdbLoadHash(rdb, type) == REDIS_ERR) {
-                return REDIS_ERR;
-            }
-        } else if (type == REDIS_LIST) {
-            if (rdbLoadList(rdb, type) == REDIS_ERR) {
+            if (rdbSkipStringObject(rdb, scratch) == REDIS_ERR) {
                 return REDIS_ERR;
             }
-        } else if (type == REDIS_SET) {
-            if (rdbLoadSet(rdb, type) == REDIS_ERR) {
+        } else if (type == REDIS_RDB_TYPE_LIST_QUICKLIST_2) {
+            if (rdbLoadLen(rdb, nullptr) == REDIS_RDB_LENERR) {
                 return REDIS_ERR;
             }
-        } else if (type == REDIS_ZSET) {
-            if (rdbLoadZset(rdb, type) == REDIS_ERR) {
-                return REDIS_ERR;
-            }
-        } else {
-            assert(false);
+        } else if (type != REDIS_LIST && type != REDIS_SET) {
+            return REDIS_ERR;
         }
 
-        expiretime = REDIS_ERR;
+        if (rdbSkipStringObject(rdb, scratch) == REDIS_ERR) {
+            return REDIS_ERR;
+        }
     }
+    return REDIS_OK;
+}
 
-    uint64_t cksum;
-    uint64_t expected = rdb->cksum;
-
-    if (rioRead(rdb, &cksum, 8) == 0) {
+int32_t Rdb::rdbSkipStringObject(Rio *rdb, std::string &scratch) {
+    int32_t isencoded;
+    uint32_t len;
+    if ((len = rdbLoadLen(rdb, &isencoded)) == REDIS_RDB_LENERR) {
         return REDIS_ERR;
     }
-    memrev64ifbe(&cksum);
 
-    if (cksum == 0) {
-        LOG_WARN << "RDB file was saved with checksum disabled: no check performed";
-        return REDIS_ERR;
-    } else if (cksum != expected) {
-        LOG_WARN << "Wrong RDB checksum. Aborting now";
-        return REDIS_ERR;
+    if (isencoded) {
+        switch (len) {
+            case REDIS_RDB_ENC_INT8:
+                len = 1;
+                break;
+            case REDIS_RDB_ENC_INT16:
+                len = 2;
+                break;
+            case REDIS_RDB_ENC_INT32:
+                len = 4;
+                break;
+            case REDIS_RDB_ENC_LZF:
+                /* Compressed length, then the length once decompressed. */
+                if ((len = rdbLoadLen(rdb, nullptr)) == REDIS_RDB_LENERR ||
+                    rdbLoadLen(rdb, nullptr) == REDIS_RDB_LENERR) {
+                    return REDIS_ERR;
+                }
+                break;
+            default:
+                return REDIS_ERR;
+        }
     }
-    return REDIS_OK;
+
+    if (len == 0) {
+        return REDIS_OK;
+    }
+
+    if (scratch.size() < len) {
+        scratch.resize(len);
+    }
+    return rioRead(rdb, &scratch[0], len) == 0 ? REDIS_ERR : REDIS_OK;
+}
+
+/* Shards are owned by one worker each during a parallel load, nobody else
+ * runs yet, so the lock is left alone then. RESTORE loads through here from
+ * a script too, see Redis::lockShard(). */
+std::unique_lock <std::mutex> Rdb::lockShard(size_t index) {
+    auto &mu = redis->getRedisShards()[index].mtx;
+    if (parallelLoading) {
+        return std::unique_lock<std::mutex>(mu, std::defer_lock);
+    }
+    return redis->lockShard(index);
 }
 
-int32_t Rdb::rdbLoad(const char *filename) {
+int32_t Rdb::rdbLoad(const char *filename, int32_t threads) {
     FILE *fp;
     Rio rdb;
     int32_t retval;
@@ -1056,7 +1390,7 @@ int32_t Rdb::rdbLoad(const char *filename) {
 
     startLoading(fp);
     rioInitWithFile(&rdb, fp);
-    retval = rdbLoadRio(&rdb);
+    retval = rdbLoadRio(&rdb, threads);
     ::fclose(fp);
     return retval;
 }
@@ -1114,19 +1448,20 @@ int32_t Rdb::rdbSaveLzfStringObject(Rio *rdb, uint8_t *s, size_t len) {
     int32_t n, nwritten = 0;
     void *out;
 
+    /* 0 means not compressed, the caller stores it verbatim. */
     if (len <= 4) {
-        return REDIS_NULL;
+        return 0;
     }
 
     outlen = len - 4;
     if ((out = zmalloc(outlen + 1)) == nullptr) {
-        return REDIS_NULL;
+        return 0;
     }
 
     comprlen = lzfCompress(s, len, out, outlen);
     if (comprlen == 0) {
         zfree(out);
-        return REDIS_NULL;
+        return 0;
     }
 
     byte = (REDIS_RDB_ENCVAL << 6) | REDIS_RDB_ENC_LZF;
@@ -1157,6 +1492,17 @@ int32_t Rdb::rdbSaveLzfStringObject(Rio *rdb, uint8_t *s, size_t len) {
 size_t Rdb::rdbSaveRawString(Rio *rdb, const char *s, size_t len) {
     int32_t n, nwritten = 0;
 
+    /* Keys and members that are numbers take 2 to 5 bytes. */
+    if (len <= 11) {
+        uint8_t buf[5];
+        if ((n = rdbTryIntegerEncoding((char *) s, len, buf)) > 0) {
+            if (rdbWriteRaw(rdb, buf, n) == REDIS_ERR) {
+                return REDIS_ERR;
+            }
+            return n;
+        }
+    }
+
     if (len > 20) {
         n = rdbSaveLzfStringObject(rdb, (unsigned char *) s, len);
         if (n == REDIS_ERR) {
@@ -1167,7 +1513,7 @@ size_t Rdb::rdbSaveRawString(Rio *rdb, const char *s, size_t len) {
         }
     }
 
-    if ((n = rdbSaveLen(rdb, len) == REDIS_ERR)) {
+    if ((n = rdbSaveLen(rdb, len)) == REDIS_ERR) {
         return REDIS_ERR;
     }
 
@@ -1198,29 +1544,31 @@ int64_t Rdb::rdbLoadMillisecondTime(Rio *rdb) {
 }
 
 RedisObjectPtr Rdb::rdbLoadObject(int32_t rdbtype, Rio *rdb) {
+    /* Only string values may become INT objects, the elements of the other
+     * types are read as bytes. */
     RedisObjectPtr o = nullptr;
     if (rdbtype == REDIS_RDB_TYPE_STRING) {
         if ((o = rdbLoadEncodedStringObject(rdb)) == nullptr) {
             return nullptr;
         }
     } else if (rdbtype == REDIS_RDB_TYPE_LIST) {
-        if ((o = rdbLoadEncodedStringObject(rdb)) == nullptr) {
+        if ((o = rdbLoadStringObject(rdb)) == nullptr) {
             return nullptr;
         }
     } else if (rdbtype == REDIS_RDB_TYPE_SET) {
-        if ((o = rdbLoadEncodedStringObject(rdb)) == nullptr) {
+        if ((o = rdbLoadStringObject(rdb)) == nullptr) {
             return nullptr;
         }
     } else if (rdbtype == REDIS_RDB_TYPE_ZSET) {
-        if ((o = rdbLoadEncodedStringObject(rdb)) == nullptr) {
+        if ((o = rdbLoadStringObject(rdb)) == nullptr) {
             return nullptr;
         }
     } else if (rdbtype == REDIS_RDB_TYPE_HASH) {
-        if ((o = rdbLoadEncodedStringObject(rdb)) == nullptr) {
+        if ((o = rdbLoadStringObject(rdb)) == nullptr) {
             return nullptr;
         }
     } else if (rdbtype == REDIS_RDB_TYPE_EXPIRE) {
-        if ((o = rdbLoadEncodedStringObject(rdb)) == nullptr) {
+        if ((o = rdbLoadStringObject(rdb)) == nullptr) {
             return nullptr;
         }
     } else {
@@ -1253,7 +1601,7 @@ ssize_t Rdb::rdbSaveLongLongAsStringObject(Rio *rdb, int64_t value) {
 
 int32_t Rdb::rdbSaveStringObject(Rio *rdb, const RedisObjectPtr &obj) {
     if (obj->encoding == OBJ_ENCODING_INT) {
-        return rdbSaveLongLongAsStringObject(rdb, *(int32_t *) obj->ptr);
+        return rdbSaveLongLongAsStringObject(rdb, (intptr_t) obj->ptr);
     } else {
         return rdbSaveRawString(rdb, obj->ptr, sdslen(obj->ptr));
     }
@@ -1358,6 +1706,30 @@ int32_t Rdb::rdbSaveKeyValuePair(Rio *rdb, const RedisObjectPtr &key,
     return REDIS_OK;
 }
 
+int32_t Rdb::rdbSaveZset(Rio *rdb, const Zset &zset) {
+    const Listpack *lp = zset.getListpack();
+    if (lp != nullptr) {
+        return rdbSaveBlob(rdb, lp->data(), lp->bytes());
+    }
+
+    if (rdbSaveLen(rdb, zset.size()) == REDIS_ERR) {
+        return REDIS_ERR;
+    }
+
+    int32_t ret = REDIS_OK;
+    zset.forEach([&](const std::string_view &ele, double score) {
+        if (ret == REDIS_ERR) {
+            return;
+        }
+
+        if (rdbSaveBinaryDoubleValue(rdb, score) == REDIS_ERR ||
+            rdbSaveRawString(rdb, ele.data(), ele.size()) == REDIS_ERR) {
+            ret = REDIS_ERR;
+        }
+    });
+    return ret;
+}
+
 int32_t Rdb::rdbSaveValue(Rio *rdb, const RedisObjectPtr &value) {
     if (rdbSaveStringObject(rdb, value) == REDIS_ERR) {
         return REDIS_ERR;
@@ -1436,7 +1808,11 @@ int32_t Rdb::rdbSaveRio(Rio *rdb, int32_t *error, int32_t flags) {
             goto werr;
         }
 
-        if (rdbSaveStruct(rdb) == REDIS_ERR) {
+        if (flags & RDB_SAVE_SNAPSHOT) {
+            if (rdbSaveSnapshotStruct(rdb) == REDIS_ERR) {
+                goto werr;
+            }
+        } else if (rdbSaveStruct(rdb) == REDIS_ERR) {
             goto werr;
         }
     }
@@ -1456,7 +1832,7 @@ int32_t Rdb::rdbSaveRio(Rio *rdb, int32_t *error, int32_t flags) {
     return REDIS_ERR;
 }
 
-int32_t Rdb::rdbSave(const char *filename) {
+int32_t Rdb::rdbSave(const char *filename, int32_t flags) {
     char tmpfile[256];
     FILE *fp;
     Rio rdb;
@@ -1469,7 +1845,7 @@ int32_t Rdb::rdbSave(const char *filename) {
     }
 
     rioInitWithFile(&rdb, fp);
-    if (rdbSaveRio(&rdb, &error, RDB_SAVE_NONE) == REDIS_ERR) {
+    if (rdbSaveRio(&rdb, &error, flags) == REDIS_ERR) {
         goto werr;
     }
 
@@ -1499,6 +1875,189 @@ int32_t Rdb::rdbSave(const char *filename) {
     return REDIS_ERR;
 }
 
+/* Start a forkless BGSAVE. While it runs writers call rdbSnapshotKey()
+ * before they modify a key, a writer never waits longer than it takes to
+ * serialize the key itself or one shard if the snapshot thread is on it. */
+int32_t Rdb::rdbSaveSnapshotBackground(const char *filename, int32_t flags) {
+    if (snapshotInProgress.exchange(true)) {
+        return REDIS_ERR;
+    }
+
+    if (!(flags & RDB_SAVE_REPLICATION)) {
+        startSnapshot();
+    }
+
+    std::thread thread(std::bind(&Rdb::rdbSnapshotThread, this, std::string(filename), flags));
+    thread.detach();
+    return REDIS_OK;
+}
+
+void Rdb::startSnapshot() {
+    snapshotTime = mstime();
+    snapshotEpoch++;
+    snapshotRunning = true;
+}
+
+void Rdb::rdbSnapshotThread(const std::string &filename, int32_t flags) {
+    int64_t start = ustime();
+    int64_t offset = 0;
+    if (flags & RDB_SAVE_REPLICATION) {
+        /* The slave continues with the replication stream right where the
+         * snapshot leaves off. A command is only in the stream once its
+         * batch is done, so the cut is taken with every loop stopped in
+         * between two batches. */
+        redis->stopLoops([this, &offset]() {
+            std::unique_lock <std::mutex> lck(redis->getSlaveMutex());
+            startSnapshot();
+            offset = redis->getReplication()->snapshotCut();
+        });
+    } else {
+        /* A command that checked for a running snapshot just before it
+         * started may still be about to modify its keys. Once every loop
+         * went through its queue such commands are done and the shards can
+         * be saved. */
+        redis->waitForLoops();
+    }
+
+    int32_t retval = rdbSave(filename.c_str(), RDB_SAVE_SNAPSHOT | flags);
+    if (flags & RDB_SAVE_AOF_PREAMBLE) {
+        /* Writers keep their commands for the rewrite until it is swapped
+         * in, so the snapshot counts as running until then. */
+        redis->getAof()->rewriteDone(filename.c_str(), retval == REDIS_OK);
+    }
+    snapshotRunning = false;
+
+    {
+        /* Only left over if the save failed half way. */
+        std::unique_lock <std::mutex> lck(snapshotMutex);
+        for (auto &it : snapshotPending) {
+            sdsfree(it.second);
+        }
+        snapshotPending.clear();
+    }
+
+    if (flags & RDB_SAVE_AOF_PREAMBLE) {
+        LOG_INFO << "AOF: forkless rewrite took " << (ustime() - start) / 1000 << " milliseconds";
+        snapshotInProgress = false;
+        return;
+    }
+
+    if (flags & RDB_SAVE_REPLICATION) {
+        LOG_INFO << "Replication snapshot at offset " << offset << " saved in "
+                 << (ustime() - start) / 1000 << " milliseconds";
+        /* Before anything else may replace the file. */
+        redis->getReplication()->sendSnapshot(filename.c_str(), offset, retval == REDIS_OK);
+        snapshotInProgress = false;
+        return;
+    }
+
+    if (retval == REDIS_OK) {
+        LOG_INFO << "RDB: forkless snapshot saved in " << (ustime() - start) / 1000 << " milliseconds";
+    } else {
+        LOG_WARN << "rdbSave failure";
+    }
+
+    snapshotInProgress = false;
+    redis->getEventLoop()->runInLoop(std::bind(&Redis::backgroundSaveDone,
+                                               redis, retval == REDIS_OK));
+}
+
+/* Walk the shards in order, serializing each under its mutex and writing
+ * it to disk after releasing it, together with whatever writers saved in
+ * the meantime. */
+int32_t Rdb::rdbSaveSnapshotStruct(Rio *rdb) {
+    auto &redisShards = redis->getRedisShards();
+    for (size_t i = 0; i < redisShards.size(); i++) {
+        {
+            std::unique_lock <std::mutex> lck(redisShards[i].mtx);
+            rdbSnapshotShard(i);
+        }
+
+        if (rdbWriteSnapshotPending(rdb) == REDIS_ERR) {
+            return REDIS_ERR;
+        }
+    }
+    return REDIS_OK;
+}
+
+/* Save the keys of the shard that writers have not saved yet. */
+void Rdb::rdbSnapshotShard(size_t index) {
+    uint64_t epoch = snapshotEpoch;
+    auto &snapshot = shardSnapshots[index];
+    if (!snapshotRunning || snapshot.savedEpoch == epoch) {
+        return;
+    }
+
+    Rio rdb;
+    rioInitWithBuffer(&rdb, sdsempty());
+    rdbSaveShard(&rdb, index, snapshotTime, snapshot.keysEpoch == epoch ? &snapshot.keys : nullptr);
+    pushSnapshotPending(epoch, &rdb);
+
+    snapshot.savedEpoch = epoch;
+    snapshot.keys.clear();
+}
+
+/* Save the key as it is now unless the shard or the key is saved already.
+ * Keys that do not exist yet are remembered too, so that the snapshot
+ * thread skips them once they are created. */
+void Rdb::rdbSnapshotKey(size_t index, const char *key, size_t len, uint32_t hash) {
+    uint64_t epoch = snapshotEpoch;
+    auto &snapshot = shardSnapshots[index];
+    if (!snapshotRunning || snapshot.savedEpoch == epoch) {
+        return;
+    }
+
+    if (snapshot.keysEpoch != epoch) {
+        snapshot.keys.clear();
+        snapshot.keysEpoch = epoch;
+    }
+
+    if (!snapshot.keys.emplace(key, len).second) {
+        return;
+    }
+
+    auto &shard = redis->getRedisShards()[index];
+    KeyEntry *entry = shard.keySpace.find(key, len, hash);
+    if (entry == nullptr) {
+        return;
+    }
+
+    Rio rdb;
+    rioInitWithBuffer(&rdb, sdsempty());
+    rdbSaveKeyEntry(&rdb, *entry, shard.expireWheel, snapshotTime);
+    pushSnapshotPending(epoch, &rdb);
+}
+
+void Rdb::pushSnapshotPending(uint64_t epoch, Rio *rdb) {
+    if (sdslen(rdb->io.buffer.ptr) == 0) {
+        sdsfree(rdb->io.buffer.ptr);
+        return;
+    }
+
+    std::unique_lock <std::mutex> lck(snapshotMutex);
+    snapshotPending.emplace_back(epoch, rdb->io.buffer.ptr);
+}
+
+/* Entries of an earlier epoch come from a writer that raced with the end
+ * of a failed snapshot, they are dropped. */
+int32_t Rdb::rdbWriteSnapshotPending(Rio *rdb) {
+    std::deque <std::pair<uint64_t, sds>> pending;
+    {
+        std::unique_lock <std::mutex> lck(snapshotMutex);
+        pending.swap(snapshotPending);
+    }
+
+    int32_t retval = REDIS_OK;
+    for (auto &it : pending) {
+        if (retval == REDIS_OK && it.first == snapshotEpoch &&
+            rdbWriteRaw(rdb, it.second, sdslen(it.second)) == REDIS_ERR) {
+            retval = REDIS_ERR;
+        }
+        sdsfree(it.second);
+    }
+    return retval;
+}
+
 /* Save a string object as [len][data] on disk. If the object is a string
  * representation of an integer value we try to save it in a special form */
 ssize_t Rdb::rdbSaveRawString(Rio *rdb, uint8_t *s, size_t len) {
@@ -4,6 +4,8 @@
 #include "object.h"
 #include "session.h"
 #include "util.h"
+#include "keyspace.h"
+#include "expire.h"
 
 /* At every loading step try to remember what we were about to do, so that
  * we can log this information when an error is encountered. */
@@ -123,7 +125,21 @@ public:
 
     void rioInitWithBuffer(Rio *r, sds s);
 
-    int32_t rdbLoadRio(Rio *rdb);
+    int32_t rdbLoadRio(Rio *rdb, int32_t threads = 1);
+
+    int32_t rdbLoadOpcode(Rio *rdb, int32_t type);
+
+    int32_t rdbLoadKeyValue(Rio *rdb, int32_t type, int64_t expiretime, int64_t now);
+
+    int32_t rdbLoadParallel(Rio *rdb, int32_t threads);
+
+    int32_t rdbLoadRecords(sds chunk, int64_t now);
+
+    int32_t rdbSkipValue(Rio *rdb, int32_t type, std::string &scratch);
+
+    int32_t rdbSkipStringObject(Rio *rdb, std::string &scratch);
+
+    std::unique_lock <std::mutex> lockShard(size_t index);
 
     int32_t startLoading(FILE *fp);
 
@@ -135,7 +151,7 @@ public:
 
     size_t rdbSaveLen(Rio *rdb, uint32_t len);
 
-    int32_t rdbSave(const char *filename);
+    int32_t rdbSave(const char *filename, int32_t flags = RDB_SAVE_NONE);
 
     int32_t rdbSaveRio(Rio *rdb, int32_t *error, int32_t flags);
 
@@ -152,10 +168,57 @@ public:
 
     int32_t rdbSaveValue(Rio *rdb, const RedisObjectPtr &value);
 
+    int32_t rdbEntryType(const KeyEntry &entry);
+
+    int32_t rdbSaveEntryValue(Rio *rdb, const KeyEntry &entry);
+
+    int32_t rdbSaveBlob(Rio *rdb, const unsigned char *buf, size_t len);
+
+    int32_t rdbSaveList(Rio *rdb, const RedisList &list);
+
+    int32_t rdbSaveHash(Rio *rdb, const RedisHash &rhash);
+
+    int32_t rdbSaveSet(Rio *rdb, const RedisSet &set);
+
+    int32_t rdbSaveZset(Rio *rdb, const Zset &zset);
+
     int32_t rdbSaveKey(Rio *rdb, const RedisObjectPtr &value);
 
     int32_t rdbSaveStruct(Rio *rdb);
 
+    int32_t rdbSaveShard(Rio *rdb, size_t index, int64_t now,
+                         const std::unordered_set <std::string> *skip = nullptr);
+
+    int32_t rdbSaveKeyEntry(Rio *rdb, KeyEntry &entry, const ExpireWheel &expireWheel, int64_t now);
+
+    /* Forkless BGSAVE. A snapshot thread saves the shards one by one under
+     * their mutex. Until it gets to a shard, a writer about to modify a key
+     * there saves the old value of that key first, so the file holds every
+     * key as it was when the snapshot started. With RDB_SAVE_AOF_PREAMBLE
+     * the file becomes the base of a rewritten append only file. */
+    int32_t rdbSaveSnapshotBackground(const char *filename, int32_t flags = RDB_SAVE_NONE);
+
+    void rdbSnapshotThread(const std::string &filename, int32_t flags);
+
+    void startSnapshot();
+
+    int32_t rdbSaveSnapshotStruct(Rio *rdb);
+
+    /* Both are called with the mutex of shard 'index' held. */
+    void rdbSnapshotShard(size_t index);
+
+    void rdbSnapshotKey(size_t index, const char *key, size_t len, uint32_t hash);
+
+    void pushSnapshotPending(uint64_t epoch, Rio *rdb);
+
+    int32_t rdbWriteSnapshotPending(Rio *rdb);
+
+    bool isSnapshotRunning() const { return snapshotRunning; }
+
+    /* Also covers the time before a replication snapshot is cut and the
+     * transfer to the slaves after it. */
+    bool isSnapshotInProgress() const { return snapshotInProgress; }
+
     int32_t rdbSaveObjectType(Rio *rdb, const RedisObjectPtr &o);
 
     int32_t rdbLoadType(Rio *rdb);
@@ -172,15 +235,20 @@ public:
 
     int32_t rdbLoadList(Rio *rdb, int32_t type);
 
+    int32_t rdbLoadQuicklist(Rio *rdb, int32_t nodes, RedisList *list);
+
     int32_t rdbLoadZset(Rio *rdb, int32_t type);
 
     int32_t rdbLoadSet(Rio *rdb, int32_t type);
 
     uint32_t rdbLoadLen(Rio *rdb, int32_t *isencoded);
 
-    int32_t rdbLoad(const char *fileName);
+    int32_t rdbLoad(const char *fileName, int32_t threads = 1);
 
-    bool rdbReplication(char *filename, const TcpConnectionPtr &conn);
+    /* Sends the file to a slave preceded by 'header' and its length.
+     * Blocks until it is out, so it runs on the snapshot thread. */
+    bool rdbReplication(const char *filename, const TcpConnectionPtr &conn,
+                        const std::string_view &header);
 
     RedisObjectPtr rdbLoadObject(int32_t type, Rio *rdb);
 
@@ -222,7 +290,25 @@ private:
     Redis *redis;
     RdbState rdbState;
     bool blockEnabled;
+    bool parallelLoading;
     int32_t rdbCheckMode;
+
+    /* Snapshot progress of one shard, guarded by the shard mutex. */
+    struct ShardSnapshot {
+        uint64_t savedEpoch; /* The whole shard is in that snapshot */
+        uint64_t keysEpoch;  /* Snapshot 'keys' belong to */
+        std::unordered_set <std::string> keys; /* Saved or created by writers */
+    };
+
+    /* Keys saved by writers wait in snapshotPending until the snapshot
+     * thread writes them out. */
+    std::atomic<bool> snapshotRunning;
+    std::atomic<bool> snapshotInProgress;
+    std::atomic <uint64_t> snapshotEpoch;
+    std::atomic <int64_t> snapshotTime;
+    std::vector <ShardSnapshot> shardSnapshots;
+    std::mutex snapshotMutex;
+    std::deque <std::pair<uint64_t, sds>> snapshotPending;
 };
 
 
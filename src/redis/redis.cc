@@ -1,23 +1,37 @@
 #include "redis.h"
 
-Redis::Redis(const char *ip, int16_t port, int16_t threadCount, bool enbaledCluster)
-        : server(&loop, ip, port, nullptr),
+Redis::Redis(const char *ip, int16_t port, int16_t threadCount,
+             bool enbaledCluster, bool enabledSharedNothing, bool enabledAppendOnly,
+             bool enabledReusePort, bool enabledCpuAffinity)
+        : expireShardIndex(0),
+          evictPending(false),
+          server(&loop, ip, port, nullptr),
           ip(ip),
           port(port),
           clusterEnabled(enbaledCluster),
           repli(this),
           clus(this),
-          rdb(this) {
+          rdb(this),
+          aof(this),
+          evict(this)
+#ifdef _LUA
+          , scripting(this)
+#endif
+{
     initConfig();
-    loadDataFromDisk();
-    server.setConnectionCallback(std::bind(&Redis::connCallBack, this, std::placeholders::_1));
-    server.setThreadNum(threadCount);
+    sharedNothingEnabled = enabledSharedNothing;
     if (threadCount > 1) {
         this->threadCount = threadCount;
     }
 
+    loadDataFromDisk(enabledAppendOnly);
+    server.setConnectionCallback(std::bind(&Redis::connCallBack, this, std::placeholders::_1));
+    server.setThreadNum(threadCount);
+    server.setReusePort(enabledReusePort, enabledCpuAffinity);
+
     server.start();
-    loop.runAfter(1.0, true, std::bind(&Redis::serverCron, this));
+    startCores();
+    loop.runAfter(1.0 / REDIS_DEFAULT_HZ, true, std::bind(&Redis::serverCron, this));
     loop.runAfter(60, true, std::bind(&Redis::bgsaveCron, this));
 
     {
@@ -39,6 +53,247 @@ Redis::~Redis() {
     clearCommand();
 }
 
+void Redis::startCores() {
+    coreLoops = server.getThreadPool()->getAllLoops();
+    pubsub.setLoops(coreLoops);
+#ifdef _LUA
+    scripting.setLoops(coreLoops);
+#endif
+    if (!sharedNothingEnabled) {
+        return;
+    }
+
+    size_t size = coreLoops.size();
+    coreNotified.reset(new std::atomic<bool>[size]);
+    for (size_t i = 0; i < size; i++) {
+        coreNotified[i] = false;
+    }
+
+    for (size_t i = 0; i < size * size; i++) {
+        mailboxes.push_back(std::unique_ptr<Mailbox>(new Mailbox(kMailboxSize)));
+    }
+    LOG_INFO << "Shared nothing mode, loops: " << size;
+}
+
+const RedisObjectPtr *Redis::getFirstKey(const RedisCommand *command,
+                                         const std::deque <RedisObjectPtr> &obj) {
+#ifdef _LUA
+    /* A script runs on the loop owning its first key. */
+    if (command->flags & CMD_SCRIPT) {
+        return Scripting::getFirstKey(obj);
+    }
+#endif
+    return command->hasKeys() ? &obj[command->firstKey - 1] : nullptr;
+}
+
+int32_t Redis::getCoreIndex(EventLoop *loop) const {
+    for (size_t i = 0; i < coreLoops.size(); i++) {
+        if (coreLoops[i] == loop) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void Redis::postToCore(int32_t from, int32_t to, Mailbox::Functor &&cb) {
+    if (!mailboxes[from * coreLoops.size() + to]->push(std::move(cb))) {
+        /* The ring is full, fall back to the locked functor queue. */
+        coreLoops[to]->queueInLoop(std::move(cb));
+        return;
+    }
+
+    /* Only the first message after the owner drained needs a wakeup. Pairs
+     * with the fence in drainMailboxes so that a message is never left
+     * behind with the flag cleared. */
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!coreNotified[to].exchange(true)) {
+        coreLoops[to]->queueInLoop(std::bind(&Redis::drainMailboxes, this, to));
+    }
+}
+
+void Redis::drainMailboxes(int32_t core) {
+    coreNotified[core].store(false);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    size_t size = coreLoops.size();
+    for (size_t from = 0; from < size; from++) {
+        mailboxes[from * size + core]->drain();
+    }
+}
+
+bool Redis::forwardCommand(const RedisCommand *command,
+                           std::deque <RedisObjectPtr> &obj, const SessionPtr &session,
+                           const TcpConnectionPtr &conn, int32_t core) {
+    const RedisObjectPtr *key = getFirstKey(command, obj);
+    if (core < 0 || key == nullptr) {
+        return false;
+    }
+
+    /* DEL and UNLINK are the only commands taking several keys. */
+    if (command->proc == &Redis::delCommand || command->proc == &Redis::unlinkCommand) {
+        return forwardDelCommand(obj, session, conn, core, command->proc == &Redis::unlinkCommand);
+    }
+
+    int32_t owner = getShardOwner((*key)->hash);
+    if (owner == core) {
+        return false;
+    }
+
+    if (monitorEnabled) {
+        std::deque <RedisObjectPtr> commands = obj;
+        commands.push_back(createStringObject((char *) command->name, strlen(command->name)));
+        feedMonitor(commands, conn->getSockfd());
+    }
+
+    struct Request {
+        const RedisCommand *command;
+        std::deque <RedisObjectPtr> obj;
+        SessionPtr session;
+        TcpConnectionPtr conn;
+        Buffer reply;
+        int64_t aofOffset;
+    };
+
+    std::shared_ptr <Request> request(new Request());
+    request->command = command;
+    request->obj.swap(obj);
+    request->session = session;
+    request->conn = conn;
+    request->aofOffset = 0;
+
+    postToCore(core, owner, [this, request, core, owner]() {
+        /* The check and the command have to run together on the owner for
+         * a snapshot starting in between, see Rdb::rdbSnapshotThread(). */
+        bool cut = snapshotBeforeWrite(request->command, request->obj);
+        TcpConnection::setReplyBuffer(&request->reply);
+        bool ok = (this->*request->command->proc)(request->obj, request->session, request->conn);
+        TcpConnection::setReplyBuffer(nullptr);
+        if (!ok) {
+            addReplyErrorFormat(&request->reply,
+                                "wrong number of arguments`%s`, for command", request->command->name);
+        } else if ((request->command->flags & CMD_WRITE) && aof.isEnabled()) {
+            request->aofOffset = aof.feedCommand(request->command->name, request->obj, cut);
+        }
+#ifdef _LUA
+        if (request->command->flags & CMD_SCRIPT) {
+            request->aofOffset = Scripting::takeAofOffset();
+        }
+#endif
+
+        postToCore(owner, core, [request]() {
+            request->session->resumeCommand(request->conn, &request->reply, request->aofOffset);
+        });
+    });
+    return true;
+}
+
+bool Redis::forwardDelCommand(std::deque <RedisObjectPtr> &obj, const SessionPtr &session,
+                              const TcpConnectionPtr &conn, int32_t core, bool lazy) {
+    /* Fan the keys out to their owners and gather the counts back on the
+     * connection loop, only that loop ever touches 'gather'. */
+    std::map <int32_t, std::vector<RedisObjectPtr>> parts;
+    for (auto &it : obj) {
+        parts[getShardOwner(it->hash)].push_back(it);
+    }
+
+    if (parts.size() == 1 && parts.begin()->first == core) {
+        return false;
+    }
+
+    struct Gather {
+        int32_t remaining;
+        int64_t count;
+        int64_t aofOffset;
+    };
+
+    std::shared_ptr <Gather> gather(new Gather());
+    gather->remaining = parts.size();
+    gather->count = 0;
+    gather->aofOffset = 0;
+
+    for (auto &it : parts) {
+        if (it.first == core) {
+            std::deque <RedisObjectPtr> keys(it.second.begin(), it.second.end());
+            gather->count += removeKeys(keys, &gather->aofOffset, lazy);
+            gather->remaining--;
+            continue;
+        }
+
+        int32_t owner = it.first;
+        std::shared_ptr <std::deque<RedisObjectPtr>> keys(
+                new std::deque<RedisObjectPtr>(it.second.begin(), it.second.end()));
+        postToCore(core, owner, [this, keys, gather, session, conn, core, owner, lazy]() {
+            int64_t aofOffset = 0;
+            int64_t count = removeKeys(*keys, &aofOffset, lazy);
+            postToCore(owner, core, [gather, session, conn, count, aofOffset]() {
+                gather->count += count;
+                gather->aofOffset = std::max(gather->aofOffset, aofOffset);
+                if (--gather->remaining == 0) {
+                    Buffer reply;
+                    addReplyLongLong(&reply, gather->count);
+                    session->resumeCommand(conn, &reply, gather->aofOffset);
+                }
+            });
+        });
+    }
+
+    obj.clear();
+    return true;
+}
+
+/* DEL or UNLINK of keys owned by the calling loop, logged as one command. */
+int64_t Redis::removeKeys(const std::deque <RedisObjectPtr> &keys, int64_t *aofOffset, bool lazy) {
+    static const RedisCommand *del = lookupCommand("del");
+    static const RedisCommand *unlink = lookupCommand("unlink");
+    const RedisCommand *command = lazy ? unlink : del;
+    bool cut = snapshotBeforeWrite(command, keys);
+    int64_t count = 0;
+    for (auto &it : keys) {
+        if (removeCommand(it, lazy)) {
+            count++;
+        }
+    }
+
+    if (aof.isEnabled()) {
+        *aofOffset = std::max(*aofOffset, aof.feedCommand(command->name, keys, cut));
+    }
+    return count;
+}
+
+bool Redis::snapshotBeforeWrite(const RedisCommand *command, const std::deque <RedisObjectPtr> &obj) {
+    if (!(command->flags & CMD_WRITE) || !rdb.isSnapshotRunning()) {
+        return false;
+    }
+
+    std::vector <std::string_view> argv;
+    for (auto &it : obj) {
+        argv.emplace_back(it->ptr, sdslen(it->ptr));
+    }
+    snapshotBeforeWrite(command, argv);
+    return true;
+}
+
+void Redis::snapshotBeforeWrite(const RedisCommand *command,
+                                const std::vector <std::string_view> &argv) {
+    if (!command->hasKeys()) {
+        /* FLUSHDB, it touches every shard. */
+        for (size_t i = 0; i < redisShards.size(); i++) {
+            std::unique_lock <std::mutex> lck(redisShards[i].mtx);
+            rdb.rdbSnapshotShard(i);
+        }
+        return;
+    }
+
+    int32_t lastKey = command->lastKey < 0 ? argv.size() + 1 + command->lastKey : command->lastKey;
+    for (int32_t j = command->firstKey; j <= lastKey && j <= argv.size(); j += command->keyStep) {
+        const std::string_view &key = argv[j - 1];
+        uint32_t hash = dictGenHashFunction(key.data(), key.size());
+        size_t index = hash % kShards;
+        std::unique_lock <std::mutex> lck(redisShards[index].mtx);
+        rdb.rdbSnapshotKey(index, key.data(), key.size(), hash);
+    }
+}
+
 bool Redis::clearClusterMigradeCommand() {
     return true;
 }
@@ -54,6 +309,24 @@ void Redis::bgsaveCron() {
 }
 
 void Redis::serverCron() {
+    activeExpireCycle();
+    Evict::updateClock();
+    evictCron();
+
+    bool waitingSlaves;
+    {
+        std::unique_lock <std::mutex> lck(slaveMutex);
+        repli.freeBacklogIfIdle();
+        waitingSlaves = repli.hasSyncSlaves();
+    }
+
+    if (waitingSlaves && !rdbSaveInProgress()) {
+        rdb.rdbSaveSnapshotBackground(REDIS_DEFAULT_RDB_FILENGTHAME, RDB_SAVE_REPLICATION);
+    }
+
+    if ((aof.isWaitingRewrite() || aof.rewriteNeeded()) && !rdbSaveInProgress()) {
+        rewriteAppendOnlyFileBackground();
+    }
 #ifndef _WIN64
     if (rdbChildPid != -1) {
         pid_t pid;
@@ -65,26 +338,8 @@ void Redis::serverCron() {
             if (WIFSIGNALED(statloc)) bysignal = WTERMSIG(statloc);
 
             if (pid == rdbChildPid) {
-                if (!bysignal && exitcode == 0) {
-                    LOG_INFO << "Background saving terminated with success";
-                    if (slavefd != -1) {
-                        std::unique_lock <std::mutex> lck(slaveMutex);
-                        auto it = slaveConns.find(slavefd);
-                        if (it == slaveConns.end()) {
-                            LOG_WARN << "Master sync send failure";
-                        } else {
-                            if (!rdb.rdbReplication("dump.rdb", it->second)) {
-                                it->second->forceClose();
-                                LOG_WARN << "Master sync send failure";
-                            } else {
-                                LOG_INFO << "Master sync send success ";
-                            }
-                        }
-
-                        slavefd = -1;
-                    }
-                } else if (!bysignal && exitcode != 0) {
-                    LOG_INFO << "Background saving error";
+                if (!bysignal) {
+                    backgroundSaveDone(exitcode == 0);
                 } else {
                     LOG_WARN << "Background saving terminated by signal " << bysignal;
                     char tmpfile[256];
@@ -103,11 +358,96 @@ void Redis::serverCron() {
 #endif
 }
 
-void Redis::slaveRepliTimeOut(int32_t context) {
-    std::unique_lock <std::mutex> lck(slaveMutex);
-    auto it = slaveConns.find(context);
-    if (it != slaveConns.end()) {
-        it->second->forceClose();
+/* Runs on the main loop once a fork or forkless BGSAVE is done. */
+int32_t Redis::rewriteAppendOnlyFileBackground() {
+    const char *tmpfile = "temp-rewriteaof-bg.aof";
+    if (rdbSaveInProgress() || !aof.rewriteStart()) {
+        return REDIS_ERR;
+    }
+
+    if (rdb.rdbSaveSnapshotBackground(tmpfile, RDB_SAVE_AOF_PREAMBLE) == REDIS_ERR) {
+        aof.rewriteDone(tmpfile, false);
+        return REDIS_ERR;
+    }
+
+    LOG_INFO << "Background append only file rewriting started";
+    return REDIS_OK;
+}
+
+void Redis::waitForLoops() {
+    std::vector < EventLoop * > loops = coreLoops;
+    if (std::find(loops.begin(), loops.end(), &loop) == loops.end()) {
+        loops.push_back(&loop);
+    }
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    size_t passed = 0;
+    for (auto &it : loops) {
+        it->queueInLoop([&]() {
+            std::unique_lock <std::mutex> lck(mutex);
+            passed++;
+            condition.notify_one();
+        });
+    }
+
+    std::unique_lock <std::mutex> lck(mutex);
+    while (passed < loops.size()) {
+        condition.wait(lck);
+    }
+}
+
+void Redis::stopLoops(const std::function<void()> &fn) {
+    std::vector < EventLoop * > loops = coreLoops;
+    if (std::find(loops.begin(), loops.end(), &loop) == loops.end()) {
+        loops.push_back(&loop);
+    }
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    size_t stopped = 0;
+    bool released = false;
+    for (auto &it : loops) {
+        it->queueInLoop([&]() {
+            std::unique_lock <std::mutex> lck(mutex);
+            stopped++;
+            condition.notify_all();
+            while (!released) {
+                condition.wait(lck);
+            }
+            stopped--;
+            condition.notify_all();
+        });
+    }
+
+    std::unique_lock <std::mutex> lck(mutex);
+    while (stopped < loops.size()) {
+        condition.wait(lck);
+    }
+
+    fn();
+
+    /* The tasks refer to the locals, wait until all of them are done. */
+    released = true;
+    condition.notify_all();
+    while (stopped > 0) {
+        condition.wait(lck);
+    }
+}
+
+void Redis::backgroundSaveDone(bool success) {
+    if (!success) {
+        LOG_INFO << "Background saving error";
+        return;
+    }
+
+    LOG_INFO << "Background saving terminated with success";
+}
+
+void Redis::slaveRepliTimeOut(const std::weak_ptr <TcpConnection> &conn) {
+    TcpConnectionPtr c = conn.lock();
+    if (c) {
+        c->forceClose();
     }
     LOG_INFO << "sync connect repli timeout ";
 }
@@ -116,33 +456,140 @@ void Redis::clearCommand(std::deque <RedisObjectPtr> &commands) {
     commands.clear();
 }
 
-void Redis::clearPubSubState(int32_t sockfd) {
+void Redis::clearPubSubState(const TcpConnectionPtr &conn) {
+    pubsub.clear(getCoreIndex(conn->getLoop()), conn->getSockfd());
+}
+
+void Redis::setExpire(const RedisObjectPtr &key, int64_t when) {
+    size_t index = key->hash % kShards;
+    std::unique_lock <std::mutex> lck = lockShard(index);
+    redisShards[index].expireWheel.add(key, when);
+}
+
+void Redis::evictCron() {
+    if (evict.performEvictions() == REDIS_OK && evict.isAboveLimit() && !evictPending) {
+        evictPending = true;
+        loop.runAfter(0.001, false, [this]() {
+            evictPending = false;
+            evictCron();
+        });
+    }
+}
+
+bool Redis::evictKey(size_t index, const std::string &key) {
+    RedisObjectPtr obj = createStringObject((char *) key.data(), key.size());
+    auto &shard = redisShards[index];
+    bool cut;
     {
-        std::unique_lock <std::mutex> lck(pubsubMutex);
-        for (auto &it : pubSubs) {
-            for (auto iter = it.second.begin(); iter != it.second.end();) {
-                if (iter->first == sockfd) {
-                    it.second.erase(iter++);
-                    continue;
-                }
-                ++iter;
-            }
+        std::unique_lock <std::mutex> lck(shard.mtx);
+        cut = rdb.isSnapshotRunning();
+        if (!removeKey(shard, obj)) {
+            return false;
         }
     }
+
+    propagate("del", {obj}, cut);
+    return true;
 }
 
-void Redis::setExpire(const RedisObjectPtr &key, double when) {
-    {
-        std::unique_lock <std::mutex> lck(expireMutex);
-        auto it = expireTimers.find(key);
-        assert(it == expireTimers.end());
+int64_t Redis::propagate(const char *name, const std::deque <RedisObjectPtr> &obj, bool cut) {
+    int64_t offset = 0;
+    if (aof.isEnabled()) {
+        offset = aof.feedCommand(name, obj, cut);
+    }
+
+    /* Only a master feeds the stream, a slave gets the writes from it. */
+    if (repliEnabled && masterfd <= 0) {
+        std::deque <RedisObjectPtr> robjs = obj;
+        robjs.push_front(createStringObject((char *) name, strlen(name)));
+        Buffer buffer;
+        structureRedisProtocol(buffer, robjs);
+        std::unique_lock <std::mutex> lck(slaveMutex);
+        repli.feedSlaves(buffer.peek(), buffer.readableBytes());
     }
+    return offset;
+}
 
-    auto timer = loop.runAfter(when, false, std::bind(&Redis::setExpireTimeOut, this, key));
+std::unique_lock <std::mutex> Redis::lockShard(size_t index) {
+    auto &mu = redisShards[index].mtx;
+#ifdef _LUA
+    if (Scripting::holdsShard(index)) {
+        return std::unique_lock <std::mutex>(mu, std::defer_lock);
+    }
+#endif
+    return std::unique_lock <std::mutex>(mu);
+}
 
-    {
-        std::unique_lock <std::mutex> lck(expireMutex);
-        expireTimers.insert(std::make_pair(key, timer));
+bool Redis::expireIfNeeded(RedisMapLock &shard, const RedisObjectPtr &key) {
+    /* Called with the shard mutex held, which no holder of slaveMutex or
+     * of the append only file mutex ever waits for. */
+    if (shard.expireWheel.size() == 0) {
+        return false;
+    }
+
+    int64_t when = shard.expireWheel.get(key);
+    if (when < 0 || mstime() <= when) {
+        return false;
+    }
+
+    bool cut = rdb.isSnapshotRunning();
+    if (!removeKey(shard, key)) {
+        return false;
+    }
+
+    /* The batch of the command that found the key expired may have written
+     * it before, that goes first or the key comes back on reload. */
+    Session *session = Session::getRunning();
+    if (session) {
+        session->flushPending();
+    }
+    propagate("del", {key}, cut);
+    return true;
+}
+
+/* Try to expire a few timed out keys. The shards are walked round robin and
+ * every shard wheel is advanced to the current time, deleting at most
+ * REDIS_EXPIRELOOKUPS_PER_CRON keys per lock acquisition so that clients
+ * waiting on the shard are not starved. If a shard has more expired keys we
+ * keep going until the time limit is reached, and the next cycle resumes
+ * from the same shard. Keys are only taken REDIS_EXPIRE_GRACE_MS after they
+ * timed out, so that a batch on another loop that wrote them while they were
+ * alive has logged that before the DEL, an access meanwhile expires them on
+ * its own session. */
+void Redis::activeExpireCycle() {
+    int64_t start = ustime();
+    int64_t timelimit = 1000000 * REDIS_EXPIRELOOKUPS_TIME_PERC / REDIS_DEFAULT_HZ / 100;
+    int64_t now = mstime() - REDIS_EXPIRE_GRACE_MS;
+    std::vector <RedisObjectPtr> expired;
+    std::vector <RedisObjectPtr> removed;
+
+    for (int32_t j = 0; j < kShards; j++) {
+        auto &shard = redisShards[expireShardIndex];
+        bool more, cut;
+        do {
+            {
+                std::unique_lock <std::mutex> lck(shard.mtx);
+                cut = rdb.isSnapshotRunning();
+                more = shard.expireWheel.advance(now, REDIS_EXPIRELOOKUPS_PER_CRON, expired);
+                for (auto &it : expired) {
+                    if (removeKey(shard, it)) {
+                        removed.push_back(it);
+                    }
+                }
+            }
+
+            for (auto &it : removed) {
+                propagate("del", {it}, cut);
+            }
+
+            removed.clear();
+            expired.clear();
+            if (ustime() - start > timelimit) {
+                return;
+            }
+        } while (more);
+
+        expireShardIndex = (expireShardIndex + 1) % kShards;
     }
 }
 
@@ -172,16 +619,8 @@ void Redis::clearSessionState(int32_t sockfd) {
 void Redis::clearRepliState(int32_t sockfd) {
     {
         std::unique_lock <std::mutex> lck(slaveMutex);
-        auto it = slaveConns.find(sockfd);
-        if (it != slaveConns.end()) {
-            salveCount--;
-            slaveConns.erase(sockfd);
-            if (slaveConns.size() == 0) {
-                repliEnabled = false;
-                Buffer buffer;
-                slaveCached.swap(buffer);
-            }
-        }
+        slaveConns.erase(sockfd);
+        repli.removeSlave(sockfd);
 
         auto iter = repliTimers.find(sockfd);
         if (iter != repliTimers.end()) {
@@ -191,10 +630,6 @@ void Redis::clearRepliState(int32_t sockfd) {
     }
 }
 
-void Redis::setExpireTimeOut(const RedisObjectPtr &expire) {
-    removeCommand(expire);
-}
-
 void Redis::writeCompleteCallBack(const TcpConnectionPtr &conn) {
     conn->startRead();
     conn->setWriteCompleteCallback(WriteCompleteCallback());
@@ -232,6 +667,7 @@ void Redis::connCallBack(const TcpConnectionPtr &conn) {
         clearRepliState(conn->getSockfd());
         clearClusterState(conn->getSockfd());
         clearMonitorState(conn->getSockfd());
+        clearPubSubState(conn);
         clearSessionState(conn->getSockfd());
 
         LOG_INFO << "Client disconnect ";
@@ -277,160 +713,435 @@ void Redis::feedMonitor(const std::deque <RedisObjectPtr> &obj, int32_t sockfd)
     }
 }
 
-void Redis::loadDataFromDisk() {
+/* Nothing is served before the load is done, so it uses every core there
+ * is rather than only the ones the server will run on. */
+void Redis::loadDataFromDisk(bool appendOnly) {
     int64_t start = ustime();
-    if (rdb.rdbLoad("dump.rdb") == REDIS_OK) {
+    int32_t threads = std::max<int32_t>(threadCount, std::thread::hardware_concurrency());
+    if (appendOnly) {
+        if (std::experimental::filesystem::exists(REDIS_DEFAULT_AOF_FILENGTHAME)) {
+            if (aof.loadAppendOnlyFile(REDIS_DEFAULT_AOF_FILENGTHAME, threads) == REDIS_ERR) {
+                /* Going on would rewrite the file with whatever was read. */
+                LOG_WARN << "Fatal error loading the append only file: Exiting.";
+                exit(1);
+            }
+
+            LOG_INFO << "DB loaded from append only file milliseconds: " << double(ustime() - start) / 1000;
+            aof.start(false);
+            return;
+        }
+
+        /* The first rewrite creates the file from what the RDB holds. */
+        aof.start(true);
+    }
+
+    if (rdb.rdbLoad("dump.rdb", threads) == REDIS_OK) {
         int64_t end = ustime();
-        double diff = double(end - end) / (1000 * 1000);
-        LOG_INFO << "DB loaded from disk seconds: " << double(end - start) / 1000;
+        LOG_INFO << "DB loaded from disk milliseconds: " << double(end - start) / 1000
+                 << " threads: " << threads;
     } else if (errno != ENOENT) {
         LOG_WARN << "Fatal error loading the DB: Exiting." << strerror(errno);
     }
 }
 
+void Redis::addReplyPubSub(Buffer *buffer, const RedisObjectPtr &kind,
+                           const RedisObjectPtr &name, size_t count) {
+    addReply(buffer, shared.mbulkhdr[3]);
+    addReply(buffer, kind);
+    if (name != nullptr) {
+        addReplyBulk(buffer, name);
+    } else {
+        addReply(buffer, shared.nullbulk);
+    }
+    addReplyLongLong(buffer, count);
+}
+
 bool Redis::subscribeCommand(const std::deque <RedisObjectPtr> &obj,
                              const SessionPtr &session, const TcpConnectionPtr &conn) {
     if (obj.size() < 1) {
         return false;
     }
 
-    bool retval;
-    int sub = 0;
-    for (int i = 0; i < obj.size(); i++) {
-        {
-            std::unique_lock <std::mutex> lck(pubsubMutex);
-            auto it = pubSubs.find(obj[i]);
-            if (it == pubSubs.end()) {
-                std::unordered_map <int32_t, TcpConnectionPtr> maps;
-                maps[conn->getSockfd()] = conn;
-                pubSubs[obj[i]] = std::move(maps);
-                retval = true;
-                sub++;
-            } else {
-                retval = false;
-                auto iter = it->second.find(conn->getSockfd());
-                if (iter == it->second.end()) {
-                    sub++;
-                }
-                it->second[conn->getSockfd()] = conn;
-            }
-        }
-
-        addReply(conn->outputBuffer(), shared.mbulkhdr[3]);
-        addReply(conn->outputBuffer(), shared.subscribebulk);
-        addReplyBulk(conn->outputBuffer(), obj[i]);
-        addReplyLongLong(conn->outputBuffer(), sub);
+    for (auto &it : obj) {
+        size_t count = pubsub.subscribe(session->getCoreIndex(), conn, it);
+        addReplyPubSub(conn->outputBuffer(), shared.subscribebulk, it, count);
     }
     return true;
 }
 
 bool Redis::unsubscribeCommand(const std::deque <RedisObjectPtr> &obj,
                                const SessionPtr &session, const TcpConnectionPtr &conn) {
-    return false;
+    std::vector <RedisObjectPtr> channels(obj.begin(), obj.end());
+    if (channels.empty()) {
+        pubsub.getChannels(session->getCoreIndex(), conn->getSockfd(), &channels);
+        if (channels.empty()) {
+            addReplyPubSub(conn->outputBuffer(), shared.unsubscribebulk, nullptr,
+                           pubsub.subscriptions(session->getCoreIndex(), conn->getSockfd()));
+            return true;
+        }
+    }
+
+    for (auto &it : channels) {
+        size_t count = pubsub.unsubscribe(session->getCoreIndex(), conn->getSockfd(), it);
+        addReplyPubSub(conn->outputBuffer(), shared.unsubscribebulk, it, count);
+    }
+    return true;
 }
 
 bool Redis::psubscribeCommand(const std::deque <RedisObjectPtr> &obj,
                               const SessionPtr &session, const TcpConnectionPtr &conn) {
-    return false;
+    if (obj.size() < 1) {
+        return false;
+    }
+
+    for (auto &it : obj) {
+        size_t count = pubsub.psubscribe(session->getCoreIndex(), conn, it);
+        addReplyPubSub(conn->outputBuffer(), shared.psubscribebulk, it, count);
+    }
+    return true;
 }
 
 bool Redis::punsubscribeCommand(const std::deque <RedisObjectPtr> &obj,
                                 const SessionPtr &session, const TcpConnectionPtr &conn) {
-    return false;
+    std::vector <RedisObjectPtr> patterns(obj.begin(), obj.end());
+    if (patterns.empty()) {
+        pubsub.getPatterns(session->getCoreIndex(), conn->getSockfd(), &patterns);
+        if (patterns.empty()) {
+            addReplyPubSub(conn->outputBuffer(), shared.punsubscribebulk, nullptr,
+                           pubsub.subscriptions(session->getCoreIndex(), conn->getSockfd()));
+            return true;
+        }
+    }
+
+    for (auto &it : patterns) {
+        size_t count = pubsub.punsubscribe(session->getCoreIndex(), conn->getSockfd(), it);
+        addReplyPubSub(conn->outputBuffer(), shared.punsubscribebulk, it, count);
+    }
+    return true;
 }
 
 bool Redis::publishCommand(const std::deque <RedisObjectPtr> &obj,
                            const SessionPtr &session, const TcpConnectionPtr &conn) {
-    return false;
-}
-
-bool Redis::pubsubCommand(const std::deque <RedisObjectPtr> &obj,
-                          const SessionPtr &session, const TcpConnectionPtr &conn) {
-    return false;
-}
+    if (obj.size() != 2) {
+        return false;
+    }
 
-bool Redis::sentinelCommand(const std::deque <RedisObjectPtr> &obj,
-                            const SessionPtr &session, const TcpConnectionPtr &conn) {
-    return false;
+    addReplyLongLong(conn->outputBuffer(), pubsub.publish(obj[0], obj[1]));
+    return true;
 }
 
-bool Redis::memoryCommand(const std::deque <RedisObjectPtr> &obj,
+bool Redis::pubsubCommand(const std::deque <RedisObjectPtr> &obj,
                           const SessionPtr &session, const TcpConnectionPtr &conn) {
-    if (obj.size() > 2) {
+    if (obj.size() < 1) {
         return false;
     }
-#ifdef USE_JEMALLOC
 
-    char tmp[32];
-    unsigned narenas = 0;
-    size_t sz = sizeof(unsigned);
-    if (!je_mallctl("arenas.narenas", &narenas, &sz, nullptr, 0))
-    {
-        sprintf(tmp, "arena.%d.purge", narenas);
-        if (!je_mallctl(tmp, nullptr, 0, nullptr, 0))
-        {
-            addReply(conn->outputBuffer(), ok);
-            return  true;
+    if (!strcasecmp(obj[0]->ptr, "channels") && obj.size() <= 2) {
+        std::vector <RedisObjectPtr> channels;
+        pubsub.channels(obj.size() == 2 ? obj[1] : nullptr, &channels);
+        addReplyMultiBulkLen(conn->outputBuffer(), channels.size());
+        for (auto &it : channels) {
+            addReplyBulk(conn->outputBuffer(), it);
         }
+    } else if (!strcasecmp(obj[0]->ptr, "numsub")) {
+        addReplyMultiBulkLen(conn->outputBuffer(), (obj.size() - 1) * 2);
+        for (size_t i = 1; i < obj.size(); i++) {
+            addReplyBulk(conn->outputBuffer(), obj[i]);
+            addReplyLongLong(conn->outputBuffer(), pubsub.numsub(obj[i]));
+        }
+    } else if (!strcasecmp(obj[0]->ptr, "numpat") && obj.size() == 1) {
+        addReplyLongLong(conn->outputBuffer(), pubsub.numpat());
+    } else {
+        addReplyErrorFormat(conn->outputBuffer(),
+                            "Unknown PUBSUB subcommand or wrong number of arguments for '%s'",
+                            obj[0]->ptr);
     }
-
-#endif
-
-    addReply(conn->outputBuffer(), shared.ok);
+    return true;
+}
+
+bool Redis::slowlogCommand(const std::deque <RedisObjectPtr> &obj,
+                           const SessionPtr &session, const TcpConnectionPtr &conn) {
+    if (obj.size() < 1) {
+        return false;
+    }
+
+    if (!strcasecmp(obj[0]->ptr, "get") && obj.size() <= 2) {
+        int64_t count = 10;
+        if (obj.size() == 2) {
+            char *end;
+            count = strtoll(obj[1]->ptr, &end, 10);
+            if (*end != '\0' || count < -1) {
+                addReplyError(conn->outputBuffer(), "count should be greater than or equal to -1");
+                return true;
+            }
+        }
+
+        auto entries = commandStats.getSlowlog(count < 0 ? SIZE_MAX : count);
+        addReplyMultiBulkLen(conn->outputBuffer(), entries.size());
+        for (auto &it : entries) {
+            addReplyMultiBulkLen(conn->outputBuffer(), 6);
+            addReplyLongLong(conn->outputBuffer(), it.id);
+            addReplyLongLong(conn->outputBuffer(), it.time);
+            addReplyLongLong(conn->outputBuffer(), it.duration);
+            addReplyMultiBulkLen(conn->outputBuffer(), it.argv.size());
+            for (auto &arg : it.argv) {
+                addReplyBulkCBuffer(conn->outputBuffer(), arg.data(), arg.size());
+            }
+            addReplyBulkCBuffer(conn->outputBuffer(), it.client.data(), it.client.size());
+            addReplyBulkCString(conn->outputBuffer(), "");
+        }
+    } else if (!strcasecmp(obj[0]->ptr, "len") && obj.size() == 1) {
+        addReplyLongLong(conn->outputBuffer(), commandStats.getSlowlogLen());
+    } else if (!strcasecmp(obj[0]->ptr, "reset") && obj.size() == 1) {
+        commandStats.resetSlowlog();
+        addReply(conn->outputBuffer(), shared.ok);
+    } else {
+        addReplyErrorFormat(conn->outputBuffer(),
+                            "Unknown SLOWLOG subcommand or wrong number of arguments for '%s'",
+                            obj[0]->ptr);
+    }
+    return true;
+}
+
+bool Redis::latencyCommand(const std::deque <RedisObjectPtr> &obj,
+                           const SessionPtr &session, const TcpConnectionPtr &conn) {
+    if (obj.size() < 1) {
+        return false;
+    }
+
+    if (strcasecmp(obj[0]->ptr, "histogram")) {
+        addReplyErrorFormat(conn->outputBuffer(),
+                            "Unknown LATENCY subcommand or wrong number of arguments for '%s'",
+                            obj[0]->ptr);
+        return true;
+    }
+
+    /* Every command that ran, or the ones named, unknown names are left
+     * out. */
+    std::vector <size_t> ids;
+    if (obj.size() == 1) {
+        for (size_t i = 0; i < getCommandCount(); i++) {
+            ids.push_back(i);
+        }
+    } else {
+        for (size_t i = 1; i < obj.size(); i++) {
+            const RedisCommand *command = lookupCommand(std::string_view(obj[i]->ptr, sdslen(obj[i]->ptr)));
+            if (command != nullptr) {
+                ids.push_back(getCommandId(command));
+            }
+        }
+    }
+
+    /* Like upstream, in buckets of powers of two microseconds, every
+     * bucket counting the calls at or below its bound. */
+    Buffer reply;
+    int32_t commands = 0;
+    CommandStats::Summary summary;
+    for (auto id : ids) {
+        commandStats.getSummary(id, &summary);
+        if (summary.histogramTotal == 0) {
+            continue;
+        }
+
+        std::map <int64_t, uint64_t> buckets;
+        for (int32_t i = 0; i < LatencyHistogram::kBuckets; i++) {
+            if (summary.histogram[i] > 0) {
+                int64_t usec = LatencyHistogram::bucketLow(i) / 1000;
+                int64_t bound = 1;
+                while (bound < usec) {
+                    bound <<= 1;
+                }
+                buckets[bound] += summary.histogram[i];
+            }
+        }
+
+        addReplyBulkCString(&reply, getCommandById(id)->name);
+        addReplyMultiBulkLen(&reply, 4);
+        addReplyBulkCString(&reply, "calls");
+        addReplyLongLong(&reply, summary.calls);
+        addReplyBulkCString(&reply, "histogram_usec");
+        addReplyMultiBulkLen(&reply, buckets.size() * 2);
+        uint64_t cumulative = 0;
+        for (auto &it : buckets) {
+            cumulative += it.second;
+            addReplyLongLong(&reply, it.first);
+            addReplyLongLong(&reply, cumulative);
+        }
+        commands++;
+    }
+
+    addReplyMultiBulkLen(conn->outputBuffer(), commands * 2);
+    conn->outputBuffer()->appendBuffer(&reply);
+    return true;
+}
+
+bool Redis::sentinelCommand(const std::deque <RedisObjectPtr> &obj,
+                            const SessionPtr &session, const TcpConnectionPtr &conn) {
+    return false;
+}
+
+bool Redis::memoryCommand(const std::deque <RedisObjectPtr> &obj,
+                          const SessionPtr &session, const TcpConnectionPtr &conn) {
+    if (obj.size() > 2) {
+        return false;
+    }
+#ifdef USE_JEMALLOC
+
+    char tmp[32];
+    unsigned narenas = 0;
+    size_t sz = sizeof(unsigned);
+    if (!je_mallctl("arenas.narenas", &narenas, &sz, nullptr, 0))
+    {
+        sprintf(tmp, "arena.%d.purge", narenas);
+        if (!je_mallctl(tmp, nullptr, 0, nullptr, 0))
+        {
+            addReply(conn->outputBuffer(), ok);
+            return  true;
+        }
+    }
+
+#endif
+
+    addReply(conn->outputBuffer(), shared.ok);
     return true;
 }
 
 bool Redis::infoCommand(const std::deque <RedisObjectPtr> &obj,
                         const SessionPtr &session, const TcpConnectionPtr &conn) {
-    if (obj.size() < 0) {
+    if (obj.size() > 1) {
         return false;
     }
 
 #ifndef _WIN64
+    /* The statistics sections are long, like upstream they are only sent
+     * when asked for by name or with "all". */
+    const char *section = obj.empty() ? "default" : obj[0]->ptr;
+    bool all = !strcasecmp(section, "all") || !strcasecmp(section, "everything");
+    bool defaults = all || !strcasecmp(section, "default");
+    auto wanted = [&](const char *name) { return defaults || !strcasecmp(section, name); };
+
     struct rusage self_ru, c_ru;
     getrusage(RUSAGE_SELF, &self_ru);
     getrusage(RUSAGE_CHILDREN, &c_ru);
     sds info = sdsempty();
 
     char hmem[64];
+    char maxmem[64];
     size_t zmallocUsed = zmalloc_used_memory();
 
     bytesToHuman(hmem, zmallocUsed);
-
-    info = sdscat(info, "\r\n");
-    info = sdscatprintf(info,
-                        "# Memory\r\n"
-                        "used_memory:%zu\r\n"
-                        "used_memory_human:%s\r\n"
-                        "mem_allocator:%s\r\n",
-                        zmallocUsed,
-                        hmem,
-                        ZMALLOC_LIB);
-
-
-    info = sdscat(info, "\r\n");
-    info = sdscatprintf(info,
-                        "# CPU\r\n"
-                        "used_cpu_sys:%.2f\r\n"
-                        "used_cpu_user:%.2f\r\n"
-                        "used_cpu_sys_children:%.2f\r\n"
-                        "used_cpu_user_children:%.2f\r\n",
-                        (float) self_ru.ru_stime.tv_sec + (float) self_ru.ru_stime.tv_usec / 1000000,
-                        (float) self_ru.ru_utime.tv_sec + (float) self_ru.ru_utime.tv_usec / 1000000,
-                        (float) c_ru.ru_stime.tv_sec + (float) c_ru.ru_stime.tv_usec / 1000000,
-                        (float) c_ru.ru_utime.tv_sec + (float) c_ru.ru_utime.tv_usec / 1000000);
-
-    info = sdscat(info, "\r\n");
-    info = sdscatprintf(info,
-                        "# Server\r\n"
-                        "tcp_connect_count:%d\r\n"
-                        "local_ip:%s\r\n"
-                        "local_port:%d\r\n"
-                        "local_thread_count:%d\n",
-                        sessions.size(),
-                        ip.c_str(),
-                        port,
-                        threadCount);
+    bytesToHuman(maxmem, evict.getMaxmemory());
+
+    if (wanted("memory")) {
+        info = sdscat(info, "\r\n");
+        info = sdscatprintf(info,
+                            "# Memory\r\n"
+                            "used_memory:%zu\r\n"
+                            "used_memory_human:%s\r\n"
+                            "maxmemory:%zu\r\n"
+                            "maxmemory_human:%s\r\n"
+                            "maxmemory_policy:%s\r\n"
+                            "evicted_keys:%ld\r\n"
+                            "lazyfree_pending_objects:%ld\r\n"
+                            "lazyfreed_objects:%ld\r\n"
+                            "mem_allocator:%s\r\n",
+                            zmallocUsed,
+                            hmem,
+                            evict.getMaxmemory(),
+                            maxmem,
+                            evict.getPolicyName(),
+                            evict.getEvictedKeys(),
+                            lazyfree.getPendingObjects(),
+                            lazyfree.getFreedObjects(),
+                            ZMALLOC_LIB);
+    }
+
+
+    if (wanted("cpu")) {
+        info = sdscat(info, "\r\n");
+        info = sdscatprintf(info,
+                            "# CPU\r\n"
+                            "used_cpu_sys:%.2f\r\n"
+                            "used_cpu_user:%.2f\r\n"
+                            "used_cpu_sys_children:%.2f\r\n"
+                            "used_cpu_user_children:%.2f\r\n",
+                            (float) self_ru.ru_stime.tv_sec + (float) self_ru.ru_stime.tv_usec / 1000000,
+                            (float) self_ru.ru_utime.tv_sec + (float) self_ru.ru_utime.tv_usec / 1000000,
+                            (float) c_ru.ru_stime.tv_sec + (float) c_ru.ru_stime.tv_usec / 1000000,
+                            (float) c_ru.ru_utime.tv_sec + (float) c_ru.ru_utime.tv_usec / 1000000);
+    }
+
+    if (wanted("persistence")) {
+        static const char *fsyncNames[] = {"no", "always", "everysec"};
+        info = sdscat(info, "\r\n");
+        info = sdscatprintf(info,
+                            "# Persistence\r\n"
+                            "aof_enabled:%d\r\n"
+                            "aof_rewrite_in_progress:%d\r\n"
+                            "aof_fsync:%s\r\n"
+                            "aof_current_size:%lld\r\n"
+                            "aof_base_size:%lld\r\n",
+                            aof.isEnabled(),
+                            aof.isRewriting(),
+                            fsyncNames[aof.getFsync()],
+                            (long long) aof.getCurrentSize(),
+                            (long long) aof.getBaseSize());
+    }
+
+    if (wanted("replication")) {
+        std::unique_lock <std::mutex> lck(slaveMutex);
+        info = sdscat(info, "\r\n");
+        info = sdscatprintf(info,
+                            "# Replication\r\n"
+                            "role:%s\r\n"
+                            "connected_slaves:%zu\r\n"
+                            "master_replid:%s\r\n"
+                            "master_repl_offset:%lld\r\n"
+                            "repl_backlog_active:%d\r\n"
+                            "repl_backlog_size:%lld\r\n"
+                            "repl_backlog_first_byte_offset:%lld\r\n"
+                            "repl_backlog_histlen:%lld\r\n"
+                            "sync_full:%lld\r\n"
+                            "sync_partial_ok:%lld\r\n"
+                            "sync_partial_err:%lld\r\n",
+                            masterPort > 0 ? "slave" : "master",
+                            slaveConns.size(),
+                            repli.getReplid(),
+                            (long long) repli.getReplOffset(),
+                            repli.isBacklogActive(),
+                            (long long) repli.getBacklogSize(),
+                            (long long) repli.getBacklogOffset(),
+                            (long long) repli.getBacklogHistlen(),
+                            (long long) repli.getSyncFull(),
+                            (long long) repli.getSyncPartialOk(),
+                            (long long) repli.getSyncPartialErr());
+    }
+
+    if (wanted("server")) {
+        info = sdscat(info, "\r\n");
+        info = sdscatprintf(info,
+                            "# Server\r\n"
+                            "tcp_connect_count:%d\r\n"
+                            "local_ip:%s\r\n"
+                            "local_port:%d\r\n"
+                            "local_thread_count:%d\r\n"
+                            "multiplexing_api:%s\r\n",
+                            sessions.size(),
+                            ip.c_str(),
+                            port,
+                            threadCount,
+                            EventLoop::getIoBackend());
+    }
+
+    if (all || !strcasecmp(section, "commandstats")) {
+        info = sdscat(info, "\r\n");
+        info = commandStats.genCommandStats(info);
+    }
+
+    if (all || !strcasecmp(section, "latencystats")) {
+        info = sdscat(info, "\r\n");
+        info = commandStats.genLatencyStats(info);
+    }
     addReplyBulkSds(conn->outputBuffer(), info);
 #endif
     return true;
@@ -494,6 +1205,119 @@ bool Redis::configCommand(const std::deque <RedisObjectPtr> &obj,
             authEnabled = true;
             session->setAuth(false);
             addReply(conn->outputBuffer(), shared.ok);
+        } else if (!strcmp(obj[1]->ptr, "appendonly")) {
+            if (!strcmp(obj[2]->ptr, "yes")) {
+                aof.start(true);
+            } else if (!strcmp(obj[2]->ptr, "no")) {
+                aof.stop();
+            } else {
+                addReplyErrorFormat(conn->outputBuffer(),
+                                    "Invalid argument '%s' for CONFIG SET '%s'",
+                                    (char *) obj[2]->ptr, (char *) obj[1]->ptr);
+                return true;
+            }
+            addReply(conn->outputBuffer(), shared.ok);
+        } else if (!strcmp(obj[1]->ptr, "appendfsync")) {
+            if (!strcmp(obj[2]->ptr, "always")) {
+                aof.setFsync(AOF_FSYNC_ALWAYS);
+            } else if (!strcmp(obj[2]->ptr, "everysec")) {
+                aof.setFsync(AOF_FSYNC_EVERYSEC);
+            } else if (!strcmp(obj[2]->ptr, "no")) {
+                aof.setFsync(AOF_FSYNC_NO);
+            } else {
+                addReplyErrorFormat(conn->outputBuffer(),
+                                    "Invalid argument '%s' for CONFIG SET '%s'",
+                                    (char *) obj[2]->ptr, (char *) obj[1]->ptr);
+                return true;
+            }
+            addReply(conn->outputBuffer(), shared.ok);
+        } else if (!strcmp(obj[1]->ptr, "repl-backlog-size")) {
+            char *end;
+            int64_t size = strtoll(obj[2]->ptr, &end, 10);
+            if (*end != '\0' || size <= 0) {
+                addReplyErrorFormat(conn->outputBuffer(),
+                                    "Invalid argument '%s' for CONFIG SET '%s'",
+                                    (char *) obj[2]->ptr, (char *) obj[1]->ptr);
+                return true;
+            }
+
+            {
+                std::unique_lock <std::mutex> lck(slaveMutex);
+                repli.setBacklogSize(size);
+            }
+            addReply(conn->outputBuffer(), shared.ok);
+        } else if (!strcmp(obj[1]->ptr, "list-compress-depth")) {
+            char *end;
+            int64_t depth = strtoll(obj[2]->ptr, &end, 10);
+            if (*end != '\0' || depth < 0 || depth > INT32_MAX) {
+                addReplyErrorFormat(conn->outputBuffer(),
+                                    "Invalid argument '%s' for CONFIG SET '%s'",
+                                    (char *) obj[2]->ptr, (char *) obj[1]->ptr);
+                return true;
+            }
+
+            RedisList::setCompressDepth(depth);
+            addReply(conn->outputBuffer(), shared.ok);
+        } else if (!strcmp(obj[1]->ptr, "maxmemory") ||
+                   !strcmp(obj[1]->ptr, "maxmemory-policy") ||
+                   !strcmp(obj[1]->ptr, "maxmemory-samples")) {
+            int32_t ret;
+            if (!strcmp(obj[1]->ptr, "maxmemory")) {
+                ret = evict.setMaxmemory(obj[2]->ptr);
+            } else if (!strcmp(obj[1]->ptr, "maxmemory-policy")) {
+                ret = evict.setPolicy(obj[2]->ptr);
+            } else {
+                ret = evict.setSamples(obj[2]->ptr);
+            }
+
+            if (ret == REDIS_ERR) {
+                addReplyErrorFormat(conn->outputBuffer(),
+                                    "Invalid argument '%s' for CONFIG SET '%s'",
+                                    (char *) obj[2]->ptr, (char *) obj[1]->ptr);
+                return true;
+            }
+            addReply(conn->outputBuffer(), shared.ok);
+        } else if (!strcmp(obj[1]->ptr, "slowlog-log-slower-than") ||
+                   !strcmp(obj[1]->ptr, "slowlog-max-len") ||
+                   !strcmp(obj[1]->ptr, "latency-tracking")) {
+            int32_t ret;
+            if (!strcmp(obj[1]->ptr, "slowlog-log-slower-than")) {
+                ret = commandStats.setSlowlogSlowerThan(obj[2]->ptr);
+            } else if (!strcmp(obj[1]->ptr, "slowlog-max-len")) {
+                ret = commandStats.setSlowlogMaxLen(obj[2]->ptr);
+            } else {
+                ret = commandStats.setLatencyTracking(obj[2]->ptr);
+            }
+
+            if (ret == REDIS_ERR) {
+                addReplyErrorFormat(conn->outputBuffer(),
+                                    "Invalid argument '%s' for CONFIG SET '%s'",
+                                    (char *) obj[2]->ptr, (char *) obj[1]->ptr);
+                return true;
+            }
+            addReply(conn->outputBuffer(), shared.ok);
+        } else if (!strcmp(obj[1]->ptr, "bgsave-forkless")) {
+            if (!strcmp(obj[2]->ptr, "yes")) {
+                forklessEnabled = true;
+            } else if (!strcmp(obj[2]->ptr, "no")) {
+                forklessEnabled = false;
+            } else {
+                addReplyErrorFormat(conn->outputBuffer(),
+                                    "Invalid argument '%s' for CONFIG SET '%s'",
+                                    (char *) obj[2]->ptr, (char *) obj[1]->ptr);
+                return true;
+            }
+            addReply(conn->outputBuffer(), shared.ok);
+#ifdef _LUA
+        } else if (!strcmp(obj[1]->ptr, "lua-time-limit")) {
+            if (scripting.setTimeLimit(obj[2]->ptr) == REDIS_ERR) {
+                addReplyErrorFormat(conn->outputBuffer(),
+                                    "Invalid argument '%s' for CONFIG SET '%s'",
+                                    (char *) obj[2]->ptr, (char *) obj[1]->ptr);
+                return true;
+            }
+            addReply(conn->outputBuffer(), shared.ok);
+#endif
         } else {
             addReplyErrorFormat(conn->outputBuffer(),
                                 "Invalid argument for CONFIG SET '%s'",
@@ -953,18 +1777,10 @@ void Redis::structureRedisProtocol(Buffer &buffer, std::deque <RedisObjectPtr> &
     }
 }
 
-bool Redis::getClusterMap(const RedisObjectPtr &command) {
-    auto it = cluterCommands.find(command);
-    if (it == cluterCommands.end()) {
-        return false;
-    }
-    return true;
-}
-
 #ifndef _WIN64
 
 bool Redis::bgsave(const SessionPtr &session, const TcpConnectionPtr &conn, bool enabled) {
-    if (rdbChildPid != -1) {
+    if (rdbSaveInProgress()) {
         if (!enabled) {
             addReplyError(conn->outputBuffer(), "Background save already in progress");
         }
@@ -1028,7 +1844,11 @@ void Redis::clearFork() {
 #ifndef _WIN64
 
 int32_t Redis::rdbSaveBackground(bool enabled) {
-    if (rdbChildPid != -1) return REDIS_ERR;
+    if (rdbSaveInProgress()) return REDIS_ERR;
+
+    if (forklessEnabled) {
+        return rdb.rdbSaveSnapshotBackground("dump.rdb");
+    }
 
     pid_t childpid;
     if ((childpid = fork()) == 0) {
@@ -1070,13 +1890,31 @@ bool Redis::bgsaveCommand(const std::deque <RedisObjectPtr> &obj,
     return true;
 }
 
+bool Redis::bgrewriteaofCommand(const std::deque <RedisObjectPtr> &obj,
+                                const SessionPtr &session, const TcpConnectionPtr &conn) {
+    if (obj.size() > 0) {
+        return false;
+    }
+
+    if (aof.isRewriting()) {
+        addReplyError(conn->outputBuffer(), "Background append only file rewriting already in progress");
+    } else if (rdbSaveInProgress()) {
+        addReplyError(conn->outputBuffer(), "Background save already in progress");
+    } else if (rewriteAppendOnlyFileBackground() == REDIS_OK) {
+        addReplyStatus(conn->outputBuffer(), "Background append only file rewriting started");
+    } else {
+        addReplyError(conn->outputBuffer(), "Can't execute an AOF background rewriting");
+    }
+    return true;
+}
+
 bool Redis::saveCommand(const std::deque <RedisObjectPtr> &obj,
                         const SessionPtr &session, const TcpConnectionPtr &conn) {
     if (obj.size() > 0) {
         return false;
     }
 
-    if (rdbChildPid != -1) {
+    if (rdbSaveInProgress()) {
         addReplyError(conn->outputBuffer(), "Background save already in progress");
         return true;
     }
@@ -1134,63 +1972,35 @@ bool Redis::commandCommand(const std::deque <RedisObjectPtr> &obj,
     return true;
 }
 
-void Redis::forkWait() {
-    forkCondWaitCount++;
-    expireCondition.notify_one();
-
-    {
-        std::unique_lock <std::mutex> lck(forkMutex);
-        forkCondition.wait(lck);
-    }
-}
-
 bool Redis::lpushCommand(const std::deque <RedisObjectPtr> &obj,
                          const SessionPtr &session, const TcpConnectionPtr &conn) {
     if (obj.size() < 2) {
         return false;
     }
 
-    obj[0]->type = OBJ_LIST;
-    size_t pushed = 0;
+    size_t len = 0;
     size_t hash = obj[0]->hash;
     size_t index = hash % kShards;
-    auto &mu = redisShards[index].mtx;
-    auto &map = redisShards[index].redisMap;
-    auto &listMap = redisShards[index].listMap;
+    auto &keySpace = redisShards[index].keySpace;
     {
-        std::unique_lock <std::mutex> lck(mu);
-        auto it = map.find(obj[0]);
-        if (it == map.end()) {
-            auto iter = listMap.find(obj[0]);
-            assert(iter == listMap.end());
-            std::deque <RedisObjectPtr> list;
-            for (int32_t i = 1; i < obj.size(); i++) {
-                obj[i]->type = OBJ_LIST;
-                pushed++;
-                list.push_back(obj[i]);
-            }
-            map.insert(obj[0]);
-            listMap.insert(std::make_pair(obj[0], std::move(list)));
-        } else {
-            if ((*it)->type != OBJ_LIST) {
-                addReplyErrorFormat(conn->outputBuffer(),
-                                    "WRONGTYPE Operation against a key holding the wrong kind of value");
-                return true;
-            }
-
-            auto iter = listMap.find(obj[0]);
-            assert(iter != listMap.end());
-            assert(iter->first->type == (*it)->type);
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        expireIfNeeded(redisShards[index], obj[0]);
+        auto entry = keySpace.find(obj[0]);
+        if (entry == nullptr) {
+            entry = keySpace.insert(obj[0], OBJ_LIST);
+        } else if (entry->type != OBJ_LIST) {
+            addReplyErrorFormat(conn->outputBuffer(),
+                                "WRONGTYPE Operation against a key holding the wrong kind of value");
+            return true;
+        }
 
-            for (int32_t i = 1; i < obj.size(); i++) {
-                obj[i]->type = OBJ_LIST;
-                pushed++;
-                iter->second.push_back(obj[i]);
-            }
+        for (int32_t i = 1; i < obj.size(); i++) {
+            entry->obj.list->push(obj[i], REDIS_LIST_HEAD);
         }
+        len = entry->obj.list->size();
     }
 
-    addReplyLongLong(conn->outputBuffer(), pushed);
+    addReplyLongLong(conn->outputBuffer(), len);
     return true;
 }
 
@@ -1202,31 +2012,26 @@ bool Redis::lpopCommand(const std::deque <RedisObjectPtr> &obj,
 
     size_t hash = obj[0]->hash;
     size_t index = hash % kShards;
-    auto &mu = redisShards[index].mtx;
-    auto &map = redisShards[index].redisMap;
-    auto &listMap = redisShards[index].listMap;
+    auto &keySpace = redisShards[index].keySpace;
     {
-        std::unique_lock <std::mutex> lck(mu);
-        auto it = map.find(obj[0]);
-        if (it == map.end()) {
-            auto iter = listMap.find(obj[0]);
-            assert(iter == listMap.end());
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        expireIfNeeded(redisShards[index], obj[0]);
+        auto entry = keySpace.find(obj[0]);
+        if (entry == nullptr) {
             addReply(conn->outputBuffer(), shared.nullbulk);
         } else {
-            if ((*it)->type != OBJ_LIST) {
+            if (entry->type != OBJ_LIST) {
                 addReplyErrorFormat(conn->outputBuffer(),
                                     "WRONGTYPE Operation against a key holding the wrong kind of value");
                 return true;
             }
 
-            auto iter = listMap.find(obj[0]);
-            assert(iter != listMap.end());
-            assert((*it)->type == iter->first->type);
-            addReplyBulk(conn->outputBuffer(), iter->second.back());
-            iter->second.pop_back();
-            if (iter->second.empty()) {
-                listMap.erase(iter);
-                map.erase(it);
+            auto &list = *entry->obj.list;
+            list.pop(REDIS_LIST_HEAD, [&](const std::string_view &value) {
+                addReplyBulkCBuffer(conn->outputBuffer(), value.data(), value.size());
+            });
+            if (list.size() == 0) {
+                keySpace.erase(entry);
             }
         }
     }
@@ -1248,30 +2053,24 @@ bool Redis::lrangeCommand(const std::deque <RedisObjectPtr> &obj,
 
     size_t hash = obj[0]->hash;
     size_t index = hash % kShards;
-    auto &mu = redisShards[index].mtx;
-    auto &map = redisShards[index].redisMap;
-    auto &listMap = redisShards[index].listMap;
+    auto &keySpace = redisShards[index].keySpace;
     {
-        std::unique_lock <std::mutex> lck(mu);
-        auto it = map.find(obj[0]);
-        if (it == map.end()) {
-            auto iter = listMap.find(obj[0]);
-            assert(iter == listMap.end());
-
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        expireIfNeeded(redisShards[index], obj[0]);
+        auto entry = keySpace.find(obj[0]);
+        if (entry == nullptr) {
             addReply(conn->outputBuffer(), shared.nullbulk);
             return true;
         }
 
-        if ((*it)->type != OBJ_LIST) {
+        if (entry->type != OBJ_LIST) {
             addReplyErrorFormat(conn->outputBuffer(),
                                 "WRONGTYPE Operation against a key holding the wrong kind of value");
             return true;
         }
 
-        auto iter = listMap.find(obj[0]);
-        assert(iter != listMap.end());
-        assert((*it)->type == iter->first->type);
-        size_t size = iter->second.size();
+        auto &list = *entry->obj.list;
+        size_t size = list.size();
         if (start < 0) {
             start = size + start;
         }
@@ -1294,13 +2093,11 @@ bool Redis::lrangeCommand(const std::deque <RedisObjectPtr> &obj,
         }
 
         size_t rangelen = (end - start) + 1;
-        addReplyMultiBulkLen(conn->outputBuffer(), rangelen);
-
-        while (rangelen--) {
-            addReplyBulkCBuffer(conn->outputBuffer(),
-                                iter->second[start]->ptr, sdslen(iter->second[start]->ptr));
-            start++;
-        }
+        Buffer *buffer = conn->outputBuffer();
+        addReplyMultiBulkLen(buffer, rangelen);
+        list.range(start, end, [&](const std::string_view &value) {
+            addReplyBulkCBuffer(buffer, value.data(), value.size());
+        });
     }
     return true;
 }
@@ -1311,47 +2108,29 @@ bool Redis::rpushCommand(const std::deque <RedisObjectPtr> &obj,
         return false;
     }
 
-    size_t pushed = 0;
+    size_t len = 0;
     size_t hash = obj[0]->hash;
     size_t index = hash % kShards;
-    auto &mu = redisShards[index].mtx;
-    auto &map = redisShards[index].redisMap;
-    auto &listMap = redisShards[index].listMap;
+    auto &keySpace = redisShards[index].keySpace;
     {
-        std::unique_lock <std::mutex> lck(mu);
-        auto it = map.find(obj[0]);
-        if (it == map.end()) {
-            auto iter = listMap.find(obj[0]);
-            assert(iter == listMap.end());
-            obj[0]->type = OBJ_LIST;
-            std::deque <RedisObjectPtr> list;
-            for (int64_t i = 1; i < obj.size(); i++) {
-                obj[i]->type = OBJ_LIST;
-                pushed++;
-                list.push_front(obj[i]);
-            }
-            map.insert(obj[0]);
-            listMap.insert(std::make_pair(obj[0], std::move(list)));
-        } else {
-            if ((*it)->type != OBJ_LIST) {
-                addReplyErrorFormat(conn->outputBuffer(),
-                                    "WRONGTYPE Operation against a key holding the wrong kind of value");
-                return true;
-            }
-
-            auto iter = listMap.find(obj[0]);
-            assert(iter != listMap.end());
-            assert(iter->first->type == (*it)->type);
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        expireIfNeeded(redisShards[index], obj[0]);
+        auto entry = keySpace.find(obj[0]);
+        if (entry == nullptr) {
+            entry = keySpace.insert(obj[0], OBJ_LIST);
+        } else if (entry->type != OBJ_LIST) {
+            addReplyErrorFormat(conn->outputBuffer(),
+                                "WRONGTYPE Operation against a key holding the wrong kind of value");
+            return true;
+        }
 
-            for (int32_t i = 1; i < obj.size(); ++i) {
-                obj[i]->type = OBJ_LIST;
-                pushed++;
-                iter->second.push_front(obj[i]);
-            }
+        for (int32_t i = 1; i < obj.size(); ++i) {
+            entry->obj.list->push(obj[i], REDIS_LIST_TAIL);
         }
+        len = entry->obj.list->size();
     }
 
-    addReplyLongLong(conn->outputBuffer(), pushed);
+    addReplyLongLong(conn->outputBuffer(), len);
     return true;
 }
 
@@ -1363,35 +2142,30 @@ Redis::rpopCommand(const std::deque <RedisObjectPtr> &obj, const SessionPtr &ses
 
     size_t hash = obj[0]->hash;
     size_t index = hash % kShards;
-    auto &mu = redisShards[index].mtx;
-    auto &map = redisShards[index].redisMap;
-    auto &listMap = redisShards[index].listMap;
+    auto &keySpace = redisShards[index].keySpace;
     {
-        std::unique_lock <std::mutex> lck(mu);
-        auto it = map.find(obj[0]);
-        if (it == map.end()) {
-            auto iter = listMap.find(obj[0]);
-            assert(iter == listMap.end());
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        expireIfNeeded(redisShards[index], obj[0]);
+        auto entry = keySpace.find(obj[0]);
+        if (entry == nullptr) {
             addReply(conn->outputBuffer(), shared.nullbulk);
         } else {
-            if ((*it)->type != OBJ_LIST) {
+            if (entry->type != OBJ_LIST) {
                 addReplyErrorFormat(conn->outputBuffer(),
                                     "WRONGTYPE Operation against a key holding the wrong kind of value");
                 return true;
             }
 
-            auto iter = listMap.find(obj[0]);
-            assert(iter != listMap.end());
-            assert((*it)->type == iter->first->type);
-            addReplyBulk(conn->outputBuffer(), iter->second.front());
-            iter->second.pop_front();
-            if (iter->second.empty()) {
-                listMap.erase(iter);
-                map.erase(it);
+            auto &list = *entry->obj.list;
+            list.pop(REDIS_LIST_TAIL, [&](const std::string_view &value) {
+                addReplyBulkCBuffer(conn->outputBuffer(), value.data(), value.size());
+            });
+            if (list.size() == 0) {
+                keySpace.erase(entry);
             }
         }
     }
-    return false;
+    return true;
 }
 
 bool
@@ -1402,115 +2176,295 @@ Redis::llenCommand(const std::deque <RedisObjectPtr> &obj, const SessionPtr &ses
 
     size_t hash = obj[0]->hash;
     size_t index = hash % kShards;
-    auto &mu = redisShards[index].mtx;
-    auto &map = redisShards[index].redisMap;
-    auto &listMap = redisShards[index].listMap;
+    auto &keySpace = redisShards[index].keySpace;
     {
-        std::unique_lock <std::mutex> lck(mu);
-        auto it = map.find(obj[0]);
-        if (it == map.end()) {
-            auto iter = listMap.find(obj[0]);
-            assert(iter == listMap.end());
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        expireIfNeeded(redisShards[index], obj[0]);
+        auto entry = keySpace.find(obj[0]);
+        if (entry == nullptr) {
             addReplyLongLong(conn->outputBuffer(), 0);
             return true;
         }
 
-        if ((*it)->type != OBJ_LIST) {
+        if (entry->type != OBJ_LIST) {
             addReplyErrorFormat(conn->outputBuffer(),
                                 "WRONGTYPE Operation against a key holding the wrong kind of value");
             return true;
         }
 
-        auto iter = listMap.find(obj[0]);
-        assert(iter != listMap.end());
-        assert((*it)->type == iter->first->type);
-        addReplyLongLong(conn->outputBuffer(), iter->second.size());
+        addReplyLongLong(conn->outputBuffer(), entry->obj.list->size());
     }
     return true;
 }
 
-bool
-Redis::syncCommand(const std::deque <RedisObjectPtr> &obj, const SessionPtr &session, const TcpConnectionPtr &conn) {
-    if (obj.size() > 0) {
+bool Redis::lindexCommand(const std::deque <RedisObjectPtr> &obj,
+                          const SessionPtr &session, const TcpConnectionPtr &conn) {
+    if (obj.size() != 2) {
         return false;
     }
 
-    TimerPtr timer;
+    int64_t idx;
+    if (getLongLongFromObjectOrReply(conn->outputBuffer(), obj[1], &idx, nullptr) != REDIS_OK) {
+        return true;
+    }
+
+    size_t hash = obj[0]->hash;
+    size_t index = hash % kShards;
+    auto &keySpace = redisShards[index].keySpace;
     {
-        std::unique_lock <std::mutex> lck(slaveMutex);
-        auto it = repliTimers.find(conn->getSockfd());
-        if (it != repliTimers.end()) {
-            LOG_WARN << "client repeat send sync ";
-            conn->forceClose();
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        expireIfNeeded(redisShards[index], obj[0]);
+        auto entry = keySpace.find(obj[0]);
+        if (entry == nullptr) {
+            addReply(conn->outputBuffer(), shared.nullbulk);
             return true;
         }
 
-        slavefd = conn->getSockfd();
-        timer = conn->getLoop()->runAfter(REPLI_TIME_OUT,
-                                          false, std::bind(&Redis::slaveRepliTimeOut, this, slavefd));
-        repliTimers.insert(std::make_pair(conn->getSockfd(), timer));
-        slaveConns.insert(std::make_pair(conn->getSockfd(), conn));
+        if (entry->type != OBJ_LIST) {
+            addReplyErrorFormat(conn->outputBuffer(),
+                                "WRONGTYPE Operation against a key holding the wrong kind of value");
+            return true;
+        }
+
+        bool found = entry->obj.list->index(idx, [&](const std::string_view &value) {
+            addReplyBulkCBuffer(conn->outputBuffer(), value.data(), value.size());
+        });
+        if (!found) {
+            addReply(conn->outputBuffer(), shared.nullbulk);
+        }
     }
+    return true;
+}
 
-    auto threadPoolVec = server.getThreadPool()->getAllLoops();
-    for (auto &it : threadPoolVec) {
-        if (conn->getLoop()->getThreadId() == it->getThreadId()) {
-            continue;
+bool Redis::lsetCommand(const std::deque <RedisObjectPtr> &obj,
+                        const SessionPtr &session, const TcpConnectionPtr &conn) {
+    if (obj.size() != 3) {
+        return false;
+    }
+
+    int64_t idx;
+    if (getLongLongFromObjectOrReply(conn->outputBuffer(), obj[1], &idx, nullptr) != REDIS_OK) {
+        return true;
+    }
+
+    size_t hash = obj[0]->hash;
+    size_t index = hash % kShards;
+    auto &keySpace = redisShards[index].keySpace;
+    {
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        expireIfNeeded(redisShards[index], obj[0]);
+        auto entry = keySpace.find(obj[0]);
+        if (entry == nullptr) {
+            addReply(conn->outputBuffer(), shared.nokeyerr);
+            return true;
+        }
+
+        if (entry->type != OBJ_LIST) {
+            addReplyErrorFormat(conn->outputBuffer(),
+                                "WRONGTYPE Operation against a key holding the wrong kind of value");
+            return true;
+        }
+
+        if (!entry->obj.list->set(idx, obj[2])) {
+            addReply(conn->outputBuffer(), shared.outofrangeerr);
+            return true;
         }
+    }
+
+    addReply(conn->outputBuffer(), shared.ok);
+    return true;
+}
 
-        it->runInLoop(std::bind(&Redis::forkWait, this));
+bool Redis::ltrimCommand(const std::deque <RedisObjectPtr> &obj,
+                         const SessionPtr &session, const TcpConnectionPtr &conn) {
+    if (obj.size() != 3) {
+        return false;
     }
 
-    if (threadCount > 1) {
-        std::unique_lock <std::mutex> lck(forkMutex);
-        while (forkCondWaitCount < threadCount) {
-            expireCondition.wait(lck);
+    int64_t start, end;
+    if ((getLongLongFromObjectOrReply(conn->outputBuffer(), obj[1], &start, nullptr) != REDIS_OK) ||
+        (getLongLongFromObjectOrReply(conn->outputBuffer(), obj[2], &end, nullptr) != REDIS_OK)) {
+        return true;
+    }
+
+    size_t hash = obj[0]->hash;
+    size_t index = hash % kShards;
+    auto &keySpace = redisShards[index].keySpace;
+    {
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        expireIfNeeded(redisShards[index], obj[0]);
+        auto entry = keySpace.find(obj[0]);
+        if (entry == nullptr) {
+            addReply(conn->outputBuffer(), shared.ok);
+            return true;
+        }
+
+        if (entry->type != OBJ_LIST) {
+            addReplyErrorFormat(conn->outputBuffer(),
+                                "WRONGTYPE Operation against a key holding the wrong kind of value");
+            return true;
+        }
+
+        auto &list = *entry->obj.list;
+        int64_t size = list.size();
+        if (start < 0) {
+            start = size + start;
+        }
+
+        if (end < 0) {
+            end = size + end;
+        }
+
+        if (start < 0) {
+            start = 0;
+        }
+
+        /* Elements to drop from the head and from the tail. */
+        int64_t ltrim, rtrim;
+        if (start > end || start >= size) {
+            ltrim = size;
+            rtrim = 0;
+        } else {
+            if (end >= size) {
+                end = size - 1;
+            }
+            ltrim = start;
+            rtrim = size - end - 1;
+        }
+
+        if (ltrim > 0) {
+            list.erase(0, ltrim);
+        }
+
+        if (rtrim > 0) {
+            list.erase(list.size() - rtrim, rtrim);
+        }
+
+        if (list.size() == 0) {
+            keySpace.erase(entry);
         }
     }
 
-    repliEnabled = true;
-    forkCondWaitCount = 0;
-    conn->setMessageCallback(std::bind(&Replication::slaveCallback,
-                                       &repli, std::placeholders::_1, std::placeholders::_2));
+    addReply(conn->outputBuffer(), shared.ok);
+    return true;
+}
 
-#ifndef _WIN64
-    if (!bgsave(session, conn, true)) {
-        {
-            std::unique_lock <std::mutex> lck(slaveMutex);
-            repliTimers.erase(conn->getSockfd());
-            conn->getLoop()->cancelAfter(timer);
-            slaveConns.erase(conn->getSockfd());
+bool Redis::linsertCommand(const std::deque <RedisObjectPtr> &obj,
+                           const SessionPtr &session, const TcpConnectionPtr &conn) {
+    if (obj.size() != 4) {
+        return false;
+    }
+
+    bool after;
+    if (!strcasecmp(obj[1]->ptr, "after")) {
+        after = true;
+    } else if (!strcasecmp(obj[1]->ptr, "before")) {
+        after = false;
+    } else {
+        addReply(conn->outputBuffer(), shared.syntaxerr);
+        return true;
+    }
+
+    int64_t len;
+    size_t hash = obj[0]->hash;
+    size_t index = hash % kShards;
+    auto &keySpace = redisShards[index].keySpace;
+    {
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        expireIfNeeded(redisShards[index], obj[0]);
+        auto entry = keySpace.find(obj[0]);
+        if (entry == nullptr) {
+            addReply(conn->outputBuffer(), shared.czero);
+            return true;
         }
-        slavefd = -1;
-        conn->forceClose();
+
+        if (entry->type != OBJ_LIST) {
+            addReplyErrorFormat(conn->outputBuffer(),
+                                "WRONGTYPE Operation against a key holding the wrong kind of value");
+            return true;
+        }
+
+        auto &list = *entry->obj.list;
+        len = list.insert(obj[2], obj[3], after) ? int64_t(list.size()) : -1;
     }
-#endif
 
-    if (threadCount > 1) {
-        forkCondition.notify_all();
+    addReplyLongLong(conn->outputBuffer(), len);
+    return true;
+}
+
+bool
+Redis::syncCommand(const std::deque <RedisObjectPtr> &obj, const SessionPtr &session, const TcpConnectionPtr &conn) {
+    if (obj.size() > 0) {
+        return false;
     }
+
+    syncSlave(conn, nullptr, 0);
     return true;
 }
 
 bool
 Redis::psyncCommand(const std::deque <RedisObjectPtr> &obj, const SessionPtr &session, const TcpConnectionPtr &conn) {
-    return false;
+    if (obj.size() != 2) {
+        return false;
+    }
+
+    char *end;
+    int64_t offset = strtoll(obj[1]->ptr, &end, 10);
+    if (*end != '\0') {
+        addReplyError(conn->outputBuffer(), "value is not an integer or out of range");
+        return true;
+    }
+
+    syncSlave(conn, obj[0]->ptr, offset);
+    return true;
 }
 
-int64_t Redis::getExpire(const RedisObjectPtr &obj) {
-    std::unique_lock <std::mutex> lck(expireMutex);
-    auto it = expireTimers.find(obj);
-    if (it == expireTimers.end()) {
-        return -1;
+/* A slave that cannot continue from the backlog waits for the next
+ * replication snapshot, the snapshot is cut at an offset of the stream
+ * and once the slave loaded it, it gets the stream from that offset on. */
+void Redis::syncSlave(const TcpConnectionPtr &conn, const char *replid, int64_t offset) {
+    {
+        std::unique_lock <std::mutex> lck(slaveMutex);
+        if (repliTimers.find(conn->getSockfd()) != repliTimers.end() ||
+            slaveConns.find(conn->getSockfd()) != slaveConns.end()) {
+            LOG_WARN << "client repeat send sync ";
+            conn->forceClose();
+            return;
+        }
+
+        if (replid != nullptr && repli.tryPartialResync(conn, replid, offset)) {
+            return;
+        }
+
+        std::weak_ptr <TcpConnection> weakConn(conn);
+        TimerPtr timer = conn->getLoop()->runAfter(REPLI_TIME_OUT,
+                                                   false, std::bind(&Redis::slaveRepliTimeOut, this, weakConn));
+        repliTimers.insert(std::make_pair(conn->getSockfd(), timer));
+        repli.addSyncSlave(conn, replid != nullptr);
+    }
+
+    conn->setMessageCallback(std::bind(&Replication::slaveCallback,
+                                       &repli, std::placeholders::_1, std::placeholders::_2));
+
+    /* Otherwise serverCron starts it once the running one is done. */
+    if (!rdbSaveInProgress()) {
+        rdb.rdbSaveSnapshotBackground(REDIS_DEFAULT_RDB_FILENGTHAME, RDB_SAVE_REPLICATION);
     }
+}
 
-    assert(it->first->type == OBJ_EXPIRE);
-    return it->second->getWhen();
+int64_t Redis::getExpire(const RedisObjectPtr &obj) {
+    size_t index = obj->hash % kShards;
+    std::unique_lock <std::mutex> lck = lockShard(index);
+    return redisShards[index].expireWheel.get(obj);
 }
 
 size_t Redis::getExpireSize() {
-    std::unique_lock <std::mutex> lck(expireMutex);
-    return expireTimers.size();
+    size_t size = 0;
+    for (auto &it : redisShards) {
+        std::unique_lock <std::mutex> lck(it.mtx);
+        size += it.expireWheel.size();
+    }
+    return size;
 }
 
 size_t Redis::getDbsize() {
@@ -1518,8 +2472,7 @@ size_t Redis::getDbsize() {
 
     for (auto &it : redisShards) {
         std::unique_lock <std::mutex> lck(it.mtx);
-        auto &map = it.redisMap;
-        size += map.size();
+        size += it.keySpace.size();
     }
     return size;
 }
@@ -1534,72 +2487,53 @@ Redis::dbsizeCommand(const std::deque <RedisObjectPtr> &obj, const SessionPtr &s
     return true;
 }
 
-bool Redis::removeCommand(const RedisObjectPtr &obj) {
+bool Redis::removeCommand(const RedisObjectPtr &obj, bool lazy) {
     size_t hash = obj->hash;
     int32_t index = hash % kShards;
-    auto &map = redisShards[index].redisMap;
-    auto &mu = redisShards[index].mtx;
-    auto &stringMap = redisShards[index].stringMap;
-    auto &hashMap = redisShards[index].hashMap;
-    auto &listMap = redisShards[index].listMap;
-    auto &zsetMap = redisShards[index].zsetMap;
-    auto &setMap = redisShards[index].setMap;
-    {
-        std::unique_lock <std::mutex> lck(mu);
-        auto it = map.find(obj);
-        if (it != map.end()) {
-            if ((*it)->type == OBJ_STRING) {
-                auto iter = stringMap.find(obj);
-                assert(iter != stringMap.end());
-                assert(iter->first->type == OBJ_STRING);
-                std::unique_lock <std::mutex> lck(expireMutex);
-                auto iterr = expireTimers.find(obj);
-                if (iterr != expireTimers.end()) {
-                    loop.cancelAfter(iterr->second);
-                    expireTimers.erase(iterr);
-                }
-                stringMap.erase(iter);
-            } else if ((*it)->type == OBJ_HASH) {
-                auto iter = hashMap.find(obj);
-                assert(iter != hashMap.end());
-                assert(iter->first->type == OBJ_HASH);
-                hashMap.erase(iter);
-            } else if ((*it)->type == OBJ_LIST) {
-                auto iter = listMap.find(obj);
-                assert(iter != listMap.end());
-                assert(iter->first->type == OBJ_LIST);
-                listMap.erase(iter);
-            } else if ((*it)->type == OBJ_ZSET) {
-                auto iter = zsetMap.find(obj);
-                assert(iter != zsetMap.end());
-                assert(iter->first->type == OBJ_ZSET);
-                assert(iter->second.first.size() == iter->second.second.size());
-                zsetMap.erase(iter);
-            } else if ((*it)->type == OBJ_SET) {
-                auto iter = setMap.find(obj);
-                assert(iter != setMap.end());
-                assert(iter->first->type == OBJ_SET);
-                setMap.erase(iter);
-            } else {
-                assert(false);
-            }
+    std::unique_lock <std::mutex> lck = lockShard(index);
+    return removeKey(redisShards[index], obj, lazy);
+}
 
-            map.erase(it);
-            return true;
-        }
+bool Redis::removeKey(RedisMapLock &shard, const RedisObjectPtr &obj, bool lazy) {
+    /* Called with the shard mutex held. Expired keys are removed by readers
+     * and the expire cycle too, which write commands do not cover. */
+    if (rdb.isSnapshotRunning()) {
+        rdb.rdbSnapshotKey(&shard - redisShards.data(), obj->ptr, sdslen(obj->ptr), obj->hash);
     }
-    return false;
+
+    KeyEntry *entry = shard.keySpace.find(obj);
+    if (entry == nullptr) {
+        return false;
+    }
+
+    if (lazy) {
+        lazyfree.freeValueAsync(*entry);
+    }
+
+    shard.keySpace.erase(entry);
+    shard.expireWheel.remove(obj);
+    return true;
 }
 
 bool Redis::delCommand(const std::deque <RedisObjectPtr> &obj,
                        const SessionPtr &session, const TcpConnectionPtr &conn) {
+    return delGenericCommand(obj, conn, false);
+}
+
+bool Redis::unlinkCommand(const std::deque <RedisObjectPtr> &obj,
+                          const SessionPtr &session, const TcpConnectionPtr &conn) {
+    return delGenericCommand(obj, conn, true);
+}
+
+bool Redis::delGenericCommand(const std::deque <RedisObjectPtr> &obj,
+                              const TcpConnectionPtr &conn, bool lazy) {
     if (obj.size() < 1) {
         return false;
     }
 
     size_t count = 0;
     for (auto &it : obj) {
-        if (removeCommand(it)) {
+        if (removeCommand(it, lazy)) {
             count++;
         }
     }
@@ -1618,6 +2552,33 @@ bool Redis::pingCommand(const std::deque <RedisObjectPtr> &obj,
     return true;
 }
 
+bool Redis::objectCommand(const std::deque <RedisObjectPtr> &obj,
+                          const SessionPtr &session, const TcpConnectionPtr &conn) {
+    if (obj.size() != 2) {
+        return false;
+    }
+
+    if (strcasecmp(obj[0]->ptr, "encoding")) {
+        addReplyErrorFormat(conn->outputBuffer(), "Unknown subcommand '%s'", obj[0]->ptr);
+        return true;
+    }
+
+    size_t hash = obj[1]->hash;
+    size_t index = hash % kShards;
+    auto &keySpace = redisShards[index].keySpace;
+    {
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        expireIfNeeded(redisShards[index], obj[1]);
+        auto entry = keySpace.find(obj[1]);
+        if (entry == nullptr) {
+            addReply(conn->outputBuffer(), shared.nullbulk);
+        } else {
+            addReplyBulkCString(conn->outputBuffer(), strEncoding(entry->getEncoding()));
+        }
+    }
+    return true;
+}
+
 bool Redis::debugCommand(const std::deque <RedisObjectPtr> &obj,
                          const SessionPtr &session, const TcpConnectionPtr &conn) {
     if (obj.size() == 1) {
@@ -1640,59 +2601,16 @@ bool Redis::debugCommand(const std::deque <RedisObjectPtr> &obj,
     return true;
 }
 
-void Redis::clearCommand() {
-    {
-        std::unique_lock <std::mutex> lck(expireMutex);
-        for (auto &it : expireTimers) {
-            assert(it.first->type == OBJ_EXPIRE);
-            loop.cancelAfter(it.second);
-        }
-        expireTimers.clear();
-    }
-
+void Redis::clearCommand(bool lazy) {
     for (auto &it : redisShards) {
         auto &mu = it.mtx;
-        auto &map = it.redisMap;
-        auto &stringMap = it.stringMap;
-        auto &hashMap = it.hashMap;
-        auto &listMap = it.listMap;
-        auto &zsetMap = it.zsetMap;
-        auto &setMap = it.setMap;
-
         std::unique_lock <std::mutex> lck(mu);
-        for (auto &iter : map) {
-            if (iter->type == OBJ_STRING) {
-                auto iterr = stringMap.find(iter);
-                assert(iterr != stringMap.end());
-                assert(iterr->first->type == OBJ_STRING);
-                stringMap.erase(iterr);
-            } else if (iter->type == OBJ_LIST) {
-                auto iterr = listMap.find(iter);
-                assert(iterr != listMap.end());
-                assert(iterr->first->type == OBJ_LIST);
-                listMap.erase(iterr);
-            } else if (iter->type == OBJ_HASH) {
-                auto iterr = hashMap.find(iter);
-                assert(iterr != hashMap.end());
-                assert(iterr->first->type == OBJ_HASH);
-                hashMap.erase(iterr);
-            } else if (iter->type == OBJ_ZSET) {
-                auto iterr = zsetMap.find(iter);
-                assert(iterr != zsetMap.end());
-                assert(iterr->first->type == OBJ_ZSET);
-                assert(iterr->second.first.size() == iterr->second.second.size());
-                zsetMap.erase(iterr);
-            } else if (iter->type == OBJ_SET) {
-                auto iterr = setMap.find(iter);
-                assert(iterr != setMap.end());
-                assert(iterr->first->type == OBJ_SET);
-                setMap.erase(iterr);
-            } else {
-                LOG_WARN << "type unkown:" << iter->type;
-                assert(false);
-            }
+        if (lazy) {
+            lazyfree.freeShardAsync(it.keySpace, it.expireWheel);
+        } else {
+            it.keySpace.clear();
+            it.expireWheel.clear();
         }
-        map.clear();
     }
 }
 
@@ -1711,52 +2629,251 @@ bool Redis::keysCommand(const std::deque <RedisObjectPtr> &obj,
     {
         for (auto &it : redisShards) {
             auto &mu = it.mtx;
-            auto &map = it.redisMap;
-            auto &stringMap = it.stringMap;
-            auto &hashMap = it.hashMap;
-            auto &listMap = it.listMap;
-            auto &zsetMap = it.zsetMap;
-            auto &setMap = it.setMap;
             std::unique_lock <std::mutex> lck(mu);
-            for (auto &iter : map) {
-                if (iter->type == OBJ_STRING) {
-                    auto iterr = stringMap.find(iter);
-                    assert(iterr != stringMap.end());
-                } else if (iter->type == OBJ_LIST) {
-                    auto iterr = listMap.find(iter);
-                    assert(iterr != listMap.end());
-                } else if (iter->type == OBJ_SET) {
-                    auto iterr = setMap.find(iter);
-                    assert(iterr != setMap.end());
-                } else if (iter->type == OBJ_ZSET) {
-                    auto iterr = zsetMap.find(iter);
-                    assert(iterr != zsetMap.end());
-                } else if (iter->type == OBJ_HASH) {
-                    auto iterr = hashMap.find(iter);
-                    assert(iterr != hashMap.end());
-                } else {
-                    assert(false);
+            for (auto &iter : it.keySpace) {
+                if (allkeys || stringmatchlen(pattern, plen, iter.getKey(), iter.getKeyLen(), 0)) {
+                    addReplyBulkCBuffer(conn->outputBuffer(), iter.getKey(), iter.getKeyLen());
+                    numkeys++;
+                }
+            }
+        }
+    }
+
+    prePendReplyLongLongWithPrefix(conn->outputBuffer(), numkeys);
+    return true;
+}
+
+bool Redis::parseScanOptions(const std::deque <RedisObjectPtr> &obj, size_t pos,
+                             bool allowType, ScanOptions *options, Buffer *buffer) {
+    const char *s = obj[pos]->ptr;
+    char *eptr;
+    errno = 0;
+    options->cursor = strtoull(s, &eptr, 10);
+    if (!isdigit(s[0]) || eptr[0] != '\0' || errno == ERANGE) {
+        addReplyError(buffer, "invalid cursor");
+        return false;
+    }
+
+    options->count = 10;
+    options->pattern = nullptr;
+    options->type = -1;
+    for (pos++; pos < obj.size(); pos += 2) {
+        if (pos + 1 >= obj.size()) {
+            addReply(buffer, shared.syntaxerr);
+            return false;
+        }
+
+        const RedisObjectPtr &value = obj[pos + 1];
+        if (!strcasecmp(obj[pos]->ptr, "count")) {
+            if (getLongLongFromObjectOrReply(buffer, value, &options->count, nullptr) != REDIS_OK) {
+                return false;
+            }
+
+            if (options->count < 1) {
+                addReply(buffer, shared.syntaxerr);
+                return false;
+            }
+        } else if (!strcasecmp(obj[pos]->ptr, "match")) {
+            options->pattern = value->ptr;
+        } else if (!strcasecmp(obj[pos]->ptr, "type") && allowType) {
+            for (int32_t type = OBJ_STRING; type <= OBJ_HASH; type++) {
+                if (!strcasecmp(value->ptr, strType(type))) {
+                    options->type = type;
+                }
+            }
+
+            if (options->type < 0) {
+                addReplyErrorFormat(buffer, "unknown type name '%s'", value->ptr);
+                return false;
+            }
+        } else {
+            addReply(buffer, shared.syntaxerr);
+            return false;
+        }
+    }
+    return true;
+}
+
+void Redis::addReplyScan(Buffer *buffer, uint64_t cursor, size_t count, Buffer *elements) {
+    char buf[32];
+    int32_t len = snprintf(buf, sizeof(buf), "%" PRIu64, cursor);
+    addReplyMultiBulkLen(buffer, 2);
+    addReplyBulkCBuffer(buffer, buf, len);
+    addReplyMultiBulkLen(buffer, count);
+    buffer->appendBuffer(elements);
+}
+
+bool Redis::scanCommand(const std::deque <RedisObjectPtr> &obj,
+                        const SessionPtr &session, const TcpConnectionPtr &conn) {
+    if (obj.size() < 1) {
+        return false;
+    }
+
+    ScanOptions options;
+    if (!parseScanOptions(obj, 0, true, &options, conn->outputBuffer())) {
+        return true;
+    }
+
+    /* The low bits of the cursor name the shard, the high bits are the
+     * cursor of its keyspace, see KeySpace::scan(). Unlike KEYS a call
+     * looks at 'count' keys or ten times as many slots at most and holds
+     * one shard mutex at a time, so it never stalls the shards for long. */
+    size_t index = options.cursor % kShards;
+    uint64_t cursor = options.cursor / kShards;
+    int32_t plen = options.pattern ? sdslen(options.pattern) : 0;
+    bool allkeys = options.pattern == nullptr || (plen == 1 && options.pattern[0] == '*');
+    int64_t visited = 0;
+    int64_t slots = options.count * 10;
+    std::vector <RedisObjectPtr> keys;
+
+    while (index < kShards && visited < options.count && slots > 0) {
+        auto &shard = redisShards[index];
+        std::unique_lock <std::mutex> lck(shard.mtx);
+        size_t start = keys.size();
+        do {
+            cursor = shard.keySpace.scan(cursor, [&](KeyEntry &entry) {
+                visited++;
+                if ((options.type < 0 || entry.type == options.type) &&
+                    (allkeys || stringmatchlen(options.pattern, plen,
+                                               entry.getKey(), entry.getKeyLen(), 0))) {
+                    keys.push_back(createStringObject((char *) entry.getKey(), entry.getKeyLen()));
                 }
+            });
+            slots--;
+        } while (cursor != 0 && visited < options.count && slots > 0);
+
+        /* Expiring has to wait for the walk, it moves entries around. */
+        if (shard.expireWheel.size() > 0) {
+            keys.erase(std::remove_if(keys.begin() + start, keys.end(),
+                                      [&](const RedisObjectPtr &key) {
+                                          return expireIfNeeded(shard, key);
+                                      }), keys.end());
+        }
+
+        if (cursor == 0) {
+            index++;
+        }
+    }
+
+    Buffer elements;
+    for (auto &it : keys) {
+        addReplyBulk(&elements, it);
+    }
+
+    addReplyScan(conn->outputBuffer(), index < kShards ? cursor * kShards + index : 0,
+                 keys.size(), &elements);
+    return true;
+}
+
+bool Redis::sscanCommand(const std::deque <RedisObjectPtr> &obj,
+                         const SessionPtr &session, const TcpConnectionPtr &conn) {
+    return scanGenericCommand(obj, session, conn, OBJ_SET);
+}
+
+bool Redis::hscanCommand(const std::deque <RedisObjectPtr> &obj,
+                         const SessionPtr &session, const TcpConnectionPtr &conn) {
+    return scanGenericCommand(obj, session, conn, OBJ_HASH);
+}
+
+bool Redis::zscanCommand(const std::deque <RedisObjectPtr> &obj,
+                         const SessionPtr &session, const TcpConnectionPtr &conn) {
+    return scanGenericCommand(obj, session, conn, OBJ_ZSET);
+}
+
+bool Redis::scanGenericCommand(const std::deque <RedisObjectPtr> &obj,
+                               const SessionPtr &session, const TcpConnectionPtr &conn, int32_t type) {
+    if (obj.size() < 2) {
+        return false;
+    }
+
+    ScanOptions options;
+    if (!parseScanOptions(obj, 1, false, &options, conn->outputBuffer())) {
+        return true;
+    }
+
+    int32_t plen = options.pattern ? sdslen(options.pattern) : 0;
+    auto match = [&](const std::string_view &s) {
+        return options.pattern == nullptr ||
+               stringmatchlen(options.pattern, plen, s.data(), s.size(), 0);
+    };
+
+    size_t hash = obj[0]->hash;
+    size_t index = hash % kShards;
+    auto &keySpace = redisShards[index].keySpace;
+    Buffer elements;
+    size_t count = 0;
+    uint64_t cursor = 0;
+    {
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        expireIfNeeded(redisShards[index], obj[0]);
+        auto entry = keySpace.find(obj[0]);
+        if (entry == nullptr) {
+            addReply(conn->outputBuffer(), shared.emptyscan);
+            return true;
+        }
 
-                if (allkeys || stringmatchlen(pattern, plen, iter->ptr, sdslen(iter->ptr), 0)) {
-                    addReplyBulkCBuffer(conn->outputBuffer(), iter->ptr, sdslen(iter->ptr));
-                    numkeys++;
-                }
-            }
+        if (entry->type != type) {
+            addReplyErrorFormat(conn->outputBuffer(),
+                                "WRONGTYPE Operation against a key holding the wrong kind of value");
+            return true;
+        }
+
+        switch (type) {
+            case OBJ_SET:
+                cursor = entry->obj.set->scan(options.cursor, options.count,
+                                              [&](const std::string_view &member) {
+                    if (match(member)) {
+                        addReplyBulkCBuffer(&elements, member.data(), member.size());
+                        count++;
+                    }
+                });
+                break;
+            case OBJ_HASH:
+                cursor = entry->obj.hash->scan(options.cursor, options.count,
+                                               [&](const std::string_view &field, const std::string_view &value) {
+                    if (match(field)) {
+                        addReplyBulkCBuffer(&elements, field.data(), field.size());
+                        addReplyBulkCBuffer(&elements, value.data(), value.size());
+                        count += 2;
+                    }
+                });
+                break;
+            case OBJ_ZSET:
+                cursor = entry->obj.zset->scan(options.cursor, options.count,
+                                               [&](const std::string_view &member, double score) {
+                    if (match(member)) {
+                        addReplyBulkCBuffer(&elements, member.data(), member.size());
+                        addReplyDouble(&elements, score);
+                        count += 2;
+                    }
+                });
+                break;
+            default:
+                break;
         }
     }
 
-    prePendReplyLongLongWithPrefix(conn->outputBuffer(), numkeys);
+    addReplyScan(conn->outputBuffer(), cursor, count, &elements);
     return true;
 }
 
 bool Redis::flushdbCommand(const std::deque <RedisObjectPtr> &obj,
                            const SessionPtr &session, const TcpConnectionPtr &conn) {
-    if (obj.size() > 0) {
+    if (obj.size() > 1) {
         return false;
     }
 
-    clearCommand();
+    bool lazy = false;
+    if (obj.size() == 1) {
+        if (!strcasecmp(obj[0]->ptr, "async")) {
+            lazy = true;
+        } else if (strcasecmp(obj[0]->ptr, "sync")) {
+            addReply(conn->outputBuffer(), shared.syntaxerr);
+            return true;
+        }
+    }
+
+    clearCommand(lazy);
     addReply(conn->outputBuffer(), shared.ok);
     return true;
 }
@@ -1769,130 +2886,170 @@ bool Redis::quitCommand(const std::deque <RedisObjectPtr> &obj,
 
 bool Redis::zaddCommand(const std::deque <RedisObjectPtr> &obj,
                         const SessionPtr &session, const TcpConnectionPtr &conn) {
-    if (obj.size() < 3) {
+    if (obj.size() < 3 || (obj.size() - 1) % 2 != 0) {
         return false;
     }
 
-    obj[0]->type = OBJ_ZSET;
-
     double scores = 0;
     size_t added = 0;
 
+    for (int i = 1; i < obj.size(); i += 2) {
+        if (getDoubleFromObjectOrReply(conn->outputBuffer(),
+                                       obj[i], &scores, nullptr) != REDIS_OK) {
+            return true;
+        }
+    }
+
     size_t hash = obj[0]->hash;
     size_t index = hash % kShards;
-    auto &mu = redisShards[index].mtx;
-    auto &map = redisShards[index].redisMap;
-    auto &zsetMap = redisShards[index].zsetMap;
+    auto &keySpace = redisShards[index].keySpace;
     {
-        std::unique_lock <std::mutex> lck(mu);
-        auto it = map.find(obj[0]);
-        if (it == map.end()) {
-            {
-                auto iter = zsetMap.find(obj[0]);
-                assert(iter == zsetMap.end());
-            }
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        expireIfNeeded(redisShards[index], obj[0]);
+        auto entry = keySpace.find(obj[0]);
+        if (entry == nullptr) {
+            entry = keySpace.insert(obj[0], OBJ_ZSET);
+        } else if (entry->type != OBJ_ZSET) {
+            addReplyErrorFormat(conn->outputBuffer(),
+                                "WRONGTYPE Operation against a key holding the wrong kind of value");
+            return true;
+        }
 
-            if (getDoubleFromObjectOrReply(conn->outputBuffer(),
-                                           obj[1], &scores, nullptr) != REDIS_OK) {
-                return false;
+        auto &zset = *entry->obj.zset;
+        for (int i = 1; i < obj.size(); i += 2) {
+            getDoubleFromObject(obj[i], &scores);
+            if (zset.add(obj[i + 1]->ptr, sdslen(obj[i + 1]->ptr), scores)) {
+                added++;
             }
+        }
+        addReplyLongLong(conn->outputBuffer(), added);
+    }
+    return true;
+}
 
-            obj[2]->type = OBJ_ZSET;
-
-            SortIndexMap indexMap;
-            SortMap sortMap;
-
-            indexMap.insert(std::make_pair(obj[2], scores));
-            sortMap.insert(std::make_pair(scores, obj[2]));
+bool Redis::zremCommand(const std::deque <RedisObjectPtr> &obj,
+                        const SessionPtr &session, const TcpConnectionPtr &conn) {
+    if (obj.size() < 2) {
+        return false;
+    }
 
-            added++;
+    size_t removed = 0;
+    size_t hash = obj[0]->hash;
+    size_t index = hash % kShards;
+    auto &keySpace = redisShards[index].keySpace;
+    {
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        expireIfNeeded(redisShards[index], obj[0]);
+        auto entry = keySpace.find(obj[0]);
+        if (entry != nullptr) {
+            if (entry->type != OBJ_ZSET) {
+                addReplyErrorFormat(conn->outputBuffer(),
+                                    "WRONGTYPE Operation against a key holding the wrong kind of value");
+                return true;
+            }
 
-            for (int i = 3; i < obj.size(); i += 2) {
-                obj[i + 1]->type = OBJ_ZSET;
-                if (getDoubleFromObjectOrReply(conn->outputBuffer(),
-                                               obj[1], &scores, nullptr) != REDIS_OK) {
-                    return false;
+            auto &zset = *entry->obj.zset;
+            for (int i = 1; i < obj.size(); i++) {
+                if (zset.remove(obj[i]->ptr, sdslen(obj[i]->ptr))) {
+                    removed++;
                 }
+            }
 
-                auto iter = indexMap.find(obj[i + 1]);
-                if (iter == indexMap.end()) {
-                    indexMap.insert(std::make_pair(obj[i + 1], scores));
-                    sortMap.insert(std::make_pair(scores, obj[i + 1]));
-                    added++;
-                } else {
-                    if (scores != iter->second) {
-                        bool mark = false;
-                        auto iterr = sortMap.find(iter->second);
-                        while (iterr != sortMap.end()) {
-                            if (!memcmp(iterr->second->ptr,
-                                        obj[i + 1]->ptr, sdslen(obj[i + 1]->ptr))) {
-                                const RedisObjectPtr &v = iterr->second;
-                                sortMap.erase(iterr);
-                                sortMap.insert(std::make_pair(scores, v));
-                                mark = true;
-                                break;
-                            }
-                            ++it;
-                        }
-
-                        assert(mark);
-                        iter->second = scores;
-                        added++;
-                    }
-                }
+            if (zset.size() == 0) {
+                keySpace.erase(entry);
             }
+        }
+    }
+
+    addReplyLongLong(conn->outputBuffer(), removed);
+    return true;
+}
+
+bool Redis::zscoreCommand(const std::deque <RedisObjectPtr> &obj,
+                          const SessionPtr &session, const TcpConnectionPtr &conn) {
+    if (obj.size() != 2) {
+        return false;
+    }
+
+    size_t hash = obj[0]->hash;
+    size_t index = hash % kShards;
+    auto &keySpace = redisShards[index].keySpace;
+    {
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        expireIfNeeded(redisShards[index], obj[0]);
+        auto entry = keySpace.find(obj[0]);
+        if (entry == nullptr) {
+            addReply(conn->outputBuffer(), shared.nullbulk);
+            return true;
+        }
 
-            map.insert(obj[0]);
-            zsetMap.insert(std::make_pair(obj[0],
-                                          std::make_pair(std::move(indexMap), std::move(sortMap))));
-            addReplyLongLong(conn->outputBuffer(), added);
+        if (entry->type != OBJ_ZSET) {
+            addReplyErrorFormat(conn->outputBuffer(),
+                                "WRONGTYPE Operation against a key holding the wrong kind of value");
             return true;
+        }
+
+        double score;
+        if (entry->obj.zset->getScore(obj[1]->ptr, sdslen(obj[1]->ptr), &score)) {
+            addReplyDouble(conn->outputBuffer(), score);
         } else {
-            if ((*it)->type != OBJ_ZSET) {
+            addReply(conn->outputBuffer(), shared.nullbulk);
+        }
+    }
+    return true;
+}
+
+bool Redis::zrankCommand(const std::deque <RedisObjectPtr> &obj,
+                         const SessionPtr &session, const TcpConnectionPtr &conn) {
+    return zrankGenericCommand(obj, session, conn, 0);
+}
+
+bool Redis::zrevrankCommand(const std::deque <RedisObjectPtr> &obj,
+                            const SessionPtr &session, const TcpConnectionPtr &conn) {
+    return zrankGenericCommand(obj, session, conn, 1);
+}
+
+bool Redis::zrangebyscoreCommand(const std::deque <RedisObjectPtr> &obj,
+                                 const SessionPtr &session, const TcpConnectionPtr &conn) {
+    return zrangeByScoreGenericCommand(obj, session, conn, 0);
+}
+
+bool Redis::zrevrangebyscoreCommand(const std::deque <RedisObjectPtr> &obj,
+                                    const SessionPtr &session, const TcpConnectionPtr &conn) {
+    return zrangeByScoreGenericCommand(obj, session, conn, 1);
+}
+
+bool Redis::zcountCommand(const std::deque <RedisObjectPtr> &obj,
+                          const SessionPtr &session, const TcpConnectionPtr &conn) {
+    if (obj.size() != 3) {
+        return false;
+    }
+
+    ZRangeSpec range;
+    if (!Zset::parseRange(obj[1]->ptr, obj[2]->ptr, &range)) {
+        addReplyError(conn->outputBuffer(), "min or max is not a float");
+        return true;
+    }
+
+    size_t count = 0;
+    size_t hash = obj[0]->hash;
+    size_t index = hash % kShards;
+    auto &keySpace = redisShards[index].keySpace;
+    {
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        expireIfNeeded(redisShards[index], obj[0]);
+        auto entry = keySpace.find(obj[0]);
+        if (entry != nullptr) {
+            if (entry->type != OBJ_ZSET) {
                 addReplyErrorFormat(conn->outputBuffer(),
                                     "WRONGTYPE Operation against a key holding the wrong kind of value");
                 return true;
             }
-
-            auto iter = zsetMap.find(obj[0]);
-            assert(iter != zsetMap.end());
-            assert(iter->first->type == (*it)->type);
-            for (int i = 1; i < obj.size(); i += 2) {
-                obj[i + 1]->type = OBJ_ZSET;
-                if (getDoubleFromObjectOrReply(conn->outputBuffer(),
-                                               obj[i], &scores, nullptr) != REDIS_OK) {
-                    return false;
-                }
-
-                auto iterr = iter->second.first.find(obj[i + 1]);
-                if (iterr == iter->second.first.end()) {
-                    iter->second.first.insert(std::make_pair(obj[i + 1], scores));
-                    iter->second.second.insert(std::make_pair(scores, obj[i + 1]));
-                    added++;
-                } else {
-                    if (scores != iterr->second) {
-                        bool mark = false;
-                        auto iterrr = iter->second.second.find(iterr->second);
-                        while (iterrr != iter->second.second.end()) {
-                            if (!memcmp(iterrr->second->ptr, obj[i + 1]->ptr, sdslen(obj[i + 1]->ptr))) {
-                                const RedisObjectPtr &v = iterrr->second;
-                                iter->second.second.erase(iterrr);
-                                iter->second.second.insert(std::make_pair(scores, v));
-                                mark = true;
-                                break;
-                            }
-                            ++iterrr;
-                        }
-
-                        assert(mark);
-                        iterr->second = scores;
-                        added++;
-                    }
-                }
-            }
+            count = entry->obj.zset->count(range);
         }
-        addReplyLongLong(conn->outputBuffer(), added);
     }
+
+    addReplyLongLong(conn->outputBuffer(), count);
     return true;
 }
 
@@ -1910,26 +3067,18 @@ bool Redis::zcardCommand(const std::deque <RedisObjectPtr> &obj,
     size_t len = 0;
     size_t hash = obj[0]->hash;
     size_t index = hash % kShards;
-    auto &mu = redisShards[index].mtx;
-    auto &map = redisShards[index].redisMap;
-    auto &zsetMap = redisShards[index].zsetMap;
+    auto &keySpace = redisShards[index].keySpace;
     {
-        std::unique_lock <std::mutex> lck(mu);
-        auto it = map.find(obj[0]);
-        if (it != map.end()) {
-            if ((*it)->type != OBJ_ZSET) {
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        expireIfNeeded(redisShards[index], obj[0]);
+        auto entry = keySpace.find(obj[0]);
+        if (entry != nullptr) {
+            if (entry->type != OBJ_ZSET) {
                 addReplyErrorFormat(conn->outputBuffer(),
                                     "WRONGTYPE Operation against a key holding the wrong kind of value");
                 return true;
             }
-            auto iter = zsetMap.find(obj[0]);
-            assert(iter != zsetMap.end());
-            assert((*it)->type == iter->first->type);
-            assert(iter->second.second.size() == iter->second.first.size());
-            len += iter->second.second.size();
-        } else {
-            auto iter = zsetMap.find(obj[0]);
-            assert(iter == zsetMap.end());
+            len += entry->obj.zset->size();
         }
     }
 
@@ -1951,27 +3100,23 @@ bool Redis::scardCommand(const std::deque <RedisObjectPtr> &obj,
     size_t len = 0;
     size_t hash = obj[0]->hash;
     size_t index = hash % kShards;
-    auto &mu = redisShards[index].mtx;
-    auto &map = redisShards[index].redisMap;
-    auto &setMap = redisShards[index].setMap;
+    auto &keySpace = redisShards[index].keySpace;
     {
-        std::unique_lock <std::mutex> lck(mu);
-        auto it = map.find(obj[0]);
-        if (it != map.end()) {
-            if ((*it)->type != OBJ_SET) {
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        expireIfNeeded(redisShards[index], obj[0]);
+        auto entry = keySpace.find(obj[0]);
+        if (entry != nullptr) {
+            if (entry->type != OBJ_SET) {
                 addReplyErrorFormat(conn->outputBuffer(),
                                     "WRONGTYPE Operation against a key holding the wrong kind of value");
                 return true;
             }
 
-            auto iter = setMap.find(obj[0]);
-            assert(iter != setMap.end());
-            assert(iter->first->type == (*it)->type);
-            len = iter->second.size();
+            len = entry->obj.set->size();
         }
         addReplyLongLong(conn->outputBuffer(), len);
     }
-    return false;
+    return true;
 }
 
 RedisObjectPtr Redis::createDumpPayload(const RedisObjectPtr &dump) {
@@ -2014,16 +3159,18 @@ bool Redis::dumpCommand(const std::deque <RedisObjectPtr> &obj,
 
 bool Redis::restoreCommand(const std::deque <RedisObjectPtr> &obj,
                            const SessionPtr &session, const TcpConnectionPtr &conn) {
-    if (obj.size() < 3 || obj.size() > 4) {
+    if (obj.size() < 3 || obj.size() > 5) {
         return false;
     }
 
     int64_t ttl;
-    int type, replace = 0;
+    int type, replace = 0, absttl = 0;
 
     for (int i = 3; i < obj.size(); i++) {
         if (!strcmp(obj[i]->ptr, "replace")) {
             replace = 1;
+        } else if (!strcmp(obj[i]->ptr, "absttl")) {
+            absttl = 1;
         } else {
             addReply(conn->outputBuffer(), shared.syntaxerr);
             return true;
@@ -2031,12 +3178,11 @@ bool Redis::restoreCommand(const std::deque <RedisObjectPtr> &obj,
     }
     size_t hash = obj[0]->hash;
     size_t index = hash % kShards;
-    auto &mu = redisShards[index].mtx;
-    auto &map = redisShards[index].redisMap;
+    auto &keySpace = redisShards[index].keySpace;
     {
-        std::unique_lock <std::mutex> lck(mu);
-        auto it = map.find(obj[0]);
-        if (it == map.end() && !replace) {
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        expireIfNeeded(redisShards[index], obj[0]);
+        if (keySpace.find(obj[0]) != nullptr && !replace) {
             addReply(conn->outputBuffer(), shared.busykeyerr);
             return true;
         }
@@ -2085,14 +3231,7 @@ bool Redis::restoreCommand(const std::deque <RedisObjectPtr> &obj,
     }
 
     if (ttl > 0) {
-        RedisObjectPtr ex = createStringObject(obj[0]->ptr, sdslen(obj[0]->ptr));
-        ex->type = OBJ_EXPIRE;
-        std::unique_lock <std::mutex> lck(slaveMutex);
-        TimerPtr timer = loop.runAfter(ttl / 1000,
-                                       false, std::bind(&Redis::setExpireTimeOut, this, ex));
-        auto it = expireTimers.find(ex);
-        assert(it == expireTimers.end());
-        expireTimers.insert(std::make_pair(ex, timer));
+        setExpire(key, absttl ? ttl : mstime() + ttl);
     }
 
     addReply(conn->outputBuffer(), shared.ok);
@@ -2107,12 +3246,11 @@ bool Redis::existsCommand(const std::deque <RedisObjectPtr> &obj,
 
     size_t hash = obj[0]->hash;
     size_t index = hash % kShards;
-    auto &mu = redisShards[index].mtx;
-    auto &map = redisShards[index].redisMap;
+    auto &keySpace = redisShards[index].keySpace;
     {
-        std::unique_lock <std::mutex> lck(mu);
-        auto it = map.find(obj[0]);
-        if (it == map.end()) {
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        expireIfNeeded(redisShards[index], obj[0]);
+        if (keySpace.find(obj[0]) == nullptr) {
             addReplyLongLong(conn->outputBuffer(), 0);
         } else {
             addReplyLongLong(conn->outputBuffer(), 1);
@@ -2127,171 +3265,268 @@ bool Redis::saddCommand(const std::deque <RedisObjectPtr> &obj,
         return false;
     }
 
-    obj[0]->type = OBJ_SET;
-
     size_t len = 0;
     size_t hash = obj[0]->hash;
     size_t index = hash % kShards;
-    auto &mu = redisShards[index].mtx;
-    auto &map = redisShards[index].redisMap;
-    auto &setMap = redisShards[index].setMap;
+    auto &keySpace = redisShards[index].keySpace;
     {
-        std::unique_lock <std::mutex> lck(mu);
-        auto it = map.find(obj[0]);
-        if (it == map.end()) {
-            auto iter = setMap.find(obj[0]);
-            assert(iter == setMap.end());
-
-            std::unordered_set <RedisObjectPtr, Hash, Equal> set;
-            for (int i = 1; i < obj.size(); i++) {
-                obj[i]->type = OBJ_SET;
-                auto iterr = set.find(obj[i]);
-                if (iterr == set.end()) {
-                    set.insert(obj[i]);
-                    len++;
-                } else {
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        expireIfNeeded(redisShards[index], obj[0]);
+        auto entry = keySpace.find(obj[0]);
+        if (entry == nullptr) {
+            entry = keySpace.insert(obj[0], OBJ_SET);
+        } else if (entry->type != OBJ_SET) {
+            addReplyErrorFormat(conn->outputBuffer(),
+                                "WRONGTYPE Operation against a key holding the wrong kind of value");
+            return true;
+        }
 
-                }
-                setMap.insert(std::make_pair(obj[0], std::move(set)));
-                map.insert(obj[0]);
+        for (int i = 1; i < obj.size(); i++) {
+            if (entry->obj.set->add(obj[i])) {
+                len++;
             }
-        } else {
-            if ((*it)->type != OBJ_SET) {
+        }
+    }
+
+    addReplyLongLong(conn->outputBuffer(), len);
+    return true;
+}
+
+bool Redis::sismemberCommand(const std::deque <RedisObjectPtr> &obj,
+                             const SessionPtr &session, const TcpConnectionPtr &conn) {
+    if (obj.size() != 2) {
+        return false;
+    }
+
+    bool found = false;
+    size_t hash = obj[0]->hash;
+    size_t index = hash % kShards;
+    auto &keySpace = redisShards[index].keySpace;
+    {
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        expireIfNeeded(redisShards[index], obj[0]);
+        auto entry = keySpace.find(obj[0]);
+        if (entry != nullptr) {
+            if (entry->type != OBJ_SET) {
                 addReplyErrorFormat(conn->outputBuffer(),
                                     "WRONGTYPE Operation against a key holding the wrong kind of value");
                 return true;
             }
+            found = entry->obj.set->contains(obj[1]);
+        }
+    }
 
-            auto iter = setMap.find(obj[0]);
-            assert(iter != setMap.end());
-            assert(iter->first->type == (*it)->type);
+    addReply(conn->outputBuffer(), found ? shared.cone : shared.czero);
+    return true;
+}
 
-            for (int i = 1; i < obj.size(); i++) {
-                obj[i]->type = OBJ_SET;
-                auto iterr = iter->second.find(obj[i]);
-                if (iterr == iter->second.end()) {
-                    iter->second.insert(obj[i]);
-                    len++;
-                } else {
+bool Redis::smembersCommand(const std::deque <RedisObjectPtr> &obj,
+                            const SessionPtr &session, const TcpConnectionPtr &conn) {
+    if (obj.size() != 1) {
+        return false;
+    }
 
-                }
-            }
+    size_t hash = obj[0]->hash;
+    size_t index = hash % kShards;
+    auto &keySpace = redisShards[index].keySpace;
+    {
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        expireIfNeeded(redisShards[index], obj[0]);
+        auto entry = keySpace.find(obj[0]);
+        if (entry == nullptr) {
+            addReply(conn->outputBuffer(), shared.emptymultibulk);
+            return true;
         }
-    }
 
-    addReplyLongLong(conn->outputBuffer(), len);
+        if (entry->type != OBJ_SET) {
+            addReplyErrorFormat(conn->outputBuffer(),
+                                "WRONGTYPE Operation against a key holding the wrong kind of value");
+            return true;
+        }
+
+        Buffer *buffer = conn->outputBuffer();
+        addReplyMultiBulkLen(buffer, entry->obj.set->size());
+        entry->obj.set->forEach([&](const std::string_view &member) {
+            addReplyBulkCBuffer(buffer, member.data(), member.size());
+        });
+    }
     return true;
 }
 
 bool Redis::zrangeGenericCommand(const std::deque <RedisObjectPtr> &obj,
                                  const SessionPtr &session, const TcpConnectionPtr &conn, int reverse) {
-    if (obj.size() != 4) {
+    if (obj.size() != 3 && obj.size() != 4) {
         return false;
     }
 
-    int rangelen;
     int withscores = 0;
     int64_t start;
-
-    if (getLongLongFromObjectOrReply(conn->outputBuffer(),
-                                     obj[1], &start, nullptr) != REDIS_OK) {
-        addReplyError(conn->outputBuffer(), "unknown double param error");
-        return true;
-    }
-
     int64_t end;
 
-    if (getLongLongFromObjectOrReply(conn->outputBuffer(),
-                                     obj[2], &end, nullptr) != REDIS_OK) {
-        addReplyError(conn->outputBuffer(), "unknown double param error");
+    if (getLongLongFromObjectOrReply(conn->outputBuffer(), obj[1], &start, nullptr) != REDIS_OK ||
+        getLongLongFromObjectOrReply(conn->outputBuffer(), obj[2], &end, nullptr) != REDIS_OK) {
         return true;
     }
 
-    if (!strcmp(obj[3]->ptr, "withscores")) {
+    if (obj.size() == 4) {
+        if (strcasecmp(obj[3]->ptr, "withscores")) {
+            addReply(conn->outputBuffer(), shared.syntaxerr);
+            return true;
+        }
         withscores = 1;
-    } else if (obj.size() >= 5) {
-        addReply(conn->outputBuffer(), shared.syntaxerr);
-        return true;
     }
 
     size_t hash = obj[0]->hash;
     size_t index = hash % kShards;
-    auto &mu = redisShards[index].mtx;
-    auto &map = redisShards[index].redisMap;
-    auto &zsetMap = redisShards[index].zsetMap;
+    auto &keySpace = redisShards[index].keySpace;
     {
-        std::unique_lock <std::mutex> lck(mu);
-        auto it = map.find(obj[0]);
-        if (it == map.end()) {
-            auto iter = zsetMap.find(obj[0]);
-            assert(iter == zsetMap.end());
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        expireIfNeeded(redisShards[index], obj[0]);
+        auto entry = keySpace.find(obj[0]);
+        if (entry == nullptr) {
             addReply(conn->outputBuffer(), shared.emptymultibulk);
             return true;
-        } else {
-            if ((*it)->type != OBJ_ZSET) {
-                addReplyErrorFormat(conn->outputBuffer(),
-                                    "WRONGTYPE Operation against a key holding the wrong kind of value");
-                return true;
-            }
+        }
 
-            auto iter = zsetMap.find(obj[0]);
-            assert(iter != zsetMap.end());
-            assert(iter->second.second.size() == iter->second.first.size());
-            assert(iter->first->type == (*it)->type);
+        if (entry->type != OBJ_ZSET) {
+            addReplyErrorFormat(conn->outputBuffer(),
+                                "WRONGTYPE Operation against a key holding the wrong kind of value");
+            return true;
+        }
 
-            size_t llen = iter->second.second.size();
+        auto &zset = *entry->obj.zset;
+        int64_t llen = zset.size();
 
-            if (start < 0) start = llen + start;
-            if (end < 0) end = llen + end;
-            if (start < 0) start = 0;
+        if (start < 0) start = llen + start;
+        if (end < 0) end = llen + end;
+        if (start < 0) start = 0;
 
-            if (start > end || start >= llen) {
-                addReply(conn->outputBuffer(), shared.emptymultibulk);
-                return true;
+        if (start > end || start >= llen) {
+            addReply(conn->outputBuffer(), shared.emptymultibulk);
+            return true;
+        }
+
+        if (end >= llen) {
+            end = llen - 1;
+        }
+
+        int64_t rangelen = (end - start) + 1;
+        Buffer *buffer = conn->outputBuffer();
+        addReplyMultiBulkLen(buffer, withscores ? (rangelen * 2) : rangelen);
+        zset.range(start, end, reverse, [&](const std::string_view &ele, double score) {
+            addReplyBulkCBuffer(buffer, ele.data(), ele.size());
+            if (withscores) {
+                addReplyDouble(buffer, score);
             }
+        });
+    }
+    return true;
+}
+
+bool Redis::zrankGenericCommand(const std::deque <RedisObjectPtr> &obj,
+                                const SessionPtr &session, const TcpConnectionPtr &conn, int reverse) {
+    if (obj.size() != 2) {
+        return false;
+    }
+
+    size_t hash = obj[0]->hash;
+    size_t index = hash % kShards;
+    auto &keySpace = redisShards[index].keySpace;
+    {
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        expireIfNeeded(redisShards[index], obj[0]);
+        auto entry = keySpace.find(obj[0]);
+        if (entry == nullptr) {
+            addReply(conn->outputBuffer(), shared.nullbulk);
+            return true;
+        }
+
+        if (entry->type != OBJ_ZSET) {
+            addReplyErrorFormat(conn->outputBuffer(),
+                                "WRONGTYPE Operation against a key holding the wrong kind of value");
+            return true;
+        }
+
+        int64_t rank = entry->obj.zset->getRank(obj[1]->ptr, sdslen(obj[1]->ptr), reverse);
+        if (rank >= 0) {
+            addReplyLongLong(conn->outputBuffer(), rank);
+        } else {
+            addReply(conn->outputBuffer(), shared.nullbulk);
+        }
+    }
+    return true;
+}
+
+bool Redis::zrangeByScoreGenericCommand(const std::deque <RedisObjectPtr> &obj,
+                                        const SessionPtr &session, const TcpConnectionPtr &conn, int reverse) {
+    if (obj.size() < 3) {
+        return false;
+    }
+
+    /* ZREVRANGEBYSCORE takes the bounds as max then min. */
+    ZRangeSpec range;
+    const RedisObjectPtr &minobj = reverse ? obj[2] : obj[1];
+    const RedisObjectPtr &maxobj = reverse ? obj[1] : obj[2];
+    if (!Zset::parseRange(minobj->ptr, maxobj->ptr, &range)) {
+        addReplyError(conn->outputBuffer(), "min or max is not a float");
+        return true;
+    }
 
-            if (end >= llen) {
-                end = llen - 1;
+    int withscores = 0;
+    int64_t offset = 0;
+    int64_t limit = -1;
+    for (int i = 3; i < obj.size(); i++) {
+        if (!strcasecmp(obj[i]->ptr, "withscores")) {
+            withscores = 1;
+        } else if (!strcasecmp(obj[i]->ptr, "limit") && i + 2 < obj.size()) {
+            if (getLongLongFromObjectOrReply(conn->outputBuffer(), obj[i + 1], &offset, nullptr) != REDIS_OK ||
+                getLongLongFromObjectOrReply(conn->outputBuffer(), obj[i + 2], &limit, nullptr) != REDIS_OK) {
+                return true;
             }
+            i += 2;
+        } else {
+            addReply(conn->outputBuffer(), shared.syntaxerr);
+            return true;
+        }
+    }
 
-            rangelen = (end - start) + 1;
-            end = rangelen;
-            addReplyMultiBulkLen(conn->outputBuffer(), withscores ? (rangelen * 2) : rangelen);
+    size_t hash = obj[0]->hash;
+    size_t index = hash % kShards;
+    auto &keySpace = redisShards[index].keySpace;
+    {
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        expireIfNeeded(redisShards[index], obj[0]);
+        auto entry = keySpace.find(obj[0]);
+        if (entry == nullptr || offset < 0) {
+            addReply(conn->outputBuffer(), shared.emptymultibulk);
+            return true;
+        }
 
-            if (reverse) {
-                int count = 0;
-                for (auto iterr = iter->second.second.rbegin();
-                     iterr != iter->second.second.rend(); ++iterr) {
-                    if (count++ >= start) {
-                        addReplyBulkCBuffer(conn->outputBuffer(),
-                                            iterr->second->ptr, sdslen(iterr->second->ptr));
-                        if (withscores) {
-                            addReplyDouble(conn->outputBuffer(), iterr->first);
-                        }
-                    }
+        if (entry->type != OBJ_ZSET) {
+            addReplyErrorFormat(conn->outputBuffer(),
+                                "WRONGTYPE Operation against a key holding the wrong kind of value");
+            return true;
+        }
 
-                    if (count >= end) {
-                        break;
-                    }
-                }
-            } else {
-                int count = 0;
-                for (auto iterr = iter->second.second.begin();
-                     iterr != iter->second.second.end(); ++iterr) {
-                    if (count++ >= start) {
-                        addReplyBulkCBuffer(conn->outputBuffer(),
-                                            iterr->second->ptr, sdslen(iterr->second->ptr));
-                        if (withscores) {
-                            addReplyDouble(conn->outputBuffer(), iterr->first);
-                        }
-                    }
+        /* The reply length goes first, counting the range is two rank
+         * lookups so there is no need to buffer the elements. */
+        auto &zset = *entry->obj.zset;
+        int64_t rangelen = int64_t(zset.count(range)) - offset;
+        if (rangelen < 0) rangelen = 0;
+        if (limit >= 0 && rangelen > limit) rangelen = limit;
+        if (rangelen == 0) {
+            addReply(conn->outputBuffer(), shared.emptymultibulk);
+            return true;
+        }
 
-                    if (count >= end) {
-                        break;
-                    }
-                }
+        Buffer *buffer = conn->outputBuffer();
+        addReplyMultiBulkLen(buffer, withscores ? (rangelen * 2) : rangelen);
+        zset.rangeByScore(range, reverse, offset, rangelen, [&](const std::string_view &ele, double score) {
+            addReplyBulkCBuffer(buffer, ele.data(), ele.size());
+            if (withscores) {
+                addReplyDouble(buffer, score);
             }
-        }
+        });
     }
     return true;
 }
@@ -2305,33 +3540,27 @@ bool Redis::hgetallCommand(const std::deque <RedisObjectPtr> &obj,
 
     size_t hash = obj[0]->hash;
     size_t index = hash % kShards;
-    auto &mu = redisShards[index].mtx;
-    auto &map = redisShards[index].redisMap;
-    auto &hashMap = redisShards[index].hashMap;
+    auto &keySpace = redisShards[index].keySpace;
     {
-        std::unique_lock <std::mutex> lck(mu);
-        auto it = map.find(obj[0]);
-        if (it == map.end()) {
-            auto iter = hashMap.find(obj[0]);
-            assert(iter == hashMap.end());
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        expireIfNeeded(redisShards[index], obj[0]);
+        auto entry = keySpace.find(obj[0]);
+        if (entry == nullptr) {
             addReply(conn->outputBuffer(), shared.emptymultibulk);
         } else {
-            if ((*it)->type != OBJ_HASH) {
+            if (entry->type != OBJ_HASH) {
                 addReplyErrorFormat(conn->outputBuffer(),
                                     "WRONGTYPE Operation against a key holding the wrong kind of value");
                 return true;
             }
 
-            auto iter = hashMap.find(obj[0]);
-            assert(iter != hashMap.end());
-            assert(iter->first->type == (*it)->type);
-            addReplyMultiBulkLen(conn->outputBuffer(), iter->second.size() * 2);
-            for (auto &iterr : iter->second) {
-                addReplyBulkCBuffer(conn->outputBuffer(),
-                                    iterr.first->ptr, sdslen(iterr.first->ptr));
-                addReplyBulkCBuffer(conn->outputBuffer(),
-                                    iterr.second->ptr, sdslen(iterr.second->ptr));
-            }
+            auto &rhash = *entry->obj.hash;
+            Buffer *buffer = conn->outputBuffer();
+            addReplyMultiBulkLen(buffer, rhash.size() * 2);
+            rhash.forEach([&](const std::string_view &field, const std::string_view &value) {
+                addReplyBulkCBuffer(buffer, field.data(), field.size());
+                addReplyBulkCBuffer(buffer, value.data(), value.size());
+            });
         }
     }
     return true;
@@ -2345,31 +3574,26 @@ bool Redis::hgetCommand(const std::deque <RedisObjectPtr> &obj,
 
     size_t hash = obj[0]->hash;
     size_t index = hash % kShards;
-    auto &mu = redisShards[index].mtx;
-    auto &map = redisShards[index].redisMap;
-    auto &hashMap = redisShards[index].hashMap;
+    auto &keySpace = redisShards[index].keySpace;
     {
-        std::unique_lock <std::mutex> lck(mu);
-        auto it = map.find(obj[0]);
-        if (it == map.end()) {
-            auto iter = hashMap.find(obj[0]);
-            assert(iter == hashMap.end());
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        expireIfNeeded(redisShards[index], obj[0]);
+        auto entry = keySpace.find(obj[0]);
+        if (entry == nullptr) {
             addReply(conn->outputBuffer(), shared.nullbulk);
         } else {
-            if ((*it)->type != OBJ_HASH) {
+            if (entry->type != OBJ_HASH) {
                 addReplyErrorFormat(conn->outputBuffer(),
                                     "WRONGTYPE Operation against a key holding the wrong kind of value");
                 return true;
             }
 
-            auto iter = hashMap.find(obj[0]);
-            assert(iter != hashMap.end());
-            assert(iter->first->type == (*it)->type);
-            auto iterr = iter->second.find(obj[1]);
-            if (iterr == iter->second.end()) {
-                addReply(conn->outputBuffer(), shared.nullbulk);
+            char buf[Listpack::kIntBufSize];
+            std::string_view value;
+            if (entry->obj.hash->get(obj[1], buf, &value)) {
+                addReplyBulkCBuffer(conn->outputBuffer(), value.data(), value.size());
             } else {
-                addReplyBulk(conn->outputBuffer(), iterr->second);
+                addReply(conn->outputBuffer(), shared.nullbulk);
             }
         }
     }
@@ -2384,33 +3608,27 @@ bool Redis::hkeysCommand(const std::deque <RedisObjectPtr> &obj,
 
     size_t hash = obj[0]->hash;
     size_t index = hash % kShards;
-    auto &mu = redisShards[index].mtx;
-    auto &map = redisShards[index].redisMap;
-    auto &hashMap = redisShards[index].hashMap;
+    auto &keySpace = redisShards[index].keySpace;
     {
-        std::unique_lock <std::mutex> lck(mu);
-        auto it = map.find(obj[0]);
-        if (it == map.end()) {
-            auto iter = hashMap.find(obj[0]);
-            assert(iter == hashMap.end());
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        expireIfNeeded(redisShards[index], obj[0]);
+        auto entry = keySpace.find(obj[0]);
+        if (entry == nullptr) {
             addReply(conn->outputBuffer(), shared.emptymultibulk);
             return true;
         } else {
-            if ((*it)->type != OBJ_HASH) {
+            if (entry->type != OBJ_HASH) {
                 addReplyErrorFormat(conn->outputBuffer(),
                                     "WRONGTYPE Operation against a key holding the wrong kind of value");
                 return true;
             }
 
-            auto iter = hashMap.find(obj[0]);
-            assert(iter != hashMap.end());
-            assert(iter->first->type == (*it)->type);
-            addReplyMultiBulkLen(conn->outputBuffer(), iter->second.size());
-
-            for (auto &iterr : iter->second) {
-                addReplyBulkCBuffer(conn->outputBuffer(),
-                                    iterr.first->ptr, sdslen(iterr.first->ptr));
-            }
+            auto &rhash = *entry->obj.hash;
+            Buffer *buffer = conn->outputBuffer();
+            addReplyMultiBulkLen(buffer, rhash.size());
+            rhash.forEach([&](const std::string_view &field, const std::string_view &value) {
+                addReplyBulkCBuffer(buffer, field.data(), field.size());
+            });
         }
     }
     return true;
@@ -2425,27 +3643,19 @@ bool Redis::hlenCommand(const std::deque <RedisObjectPtr> &obj,
     size_t len = 0;
     size_t hash = obj[0]->hash;
     size_t index = hash % kShards;
-    auto &mu = redisShards[index].mtx;
-    auto &map = redisShards[index].redisMap;
-    auto &hashMap = redisShards[index].hashMap;
+    auto &keySpace = redisShards[index].keySpace;
     {
-        std::unique_lock <std::mutex> lck(mu);
-        auto it = map.find(obj[0]);
-        if (it == map.end()) {
-            auto iter = hashMap.find(obj[0]);
-            assert(iter == hashMap.end());
-        } else {
-            if ((*it)->type != OBJ_HASH) {
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        expireIfNeeded(redisShards[index], obj[0]);
+        auto entry = keySpace.find(obj[0]);
+        if (entry != nullptr) {
+            if (entry->type != OBJ_HASH) {
                 addReplyErrorFormat(conn->outputBuffer(),
                                     "WRONGTYPE Operation against a key holding the wrong kind of value");
                 return true;
             }
 
-            auto iter = hashMap.find(obj[0]);
-            assert(iter != hashMap.end());
-            assert(iter->first->type == (*it)->type);
-            assert(!iter->second.empty());
-            len = iter->second.size();
+            len = entry->obj.hash->size();
         }
     }
 
@@ -2459,45 +3669,24 @@ bool Redis::hsetCommand(const std::deque <RedisObjectPtr> &obj,
         return false;
     }
 
-    obj[0]->type = OBJ_HASH;
-    obj[1]->type = OBJ_HASH;
-    obj[2]->type = OBJ_HASH;
-
     bool update = false;
 
     size_t hash = obj[0]->hash;
     size_t index = hash % kShards;
-    auto &mu = redisShards[index].mtx;
-    auto &map = redisShards[index].redisMap;
-    auto &hashMap = redisShards[index].hashMap;
+    auto &keySpace = redisShards[index].keySpace;
     {
-        std::unique_lock <std::mutex> lck(mu);
-        auto it = map.find(obj[0]);
-        if (it == map.end()) {
-            auto iter = hashMap.find(obj[0]);
-            assert(iter == hashMap.end());
-            std::unordered_map <RedisObjectPtr, RedisObjectPtr, Hash, Equal> rhash;
-            rhash.insert(std::make_pair(obj[1], obj[2]));
-            hashMap.insert(std::make_pair(obj[0], std::move(rhash)));
-            map.insert(obj[0]);
-        } else {
-            if ((*it)->type != OBJ_HASH) {
-                addReplyErrorFormat(conn->outputBuffer(),
-                                    "WRONGTYPE Operation against a key holding the wrong kind of value");
-                return true;
-            }
-
-            auto iter = hashMap.find(obj[0]);
-            assert(iter != hashMap.end());
-
-            auto iterr = iter->second.find(obj[1]);
-            if (iterr == iter->second.end()) {
-                iter->second.insert(std::make_pair(obj[1], obj[2]));
-            } else {
-                iterr->second = obj[2];
-                update = true;
-            }
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        expireIfNeeded(redisShards[index], obj[0]);
+        auto entry = keySpace.find(obj[0]);
+        if (entry == nullptr) {
+            entry = keySpace.insert(obj[0], OBJ_HASH);
+        } else if (entry->type != OBJ_HASH) {
+            addReplyErrorFormat(conn->outputBuffer(),
+                                "WRONGTYPE Operation against a key holding the wrong kind of value");
+            return true;
         }
+
+        update = !entry->obj.hash->set(obj[1], obj[2]);
     }
 
     addReply(conn->outputBuffer(), update ? shared.czero : shared.cone);
@@ -2512,7 +3701,6 @@ bool Redis::setCommand(const std::deque <RedisObjectPtr> &obj,
 
     int32_t j;
     RedisObjectPtr expire = nullptr;
-    RedisObjectPtr ex = nullptr;
     int32_t unit = UNIT_SECONDS;
     int32_t flags = OBJ_SET_NO_FLAGS;
 
@@ -2530,18 +3718,24 @@ bool Redis::setCommand(const std::deque <RedisObjectPtr> &obj,
             flags |= OBJ_SET_XX;
         } else if ((a[0] == 'e' || a[0] == 'E') &&
                    (a[1] == 'x' || a[1] == 'X') && a[2] == '\0' &&
-                   !(flags & OBJ_SET_PX) && next) {
+                   !(flags & (OBJ_SET_PX | OBJ_SET_PXAT)) && next) {
             flags |= OBJ_SET_EX;
             unit = UNIT_SECONDS;
             expire = next;
             j++;
         } else if ((a[0] == 'p' || a[0] == 'P') &&
                    (a[1] == 'x' || a[1] == 'X') && a[2] == '\0' &&
-                   !(flags & OBJ_SET_EX) && next) {
+                   !(flags & (OBJ_SET_EX | OBJ_SET_PXAT)) && next) {
             flags |= OBJ_SET_PX;
             unit = UNIT_MILLISECONDS;
             expire = next;
             j++;
+        } else if (!strcasecmp(a, "pxat") &&
+                   !(flags & (OBJ_SET_EX | OBJ_SET_PX)) && next) {
+            flags |= OBJ_SET_PXAT;
+            unit = UNIT_MILLISECONDS;
+            expire = next;
+            j++;
         } else {
             addReply(conn->outputBuffer(), shared.syntaxerr);
             return true;
@@ -2561,34 +3755,25 @@ bool Redis::setCommand(const std::deque <RedisObjectPtr> &obj,
         if (unit == UNIT_SECONDS) milliseconds *= 1000;
     }
 
-    obj[0]->type = OBJ_STRING;
     obj[1]->type = OBJ_STRING;
+    RedisObjectPtr val = tryObjectEncoding(obj[1]);
 
     size_t hash = obj[0]->hash;
     size_t index = hash % kShards;
-    auto &mu = redisShards[index].mtx;
-    auto &map = redisShards[index].redisMap;
-    auto &stringMap = redisShards[index].stringMap;
+    auto &keySpace = redisShards[index].keySpace;
     {
-        std::unique_lock <std::mutex> lck(mu);
-        auto it = map.find(obj[0]);
-        if (it == map.end()) {
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        expireIfNeeded(redisShards[index], obj[0]);
+        auto entry = keySpace.find(obj[0]);
+        if (entry == nullptr) {
             if (flags & OBJ_SET_XX) {
                 addReply(conn->outputBuffer(), shared.nullbulk);
                 return true;
             }
 
-            auto iter = stringMap.find(obj[0]);
-            assert(iter == stringMap.end());
-
-            map.insert(obj[0]);
-            stringMap.insert(std::make_pair(obj[0], obj[1]));
-
-            if (expire) {
-                ex = createStringObject(obj[0]->ptr, sdslen(obj[0]->ptr));
-            }
+            entry = keySpace.insert(obj[0], OBJ_STRING);
         } else {
-            if ((*it)->type != OBJ_STRING) {
+            if (entry->type != OBJ_STRING) {
                 addReplyErrorFormat(conn->outputBuffer(),
                                     "WRONGTYPE Operation against a key holding the wrong kind of value");
                 return true;
@@ -2598,27 +3783,15 @@ bool Redis::setCommand(const std::deque <RedisObjectPtr> &obj,
                 addReply(conn->outputBuffer(), shared.nullbulk);
                 return true;
             }
-
-            if (expire) {
-                ex = createStringObject(obj[0]->ptr, sdslen(obj[0]->ptr));
-            }
-
-            auto iter = stringMap.find(obj[0]);
-            assert(iter != stringMap.end());
-            iter->second = obj[1];
         }
-    }
+        entry->val = val;
 
-    if (expire) {
-        {
-            std::unique_lock <std::mutex> lck(expireMutex);
-            ex->type = OBJ_EXPIRE;
-            auto iter = expireTimers.find(ex);
-            if (iter != expireTimers.end()) {
-                loop.cancelAfter(iter->second);
-                expireTimers.erase(iter);
-            }
-            setExpire(ex, milliseconds / 1000);
+        if (flags & OBJ_SET_PXAT) {
+            redisShards[index].expireWheel.add(obj[0], milliseconds);
+        } else if (expire) {
+            redisShards[index].expireWheel.add(obj[0], mstime() + milliseconds);
+        } else {
+            redisShards[index].expireWheel.remove(obj[0]);
         }
     }
 
@@ -2634,34 +3807,93 @@ bool Redis::getCommand(const std::deque <RedisObjectPtr> &obj,
 
     size_t hash = obj[0]->hash;
     int32_t index = hash % kShards;
-    auto &map = redisShards[index].redisMap;
-    auto &mu = redisShards[index].mtx;
-    auto &stringMap = redisShards[index].stringMap;
+    auto &keySpace = redisShards[index].keySpace;
     {
-        std::unique_lock <std::mutex> lck(mu);
-        auto it = map.find(obj[0]);
-        if (it == map.end()) {
-            auto iter = stringMap.find(obj[0]);
-            assert(iter == stringMap.end());
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        expireIfNeeded(redisShards[index], obj[0]);
+        auto entry = keySpace.find(obj[0]);
+        if (entry == nullptr) {
             addReply(conn->outputBuffer(), shared.nullbulk);
-            return false;
+            return true;
         }
 
-        auto iter = stringMap.find(obj[0]);
-        assert(iter != stringMap.end());
-        assert(iter->first->type == (*it)->type);
-
-        if ((*it)->type != OBJ_STRING) {
+        if (entry->type != OBJ_STRING) {
             addReplyErrorFormat(conn->outputBuffer(),
                                 "WRONGTYPE Operation against a key holding the wrong kind of value");
             return true;
         }
 
-        addReplyBulk(conn->outputBuffer(), iter->second);
+        addReplyBulk(conn->outputBuffer(), entry->val);
     }
     return true;
 }
 
+/* SET key value without options. Only the value becomes an object, the key
+ * is copied into the keyspace slot. */
+int32_t Redis::setViewCommand(const std::vector <std::string_view> &argv,
+                              const SessionPtr &session, const TcpConnectionPtr &conn) {
+    if (argv.size() != 2) {
+        return REDIS_ERR;
+    }
+
+    const std::string_view &key = argv[0];
+    uint32_t hash = dictGenHashFunction(key.data(), key.size());
+    auto &shard = redisShards[hash % kShards];
+    RedisObjectPtr val = createEncodedStringObject(argv[1].data(), argv[1].size());
+    {
+        std::unique_lock <std::mutex> lck(shard.mtx);
+        auto entry = shard.keySpace.find(key.data(), key.size(), hash);
+        if (entry != nullptr && entry->type != OBJ_STRING) {
+            addReplyErrorFormat(conn->outputBuffer(),
+                                "WRONGTYPE Operation against a key holding the wrong kind of value");
+            return REDIS_OK;
+        }
+
+        if (entry == nullptr) {
+            entry = shard.keySpace.insert(key.data(), key.size(), hash, OBJ_STRING);
+        } else if (shard.expireWheel.size() > 0) {
+            shard.expireWheel.remove(entry->createKeyObject());
+        }
+        entry->val = val;
+    }
+
+    addReply(conn->outputBuffer(), shared.ok);
+    return REDIS_OK;
+}
+
+int32_t Redis::getViewCommand(const std::vector <std::string_view> &argv,
+                              const SessionPtr &session, const TcpConnectionPtr &conn) {
+    if (argv.size() != 1) {
+        return REDIS_ERR;
+    }
+
+    const std::string_view &key = argv[0];
+    uint32_t hash = dictGenHashFunction(key.data(), key.size());
+    auto &shard = redisShards[hash % kShards];
+    {
+        std::unique_lock <std::mutex> lck(shard.mtx);
+        auto entry = shard.keySpace.find(key.data(), key.size(), hash);
+        if (entry != nullptr && shard.expireWheel.size() > 0 &&
+            expireIfNeeded(shard, entry->createKeyObject())) {
+            entry = nullptr;
+        }
+
+        if (entry == nullptr) {
+            addReply(conn->outputBuffer(), shared.nullbulk);
+            return REDIS_OK;
+        }
+
+        if (entry->type != OBJ_STRING) {
+            addReplyErrorFormat(conn->outputBuffer(),
+                                "WRONGTYPE Operation against a key holding the wrong kind of value");
+            return REDIS_OK;
+        }
+
+        addReplyBulk(conn->outputBuffer(), entry->val);
+    }
+    return REDIS_OK;
+}
+
 bool Redis::incrCommand(const std::deque <RedisObjectPtr> &obj,
                         const SessionPtr &session, const TcpConnectionPtr &conn) {
     if (obj.size() != 1) {
@@ -2682,48 +3914,47 @@ bool Redis::incrDecrCommand(const RedisObjectPtr &obj,
                             const SessionPtr &session, const TcpConnectionPtr &conn, int64_t incr) {
     size_t hash = obj->hash;
     size_t index = hash % kShards;
-    auto &mu = redisShards[index].mtx;
-    auto &map = redisShards[index].redisMap;
-    auto &stringMap = redisShards[index].stringMap;
+    auto &keySpace = redisShards[index].keySpace;
     {
-        std::unique_lock <std::mutex> lck(mu);
-        auto it = map.find(obj);
-        if (it == map.end()) {
-            auto iter = stringMap.find(obj);
-            assert(iter == stringMap.end());
-
-            obj->type = OBJ_STRING;
-            map.insert(obj);
-
-            stringMap.insert(std::make_pair(obj, createStringObjectFromLongLong(incr)));
+        std::unique_lock <std::mutex> lck = lockShard(index);
+        expireIfNeeded(redisShards[index], obj);
+        auto entry = keySpace.find(obj);
+        if (entry == nullptr) {
+            entry = keySpace.insert(obj, OBJ_STRING);
+            entry->val = createStringObjectFromLongLong(incr);
             addReplyLongLong(conn->outputBuffer(), incr);
             return true;
         } else {
-            if ((*it)->type != OBJ_STRING) {
+            if (entry->type != OBJ_STRING) {
                 addReplyErrorFormat(conn->outputBuffer(),
                                     "WRONGTYPE Operation against a key holding the wrong kind of value");
                 return true;
             }
 
-            auto iter = stringMap.find(obj);
-            assert(iter != stringMap.end());
-
             int64_t value;
             if (getLongLongFromObjectOrReply(conn->outputBuffer(),
-                                             iter->second, &value, nullptr) != REDIS_OK)
-                return false;
+                                             entry->val, &value, nullptr) != REDIS_OK) {
+                return true;
+            }
 
-            value += incr;
             if ((incr < 0 && value < 0 && incr < (LLONG_MIN - value)) ||
                 (incr > 0 && value > 0 && incr > (LLONG_MAX - value))) {
                 addReplyError(conn->outputBuffer(), "increment or decrement would overflow");
                 return true;
             }
 
-            iter->second = createStringObjectFromLongLong(value);
-            addReply(conn->outputBuffer(), shared.colon);
-            addReply(conn->outputBuffer(), iter->second);
-            addReply(conn->outputBuffer(), shared.crlf);
+            value += incr;
+            /* A counter nobody else holds is updated in place, no allocation
+             * per INCR. Shared integers and RAW values get a new object. */
+            RedisObjectPtr &val = entry->val;
+            if (val->encoding == OBJ_ENCODING_INT && val.use_count() == 1 &&
+                (value < 0 || value >= REDIS_SHARED_INTEGERS) &&
+                value >= INTPTR_MIN && value <= INTPTR_MAX) {
+                val->ptr = (sds)(intptr_t) value;
+            } else {
+                val = createStringObjectFromLongLong(value);
+            }
+            addReplyLongLong(conn->outputBuffer(), value);
             return true;
         }
     }
@@ -2735,17 +3966,25 @@ bool Redis::ttlCommand(const std::deque <RedisObjectPtr> &obj,
         return false;
     }
 
-    std::unique_lock <std::mutex> lck(expireMutex);
-    auto it = expireTimers.find(obj[0]);
-    if (it == expireTimers.end()) {
+    size_t index = obj[0]->hash % kShards;
+    std::unique_lock <std::mutex> lck = lockShard(index);
+    expireIfNeeded(redisShards[index], obj[0]);
+    if (redisShards[index].keySpace.find(obj[0]) == nullptr) {
         addReplyLongLong(conn->outputBuffer(), -2);
         return true;
     }
 
-    int64_t ttl = it->second->getExpiration().getMicroSecondsSinceEpoch()
-                  - TimeStamp::now().getMicroSecondsSinceEpoch();
+    int64_t when = redisShards[index].expireWheel.get(obj[0]);
+    if (when == -1) {
+        addReplyLongLong(conn->outputBuffer(), -1);
+        return true;
+    }
 
-    addReplyLongLong(conn->outputBuffer(), ttl / 1000000);
+    int64_t ttl = when - mstime();
+    if (ttl < 0) {
+        ttl = 0;
+    }
+    addReplyLongLong(conn->outputBuffer(), (ttl + 500) / 1000);
     return true;
 }
 
@@ -2763,466 +4002,39 @@ bool Redis::monitorCommand(const std::deque <RedisObjectPtr> &obj,
 }
 
 #ifdef _LUA
-int32_t Redis::luaCreateFunction(Buffer *buffer, lua_State *lua,
-    char *funcname, const RedisObjectPtr &body)
-{
-    sds funcdef = sdsempty();
-    funcdef = sdscat(funcdef, "function ");
-    funcdef = sdscatlen(funcdef, funcname, 42);
-    funcdef = sdscatlen(funcdef, "() ", 3);
-    funcdef = sdscatlen(funcdef, body->ptr, sdslen(body->ptr));
-    funcdef = sdscatlen(funcdef, " end", 4);
-
-    if (luaL_loadbuffer(lua, funcdef, sdslen(funcdef), "@user_script"))
-    {
-        addReplyErrorFormat(buffer, "Error compiling script (new function): %s\n",
-        lua_tostring(lua, -1));
-        lua_pop(lua, 1);
-        sdsfree(funcdef);
-        return REDIS_ERR;
-    }
-
-    sdsfree(funcdef);
-    if (lua_pcall(lua, 0, 0, 0))
-    {
-        addReplyErrorFormat(buffer, "Error running script (new function): %s\n",
-            lua_tostring(lua, -1));
-        lua_pop(lua, 1);
-        return REDIS_ERR;
-    }
-    return REDIS_OK;
+bool Redis::evalCommand(const std::deque <RedisObjectPtr> &obj,
+                        const SessionPtr &session, const TcpConnectionPtr &conn) {
+    return scripting.eval(obj, session, conn, false);
 }
 
-void Redis::luaSetGlobalArray(lua_State *lua,
-    char *var, const std::deque<RedisObjectPtr> &elev, int32_t start, int32_t end)
-{
-    int j;
-
-    lua_newtable(lua);
-    for (j = start; j < end; j++)
-    {
-        lua_pushlstring(lua,(char*)elev[j]->ptr, sdslen(elev[j]->ptr));
-        lua_rawseti(lua, -2, j + 1);
-    }
-    lua_setglobal(lua,var);
+bool Redis::evalshaCommand(const std::deque <RedisObjectPtr> &obj,
+                           const SessionPtr &session, const TcpConnectionPtr &conn) {
+    return scripting.eval(obj, session, conn, true);
 }
 
-bool Redis::evalCommand(const std::deque<RedisObjectPtr> &obj,
-    const SessionPtr &session, const TcpConnectionPtr &conn)
-{
-    int delhook = 0, err;
-    int evalsha = 0;
-    char funcname[43];
-    int64_t numkeys;
-    /* Get the number of arguments that are keys */
-    if (getLongLongFromObjectOrReply(conn->outputBuffer(),
-        obj[1], &numkeys, nullptr) != REDIS_OK)
-    {
-        return false;
-    }
-
-    if (numkeys > (obj.size() - 2))
-    {
-        addReplyError(conn->outputBuffer(),
-            "Number of keys can't be greater than number of args");
-        return true;
-    }
-    else if (numkeys < 0)
-    {
-        addReplyError(conn->outputBuffer(),
-            "Number of keys can't be negative");
-        return true;
-    }
-
-    /* We obtain the script SHA1, then check if this function is already
-     * defined into the Lua state */
-    funcname[0] = 'f';
-    funcname[1] = '_';
-
-    if (!evalsha)
-    {
-        /* Hash the code if this is an EVAL call */
-        sha1hex(funcname + 2, obj[0]->ptr, sdslen(obj[0]->ptr));
-    }
-    else
-    {
-        /* We already have the SHA if it is a EVALSHA */
-        int j;
-        char *sha = obj[0]->ptr;
-
-        /* Convert to lowercase. We don't use tolower since the function
-         * managed to always show up in the profiler output consuming
-         * a non trivial amount of time. */
-        for (j = 0; j < 40; j++)
-            funcname[j + 2] = (sha[j] >= 'A' && sha[j] <= 'Z') ?
-                sha[j] + ('a'-'A') : sha[j];
-        funcname[42] = '\0';
-    }
-
-    /* Push the pcall error handler function on the stack. */
-    lua_getglobal(lua, "__redis__err__handler");
-
-    /* Try to lookup the Lua function */
-    lua_getglobal(lua, funcname);
-    if (lua_isnil(lua, -1))
-    {
-        lua_pop(lua, 1); /* remove the nil from the stack */
-        /* Function not defined... let's define it if we have the
-         * body of the function. If this is an EVALSHA call we can just
-         * return an error. */
-        if (evalsha)
-        {
-            lua_pop(lua, 1); /* remove the error handler from the stack. */
-            addReply(conn->outputBuffer(), shared.noscripterr);
-            return true;
-        }
-
-        if (luaCreateFunction(conn->outputBuffer(),
-            lua, funcname, obj[0]) == REDIS_ERR)
-        {
-            lua_pop(lua, 1); /* remove the error handler from the stack. */
-            /* The error is sent to the client by luaCreateFunction()
-             * itself when it returns NULL. */
-            return true;
+bool Redis::scriptCommand(const std::deque <RedisObjectPtr> &obj,
+                          const SessionPtr &session, const TcpConnectionPtr &conn) {
+    if (obj.size() == 1 && !strcasecmp(obj[0]->ptr, "flush")) {
+        scripting.flush();
+        addReply(conn->outputBuffer(), shared.ok);
+    } else if (obj.size() >= 2 && !strcasecmp(obj[0]->ptr, "exists")) {
+        addReplyMultiBulkLen(conn->outputBuffer(), obj.size() - 1);
+        for (size_t j = 1; j < obj.size(); j++) {
+            addReply(conn->outputBuffer(), scripting.exists(obj[j]) ? shared.cone : shared.czero);
         }
-
-        /* Now the following is guaranteed to return non nil */
-        lua_getglobal(lua, funcname);
-        assert(!lua_isnil(lua, -1));
-    }
-
-    luaSetGlobalArray(lua, "KEYS", obj, 2, numkeys);
-    luaSetGlobalArray(lua, "ARGV", obj, 2 + numkeys, obj.size() - 2 - numkeys);
-    err = lua_pcall(lua, 0, 1, -2);
-
-    if (err)
-    {
-        addReplyErrorFormat(conn->outputBuffer(), "Error running script (call to %s): %s\n",
-            funcname, lua_tostring(lua,-1));
-        lua_pop(lua,2); /* Consume the Lua reply and remove error handler. */
-    }
-    else
-    {
-        /* On success convert the Lua return value into Redis protocol, and
-         * send it to * the client. */
-        luaReplyToRedisReply(conn->outputBuffer(), lua); /* Convert and consume the reply. */
-        lua_pop(lua, 1); /* Remove the error handler. */
+    } else if (obj.size() == 2 && !strcasecmp(obj[0]->ptr, "load")) {
+        scripting.load(obj[1], conn->outputBuffer());
+    } else {
+        addReplyErrorFormat(conn->outputBuffer(), "Unknown SCRIPT subcommand or wrong # of args.");
     }
     return true;
 }
-
-void Redis::luaReplyToRedisReply(Buffer *buffer, lua_State *lua)
-{
-    int t = lua_type(lua, -1);
-
-    switch(t)
-    {
-        case LUA_TSTRING:
-            addReplyBulkCBuffer(buffer, (char*)lua_tostring(lua, -1), lua_strlen(lua, -1));
-            break;
-        case LUA_TBOOLEAN:
-            addReply(buffer, lua_toboolean(lua,-1) ? shared.cone : shared.nullbulk);
-            break;
-        case LUA_TNUMBER:
-            addReplyLongLong(buffer, (int64_t)lua_tonumber(lua, -1));
-            break;
-        case LUA_TTABLE:
-            /* We need to check if it is an array, an error, or a status reply.
-             * Error are returned as a single element table with 'err' field.
-             * Status replies are returned as single element table with 'ok' field */
-            lua_pushstring(lua, "err");
-            lua_gettable(lua, -2);
-            t = lua_type(lua, -1);
-            if (t == LUA_TSTRING)
-            {
-                sds err = sdsnew(lua_tostring(lua, -1));
-                sdsmapchars(err, "\r\n","   ", 2);
-                addReplySds(buffer, sdscatprintf(sdsempty(), "-%s\r\n", err));
-                sdsfree(err);
-                lua_pop(lua, 2);
-                return;
-            }
-
-            lua_pop(lua, 1);
-            lua_pushstring(lua, "ok");
-            lua_gettable(lua, -2);
-            t = lua_type(lua, -1);
-            if (t == LUA_TSTRING)
-            {
-                sds ok = sdsnew(lua_tostring(lua, -1));
-                sdsmapchars(ok, "\r\n", "  ", 2);
-                addReplySds(buffer, sdscatprintf(sdsempty(), "+%s\r\n", ok));
-                sdsfree(ok);
-                lua_pop(lua, 1);
-            }
-            else
-            {
-                LOG_INFO << "lua table";
-                int j = 1, mbulklen = 0;
-                lua_pop(lua, 1); /* Discard the 'ok' field value we popped */
-                while(1)
-                {
-                    lua_pushnumber(lua, j++);
-                    lua_gettable(lua, -2);
-                    t = lua_type(lua, -1);
-                    if (t == LUA_TNIL)
-                    {
-                        lua_pop(lua, 1);
-                        break;
-                    }
-
-                    luaReplyToRedisReply(buffer, lua);
-                    mbulklen++;
-                }
-
-                int32_t len;
-                char buf[128];
-                buf[0] = '*';
-                len = ll2string(buf + 1, sizeof(buf) - 1, mbulklen);
-                buf[len + 1] = '\r';
-                buf[len + 2] = '\n';
-                buffer->prepend(buf, len + 3);
-            }
-            break;
-        default:
-            addReply(buffer, shared.nullbulk);
-    }
-    lua_pop(lua,1);
-}
-
-void Redis::luaLoadLib(lua_State *lua, const char *libname, lua_CFunction luafunc)
-{
-    lua_pushcfunction(lua, luafunc);
-    lua_pushstring(lua, libname);
-    lua_call(lua, 1, 0);
-}
-
-void Redis::luaLoadLibraries(lua_State *lua)
-{
-    luaLoadLib(lua, "", luaopen_base);
-    luaLoadLib(lua, LUA_TABLIBNAME, luaopen_table);
-    luaLoadLib(lua, LUA_STRLIBNAME, luaopen_string);
-    luaLoadLib(lua, LUA_MATHLIBNAME, luaopen_math);
-    luaLoadLib(lua, LUA_DBLIBNAME, luaopen_debug);
-#if 0 /* Stuff that we don't load currently, for sandboxing concerns. */
-    luaLoadLib(lua, LUA_LOADLIBNAME, luaopen_package);
-    luaLoadLib(lua, LUA_OSLIBNAME, luaopen_os);
-#endif
-}
-
-/* Remove a functions that we don't want to expose to the Redis scripting
- * environment. */
-void Redis::luaRemoveUnsupportedFunctions(lua_State *lua)
-{
-    lua_pushnil(lua);
-    lua_setglobal(lua,"loadfile");
-    lua_pushnil(lua);
-    lua_setglobal(lua,"dofile");
-}
-
-int32_t Redis::luaRedisGenericCommand(lua_State *lua, int32_t raise)
-{
-
-}
-
-int Redis::luaRedisCallCommand(lua_State *lua)
-{
-    int j, argc = lua_gettop(lua);
-    /* Require at least one argument */
-    if (argc == 0)
-    {
-        luaPushError(lua,
-            "Please specify at least one argument for redis.call()");
-        return 1;
-    }
-
-    std::deque<RedisObjectPtr> argv;
-    argv.resize(argc - 1);
-
-    char *objs;
-    size_t objlen;
-    objs = (char*)lua_tolstring(lua, 1, &objlen);
-
-    RedisObjectPtr cmd = createStringObject(objs, objlen);
-    for (j = 1; j < argc; j++)
-    {
-        char *objs;
-        size_t objlen;
-
-        objs = (char*)lua_tolstring(lua, j + 1, &objlen);
-        if (objs == nullptr) break; /* Not a string. */
-        argv[j] = createStringObject(objs, objlen);
-    }
-
-    /* Check if one of the arguments passed by the Lua script
-    * is not a string or an integer (lua_isstring() return true for
-    * integers as well). */
-
-   /* auto it = handlerCommands.find(cmd);
-    if (it == handlerCommands.end())
-    {
-        luaPushError(lua, "Unknown Redis command called from Lua script");
-        goto cleanup;
-    }
-
-    if (!it->second(argv, nullptr, conn))
-    {
-        luaPushError(lua,
-                "Wrong number of args calling Redis command From Lua script");
-        goto cleanup;
-    }
-
-
-    */
-
-    return 1;
-cleanup:
-     /* If we are here we should have an error in the stack, in the
-         * form of a table with an "err" field. Extract the string to
-         * return the plain error. */
-
-    lua_pushstring(lua,"err");
-    lua_gettable(lua,-2);
-    return lua_error(lua);
-}
-
-int Redis::luaRedisPCallCommand(lua_State *lua)
-{
-
-}
-
-/* This function installs metamethods in the global table _G that prevent
- * the creation of globals accidentally.
- *
- * It should be the last to be called in the scripting engine initialization
- * sequence, because it may interact with creation of globals. */
-void Redis::scriptingEnableGlobalsProtection(lua_State *lua)
-{
-    char *s[32];
-    sds code = sdsempty();
-    int j = 0;
-
-    /* strict.lua from: http://metalua.luaforge.net/src/lib/strict.lua.html.
-     * Modified to be adapted to Redis. */
-    s[j++]="local dbg=debug\n";
-    s[j++]="local mt = {}\n";
-    s[j++]="setmetatable(_G, mt)\n";
-    s[j++]="mt.__newindex = function (t, n, v)\n";
-    s[j++]="  if dbg.getinfo(2) then\n";
-    s[j++]="    local w = dbg.getinfo(2, \"S\").what\n";
-    s[j++]="    if w ~= \"main\" and w ~= \"C\" then\n";
-    s[j++]="      error(\"Script attempted to create global variable '\"..tostring(n)..\"'\", 2)\n";
-    s[j++]="    end\n";
-    s[j++]="  end\n";
-    s[j++]="  rawset(t, n, v)\n";
-    s[j++]="end\n";
-    s[j++]="mt.__index = function (t, n)\n";
-    s[j++]="  if dbg.getinfo(2) and dbg.getinfo(2, \"S\").what ~= \"C\" then\n";
-    s[j++]="    error(\"Script attempted to access nonexistent global variable '\"..tostring(n)..\"'\", 2)\n";
-    s[j++]="  end\n";
-    s[j++]="  return rawget(t, n)\n";
-    s[j++]="end\n";
-    s[j++]="debug = nil\n";
-    s[j++]=nullptr;
-
-    for (j = 0; s[j] != nullptr; j++) code = sdscatlen(code,s[j],strlen(s[j]));
-    luaL_loadbuffer(lua,code,sdslen(code),"@enable_strict_lua");
-    lua_pcall(lua,0,0,0);
-    sdsfree(code);
-}
-
-void Redis::scriptingInit()
-{
-    lua = lua_open();
-    luaLoadLibraries(lua);
-    luaRemoveUnsupportedFunctions(lua);
-    /* Register the redis commands table and fields */
-    lua_newtable(lua);
-
-     /* redis.call */
-    lua_pushstring(lua, "call");
-    lua_pushcfunction(lua, luaRedisCallCommand);
-    lua_settable(lua,-3);
-
-    /* redis.pcall */
-    lua_pushstring(lua, "pcall");
-    lua_pushcfunction(lua, luaRedisPCallCommand);
-    lua_settable(lua, -3);
-
-     /* Add a helper function that we use to sort the multi bulk output of non
-     * deterministic commands, when containing 'false' elements. */
-    {
-        char *func = "function __redis__compare_helper(a,b)\n"
-                                "  if a == false then a = '' end\n"
-                                "  if b == false then b = '' end\n"
-                                "  return a<b\n"
-                                "end\n";
-        luaL_loadbuffer(lua, func, strlen(func), "@cmp_func_def");
-        lua_pcall(lua, 0, 0, 0);
-    }
-
-     /* Add a helper function we use for pcall error reporting.
-     * Note that when the error is in the C function we want to report the
-     * information about the caller, that's what makes sense from the point
-     * of view of the user debugging a script. */
-    {
-        char *func = "local dbg = debug\n"
-                                "function __redis__err__handler(err)\n"
-                                "  local i = dbg.getinfo(2,'nSl')\n"
-                                "  if i and i.what == 'C' then\n"
-                                "    i = dbg.getinfo(3,'nSl')\n"
-                                "  end\n"
-                                "  if i then\n"
-                                "    return i.source .. ':' .. i.currentline .. ': ' .. err\n"
-                                "  else\n"
-                                "    return err\n"
-                                "  end\n"
-                                "end\n";
-        luaL_loadbuffer(lua, func, strlen(func), "@err_handler_def");
-        lua_pcall(lua, 0, 0, 0);
-    }
-
-    /* Lua beginners often don't use "local", this is likely to introduce
-     * subtle bugs in their code. To prevent problems we protect accesses
-     * to global variables. */
-    scriptingEnableGlobalsProtection(lua);
-}
-
-void Redis::luaPushError(lua_State *lua, char *error)
-{
-    lua_Debug dbg;
-
-    lua_newtable(lua);
-    lua_pushstring(lua,"err");
-
-    /* Attempt to figure out where this function was called, if possible */
-    if(lua_getstack(lua, 1, &dbg) && lua_getinfo(lua, "nSl", &dbg))
-    {
-        sds msg = sdscatprintf(sdsempty(), "%s: %d: %s",
-            dbg.source, dbg.currentline, error);
-        lua_pushstring(lua, msg);
-        sdsfree(msg);
-    }
-    else
-    {
-        lua_pushstring(lua, error);
-    }
-    lua_settable(lua, -3);
-}
 #endif
 
 void Redis::flush() {
 
 }
 
-bool Redis::checkCommand(const RedisObjectPtr &cmd) {
-    auto it = checkCommands.find(cmd);
-    if (it == checkCommands.end()) {
-        return false;
-    }
-    return true;
-}
-
 void Redis::timeOut() {
     loop.quit();
 }
@@ -3239,15 +4051,14 @@ void Redis::initConfig() {
     slaveEnabled = false;
     authEnabled = false;
     repliEnabled = false;
-    salveCount = 0;
     clusterSlotEnabled = false;
     clusterRepliMigratEnabled = false;
     clusterRepliImportEnabeld = false;
     monitorEnabled = false;
+    sharedNothingEnabled = false;
     forkEnabled = false;
-    forkCondWaitCount = 0;
+    forklessEnabled = false;
     rdbChildPid = -1;
-    slavefd = -1;
     masterfd = -1;
     dbnum = 1;
 
@@ -3257,53 +4068,6 @@ void Redis::initConfig() {
     shared.rPort = createStringObject(buf, len);
     shared.rIp = createStringObject(getIp().data(), getIp().length());
 
-#define REGISTER_REDIS_COMMAND(msgId, func) \
-    handlerCommands[msgId] = std::bind(&Redis::func,this,std::placeholders::_1,std::placeholders::_2,std::placeholders::_3);
-    REGISTER_REDIS_COMMAND(shared.set, setCommand);
-    REGISTER_REDIS_COMMAND(shared.get, getCommand);
-    REGISTER_REDIS_COMMAND(shared.hset, hsetCommand);
-    REGISTER_REDIS_COMMAND(shared.hget, hgetCommand);
-    REGISTER_REDIS_COMMAND(shared.hlen, hlenCommand);
-    REGISTER_REDIS_COMMAND(shared.hgetall, hgetallCommand);
-    REGISTER_REDIS_COMMAND(shared.lpush, lpushCommand);
-    REGISTER_REDIS_COMMAND(shared.rpush, rpushCommand);
-    REGISTER_REDIS_COMMAND(shared.lpop, lpopCommand);
-    REGISTER_REDIS_COMMAND(shared.rpop, rpopCommand);
-    REGISTER_REDIS_COMMAND(shared.lrange, lrangeCommand);
-    REGISTER_REDIS_COMMAND(shared.rpop, rpopCommand);
-    REGISTER_REDIS_COMMAND(shared.llen, llenCommand);
-    REGISTER_REDIS_COMMAND(shared.zadd, zaddCommand);
-    REGISTER_REDIS_COMMAND(shared.zrange, zrangeCommand);
-    REGISTER_REDIS_COMMAND(shared.zcard, zcardCommand);
-    REGISTER_REDIS_COMMAND(shared.zrevrange, zrevrangeCommand);
-    REGISTER_REDIS_COMMAND(shared.scard, scardCommand);
-    REGISTER_REDIS_COMMAND(shared.sadd, saddCommand);
-    REGISTER_REDIS_COMMAND(shared.dump, dumpCommand);
-    REGISTER_REDIS_COMMAND(shared.restore, restoreCommand);
-    REGISTER_REDIS_COMMAND(shared.flushdb, flushdbCommand);
-    REGISTER_REDIS_COMMAND(shared.dbsize, dbsizeCommand);
-    REGISTER_REDIS_COMMAND(shared.ping, pingCommand);
-    REGISTER_REDIS_COMMAND(shared.save, saveCommand);
-    REGISTER_REDIS_COMMAND(shared.slaveof, slaveofCommand);
-    REGISTER_REDIS_COMMAND(shared.sync, syncCommand);
-    REGISTER_REDIS_COMMAND(shared.command, commandCommand);
-    REGISTER_REDIS_COMMAND(shared.config, configCommand);
-    REGISTER_REDIS_COMMAND(shared.auth, authCommand);
-    REGISTER_REDIS_COMMAND(shared.info, infoCommand);
-    REGISTER_REDIS_COMMAND(shared.echo, echoCommand);
-    REGISTER_REDIS_COMMAND(shared.client, clientCommand);
-    REGISTER_REDIS_COMMAND(shared.del, delCommand);
-    REGISTER_REDIS_COMMAND(shared.keys, keysCommand);
-    REGISTER_REDIS_COMMAND(shared.bgsave, bgsaveCommand);
-    REGISTER_REDIS_COMMAND(shared.memory, memoryCommand);
-    REGISTER_REDIS_COMMAND(shared.cluster, clusterCommand);
-    REGISTER_REDIS_COMMAND(shared.migrate, migrateCommand);
-    REGISTER_REDIS_COMMAND(shared.debug, debugCommand);
-    REGISTER_REDIS_COMMAND(shared.ttl, ttlCommand);
-    REGISTER_REDIS_COMMAND(shared.incr, incrCommand);
-    REGISTER_REDIS_COMMAND(shared.decr, decrCommand);
-    REGISTER_REDIS_COMMAND(shared.monitor, monitorCommand);
-
 #define REGISTER_REDIS_REPLY_COMMAND(msgId) \
     replyCommands.insert(msgId);
     REGISTER_REDIS_REPLY_COMMAND(shared.addsync);
@@ -3315,24 +4079,6 @@ void Redis::initConfig() {
     REGISTER_REDIS_REPLY_COMMAND(shared.rIp);
     REGISTER_REDIS_REPLY_COMMAND(shared.rPort);
 
-#define REGISTER_REDIS_CHECK_COMMAND(msgId) \
-    checkCommands.insert(msgId);
-    REGISTER_REDIS_CHECK_COMMAND(shared.set);
-    REGISTER_REDIS_CHECK_COMMAND(shared.set);
-    REGISTER_REDIS_CHECK_COMMAND(shared.lpush);
-    REGISTER_REDIS_CHECK_COMMAND(shared.rpush);
-    REGISTER_REDIS_CHECK_COMMAND(shared.sadd);
-    REGISTER_REDIS_CHECK_COMMAND(shared.lpop);
-    REGISTER_REDIS_CHECK_COMMAND(shared.rpop);
-    REGISTER_REDIS_CHECK_COMMAND(shared.del);
-    REGISTER_REDIS_CHECK_COMMAND(shared.flushdb);
-
-#define REGISTER_REDIS_CLUSTER_CHECK_COMMAND(msgId) \
-    cluterCommands.insert(msgId);
-    REGISTER_REDIS_CLUSTER_CHECK_COMMAND(shared.cluster);
-    REGISTER_REDIS_CLUSTER_CHECK_COMMAND(shared.migrate);
-    REGISTER_REDIS_CLUSTER_CHECK_COMMAND(shared.command);
-
     master = "master";
     slave = "slave";
     ipPort = ip + "::" + std::to_string(port);
@@ -9,33 +9,50 @@
 #include "session.h"
 #include "object.h"
 #include "rdb.h"
+#include "aof.h"
 #include "log.h"
 #include "socket.h"
 #include "replication.h"
 #include "cluster.h"
 #include "util.h"
+#include "expire.h"
+#include "keyspace.h"
+#include "mailbox.h"
+#include "command.h"
+#include "pubsub.h"
+#include "evict.h"
+#include "lazyfree.h"
+#include "stats.h"
+#include "scripting.h"
 
 class Redis {
 public:
-    Redis(const char *ip, int16_t port, int16_t threadCount, bool enbaledCluster = false);
+    Redis(const char *ip, int16_t port, int16_t threadCount,
+          bool enbaledCluster = false, bool enabledSharedNothing = false,
+          bool enabledAppendOnly = false, bool enabledReusePort = false,
+          bool enabledCpuAffinity = false);
 
     ~Redis();
 
     void initConfig();
 
-    void scriptingInit();
-
     void timeOut();
 
     void serverCron();
 
     void bgsaveCron();
 
-    void slaveRepliTimeOut(int32_t context);
+    /* Keeps evicting on the main loop while memory is above maxmemory and
+     * keys could be evicted, for when no write comes to do it. */
+    void evictCron();
+
+    void backgroundSaveDone(bool success);
 
-    void setExpireTimeOut(const RedisObjectPtr &expire);
+    int32_t rewriteAppendOnlyFileBackground();
 
-    void forkWait();
+    void slaveRepliTimeOut(const std::weak_ptr <TcpConnection> &conn);
+
+    void activeExpireCycle();
 
     void run();
 
@@ -47,26 +64,19 @@ public:
 
     void replyCheck();
 
-    void loadDataFromDisk();
+    void loadDataFromDisk(bool appendOnly);
 
     void flush();
 
 #ifdef _LUA
-    void luaLoadLib(lua_State *lua, const char *libname, lua_CFunction luafunc);
-    static int32_t luaRedisCallCommand(lua_State *lua);
-    static int32_t luaRedisPCallCommand(lua_State *lua);
-    int32_t luaRedisGenericCommand(lua_State *lua, int32_t raise);
-    void luaLoadLibraries(lua_State *lua);
-    void luaRemoveUnsupportedFunctions(lua_State *lua);
-    void scriptingEnableGlobalsProtection(lua_State *lua);
-    int32_t luaCreateFunction(Buffer *buffer, lua_State *lua,
-        char *funcname, const RedisObjectPtr &body);
-    void luaSetGlobalArray(lua_State *lua, char *var,
-        const std::deque<RedisObjectPtr> &elev, int32_t start, int32_t elec);
-    bool evalCommand(const std::deque<RedisObjectPtr> &obj,
-        const SessionPtr &session, const TcpConnectionPtr &conn);
-    void luaReplyToRedisReply(Buffer *buffer, lua_State *lua);
-    void luaPushError(lua_State *lua, char *error);
+    bool evalCommand(const std::deque <RedisObjectPtr> &obj,
+                     const SessionPtr &session, const TcpConnectionPtr &conn);
+
+    bool evalshaCommand(const std::deque <RedisObjectPtr> &obj,
+                        const SessionPtr &session, const TcpConnectionPtr &conn);
+
+    bool scriptCommand(const std::deque <RedisObjectPtr> &obj,
+                       const SessionPtr &session, const TcpConnectionPtr &conn);
 #endif
 
     bool saveCommand(const std::deque <RedisObjectPtr> &obj,
@@ -90,12 +100,27 @@ public:
     bool delCommand(const std::deque <RedisObjectPtr> &obj,
                     const SessionPtr &session, const TcpConnectionPtr &conn);
 
+    bool unlinkCommand(const std::deque <RedisObjectPtr> &obj,
+                       const SessionPtr &session, const TcpConnectionPtr &conn);
+
+    bool slowlogCommand(const std::deque <RedisObjectPtr> &obj,
+                        const SessionPtr &session, const TcpConnectionPtr &conn);
+
+    bool latencyCommand(const std::deque <RedisObjectPtr> &obj,
+                        const SessionPtr &session, const TcpConnectionPtr &conn);
+
     bool setCommand(const std::deque <RedisObjectPtr> &obj,
                     const SessionPtr &session, const TcpConnectionPtr &conn);
 
     bool getCommand(const std::deque <RedisObjectPtr> &obj,
                     const SessionPtr &session, const TcpConnectionPtr &conn);
 
+    int32_t setViewCommand(const std::vector <std::string_view> &argv,
+                           const SessionPtr &session, const TcpConnectionPtr &conn);
+
+    int32_t getViewCommand(const std::vector <std::string_view> &argv,
+                           const SessionPtr &session, const TcpConnectionPtr &conn);
+
     bool hkeysCommand(const std::deque <RedisObjectPtr> &obj,
                       const SessionPtr &session, const TcpConnectionPtr &conn);
 
@@ -111,6 +136,15 @@ public:
     bool hgetallCommand(const std::deque <RedisObjectPtr> &obj,
                         const SessionPtr &session, const TcpConnectionPtr &conn);
 
+    bool sismemberCommand(const std::deque <RedisObjectPtr> &obj,
+                          const SessionPtr &session, const TcpConnectionPtr &conn);
+
+    bool smembersCommand(const std::deque <RedisObjectPtr> &obj,
+                         const SessionPtr &session, const TcpConnectionPtr &conn);
+
+    bool objectCommand(const std::deque <RedisObjectPtr> &obj,
+                       const SessionPtr &session, const TcpConnectionPtr &conn);
+
     bool zaddCommand(const std::deque <RedisObjectPtr> &obj,
                      const SessionPtr &session, const TcpConnectionPtr &conn);
 
@@ -126,6 +160,33 @@ public:
     bool zrangeGenericCommand(const std::deque <RedisObjectPtr> &obj,
                               const SessionPtr &session, const TcpConnectionPtr &conn, int reverse);
 
+    bool zremCommand(const std::deque <RedisObjectPtr> &obj,
+                     const SessionPtr &session, const TcpConnectionPtr &conn);
+
+    bool zscoreCommand(const std::deque <RedisObjectPtr> &obj,
+                       const SessionPtr &session, const TcpConnectionPtr &conn);
+
+    bool zrankCommand(const std::deque <RedisObjectPtr> &obj,
+                      const SessionPtr &session, const TcpConnectionPtr &conn);
+
+    bool zrevrankCommand(const std::deque <RedisObjectPtr> &obj,
+                         const SessionPtr &session, const TcpConnectionPtr &conn);
+
+    bool zrankGenericCommand(const std::deque <RedisObjectPtr> &obj,
+                             const SessionPtr &session, const TcpConnectionPtr &conn, int reverse);
+
+    bool zrangebyscoreCommand(const std::deque <RedisObjectPtr> &obj,
+                              const SessionPtr &session, const TcpConnectionPtr &conn);
+
+    bool zrevrangebyscoreCommand(const std::deque <RedisObjectPtr> &obj,
+                                 const SessionPtr &session, const TcpConnectionPtr &conn);
+
+    bool zrangeByScoreGenericCommand(const std::deque <RedisObjectPtr> &obj,
+                                     const SessionPtr &session, const TcpConnectionPtr &conn, int reverse);
+
+    bool zcountCommand(const std::deque <RedisObjectPtr> &obj,
+                       const SessionPtr &session, const TcpConnectionPtr &conn);
+
     bool lpushCommand(const std::deque <RedisObjectPtr> &obj,
                       const SessionPtr &session, const TcpConnectionPtr &conn);
 
@@ -144,6 +205,18 @@ public:
     bool llenCommand(const std::deque <RedisObjectPtr> &obj,
                      const SessionPtr &session, const TcpConnectionPtr &conn);
 
+    bool lindexCommand(const std::deque <RedisObjectPtr> &obj,
+                       const SessionPtr &session, const TcpConnectionPtr &conn);
+
+    bool lsetCommand(const std::deque <RedisObjectPtr> &obj,
+                     const SessionPtr &session, const TcpConnectionPtr &conn);
+
+    bool ltrimCommand(const std::deque <RedisObjectPtr> &obj,
+                      const SessionPtr &session, const TcpConnectionPtr &conn);
+
+    bool linsertCommand(const std::deque <RedisObjectPtr> &obj,
+                        const SessionPtr &session, const TcpConnectionPtr &conn);
+
     bool scardCommand(const std::deque <RedisObjectPtr> &obj,
                       const SessionPtr &session, const TcpConnectionPtr &conn);
 
@@ -186,6 +259,9 @@ public:
     bool psyncCommand(const std::deque <RedisObjectPtr> &obj,
                       const SessionPtr &session, const TcpConnectionPtr &conn);
 
+    /* SYNC and PSYNC, 'replid' is nullptr for SYNC. */
+    void syncSlave(const TcpConnectionPtr &conn, const char *replid, int64_t offset);
+
     bool commandCommand(const std::deque <RedisObjectPtr> &obj,
                         const SessionPtr &session, const TcpConnectionPtr &conn);
 
@@ -210,9 +286,27 @@ public:
     bool keysCommand(const std::deque <RedisObjectPtr> &obj,
                      const SessionPtr &session, const TcpConnectionPtr &conn);
 
+    bool scanCommand(const std::deque <RedisObjectPtr> &obj,
+                     const SessionPtr &session, const TcpConnectionPtr &conn);
+
+    bool sscanCommand(const std::deque <RedisObjectPtr> &obj,
+                      const SessionPtr &session, const TcpConnectionPtr &conn);
+
+    bool hscanCommand(const std::deque <RedisObjectPtr> &obj,
+                      const SessionPtr &session, const TcpConnectionPtr &conn);
+
+    bool zscanCommand(const std::deque <RedisObjectPtr> &obj,
+                      const SessionPtr &session, const TcpConnectionPtr &conn);
+
+    bool scanGenericCommand(const std::deque <RedisObjectPtr> &obj,
+                            const SessionPtr &session, const TcpConnectionPtr &conn, int32_t type);
+
     bool bgsaveCommand(const std::deque <RedisObjectPtr> &obj,
                        const SessionPtr &session, const TcpConnectionPtr &conn);
 
+    bool bgrewriteaofCommand(const std::deque <RedisObjectPtr> &obj,
+                             const SessionPtr &session, const TcpConnectionPtr &conn);
+
     bool memoryCommand(const std::deque <RedisObjectPtr> &obj,
                        const SessionPtr &session, const TcpConnectionPtr &conn);
 
@@ -249,13 +343,14 @@ public:
 
     bool save(const SessionPtr &session, const TcpConnectionPtr &conn);
 
-    bool removeCommand(const RedisObjectPtr &obj);
+    /* 'lazy' hands a big value to the lazy free thread, see LazyFree. */
+    bool removeCommand(const RedisObjectPtr &obj, bool lazy = false);
 
     bool clearClusterMigradeCommand();
 
     void clearFork();
 
-    void clearCommand();
+    void clearCommand(bool lazy = false);
 
     void clearSessionState(int32_t sockfd);
 
@@ -263,7 +358,12 @@ public:
 
     void clearClusterState(int32_t sockfd);
 
-    void clearPubSubState(int32_t sockfd);
+    void clearPubSubState(const TcpConnectionPtr &conn);
+
+    /* One [kind, name, count] reply of (P)SUBSCRIBE or (P)UNSUBSCRIBE, a
+     * nullptr name is sent as a null bulk. */
+    void addReplyPubSub(Buffer *buffer, const RedisObjectPtr &kind,
+                        const RedisObjectPtr &name, size_t count);
 
     void clearMonitorState(int32_t sockfd);
 
@@ -275,14 +375,20 @@ public:
 
     void structureRedisProtocol(Buffer &buffer, std::deque <RedisObjectPtr> &robjs);
 
-    void setExpire(const RedisObjectPtr &key, double when);
-
-    bool checkCommand(const RedisObjectPtr &cmd);
+    void setExpire(const RedisObjectPtr &key, int64_t when);
 
     EventLoop *getEventLoop() { return &loop; }
 
     Rdb *getRdb() { return &rdb; }
 
+    Aof *getAof() { return &aof; }
+
+    Evict *getEvict() { return &evict; }
+
+    LazyFree *getLazyFree() { return &lazyfree; }
+
+    CommandStats *getCommandStats() { return &commandStats; }
+
     Cluster *getCluster() { return &clus; }
 
     Replication *getReplication() { return &repli; }
@@ -297,12 +403,13 @@ public:
 
     int16_t getPort() { return port; }
 
-    bool getClusterMap(const RedisObjectPtr &command);
-
-    auto &getHandlerCommandMap() { return handlerCommands; }
 
     auto &getRedisShards() { return redisShards; }
 
+    /* Lock a shard for a command handler. A script holds the shards of its
+     * keys while it calls the handlers, then the lock is left alone. */
+    std::unique_lock <std::mutex> lockShard(size_t index);
+
     auto &getSession() { return sessions; }
 
     auto &getSessionConn() { return sessionConns; }
@@ -313,39 +420,62 @@ public:
 
     auto &getSlaveConn() { return slaveConns; }
 
-    auto &getExpireTimer() { return expireTimers; }
-
     auto &getClusterMutex() { return clusterMutex; }
 
     auto &getSlaveMutex() { return slaveMutex; }
 
-    auto &getExpireMutex() { return expireMutex; }
-
     auto &getMutex() { return mtx; }
 
-    auto &getForkMutex() { return forkMutex; }
-
-    auto &pubSubMutex() { return pubsubMutex; }
-
 public:
     const static int32_t kShards = 1024;
-    typedef std::function<bool(const std::deque <RedisObjectPtr> &,
-                               const SessionPtr &, const TcpConnectionPtr &)> CommandFunc;
-    typedef std::unordered_map <RedisObjectPtr,
-    RedisObjectPtr, Hash, Equal> StringMap;
-    typedef std::unordered_map <RedisObjectPtr, std::unordered_map<RedisObjectPtr,
-            RedisObjectPtr, Hash, Equal>, Hash, Equal> HashMap;
-    typedef std::unordered_map <RedisObjectPtr,
-    std::deque<RedisObjectPtr>, Hash, Equal> ListMap;
-    typedef std::unordered_map<RedisObjectPtr, double, Hash, Equal> SortIndexMap;
-    typedef std::multimap<double, RedisObjectPtr> SortMap;
-    typedef std::unordered_map <RedisObjectPtr,
-    std::pair<SortIndexMap, SortMap>, Hash, Equal> ZsetMap;
-    typedef std::unordered_map <RedisObjectPtr,
-    std::unordered_set<RedisObjectPtr, Hash, Equal>, Hash, Equal> SetMap;
-    typedef std::unordered_set <RedisObjectPtr, Hash, Equal> RedisMap;
     typedef std::unordered_set <RedisObjectPtr, Hash, Equal> Command;
 
+    /* Shared nothing mode: every loop owns a contiguous slice of the shards.
+     * Returns true if the command was handed to the loops owning its keys,
+     * the reply is then delivered later through Session::resumeCommand and
+     * 'obj' has been consumed. Returns false if the calling loop owns every
+     * key and should run the command itself. */
+    bool forwardCommand(const RedisCommand *command,
+                        std::deque <RedisObjectPtr> &obj, const SessionPtr &session,
+                        const TcpConnectionPtr &conn, int32_t core);
+
+    /* The key deciding which loop runs the command, nullptr if none. */
+    const RedisObjectPtr *getFirstKey(const RedisCommand *command,
+                                      const std::deque <RedisObjectPtr> &obj);
+
+    int32_t getCoreIndex(EventLoop *loop) const;
+
+    int32_t getShardOwner(size_t hash) const {
+        return (hash % kShards) * coreLoops.size() / kShards;
+    }
+
+    /* Forkless BGSAVE: have the shards a write command is about to modify
+     * saved before it runs, see Rdb::rdbSnapshotShard(). */
+    void snapshotBeforeWrite(const RedisCommand *command,
+                             const std::vector <std::string_view> &argv);
+
+    /* The same for argument objects if the command writes and a snapshot
+     * is running, returns whether it did. */
+    bool snapshotBeforeWrite(const RedisCommand *command, const std::deque <RedisObjectPtr> &obj);
+
+    /* Remove a key chosen by Evict, logged and sent to the slaves as a DEL. */
+    bool evictKey(size_t index, const std::string &key);
+
+    /* Log a write that no client sent as such to the append only file and
+     * the slaves, the DEL of a key that expired or was evicted or a write
+     * of a script. Returns the offset in the append only file, 0 if off. */
+    int64_t propagate(const char *name, const std::deque <RedisObjectPtr> &obj, bool cut);
+
+    bool rdbSaveInProgress() const { return rdbChildPid != -1 || rdb.isSnapshotInProgress(); }
+
+    /* Returns once every loop has run the tasks queued before the call.
+     * Must not be called from a loop. */
+    void waitForLoops();
+
+    /* Runs 'fn' while every loop waits in between two tasks. Must not be
+     * called from a loop. */
+    void stopLoops(const std::function<void()> &fn);
+
 private:
     Redis(const Redis &);
 
@@ -356,40 +486,70 @@ private:
     std::unordered_map <int32_t, TcpConnectionPtr> slaveConns;
     std::unordered_map <int32_t, TcpConnectionPtr> clusterConns;
     std::unordered_map <int32_t, TimerPtr> repliTimers;
-    std::unordered_map <RedisObjectPtr, TimerPtr, Hash, Equal> expireTimers;
-    std::unordered_map <RedisObjectPtr,
-    std::unordered_map<int32_t, TcpConnectionPtr>, Hash, Equal> pubSubs;
     std::unordered_map <int32_t, TcpConnectionPtr> monitorConns;
-    std::unordered_map <RedisObjectPtr, CommandFunc, Hash, Equal> handlerCommands;
-    std::unordered_map <RedisObjectPtr, RedisObjectPtr, Hash, Equal> luaScipts;
 
-    Command checkCommands;
     Command stopReplis;
     Command replyCommands;
-    Command cluterCommands;
 
     struct RedisMapLock {
-        RedisMap redisMap;
-        StringMap stringMap;
-        HashMap hashMap;
-        ListMap listMap;
-        ZsetMap zsetMap;
-        SetMap setMap;
+        KeySpace keySpace;
+        ExpireWheel expireWheel;
         std::mutex mtx;
     };
 
+    bool expireIfNeeded(RedisMapLock &shard, const RedisObjectPtr &key);
+
+    /* The cursor and the MATCH, COUNT and TYPE options of the SCAN family,
+     * COUNT is how many elements a call looks at, not how many it returns. */
+    struct ScanOptions {
+        uint64_t cursor;
+        int64_t count;
+        sds pattern;   /* nullptr to match everything */
+        int32_t type;  /* -1 for every type, only SCAN takes TYPE */
+    };
+
+    /* Parses the arguments from obj[pos] on, replies with the error and
+     * returns false if they are not valid. */
+    bool parseScanOptions(const std::deque <RedisObjectPtr> &obj, size_t pos,
+                          bool allowType, ScanOptions *options, Buffer *buffer);
+
+    void addReplyScan(Buffer *buffer, uint64_t cursor, size_t count, Buffer *elements);
+
+    bool removeKey(RedisMapLock &shard, const RedisObjectPtr &key, bool lazy = false);
+
+    bool delGenericCommand(const std::deque <RedisObjectPtr> &obj,
+                           const TcpConnectionPtr &conn, bool lazy);
+
     std::array <RedisMapLock, kShards> redisShards;
+    int32_t expireShardIndex;
+    bool evictPending;
+
+    void startCores();
+
+    void postToCore(int32_t from, int32_t to, Mailbox::Functor &&cb);
+
+    void drainMailboxes(int32_t core);
+
+    bool forwardDelCommand(std::deque <RedisObjectPtr> &obj, const SessionPtr &session,
+                           const TcpConnectionPtr &conn, int32_t core, bool lazy);
+
+    int64_t removeKeys(const std::deque <RedisObjectPtr> &keys, int64_t *aofOffset, bool lazy);
+
+    const static size_t kMailboxSize = 256;
+
+    std::vector<EventLoop *> coreLoops;
+    /* coreLoops.size() squared mailboxes, the one at from * size + to carries
+     * closures from loop 'from' to loop 'to'. */
+    std::vector <std::unique_ptr<Mailbox>> mailboxes;
+    std::unique_ptr <std::atomic<bool>[]> coreNotified;
 
     EventLoop loop;
     TcpServer server;
 
     std::mutex mtx;
     std::mutex slaveMutex;
-    std::mutex expireMutex;
     std::mutex sentinelMutex;
     std::mutex clusterMutex;
-    std::mutex forkMutex;
-    std::mutex pubsubMutex;
     std::mutex monitorMutex;
 public:
     std::atomic<bool> clusterEnabled;
@@ -401,16 +561,12 @@ public:
     std::atomic<bool> clusterRepliMigratEnabled;
     std::atomic<bool> clusterRepliImportEnabeld;
     std::atomic<bool> forkEnabled;
+    std::atomic<bool> forklessEnabled;
     std::atomic<bool> monitorEnabled;
+    std::atomic<bool> sharedNothingEnabled;
 
-    std::atomic <int32_t> forkCondWaitCount;
     std::atomic <int32_t> rdbChildPid;
-    std::atomic <int32_t> salveCount;
-
-    std::condition_variable expireCondition;
-    std::condition_variable forkCondition;
 
-    Buffer slaveCached;
     Buffer clusterMigratCached;
     Buffer clusterImportCached;
 
@@ -421,19 +577,23 @@ public:
     std::string master;
     std::string slave;
 
-#ifdef _LUA
-    lua_State *lua;
-#endif
     int16_t port;
     int16_t threadCount;
     int32_t masterPort;
     int32_t dbnum;
-    int32_t slavefd;
     int32_t masterfd;
 private:
     Replication repli;
     Cluster clus;
     Rdb rdb;
+    Aof aof;
+    Evict evict;
+    LazyFree lazyfree;
+    CommandStats commandStats;
+    PubSub pubsub;
+#ifdef _LUA
+    Scripting scripting;
+#endif
 };
 
 
@@ -4,16 +4,30 @@
 
 Replication::Replication(Redis *redis)
         : redis(redis),
+          client(nullptr),
+          fp(nullptr),
           port(0),
+          replState(REPL_STATE_NONE),
           salveLen(0),
           salveReadLen(0),
           slaveSyncEnabled(false),
-          client(nullptr) {
-
+          masterCached(false),
+          replOffset(0),
+          backlog(nullptr),
+          backlogSize(REDIS_DEFAULT_REPL_BACKLOG_SIZE),
+          backlogIdx(0),
+          backlogHistlen(0),
+          backlogOff(0),
+          noSlavesSince(time(nullptr)),
+          syncFull(0),
+          syncPartialOk(0),
+          syncPartialErr(0) {
+    getRandomHexChars(replid, REDIS_RUN_ID_SIZE);
+    replid[REDIS_RUN_ID_SIZE] = '\0';
 }
 
 Replication::~Replication() {
-
+    zfree(backlog);
 }
 
 void Replication::connectMaster() {
@@ -30,15 +44,21 @@ void Replication::disConnect() {
     client->disConnect();
 }
 
+/* Ask for the stream from where the data set left off, the master falls
+ * back to a full resync if it does not know the id or lost that part. */
 void Replication::syncWrite(const TcpConnectionPtr &conn) {
-    char tmpfile[256];
-    snprintf(tmpfile, 256, "temp-%d.rdb", std::this_thread::get_id());
-    fp = ::fopen(tmpfile, "w");
-    if (!fp) {
-        LOG_TRACE << "Failed opening .rdb for saving:" << strerror(errno);
-        return;
+    char buf[128];
+    int32_t len;
+    {
+        std::unique_lock <std::mutex> lck(redis->getSlaveMutex());
+        if (masterCached) {
+            len = snprintf(buf, sizeof(buf), "PSYNC %s %lld\r\n", replid, (long long) replOffset + 1);
+        } else {
+            len = snprintf(buf, sizeof(buf), "PSYNC ? -1\r\n");
+        }
     }
-    conn->send("sync\r\n", 6);
+    replState = REPL_STATE_RECEIVE_PSYNC;
+    conn->send(buf, len);
 }
 
 void Replication::syncWithMaster(const TcpConnectionPtr &conn) {
@@ -58,84 +78,159 @@ void Replication::syncWithMaster(const TcpConnectionPtr &conn) {
 }
 
 void Replication::close() {
-    ::fclose(fp);
+    if (fp != nullptr) {
+        ::fclose(fp);
+        fp = nullptr;
+    }
     salveLen = 0;
     repliConn->forceClose();
 }
 
-void Replication::readCallback(const TcpConnectionPtr &conn, Buffer *buffer) {
-    while (buffer->readableBytes() >= sizeof(int32_t)) {
-        if (salveLen == 0) {
-            salveLen = buffer->peekInt32();
-            buffer->retrieveInt32();
-            if (buffer->readableBytes() == 0) {
-                break;
-            }
-        }
+/* +FULLRESYNC <replid> <offset> is followed by the RDB, +CONTINUE by the
+ * part of the stream the slave missed. */
+bool Replication::readPsyncReply(const TcpConnectionPtr &conn, Buffer *buffer) {
+    const char *eol = buffer->findCRLF();
+    if (eol == nullptr) {
+        return false;
+    }
 
-        int32_t status = redis->getRdb()->rdbSyncWrite(buffer->peek(),
-                                                       fp, buffer->readableBytes());
-        assert(status != REDIS_ERR);
+    std::string reply(buffer->peek(), eol);
+    buffer->retrieveUntil(eol + 2);
 
-        salveReadLen += buffer->readableBytes();
-        buffer->retrieveAll();
+    char id[REDIS_RUN_ID_SIZE + 1];
+    long long offset;
+    if (sscanf(reply.c_str(), "+FULLRESYNC %40s %lld", id, &offset) == 2 &&
+        strlen(id) == REDIS_RUN_ID_SIZE) {
+        char tmpfile[256];
+        snprintf(tmpfile, 256, "temp-%d.rdb", std::this_thread::get_id());
+        fp = ::fopen(tmpfile, "w");
+        if (!fp) {
+            LOG_WARN << "Failed opening .rdb for saving:" << strerror(errno);
+            conn->forceClose();
+            return false;
+        }
 
-        assert(salveReadLen <= salveLen);
-        if (salveLen == salveReadLen) {
-            redis->getRdb()->rdbSyncClose(REDIS_DEFAULT_RDB_FILENGTHAME, fp);
-            redis->clearCommand();
+        {
+            std::unique_lock <std::mutex> lck(redis->getSlaveMutex());
+            memcpy(replid, id, sizeof(id));
+            replOffset = offset;
+            masterCached = true;
+        }
+        salveLen = 0;
+        salveReadLen = 0;
+        replState = REPL_STATE_TRANSFER;
+        LOG_INFO << "Full resync from master: " << id << ":" << offset;
+        return true;
+    }
 
-            assert(redis->getRdb()->rdbLoad(REDIS_DEFAULT_RDB_FILENGTHAME) != REDIS_ERR);
-            std::shared_ptr <Session> session(new Session(redis, conn));
+    if (!strncmp(reply.c_str(), "+CONTINUE", 9)) {
+        replState = REPL_STATE_CONNECTED;
+        LOG_INFO << "Successful partial resynchronization with master at offset " << replOffset;
+        masterOnline(conn);
+        if (buffer->readableBytes() > 0) {
+            auto &sessions = redis->getSession();
+            SessionPtr session;
             {
                 std::unique_lock <std::mutex> lck(redis->getMutex());
-                auto &sessions = redis->getSession();
-                sessions[conn->getSockfd()] = session;
-                auto &sessionConns = redis->getSessionConn();
-                sessionConns[conn->getSockfd()] = conn;
+                session = sessions[conn->getSockfd()];
             }
+            session->readCallback(conn, buffer);
+        }
+        return false;
+    }
 
-            conn->send(shared.ok->ptr, sdslen(shared.ok->ptr));
-            LOG_INFO << "Replication load rdb success";
+    LOG_WARN << "Unexpected reply to PSYNC from master: " << reply;
+    conn->forceClose();
+    return false;
+}
+
+/* The connection to the master is served like a client from now on, the
+ * stream it sends is executed by a session. */
+void Replication::masterOnline(const TcpConnectionPtr &conn) {
+    std::shared_ptr <Session> session(new Session(redis, conn));
+    std::unique_lock <std::mutex> lck(redis->getMutex());
+    auto &sessions = redis->getSession();
+    sessions[conn->getSockfd()] = session;
+    auto &sessionConns = redis->getSessionConn();
+    sessionConns[conn->getSockfd()] = conn;
+}
+
+void Replication::readCallback(const TcpConnectionPtr &conn, Buffer *buffer) {
+    if (replState == REPL_STATE_RECEIVE_PSYNC && !readPsyncReply(conn, buffer)) {
+        return;
+    }
+
+    if (replState != REPL_STATE_TRANSFER) {
+        return;
+    }
+
+    if (salveLen == 0) {
+        if (buffer->readableBytes() < sizeof(int32_t)) {
+            return;
         }
+
+        salveLen = buffer->peekInt32();
+        buffer->retrieveInt32();
+    }
+
+    size_t len = std::min<size_t>(buffer->readableBytes(), salveLen - salveReadLen);
+    if (len > 0) {
+        int32_t status = redis->getRdb()->rdbSyncWrite(buffer->peek(), fp, len);
+        assert(status != REDIS_ERR);
+        salveReadLen += len;
+        buffer->retrieve(len);
+    }
+
+    if (salveLen == salveReadLen) {
+        redis->getRdb()->rdbSyncClose(REDIS_DEFAULT_RDB_FILENGTHAME, fp);
+        fp = nullptr;
+        redis->clearCommand();
+
+        assert(redis->getRdb()->rdbLoad(REDIS_DEFAULT_RDB_FILENGTHAME) != REDIS_ERR);
+        replState = REPL_STATE_CONNECTED;
+        masterOnline(conn);
+        conn->send(shared.ok->ptr, sdslen(shared.ok->ptr));
+        LOG_INFO << "Replication load rdb success";
     }
 }
 
 void Replication::slaveCallback(const TcpConnectionPtr &conn, Buffer *buffer) {
-    while (buffer->readableBytes() >= sdslen(shared.ok->ptr)) {
+    if (buffer->readableBytes() < sdslen(shared.ok->ptr)) {
+        return;
+    }
+
+    if (memcmp(buffer->peek(), shared.ok->ptr, sdslen(shared.ok->ptr)) != 0) {
+        LOG_WARN << "Unexpected reply from slave after the snapshot";
+        conn->forceClose();
+        return;
+    }
+    buffer->retrieve(sdslen(shared.ok->ptr));
+
+    {
         std::unique_lock <std::mutex> lck(redis->getSlaveMutex());
-        auto &salveConn = redis->getSlaveConn();
-        auto it = salveConn.find(conn->getSockfd());
-        if (it != salveConn.end()) {
-            if (memcmp(buffer->peek(), shared.ok->ptr, sdslen(shared.ok->ptr)) == 0) {
-                buffer->retrieve(sdslen(shared.ok->ptr));
-                if (++redis->salveCount >= salveConn.size()) {
-                    if (redis->slaveCached.readableBytes() > 0) {
-                        conn->send(&redis->slaveCached);
-                        Buffer buffer;
-                        redis->slaveCached.swap(buffer);
-                    }
-
-                    auto &repliTimer = redis->getRepliTimer();
-                    auto iter = repliTimer.find(conn->getSockfd());
-                    assert(iter != repliTimer.end());
-                    assert(iter->second != nullptr);
-                    conn->getLoop()->cancelAfter(iter->second);
-                    repliTimer.erase(conn->getSockfd());
-
-                    {
-                        std::shared_ptr <Session> session(new Session(redis, conn));
-                        auto &sessions = redis->getSession();
-                        std::unique_lock <std::mutex> lck(redis->getMutex());
-                        sessions[conn->getSockfd()] = session;
-                        auto &sessionConns = redis->getSessionConn();
-                        sessionConns[conn->getSockfd()] = conn;
-                    }
-                    LOG_INFO << "Slaveof sync success";
-                }
-            }
+        auto &repliTimer = redis->getRepliTimer();
+        auto iter = repliTimer.find(conn->getSockfd());
+        if (iter != repliTimer.end()) {
+            conn->getLoop()->cancelAfter(iter->second);
+            repliTimer.erase(iter);
+        }
+
+        if (!syncSlaveOnline(conn)) {
+            LOG_WARN << "Slave acknowledged a snapshot it was not sent";
+            conn->forceClose();
+            return;
         }
     }
+
+    {
+        std::shared_ptr <Session> session(new Session(redis, conn));
+        auto &sessions = redis->getSession();
+        std::unique_lock <std::mutex> lck(redis->getMutex());
+        sessions[conn->getSockfd()] = session;
+        auto &sessionConns = redis->getSessionConn();
+        sessionConns[conn->getSockfd()] = conn;
+    }
+    LOG_INFO << "Slaveof sync success";
 }
 
 void Replication::connCallback(const TcpConnectionPtr &conn) {
@@ -161,11 +256,22 @@ void Replication::connCallback(const TcpConnectionPtr &conn) {
         repliConn = nullptr;
         salveReadLen = 0;
         salveLen = 0;
+        if (fp != nullptr) {
+            ::fclose(fp);
+            fp = nullptr;
+        }
+        replState = REPL_STATE_NONE;
         redis->masterHost.clear();
         redis->masterPort = 0;
         redis->masterfd = 0;
         redis->slaveEnabled = false;
         redis->repliEnabled = false;
+        {
+            /* Only there if the link was up. */
+            std::unique_lock <std::mutex> lck(redis->getMutex());
+            redis->getSession().erase(conn->getSockfd());
+            redis->getSessionConn().erase(conn->getSockfd());
+        }
         LOG_INFO << "connect master disconnect";
     }
 }
@@ -183,15 +289,276 @@ void Replication::replicationSetMaster(const RedisObjectPtr &obj, int16_t port)
         }
     }
 
+    this->ip = obj->ptr;
+    this->port = port;
+    /* A new master knows nothing of the stream this one has. */
+    masterCached = false;
+
     TcpClientPtr client(new TcpClient(loop, ip.c_str(), port, this));
     client->setConnectionCallback(std::bind(&Replication::connCallback,
                                             this, std::placeholders::_1));
     client->setMessageCallback(std::bind(&Replication::readCallback,
                                          this, std::placeholders::_1, std::placeholders::_2));
+    /* Reconnect after a broken link, PSYNC then picks up where it was. */
+    client->enableRetry();
+    this->client = client;
     client->connect();
+}
 
-    this->ip = obj->ptr;
-    this->port = port;
-    this->client = client;
+void Replication::createBacklog() {
+    backlog = (char *) zmalloc(backlogSize);
+    backlogIdx = 0;
+    backlogHistlen = 0;
+    /* The next byte fed is the first one the backlog holds. */
+    backlogOff = replOffset + 1;
+}
+
+void Replication::setBacklogSize(int64_t size) {
+    size = std::max<int64_t>(size, REDIS_REPL_BACKLOG_MIN_SIZE);
+    if (size == backlogSize) {
+        return;
+    }
+
+    backlogSize = size;
+    if (backlog != nullptr) {
+        /* What it holds is lost, slaves have to resync in full. */
+        zfree(backlog);
+        createBacklog();
+    }
+}
+
+/* Like a master with no slaves for a long time, drop the backlog and stop
+ * producing the stream. A new id tells slaves that come back that the
+ * offsets they have no longer mean anything. */
+void Replication::freeBacklogIfIdle() {
+    if (backlog == nullptr || !redis->getSlaveConn().empty() || !syncSlaves.empty()) {
+        noSlavesSince = time(nullptr);
+        return;
+    }
+
+    if (time(nullptr) - noSlavesSince < REDIS_DEFAULT_REPL_BACKLOG_TIME_LIMIT) {
+        return;
+    }
+
+    LOG_INFO << "Replication backlog freed after " << REDIS_DEFAULT_REPL_BACKLOG_TIME_LIMIT
+             << " seconds without slaves";
+    zfree(backlog);
+    backlog = nullptr;
+    backlogHistlen = 0;
+    redis->repliEnabled = false;
+    getRandomHexChars(replid, REDIS_RUN_ID_SIZE);
+}
+
+void Replication::feedSlaves(const char *buf, size_t len) {
+    if (backlog == nullptr) {
+        return;
+    }
+
+    replOffset += len;
+    const char *p = buf;
+    size_t remaining = len;
+    while (remaining > 0) {
+        size_t thislen = std::min<size_t>(backlogSize - backlogIdx, remaining);
+        memcpy(backlog + backlogIdx, p, thislen);
+        backlogIdx += thislen;
+        if (backlogIdx == backlogSize) {
+            backlogIdx = 0;
+        }
+        remaining -= thislen;
+        p += thislen;
+        backlogHistlen += thislen;
+    }
+
+    if (backlogHistlen > backlogSize) {
+        backlogHistlen = backlogSize.load();
+    }
+    backlogOff = replOffset - backlogHistlen + 1;
+
+    for (auto it = syncSlaves.begin(); it != syncSlaves.end();) {
+        if (it->second.offset < 0) {
+            ++it;
+            continue;
+        }
+
+        if (it->second.pending.readableBytes() + len > REDIS_REPL_SYNC_BUFFER_LIMIT) {
+            LOG_WARN << "Slave fell too far behind while loading the snapshot, closing it";
+            it->second.conn->forceClose();
+            syncSlaves.erase(it++);
+            continue;
+        }
+        it->second.pending.append(buf, len);
+        ++it;
+    }
+
+    /* Always queued, even on the loop of the slave, so that the stream
+     * reaches every slave in the order it went into the backlog. The slaves
+     * of a loop share one copy of the data and get it with one push. */
+    std::shared_ptr <std::string> data;
+    for (auto &it : redis->getSlaveConn()) {
+        TcpConnectionPtr conn = it.second;
+        if (data == nullptr) {
+            data = std::make_shared<std::string>(buf, len);
+        }
+
+        EventLoop *slaveLoop = conn->getLoop();
+        auto batch = std::find_if(feedBatches.begin(), feedBatches.end(),
+                                  [slaveLoop](const auto &b) { return b.first == slaveLoop; });
+        if (batch == feedBatches.end()) {
+            feedBatches.push_back(std::make_pair(slaveLoop, std::unique_ptr<TaskQueue::Batch>(
+                    new TaskQueue::Batch(slaveLoop->getTaskQueue()))));
+            batch = feedBatches.end() - 1;
+        }
+
+        batch->second->add([conn, data]() {
+            conn->sendInLoop(*data);
+        });
+    }
+
+    for (auto &it : feedBatches) {
+        it.first->queueInLoop(*it.second);
+    }
+}
+
+void Replication::addReplyBacklog(Buffer *buffer, int64_t offset) {
+    int64_t skip = offset - backlogOff;
+    /* Index of the oldest byte, then of the first one to send. */
+    int64_t j = (backlogIdx + (backlogSize - backlogHistlen)) % backlogSize;
+    j = (j + skip) % backlogSize;
+
+    int64_t len = backlogHistlen - skip;
+    while (len > 0) {
+        int64_t thislen = std::min<int64_t>(backlogSize - j, len);
+        buffer->append(backlog + j, thislen);
+        len -= thislen;
+        j = 0;
+    }
+}
+
+bool Replication::tryPartialResync(const TcpConnectionPtr &conn, const char *replid, int64_t offset) {
+    if (replid[0] == '?') {
+        LOG_INFO << "Full resync requested by slave";
+        return false;
+    }
+
+    if (strcasecmp(replid, this->replid) != 0) {
+        syncPartialErr++;
+        LOG_INFO << "Partial resynchronization not accepted: replication id mismatch";
+        return false;
+    }
+
+    if (backlog == nullptr || offset < backlogOff || offset > backlogOff + backlogHistlen) {
+        syncPartialErr++;
+        LOG_INFO << "Unable to partial resync with the slave, lack of backlog (slave request was: "
+                 << offset << ")";
+        return false;
+    }
+
+    Buffer *buffer = conn->outputBuffer();
+    buffer->append("+CONTINUE ", 10);
+    buffer->append(this->replid, REDIS_RUN_ID_SIZE);
+    buffer->append("\r\n", 2);
+    int64_t before = buffer->readableBytes();
+    addReplyBacklog(buffer, offset);
+    LOG_INFO << "Partial resynchronization request accepted. Sending "
+             << buffer->readableBytes() - before << " bytes of backlog starting from offset " << offset;
+
+    syncPartialOk++;
+    slaveOnline(conn);
+    return true;
+}
+
+void Replication::slaveOnline(const TcpConnectionPtr &conn) {
+    syncSlaves.erase(conn->getSockfd());
+    redis->getSlaveConn()[conn->getSockfd()] = conn;
+    redis->repliEnabled = true;
+}
+
+void Replication::addSyncSlave(const TcpConnectionPtr &conn, bool psync) {
+    /* From now on the stream is produced and kept in the backlog, a slave
+     * that loses the link later continues from there. */
+    if (backlog == nullptr) {
+        createBacklog();
+    }
+
+    SyncSlave &slave = syncSlaves[conn->getSockfd()];
+    slave.conn = conn;
+    slave.psync = psync;
+    slave.sent = false;
+    slave.offset = -1;
+    redis->repliEnabled = true;
+}
+
+bool Replication::hasSyncSlaves() const {
+    for (auto &it : syncSlaves) {
+        if (it.second.offset < 0) {
+            return true;
+        }
+    }
+    return false;
 }
 
+int64_t Replication::snapshotCut() {
+    for (auto &it : syncSlaves) {
+        if (it.second.offset < 0) {
+            it.second.offset = replOffset;
+        }
+    }
+    return replOffset;
+}
+
+bool Replication::syncSlaveOnline(const TcpConnectionPtr &conn) {
+    auto it = syncSlaves.find(conn->getSockfd());
+    if (it == syncSlaves.end() || !it->second.sent) {
+        return false;
+    }
+
+    conn->send(&it->second.pending);
+    slaveOnline(conn);
+    return true;
+}
+
+void Replication::removeSlave(int32_t sockfd) {
+    syncSlaves.erase(sockfd);
+}
+
+void Replication::sendSnapshot(const char *filename, int64_t offset, bool success) {
+    std::vector <std::pair<TcpConnectionPtr, bool>> slaves;
+    {
+        std::unique_lock <std::mutex> lck(redis->getSlaveMutex());
+        for (auto it = syncSlaves.begin(); it != syncSlaves.end();) {
+            if (it->second.offset != offset || it->second.sent) {
+                ++it;
+                continue;
+            }
+
+            slaves.push_back(std::make_pair(it->second.conn, it->second.psync));
+            if (success) {
+                it->second.sent = true;
+                ++it;
+            } else {
+                syncSlaves.erase(it++);
+            }
+        }
+    }
+
+    char header[128];
+    for (auto &it : slaves) {
+        if (!success) {
+            it.first->forceClose();
+            continue;
+        }
+
+        int32_t len = 0;
+        if (it.second) {
+            len = snprintf(header, sizeof(header), "+FULLRESYNC %s %lld\r\n", replid, (long long) offset);
+        }
+
+        if (!redis->getRdb()->rdbReplication(filename, it.first, std::string_view(header, len))) {
+            it.first->forceClose();
+            LOG_WARN << "Master sync send failure";
+        } else {
+            syncFull++;
+            LOG_INFO << "Master sync send success, snapshot at offset " << offset;
+        }
+    }
+}
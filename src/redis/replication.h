@@ -35,11 +35,79 @@ public:
 
     void close();
 
+    /* Master side. The replication stream is kept in a circular backlog
+     * and every slave knows its offset in it, so a slave that lost the
+     * connection continues from there as long as the backlog still holds
+     * that part of the stream. All of these are called with
+     * Redis::slaveMutex held. */
+    void feedSlaves(const char *buf, size_t len);
+
+    /* Answers PSYNC with +CONTINUE and the missing part of the stream if
+     * the backlog has it, then the slave is online. */
+    bool tryPartialResync(const TcpConnectionPtr &conn, const char *replid, int64_t offset);
+
+    /* The slave waits for the next replication snapshot. */
+    void addSyncSlave(const TcpConnectionPtr &conn, bool psync);
+
+    bool hasSyncSlaves() const;
+
+    /* Called with every loop stopped when the replication snapshot is
+     * taken. The slaves waiting for it keep the stream from here on until
+     * they loaded the snapshot. Returns the offset of the snapshot. */
+    int64_t snapshotCut();
+
+    /* Called once the slave loaded the snapshot, it is sent the stream
+     * kept since the cut. Returns false if it was not sent a snapshot. */
+    bool syncSlaveOnline(const TcpConnectionPtr &conn);
+
+    void removeSlave(int32_t sockfd);
+
+    /* Called by the snapshot thread without the mutex once 'filename'
+     * holds the data set as of replication offset 'offset'. */
+    void sendSnapshot(const char *filename, int64_t offset, bool success);
+
+    void setBacklogSize(int64_t size);
+
+    void freeBacklogIfIdle();
+
+    const char *getReplid() const { return replid; }
+
+    bool isBacklogActive() const { return backlog != nullptr; }
+
+    int64_t getReplOffset() const { return replOffset; }
+
+    int64_t getBacklogSize() const { return backlogSize; }
+
+    int64_t getBacklogOffset() const { return backlogOff; }
+
+    int64_t getBacklogHistlen() const { return backlogHistlen; }
+
+    int64_t getSyncFull() const { return syncFull; }
+
+    int64_t getSyncPartialOk() const { return syncPartialOk; }
+
+    int64_t getSyncPartialErr() const { return syncPartialErr; }
+
+    int32_t getReplState() const { return replState; }
+
+    /* Slave side, bytes of the stream the master sent that were applied. */
+    void addReplOffset(int64_t len) { replOffset += len; }
+
 private:
     Replication(const Replication &);
 
     void operator=(const Replication &);
 
+    void createBacklog();
+
+    void addReplyBacklog(Buffer *buffer, int64_t offset);
+
+    bool readPsyncReply(const TcpConnectionPtr &conn, Buffer *buffer);
+
+    void masterOnline(const TcpConnectionPtr &conn);
+
+    void slaveOnline(const TcpConnectionPtr &conn);
+
     Redis *redis;
     EventLoop *loop;
     TcpClientPtr client;
@@ -54,5 +122,35 @@ private:
     std::atomic <int32_t> salveLen;
     std::atomic <int32_t> salveReadLen;
     std::atomic<bool> slaveSyncEnabled;
+    /* The id and offset are the ones of the master, worth a PSYNC. */
+    std::atomic<bool> masterCached;
+
+    /* Id and offset of the replication stream, the ones of the master on
+     * a slave. */
+    char replid[REDIS_RUN_ID_SIZE + 1];
+    std::atomic <int64_t> replOffset;
+
+    struct SyncSlave {
+        TcpConnectionPtr conn;
+        bool psync;
+        bool sent;
+        int64_t offset; /* Of the snapshot, -1 before the cut */
+        Buffer pending; /* The stream since the cut */
+    };
+    std::unordered_map <int32_t, SyncSlave> syncSlaves;
+
+    /* Tasks of feedSlaves() for each loop with slaves, kept between calls. */
+    std::vector <std::pair<EventLoop *, std::unique_ptr<TaskQueue::Batch>>> feedBatches;
+
+    char *backlog;
+    std::atomic <int64_t> backlogSize;
+    int64_t backlogIdx;                   /* Next byte to write */
+    std::atomic <int64_t> backlogHistlen; /* Valid bytes */
+    std::atomic <int64_t> backlogOff;     /* Replication offset of the first valid byte */
+    int64_t noSlavesSince;
+
+    std::atomic <int64_t> syncFull;
+    std::atomic <int64_t> syncPartialOk;
+    std::atomic <int64_t> syncPartialErr;
 };
 
@@ -0,0 +1,237 @@
+#include "resp.h"
+#include "util.h"
+
+RespParser::RespParser()
+        : reqtype(0),
+          multibulklen(0),
+          bulklen(-1),
+          pos(0),
+          inlineArgv(nullptr),
+          inlineArgc(0) {
+    argv.reserve(8);
+    offsets.reserve(8);
+}
+
+RespParser::~RespParser() {
+    freeInlineArgv();
+}
+
+void RespParser::freeInlineArgv() {
+    if (inlineArgv) {
+        sdsfreesplitres(inlineArgv, inlineArgc);
+        inlineArgv = nullptr;
+        inlineArgc = 0;
+    }
+}
+
+void RespParser::setArgv(const char *base) {
+    argv.clear();
+    if (offsets.empty()) {
+        command = std::string_view();
+        return;
+    }
+
+    command = std::string_view(base + offsets[0].first, offsets[0].second);
+    for (size_t i = 1; i < offsets.size(); i++) {
+        argv.emplace_back(base + offsets[i].first, offsets[i].second);
+    }
+}
+
+void RespParser::consume(Buffer *buffer) {
+    assert(pos <= buffer->readableBytes());
+    buffer->retrieve(pos);
+    reset();
+}
+
+void RespParser::reset() {
+    pos = 0;
+    reqtype = 0;
+    multibulklen = 0;
+    bulklen = -1;
+    offsets.clear();
+    argv.clear();
+    command = std::string_view();
+    error.clear();
+    freeInlineArgv();
+}
+
+int32_t RespParser::parse(Buffer *buffer) {
+    if (buffer->readableBytes() == 0) {
+        return REDIS_ERR;
+    }
+
+    /* Determine request type when unknown. */
+    if (!reqtype) {
+        if (buffer->peek()[0] == '*') {
+            reqtype = REDIS_REQ_MULTIBULK;
+        } else {
+            reqtype = REDIS_REQ_INLINE;
+        }
+    }
+
+    if (reqtype == REDIS_REQ_MULTIBULK) {
+        return parseMultibulk(buffer);
+    } else {
+        return parseInline(buffer);
+    }
+}
+
+/* Like parseMultibulk(), but for the inline protocol instead of RESP. An
+ * empty line is returned as a command with an empty name. */
+int32_t RespParser::parseInline(Buffer *buffer) {
+    const char *queryBuf = buffer->peek();
+    size_t linefeedChars = 1;
+
+    /* Search for end of line */
+    const char *newline = buffer->findEOL();
+
+    /* Nothing to do without a \r\n */
+    if (newline == nullptr) {
+        if (buffer->readableBytes() > REDIS_INLINE_MAX_SIZE) {
+            error = "Protocol error: too big inline request";
+        }
+        return REDIS_ERR;
+    }
+
+    /* Handle the \r\n case. */
+    if (newline != queryBuf && *(newline - 1) == '\r') {
+        newline--;
+        linefeedChars++;
+    }
+
+    size_t queryLen = newline - queryBuf;
+    pos = queryLen + linefeedChars;
+    offsets.clear();
+
+    /* Quoted arguments need unescaping, leave them to sdssplitargs(). */
+    if (memchr(queryBuf, '"', queryLen) || memchr(queryBuf, '\'', queryLen)) {
+        sds aux = sdsnewlen(queryBuf, queryLen);
+        inlineArgv = sdssplitargs(aux, &inlineArgc);
+        sdsfree(aux);
+
+        if (inlineArgv == nullptr) {
+            error = "Protocol error: unbalanced quotes in request";
+            return REDIS_ERR;
+        }
+
+        argv.clear();
+        command = std::string_view();
+        for (int32_t j = 0; j < inlineArgc; j++) {
+            std::string_view arg(inlineArgv[j], sdslen(inlineArgv[j]));
+            if (j == 0) {
+                command = arg;
+            } else {
+                argv.push_back(arg);
+            }
+        }
+        return REDIS_OK;
+    }
+
+    const char *p = queryBuf;
+    while (true) {
+        while (p < newline && isspace(*p)) {
+            p++;
+        }
+
+        if (p == newline) {
+            break;
+        }
+
+        const char *start = p;
+        while (p < newline && !isspace(*p)) {
+            p++;
+        }
+        offsets.emplace_back(start - queryBuf, p - start);
+    }
+
+    setArgv(queryBuf);
+    return REDIS_OK;
+}
+
+/* Read as much of a multibulk request as the buffer holds. Every argument
+ * that is complete is remembered as an offset so that the next call resumes
+ * where this one stopped. */
+int32_t RespParser::parseMultibulk(Buffer *buffer) {
+    const char *queryBuf = buffer->peek();
+    const char *end = buffer->beginWrite();
+    const char *newline = nullptr;
+    int64_t ll = 0;
+
+    if (multibulklen == 0) {
+        /* Multi bulk length cannot be read without a \r\n */
+        newline = buffer->findCRLF(queryBuf + pos);
+        if (newline == nullptr) {
+            if (buffer->readableBytes() > REDIS_INLINE_MAX_SIZE) {
+                error = "Protocol error: too big mbulk count string";
+            }
+            return REDIS_ERR;
+        }
+
+        /* We know for sure there is a whole line since newline != NULL,
+         * so go ahead and find out the multi bulk length. */
+        assert(queryBuf[pos] == '*');
+        if (!string2ll(queryBuf + pos + 1, newline - (queryBuf + pos + 1), &ll) ||
+            ll > REDIS_MBULK_BIG_ARG || ll <= 0) {
+            error = "Protocol error: invalid multibulk length";
+            return REDIS_ERR;
+        }
+
+        pos = newline - queryBuf + 2;
+        multibulklen = ll;
+        offsets.clear();
+    }
+
+    while (multibulklen) {
+        /* Read bulk length if unknown */
+        if (bulklen == -1) {
+            newline = buffer->findCRLF(queryBuf + pos);
+            if (newline == nullptr) {
+                break;
+            }
+
+            if (queryBuf[pos] != '$') {
+                char buf[64];
+                snprintf(buf, sizeof(buf), "Protocol error: expected '$', got '%c'", queryBuf[pos]);
+                error = buf;
+                return REDIS_ERR;
+            }
+
+            if (!string2ll(queryBuf + pos + 1, newline - (queryBuf + pos + 1), &ll) ||
+                ll < 0 || ll > REDIS_MBULK_BIG_ARG) {
+                error = "Protocol error: invalid bulk length";
+                return REDIS_ERR;
+            }
+
+            pos = newline - queryBuf + 2;
+            bulklen = ll;
+
+            /* A big argument is read into room made for all of it up front,
+             * the buffer does not grow again and again while it arrives. */
+            int32_t missing = pos + bulklen + 2 - buffer->readableBytes();
+            if (bulklen >= PROTO_MBULK_BIG_ARG && missing > 0) {
+                buffer->ensureWritableBytes(missing);
+                queryBuf = buffer->peek();
+                end = buffer->beginWrite();
+            }
+        }
+
+        /* Read bulk argument */
+        if (end - (queryBuf + pos) < bulklen + 2) {
+            break;
+        }
+
+        offsets.emplace_back(pos, bulklen);
+        pos += bulklen + 2;
+        bulklen = -1;
+        multibulklen--;
+    }
+
+    /* We're done when multibulklen == 0 */
+    if (multibulklen == 0) {
+        setArgv(queryBuf);
+        return REDIS_OK;
+    }
+
+    /* Still not ready to process the command */
+    return REDIS_ERR;
+}
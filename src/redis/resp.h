@@ -0,0 +1,69 @@
+#pragma once
+
+#include "all.h"
+#include "buffer.h"
+#include "sds.h"
+
+/* Incremental parser for client requests, both the multibulk and the inline
+ * protocol. The arguments of a complete command are handed out as slices of
+ * the input buffer, nothing is copied and nothing is allocated for a well
+ * formed request. While a command is only partially read the arguments are
+ * kept as offsets from the buffer read position, so the buffer may grow and
+ * move its storage between two reads.
+ *
+ * The slices stay valid until consume() drops the command from the buffer. */
+class RespParser {
+public:
+    RespParser();
+
+    ~RespParser();
+
+    /* Returns REDIS_OK if a whole command is ready in getCommand() and
+     * getArgv(). Returns REDIS_ERR if more input is needed, or on a protocol
+     * error, in which case getError() is not null and the connection should
+     * be closed. */
+    int32_t parse(Buffer *buffer);
+
+    /* Remove the command returned by the last successful parse() from the
+     * buffer and get ready for the next one. */
+    void consume(Buffer *buffer);
+
+    /* Forget a partially read command, used after a protocol error. */
+    void reset();
+
+    const std::string_view &getCommand() const { return command; }
+
+    /* Arguments following the command name. */
+    const std::vector <std::string_view> &getArgv() const { return argv; }
+
+    const char *getError() const { return error.empty() ? nullptr : error.c_str(); }
+
+private:
+    RespParser(const RespParser &);
+
+    void operator=(const RespParser &);
+
+    int32_t parseMultibulk(Buffer *buffer);
+
+    int32_t parseInline(Buffer *buffer);
+
+    void setArgv(const char *base);
+
+    void freeInlineArgv();
+
+    int32_t reqtype;
+    int32_t multibulklen;
+    int64_t bulklen;
+    size_t pos;
+
+    std::string_view command;
+    std::vector <std::string_view> argv;
+    /* Offset and length of every argument read so far, relative to the
+     * buffer read position. */
+    std::vector <std::pair<size_t, size_t>> offsets;
+    /* Inline requests with quotes are unescaped by sdssplitargs(), the
+     * slices then point into these strings instead of the buffer. */
+    sds *inlineArgv;
+    int32_t inlineArgc;
+    std::string error;
+};
@@ -0,0 +1,725 @@
+#include "scripting.h"
+#include "redis.h"
+
+#ifdef _LUA
+/* Handed from redis.call() to the caller of the script, like the reply
+ * buffer of TcpConnection. */
+static thread_local int64_t scriptAofOffset = 0;
+
+/* The shards of the script running on the calling thread, see lockKeys(). */
+static thread_local const std::vector <int32_t> *scriptShards = nullptr;
+
+/* When the script running on the calling thread runs out of time, 0 if it
+ * may run as long as it likes, and whether it did. */
+static thread_local int64_t scriptDeadline = 0;
+static thread_local bool scriptTimedOut = false;
+
+Scripting::Scripting(Redis *redis)
+        : redis(redis),
+          epoch(1),
+          timeLimit(LUA_TIME_LIMIT) {
+
+}
+
+Scripting::~Scripting() {
+    for (auto &it : interpreters) {
+        closeInterpreter(it.get());
+    }
+}
+
+void Scripting::setLoops(const std::vector<EventLoop *> &loops) {
+    this->loops = loops;
+    interpreters.clear();
+    for (size_t i = 0; i < loops.size(); i++) {
+        std::unique_ptr <Interpreter> in(new Interpreter());
+        in->scripting = this;
+        in->core = i;
+        interpreters.push_back(std::move(in));
+    }
+}
+
+Scripting::Interpreter *Scripting::getInterpreter() {
+    for (size_t i = 0; i < loops.size(); i++) {
+        if (loops[i]->isInLoopThread()) {
+            Interpreter *in = interpreters[i].get();
+            if (in->lua == nullptr || in->epoch != epoch) {
+                closeInterpreter(in);
+                createInterpreter(in);
+            }
+            return in;
+        }
+    }
+    return nullptr;
+}
+
+void Scripting::createInterpreter(Interpreter *in) {
+    lua_State *lua = luaL_newstate();
+    loadLibraries(lua);
+    removeUnsupportedFunctions(lua);
+
+    /* The redis table, its functions find the interpreter in an upvalue. */
+    lua_newtable(lua);
+    lua_pushstring(lua, "call");
+    lua_pushlightuserdata(lua, in);
+    lua_pushcclosure(lua, callCommand, 1);
+    lua_settable(lua, -3);
+
+    lua_pushstring(lua, "pcall");
+    lua_pushlightuserdata(lua, in);
+    lua_pushcclosure(lua, pcallCommand, 1);
+    lua_settable(lua, -3);
+    lua_setglobal(lua, "redis");
+
+    /* Add a helper function we use for pcall error reporting.
+     * Note that when the error is in the C function we want to report the
+     * information about the caller, that's what makes sense from the point
+     * of view of the user debugging a script. */
+    const char *func = "local dbg = debug\n"
+                       "function __redis__err__handler(err)\n"
+                       "  local i = dbg.getinfo(2,'nSl')\n"
+                       "  if i and i.what == 'C' then\n"
+                       "    i = dbg.getinfo(3,'nSl')\n"
+                       "  end\n"
+                       "  if i then\n"
+                       "    return i.source .. ':' .. i.currentline .. ': ' .. err\n"
+                       "  else\n"
+                       "    return err\n"
+                       "  end\n"
+                       "end\n";
+    luaL_loadbuffer(lua, func, strlen(func), "@err_handler_def");
+    lua_pcall(lua, 0, 0, 0);
+
+    /* Lua beginners often don't use "local", this is likely to introduce
+     * subtle bugs in their code. To prevent problems we protect accesses
+     * to global variables. */
+    enableGlobalsProtection(lua);
+
+    in->lua = lua;
+    in->epoch = epoch;
+}
+
+void Scripting::closeInterpreter(Interpreter *in) {
+    if (in->lua != nullptr) {
+        lua_close(in->lua);
+        in->lua = nullptr;
+    }
+    in->shas.clear();
+}
+
+void Scripting::loadLibraries(lua_State *lua) {
+    const luaL_Reg libs[] = {
+            {"",             luaopen_base},
+            {LUA_TABLIBNAME, luaopen_table},
+            {LUA_STRLIBNAME, luaopen_string},
+            {LUA_MATHLIBNAME, luaopen_math},
+            {LUA_DBLIBNAME,  luaopen_debug},
+    };
+
+    /* No package and os, for sandboxing concerns. */
+    for (auto &it : libs) {
+        lua_pushcfunction(lua, it.func);
+        lua_pushstring(lua, it.name);
+        lua_call(lua, 1, 0);
+    }
+}
+
+/* Remove the functions that we don't want to expose to the scripting
+ * environment. */
+void Scripting::removeUnsupportedFunctions(lua_State *lua) {
+    lua_pushnil(lua);
+    lua_setglobal(lua, "loadfile");
+    lua_pushnil(lua);
+    lua_setglobal(lua, "dofile");
+}
+
+/* This function installs metamethods in the global table _G that prevent
+ * the creation of globals accidentally.
+ *
+ * It should be the last to be called in the scripting engine initialization
+ * sequence, because it may interact with creation of globals. */
+void Scripting::enableGlobalsProtection(lua_State *lua) {
+    /* strict.lua from: http://metalua.luaforge.net/src/lib/strict.lua.html.
+     * Modified to be adapted to Redis. */
+    const char *code = "local dbg=debug\n"
+                       "local mt = {}\n"
+                       "setmetatable(_G, mt)\n"
+                       "mt.__newindex = function (t, n, v)\n"
+                       "  if dbg.getinfo(2) then\n"
+                       "    local w = dbg.getinfo(2, \"S\").what\n"
+                       "    if w ~= \"main\" and w ~= \"C\" then\n"
+                       "      error(\"Script attempted to create global variable '\"..tostring(n)..\"'\", 2)\n"
+                       "    end\n"
+                       "  end\n"
+                       "  rawset(t, n, v)\n"
+                       "end\n"
+                       "mt.__index = function (t, n)\n"
+                       "  if dbg.getinfo(2) and dbg.getinfo(2, \"S\").what ~= \"C\" then\n"
+                       "    error(\"Script attempted to access nonexistent global variable '\"..tostring(n)..\"'\", 2)\n"
+                       "  end\n"
+                       "  return rawget(t, n)\n"
+                       "end\n"
+                       "debug = nil\n";
+    luaL_loadbuffer(lua, code, strlen(code), "@enable_strict_lua");
+    lua_pcall(lua, 0, 0, 0);
+}
+
+int32_t Scripting::createFunction(Interpreter *in, const char *funcname,
+                                  const RedisObjectPtr &body, Buffer *buffer) {
+    sds funcdef = sdsempty();
+    funcdef = sdscat(funcdef, "function ");
+    funcdef = sdscatlen(funcdef, funcname, 42);
+    funcdef = sdscatlen(funcdef, "() ", 3);
+    funcdef = sdscatlen(funcdef, body->ptr, sdslen(body->ptr));
+    funcdef = sdscatlen(funcdef, "\nend", 4);
+
+    if (luaL_loadbuffer(in->lua, funcdef, sdslen(funcdef), "@user_script")) {
+        addReplyErrorFormat(buffer, "Error compiling script (new function): %s\n",
+                            lua_tostring(in->lua, -1));
+        lua_pop(in->lua, 1);
+        sdsfree(funcdef);
+        return REDIS_ERR;
+    }
+
+    sdsfree(funcdef);
+    if (lua_pcall(in->lua, 0, 0, 0)) {
+        addReplyErrorFormat(buffer, "Error running script (new function): %s\n",
+                            lua_tostring(in->lua, -1));
+        lua_pop(in->lua, 1);
+        return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
+
+RedisObjectPtr Scripting::registerScript(const char *sha, const RedisObjectPtr &body) {
+    RedisObjectPtr key = createStringObject((char *) sha, 40);
+    std::unique_lock <std::mutex> lck(mutex);
+    auto it = scripts.find(key);
+    if (it != scripts.end()) {
+        return it->first;
+    }
+
+    scripts.insert(std::make_pair(key, body));
+    return key;
+}
+
+RedisObjectPtr Scripting::lookupScript(const char *sha) {
+    RedisObjectPtr key = createStringObject((char *) sha, 40);
+    std::unique_lock <std::mutex> lck(mutex);
+    auto it = scripts.find(key);
+    return it == scripts.end() ? nullptr : it->second;
+}
+
+void Scripting::load(const RedisObjectPtr &body, Buffer *buffer) {
+    Interpreter *in = getInterpreter();
+    assert(in != nullptr);
+
+    char funcname[43];
+    funcname[0] = 'f';
+    funcname[1] = '_';
+    sha1hex(funcname + 2, body->ptr, sdslen(body->ptr));
+
+    lua_getglobal(in->lua, funcname);
+    bool defined = !lua_isnil(in->lua, -1);
+    lua_pop(in->lua, 1);
+    if (!defined && createFunction(in, funcname, body, buffer) == REDIS_ERR) {
+        return;
+    }
+
+    registerScript(funcname + 2, body);
+    addReplyBulkCBuffer(buffer, funcname + 2, 40);
+}
+
+bool Scripting::exists(const RedisObjectPtr &sha) {
+    if (sdslen(sha->ptr) != 40) {
+        return false;
+    }
+
+    char buf[41];
+    for (int32_t j = 0; j < 40; j++) {
+        buf[j] = tolower(sha->ptr[j]);
+    }
+    buf[40] = '\0';
+    return lookupScript(buf) != nullptr;
+}
+
+void Scripting::flush() {
+    {
+        std::unique_lock <std::mutex> lck(mutex);
+        scripts.clear();
+    }
+    epoch++;
+}
+
+int32_t Scripting::setTimeLimit(const char *value) {
+    char *end;
+    errno = 0;
+    long long n = strtoll(value, &end, 10);
+    if (errno || end == value || *end != '\0') {
+        return REDIS_ERR;
+    }
+
+    timeLimit = n;
+    return REDIS_OK;
+}
+
+int64_t Scripting::takeAofOffset() {
+    int64_t offset = scriptAofOffset;
+    scriptAofOffset = 0;
+    return offset;
+}
+
+bool Scripting::holdsShard(size_t index) {
+    return scriptShards != nullptr &&
+           std::binary_search(scriptShards->begin(), scriptShards->end(), (int32_t) index);
+}
+
+const RedisObjectPtr *Scripting::getFirstKey(const std::deque <RedisObjectPtr> &obj) {
+    int64_t numkeys;
+    if (obj.size() > 2 && string2ll(obj[1]->ptr, sdslen(obj[1]->ptr), &numkeys) && numkeys > 0) {
+        return &obj[2];
+    }
+    return nullptr;
+}
+
+/* Lock in shard order, a script waits for shards only here and any other
+ * command holds a single shard, so nobody waits in a circle. The handlers
+ * the script calls find the shards held, see Redis::lockShard(). */
+void Scripting::lockKeys(const std::deque <RedisObjectPtr> &obj, int64_t numkeys,
+                         std::vector <int32_t> *shards) {
+    for (int64_t j = 0; j < numkeys; j++) {
+        shards->push_back(obj[2 + j]->hash % Redis::kShards);
+    }
+
+    std::sort(shards->begin(), shards->end());
+    shards->erase(std::unique(shards->begin(), shards->end()), shards->end());
+    auto &redisShards = redis->getRedisShards();
+    for (auto it : *shards) {
+        redisShards[it].mtx.lock();
+    }
+    scriptShards = shards;
+}
+
+void Scripting::unlockKeys(const std::vector <int32_t> &shards) {
+    scriptShards = nullptr;
+    auto &redisShards = redis->getRedisShards();
+    for (auto it = shards.rbegin(); it != shards.rend(); ++it) {
+        redisShards[*it].mtx.unlock();
+    }
+}
+
+/* Whether the script may run the command. In shared nothing mode its keys
+ * have to be owned by the loop, otherwise they have to be in the shards
+ * the script holds, waiting for another shard could wait for a script
+ * waiting for ours. */
+bool Scripting::ownsKeys(Interpreter *in, const RedisCommand *command,
+                         const std::deque <RedisObjectPtr> &argv) {
+    if (!command->hasKeys()) {
+        /* KEYS, SCAN, DBSIZE and FLUSHDB walk every shard. */
+        return redis->sharedNothingEnabled || in->shards.empty() ||
+               !(command->flags & (CMD_WRITE | CMD_READONLY));
+    }
+
+    /* Positions count the command name, see RedisCommand. */
+    int32_t argc = argv.size() + 1;
+    int32_t last = command->lastKey < 0 ? argc + command->lastKey : command->lastKey;
+    for (int32_t j = command->firstKey; j <= last && j < argc; j += command->keyStep) {
+        size_t hash = argv[j - 1]->hash;
+        if (redis->sharedNothingEnabled ? redis->getShardOwner(hash) != in->core :
+            !std::binary_search(in->shards.begin(), in->shards.end(), hash % Redis::kShards)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Scripting::setGlobalArray(lua_State *lua, const char *var,
+                               const std::deque <RedisObjectPtr> &obj, size_t start, size_t count) {
+    lua_newtable(lua);
+    for (size_t j = 0; j < count; j++) {
+        lua_pushlstring(lua, obj[start + j]->ptr, sdslen(obj[start + j]->ptr));
+        lua_rawseti(lua, -2, j + 1);
+    }
+    lua_setglobal(lua, var);
+}
+
+bool Scripting::eval(const std::deque <RedisObjectPtr> &obj, const SessionPtr &session,
+                     const TcpConnectionPtr &conn, bool evalsha) {
+    int64_t numkeys;
+    if (getLongLongFromObjectOrReply(conn->outputBuffer(), obj[1], &numkeys, nullptr) != REDIS_OK) {
+        return true;
+    }
+
+    if (numkeys > (int64_t) obj.size() - 2) {
+        addReplyError(conn->outputBuffer(), "Number of keys can't be greater than number of args");
+        return true;
+    } else if (numkeys < 0) {
+        addReplyError(conn->outputBuffer(), "Number of keys can't be negative");
+        return true;
+    }
+
+    Interpreter *in = getInterpreter();
+    assert(in != nullptr);
+    lua_State *lua = in->lua;
+
+    /* We obtain the script SHA1, then check if this function is already
+     * defined into the Lua state */
+    char funcname[43];
+    funcname[0] = 'f';
+    funcname[1] = '_';
+    bool known = false;
+    if (evalsha) {
+        if (sdslen(obj[0]->ptr) != 40) {
+            addReply(conn->outputBuffer(), shared.noscripterr);
+            return true;
+        }
+
+        for (int32_t j = 0; j < 40; j++) {
+            char c = obj[0]->ptr[j];
+            funcname[j + 2] = (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+        }
+        funcname[42] = '\0';
+    } else {
+        auto it = in->shas.find(obj[0]);
+        if (it != in->shas.end()) {
+            memcpy(funcname + 2, it->second->ptr, 40);
+            funcname[42] = '\0';
+            known = true;
+        } else {
+            sha1hex(funcname + 2, obj[0]->ptr, sdslen(obj[0]->ptr));
+        }
+    }
+
+    /* Push the pcall error handler function on the stack. */
+    lua_getglobal(lua, "__redis__err__handler");
+
+    /* Try to lookup the Lua function */
+    lua_getglobal(lua, funcname);
+    if (lua_isnil(lua, -1)) {
+        lua_pop(lua, 1);
+
+        /* EVALSHA of a script loaded on another loop compiles it here. */
+        RedisObjectPtr body = evalsha ? lookupScript(funcname + 2) : obj[0];
+        if (body == nullptr) {
+            lua_pop(lua, 1);
+            addReply(conn->outputBuffer(), shared.noscripterr);
+            return true;
+        }
+
+        if (createFunction(in, funcname, body, conn->outputBuffer()) == REDIS_ERR) {
+            lua_pop(lua, 1);
+            return true;
+        }
+
+        lua_getglobal(lua, funcname);
+        assert(!lua_isnil(lua, -1));
+    }
+
+    if (!evalsha && !known) {
+        in->shas[obj[0]] = registerScript(funcname + 2, obj[0]);
+    }
+
+    /* In shared nothing mode this loop owns the keys, see getFirstKey(). */
+    if (!redis->sharedNothingEnabled) {
+        lockKeys(obj, numkeys, &in->shards);
+    }
+
+    setGlobalArray(lua, "KEYS", obj, 2, numkeys);
+    setGlobalArray(lua, "ARGV", obj, 2 + numkeys, obj.size() - 2 - numkeys);
+    in->session = session;
+    in->conn = conn;
+    int64_t limit = timeLimit.load(std::memory_order_relaxed);
+    scriptDeadline = limit > 0 ? mstime() + limit : 0;
+    scriptTimedOut = false;
+    if (scriptDeadline > 0) {
+        lua_sethook(lua, timeLimitHook, LUA_MASKCOUNT, LUA_HOOK_COUNT);
+    }
+    int32_t err = lua_pcall(lua, 0, 1, -2);
+    if (scriptDeadline > 0) {
+        lua_sethook(lua, nullptr, 0, 0);
+    }
+    in->session.reset();
+    in->conn.reset();
+    unlockKeys(in->shards);
+    in->shards.clear();
+
+    if (err && scriptTimedOut) {
+        addReplySds(conn->outputBuffer(),
+                    sdscatprintf(sdsempty(), "-BUSY Script (call to %s) ran longer than "
+                                             "%lld milliseconds and was aborted\r\n",
+                                 funcname, (long long) limit));
+        lua_pop(lua, 2); /* Consume the Lua error and remove error handler. */
+    } else if (err) {
+        addReplyErrorFormat(conn->outputBuffer(), "Error running script (call to %s): %s\n",
+                            funcname, lua_tostring(lua, -1));
+        lua_pop(lua, 2); /* Consume the Lua reply and remove error handler. */
+    } else {
+        /* On success convert the Lua return value into Redis protocol, and
+         * send it to * the client. */
+        replyValue(lua, conn->outputBuffer()); /* Convert and consume the reply. */
+        lua_pop(lua, 1); /* Remove the error handler. */
+    }
+    return true;
+}
+
+/* The C++ side of redis.call() and redis.pcall(), returns false if it
+ * pushed an error. lua_error() must not unwind through it, it would skip
+ * the destructors. */
+bool Scripting::genericCommand(lua_State *lua) {
+    Interpreter *in = static_cast<Interpreter *>(lua_touserdata(lua, lua_upvalueindex(1)));
+    Redis *redis = in->scripting->redis;
+    int32_t argc = lua_gettop(lua);
+    if (argc == 0) {
+        pushError(lua, "Please specify at least one argument for redis.call()");
+        return false;
+    }
+
+    size_t len;
+    const char *name = lua_tolstring(lua, 1, &len);
+    std::string_view commandName(name ? name : "", name ? len : 0);
+    std::deque <RedisObjectPtr> argv;
+    for (int32_t j = 2; j <= argc && name != nullptr; j++) {
+        const char *s = lua_tolstring(lua, j, &len);
+        if (s == nullptr) {
+            name = nullptr;
+            break;
+        }
+        argv.push_back(createStringObject((char *) s, len));
+    }
+
+    /* Check if one of the arguments passed by the Lua script
+     * is not a string or an integer (lua_isstring() return true for
+     * integers as well). */
+    if (name == nullptr) {
+        pushError(lua, "Lua redis() command arguments must be strings or integers");
+        return false;
+    }
+
+    const RedisCommand *command = lookupCommand(commandName);
+    if (command == nullptr) {
+        pushError(lua, "Unknown Redis command called from Lua script");
+        return false;
+    }
+
+    if (!command->checkArity(argc)) {
+        pushError(lua, "Wrong number of args calling Redis command From Lua script");
+        return false;
+    }
+
+    if (command->flags & CMD_NOSCRIPT) {
+        pushError(lua, "This Redis command is not allowed from scripts");
+        return false;
+    }
+
+    if (!in->scripting->ownsKeys(in, command, argv)) {
+        pushError(lua, redis->sharedNothingEnabled ? "Script accessed a key owned by another thread" :
+                       "Script accessed a key not declared in KEYS or ran a command over every key");
+        return false;
+    }
+
+    /* A slave only takes writes from its master. */
+    if ((command->flags & CMD_WRITE) && redis->repliEnabled && redis->masterfd > 0) {
+        pushError(lua, "Write commands are not allowed from scripts on a slave");
+        return false;
+    }
+
+    /* Straight into the handler, the reply is taken from the scratch
+     * buffer. A forwarded script restores the buffer it replies to. */
+    bool cut = redis->snapshotBeforeWrite(command, argv);
+    Buffer *saved = TcpConnection::getReplyBuffer();
+    TcpConnection::setReplyBuffer(&in->reply);
+    bool ok = (redis->*command->proc)(argv, in->session, in->conn);
+    TcpConnection::setReplyBuffer(saved);
+
+    if (!ok) {
+        in->reply.retrieveAll();
+        pushError(lua, "Wrong number of args calling Redis command From Lua script");
+        return false;
+    }
+
+    /* The effects of a script go to the append only file and the slaves
+     * one command at a time, the script itself may not be deterministic. */
+    if (command->flags & CMD_WRITE) {
+        scriptAofOffset = std::max(scriptAofOffset, redis->propagate(command->name, argv, cut));
+    }
+
+    in->reply.copyRefs();
+    if (in->reply.readableBytes() == 0) {
+        lua_pushboolean(lua, 0);
+    } else {
+        pushReply(lua, in->reply.peek(), in->reply.peek() + in->reply.readableBytes());
+    }
+    in->reply.retrieveAll();
+
+    if (lua_istable(lua, -1)) {
+        lua_pushstring(lua, "err");
+        lua_rawget(lua, -2);
+        bool error = lua_isstring(lua, -1);
+        lua_pop(lua, 1);
+        return !error;
+    }
+    return true;
+}
+
+int32_t Scripting::callCommand(lua_State *lua) {
+    if (!genericCommand(lua)) {
+        return raiseError(lua);
+    }
+    return 1;
+}
+
+int32_t Scripting::pcallCommand(lua_State *lua) {
+    genericCommand(lua);
+    return 1;
+}
+
+/* Raise the error table on top of the stack as a plain error string. */
+int32_t Scripting::raiseError(lua_State *lua) {
+    lua_pushstring(lua, "err");
+    lua_gettable(lua, -2);
+    return lua_error(lua);
+}
+
+void Scripting::timeLimitHook(lua_State *lua, lua_Debug *ar) {
+    if (mstime() < scriptDeadline) {
+        return;
+    }
+
+    /* Raise the error at every line from now on, a pcall() in the script
+     * must not catch it and keep going. */
+    scriptTimedOut = true;
+    lua_sethook(lua, timeLimitHook, LUA_MASKLINE, 0);
+    lua_pushstring(lua, "Script ran out of time");
+    lua_error(lua);
+}
+
+void Scripting::pushError(lua_State *lua, const char *error) {
+    lua_Debug dbg;
+
+    lua_newtable(lua);
+    lua_pushstring(lua, "err");
+
+    /* Attempt to figure out where this function was called, if possible */
+    if (lua_getstack(lua, 1, &dbg) && lua_getinfo(lua, "nSl", &dbg)) {
+        sds msg = sdscatprintf(sdsempty(), "%s: %d: %s",
+                               dbg.source, dbg.currentline, error);
+        lua_pushstring(lua, msg);
+        sdsfree(msg);
+    } else {
+        lua_pushstring(lua, error);
+    }
+    lua_settable(lua, -3);
+}
+
+const char *Scripting::pushReply(lua_State *lua, const char *p, const char *end) {
+    const char *crlf = static_cast<const char *>(memchr(p, '\r', end - p));
+    assert(crlf != nullptr);
+    int64_t value = 0;
+    switch (*p) {
+        case ':':
+            string2ll(p + 1, crlf - p - 1, &value);
+            lua_pushnumber(lua, (lua_Number) value);
+            return crlf + 2;
+        case '$':
+            string2ll(p + 1, crlf - p - 1, &value);
+            if (value < 0) {
+                lua_pushboolean(lua, 0);
+                return crlf + 2;
+            }
+            lua_pushlstring(lua, crlf + 2, value);
+            return crlf + 2 + value + 2;
+        case '+':
+        case '-':
+            /* Status and error replies are tables with an 'ok' or an 'err'
+             * field. */
+            lua_newtable(lua);
+            lua_pushstring(lua, *p == '+' ? "ok" : "err");
+            lua_pushlstring(lua, p + 1, crlf - p - 1);
+            lua_settable(lua, -3);
+            return crlf + 2;
+        case '*':
+            string2ll(p + 1, crlf - p - 1, &value);
+            if (value < 0) {
+                lua_pushboolean(lua, 0);
+                return crlf + 2;
+            }
+
+            p = crlf + 2;
+            lua_newtable(lua);
+            for (int64_t j = 0; j < value; j++) {
+                p = pushReply(lua, p, end);
+                lua_rawseti(lua, -2, j + 1);
+            }
+            return p;
+        default:
+            lua_pushboolean(lua, 0);
+            return end;
+    }
+}
+
+void Scripting::replyValue(lua_State *lua, Buffer *buffer) {
+    switch (lua_type(lua, -1)) {
+        case LUA_TSTRING: {
+            size_t len;
+            const char *s = lua_tolstring(lua, -1, &len);
+            addReplyBulkCBuffer(buffer, s, len);
+            break;
+        }
+        case LUA_TBOOLEAN:
+            addReply(buffer, lua_toboolean(lua, -1) ? shared.cone : shared.nullbulk);
+            break;
+        case LUA_TNUMBER:
+            addReplyLongLong(buffer, (int64_t) lua_tonumber(lua, -1));
+            break;
+        case LUA_TTABLE: {
+            /* We need to check if it is an array, an error, or a status reply.
+             * Error are returned as a single element table with 'err' field.
+             * Status replies are returned as single element table with 'ok' field */
+            lua_pushstring(lua, "err");
+            lua_gettable(lua, -2);
+            if (lua_type(lua, -1) == LUA_TSTRING) {
+                sds err = sdsnew(lua_tostring(lua, -1));
+                sdsmapchars(err, "\r\n", "  ", 2);
+                addReplySds(buffer, sdscatprintf(sdsempty(), "-%s\r\n", err));
+                sdsfree(err);
+                lua_pop(lua, 2);
+                return;
+            }
+            lua_pop(lua, 1);
+
+            lua_pushstring(lua, "ok");
+            lua_gettable(lua, -2);
+            if (lua_type(lua, -1) == LUA_TSTRING) {
+                sds ok = sdsnew(lua_tostring(lua, -1));
+                sdsmapchars(ok, "\r\n", "  ", 2);
+                addReplySds(buffer, sdscatprintf(sdsempty(), "+%s\r\n", ok));
+                sdsfree(ok);
+                lua_pop(lua, 2);
+                return;
+            }
+            lua_pop(lua, 1);
+
+            /* An array, up to the first nil. The length goes first. */
+            int32_t count = 0;
+            for (;;) {
+                lua_rawgeti(lua, -1, count + 1);
+                bool nil = lua_isnil(lua, -1);
+                lua_pop(lua, 1);
+                if (nil) {
+                    break;
+                }
+                count++;
+            }
+
+            addReplyMultiBulkLen(buffer, count);
+            for (int32_t j = 1; j <= count; j++) {
+                lua_rawgeti(lua, -1, j);
+                replyValue(lua, buffer);
+            }
+            break;
+        }
+        default:
+            addReply(buffer, shared.nullbulk);
+    }
+    lua_pop(lua, 1);
+}
+#endif
@@ -0,0 +1,155 @@
+#pragma once
+
+#include "all.h"
+#include "buffer.h"
+#include "object.h"
+#include "callback.h"
+
+#ifdef _LUA
+class Redis;
+class EventLoop;
+struct RedisCommand;
+
+/* Lua scripting. Every loop runs scripts on an interpreter of its own, so
+ * scripts sent to different loops run in parallel instead of taking turns
+ * on one lua_State.
+ *
+ * The bodies are kept in a registry by SHA1 that all loops share. EVAL and
+ * SCRIPT LOAD register a body, an interpreter that has not seen a SHA1 yet
+ * compiles the body from the registry the first time EVALSHA asks for it.
+ * SCRIPT FLUSH empties the registry and moves the epoch on, so every
+ * interpreter starts over the next time it runs a script.
+ *
+ * redis.call() looks the command up in the command table and calls its
+ * handler with the reply redirected to a scratch buffer, the reply is
+ * converted to Lua values from there. A script holds the shard mutexes of
+ * its KEYS while it runs, no other command or script touches those shards
+ * in between its calls, and it may only touch keys in those shards. In
+ * shared nothing mode a script runs on the loop owning its first key, which
+ * then owns every key the script may touch.
+ *
+ * A script that runs longer than lua-time-limit is aborted, so that the
+ * commands waiting for its shards do not wait forever. The caller gets a
+ * BUSY error, the writes the script made until then stay. */
+class Scripting {
+public:
+    Scripting(Redis *redis);
+
+    ~Scripting();
+
+    /* The loops commands run on, one interpreter for each. */
+    void setLoops(const std::vector<EventLoop *> &loops);
+
+    /* EVAL and EVALSHA, 'obj' holds the script or its SHA1, the number of
+     * keys, the keys and the arguments. Runs on the calling loop. */
+    bool eval(const std::deque <RedisObjectPtr> &obj, const SessionPtr &session,
+              const TcpConnectionPtr &conn, bool evalsha);
+
+    /* SCRIPT LOAD, replies with the SHA1 if the body compiles. */
+    void load(const RedisObjectPtr &body, Buffer *buffer);
+
+    bool exists(const RedisObjectPtr &sha);
+
+    /* SCRIPT FLUSH */
+    void flush();
+
+    /* CONFIG SET lua-time-limit, in milliseconds, 0 or less for none. */
+    int32_t setTimeLimit(const char *value);
+
+    /* The first key of EVAL or EVALSHA arguments, nullptr if none. */
+    static const RedisObjectPtr *getFirstKey(const std::deque <RedisObjectPtr> &obj);
+
+    /* The append only file offset of the last write of the scripts that ran
+     * on the calling thread since the last call, 0 if none. */
+    static int64_t takeAofOffset();
+
+    /* Whether the script running on the calling thread holds the shard. */
+    static bool holdsShard(size_t index);
+
+private:
+    Scripting(const Scripting &);
+
+    void operator=(const Scripting &);
+
+    struct Interpreter {
+        Interpreter() : scripting(nullptr), lua(nullptr), core(0), epoch(0) {}
+
+        Scripting *scripting;
+        lua_State *lua;
+        int32_t core;
+        uint64_t epoch;
+        /* The SHA1 of every body EVAL compiled here, a known body costs a
+         * hash lookup instead of a digest. */
+        std::unordered_map <RedisObjectPtr, RedisObjectPtr, Hash, Equal> shas;
+        /* The shards the running script holds, sorted. */
+        std::vector <int32_t> shards;
+        /* The caller of the running script, for redis.call(). */
+        SessionPtr session;
+        TcpConnectionPtr conn;
+        Buffer reply;
+    };
+
+    /* The interpreter of the calling loop, recreated after a flush. */
+    Interpreter *getInterpreter();
+
+    void createInterpreter(Interpreter *in);
+
+    void closeInterpreter(Interpreter *in);
+
+    /* Define f_<sha> in the interpreter, replies with the error if the body
+     * does not compile. */
+    int32_t createFunction(Interpreter *in, const char *funcname,
+                           const RedisObjectPtr &body, Buffer *buffer);
+
+    /* Register the body, returns the object of its SHA1. */
+    RedisObjectPtr registerScript(const char *sha, const RedisObjectPtr &body);
+
+    RedisObjectPtr lookupScript(const char *sha);
+
+    void lockKeys(const std::deque <RedisObjectPtr> &obj, int64_t numkeys,
+                  std::vector <int32_t> *shards);
+
+    void unlockKeys(const std::vector <int32_t> &shards);
+
+    bool ownsKeys(Interpreter *in, const RedisCommand *command,
+                  const std::deque <RedisObjectPtr> &argv);
+
+    static void loadLibraries(lua_State *lua);
+
+    static void removeUnsupportedFunctions(lua_State *lua);
+
+    static void enableGlobalsProtection(lua_State *lua);
+
+    static void setGlobalArray(lua_State *lua, const char *var,
+                               const std::deque <RedisObjectPtr> &obj, size_t start, size_t count);
+
+    static int32_t callCommand(lua_State *lua);
+
+    static int32_t pcallCommand(lua_State *lua);
+
+    static bool genericCommand(lua_State *lua);
+
+    static void pushError(lua_State *lua, const char *error);
+
+    /* Called every LUA_HOOK_COUNT instructions, aborts the script once it
+     * ran out of time. */
+    static void timeLimitHook(lua_State *lua, lua_Debug *ar);
+
+    static int32_t raiseError(lua_State *lua);
+
+    /* Push the RESP reply at 'p' as a Lua value, returns where it ends. */
+    static const char *pushReply(lua_State *lua, const char *p, const char *end);
+
+    /* Reply with the value on top of the stack and pop it. */
+    static void replyValue(lua_State *lua, Buffer *buffer);
+
+    Redis *redis;
+    std::vector<EventLoop *> loops;
+    std::vector <std::unique_ptr<Interpreter>> interpreters;
+
+    std::mutex mutex;
+    std::unordered_map <RedisObjectPtr, RedisObjectPtr, Hash, Equal> scripts;
+    std::atomic <uint64_t> epoch;
+    std::atomic <int64_t> timeLimit;
+};
+#endif
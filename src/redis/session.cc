@@ -1,18 +1,23 @@
 #include "session.h"
 #include "redis.h"
 
+/* Set while a session runs a command, so that a key expired by it can be
+ * logged after what the batch wrote before. */
+static thread_local Session *runningSession = nullptr;
+
 Session::Session(Redis *redis, const TcpConnectionPtr &conn)
-        : reqtype(0),
-          multibulklen(0),
-          bulklen(-1),
-          argc(0),
-          redis(redis),
+        : redis(redis),
+          slaveMark(0),
+          aofCut(false),
+          aofOffset(0),
           authEnabled(false),
           replyBuffer(false),
           fromMaster(false),
           fromSlave(false),
-          pos(0) {
-    cmd = createStringObject(nullptr, REDIS_COMMAND_LENGTH);
+          blocked(false),
+          syncing(false) {
+    coreIndex = redis->getCoreIndex(conn->getLoop());
+    cmd = createRawStringObject(nullptr, REDIS_COMMAND_LENGTH);
     conn->setMessageCallback(std::bind(&Session::readCallback,
                                        this, std::placeholders::_1, std::placeholders::_2));
 }
@@ -31,37 +36,77 @@ void Session::clearCommand() {
  * pending query buffer, already representing a full command, to process. */
 
 void Session::readCallback(const TcpConnectionPtr &conn, Buffer *buffer) {
+    /* A command is running on another loop, or the replies wait for the
+     * append only file to be synced, keep the input buffered until then so
+     * that replies stay in order. */
+    if (blocked || syncing) {
+        return;
+    }
+
+    /* On a slave, the stream from the master moves the replication offset
+     * by what was applied of it, and the master gets no replies. */
+    bool master = redis->repliEnabled && conn->getSockfd() == redis->masterfd;
+
     /* Keep processing while there is something in the input buffer */
     while (buffer->readableBytes() > 0) {
-        /* Determine request type when unknown. */
-        if (!reqtype) {
-            if ((buffer->peek()[pos]) == '*') {
-                reqtype = REDIS_REQ_MULTIBULK;
-            } else {
-                reqtype = REDIS_REQ_INLINE;
+        size_t readable = buffer->readableBytes();
+        if (parser.parse(buffer) != REDIS_OK) {
+            if (parser.getError()) {
+                /* Flush the error first, the connection is closed once the
+                 * output buffer has been written. */
+                addReplyError(conn->outputBuffer(), parser.getError());
+                conn->sendPipe();
+                conn->shutdown();
+                parser.reset();
+                buffer->retrieveAll();
             }
+            break;
         }
 
-        if (reqtype == REDIS_REQ_MULTIBULK) {
-            if (processMultibulkBuffer(conn, buffer) != REDIS_OK) {
-                break;
-            }
-        } else if (reqtype == REDIS_REQ_INLINE) {
-            if (processInlineBuffer(conn, buffer) != REDIS_OK) {
-                break;
+        /* The arguments point into the input buffer, the command is only
+         * dropped from it once it has been executed. */
+        if (!parser.getCommand().empty()) {
+            processCommand(conn);
+        }
+        parser.consume(buffer);
+        if (master) {
+            redis->getReplication()->addReplOffset(readable - buffer->readableBytes());
+        }
+        reset();
+
+        if (blocked) {
+            break;
+        }
+    }
+
+    /* With fsync always, the replies of the batch are only sent once the
+     * sync thread has the commands on disk, one fsync serves every batch
+     * that piled up meanwhile. */
+    flushAppendOnly();
+    if (aofOffset > 0 && !blocked) {
+        int64_t offset = aofOffset;
+        aofOffset = 0;
+        std::weak_ptr <TcpConnection> weakConn(conn);
+        std::shared_ptr <Session> self(shared_from_this());
+        if (redis->getAof()->waitSync(offset, [self, weakConn]() {
+            TcpConnectionPtr conn = weakConn.lock();
+            if (conn) {
+                conn->getLoop()->queueInLoop(std::bind(&Session::resumeSync, self, conn));
             }
-        } else {
-            LOG_WARN << "Unknown request type";
+        })) {
+            syncing = true;
         }
+    }
 
-        assert(multibulklen == 0);
-        processCommand(conn);
-        reset();
+    if (master) {
+        conn->outputBuffer()->retrieveAll();
     }
 
     /* If there already are entries in the reply list, we cannot
      * add anything more to the static buffer. */
-    if (conn->outputBuffer()->readableBytes() > 0) {
+    bool waiting = syncing || (blocked && aofOffset > 0 &&
+                               redis->getAof()->getFsync() == AOF_FSYNC_ALWAYS);
+    if (!waiting && (conn->outputBuffer()->readableBytes() > 0 || conn->outputBuffer()->hasRefs())) {
         conn->sendPipe();
     }
 
@@ -69,27 +114,165 @@ void Session::readCallback(const TcpConnectionPtr &conn, Buffer *buffer) {
         pubsubBuffer.retrieveAll();
     }
 
-    if (redis->repliEnabled) {
+    /* The backlog gets the batch as a whole, in the order batches ran in. */
+    flushSlaves();
+}
+
+void Session::setAuth(bool enbaled) {
+    authEnabled = enbaled;
+}
+
+void Session::resumeCommand(const TcpConnectionPtr &conn, Buffer *reply, int64_t aofOffset) {
+    assert(blocked);
+    blocked = false;
+    this->aofOffset = std::max(this->aofOffset, aofOffset);
+    conn->outputBuffer()->appendBuffer(reply);
+    readCallback(conn, conn->intputBuffer());
+}
+
+void Session::resumeSync(const TcpConnectionPtr &conn) {
+    assert(syncing);
+    syncing = false;
+    if (conn->outputBuffer()->readableBytes() > 0 || conn->outputBuffer()->hasRefs()) {
+        conn->sendPipe();
+    }
+    readCallback(conn, conn->intputBuffer());
+}
+
+/* Commands before and after a snapshot cut go to the append only file in
+ * separate pieces, everything else of a batch is handed over at once. */
+void Session::feedAppendOnly(const RedisCommand *command, bool cut) {
+    if (cut != aofCut) {
+        flushAppendOnly();
+        aofCut = cut;
+    }
+    Aof::catCommand(&aofBuffer, parser.getCommand(), parser.getArgv());
+}
+
+void Session::flushAppendOnly() {
+    if (aofBuffer.readableBytes() > 0) {
+        aofOffset = redis->getAof()->feed(aofBuffer.peek(), aofBuffer.readableBytes(), aofCut);
+        aofBuffer.retrieveAll();
+    }
+}
+
+Session *Session::getRunning() {
+    return runningSession;
+}
+
+void Session::flushPending() {
+    flushAppendOnly();
+    if (slaveMark > 0) {
         std::unique_lock <std::mutex> lck(redis->getSlaveMutex());
-        auto &slaveConns = redis->getSlaveConn();
-        for (auto &it : slaveConns) {
-            if (slaveBuffer.readableBytes() > 0) {
-                it.second->send(&slaveBuffer);
-            }
-        }
+        redis->getReplication()->feedSlaves(slaveBuffer.peek(), slaveMark);
+        slaveBuffer.retrieve(slaveMark);
+        slaveMark = 0;
+    }
+}
+
+void Session::flushSlaves() {
+    if (slaveBuffer.readableBytes() > 0) {
+        std::unique_lock <std::mutex> lck(redis->getSlaveMutex());
+        redis->getReplication()->feedSlaves(slaveBuffer.peek(), slaveBuffer.readableBytes());
         slaveBuffer.retrieveAll();
     }
 }
 
-void Session::setAuth(bool enbaled) {
-    authEnabled = enbaled;
+/* Commands with a view handler can run straight on the argument slices,
+ * unless a feature is on that needs the arguments as objects or the key is
+ * owned by another loop. */
+bool Session::viewEnabled(const RedisCommand *command) {
+    if ((redis->authEnabled && !authEnabled) || redis->clusterEnabled ||
+        redis->repliEnabled || redis->monitorEnabled) {
+        return false;
+    }
+
+    if (redis->sharedNothingEnabled) {
+        const std::string_view &key = parser.getArgv()[command->firstKey - 1];
+        if (redis->getShardOwner(dictGenHashFunction(key.data(), key.size())) != coreIndex) {
+            return false;
+        }
+    }
+    return true;
 }
 
 /* Only reset the client when the command was executed. */
 int32_t Session::processCommand(const TcpConnectionPtr &conn) {
+    const std::string_view &name = parser.getCommand();
+    const RedisCommand *command = lookupCommand(name);
+    if (command == nullptr) {
+        addReplyErrorFormat(conn->outputBuffer(),
+                            "unknown command `%.*s`, with args beginning", (int) name.size(), name.data());
+        return REDIS_ERR;
+    }
+
+    /* A command handed to the loop owning its key is timed up to the
+     * hand over only. */
+    CommandStats *stats = redis->getCommandStats();
+    int64_t start = CommandStats::now();
+    slaveMark = slaveBuffer.readableBytes();
+    runningSession = this;
+    int32_t ret = execCommand(command, conn);
+    runningSession = nullptr;
+    int64_t duration = CommandStats::now() - start;
+    stats->record(command, duration, ret == REDIS_ERR);
+    if (ret == REDIS_OK && stats->isSlow(duration)) {
+        stats->slowlogPush(command, parser.getArgv(), duration, conn->getSockfd());
+    }
+    return ret;
+}
+
+int32_t Session::execCommand(const RedisCommand *command, const TcpConnectionPtr &conn) {
+    if (!command->checkArity(parser.getArgv().size() + 1)) {
+        addReplyErrorFormat(conn->outputBuffer(),
+                            "wrong number of arguments`%s`, for command", command->name);
+        return REDIS_ERR;
+    }
+
+    /* Make room before a write, and refuse the writes that may add memory
+     * when nothing could be evicted. Writes of the master are never refused,
+     * the master decides what the data set holds. The DELs of the evicted
+     * keys are logged straight away, so what the batch wrote so far goes
+     * first, it may have written those keys. */
+    if ((command->flags & CMD_WRITE) && conn->getSockfd() != redis->masterfd) {
+        if (redis->getEvict()->isAboveLimit()) {
+            flushPending();
+        }
+
+        if (redis->getEvict()->performEvictions() == REDIS_ERR && (command->flags & CMD_DENYOOM)) {
+            addReply(conn->outputBuffer(), shared.oomerr);
+            return REDIS_ERR;
+        }
+    }
+
+    bool cut = false;
+    if ((command->flags & CMD_WRITE) && redis->getRdb()->isSnapshotRunning()) {
+        redis->snapshotBeforeWrite(command, parser.getArgv());
+        cut = true;
+    }
+
+    bool appendOnly = (command->flags & CMD_WRITE) && redis->getAof()->isEnabled();
+    if (command->viewProc && viewEnabled(command)) {
+        if ((redis->*command->viewProc)(parser.getArgv(), shared_from_this(), conn) == REDIS_OK) {
+            if (appendOnly) {
+                feedAppendOnly(command, cut);
+            }
+            return REDIS_OK;
+        }
+    }
+
+    /* The name object is only needed for replication and monitor output. */
+    cmd->ptr = sdscpylen(cmd->ptr, command->name, strlen(command->name));
+    cmd->calHash();
+
+    /* Create redis objects for all arguments. */
+    for (auto &it : parser.getArgv()) {
+        redisCommands.push_back(createStringObject((char *) it.data(), it.size()));
+    }
+
     if (redis->authEnabled) {
         if (!authEnabled) {
-            if (STRCMP(redisCommands[0]->ptr, "auth") != 0) {
+            if (command->proc != &Redis::authCommand) {
                 addReplyErrorFormat(conn->outputBuffer(), "NOAUTH Authentication required");
                 return REDIS_ERR;
             }
@@ -97,15 +280,11 @@ int32_t Session::processCommand(const TcpConnectionPtr &conn) {
     }
 
     if (redis->clusterEnabled) {
-        if (redis->getClusterMap(cmd)) {
-            goto jump;
-        }
-
-        if (redisCommands.empty()) {
+        if (!command->hasKeys()) {
             goto jump;
         }
 
-        char *key = redisCommands[0]->ptr;
+        char *key = redisCommands[command->firstKey - 1]->ptr;
         int32_t hashslot = redis->getCluster()->keyHashSlot(key, sdslen(key));
 
         std::unique_lock <std::mutex> lck(redis->getClusterMutex());
@@ -153,41 +332,46 @@ int32_t Session::processCommand(const TcpConnectionPtr &conn) {
         if (conn->getSockfd() == redis->masterfd) {
             fromMaster = true;
 
-            if (!redis->checkCommand(cmd)) {
+            if (!(command->flags & CMD_WRITE)) {
                 return REDIS_ERR;
             }
         } else if (redis->masterfd > 0) {
-            if (redis->checkCommand(cmd)) {
+            if (command->flags & CMD_WRITE) {
                 addReplyErrorFormat(conn->outputBuffer(), "slaveof cmd unknown");
                 return REDIS_ERR;
             }
         } else {
-            if (redis->checkCommand(cmd)) {
+            if (command->flags & CMD_WRITE) {
                 redisCommands.push_front(cmd);
-                {
-                    std::unique_lock <std::mutex> lck(redis->getSlaveMutex());
-                    if (redis->salveCount < redis->getSlaveConn().size()) {
-                        redis->structureRedisProtocol(redis->slaveCached, redisCommands);
-                    } else {
-                        redis->structureRedisProtocol(slaveBuffer, redisCommands);
-                    }
-                }
+                redis->structureRedisProtocol(slaveBuffer, redisCommands);
                 redisCommands.pop_front();
             }
         }
     }
 
-    auto &handlerCommands = redis->getHandlerCommandMap();
-    auto it = handlerCommands.find(cmd);
-    if (it == handlerCommands.end()) {
-        addReplyErrorFormat(conn->outputBuffer(),
-                            "unknown command `%s`, with args beginning", cmd->ptr);
-        return REDIS_ERR;
+    /* Whatever ran before goes ahead of a command the owner loop might log
+     * first, or of the writes of a script, which are logged straight away. */
+    if (redis->sharedNothingEnabled || (command->flags & CMD_SCRIPT)) {
+        flushPending();
+    }
+
+    if (redis->sharedNothingEnabled &&
+        redis->forwardCommand(command, redisCommands, shared_from_this(), conn, coreIndex)) {
+        blocked = true;
     } else {
-        if (!it->second(redisCommands, shared_from_this(), conn)) {
+        if (!(redis->*command->proc)(redisCommands, shared_from_this(), conn)) {
             addReplyErrorFormat(conn->outputBuffer(),
                                 "wrong number of arguments`%s`, for command", cmd->ptr);
         } else {
+            if (appendOnly) {
+                feedAppendOnly(command, cut);
+            }
+#ifdef _LUA
+            if (command->flags & CMD_SCRIPT) {
+                aofOffset = std::max(aofOffset, Scripting::takeAofOffset());
+            }
+#endif
+
             if (redis->monitorEnabled) {
                 redisCommands.push_back(cmd);
                 redis->feedMonitor(redisCommands, conn->getSockfd());
@@ -202,10 +386,6 @@ void Session::resetVlaue() {
 }
 
 void Session::reset() {
-    reqtype = 0;
-    argc = 0;
-    multibulklen = 0;
-    bulklen = -1;
     redisCommands.clear();
 
     if (replyBuffer) {
@@ -218,198 +398,3 @@ void Session::reset() {
         fromMaster = false;
     }
 }
-
-/* Like processMultibulkBuffer(), but for the inline protocol instead of RESP,
- * this function consumes the client query buffer and creates a command ready
- * to be executed inside the client structure. Returns C_OK if the command
- * is ready to be executed, or C_ERR if there is still protocol to read to
- * have a well formed command. The function also returns C_ERR when there is
- * a protocol error: in such a case the client structure is setup to reply
- * with the error and close the connection. */
-
-int32_t Session::processInlineBuffer(const TcpConnectionPtr &conn, Buffer *buffer) {
-    const char *newline;
-    const char *queryBuf = buffer->peek();
-    int32_t j, linefeedChars = 1;
-    size_t queryLen;
-    sds *argv, aux;
-    /* Search for end of line */
-    newline = strchr(queryBuf, '\n');
-
-    /* Nothing to do without a \r\n */
-    if (newline == nullptr) {
-        return REDIS_ERR;
-    }
-
-    /* Handle the \r\n case. */
-    if (newline && newline != queryBuf && *(newline - 1) == '\r')
-        newline--, linefeedChars++;
-
-    /* Split the input buffer up to the \r\n */
-    queryLen = newline - queryBuf;
-    if ((queryLen + linefeedChars) > buffer->readableBytes()) {
-        return REDIS_ERR;
-    }
-
-    aux = sdsnewlen(queryBuf, queryLen);
-    argv = sdssplitargs(aux, &argc);
-    sdsfree(aux);
-
-    if (argv == nullptr) {
-        addReplyError(conn->outputBuffer(), "Protocol error: unbalanced quotes in request");
-        conn->shutdown();
-        return REDIS_ERR;
-    }
-
-    /* Leave data after the first line of the query in the buffer */
-    buffer->retrieve(queryLen + linefeedChars);
-
-    /* Create redis objects for all arguments. */
-    for (j = 0; j < argc; j++) {
-        if (j == 0) {
-            cmd->ptr = sdscpylen((sds) (cmd->ptr), argv[j], sdslen(argv[j]));
-            if (cmd->ptr[0] >= 'A' && cmd->ptr[0] <= 'Z') {
-                int len = sdslen(cmd->ptr);
-                for (int i = 0; i < len; i++) {
-                    cmd->ptr[i] += 32;
-                }
-            }
-            cmd->calHash();
-        } else {
-            RedisObjectPtr obj = createStringObject(argv[j], sdslen(argv[j]));
-            redisCommands.push_back(obj);
-        }
-        sdsfree(argv[j]);
-    }
-
-    zfree(argv);
-    return REDIS_OK;
-}
-
-/* Process the query buffer for client 'c', setting up the client argument
- * vector for command execution. Returns C_OK if after running the function
- * the client has a well-formed ready to be processed command, otherwise
- * C_ERR if there is still to read more buffer to get the full command.
- * The function also returns C_ERR when there is a protocol error: in such a
- * case the client structure is setup to reply with the error and close
- * the connection.
- *
- * This function is called if processInputBuffer() detects that the next
- * command is in RESP format, so the first byte in the command is found
- * to be '*'. Otherwise for inline commands processInlineBuffer() is called. */
-
-int32_t Session::processMultibulkBuffer(const TcpConnectionPtr &conn, Buffer *buffer) {
-    const char *newline = nullptr;
-    int32_t ok;
-    int64_t ll = 0;
-    const char *queryBuf = buffer->peek();
-    if (multibulklen == 0) {
-        /* Multi bulk length cannot be read without a \r\n */
-        newline = strchr(queryBuf + pos, '\r');
-        if (newline == nullptr) {
-            return REDIS_ERR;
-        }
-
-        /* Buffer should also contain \n */
-        if ((newline - (queryBuf + pos)) > (buffer->readableBytes() - pos - 2)) {
-            return REDIS_ERR;
-        }
-
-        if (queryBuf[pos] != '*') {
-            addReplyError(conn->outputBuffer(), "Protocol error: *");
-            conn->shutdown();
-            return REDIS_ERR;
-        }
-
-        /* We know for sure there is a whole line since newline != NULL,
-         * so go ahead and find out the multi bulk length. */
-        ok = string2ll(queryBuf + pos + 1, newline - (queryBuf + pos + 1), &ll);
-        if (!ok || ll > REDIS_MBULK_BIG_ARG || ll <= 0) {
-            addReplyError(conn->outputBuffer(), "Protocol error: invalid multibulk length");
-            conn->shutdown();
-            return REDIS_ERR;
-        }
-
-        pos += (newline - (queryBuf + pos)) + 2;
-        multibulklen = ll;
-    }
-
-    while (multibulklen) {
-        /* Read bulk length if unknown */
-        if (bulklen == -1) {
-            newline = strchr(queryBuf + pos, '\r');
-            if (newline == nullptr) {
-                break;
-            }
-
-            /* Buffer should also contain \n */
-            if ((newline - (queryBuf + pos)) > (buffer->readableBytes() - pos - 2)) {
-                return REDIS_ERR;
-            }
-
-
-            if (queryBuf[pos] != '$') {
-                addReplyErrorFormat(conn->outputBuffer(),
-                                    "Protocol error: expected '$',got '%c'", queryBuf[pos]);
-                conn->shutdown();
-                return REDIS_ERR;
-            }
-
-            ok = string2ll(queryBuf + pos + 1, newline - (queryBuf + pos + 1), &ll);
-            if (!ok || ll < 0 || ll > REDIS_MBULK_BIG_ARG) {
-                addReplyError(conn->outputBuffer(),
-                              "Protocol error: invalid bulk length");
-                conn->shutdown();
-                return REDIS_ERR;
-            }
-
-            pos += (newline - (queryBuf + pos)) + 2;
-            bulklen = ll;
-        }
-
-        /* Read bulk argument */
-        if ((buffer->readableBytes() - pos) < (bulklen + 2)) {
-            break;
-        } else {
-            /* Optimization: if the buffer contains JUST our bulk element
-            * instead of creating a new object by *copying* the sds we
-            * just use the current sds string. */
-            if (++argc == 1) {
-                cmd->ptr = sdscpylen(cmd->ptr, queryBuf + pos, bulklen);
-                if (cmd->ptr[0] >= 'A' && cmd->ptr[0] <= 'Z') {
-                    int len = sdslen(cmd->ptr);
-                    for (int i = 0; i < len; i++) {
-                        cmd->ptr[i] += 32;
-                    }
-                }
-                cmd->calHash();
-            } else {
-                RedisObjectPtr obj = createStringObject((char *) (queryBuf + pos), bulklen);
-                redisCommands.push_back(obj);
-            }
-
-            pos += bulklen + 2;
-            bulklen = -1;
-            multibulklen--;
-        }
-    }
-
-    /* We're done when c->multibulk == 0 */
-    if (multibulklen == 0) {
-        /* Trim to pos */
-        assert(pos <= buffer->readableBytes());
-        buffer->retrieve(pos);
-        pos = 0;
-        return REDIS_OK;
-    }
-
-    /* Still not ready to process the command */
-    return REDIS_ERR;
-}
-
-
-
-
-
-
-
@@ -3,6 +3,8 @@
 #include "all.h"
 #include "tcpconnection.h"
 #include "object.h"
+#include "resp.h"
+#include "command.h"
 #include "sds.h"
 #include "util.h"
 
@@ -22,35 +24,68 @@ public:
 
     void readCallback(const TcpConnectionPtr &conn, Buffer *buffer);
 
-    int32_t processMultibulkBuffer(const TcpConnectionPtr &conn, Buffer *buffer);
-
-    int32_t processInlineBuffer(const TcpConnectionPtr &conn, Buffer *buffer);
-
     int32_t processCommand(const TcpConnectionPtr &conn);
 
     void setAuth(bool enbaled);
 
+    /* Index of the loop the connection is served on. */
+    int32_t getCoreIndex() const { return coreIndex; }
+
+    /* Called on the connection loop with the reply of a command that ran on
+     * another loop, then continues with the pipelined commands held back. */
+    void resumeCommand(const TcpConnectionPtr &conn, Buffer *reply, int64_t aofOffset = 0);
+
+    /* Called on the connection loop once the append only file has been
+     * synced up to the last command of the batch. */
+    void resumeSync(const TcpConnectionPtr &conn);
+
+    /* The session running a command on the calling thread, if any. */
+    static Session *getRunning();
+
+    /* Hand what the batch wrote before the running command to the append
+     * only file and the slaves, ahead of a DEL logged on its behalf. */
+    void flushPending();
+
 private:
     Session(const Session &);
 
     void operator=(const Session &);
 
+    bool viewEnabled(const RedisCommand *command);
+
+    /* Runs a command that was looked up, REDIS_ERR if it was refused. */
+    int32_t execCommand(const RedisCommand *command, const TcpConnectionPtr &conn);
+
+    void feedAppendOnly(const RedisCommand *command, bool cut);
+
+    void flushAppendOnly();
+
+    /* Hand the write commands of the batch so far to the slaves. */
+    void flushSlaves();
+
     Redis *redis;
     RedisObjectPtr cmd;
     std::deque <RedisObjectPtr> redisCommands;
+    RespParser parser;
 
-    int32_t reqtype;
-    int32_t multibulklen;
-    int64_t bulklen;
-    int32_t argc;
-    size_t pos;
+    int32_t coreIndex;
 
     Buffer slaveBuffer;
+    /* Bytes of slaveBuffer written before the running command. */
+    size_t slaveMark;
     Buffer pubsubBuffer;
 
+    /* Write commands of the current batch for the append only file, all of
+     * them either before or after a snapshot cut, see Aof::feed(). */
+    Buffer aofBuffer;
+    bool aofCut;
+    int64_t aofOffset;
+
     bool authEnabled;
     bool replyBuffer;
     bool fromMaster;
     bool fromSlave;
+    bool blocked;
+    bool syncing;
 };
 
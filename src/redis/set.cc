@@ -0,0 +1,186 @@
+#include "set.h"
+#include "util.h"
+
+RedisSet::RedisSet()
+        : is(new Intset()),
+          lp(nullptr),
+          dict(nullptr) {
+
+}
+
+RedisSet::~RedisSet() {
+    reset();
+}
+
+void RedisSet::reset() {
+    delete is;
+    delete lp;
+    delete dict;
+    is = nullptr;
+    lp = nullptr;
+    dict = nullptr;
+}
+
+int32_t RedisSet::getEncoding() const {
+    if (is != nullptr) {
+        return OBJ_ENCODING_INTSET;
+    }
+    return lp ? OBJ_ENCODING_LISTPACK : OBJ_ENCODING_HT;
+}
+
+size_t RedisSet::size() const {
+    if (is != nullptr) {
+        return is->size();
+    }
+    return lp ? lp->size() : dict->size();
+}
+
+void RedisSet::swap(RedisSet &rhs) {
+    std::swap(is, rhs.is);
+    std::swap(lp, rhs.lp);
+    std::swap(dict, rhs.dict);
+}
+
+bool RedisSet::findListpack(const char *member, size_t len) const {
+    for (unsigned char *p = lp->first(); p != nullptr; p = lp->next(p)) {
+        if (Listpack::equals(p, member, len)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void RedisSet::convertToListpack() {
+    assert(is != nullptr);
+    lp = new Listpack();
+    for (size_t i = 0; i < is->size(); i++) {
+        lp->appendInteger(is->get(i));
+    }
+    delete is;
+    is = nullptr;
+}
+
+void RedisSet::convertToDict() {
+    assert(dict == nullptr);
+    dict = new Dict();
+    dict->reserve(size());
+
+    char buf[Listpack::kIntBufSize];
+    if (is != nullptr) {
+        for (size_t i = 0; i < is->size(); i++) {
+            dict->insert(createObject(OBJ_STRING, sdsfromlonglong(is->get(i))));
+        }
+        delete is;
+        is = nullptr;
+    } else {
+        for (unsigned char *p = lp->first(); p != nullptr; p = lp->next(p)) {
+            std::string_view member = Listpack::get(p).view(buf);
+            dict->insert(createStringObject((char *) member.data(), member.size()));
+        }
+        delete lp;
+        lp = nullptr;
+    }
+}
+
+bool RedisSet::add(const RedisObjectPtr &member) {
+    size_t len = sdslen(member->ptr);
+    if (is != nullptr) {
+        int64_t value;
+        if (len <= 20 && string2ll(member->ptr, len, &value)) {
+            if (is->find(value)) {
+                return false;
+            }
+
+            if (is->size() < REDIS_SET_MAX_INTSET_ENTRIES) {
+                is->add(value);
+                return true;
+            }
+            convertToDict();
+        } else if (is->size() < REDIS_SET_MAX_LISTPACK_ENTRIES &&
+                   len <= REDIS_SET_MAX_LISTPACK_VALUE) {
+            /* The integers are not in the intset as strings, so the new
+             * member cannot be one of them. */
+            convertToListpack();
+        } else {
+            convertToDict();
+        }
+    }
+
+    if (lp != nullptr) {
+        if (findListpack(member->ptr, len)) {
+            return false;
+        }
+
+        if (lp->size() < REDIS_SET_MAX_LISTPACK_ENTRIES && len <= REDIS_SET_MAX_LISTPACK_VALUE) {
+            lp->append(member->ptr, len);
+            return true;
+        }
+        convertToDict();
+    }
+    return dict->insert(member).second;
+}
+
+bool RedisSet::contains(const RedisObjectPtr &member) const {
+    size_t len = sdslen(member->ptr);
+    if (is != nullptr) {
+        int64_t value;
+        return len <= 20 && string2ll(member->ptr, len, &value) && is->find(value);
+    } else if (lp != nullptr) {
+        return findListpack(member->ptr, len);
+    }
+    return dict->find(member) != dict->end();
+}
+
+void RedisSet::forEach(const Callback &cb) const {
+    char buf[Listpack::kIntBufSize];
+    if (is != nullptr) {
+        for (size_t i = 0; i < is->size(); i++) {
+            cb(std::string_view(buf, ll2string(buf, sizeof(buf), is->get(i))));
+        }
+    } else if (lp != nullptr) {
+        for (unsigned char *p = lp->first(); p != nullptr; p = lp->next(p)) {
+            cb(Listpack::get(p).view(buf));
+        }
+    } else {
+        for (auto &it : *dict) {
+            cb(std::string_view(it->ptr, sdslen(it->ptr)));
+        }
+    }
+}
+
+uint64_t RedisSet::scan(uint64_t cursor, size_t count, const Callback &cb) const {
+    if (dict == nullptr) {
+        forEach(cb);
+        return 0;
+    }
+
+    return scanBuckets(*dict, cursor, count, [&](const RedisObjectPtr &it) {
+        cb(std::string_view(it->ptr, sdslen(it->ptr)));
+    });
+}
+
+bool RedisSet::assignIntset(const unsigned char *buf, size_t len) {
+    reset();
+    is = new Intset();
+    if (!is->assign(buf, len)) {
+        return false;
+    }
+
+    if (is->size() > REDIS_SET_MAX_INTSET_ENTRIES) {
+        convertToDict();
+    }
+    return true;
+}
+
+bool RedisSet::assignListpack(const unsigned char *buf, size_t len) {
+    reset();
+    lp = new Listpack();
+    if (!lp->assign(buf, len)) {
+        return false;
+    }
+
+    if (lp->size() > REDIS_SET_MAX_LISTPACK_ENTRIES) {
+        convertToDict();
+    }
+    return true;
+}
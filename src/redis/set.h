@@ -0,0 +1,67 @@
+#pragma once
+
+#include "all.h"
+#include "intset.h"
+#include "listpack.h"
+#include "object.h"
+
+/* Set with three encodings. A set of integers is an intset until it has
+ * more than REDIS_SET_MAX_INTSET_ENTRIES members. Other small sets are an
+ * unsorted listpack, up to REDIS_SET_MAX_LISTPACK_ENTRIES members of at
+ * most REDIS_SET_MAX_LISTPACK_VALUE bytes. Anything larger is a hash table
+ * of member objects. A set never goes back to a smaller encoding. */
+class RedisSet {
+public:
+    typedef std::function<void(const std::string_view &)> Callback;
+
+    RedisSet();
+
+    ~RedisSet();
+
+    int32_t getEncoding() const;
+
+    size_t size() const;
+
+    void swap(RedisSet &rhs);
+
+    /* Returns true if the member is new. */
+    bool add(const RedisObjectPtr &member);
+
+    bool contains(const RedisObjectPtr &member) const;
+
+    void forEach(const Callback &cb) const;
+
+    /* One step of SSCAN, see scanBuckets(). An intset or a listpack is
+     * small enough to be returned whole, with cursor 0. */
+    uint64_t scan(uint64_t cursor, size_t count, const Callback &cb) const;
+
+    /* nullptr unless the set has that encoding. */
+    const Intset *getIntset() const { return is; }
+
+    const Listpack *getListpack() const { return lp; }
+
+    /* Load a serialized intset or listpack. */
+    bool assignIntset(const unsigned char *buf, size_t len);
+
+    bool assignListpack(const unsigned char *buf, size_t len);
+
+private:
+    RedisSet(const RedisSet &);
+
+    void operator=(const RedisSet &);
+
+    typedef std::unordered_set <RedisObjectPtr, Hash, Equal> Dict;
+
+    bool findListpack(const char *member, size_t len) const;
+
+    void convertToListpack();
+
+    void convertToDict();
+
+    void reset();
+
+    /* Exactly one of them is set. */
+    Intset *is;
+    Listpack *lp;
+    Dict *dict;
+};
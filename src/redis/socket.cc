@@ -80,6 +80,20 @@ ssize_t Socket::readv(int32_t sockfd, IOV_TYPE *iov, int32_t iovcnt)
 #endif
 }
 
+ssize_t Socket::writev(int32_t sockfd, IOV_TYPE *iov, int32_t iovcnt)
+{
+#ifdef _WIN64
+	DWORD bytesSent;
+	if (::WSASend(sockfd, iov, iovcnt, &bytesSent, 0, nullptr, nullptr))
+	{
+		return -1;
+	}
+	return bytesSent;
+#else
+	return ::writev(sockfd, iov, iovcnt);
+#endif
+}
+
 ssize_t Socket::read(int32_t sockfd, void *buf, int32_t count)
 {
 #ifdef __linux__
@@ -98,11 +112,11 @@ ssize_t Socket::read(int32_t sockfd, void *buf, int32_t count)
 ssize_t Socket::write(int32_t sockfd, const void* buf, int32_t count)
 {
 #ifdef __linux__
-	ssize_t n = ::write(sockfd, static_cast<const char*>(buf), count);
+	return ::write(sockfd, static_cast<const char*>(buf), count);
 #endif
 
 #ifdef __APPLE__
-	ssize_t n = ::write(sockfd, static_cast<const char*>(buf), count);
+	return ::write(sockfd, static_cast<const char*>(buf), count);
 #endif
 
 #ifdef _WIN64
@@ -231,6 +245,16 @@ void Socket::close(int32_t sockfd)
 	::close(sockfd);
 #endif
 }
+
+int32_t Socket::shutdown(int32_t sockfd)
+{
+#ifdef _WIN64
+	return ::shutdown(sockfd, SD_SEND);
+#else
+	return ::shutdown(sockfd, SHUT_WR);
+#endif
+}
+
 struct sockaddr_in6 Socket::getLocalAddr(int32_t sockfd)
 {
 	struct sockaddr_in6 localaddr;
@@ -476,6 +500,30 @@ void Socket::setReusePort(int32_t sockfd, bool on)
 #endif
 }
 
+bool Socket::setReusePortCpu(int32_t sockfd, int32_t groupSize)
+{
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+	struct sock_filter code[] = {
+		{ BPF_LD | BPF_W | BPF_ABS, 0, 0, uint32_t(SKF_AD_OFF + SKF_AD_CPU) },
+		{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, uint32_t(groupSize) },
+		{ BPF_RET | BPF_A, 0, 0, 0 },
+	};
+
+	struct sock_fprog prog;
+	prog.len = sizeof(code) / sizeof(code[0]);
+	prog.filter = code;
+	if (::setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0)
+	{
+		LOG_WARN << "SO_ATTACH_REUSEPORT_CBPF failed " << strerror(errno);
+		return false;
+	}
+	return true;
+#else
+	LOG_WARN << "SO_ATTACH_REUSEPORT_CBPF is not supported.";
+	return false;
+#endif
+}
+
 int32_t Socket::createTcpSocket(const char *ip, int16_t port)
 {
 	struct sockaddr_in sa;
@@ -17,8 +17,10 @@ namespace Socket
 	ssize_t read(int32_t sockfd, void *buf, int32_t count);
 	ssize_t readv(int32_t sockfd, IOV_TYPE *iov, int32_t iovcnt);
 	ssize_t write(int32_t sockfd, const void* buf, int32_t count);
+	ssize_t writev(int32_t sockfd, IOV_TYPE *iov, int32_t iovcnt);
 
 	void close(int32_t sockfd);
+	int32_t shutdown(int32_t sockfd);
 	struct sockaddr_in6 getPeerAddr(int32_t sockfd);
 	struct sockaddr_in6 getLocalAddr(int32_t sockfd);
 
@@ -45,6 +47,10 @@ namespace Socket
 	bool setTimeOut(int32_t sockfd, const struct timeval tc);
 	void setReuseAddr(int32_t sockfd, bool on);
 	void setReusePort(int32_t sockfd, bool on);
+
+	/* Steer the connections of the SO_REUSEPORT group of 'sockfd' by the CPU
+	 * they arrive on, to the socket that joined the group at that index. */
+	bool setReusePortCpu(int32_t sockfd, int32_t groupSize);
 	bool resolve(std::string_view hostname, struct sockaddr_in *out);
 	bool resolve(std::string_view hostname, struct sockaddr_in6 *out);
 };
@@ -0,0 +1,279 @@
+#include "stats.h"
+#include "socket.h"
+
+static int32_t highestBit(uint64_t value) {
+#ifdef _WIN64
+    unsigned long idx;
+    _BitScanReverse64(&idx, value);
+    return idx;
+#else
+    return 63 - __builtin_clzll(value);
+#endif
+}
+
+LatencyHistogram::LatencyHistogram() {
+    for (auto &it : counts) {
+        it.store(0, std::memory_order_relaxed);
+    }
+}
+
+int32_t LatencyHistogram::bucketIndex(uint64_t value) {
+    if (value < kSubBuckets) {
+        return value;
+    }
+
+    int32_t bits = highestBit(value);
+    if (bits >= kMaxBits) {
+        return kBuckets - 1;
+    }
+
+    /* The kSubBits bits below the highest one pick the sub bucket. */
+    int32_t shift = bits - kSubBits;
+    return (shift + 1) * kSubBuckets + int32_t((value >> shift) - kSubBuckets);
+}
+
+uint64_t LatencyHistogram::bucketLow(int32_t index) {
+    if (index < 2 * kSubBuckets) {
+        return index;
+    }
+
+    int32_t shift = index / kSubBuckets - 1;
+    return uint64_t(index % kSubBuckets + kSubBuckets) << shift;
+}
+
+void LatencyHistogram::merge(Counts &sum) const {
+    for (int32_t i = 0; i < kBuckets; i++) {
+        sum[i] += counts[i].load(std::memory_order_relaxed);
+    }
+}
+
+uint64_t LatencyHistogram::percentile(const Counts &sum, uint64_t total, double percentile) {
+    if (total == 0) {
+        return 0;
+    }
+
+    uint64_t rank = std::max<uint64_t>(1, uint64_t(total * percentile / 100.0 + 0.5));
+    uint64_t seen = 0;
+    for (int32_t i = 0; i < kBuckets; i++) {
+        seen += sum[i];
+        if (seen >= rank) {
+            uint64_t low = bucketLow(i);
+            uint64_t width = i + 1 < kBuckets ? bucketLow(i + 1) - low : 1;
+            return low + width / 2;
+        }
+    }
+    return bucketLow(kBuckets - 1);
+}
+
+CommandStats::CommandStats()
+        : slowlogSlowerThan(SLOWLOG_LOG_SLOWER_THAN),
+          slowlogMaxLen(SLOWLOG_MAX_LEN),
+          latencyTracking(true),
+          slowlogNextId(0) {
+
+}
+
+CommandStats::~CommandStats() {
+    for (auto &it : threads) {
+        for (size_t i = 0; i < getCommandCount(); i++) {
+            delete it->counters[i].histogram.load();
+        }
+    }
+}
+
+CommandStats::ThreadStats *CommandStats::getThreadStats() {
+    static thread_local ThreadStats *local = nullptr;
+    if (local != nullptr && local->owner == this) {
+        return local;
+    }
+
+    std::unique_ptr <ThreadStats> stats(new ThreadStats());
+    stats->owner = this;
+    stats->counters.reset(new Counter[getCommandCount()]);
+    for (size_t i = 0; i < getCommandCount(); i++) {
+        Counter &counter = stats->counters[i];
+        counter.calls = 0;
+        counter.duration = 0;
+        counter.rejected = 0;
+        counter.histogram = nullptr;
+    }
+
+    std::unique_lock <std::mutex> lck(mutex);
+    local = stats.get();
+    threads.push_back(std::move(stats));
+    return local;
+}
+
+void CommandStats::record(const RedisCommand *command, int64_t duration, bool rejected) {
+    Counter &counter = getThreadStats()->counters[getCommandId(command)];
+    if (rejected) {
+        add(counter.rejected, 1);
+        return;
+    }
+
+    add(counter.calls, 1);
+    add(counter.duration, duration);
+    if (latencyTracking.load(std::memory_order_relaxed)) {
+        LatencyHistogram *histogram = counter.histogram.load(std::memory_order_acquire);
+        if (histogram == nullptr) {
+            histogram = new LatencyHistogram();
+            counter.histogram.store(histogram, std::memory_order_release);
+        }
+        histogram->record(duration);
+    }
+}
+
+void CommandStats::slowlogPush(const RedisCommand *command, const std::vector <std::string_view> &argv,
+                               int64_t duration, int32_t sockfd) {
+    /* Like upstream, long argument lists and long strings are cut, the
+     * entry says how much was left out. */
+    SlowlogEntry entry;
+    entry.time = setime();
+    entry.duration = duration / 1000;
+    entry.argv.push_back(command->name);
+    size_t argc = std::min<size_t>(argv.size(), kSlowlogMaxArgc - 1);
+    for (size_t i = 0; i < argc; i++) {
+        if (i == argc - 1 && argc < argv.size()) {
+            entry.argv.push_back("... (" + std::to_string(argv.size() - argc + 1) + " more arguments)");
+        } else if (argv[i].size() > kSlowlogMaxString) {
+            entry.argv.push_back(std::string(argv[i].substr(0, kSlowlogMaxString)) + "... (" +
+                                 std::to_string(argv[i].size() - kSlowlogMaxString) + " more bytes)");
+        } else {
+            entry.argv.push_back(std::string(argv[i]));
+        }
+    }
+
+    char buf[64] = "";
+    if (sockfd >= 0) {
+        struct sockaddr_in6 addr = Socket::getPeerAddr(sockfd);
+        Socket::toIpPort(buf, sizeof(buf), (const struct sockaddr *) &addr);
+    }
+    entry.client = buf;
+
+    std::unique_lock <std::mutex> lck(mutex);
+    entry.id = slowlogNextId++;
+    slowlog.push_front(std::move(entry));
+    while (slowlog.size() > slowlogMaxLen) {
+        slowlog.pop_back();
+    }
+}
+
+std::vector <CommandStats::SlowlogEntry> CommandStats::getSlowlog(size_t count) {
+    std::unique_lock <std::mutex> lck(mutex);
+    count = std::min(count, slowlog.size());
+    return std::vector<SlowlogEntry>(slowlog.begin(), slowlog.begin() + count);
+}
+
+size_t CommandStats::getSlowlogLen() {
+    std::unique_lock <std::mutex> lck(mutex);
+    return slowlog.size();
+}
+
+void CommandStats::resetSlowlog() {
+    std::unique_lock <std::mutex> lck(mutex);
+    slowlog.clear();
+}
+
+int32_t CommandStats::setSlowlogSlowerThan(const char *value) {
+    /* Negative disables the slow log, 0 logs every command. */
+    char *end;
+    errno = 0;
+    long long n = strtoll(value, &end, 10);
+    if (errno || end == value || *end != '\0') {
+        return REDIS_ERR;
+    }
+
+    slowlogSlowerThan = n;
+    return REDIS_OK;
+}
+
+int32_t CommandStats::setSlowlogMaxLen(const char *value) {
+    char *end;
+    errno = 0;
+    long long n = strtoll(value, &end, 10);
+    if (errno || end == value || *end != '\0' || n < 0) {
+        return REDIS_ERR;
+    }
+
+    std::unique_lock <std::mutex> lck(mutex);
+    slowlogMaxLen = n;
+    while (slowlog.size() > slowlogMaxLen) {
+        slowlog.pop_back();
+    }
+    return REDIS_OK;
+}
+
+int32_t CommandStats::setLatencyTracking(const char *value) {
+    if (!strcmp(value, "yes")) {
+        latencyTracking = true;
+    } else if (!strcmp(value, "no")) {
+        latencyTracking = false;
+    } else {
+        return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
+
+void CommandStats::getSummary(size_t id, Summary *summary) {
+    summary->calls = 0;
+    summary->duration = 0;
+    summary->rejected = 0;
+    summary->histogramTotal = 0;
+    summary->histogram.fill(0);
+
+    std::unique_lock <std::mutex> lck(mutex);
+    for (auto &it : threads) {
+        Counter &counter = it->counters[id];
+        summary->calls += counter.calls.load(std::memory_order_relaxed);
+        summary->duration += counter.duration.load(std::memory_order_relaxed);
+        summary->rejected += counter.rejected.load(std::memory_order_relaxed);
+        LatencyHistogram *histogram = counter.histogram.load(std::memory_order_acquire);
+        if (histogram != nullptr) {
+            histogram->merge(summary->histogram);
+        }
+    }
+
+    for (auto &it : summary->histogram) {
+        summary->histogramTotal += it;
+    }
+}
+
+sds CommandStats::genCommandStats(sds info) {
+    Summary summary;
+    info = sdscat(info, "# Commandstats\r\n");
+    for (size_t i = 0; i < getCommandCount(); i++) {
+        getSummary(i, &summary);
+        if (summary.calls == 0 && summary.rejected == 0) {
+            continue;
+        }
+
+        double usec = summary.duration / 1000.0;
+        info = sdscatprintf(info,
+                            "cmdstat_%s:calls=%llu,usec=%llu,usec_per_call=%.2f,rejected_calls=%llu\r\n",
+                            getCommandById(i)->name,
+                            (unsigned long long) summary.calls,
+                            (unsigned long long) (summary.duration / 1000),
+                            summary.calls > 0 ? usec / summary.calls : 0,
+                            (unsigned long long) summary.rejected);
+    }
+    return info;
+}
+
+sds CommandStats::genLatencyStats(sds info) {
+    Summary summary;
+    info = sdscat(info, "# Latencystats\r\n");
+    for (size_t i = 0; i < getCommandCount(); i++) {
+        getSummary(i, &summary);
+        if (summary.histogramTotal == 0) {
+            continue;
+        }
+
+        info = sdscatprintf(info,
+                            "latency_percentiles_usec_%s:p50=%.3f,p99=%.3f,p99.9=%.3f\r\n",
+                            getCommandById(i)->name,
+                            LatencyHistogram::percentile(summary.histogram, summary.histogramTotal, 50) / 1000.0,
+                            LatencyHistogram::percentile(summary.histogram, summary.histogramTotal, 99) / 1000.0,
+                            LatencyHistogram::percentile(summary.histogram, summary.histogramTotal, 99.9) / 1000.0);
+    }
+    return info;
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include "all.h"
+#include "command.h"
+
+/* Latency histogram in the manner of HdrHistogram: values below
+ * kSubBuckets are counted exactly, every power of two above is split into
+ * kSubBuckets buckets, so a bucket is within 1/kSubBuckets of any value it
+ * holds. Values are nanoseconds, up to 2^kMaxBits. One thread records,
+ * any number of threads read. */
+class LatencyHistogram {
+public:
+    const static int32_t kSubBits = 4;
+    const static int32_t kSubBuckets = 1 << kSubBits;
+    const static int32_t kMaxBits = 40;
+    const static int32_t kBuckets = (kMaxBits - kSubBits + 1) * kSubBuckets;
+
+    typedef std::array <uint64_t, kBuckets> Counts;
+
+    LatencyHistogram();
+
+    void record(uint64_t value) {
+        std::atomic <uint64_t> &count = counts[bucketIndex(value)];
+        count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    /* Add the counts to 'sum'. */
+    void merge(Counts &sum) const;
+
+    static int32_t bucketIndex(uint64_t value);
+
+    /* Smallest value of a bucket. */
+    static uint64_t bucketLow(int32_t index);
+
+    /* Value at or below which 'percentile' percent of the counts are, the
+     * middle of its bucket. */
+    static uint64_t percentile(const Counts &sum, uint64_t total, double percentile);
+
+private:
+    LatencyHistogram(const LatencyHistogram &);
+
+    void operator=(const LatencyHistogram &);
+
+    std::atomic <uint64_t> counts[kBuckets];
+};
+
+/* Per command statistics and the slow log.
+ *
+ * Every loop records into a block of counters of its own, found through a
+ * thread local pointer, so recording is a few relaxed stores on memory no
+ * other writer touches. INFO and LATENCY sum the blocks of all loops. The
+ * histogram of a command is allocated the first time a loop runs it.
+ *
+ * Commands slower than slowlog-log-slower-than microseconds go to the slow
+ * log, a ring of the last slowlog-max-len entries under a mutex, taken for
+ * slow commands only. */
+class CommandStats {
+public:
+    struct SlowlogEntry {
+        int64_t id;
+        int64_t time;     /* Unix time in seconds */
+        int64_t duration; /* Microseconds */
+        std::vector <std::string> argv;
+        std::string client;
+    };
+
+    CommandStats();
+
+    ~CommandStats();
+
+    static int64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /* Called by the loop that ran 'command' for 'duration' nanoseconds,
+     * 'rejected' if it was refused before running. */
+    void record(const RedisCommand *command, int64_t duration, bool rejected);
+
+    bool isSlow(int64_t duration) const {
+        int64_t slower = slowlogSlowerThan.load(std::memory_order_relaxed);
+        return slower >= 0 && duration / 1000 >= slower;
+    }
+
+    void slowlogPush(const RedisCommand *command, const std::vector <std::string_view> &argv,
+                     int64_t duration, int32_t sockfd);
+
+    /* The newest 'count' entries first. */
+    std::vector <SlowlogEntry> getSlowlog(size_t count);
+
+    size_t getSlowlogLen();
+
+    void resetSlowlog();
+
+    /* CONFIG SET, return REDIS_ERR for an invalid value. */
+    int32_t setSlowlogSlowerThan(const char *value);
+
+    int32_t setSlowlogMaxLen(const char *value);
+
+    int32_t setLatencyTracking(const char *value);
+
+    struct Summary {
+        uint64_t calls;
+        uint64_t duration; /* Nanoseconds */
+        uint64_t rejected;
+        uint64_t histogramTotal;
+        LatencyHistogram::Counts histogram;
+    };
+
+    /* The counters of every loop for one command. */
+    void getSummary(size_t id, Summary *summary);
+
+    sds genCommandStats(sds info);
+
+    sds genLatencyStats(sds info);
+
+    const static int32_t kSlowlogMaxArgc = 32;
+    const static int32_t kSlowlogMaxString = 128;
+
+private:
+    CommandStats(const CommandStats &);
+
+    void operator=(const CommandStats &);
+
+    struct Counter {
+        std::atomic <uint64_t> calls;
+        std::atomic <uint64_t> duration;
+        std::atomic <uint64_t> rejected;
+        std::atomic<LatencyHistogram *> histogram;
+    };
+
+    struct alignas(64) ThreadStats {
+        const CommandStats *owner;
+        std::unique_ptr<Counter[]> counters;
+    };
+
+    ThreadStats *getThreadStats();
+
+    static void add(std::atomic <uint64_t> &counter, uint64_t value) {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    std::atomic <int64_t> slowlogSlowerThan;
+    std::atomic <size_t> slowlogMaxLen;
+    std::atomic<bool> latencyTracking;
+
+    std::mutex mutex;
+    std::vector <std::unique_ptr<ThreadStats>> threads;
+    std::deque <SlowlogEntry> slowlog;
+    int64_t slowlogNextId;
+};
@@ -0,0 +1,129 @@
+#include "taskqueue.h"
+
+/* Tasks a thread took for pushing and has not used yet. */
+struct TaskCache {
+    Task *head = nullptr;
+
+    ~TaskCache();
+};
+
+static thread_local TaskCache taskCache;
+
+TaskQueue::Batch::Batch(TaskQueue *queue)
+        : queue(queue),
+          newest(nullptr),
+          oldest(nullptr),
+          count(0) {
+
+}
+
+TaskQueue::Batch::~Batch() {
+    while (newest != nullptr) {
+        Task *task = newest;
+        newest = task->next;
+        task->finish(false);
+        delete task;
+    }
+}
+
+TaskQueue::TaskQueue()
+        : head(nullptr),
+          freeTasks(nullptr) {
+
+}
+
+TaskQueue::~TaskQueue() {
+    Task *task = head.exchange(nullptr);
+    while (task != nullptr) {
+        Task *next = task->next;
+        task->finish(false);
+        delete task;
+        task = next;
+    }
+
+    task = freeTasks.exchange(nullptr);
+    while (task != nullptr) {
+        Task *next = task->next;
+        delete task;
+        task = next;
+    }
+}
+
+TaskCache::~TaskCache() {
+    while (head != nullptr) {
+        Task *task = head;
+        head = task->next;
+        delete task;
+    }
+}
+
+Task *TaskQueue::allocate() {
+    Task *task = taskCache.head;
+    if (task == nullptr) {
+        task = freeTasks.exchange(nullptr, std::memory_order_acquire);
+        if (task == nullptr) {
+            return new Task();
+        }
+    }
+
+    taskCache.head = task->next;
+    task->next = nullptr;
+    return task;
+}
+
+void TaskQueue::pushList(Task *newest, Task *oldest) {
+    Task *old = head.load(std::memory_order_relaxed);
+    do {
+        oldest->next = old;
+    } while (!head.compare_exchange_weak(old, newest,
+                                         std::memory_order_release, std::memory_order_relaxed));
+}
+
+void TaskQueue::push(Batch &batch) {
+    if (batch.newest == nullptr) {
+        return;
+    }
+
+    assert(batch.queue == this);
+    pushList(batch.newest, batch.oldest);
+    batch.newest = nullptr;
+    batch.oldest = nullptr;
+    batch.count = 0;
+}
+
+size_t TaskQueue::drain() {
+    Task *task = head.exchange(nullptr, std::memory_order_acquire);
+    if (task == nullptr) {
+        return 0;
+    }
+
+    /* Newest first, turn it around. */
+    Task *oldest = nullptr;
+    while (task != nullptr) {
+        Task *next = task->next;
+        task->next = oldest;
+        oldest = task;
+        task = next;
+    }
+
+    /* The tasks stay linked while they run, so once done the whole list
+     * goes to the free list at once. */
+    size_t count = 0;
+    Task *newest = oldest;
+    for (task = oldest; task != nullptr; task = task->next) {
+        task->finish(true);
+        newest = task;
+        count++;
+    }
+
+    Task *old = freeTasks.load(std::memory_order_relaxed);
+    do {
+        newest->next = old;
+    } while (!freeTasks.compare_exchange_weak(old, oldest,
+                                              std::memory_order_release, std::memory_order_relaxed));
+    return count;
+}
+
+bool TaskQueue::empty() const {
+    return head.load(std::memory_order_acquire) == nullptr;
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include "all.h"
+
+/* A closure queued to a TaskQueue, and the node of the queue that holds it.
+ * The closure is kept in the task when it fits in kInlineSize bytes, which
+ * the binds and lambdas handed to the loops do, and on the heap otherwise.
+ * Tasks are reused instead of freed, so queueing a small closure allocates
+ * nothing once the queue is warm. */
+class Task {
+public:
+    const static size_t kInlineSize = 64;
+
+private:
+    friend class TaskQueue;
+
+    friend struct TaskCache;
+
+    Task()
+            : next(nullptr),
+              call(nullptr) {
+
+    }
+
+    Task(const Task &);
+
+    void operator=(const Task &);
+
+    template<class F>
+    void set(F &&f) {
+        typedef typename std::decay<F>::type Fn;
+        if constexpr (sizeof(Fn) <= kInlineSize && alignof(Fn) <= alignof(std::max_align_t)) {
+            new(storage) Fn(std::forward<F>(f));
+            call = &callInline<Fn>;
+        } else {
+            *reinterpret_cast<Fn **>(storage) = new Fn(std::forward<F>(f));
+            call = &callHeap<Fn>;
+        }
+    }
+
+    /* Run the closure if 'run', then destroy it. */
+    void finish(bool run) {
+        call(this, run);
+        call = nullptr;
+    }
+
+    template<class Fn>
+    static void callInline(Task *task, bool run) {
+        Fn *fn = std::launder(reinterpret_cast<Fn *>(task->storage));
+        if (run) {
+            (*fn)();
+        }
+        fn->~Fn();
+    }
+
+    template<class Fn>
+    static void callHeap(Task *task, bool run) {
+        Fn *fn = *reinterpret_cast<Fn **>(task->storage);
+        if (run) {
+            (*fn)();
+        }
+        delete fn;
+    }
+
+    Task *next;
+    void (*call)(Task *task, bool run);
+    alignas(std::max_align_t) unsigned char storage[kInlineSize];
+};
+
+/* Unbounded lock free queue of tasks: any thread pushes, one thread drains.
+ * The queue is a list of tasks, newest first. A push is a compare and swap
+ * on its head, a drain takes the whole list with one exchange and runs it
+ * oldest first, so a drain runs exactly the tasks pushed before it, in the
+ * order they were pushed.
+ *
+ * A drained task goes to the free list of the queue. Pushing takes a task
+ * from a cache of the pushing thread, refilled by taking the whole free
+ * list of the queue pushed to. Nothing ever pops a single task off a shared
+ * list, so neither list has the ABA problem. */
+class TaskQueue {
+public:
+    /* Tasks linked up front and pushed together with one compare and swap.
+     * Emptied by push(), whatever was not pushed is dropped unrun. */
+    class Batch {
+    public:
+        explicit Batch(TaskQueue *queue);
+
+        ~Batch();
+
+        template<class F>
+        void add(F &&f) {
+            Task *task = queue->allocate();
+            task->set(std::forward<F>(f));
+            task->next = newest;
+            newest = task;
+            if (oldest == nullptr) {
+                oldest = task;
+            }
+            count++;
+        }
+
+        size_t size() const { return count; }
+
+        bool empty() const { return count == 0; }
+
+    private:
+        friend class TaskQueue;
+
+        Batch(const Batch &);
+
+        void operator=(const Batch &);
+
+        TaskQueue *queue;
+        Task *newest;
+        Task *oldest;
+        size_t count;
+    };
+
+    TaskQueue();
+
+    /* Drops the tasks left without running them. */
+    ~TaskQueue();
+
+    template<class F>
+    void push(F &&f) {
+        Task *task = allocate();
+        task->set(std::forward<F>(f));
+        pushList(task, task);
+    }
+
+    void push(Batch &batch);
+
+    /* Run the tasks pushed before the call, returns the count. Only the
+     * thread that owns the queue may drain. */
+    size_t drain();
+
+    bool empty() const;
+
+private:
+    TaskQueue(const TaskQueue &);
+
+    void operator=(const TaskQueue &);
+
+    Task *allocate();
+
+    /* Push tasks linked newest to oldest through next. */
+    void pushList(Task *newest, Task *oldest);
+
+    alignas(64) std::atomic<Task *> head;
+    alignas(64) std::atomic<Task *> freeTasks;
+};
@@ -2,10 +2,13 @@
 #include "tcpconnection.h"
 #include "socket.h"
 
+thread_local Buffer *TcpConnection::replyBuffer = nullptr;
+
 TcpConnection::TcpConnection(EventLoop *loop, int32_t sockfd, const std::any &context)
 	: loop(loop),
 	sockfd(sockfd),
 	reading(true),
+	highWaterMark(64 * 1024 * 1024),
 	state(kConnecting),
 	channel(new Channel(loop, sockfd)),
 	context(context) {
@@ -17,6 +20,12 @@ TcpConnection::TcpConnection(EventLoop *loop, int32_t sockfd, const std::any &co
 		std::bind(&TcpConnection::handleClose, this));
 	channel->setErrorCallback(
 		std::bind(&TcpConnection::handleError, this));
+	if (loop->usingUring()) {
+		channel->setRecvCallback(
+			std::bind(&TcpConnection::handleRecv, this, std::placeholders::_1, std::placeholders::_2));
+		channel->setSendCompleteCallback(
+			std::bind(&TcpConnection::handleSendComplete, this));
+	}
 }
 
 TcpConnection::~TcpConnection() {
@@ -52,7 +61,7 @@ void TcpConnection::forceCloseInLoop() {
 
 void TcpConnection::shutdownInLoop() {
 	loop->assertInLoopThread();
-	if (!channel->isWriting()) {
+	if (!isWriting()) {
 		if (Socket::shutdown(sockfd) < 0) {
 			LOG_DEBUG << "";
 		}
@@ -90,15 +99,25 @@ void TcpConnection::handleWrite() {
 	loop->assertInLoopThread();
 
 	if (channel->isWriting()) {
-		if (writeBuffer.readableBytes() <=0) {
+		if (writeBuffer.readableBytes() <= 0 && !writeBuffer.hasRefs()) {
 			channel->disableWriting();
 			return ;
 		}
-		
-		ssize_t n = Socket::write(channel->getfd(), writeBuffer.peek(), writeBuffer.readableBytes());
+
+		ssize_t n;
+		if (writeBuffer.hasRefs()) {
+			int32_t saveErrno = 0;
+			n = writeBuffer.writeFd(channel->getfd(), &saveErrno);
+		}
+		else {
+			n = Socket::write(channel->getfd(), writeBuffer.peek(), writeBuffer.readableBytes());
+			if (n > 0) {
+				writeBuffer.retrieve(n);
+			}
+		}
+
 		if (n > 0) {
-			writeBuffer.retrieve(n);
-			if (writeBuffer.readableBytes() == 0) {
+			if (writeBuffer.readableBytes() == 0 && !writeBuffer.hasRefs()) {
 				channel->disableWriting();
 				if (writeCompleteCallback) {
 					loop->queueInLoop(std::bind(writeCompleteCallback, shared_from_this()));
@@ -118,6 +137,49 @@ void TcpConnection::handleWrite() {
 	}
 }
 
+void TcpConnection::handleRecv(const char *data, ssize_t n) {
+	loop->assertInLoopThread();
+	if (state == kDisconnected) {
+		return;
+	}
+
+	/* With reading stopped the bytes wait in the buffer for startRead(),
+	 * the kernel has taken them from the socket already. */
+	if (n > 0) {
+		readBuffer.append(data, n);
+		if (channel->isReading()) {
+			messageCallback(shared_from_this(), &readBuffer);
+		}
+	}
+	else {
+		handleClose();
+	}
+}
+
+void TcpConnection::handleSendComplete() {
+	loop->assertInLoopThread();
+	if (writeCompleteCallback) {
+		loop->queueInLoop(std::bind(writeCompleteCallback, shared_from_this()));
+	}
+
+	if (state == kDisconnecting) {
+		shutdownInLoop();
+	}
+}
+
+void TcpConnection::queueWrite() {
+	if (loop->usingUring()) {
+		loop->queueSend(channel.get(), &writeBuffer);
+	}
+	else if (!channel->isWriting()) {
+		channel->enableWriting();
+	}
+}
+
+bool TcpConnection::isWriting() {
+	return loop->usingUring() ? loop->isSending(channel.get()) : channel->isWriting();
+}
+
 void TcpConnection::handleClose() {
 	loop->assertInLoopThread();
 	assert(state == kConnected || state == kDisconnecting);
@@ -141,6 +203,9 @@ void TcpConnection::startReadInLoop() {
 	if (!reading || !channel->isReading()) {
 		channel->enableReading();
 		reading = true;
+		if (loop->usingUring() && readBuffer.readableBytes() > 0) {
+			messageCallback(shared_from_this(), &readBuffer);
+		}
 	}
 }
 
@@ -182,9 +247,7 @@ void TcpConnection::sendInLoopPipe() {
 void TcpConnection::sendPipe() {
 	loop->assertInLoopThread();
 	if (!channel->isNoneEvent()) {
-		if (!channel->isWriting()) {
-			channel->enableWriting();
-		}
+		queueWrite();
 	}
 }
 
@@ -240,9 +303,7 @@ void TcpConnection::sendPipeInLoop(const std::string_view &message) {
 void TcpConnection::sendPipeInLoop(const void *message, size_t len) {
 	writeBuffer.append(message, len);
 	if (!channel->isNoneEvent()) {
-		if (!channel->isWriting()) {
-			channel->enableWriting();
-		}
+		queueWrite();
 	}
 }
 
@@ -280,8 +341,9 @@ void TcpConnection::sendInLoop(const void *data, size_t len) {
 		return;
 	}
 
-	if (!channel->isWriting() && writeBuffer.readableBytes() == 0) {
-		Socket::write(channel->getfd(), data, len);
+	/* On io_uring the write goes out with the next submission instead. */
+	if (!loop->usingUring() && !channel->isWriting() && writeBuffer.readableBytes() == 0 && !writeBuffer.hasRefs()) {
+		nwrote = Socket::write(channel->getfd(), data, len);
 		if (nwrote >= 0) {
 			remaining = len - nwrote;
 			if (remaining == 0 && writeCompleteCallback) {
@@ -298,21 +360,20 @@ void TcpConnection::sendInLoop(const void *data, size_t len) {
 				}
 			}
 		}
+	}
 
-		assert(remaining <= len);
-		if (!faultError && remaining > 0) {
-			size_t oldLen = writeBuffer.readableBytes();
-			if (oldLen + remaining >= highWaterMark
-				&& oldLen < highWaterMark
-				&& highWaterMarkCallback) {
-				loop->queueInLoop(std::bind(highWaterMarkCallback, shared_from_this(), oldLen + remaining));
-			}
-
-			writeBuffer.append(static_cast<const char *>(data) + nwrote, remaining);
-			if (!channel->isWriting()) {
-				channel->enableWriting();
-			}
+	/* Anything not written directly queues up behind the pending output. */
+	assert(remaining <= len);
+	if (!faultError && remaining > 0) {
+		size_t oldLen = writeBuffer.readableBytes();
+		if (oldLen + remaining >= highWaterMark
+			&& oldLen < highWaterMark
+			&& highWaterMarkCallback) {
+			loop->queueInLoop(std::bind(highWaterMarkCallback, shared_from_this(), oldLen + remaining));
 		}
+
+		writeBuffer.append(static_cast<const char *>(data) + nwrote, remaining);
+		queueWrite();
 	}
 }
 
@@ -100,6 +100,10 @@ public:
 
     void handleError();
 
+    void handleRecv(const char *data, ssize_t n);
+
+    void handleSendComplete();
+
     void startReadInLoop();
 
     void stopReadInLoop();
@@ -116,7 +120,13 @@ public:
 
     void setContext(const std::any &context) { this->context = context; }
 
-    Buffer *outputBuffer() { return &writeBuffer; }
+    Buffer *outputBuffer() { return replyBuffer ? replyBuffer : &writeBuffer; }
+
+    /* Redirect outputBuffer() of every connection on the calling thread, used
+     * when a command runs on a loop that does not own the connection. */
+    static void setReplyBuffer(Buffer *buffer) { replyBuffer = buffer; }
+
+    static Buffer *getReplyBuffer() { return replyBuffer; }
 
     Buffer *intputBuffer() { return &readBuffer; }
 
@@ -125,6 +135,12 @@ private:
 
     void operator=(const TcpConnection &);
 
+    /* Have the output buffer sent, through the write callback or on a loop
+     * using io_uring with the next submission. */
+    void queueWrite();
+
+    bool isWriting();
+
     EventLoop *loop;
     int32_t sockfd;
     bool reading;
@@ -141,4 +157,6 @@ private:
     StateE state;
     ChannelPtr channel;
     std::any context;
+
+    static thread_local Buffer *replyBuffer;
 };
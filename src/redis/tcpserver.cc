@@ -1,11 +1,27 @@
 #include "tcpserver.h"
 #include "tcpconnection.h"
 
+static void setThreadAffinity(int32_t cpu) {
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+		LOG_WARN << "pin thread to cpu " << cpu << " failed";
+	}
+#endif
+}
+
 TcpServer::TcpServer(EventLoop *loop, const char *ip, int16_t port, const std::any &context)
 	: loop(loop),
 	acceptor(new Acceptor(loop, ip, port)),
 	threadPool(new ThreadPool(loop)),
-	context(context) {
+	context(context),
+	ip(ip),
+	port(port),
+	reusePort(false),
+	cpuAffinity(false),
+	nextCpu(0) {
 	acceptor->setNewConnectionCallback(std::bind(&TcpServer::newConnection, this, std::placeholders::_1));
 }
 
@@ -17,6 +33,17 @@ TcpServer::~TcpServer() {
 		conn->getLoop()->runInLoop(std::bind(&TcpConnection::connectDestroyed, conn));
 		conn.reset();
 	}
+
+	/* The connections of a loop are only touched on that loop. */
+	for (auto &it : loopAcceptors) {
+		LoopAcceptor *loopAcceptor = it.release();
+		loopAcceptor->loop->runInLoop([loopAcceptor]() {
+			for (auto &iter : loopAcceptor->connections) {
+				iter.second->connectDestroyed();
+			}
+			delete loopAcceptor;
+		});
+	}
 }
 
 void TcpServer::newConnection(int32_t sockfd) {
@@ -31,13 +58,78 @@ void TcpServer::newConnection(int32_t sockfd) {
 	loop->runInLoop(std::bind(&TcpConnection::connectEstablished, conn));
 }
 
+void TcpServer::newLoopConnection(LoopAcceptor *loopAcceptor, int32_t sockfd) {
+	loopAcceptor->loop->assertInLoopThread();
+	TcpConnectionPtr conn(new TcpConnection(loopAcceptor->loop, sockfd, context));
+	loopAcceptor->connections[sockfd] = conn;
+	conn->setConnectionCallback(std::move(connectionCallback));
+	conn->setMessageCallback(std::move(messageCallback));
+	conn->setWriteCompleteCallback(std::move(writeCompleteCallback));
+	conn->setCloseCallback(std::bind(&TcpServer::removeLoopConnection, this, loopAcceptor, std::placeholders::_1));
+	conn->connectEstablished();
+}
+
+void TcpServer::removeLoopConnection(LoopAcceptor *loopAcceptor, const TcpConnectionPtr &conn) {
+	loopAcceptor->loop->assertInLoopThread();
+	size_t n = loopAcceptor->connections.erase(conn->getSockfd());
+	(void)n;
+	assert(n == 1);
+	loopAcceptor->loop->queueInLoop(std::bind(&TcpConnection::connectDestroyed, conn));
+}
+
 void TcpServer::setThreadNum(int16_t numThreads) {
 	threadPool->setThreadNum(numThreads);
 }
 
+void TcpServer::setReusePort(bool on, bool cpuAffinity) {
+	reusePort = on;
+	this->cpuAffinity = on && cpuAffinity;
+}
+
 void TcpServer::start() {
-	threadPool->start(threadInitCallback);
-	acceptor->listen();
+	/* The pool starts its threads one after the other, the n-th IO loop
+	 * gets CPU n. */
+	int32_t cpus = std::max<int32_t>(1, std::thread::hardware_concurrency());
+	threadPool->start([this, cpus](EventLoop *ioLoop) {
+		if (cpuAffinity && ioLoop != loop) {
+			setThreadAffinity(nextCpu++ % cpus);
+		}
+
+		if (threadInitCallback) {
+			threadInitCallback(ioLoop);
+		}
+	});
+
+	std::vector<EventLoop *> loops = threadPool->getAllLoops();
+	if (!reusePort || loops[0] == loop) {
+		acceptor->listen();
+		return;
+	}
+
+	/* The socket of the base loop leaves the group before the IO loops
+	 * join it, so the group is in the order of the IO loops. */
+	acceptor.reset();
+	for (auto &it : loops) {
+		std::unique_ptr<LoopAcceptor> loopAcceptor(new LoopAcceptor());
+		loopAcceptor->loop = it;
+		loopAcceptor->acceptor.reset(new Acceptor(it, ip.c_str(), port));
+		loopAcceptor->acceptor->setNewConnectionCallback(
+			std::bind(&TcpServer::newLoopConnection, this, loopAcceptor.get(), std::placeholders::_1));
+		loopAcceptors.push_back(std::move(loopAcceptor));
+	}
+
+	if (cpuAffinity) {
+		if (loops.size() <= cpus) {
+			Socket::setReusePortCpu(loopAcceptors[0]->acceptor->getfd(), loops.size());
+		}
+		else {
+			LOG_WARN << "more IO loops than CPUs, connections are not steered by CPU";
+		}
+	}
+
+	for (auto &it : loopAcceptors) {
+		it->loop->runInLoop(std::bind(&Acceptor::listen, it->acceptor.get()));
+	}
 }
 
 void TcpServer::removeConnection(const TcpConnectionPtr &conn) {
@@ -32,6 +32,13 @@ public:
 
 	void setThreadNum(int16_t numThreads);
 
+	/* Give every IO loop a listening socket of its own on the port with
+	 * SO_REUSEPORT. The kernel spreads connections over the sockets and
+	 * each loop accepts and keeps its connections without the base loop.
+	 * With 'cpuAffinity' IO loop i is pinned to CPU i and a connection
+	 * goes to the loop on the CPU that received it. Call before start(). */
+	void setReusePort(bool on, bool cpuAffinity = false);
+
 	EventLoop *getLoop() const { return loop; }
 
 	ThreadPoolPtr getThreadPool() { return threadPool; }
@@ -59,4 +66,21 @@ private:
 	ConnectionMap connections;
 	std::any context;
 
+	struct LoopAcceptor {
+		EventLoop *loop;
+		AcceptorPtr acceptor;
+		ConnectionMap connections;
+	};
+
+	void newLoopConnection(LoopAcceptor *loopAcceptor, int32_t sockfd);
+
+	void removeLoopConnection(LoopAcceptor *loopAcceptor, const TcpConnectionPtr &conn);
+
+	std::string ip;
+	int16_t port;
+	bool reusePort;
+	bool cpuAffinity;
+	int32_t nextCpu;
+	std::vector <std::unique_ptr<LoopAcceptor>> loopAcceptors;
+
 };
@@ -1,332 +1,393 @@
-#include "timer.h"
-#include "eventloop.h"
-
-std::atomic <int64_t> Timer::numCreated = 0;
-
-Timer::Timer(TimerCallback &&cb,
-	TimeStamp &&expiration, bool repeat, double interval)
-	: repeat(repeat),
-	interval(interval),
-	expiration(std::move(expiration)),
-	callback(std::move(cb)),
-	sequence(++numCreated) {
-
-}
-
-Timer::~Timer() {
-
-}
-
-int64_t Timer::getSequence() {
-	return sequence;
-}
-
-TimeStamp &Timer::getExpiration() {
-	return expiration;
-}
-
-int64_t Timer::getWhen() {
-	return expiration.getMicroSecondsSinceEpoch();
-}
-
-bool Timer::getRepeat() {
-	return repeat;
-}
-
-void Timer::setSequence(int64_t seq) {
-	sequence = seq;
-}
-
-double Timer::getInterval() {
-	return interval;
-}
-
-void Timer::run() {
-	assert(callback != nullptr);
-	callback();
-}
-
-void Timer::restart(const TimeStamp &now) {
-	if (repeat) {
-		expiration = std::move(addTime(now, interval));
-	}
-	else {
-		expiration = std::move(TimeStamp::invalid());
-	}
-}
-
-std::string TimeStamp::toString() const {
-	char buf[32] = { 0 };
-	int64_t seconds = microSecondsSinceEpoch / kMicroSecondsPerSecond;
-	int64_t microseconds = microSecondsSinceEpoch % kMicroSecondsPerSecond;
-	snprintf(buf, sizeof(buf) - 1, "%"
-		PRId64
-		".%06"
-		PRId64
-		"", seconds, microseconds);
-	return buf;
-}
-
-std::string TimeStamp::toFormattedString(bool showMicroseconds) const {
-	char buf[32] = { 0 };
-	time_t seconds = static_cast<time_t>(microSecondsSinceEpoch / kMicroSecondsPerSecond);
-	struct tm tm;
-	time_t now = time(0);
-	tm = *(localtime(&now));
-	if (showMicroseconds) {
-		int microseconds = static_cast<int>(microSecondsSinceEpoch % kMicroSecondsPerSecond);
-		snprintf(buf, sizeof(buf), "%4d%02d%02d %02d:%02d:%02d.%06d",
-			tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
-			tm.tm_hour, tm.tm_min, tm.tm_sec,
-			microseconds);
-	}
-	else {
-		snprintf(buf, sizeof(buf), "%4d%02d%02d %02d:%02d:%02d",
-			tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
-			tm.tm_hour, tm.tm_min, tm.tm_sec);
-	}
-	return buf;
-}
-
-#ifdef __linux__
-int64_t createTimerfd()
-{
-	int64_t timerfd = ::timerfd_create(CLOCK_MONOTONIC,
-		TFD_NONBLOCK | TFD_CLOEXEC);
-	if (timerfd < 0)
-	{
-		assert(false);
-	}
-
-	return timerfd;
-}
-#endif
-
-int64_t howMuchTimeFrom(const TimeStamp &when) {
-	int64_t microseconds = when.getMicroSecondsSinceEpoch()
-		- TimeStamp::now().getMicroSecondsSinceEpoch();
-	if (microseconds < 1000) {
-		microseconds = 1000;
-	}
-	return static_cast<int>(microseconds / 1000);
-}
-
-
-int64_t TimerQueue::getTimeout() const {
-	loop->assertInLoopThread();
-	if (timers.empty()) {
-		return 1000;
-	}
-	else {
-		return howMuchTimeFrom(timers.begin()->second->getExpiration());
-	}
-}
-
-#ifdef __linux__
-struct timespec howMuchTimeFromNow(const TimeStamp &when)
-{
-	int64_t microseconds = when.getMicroSecondsSinceEpoch()
-		- TimeStamp::now().getMicroSecondsSinceEpoch();
-	if (microseconds < 100)
-	{
-		microseconds = 100;
-	}
-
-	struct timespec ts;
-	ts.tv_sec = static_cast<time_t>(microseconds / TimeStamp::kMicroSecondsPerSecond);
-	ts.tv_nsec = static_cast<int64_t>((microseconds % TimeStamp::kMicroSecondsPerSecond) * 1000);
-	return ts;
-}
-
-void resetTimerfd(int64_t timerfd, const TimeStamp &expiration)
-{
-	struct itimerspec newValue;
-	struct itimerspec oldValue;
-	bzero(&newValue, sizeof newValue);
-	bzero(&oldValue, sizeof oldValue);
-	newValue.it_value = howMuchTimeFromNow(expiration);
-	int64_t net = ::timerfd_settime(timerfd, 0, &newValue, &oldValue);
-	if (net < 0)
-	{
-		assert(false);
-	}
-}
-
-void readTimerfd(int64_t timerfd, const TimeStamp &now)
-{
-	uint64_t howmany;
-	ssize_t n = ::read(timerfd, &howmany, sizeof howmany);
-	if (n != sizeof howmany)
-	{
-		assert(false);
-	}
-}
-#endif
-
-TimerQueue::TimerQueue(EventLoop *loop)
-	: loop(loop),
-#ifdef __linux__
-	timerfd(createTimerfd()),
-	timerfdChannel(loop, timerfd),
-#endif
-	callingExpiredTimers(false) {
-#ifdef __linux__
-	timerfdChannel.setReadCallback(std::bind(&TimerQueue::handleRead, this));
-	timerfdChannel.enableReading();
-#endif
-}
-
-TimerQueue::~TimerQueue() {
-#ifdef __linux__
-	timerfdChannel.disableAll();
-	timerfdChannel.remove();
-	::close(timerfd);
-#endif
-}
-
-TimerPtr TimerQueue::addTimer(double when, bool repeat, TimerCallback &&cb) {
-	TimeStamp time(addTime(TimeStamp::now(), when));
-	TimerPtr timer(new Timer(std::move(cb), std::move(time), repeat, when));
-	loop->runInLoop(std::bind(&TimerQueue::addTimerInLoop, this, timer));
-	return timer;
-}
-
-TimerPtr TimerQueue::addTimer(TimeStamp &&stamp, double when, bool repeat, TimerCallback &&cb) {
-	TimerPtr timer(new Timer(std::move(cb), std::move(stamp), repeat, when));
-	loop->runInLoop(std::bind(&TimerQueue::addTimerInLoop, this, timer));
-	return timer;
-}
-
-void TimerQueue::cancelTimer(const TimerPtr &timer) {
-	loop->runInLoop(std::bind(&TimerQueue::cancelInloop, this, timer));
-}
-
-void TimerQueue::cancelInloop(const TimerPtr &timer) {
-	loop->assertInLoopThread();
-	assert(timers.size() == activeTimers.size());
-
-	auto it = activeTimers.find(timer->getSequence());
-	if (it != activeTimers.end()) {
-		auto iter = timers.find(timer->getWhen());
-		while (iter != timers.end()) {
-			if (timer->getSequence() == iter->second->getSequence()) {
-				timers.erase(iter);
-				break;
-			}
-			else {
-				++iter;
-			}
-		}
-		activeTimers.erase(it);
-	}
-	else if (callingExpiredTimers) {
-		cancelingTimers.insert(std::make_pair(timer->getSequence(), timer));
-	}
-	assert(timers.size() == activeTimers.size());
-}
-
-void TimerQueue::addTimerInLoop(const TimerPtr &timer) {
-	loop->assertInLoopThread();
-	bool earliestChanged = insert(timer);
-	if (earliestChanged) {
-#ifdef __linux__
-		resetTimerfd(timerfd, timer->getExpiration());
-#endif
-	}
-}
-
-TimerPtr TimerQueue::getTimerBegin() {
-	if (timers.empty()) {
-		return nullptr;
-	}
-	return timers.begin()->second;
-}
-
-void TimerQueue::handleRead() {
-	loop->assertInLoopThread();
-	assert(timers.size() == activeTimers.size());
-	TimeStamp now(TimeStamp::now());
-
-#ifdef __linux__
-	readTimerfd(timerfd, now);
-#endif
-	getExpired(now);
-
-	callingExpiredTimers = true;
-	cancelingTimers.clear();
-	// safe to callback outside critical section
-
-	for (auto &it : expired) {
-		it.second->run();
-	}
-
-	callingExpiredTimers = false;
-	reset(now);
-}
-
-bool TimerQueue::insert(const TimerPtr &timer) {
-	loop->assertInLoopThread();
-	assert(timers.size() == activeTimers.size());
-
-	bool earliestChanged = false;
-	int64_t microseconds = timer->getExpiration().getMicroSecondsSinceEpoch();
-	auto it = timers.begin();
-	if (it == timers.end() || microseconds < it->first) {
-		earliestChanged = true;
-	}
-
-	timers.insert(std::make_pair(microseconds, timer));
-	activeTimers.insert(std::make_pair(timer->getSequence(), timer));
-
-	if (timers.size() != activeTimers.size()) {
-		assert(false);
-	}
-	assert(timers.size() == activeTimers.size());
-	return earliestChanged;
-}
-
-void TimerQueue::reset(const TimeStamp &now) {
-	TimeStamp nextExpire;
-	for (auto &it : expired) {
-		if (it.second->getRepeat() &&
-			cancelingTimers.find(it.second->getSequence()) == cancelingTimers.end()) {
-			it.second->restart(now);
-			insert(it.second);
-		}
-		else {
-
-		}
-	}
-
-	expired.clear();
-	if (!timers.empty()) {
-		nextExpire = timers.begin()->second->getExpiration();
-	}
-
-	if (nextExpire.valid()) {
-#ifdef __linux__
-		resetTimerfd(timerfd, nextExpire);
-#endif
-	}
-}
-
-size_t TimerQueue::getTimerSize() {
-	loop->assertInLoopThread();
-	assert(timers.size() == activeTimers.size());
-	return timers.size();
-}
-
-void TimerQueue::getExpired(const TimeStamp &now) {
-	assert(timers.size() == activeTimers.size());
-	auto end = timers.lower_bound(now.getMicroSecondsSinceEpoch());
-	assert(end == timers.end() || now.getMicroSecondsSinceEpoch() <= end->first);
-	expired.insert(timers.begin(), end);
-	timers.erase(timers.begin(), end);
-
-	for (auto &it : expired) {
-		size_t n = activeTimers.erase(it.second->getSequence());
-		assert(n == 1);
-		(void)n;
-	}
-	assert(timers.size() == activeTimers.size());
-}
+#include "timer.h"
+#include "eventloop.h"
+
+static int32_t countTrailingZeros(uint64_t mask) {
+#ifdef _WIN64
+	unsigned long idx;
+	_BitScanForward64(&idx, mask);
+	return idx;
+#else
+	return __builtin_ctzll(mask);
+#endif
+}
+
+/* First tick at or after a deadline in microseconds, so that no timer runs
+ * early. */
+static int64_t tickOf(int64_t when) {
+	return (when + 999) / 1000;
+}
+
+Timer::Timer(TimerCallback &&cb, int64_t when, bool repeat, double interval)
+	: repeat(repeat),
+	canceled(false),
+	interval(interval),
+	when(when),
+	callback(std::move(cb)),
+	prev(nullptr),
+	next(nullptr),
+	slot(-1) {
+
+}
+
+Timer::~Timer() {
+
+}
+
+int64_t Timer::getWhen() const {
+	return when;
+}
+
+bool Timer::getRepeat() const {
+	return repeat;
+}
+
+double Timer::getInterval() const {
+	return interval;
+}
+
+void Timer::run() {
+	assert(callback != nullptr);
+	callback();
+}
+
+std::string TimeStamp::toString() const {
+	char buf[32] = { 0 };
+	int64_t seconds = microSecondsSinceEpoch / kMicroSecondsPerSecond;
+	int64_t microseconds = microSecondsSinceEpoch % kMicroSecondsPerSecond;
+	snprintf(buf, sizeof(buf) - 1, "%"
+		PRId64
+		".%06"
+		PRId64
+		"", seconds, microseconds);
+	return buf;
+}
+
+std::string TimeStamp::toFormattedString(bool showMicroseconds) const {
+	char buf[32] = { 0 };
+	time_t seconds = static_cast<time_t>(microSecondsSinceEpoch / kMicroSecondsPerSecond);
+	struct tm tm;
+	time_t now = time(0);
+	tm = *(localtime(&now));
+	if (showMicroseconds) {
+		int microseconds = static_cast<int>(microSecondsSinceEpoch % kMicroSecondsPerSecond);
+		snprintf(buf, sizeof(buf), "%4d%02d%02d %02d:%02d:%02d.%06d",
+			tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+			tm.tm_hour, tm.tm_min, tm.tm_sec,
+			microseconds);
+	}
+	else {
+		snprintf(buf, sizeof(buf), "%4d%02d%02d %02d:%02d:%02d",
+			tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+			tm.tm_hour, tm.tm_min, tm.tm_sec);
+	}
+	return buf;
+}
+
+#ifdef __linux__
+int64_t createTimerfd()
+{
+	int64_t timerfd = ::timerfd_create(CLOCK_MONOTONIC,
+		TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timerfd < 0)
+	{
+		assert(false);
+	}
+
+	return timerfd;
+}
+
+void resetTimerfd(int64_t timerfd, int64_t tick)
+{
+	/* Absolute, on the clock of monotonicNow(). A zero it_value would
+	 * disarm the timer instead. */
+	struct itimerspec newValue;
+	bzero(&newValue, sizeof newValue);
+	tick = std::max<int64_t>(tick, 1);
+	newValue.it_value.tv_sec = static_cast<time_t>(tick / 1000);
+	newValue.it_value.tv_nsec = static_cast<long>((tick % 1000) * 1000000);
+	int64_t net = ::timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &newValue, nullptr);
+	if (net < 0)
+	{
+		assert(false);
+	}
+}
+
+void readTimerfd(int64_t timerfd)
+{
+	/* Nothing to read if the timer was set again since it fired. */
+	uint64_t howmany;
+	ssize_t n = ::read(timerfd, &howmany, sizeof howmany);
+	(void)n;
+}
+#endif
+
+TimerQueue::TimerQueue(EventLoop *loop)
+	: loop(loop),
+#ifdef __linux__
+	timerfd(createTimerfd()),
+	timerfdChannel(loop, timerfd),
+#endif
+	armed(INT64_MAX),
+	now(monotonicNow()),
+	count(0) {
+	memset(slots, 0, sizeof(slots));
+	memset(bitmap, 0, sizeof(bitmap));
+	current = tickOf(now);
+#ifdef __linux__
+	timerfdChannel.setReadCallback(std::bind(&TimerQueue::handleRead, this));
+	timerfdChannel.enableReading();
+#endif
+}
+
+TimerQueue::~TimerQueue() {
+#ifdef __linux__
+	timerfdChannel.disableAll();
+	timerfdChannel.remove();
+	::close(timerfd);
+#endif
+	for (int32_t i = 0; i <= kRunningSlot; i++) {
+		while (slots[i] != nullptr) {
+			Timer *timer = slots[i];
+			TimerPtr self = std::move(timer->self);
+			unlink(timer);
+		}
+	}
+}
+
+int64_t TimerQueue::monotonicNow() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void TimerQueue::updateTime() {
+	now = monotonicNow();
+}
+
+TimerPtr TimerQueue::addTimer(double when, bool repeat, TimerCallback &&cb) {
+	int64_t base = loop->isInLoopThread() ? now : monotonicNow();
+	TimerPtr timer = std::make_shared<Timer>(std::move(cb),
+		base + static_cast<int64_t>(when * TimeStamp::kMicroSecondsPerSecond), repeat, when);
+	loop->runInLoop(std::bind(&TimerQueue::addTimerInLoop, this, timer));
+	return timer;
+}
+
+TimerPtr TimerQueue::addTimer(TimeStamp &&stamp, double when, bool repeat, TimerCallback &&cb) {
+	TimeStamp expiration = addTime(stamp, when);
+	int64_t delay = expiration.getMicroSecondsSinceEpoch() - TimeStamp::now().getMicroSecondsSinceEpoch();
+	TimerPtr timer = std::make_shared<Timer>(std::move(cb), monotonicNow() + delay, repeat, when);
+	loop->runInLoop(std::bind(&TimerQueue::addTimerInLoop, this, timer));
+	return timer;
+}
+
+void TimerQueue::cancelTimer(const TimerPtr &timer) {
+	loop->runInLoop(std::bind(&TimerQueue::cancelInloop, this, timer));
+}
+
+void TimerQueue::cancelInloop(const TimerPtr &timer) {
+	loop->assertInLoopThread();
+	/* A timer canceled while it runs is not scheduled again. */
+	timer->canceled = true;
+	if (timer->slot >= 0) {
+		unlink(timer.get());
+		timer->self.reset();
+	}
+}
+
+void TimerQueue::addTimerInLoop(const TimerPtr &timer) {
+	loop->assertInLoopThread();
+	if (timer->canceled) {
+		return;
+	}
+
+	if (count == 0) {
+		/* Nothing ran the wheel while it was empty. */
+		current = std::max(current, monotonicNow() / 1000);
+	}
+
+	timer->self = timer;
+	int64_t tick = place(timer.get());
+	if (tick < armed) {
+		arm(tick);
+	}
+}
+
+void TimerQueue::arm(int64_t tick) {
+	armed = tick;
+#ifdef __linux__
+	resetTimerfd(timerfd, tick);
+#endif
+}
+
+void TimerQueue::link(Timer *timer, int32_t slot) {
+	timer->slot = slot;
+	timer->prev = nullptr;
+	timer->next = slots[slot];
+	if (timer->next != nullptr) {
+		timer->next->prev = timer;
+	}
+	slots[slot] = timer;
+
+	if (slot < kRunningSlot) {
+		bitmap[slot >> kWheelBits] |= uint64_t(1) << (slot & kWheelMask);
+	}
+	count++;
+}
+
+void TimerQueue::unlink(Timer *timer) {
+	int32_t slot = timer->slot;
+	assert(slot >= 0);
+	if (timer->prev != nullptr) {
+		timer->prev->next = timer->next;
+	}
+	else {
+		slots[slot] = timer->next;
+	}
+
+	if (timer->next != nullptr) {
+		timer->next->prev = timer->prev;
+	}
+
+	timer->prev = nullptr;
+	timer->next = nullptr;
+	timer->slot = -1;
+
+	if (slot < kRunningSlot && slots[slot] == nullptr) {
+		bitmap[slot >> kWheelBits] &= ~(uint64_t(1) << (slot & kWheelMask));
+	}
+	count--;
+}
+
+int64_t TimerQueue::place(Timer *timer) {
+	/* Deadlines beyond the top level are parked in its farthest slot, and
+	 * placed again every time that slot is cascaded. */
+	int64_t tick = std::max(tickOf(timer->when), current);
+	int64_t delta = tick - current;
+	const int64_t range = int64_t(1) << (kWheelLevels * kWheelBits);
+	if (delta >= range) {
+		tick = current + range - 1;
+		delta = range - 1;
+	}
+
+	int32_t level = 0;
+	while (delta >= (int64_t(1) << ((level + 1) * kWheelBits))) {
+		level++;
+	}
+
+	int32_t shift = level * kWheelBits;
+	link(timer, (level << kWheelBits) + int32_t((tick >> shift) & kWheelMask));
+	/* A timer above level 0 needs the wheel at the start of its stretch,
+	 * which always lies after the current one. */
+	return (tick >> shift) << shift;
+}
+
+void TimerQueue::cascade() {
+	for (int32_t level = 1; level < kWheelLevels; level++) {
+		int32_t idx = (current >> (level * kWheelBits)) & kWheelMask;
+		int32_t slot = (level << kWheelBits) + idx;
+		Timer *timer = slots[slot];
+		while (timer != nullptr) {
+			Timer *next = timer->next;
+			unlink(timer);
+			place(timer);
+			timer = next;
+		}
+
+		if (idx != 0) {
+			break;
+		}
+	}
+}
+
+int64_t TimerQueue::nextTick() const {
+	/* The first tick at or after 'current' with work to do: an occupied
+	 * level 0 slot or the cascade of an occupied slot above. */
+	int64_t next = INT64_MAX;
+	for (int32_t level = 0; level < kWheelLevels; level++) {
+		if (bitmap[level] == 0) {
+			continue;
+		}
+
+		int32_t shift = level * kWheelBits;
+		int64_t first = current >> shift;
+		if (level > 0 && (current & ((int64_t(1) << shift) - 1)) != 0) {
+			first++;
+		}
+
+		int32_t d = first & kWheelMask;
+		uint64_t mask = (bitmap[level] >> d) | (bitmap[level] << ((kWheelSize - d) & kWheelMask));
+		int64_t tick = (first + countTrailingZeros(mask)) << shift;
+		next = std::min(next, tick);
+	}
+	return next;
+}
+
+void TimerQueue::expire(int64_t tick) {
+	while (true) {
+		int64_t next = nextTick();
+		if (next > tick) {
+			break;
+		}
+
+		current = next;
+		if ((current & kWheelMask) == 0) {
+			cascade();
+		}
+
+		/* Timers added by the callbacks go to a later tick, so even one
+		 * that keeps adding itself with no delay runs once per tick. */
+		int32_t slot = current & kWheelMask;
+		while (slots[slot] != nullptr) {
+			Timer *timer = slots[slot];
+			unlink(timer);
+			link(timer, kRunningSlot);
+		}
+		current++;
+
+		while (slots[kRunningSlot] != nullptr) {
+			Timer *timer = slots[kRunningSlot];
+			TimerPtr self = std::move(timer->self);
+			unlink(timer);
+			timer->run();
+
+			if (timer->repeat && !timer->canceled && timer->slot < 0) {
+				timer->when = now + static_cast<int64_t>(timer->interval * TimeStamp::kMicroSecondsPerSecond);
+				timer->self = self;
+				place(timer);
+			}
+		}
+	}
+
+	current = std::max(current, tick + 1);
+}
+
+void TimerQueue::handleRead() {
+	loop->assertInLoopThread();
+#ifdef __linux__
+	readTimerfd(timerfd);
+#endif
+	/* Timers added by the callbacks do not set the timerfd, it is set once
+	 * for all of them when they are done. */
+	armed = INT64_MIN;
+	updateTime();
+	expire(now / 1000);
+
+	armed = INT64_MAX;
+	int64_t tick = nextTick();
+	if (tick != INT64_MAX) {
+		arm(tick);
+	}
+}
+
+int64_t TimerQueue::getTimeout() const {
+	loop->assertInLoopThread();
+	int64_t tick = nextTick();
+	if (tick == INT64_MAX) {
+		return 1000;
+	}
+	return std::max<int64_t>(tick - monotonicNow() / 1000, 1);
+}
+
+size_t TimerQueue::getTimerSize() {
+	loop->assertInLoopThread();
+	return count;
+}
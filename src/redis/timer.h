@@ -1,154 +1,190 @@
-#pragma once
-
-#include "all.h"
-#include "channel.h"
-#include "callback.h"
-
-class EventLoop;
-
-class TimeStamp {
-public:
-	TimeStamp()
-		: microSecondsSinceEpoch(0) {
-
-	}
-
-	explicit TimeStamp(int64_t microSecondsSinceEpochArg)
-		: microSecondsSinceEpoch(microSecondsSinceEpochArg) {
-
-	}
-
-	int64_t getMicroSecondsSinceEpoch() const {
-		return microSecondsSinceEpoch;
-	}
-
-	time_t secondsSinceEpoch() const {
-		return static_cast<time_t>(microSecondsSinceEpoch / kMicroSecondsPerSecond);
-	}
-
-	bool valid() const { return microSecondsSinceEpoch > 0; }
-
-	std::string toFormattedString(bool showMicroseconds = true) const;
-
-	static TimeStamp now() {
-		auto timeNow = std::chrono::system_clock::now();
-		auto microseconds = std::chrono::duration_cast<std::chrono::microseconds>(timeNow.time_since_epoch());
-		return TimeStamp(microseconds.count());
-	}
-
-	std::string toString() const;
-
-	static TimeStamp invalid() { return TimeStamp(); }
-
-	static const int32_t kMicroSecondsPerSecond = 1000 * 1000;
-
-private:
-	int64_t microSecondsSinceEpoch;
-};
-
-inline bool operator<(const TimeStamp &lhs, const TimeStamp &rhs) {
-	return lhs.getMicroSecondsSinceEpoch() < rhs.getMicroSecondsSinceEpoch();
-}
-
-inline bool operator==(const TimeStamp &lhs, const TimeStamp &rhs) {
-	return lhs.getMicroSecondsSinceEpoch() == rhs.getMicroSecondsSinceEpoch();
-}
-
-inline TimeStamp addTime(const TimeStamp &timestamp, double seconds) {
-	int64_t delta = static_cast<int64_t>(seconds * TimeStamp::kMicroSecondsPerSecond);
-	return TimeStamp(timestamp.getMicroSecondsSinceEpoch() + delta);
-}
-
-inline double timeDifference(const TimeStamp &high, const TimeStamp &low) {
-	int64_t diff = high.getMicroSecondsSinceEpoch() - low.getMicroSecondsSinceEpoch();
-	return static_cast<double>(diff) / TimeStamp::kMicroSecondsPerSecond;
-}
-
-class Timer {
-public:
-	Timer(TimerCallback &&cb, TimeStamp &&expiration,
-		bool repeat, double interval);
-
-	~Timer();
-
-	void run();
-
-	int64_t getSequence();
-
-	int64_t getWhen();
-
-	TimeStamp &getExpiration();
-
-	bool getRepeat();
-
-	void setSequence(int64_t seq);
-
-	void restart(const TimeStamp &now);
-
-	double getInterval();
-
-private:
-	Timer(const Timer &);
-
-	void operator=(const Timer &);
-
-	bool repeat;
-	double interval;
-	int64_t sequence;
-	TimeStamp expiration;
-	TimerCallback callback;
-	static std::atomic <int64_t> numCreated;
-};
-
-class TimerQueue {
-public:
-	TimerQueue(EventLoop *loop);
-
-	~TimerQueue();
-
-	void cancelTimer(const TimerPtr &timer);
-
-	void handleRead();
-
-	TimerPtr addTimer(double when, bool repeat, TimerCallback &&cb);
-
-	TimerPtr addTimer(TimeStamp &&stamp, double when, bool repeat, TimerCallback &&cb);
-
-	TimerPtr getTimerBegin();
-
-	int64_t getTimeout() const;
-
-	size_t getTimerSize();
-
-private:
-	TimerQueue(const TimerQueue &);
-
-	void operator=(const TimerQueue &);
-
-	EventLoop *loop;
-	int32_t timerfd;
-#ifdef __linux__
-	Channel timerfdChannel;
-#endif
-
-	void cancelInloop(const TimerPtr &timer);
-
-	void addTimerInLoop(const TimerPtr &timer);
-
-	void getExpired(const TimeStamp &now);
-
-	void reset(const TimeStamp &now);
-
-	bool insert(const TimerPtr &timer);
-
-	typedef std::multimap <int64_t, TimerPtr> TimerList;
-	typedef std::map <int64_t, TimerPtr> ActiveTimer;
-
-	ActiveTimer activeTimers;
-	ActiveTimer cancelingTimers;
-	TimerList expired;
-	TimerList timers;
-	bool callingExpiredTimers;
-};
-
-
+#pragma once
+
+#include "all.h"
+#include "channel.h"
+#include "callback.h"
+
+class EventLoop;
+
+class TimeStamp {
+public:
+	TimeStamp()
+		: microSecondsSinceEpoch(0) {
+
+	}
+
+	explicit TimeStamp(int64_t microSecondsSinceEpochArg)
+		: microSecondsSinceEpoch(microSecondsSinceEpochArg) {
+
+	}
+
+	int64_t getMicroSecondsSinceEpoch() const {
+		return microSecondsSinceEpoch;
+	}
+
+	time_t secondsSinceEpoch() const {
+		return static_cast<time_t>(microSecondsSinceEpoch / kMicroSecondsPerSecond);
+	}
+
+	bool valid() const { return microSecondsSinceEpoch > 0; }
+
+	std::string toFormattedString(bool showMicroseconds = true) const;
+
+	static TimeStamp now() {
+		auto timeNow = std::chrono::system_clock::now();
+		auto microseconds = std::chrono::duration_cast<std::chrono::microseconds>(timeNow.time_since_epoch());
+		return TimeStamp(microseconds.count());
+	}
+
+	std::string toString() const;
+
+	static TimeStamp invalid() { return TimeStamp(); }
+
+	static const int32_t kMicroSecondsPerSecond = 1000 * 1000;
+
+private:
+	int64_t microSecondsSinceEpoch;
+};
+
+inline bool operator<(const TimeStamp &lhs, const TimeStamp &rhs) {
+	return lhs.getMicroSecondsSinceEpoch() < rhs.getMicroSecondsSinceEpoch();
+}
+
+inline bool operator==(const TimeStamp &lhs, const TimeStamp &rhs) {
+	return lhs.getMicroSecondsSinceEpoch() == rhs.getMicroSecondsSinceEpoch();
+}
+
+inline TimeStamp addTime(const TimeStamp &timestamp, double seconds) {
+	int64_t delta = static_cast<int64_t>(seconds * TimeStamp::kMicroSecondsPerSecond);
+	return TimeStamp(timestamp.getMicroSecondsSinceEpoch() + delta);
+}
+
+inline double timeDifference(const TimeStamp &high, const TimeStamp &low) {
+	int64_t diff = high.getMicroSecondsSinceEpoch() - low.getMicroSecondsSinceEpoch();
+	return static_cast<double>(diff) / TimeStamp::kMicroSecondsPerSecond;
+}
+
+/* A timer of a TimerQueue. Deadlines are microseconds of the monotonic
+ * clock. While scheduled, the timer is linked into a slot of the wheel of
+ * its queue and holds a reference to itself, so a timer nobody else keeps
+ * runs all the same. */
+class Timer {
+public:
+	Timer(TimerCallback &&cb, int64_t when, bool repeat, double interval);
+
+	~Timer();
+
+	void run();
+
+	int64_t getWhen() const;
+
+	bool getRepeat() const;
+
+	double getInterval() const;
+
+private:
+	friend class TimerQueue;
+
+	Timer(const Timer &);
+
+	void operator=(const Timer &);
+
+	bool repeat;
+	bool canceled;
+	double interval;
+	int64_t when;
+	TimerCallback callback;
+
+	Timer *prev;
+	Timer *next;
+	int32_t slot;	/* -1 when not linked */
+	TimerPtr self;	/* Set while linked */
+};
+
+/* Timers of a loop in a hierarchical timing wheel with 1ms ticks: kWheelLevels
+ * levels of kWheelSize slots, a slot of level n holding the timers due in
+ * one stretch of kWheelSize^n ticks. A slot is a list through the timers
+ * themselves, so adding and canceling a timer is O(1) and allocates
+ * nothing. When the wheel reaches the start of a stretch, its slot is
+ * cascaded, its timers moved down to the level that fits how far away
+ * they are now. A bitmap per level finds the next tick with work without
+ * going through the empty ones.
+ *
+ * The timerfd is set, to an absolute time, for the next tick with work,
+ * and set again only when a timer is added before it or once it fired.
+ * Timers added by the loop thread are relative to the time cached at the
+ * start of the loop iteration. */
+class TimerQueue {
+public:
+	TimerQueue(EventLoop *loop);
+
+	~TimerQueue();
+
+	void cancelTimer(const TimerPtr &timer);
+
+	void handleRead();
+
+	TimerPtr addTimer(double when, bool repeat, TimerCallback &&cb);
+
+	/* 'stamp' is a wall clock time, the timer runs 'when' seconds after it. */
+	TimerPtr addTimer(TimeStamp &&stamp, double when, bool repeat, TimerCallback &&cb);
+
+	/* Milliseconds until the next tick with work, for the loops that wait
+	 * with poll or select. */
+	int64_t getTimeout() const;
+
+	size_t getTimerSize();
+
+	/* Refresh the cached time, called by the loop after every wait. */
+	void updateTime();
+
+	/* Microseconds of the monotonic clock. */
+	static int64_t monotonicNow();
+
+	const static int32_t kWheelBits = 6;
+	const static int32_t kWheelSize = 1 << kWheelBits;
+	const static int32_t kWheelMask = kWheelSize - 1;
+	const static int32_t kWheelLevels = 5;
+
+private:
+	TimerQueue(const TimerQueue &);
+
+	void operator=(const TimerQueue &);
+
+	/* The slot past the wheel holds the timers being run. */
+	const static int32_t kRunningSlot = kWheelLevels * kWheelSize;
+
+	EventLoop *loop;
+	int32_t timerfd;
+#ifdef __linux__
+	Channel timerfdChannel;
+#endif
+
+	void cancelInloop(const TimerPtr &timer);
+
+	void addTimerInLoop(const TimerPtr &timer);
+
+	void link(Timer *timer, int32_t slot);
+
+	void unlink(Timer *timer);
+
+	/* Link 'timer' into the slot for its deadline, returns the tick the
+	 * wheel has to wake up at for it. */
+	int64_t place(Timer *timer);
+
+	void cascade();
+
+	int64_t nextTick() const;
+
+	/* Run every timer due at or before 'tick'. */
+	void expire(int64_t tick);
+
+	void arm(int64_t tick);
+
+	Timer *slots[kRunningSlot + 1];
+	uint64_t bitmap[kWheelLevels];
+	int64_t current;	/* The next tick to run, ticks before it are done */
+	int64_t armed;		/* The tick the timerfd is set for, INT64_MAX if none */
+	int64_t now;		/* Cached monotonicNow() */
+	size_t count;
+};
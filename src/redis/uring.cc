@@ -0,0 +1,539 @@
+#include "uring.h"
+
+#ifdef HAVE_IO_URING
+#include "channel.h"
+#include "eventloop.h"
+#include "socket.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+static int32_t uringSetup(uint32_t entries, struct io_uring_params *params) {
+    return ::syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int32_t uringEnter(int32_t fd, uint32_t submit, uint32_t wait, uint32_t flags, void *arg, size_t size) {
+    return ::syscall(__NR_io_uring_enter, fd, submit, wait, flags, arg, size);
+}
+
+static int32_t uringRegister(int32_t fd, uint32_t opcode, void *arg, uint32_t count) {
+    return ::syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+bool Uring::isSupported() {
+    static const bool supported = []() {
+        /* There is no feature bit for multishot receive, it came with the
+         * release that added IORING_SETUP_SINGLE_ISSUER. */
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_SINGLE_ISSUER;
+        int32_t fd = uringSetup(2, &params);
+        if (fd < 0) {
+            return false;
+        }
+
+        const uint32_t features = IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG | IORING_FEAT_FAST_POLL;
+        bool ok = (params.features & features) == features;
+        if (ok) {
+            size_t size = sysconf(_SC_PAGESIZE);
+            void *ring = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            struct io_uring_buf_reg reg;
+            memset(&reg, 0, sizeof(reg));
+            reg.ring_addr = (uint64_t) ring;
+            reg.ring_entries = 1;
+            reg.bgid = kBufferGroup;
+            ok = ring != MAP_FAILED && uringRegister(fd, IORING_REGISTER_PBUF_RING, &reg, 1) == 0;
+            if (ring != MAP_FAILED) {
+                ::munmap(ring, size);
+            }
+        }
+        ::close(fd);
+        return ok;
+    }();
+    return supported;
+}
+
+Uring::Uring(EventLoop *loop)
+        : loop(loop),
+          sqLocalTail(0),
+          bufTail(0) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = kCqEntries;
+    ringFd = uringSetup(kEntries, &params);
+    assert(ringFd >= 0);
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+    }
+
+    sqRing = ::mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    assert(sqRing != MAP_FAILED);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        cqRing = sqRing;
+    } else {
+        cqRing = ::mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        assert(cqRing != MAP_FAILED);
+    }
+
+    sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = (struct io_uring_sqe *) ::mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE,
+                                          MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    assert(sqes != MAP_FAILED);
+
+    char *sq = (char *) sqRing;
+    sqHead = (uint32_t *) (sq + params.sq_off.head);
+    sqTail = (uint32_t *) (sq + params.sq_off.tail);
+    sqMask = *(uint32_t *) (sq + params.sq_off.ring_mask);
+    sqEntries = params.sq_entries;
+    sqLocalTail = *sqTail;
+
+    /* Submission entries are used in ring order, the index array never
+     * changes. */
+    uint32_t *array = (uint32_t *) (sq + params.sq_off.array);
+    for (uint32_t i = 0; i < sqEntries; i++) {
+        array[i] = i;
+    }
+
+    char *cq = (char *) cqRing;
+    cqHead = (uint32_t *) (cq + params.cq_off.head);
+    cqTail = (uint32_t *) (cq + params.cq_off.tail);
+    cqMask = *(uint32_t *) (cq + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    /* The buffers multishot receives fill, handed back to the kernel once
+     * the receive callback returns. */
+    bufRingSize = kBufferCount * sizeof(struct io_uring_buf);
+    bufRing = (struct io_uring_buf_ring *) ::mmap(nullptr, bufRingSize, PROT_READ | PROT_WRITE,
+                                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(bufRing != MAP_FAILED);
+    buffers = (char *) ::mmap(nullptr, size_t(kBufferCount) * kBufferSize, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(buffers != MAP_FAILED);
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t) bufRing;
+    reg.ring_entries = kBufferCount;
+    reg.bgid = kBufferGroup;
+    int32_t ret = uringRegister(ringFd, IORING_REGISTER_PBUF_RING, &reg, 1);
+    (void) ret;
+    assert(ret == 0);
+
+    for (uint32_t i = 0; i < kBufferCount; i++) {
+        recycleBuffer(i);
+    }
+}
+
+Uring::~Uring() {
+    ::munmap(sqes, sqesSize);
+    if (cqRing != sqRing) {
+        ::munmap(cqRing, cqRingSize);
+    }
+    ::munmap(sqRing, sqRingSize);
+    Socket::close(ringFd);
+    ::munmap(buffers, size_t(kBufferCount) * kBufferSize);
+    ::munmap(bufRing, bufRingSize);
+}
+
+struct io_uring_sqe *Uring::getSqe() {
+    if (sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) {
+        submit();
+    }
+
+    assert(sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) < sqEntries);
+    struct io_uring_sqe *sqe = &sqes[sqLocalTail & sqMask];
+    sqLocalTail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+void Uring::submit() {
+    __atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+    uint32_t pending = sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    while (pending > 0) {
+        int32_t ret = uringEnter(ringFd, pending, 0, 0, nullptr, 0);
+        if (ret < 0 && errno != EINTR) {
+            LOG_WARN << "io_uring_enter " << errno;
+            break;
+        }
+        pending = sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    }
+}
+
+void Uring::epollWait(ChannelList *activeChannels, int32_t msTime) {
+    for (size_t i = 0; i < dirtySlots.size(); i++) {
+        arm(dirtySlots[i]);
+    }
+    dirtySlots.clear();
+
+    for (size_t i = 0; i < sendSlots.size(); i++) {
+        startSend(sendSlots[i]);
+    }
+    sendSlots.clear();
+
+    __atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+    uint32_t pending = sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    bool ready = *cqHead != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+
+    /* Completions left from a full ring are taken without entering. */
+    if (pending > 0 || !ready) {
+        struct __kernel_timespec ts;
+        ts.tv_sec = msTime / 1000;
+        ts.tv_nsec = (msTime % 1000) * 1000000LL;
+        struct io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (uint64_t) &ts;
+
+        int32_t ret = uringEnter(ringFd, pending, ready ? 0 : 1,
+                                 IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+        if (ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY) {
+            LOG_WARN << "io_uring_enter " << errno;
+        }
+    }
+
+    uint32_t head = *cqHead;
+    uint32_t tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        reap(&cqes[head & cqMask], activeChannels);
+    }
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+}
+
+Uring::Slot *Uring::getSlot(uint64_t userData) {
+    uint32_t id = uint32_t(userData >> 4) & 0xfffffff;
+    if (id >= slots.size() || slots[id]->generation != uint32_t(userData >> 32)) {
+        return nullptr;
+    }
+    return slots[id].get();
+}
+
+void Uring::reap(const struct io_uring_cqe *cqe, ChannelList *activeChannels) {
+    /* Cancellations carry no user data, their target completes too. */
+    if (cqe->user_data == 0) {
+        return;
+    }
+
+    int32_t op = cqe->user_data & 15;
+    uint32_t id = uint32_t(cqe->user_data >> 4) & 0xfffffff;
+    Slot *slot = getSlot(cqe->user_data);
+    if (slot == nullptr) {
+        completions.push_back({cqe->user_data, cqe->res, cqe->flags});
+        return;
+    }
+
+    bool done = !(cqe->flags & IORING_CQE_F_MORE);
+    if (done) {
+        slot->armed &= ~op;
+        slot->cancelling &= ~op;
+    }
+
+    if (op == kOpPoll) {
+        if (cqe->res >= 0 || cqe->res == -ECANCELED) {
+            markDirty(id);
+        } else {
+            LOG_WARN << "io_uring poll " << -cqe->res;
+        }
+
+        /* A poll asked to stop can still complete, it only counts for the
+         * events the channel still wants. */
+        if (slot->channel != nullptr && cqe->res > 0) {
+            int32_t revents = cqe->res & (slot->channel->getEvents() | POLLERR | POLLHUP | POLLNVAL);
+            if (revents != 0) {
+                slot->channel->setRevents(revents);
+                activeChannels->push_back(slot->channel);
+            }
+        }
+    } else if (op == kOpSend) {
+        if (cqe->res > 0) {
+            slot->sending.retrieveWritten(cqe->res);
+        } else {
+            slot->sending.retrieveAll();
+        }
+
+        if (slot->channel != nullptr) {
+            if (isSending(slot->channel)) {
+                if (cqe->res > 0) {
+                    queueSend(slot->channel, slot->output);
+                }
+            } else {
+                completions.push_back({cqe->user_data, cqe->res, cqe->flags});
+            }
+        }
+    } else {
+        if (done) {
+            markDirty(id);
+        }
+        completions.push_back({cqe->user_data, cqe->res, cqe->flags});
+    }
+
+    if (slot->channel == nullptr && slot->armed == 0) {
+        freeSlot(id);
+    }
+}
+
+void Uring::handleCompletions() {
+    for (size_t i = 0; i < completions.size(); i++) {
+        const Completion &completion = completions[i];
+        Slot *slot = getSlot(completion.userData);
+        Channel *channel = slot != nullptr ? slot->channel : nullptr;
+        int32_t op = completion.userData & 15;
+
+        if (op == kOpRecv) {
+            const char *data = nullptr;
+            uint16_t bid = completion.flags >> IORING_CQE_BUFFER_SHIFT;
+            if (completion.flags & IORING_CQE_F_BUFFER) {
+                data = buffers + size_t(bid) * kBufferSize;
+            }
+
+            /* Out of buffers only stops the receive, it is armed again
+             * with the next wait. */
+            if (channel != nullptr && completion.res != -ENOBUFS && completion.res != -ECANCELED) {
+                channel->handleRecv(data, completion.res);
+            }
+
+            if (data != nullptr) {
+                recycleBuffer(bid);
+            }
+        } else if (op == kOpAccept) {
+            if (completion.res >= 0) {
+                if (channel != nullptr) {
+                    channel->handleAccept(completion.res);
+                } else {
+                    Socket::close(completion.res);
+                }
+            }
+        } else if (op == kOpSend) {
+            if (channel != nullptr && !isSending(channel)) {
+                channel->handleSendComplete();
+            }
+        }
+    }
+    completions.clear();
+}
+
+bool Uring::hasChannel(Channel *channel) {
+    loop->assertInLoopThread();
+    int32_t id = channel->getIndex();
+    return id >= 0 && size_t(id) < slots.size() && slots[id]->channel == channel;
+}
+
+void Uring::updateChannel(Channel *channel) {
+    loop->assertInLoopThread();
+    int32_t id = channel->getIndex();
+    if (id < 0) {
+        if (freeSlots.empty()) {
+            id = slots.size();
+            slots.emplace_back(new Slot());
+            slots[id]->generation = 0;
+        } else {
+            id = freeSlots.back();
+            freeSlots.pop_back();
+        }
+
+        Slot &slot = *slots[id];
+        slot.channel = channel;
+        slot.armed = 0;
+        slot.cancelling = 0;
+        slot.pollEvents = 0;
+        slot.dirty = false;
+        slot.sendQueued = false;
+        slot.output = nullptr;
+        channel->setIndex(id);
+    } else {
+        assert(hasChannel(channel));
+    }
+    markDirty(id);
+}
+
+void Uring::removeChannel(Channel *channel) {
+    loop->assertInLoopThread();
+    assert(hasChannel(channel));
+    assert(channel->isNoneEvent());
+    int32_t id = channel->getIndex();
+    Slot &slot = *slots[id];
+    slot.channel = nullptr;
+    slot.output = nullptr;
+    channel->setIndex(-1);
+
+    if (slot.armed == 0) {
+        freeSlot(id);
+    } else {
+        markDirty(id);
+    }
+}
+
+void Uring::queueSend(Channel *channel, Buffer *buffer) {
+    assert(hasChannel(channel));
+    Slot &slot = *slots[channel->getIndex()];
+    slot.output = buffer;
+    if (!slot.sendQueued) {
+        slot.sendQueued = true;
+        sendSlots.push_back(channel->getIndex());
+    }
+}
+
+bool Uring::isSending(Channel *channel) {
+    int32_t id = channel->getIndex();
+    if (id < 0 || size_t(id) >= slots.size() || slots[id]->channel != channel) {
+        return false;
+    }
+
+    Slot &slot = *slots[id];
+    return (slot.armed & kOpSend) ||
+           slot.sending.readableBytes() > 0 || slot.sending.hasRefs() ||
+           (slot.output != nullptr && (slot.output->readableBytes() > 0 || slot.output->hasRefs()));
+}
+
+void Uring::markDirty(uint32_t id) {
+    Slot &slot = *slots[id];
+    if (!slot.dirty) {
+        slot.dirty = true;
+        dirtySlots.push_back(id);
+    }
+}
+
+void Uring::arm(uint32_t id) {
+    Slot &slot = *slots[id];
+    slot.dirty = false;
+
+    /* Reading goes to the multishot receive or accept when the channel has
+     * a callback for it, whatever is left to the poll. Sends are started by
+     * startSend() and only stopped with the channel. */
+    int32_t want = 0;
+    int32_t pollEvents = 0;
+    if (slot.channel != nullptr) {
+        pollEvents = slot.channel->getEvents();
+        if (pollEvents & POLLIN) {
+            if (slot.channel->hasRecvCallback()) {
+                want |= kOpRecv;
+                pollEvents &= ~(POLLIN | POLLPRI);
+            } else if (slot.channel->hasAcceptCallback()) {
+                want |= kOpAccept;
+                pollEvents &= ~(POLLIN | POLLPRI);
+            }
+        }
+
+        if (pollEvents != 0) {
+            want |= kOpPoll;
+        }
+        want |= kOpSend;
+    }
+
+    /* A poll for other events is stopped, the next one is armed once it
+     * completed. */
+    int32_t active = slot.armed & ~slot.cancelling;
+    int32_t stop = active & ~want;
+    if ((active & kOpPoll) && (want & kOpPoll) && slot.pollEvents != pollEvents) {
+        stop |= kOpPoll;
+    }
+
+    for (int32_t op = kOpPoll; op <= kOpSend; op <<= 1) {
+        if (stop & op) {
+            cancel(id, op);
+        }
+    }
+    slot.cancelling |= stop;
+
+    int32_t start = want & ~slot.armed & ~kOpSend;
+    int32_t fd = slot.channel != nullptr ? slot.channel->getfd() : -1;
+    if (start & kOpPoll) {
+        struct io_uring_sqe *sqe = getSqe();
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fd;
+        sqe->poll32_events = pollEvents;
+        sqe->user_data = userData(id, slot.generation, kOpPoll);
+        slot.pollEvents = pollEvents;
+    }
+
+    if (start & kOpRecv) {
+        struct io_uring_sqe *sqe = getSqe();
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = fd;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = kBufferGroup;
+        sqe->user_data = userData(id, slot.generation, kOpRecv);
+    }
+
+    if (start & kOpAccept) {
+        struct io_uring_sqe *sqe = getSqe();
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = fd;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+        sqe->user_data = userData(id, slot.generation, kOpAccept);
+    }
+    slot.armed |= start;
+}
+
+void Uring::cancel(uint32_t id, int32_t op) {
+    struct io_uring_sqe *sqe = getSqe();
+    sqe->opcode = op == kOpPoll ? IORING_OP_POLL_REMOVE : IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = userData(id, slots[id]->generation, op);
+    sqe->user_data = 0;
+}
+
+void Uring::startSend(uint32_t id) {
+    Slot &slot = *slots[id];
+    slot.sendQueued = false;
+    if (slot.channel == nullptr || slot.output == nullptr || (slot.armed & kOpSend)) {
+        return;
+    }
+
+    /* The output buffer is taken whole when nothing is left of the last
+     * send, the connection goes on with the emptied buffer. */
+    if (slot.output->readableBytes() > 0 || slot.output->hasRefs()) {
+        if (slot.sending.readableBytes() == 0 && !slot.sending.hasRefs()) {
+            slot.sending.swap(*slot.output);
+        } else {
+            slot.sending.appendBuffer(slot.output);
+        }
+    }
+
+    if (slot.sending.readableBytes() == 0 && !slot.sending.hasRefs()) {
+        return;
+    }
+
+    memset(&slot.msg, 0, sizeof(slot.msg));
+    slot.msg.msg_iov = slot.iov;
+    slot.msg.msg_iovlen = slot.sending.fillIovec(slot.iov, kMaxIovec);
+
+    struct io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = slot.channel->getfd();
+    sqe->addr = (uint64_t) &slot.msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = userData(id, slot.generation, kOpSend);
+    slot.armed |= kOpSend;
+}
+
+void Uring::freeSlot(uint32_t id) {
+    Slot &slot = *slots[id];
+    slot.generation++;
+    slot.dirty = false;
+    slot.sendQueued = false;
+    slot.output = nullptr;
+    slot.sending.retrieveAll();
+    freeSlots.push_back(id);
+}
+
+void Uring::recycleBuffer(uint16_t bid) {
+    /* The entries start at the ring itself, the tail overlays a reserved
+     * field of the first one. Not through 'bufs', which C++ places after an
+     * empty struct of one byte. */
+    struct io_uring_buf *buf = (struct io_uring_buf *) bufRing + (bufTail & (kBufferCount - 1));
+    buf->addr = (uint64_t) (buffers + size_t(bid) * kBufferSize);
+    buf->len = kBufferSize;
+    buf->bid = bid;
+    bufTail++;
+    __atomic_store_n(&bufRing->tail, bufTail, __ATOMIC_RELEASE);
+}
+#endif
@@ -0,0 +1,159 @@
+#pragma once
+
+#include "all.h"
+
+#ifdef HAVE_IO_URING
+#include "buffer.h"
+#include "log.h"
+
+class Channel;
+
+class EventLoop;
+
+/* io_uring backend of the loop, an alternative to Epoll behind the same
+ * interface. A loop iteration costs a single io_uring_enter(), which
+ * submits everything the iteration queued and waits for completions.
+ *
+ * Channels with a receive callback get a multishot receive, filled from a
+ * ring of buffers provided to the kernel, and channels with an accept
+ * callback a multishot accept, so neither needs a request per event. Sends
+ * are queued with queueSend() and go out together before the wait. Every
+ * other channel, the wakeup eventfd and the timerfd included, is watched
+ * with a oneshot poll armed again after each completion, which behaves as
+ * the level triggered epoll does.
+ *
+ * Requests are prepared at the wait from the state of the channels, so a
+ * channel updated several times in an iteration costs one request, and a
+ * channel removed before the wait costs none. A removed channel keeps its
+ * slot until the kernel is done with every request it had. */
+class Uring {
+public:
+    typedef std::vector<Channel *> ChannelList;
+
+    Uring(EventLoop *loop);
+
+    ~Uring();
+
+    /* Whether the kernel has what the backend needs: multishot receive,
+     * provided buffer rings and waiting with a timeout. */
+    static bool isSupported();
+
+    /* Submit and wait for completions. Channels ready for a polled event go
+     * to 'activeChannels' as with Epoll, the other completions are kept for
+     * handleCompletions(). */
+    void epollWait(ChannelList *activeChannels, int32_t msTime = 100);
+
+    /* Run the callbacks of the receive, accept and send completions of the
+     * last wait. */
+    void handleCompletions();
+
+    bool hasChannel(Channel *channel);
+
+    void updateChannel(Channel *channel);
+
+    void removeChannel(Channel *channel);
+
+    /* Send what is in 'buffer' with the next submission. 'buffer' is where
+     * the channel appends its output until it is removed. */
+    void queueSend(Channel *channel, Buffer *buffer);
+
+    /* Whether output queued with queueSend() is not all sent yet. */
+    bool isSending(Channel *channel);
+
+private:
+    Uring(const Uring &);
+
+    void operator=(const Uring &);
+
+    enum {
+        kOpPoll = 1,
+        kOpRecv = 2,
+        kOpAccept = 4,
+        kOpSend = 8
+    };
+
+    const static uint32_t kEntries = 256;
+    const static uint32_t kCqEntries = 4096;
+    const static uint32_t kBufferCount = 256;
+    const static uint32_t kBufferSize = 16384;
+    const static uint16_t kBufferGroup = 0;
+    const static int32_t kMaxIovec = 64;
+
+    struct Slot {
+        Channel *channel;   /* nullptr once removed */
+        uint32_t generation;
+        int32_t armed;      /* Requests in the kernel */
+        int32_t cancelling; /* Of those, the ones asked to stop */
+        int32_t pollEvents; /* Events of the armed poll */
+        bool dirty;
+        bool sendQueued;
+        Buffer *output;
+        Buffer sending;     /* What the kernel sends from */
+        IOV_TYPE iov[kMaxIovec];
+        struct msghdr msg;
+    };
+
+    struct Completion {
+        uint64_t userData;
+        int32_t res;
+        uint32_t flags;
+    };
+
+    static uint64_t userData(uint32_t id, uint32_t generation, int32_t op) {
+        return uint64_t(generation) << 32 | uint64_t(id) << 4 | op;
+    }
+
+    /* The slot a completion is for, nullptr if the slot went to another
+     * channel since. */
+    Slot *getSlot(uint64_t userData);
+
+    struct io_uring_sqe *getSqe();
+
+    void submit();
+
+    void markDirty(uint32_t id);
+
+    /* Bring the requests of a slot in line with the events of its channel. */
+    void arm(uint32_t id);
+
+    void cancel(uint32_t id, int32_t op);
+
+    void startSend(uint32_t id);
+
+    void reap(const struct io_uring_cqe *cqe, ChannelList *activeChannels);
+
+    void freeSlot(uint32_t id);
+
+    void recycleBuffer(uint16_t bid);
+
+    EventLoop *loop;
+    int32_t ringFd;
+
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;
+    size_t cqRingSize;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+    uint32_t *sqHead;
+    uint32_t *sqTail;
+    uint32_t sqMask;
+    uint32_t sqEntries;
+    uint32_t sqLocalTail;
+    uint32_t *cqHead;
+    uint32_t *cqTail;
+    uint32_t cqMask;
+    struct io_uring_cqe *cqes;
+
+    struct io_uring_buf_ring *bufRing;
+    size_t bufRingSize;
+    char *buffers;
+    uint16_t bufTail;
+
+    std::vector <std::unique_ptr<Slot>> slots;
+    std::vector <uint32_t> freeSlots;
+    std::vector <uint32_t> dirtySlots;
+    std::vector <uint32_t> sendSlots;
+    std::vector <Completion> completions;
+};
+#endif
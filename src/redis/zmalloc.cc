@@ -349,24 +349,29 @@ void setproctitle(const char *fmt, ...);
 #define REDIS_ATOMIC_API "pthread-mutex"
 #endif
 
-#define update_zmalloc_stat_alloc(__n) do { \
-    size_t _n = (__n); \
-    if (_n&(sizeof(long)-1)) _n += sizeof(long)-(_n&(sizeof(long)-1)); \
-    atomicIncr(used_memory,__n); \
-} while(0)
+#define update_zmalloc_stat_alloc(__n) \
+    thread_used_memory().fetch_add((__n), std::memory_order_relaxed)
 
-#define update_zmalloc_stat_free(__n) do { \
-    size_t _n = (__n); \
-    if (_n&(sizeof(long)-1)) _n += sizeof(long)-(_n&(sizeof(long)-1)); \
-    atomicDecr(used_memory,__n); \
-} while(0)
+#define update_zmalloc_stat_free(__n) \
+    thread_used_memory().fetch_sub((__n), std::memory_order_relaxed)
 
-static size_t used_memory = 0;
-#ifdef _WIN64
-std::mutex mutex;
-#else
-pthread_mutex_t used_memory_mutex = PTHREAD_MUTEX_INITIALIZER;
-#endif
+/* Used memory is counted per thread, in slots of a cache line each, so the
+ * loops allocating at the same time do not all hit one counter. A block
+ * freed by another thread than the one allocating it leaves a slot high and
+ * another one low, only the sum means something. */
+#define ZMALLOC_THREAD_SLOTS 32
+
+struct alignas(64) UsedMemorySlot {
+    std::atomic <size_t> bytes;
+};
+
+static UsedMemorySlot used_memory[ZMALLOC_THREAD_SLOTS];
+static std::atomic <uint32_t> used_memory_next_slot(0);
+
+static inline std::atomic <size_t> &thread_used_memory() {
+    static thread_local uint32_t slot = used_memory_next_slot++ % ZMALLOC_THREAD_SLOTS;
+    return used_memory[slot].bytes;
+}
 
 static void zmalloc_default_oom(size_t size) {
     fprintf(stderr, "zmalloc: Out of memory trying to allocate %zu bytes\n",
@@ -501,11 +506,40 @@ char *zstrdup(const char *s) {
 }
 
 size_t zmalloc_used_memory(void) {
-    size_t um;
-    atomicGet(used_memory, um);
+    size_t um = 0;
+    for (int j = 0; j < ZMALLOC_THREAD_SLOTS; j++) {
+        um += used_memory[j].bytes.load(std::memory_order_relaxed);
+    }
     return um;
 }
 
+/* The keyspace tables, the objects and the containers of the collections
+ * are allocated with new, route it through zmalloc as well so used_memory
+ * covers the whole data set and maxmemory can be enforced on it. */
+void *operator new(size_t size) {
+    return zmalloc(size);
+}
+
+void *operator new[](size_t size) {
+    return zmalloc(size);
+}
+
+void operator delete(void *ptr) noexcept {
+    zfree(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+    zfree(ptr);
+}
+
+void operator delete(void *ptr, size_t size) noexcept {
+    zfree(ptr);
+}
+
+void operator delete[](void *ptr, size_t size) noexcept {
+    zfree(ptr);
+}
+
 void zmalloc_set_oom_handler(void(*oom_handler)(size_t)) {
     zmalloc_oom_handler = oom_handler;
 }
@@ -0,0 +1,607 @@
+#include "zset.h"
+#include "object.h"
+#include "util.h"
+#include "zmalloc.h"
+
+#define ZSKIPLIST_P 0.25 /* Skiplist P = 1/4 */
+
+ZSkiplist::ZSkiplist()
+        : tail(nullptr),
+          length(0),
+          level(1) {
+    header = createNode(kMaxLevel, 0, nullptr);
+    for (int32_t i = 0; i < kMaxLevel; i++) {
+        header->level[i].forward = nullptr;
+        header->level[i].span = 0;
+    }
+    header->backward = nullptr;
+}
+
+ZSkiplist::~ZSkiplist() {
+    Node *node = header->level[0].forward;
+    while (node) {
+        Node *next = node->level[0].forward;
+        sdsfree(node->ele);
+        zfree(node);
+        node = next;
+    }
+    zfree(header);
+}
+
+ZSkiplist::Node *ZSkiplist::createNode(int32_t level, double score, sds ele) {
+    Node *node = (Node *) zmalloc(sizeof(Node) + level * sizeof(Node::Level));
+    node->score = score;
+    node->ele = ele;
+    return node;
+}
+
+/* Returns a level between 1 and kMaxLevel, higher levels are less likely
+ * with a power law distribution. */
+int32_t ZSkiplist::randomLevel() {
+    int32_t level = 1;
+    while ((rand() & 0xFFFF) < (ZSKIPLIST_P * 0xFFFF)) {
+        level++;
+    }
+    return level < kMaxLevel ? level : kMaxLevel;
+}
+
+/* Orders 'node' against the element 'score', 'ele'. */
+int32_t ZSkiplist::compare(const Node *node, double score, const char *ele, size_t len) {
+    if (node->score != score) {
+        return node->score < score ? -1 : 1;
+    }
+
+    size_t nodelen = sdslen(node->ele);
+    int32_t cmp = memcmp(node->ele, ele, std::min(nodelen, len));
+    if (cmp != 0) {
+        return cmp;
+    }
+    return nodelen < len ? -1 : nodelen > len ? 1 : 0;
+}
+
+ZSkiplist::Node *ZSkiplist::insert(double score, sds ele) {
+    Node *update[kMaxLevel];
+    uint64_t rank[kMaxLevel];
+    size_t len = sdslen(ele);
+
+    Node *x = header;
+    for (int32_t i = level - 1; i >= 0; i--) {
+        /* Store the rank that is crossed to reach the insert position */
+        rank[i] = i == (level - 1) ? 0 : rank[i + 1];
+        while (x->level[i].forward && compare(x->level[i].forward, score, ele, len) < 0) {
+            rank[i] += x->level[i].span;
+            x = x->level[i].forward;
+        }
+        update[i] = x;
+    }
+
+    int32_t lvl = randomLevel();
+    if (lvl > level) {
+        for (int32_t i = level; i < lvl; i++) {
+            rank[i] = 0;
+            update[i] = header;
+            update[i]->level[i].span = length;
+        }
+        level = lvl;
+    }
+
+    x = createNode(lvl, score, ele);
+    for (int32_t i = 0; i < lvl; i++) {
+        x->level[i].forward = update[i]->level[i].forward;
+        update[i]->level[i].forward = x;
+
+        /* Update the span covered by update[i] as x is inserted here */
+        x->level[i].span = update[i]->level[i].span - (rank[0] - rank[i]);
+        update[i]->level[i].span = (rank[0] - rank[i]) + 1;
+    }
+
+    /* Increment the span for untouched levels */
+    for (int32_t i = lvl; i < level; i++) {
+        update[i]->level[i].span++;
+    }
+
+    x->backward = (update[0] == header) ? nullptr : update[0];
+    if (x->level[0].forward) {
+        x->level[0].forward->backward = x;
+    } else {
+        tail = x;
+    }
+    length++;
+    return x;
+}
+
+void ZSkiplist::deleteNode(Node *x, Node **update) {
+    for (int32_t i = 0; i < level; i++) {
+        if (update[i]->level[i].forward == x) {
+            update[i]->level[i].span += x->level[i].span - 1;
+            update[i]->level[i].forward = x->level[i].forward;
+        } else {
+            update[i]->level[i].span -= 1;
+        }
+    }
+
+    if (x->level[0].forward) {
+        x->level[0].forward->backward = x->backward;
+    } else {
+        tail = x->backward;
+    }
+
+    while (level > 1 && header->level[level - 1].forward == nullptr) {
+        level--;
+    }
+    length--;
+}
+
+bool ZSkiplist::remove(double score, const char *ele, size_t len) {
+    Node *update[kMaxLevel];
+    Node *x = header;
+    for (int32_t i = level - 1; i >= 0; i--) {
+        while (x->level[i].forward && compare(x->level[i].forward, score, ele, len) < 0) {
+            x = x->level[i].forward;
+        }
+        update[i] = x;
+    }
+
+    /* We may have multiple elements with the same score, what we need
+     * is to find the element with both the right score and object. */
+    x = x->level[0].forward;
+    if (x && compare(x, score, ele, len) == 0) {
+        deleteNode(x, update);
+        sdsfree(x->ele);
+        zfree(x);
+        return true;
+    }
+    return false;
+}
+
+ZSkiplist::Node *ZSkiplist::updateScore(double score, const char *ele, size_t len, double newscore) {
+    Node *update[kMaxLevel];
+    Node *x = header;
+    for (int32_t i = level - 1; i >= 0; i--) {
+        while (x->level[i].forward && compare(x->level[i].forward, score, ele, len) < 0) {
+            x = x->level[i].forward;
+        }
+        update[i] = x;
+    }
+
+    x = x->level[0].forward;
+    assert(x && compare(x, score, ele, len) == 0);
+
+    /* If the node stays in place, just change the score. */
+    if ((x->backward == nullptr || x->backward->score < newscore) &&
+        (x->level[0].forward == nullptr || x->level[0].forward->score > newscore)) {
+        x->score = newscore;
+        return x;
+    }
+
+    /* Otherwise remove and insert it again, the new node takes over the
+     * member so that references to it stay valid. */
+    deleteNode(x, update);
+    Node *node = insert(newscore, x->ele);
+    zfree(x);
+    return node;
+}
+
+uint64_t ZSkiplist::getRank(double score, const char *ele, size_t len) const {
+    uint64_t rank = 0;
+    Node *x = header;
+    for (int32_t i = level - 1; i >= 0; i--) {
+        while (x->level[i].forward && compare(x->level[i].forward, score, ele, len) <= 0) {
+            rank += x->level[i].span;
+            x = x->level[i].forward;
+        }
+
+        /* x might be equal to header, so test if it is the element */
+        if (x != header && compare(x, score, ele, len) == 0) {
+            return rank;
+        }
+    }
+    return 0;
+}
+
+ZSkiplist::Node *ZSkiplist::getByRank(uint64_t rank) const {
+    uint64_t traversed = 0;
+    Node *x = header;
+    for (int32_t i = level - 1; i >= 0; i--) {
+        while (x->level[i].forward && (traversed + x->level[i].span) <= rank) {
+            traversed += x->level[i].span;
+            x = x->level[i].forward;
+        }
+
+        if (traversed == rank) {
+            return x == header ? nullptr : x;
+        }
+    }
+    return nullptr;
+}
+
+ZSkiplist::Node *ZSkiplist::firstInRange(const ZRangeSpec &range) const {
+    if (range.isEmpty() || tail == nullptr || !range.gteMin(tail->score) ||
+        !range.lteMax(header->level[0].forward->score)) {
+        return nullptr;
+    }
+
+    Node *x = header;
+    for (int32_t i = level - 1; i >= 0; i--) {
+        /* Go forward while *OUT* of range. */
+        while (x->level[i].forward && !range.gteMin(x->level[i].forward->score)) {
+            x = x->level[i].forward;
+        }
+    }
+
+    /* This is an inner range, so the next node cannot be nullptr. */
+    x = x->level[0].forward;
+    return range.lteMax(x->score) ? x : nullptr;
+}
+
+ZSkiplist::Node *ZSkiplist::lastInRange(const ZRangeSpec &range) const {
+    if (range.isEmpty() || tail == nullptr || !range.gteMin(tail->score) ||
+        !range.lteMax(header->level[0].forward->score)) {
+        return nullptr;
+    }
+
+    Node *x = header;
+    for (int32_t i = level - 1; i >= 0; i--) {
+        /* Go forward while *IN* range. */
+        while (x->level[i].forward && range.lteMax(x->level[i].forward->score)) {
+            x = x->level[i].forward;
+        }
+    }
+
+    /* This is an inner range, so this node cannot be nullptr. */
+    return range.gteMin(x->score) ? x : nullptr;
+}
+
+size_t Zset::StringViewHash::operator()(const std::string_view &s) const {
+    return dictGenHashFunction(s.data(), s.size());
+}
+
+Zset::Zset()
+        : zsl(nullptr),
+          dict(nullptr) {
+
+}
+
+Zset::~Zset() {
+    delete dict;
+    delete zsl;
+}
+
+size_t Zset::size() const {
+    return zsl ? zsl->size() : lp.size() / 2;
+}
+
+void Zset::swap(Zset &rhs) {
+    lp.swap(rhs.lp);
+    std::swap(zsl, rhs.zsl);
+    std::swap(dict, rhs.dict);
+}
+
+double Zset::getListpackScore(const unsigned char *p) {
+    Listpack::Entry entry = Listpack::get(p);
+    if (entry.sval == nullptr) {
+        return double(entry.lval);
+    }
+
+    char buf[128];
+    size_t len = std::min<size_t>(entry.slen, sizeof(buf) - 1);
+    memcpy(buf, entry.sval, len);
+    buf[len] = '\0';
+    return strtod(buf, nullptr);
+}
+
+/* Scores that are integers go in as integers, which the listpack keeps in
+ * a few bytes. */
+static size_t formatScore(char *buf, size_t size, double score) {
+    if (score == (double) (int64_t) score && std::abs(score) < (double) (1LL << 53)) {
+        return ll2string(buf, size, (int64_t) score);
+    }
+    return snprintf(buf, size, "%.17g", score);
+}
+
+unsigned char *Zset::findListpack(const char *ele, size_t len, double *score) const {
+    for (unsigned char *eptr = lp.first(); eptr != nullptr; eptr = lp.next(lp.next(eptr))) {
+        unsigned char *sptr = lp.next(eptr);
+        if (Listpack::equals(eptr, ele, len)) {
+            *score = getListpackScore(sptr);
+            return eptr;
+        }
+    }
+    return nullptr;
+}
+
+/* Orders the member at 'eptr' against 'ele'. */
+int32_t Zset::compareListpack(const unsigned char *eptr, const char *ele, size_t len) {
+    char buf[Listpack::kIntBufSize];
+    std::string_view member = Listpack::get(eptr).view(buf);
+    int32_t cmp = memcmp(member.data(), ele, std::min(member.size(), len));
+    if (cmp != 0) {
+        return cmp;
+    }
+    return member.size() < len ? -1 : member.size() > len ? 1 : 0;
+}
+
+void Zset::insertListpack(const char *ele, size_t len, double score) {
+    unsigned char *eptr = lp.first();
+    while (eptr != nullptr) {
+        unsigned char *sptr = lp.next(eptr);
+        double s = getListpackScore(sptr);
+        if (s > score || (s == score && compareListpack(eptr, ele, len) > 0)) {
+            break;
+        }
+        eptr = lp.next(sptr);
+    }
+
+    char buf[128];
+    size_t slen = formatScore(buf, sizeof(buf), score);
+    unsigned char *p = lp.insert(eptr, ele, len);
+    lp.insert(lp.next(p), buf, slen);
+}
+
+bool Zset::assignListpack(const unsigned char *buf, size_t len) {
+    delete dict;
+    delete zsl;
+    dict = nullptr;
+    zsl = nullptr;
+    if (!lp.assign(buf, len) || lp.size() % 2 != 0) {
+        lp.clear();
+        return false;
+    }
+
+    if (lp.size() / 2 > REDIS_ZSET_MAX_LISTPACK_ENTRIES) {
+        convert();
+    }
+    return true;
+}
+
+void Zset::convert() {
+    assert(zsl == nullptr);
+    zsl = new ZSkiplist();
+    dict = new ZDict();
+    dict->reserve(lp.size() / 2);
+
+    char buf[Listpack::kIntBufSize];
+    for (unsigned char *eptr = lp.first(); eptr != nullptr; eptr = lp.next(lp.next(eptr))) {
+        std::string_view member = Listpack::get(eptr).view(buf);
+        ZSkiplist::Node *node = zsl->insert(getListpackScore(lp.next(eptr)),
+                                            sdsnewlen(member.data(), member.size()));
+        dict->emplace(std::string_view(node->ele, sdslen(node->ele)), node);
+    }
+    lp.clear();
+}
+
+bool Zset::add(const char *ele, size_t len, double score) {
+    if (zsl == nullptr) {
+        double cur;
+        unsigned char *eptr = findListpack(ele, len, &cur);
+        if (eptr != nullptr) {
+            /* Remove and re-insert when the score changes. */
+            if (cur != score) {
+                lp.erase(eptr, 2);
+                insertListpack(ele, len, score);
+            }
+            return false;
+        }
+
+        if (lp.size() / 2 + 1 <= REDIS_ZSET_MAX_LISTPACK_ENTRIES &&
+            len <= REDIS_ZSET_MAX_LISTPACK_VALUE) {
+            insertListpack(ele, len, score);
+            return true;
+        }
+        convert();
+    }
+
+    auto it = dict->find(std::string_view(ele, len));
+    if (it != dict->end()) {
+        ZSkiplist::Node *node = it->second;
+        if (node->score != score) {
+            /* The member sds moves to the new node, the key stays valid. */
+            it->second = zsl->updateScore(node->score, ele, len, score);
+        }
+        return false;
+    }
+
+    ZSkiplist::Node *node = zsl->insert(score, sdsnewlen(ele, len));
+    dict->emplace(std::string_view(node->ele, sdslen(node->ele)), node);
+    return true;
+}
+
+bool Zset::remove(const char *ele, size_t len) {
+    if (zsl == nullptr) {
+        double score;
+        unsigned char *eptr = findListpack(ele, len, &score);
+        if (eptr == nullptr) {
+            return false;
+        }
+        lp.erase(eptr, 2);
+        return true;
+    }
+
+    auto it = dict->find(std::string_view(ele, len));
+    if (it == dict->end()) {
+        return false;
+    }
+
+    /* The key points into the node, drop it first. */
+    double score = it->second->score;
+    dict->erase(it);
+    bool removed = zsl->remove(score, ele, len);
+    assert(removed);
+    return true;
+}
+
+bool Zset::getScore(const char *ele, size_t len, double *score) const {
+    if (zsl == nullptr) {
+        return findListpack(ele, len, score) != nullptr;
+    }
+
+    auto it = dict->find(std::string_view(ele, len));
+    if (it == dict->end()) {
+        return false;
+    }
+    *score = it->second->score;
+    return true;
+}
+
+int64_t Zset::getRank(const char *ele, size_t len, bool reverse) const {
+    int64_t length = size();
+    if (zsl == nullptr) {
+        int64_t rank = 0;
+        for (unsigned char *eptr = lp.first(); eptr != nullptr; eptr = lp.next(lp.next(eptr))) {
+            if (Listpack::equals(eptr, ele, len)) {
+                return reverse ? length - rank - 1 : rank;
+            }
+            rank++;
+        }
+        return -1;
+    }
+
+    auto it = dict->find(std::string_view(ele, len));
+    if (it == dict->end()) {
+        return -1;
+    }
+
+    int64_t rank = zsl->getRank(it->second->score, ele, len);
+    assert(rank != 0);
+    return reverse ? length - rank : rank - 1;
+}
+
+unsigned char *Zset::prevListpack(unsigned char *eptr) const {
+    /* The score before the member, then the member before it. */
+    unsigned char *sptr = lp.prev(eptr);
+    return sptr == nullptr ? nullptr : lp.prev(sptr);
+}
+
+void Zset::range(int64_t start, int64_t end, bool reverse, const Callback &cb) const {
+    int64_t rangelen = end - start + 1;
+    if (rangelen <= 0) {
+        return;
+    }
+
+    if (zsl == nullptr) {
+        char buf[Listpack::kIntBufSize];
+        unsigned char *eptr = reverse ? lp.seek(-2 - 2 * start) : lp.seek(2 * start);
+        while (rangelen-- > 0 && eptr != nullptr) {
+            unsigned char *sptr = lp.next(eptr);
+            cb(Listpack::get(eptr).view(buf), getListpackScore(sptr));
+            eptr = reverse ? prevListpack(eptr) : lp.next(sptr);
+        }
+        return;
+    }
+
+    /* Check if starting point is trivial, before doing log(N) lookup. */
+    ZSkiplist::Node *ln;
+    if (reverse) {
+        ln = start == 0 ? zsl->last() : zsl->getByRank(zsl->size() - start);
+    } else {
+        ln = start == 0 ? zsl->first() : zsl->getByRank(start + 1);
+    }
+
+    while (rangelen-- > 0 && ln != nullptr) {
+        cb(std::string_view(ln->ele, sdslen(ln->ele)), ln->score);
+        ln = reverse ? ln->backward : ln->level[0].forward;
+    }
+}
+
+uint64_t Zset::scan(uint64_t cursor, size_t count, const Callback &cb) const {
+    if (zsl == nullptr) {
+        forEach(cb);
+        return 0;
+    }
+
+    return scanBuckets(*dict, cursor, count, [&](const ZDict::value_type &it) {
+        cb(it.first, it.second->score);
+    });
+}
+
+void Zset::rangeByScore(const ZRangeSpec &range, bool reverse,
+                        int64_t offset, int64_t limit, const Callback &cb) const {
+    if (zsl == nullptr) {
+        char buf[Listpack::kIntBufSize];
+        unsigned char *eptr = reverse ? lp.seek(-2) : lp.first();
+        while (eptr != nullptr) {
+            unsigned char *sptr = lp.next(eptr);
+            double score = getListpackScore(sptr);
+            if (reverse ? !range.lteMax(score) : !range.gteMin(score)) {
+                /* Not yet in range. */
+            } else if (reverse ? !range.gteMin(score) : !range.lteMax(score)) {
+                break;
+            } else if (offset > 0) {
+                offset--;
+            } else if (limit == 0) {
+                break;
+            } else {
+                cb(Listpack::get(eptr).view(buf), score);
+                if (limit > 0) {
+                    limit--;
+                }
+            }
+            eptr = reverse ? prevListpack(eptr) : lp.next(sptr);
+        }
+        return;
+    }
+
+    ZSkiplist::Node *ln = reverse ? zsl->lastInRange(range) : zsl->firstInRange(range);
+    if (ln != nullptr && offset > 0) {
+        /* Jump over the offset by rank instead of walking it. */
+        int64_t rank = zsl->getRank(ln->score, ln->ele, sdslen(ln->ele));
+        rank = reverse ? rank - offset : rank + offset;
+        ln = rank >= 1 && rank <= int64_t(zsl->size()) ? zsl->getByRank(rank) : nullptr;
+    }
+
+    while (ln != nullptr && limit != 0) {
+        if (reverse ? !range.gteMin(ln->score) : !range.lteMax(ln->score)) {
+            break;
+        }
+
+        cb(std::string_view(ln->ele, sdslen(ln->ele)), ln->score);
+        if (limit > 0) {
+            limit--;
+        }
+        ln = reverse ? ln->backward : ln->level[0].forward;
+    }
+}
+
+size_t Zset::count(const ZRangeSpec &range) const {
+    if (zsl == nullptr) {
+        size_t n = 0;
+        for (unsigned char *eptr = lp.first(); eptr != nullptr; eptr = lp.next(lp.next(eptr))) {
+            double score = getListpackScore(lp.next(eptr));
+            if (!range.gteMin(score)) {
+                continue;
+            }
+            if (!range.lteMax(score)) {
+                break;
+            }
+            n++;
+        }
+        return n;
+    }
+
+    /* The difference of the ranks of both ends. */
+    ZSkiplist::Node *first = zsl->firstInRange(range);
+    if (first == nullptr) {
+        return 0;
+    }
+
+    ZSkiplist::Node *last = zsl->lastInRange(range);
+    return zsl->getRank(last->score, last->ele, sdslen(last->ele)) -
+           zsl->getRank(first->score, first->ele, sdslen(first->ele)) + 1;
+}
+
+/* Parses a score bound, "(" in front makes it exclusive. */
+static bool parseScore(const char *s, double *value, bool *exclusive) {
+    char *eptr;
+    *exclusive = s[0] == '(';
+    if (*exclusive) {
+        s++;
+    }
+
+    *value = strtod(s, &eptr);
+    return eptr[0] == '\0' && eptr != s && !std::isnan(*value);
+}
+
+bool Zset::parseRange(const char *min, const char *max, ZRangeSpec *spec) {
+    return parseScore(min, &spec->min, &spec->minex) &&
+           parseScore(max, &spec->max, &spec->maxex);
+}
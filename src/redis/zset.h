@@ -0,0 +1,168 @@
+#pragma once
+
+#include "all.h"
+#include "listpack.h"
+#include "sds.h"
+
+/* Score interval of ZRANGEBYSCORE and ZCOUNT, 'minex' and 'maxex' tell
+ * whether an end is excluded. */
+struct ZRangeSpec {
+    double min;
+    double max;
+    bool minex;
+    bool maxex;
+
+    bool gteMin(double value) const { return minex ? value > min : value >= min; }
+
+    bool lteMax(double value) const { return maxex ? value < max : value <= max; }
+
+    bool isEmpty() const { return min > max || (min == max && (minex || maxex)); }
+};
+
+/* Order statistic skiplist, every forward link counts the elements it
+ * skips, so the rank of an element and the element at a rank are found in
+ * O(log n) by adding up spans on the way down. Elements are ordered by
+ * score, then by member. */
+class ZSkiplist {
+public:
+    const static int32_t kMaxLevel = 32;
+
+    struct Node {
+        sds ele;
+        double score;
+        Node *backward;
+        struct Level {
+            Node *forward;
+            uint64_t span;
+        } level[];
+    };
+
+    ZSkiplist();
+
+    ~ZSkiplist();
+
+    /* The member must not be in the list yet, the node takes 'ele'. */
+    Node *insert(double score, sds ele);
+
+    /* Unlinks and frees the node, or returns false if there is none. */
+    bool remove(double score, const char *ele, size_t len);
+
+    /* Moves an element to a new score, returns the node holding it. */
+    Node *updateScore(double score, const char *ele, size_t len, double newscore);
+
+    /* 1-based rank, 0 if the element is not there. */
+    uint64_t getRank(double score, const char *ele, size_t len) const;
+
+    /* The node at a 1-based rank. */
+    Node *getByRank(uint64_t rank) const;
+
+    Node *firstInRange(const ZRangeSpec &range) const;
+
+    Node *lastInRange(const ZRangeSpec &range) const;
+
+    Node *first() const { return header->level[0].forward; }
+
+    Node *last() const { return tail; }
+
+    uint64_t size() const { return length; }
+
+private:
+    ZSkiplist(const ZSkiplist &);
+
+    void operator=(const ZSkiplist &);
+
+    static Node *createNode(int32_t level, double score, sds ele);
+
+    static int32_t randomLevel();
+
+    static int32_t compare(const Node *node, double score, const char *ele, size_t len);
+
+    void deleteNode(Node *x, Node **update);
+
+    Node *header;
+    Node *tail;
+    uint64_t length;
+    int32_t level;
+};
+
+/* Sorted set with two encodings. Small sets are a listpack of member and
+ * score pairs kept in order, which costs a few bytes per element. Past
+ * REDIS_ZSET_MAX_LISTPACK_ENTRIES elements, or once a member is longer than
+ * REDIS_ZSET_MAX_LISTPACK_VALUE, the set turns into a skiplist for the
+ * order and a hash table from member to node for lookups. */
+class Zset {
+public:
+    typedef std::function<void(const std::string_view &, double)> Callback;
+
+    Zset();
+
+    ~Zset();
+
+    int32_t getEncoding() const { return zsl ? OBJ_ENCODING_SKIPLIST : OBJ_ENCODING_LISTPACK; }
+
+    size_t size() const;
+
+    void swap(Zset &rhs);
+
+    /* Returns true if the member is new. */
+    bool add(const char *ele, size_t len, double score);
+
+    bool remove(const char *ele, size_t len);
+
+    bool getScore(const char *ele, size_t len, double *score) const;
+
+    /* 0-based rank, -1 if the member is not there. */
+    int64_t getRank(const char *ele, size_t len, bool reverse) const;
+
+    /* Elements with a rank from 'start' to 'end', both valid. */
+    void range(int64_t start, int64_t end, bool reverse, const Callback &cb) const;
+
+    /* Elements in the score range, skipping 'offset' of them and stopping
+     * after 'limit' unless it is negative. */
+    void rangeByScore(const ZRangeSpec &range, bool reverse,
+                      int64_t offset, int64_t limit, const Callback &cb) const;
+
+    size_t count(const ZRangeSpec &range) const;
+
+    /* Every element in order. */
+    void forEach(const Callback &cb) const { range(0, int64_t(size()) - 1, false, cb); }
+
+    /* One step of ZSCAN, see scanBuckets(). A listpack is small enough to
+     * be returned whole, with cursor 0. */
+    uint64_t scan(uint64_t cursor, size_t count, const Callback &cb) const;
+
+    static bool parseRange(const char *min, const char *max, ZRangeSpec *spec);
+
+    /* nullptr unless the set is a listpack. */
+    const Listpack *getListpack() const { return zsl ? nullptr : &lp; }
+
+    /* Load a serialized listpack of member and score pairs in order. */
+    bool assignListpack(const unsigned char *buf, size_t len);
+
+private:
+    Zset(const Zset &);
+
+    void operator=(const Zset &);
+
+    struct StringViewHash {
+        size_t operator()(const std::string_view &s) const;
+    };
+
+    typedef std::unordered_map <std::string_view, ZSkiplist::Node *, StringViewHash> ZDict;
+
+    static double getListpackScore(const unsigned char *p);
+
+    static int32_t compareListpack(const unsigned char *eptr, const char *ele, size_t len);
+
+    unsigned char *findListpack(const char *ele, size_t len, double *score) const;
+
+    void insertListpack(const char *ele, size_t len, double score);
+
+    unsigned char *prevListpack(unsigned char *eptr) const;
+
+    void convert();
+
+    Listpack lp;
+    ZSkiplist *zsl;
+    ZDict *dict;
+};